@@ -39,9 +39,7 @@ struct _auth_mgr
 	unsigned int of_head, of_tail;	/* head and tail of the overflow queue */
 	struct auth_map *auth_mapper; /* table of currently tracked auth sessions */
 	UINT32 auth_mapper_size, overflow_size;
-} auth_mgr;
-
-MUTEX_DECLARE_INIT(auth_mgr_lock);
+};
 
 TSS_RESULT TPM_SaveAuthContext(TPM_AUTHHANDLE, UINT32 *, BYTE **);
 TSS_RESULT TPM_LoadAuthContext(UINT32, BYTE *, TPM_AUTHHANDLE *);
@@ -40,6 +40,8 @@ struct authsess {
 	TPM_NONCE nonceOddxSAP;
 	TPM_NONCE nonceEvenxSAP;
 	TPM_HMAC sharedSecret;
+	/* Key schedule for sharedSecret, derived on its first use by authsess_callback_hmac */
+	Trspi_HmacKey sharedSecretKey;
 
 	//MUTEX_DECLARE(lock);
 	//struct authsess *next;
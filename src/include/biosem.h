@@ -15,6 +15,8 @@ int bios_open(void *, FILE **);
 TSS_RESULT bios_get_entries_by_pcr(FILE *, UINT32, UINT32, UINT32 *, TSS_PCR_EVENT **);
 TSS_RESULT bios_get_entry(FILE *, UINT32, UINT32 *, TSS_PCR_EVENT **);
 int bios_close(FILE *);
+void bios_index_free();
+TSS_BOOL bios_index_contains(void *);
 
 extern struct ext_log_source bios_source;
 
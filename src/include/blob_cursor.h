@@ -0,0 +1,261 @@
+/*
+ * Licensed Materials - Property of IBM
+ *
+ * trousers - An open source TCG Software Stack
+ *
+ * (C) Copyright International Business Machines Corp. 2004-2007
+ *
+ */
+
+#ifndef _BLOB_CURSOR_H_
+#define _BLOB_CURSOR_H_
+
+#include <string.h>
+
+/*
+ * A blob cursor is a position in a buffer of known capacity. Every PutBlob_ and GetBlob_ call
+ * checks the field against the capacity; a field that doesn't fit is not copied, the position
+ * doesn't move and the cursor is marked as overflowed, after which nothing more is read or
+ * written. Callers check blob_cursor_ok() once at the end instead of after every field.
+ *
+ * A cursor with a NULL base only counts bytes, which sizes a structure without a second
+ * encoding pass.
+ *
+ * The older UINT64 *offset interfaces (Trspi_LoadBlob_*, LoadBlob_* in the TCS) are thin
+ * wrappers around these and keep their historical TSS_TPM_TXBLOB_SIZE bound.
+ */
+struct blob_cursor
+{
+	BYTE *base;
+	UINT64 cap;
+	UINT64 pos;
+	TSS_BOOL overflow;
+};
+
+#define BLOB_CURSOR_UNBOUNDED	((UINT64)-1)
+
+static inline void
+blob_cursor_init(struct blob_cursor *c, BYTE *base, UINT64 cap, UINT64 pos)
+{
+	c->base = base;
+	c->cap = cap;
+	c->pos = pos;
+	c->overflow = (pos > cap);
+}
+
+/* A cursor that only measures, starting at @pos */
+static inline void
+blob_cursor_init_sizer(struct blob_cursor *c, UINT64 pos)
+{
+	blob_cursor_init(c, NULL, BLOB_CURSOR_UNBOUNDED, pos);
+}
+
+/*
+ * The cursor behind an (offset, blob) pair of the older interfaces. They don't know how big
+ * @blob is, so writes stay bounded by TSS_TPM_TXBLOB_SIZE; without a blob the caller is only
+ * sizing something and there's nothing to overflow.
+ */
+#define blob_cursor_init_offset(c, offset, blob) \
+	blob_cursor_init((c), (blob), (blob) ? TSS_TPM_TXBLOB_SIZE : BLOB_CURSOR_UNBOUNDED, \
+			 *(offset))
+
+static inline TSS_BOOL
+blob_cursor_ok(struct blob_cursor *c)
+{
+	return !c->overflow;
+}
+
+/* Check that @size more bytes fit, marking the cursor as overflowed if they don't */
+static inline TSS_BOOL
+blob_cursor_fits(struct blob_cursor *c, UINT64 size)
+{
+	if (c->overflow || size > c->cap - c->pos) {
+		c->overflow = TRUE;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static inline void
+PutBlob(struct blob_cursor *c, UINT64 size, const void *from)
+{
+	if (size == 0 || !blob_cursor_fits(c, size))
+		return;
+
+	if (c->base)
+		memcpy(&c->base[c->pos], from, size);
+	c->pos += size;
+}
+
+static inline void
+PutBlob_BYTE(struct blob_cursor *c, BYTE in)
+{
+	if (!blob_cursor_fits(c, sizeof(BYTE)))
+		return;
+
+	if (c->base)
+		c->base[c->pos] = in;
+	c->pos += sizeof(BYTE);
+}
+
+static inline void
+PutBlob_BOOL(struct blob_cursor *c, TSS_BOOL in)
+{
+	PutBlob_BYTE(c, (BYTE)in);
+}
+
+static inline void
+PutBlob_UINT16(struct blob_cursor *c, UINT16 in)
+{
+	BYTE *p;
+
+	if (!blob_cursor_fits(c, sizeof(UINT16)))
+		return;
+
+	if ((p = c->base)) {
+		p += c->pos;
+		p[0] = (BYTE)(in >> 8);
+		p[1] = (BYTE)in;
+	}
+	c->pos += sizeof(UINT16);
+}
+
+static inline void
+PutBlob_UINT32(struct blob_cursor *c, UINT32 in)
+{
+	BYTE *p;
+
+	if (!blob_cursor_fits(c, sizeof(UINT32)))
+		return;
+
+	if ((p = c->base)) {
+		p += c->pos;
+		p[0] = (BYTE)(in >> 24);
+		p[1] = (BYTE)(in >> 16);
+		p[2] = (BYTE)(in >> 8);
+		p[3] = (BYTE)in;
+	}
+	c->pos += sizeof(UINT32);
+}
+
+static inline void
+PutBlob_UINT64(struct blob_cursor *c, UINT64 in)
+{
+	if (!blob_cursor_fits(c, sizeof(UINT64)))
+		return;
+
+	PutBlob_UINT32(c, (UINT32)(in >> 32));
+	PutBlob_UINT32(c, (UINT32)in);
+}
+
+/* Copy @size bytes out to @to, or just skip over them if @to is NULL */
+static inline void
+GetBlob(struct blob_cursor *c, UINT64 size, void *to)
+{
+	if (size == 0 || !blob_cursor_fits(c, size))
+		return;
+
+	if (to)
+		memcpy(to, &c->base[c->pos], size);
+	c->pos += size;
+}
+
+static inline void
+GetBlob_BYTE(struct blob_cursor *c, BYTE *out)
+{
+	if (!blob_cursor_fits(c, sizeof(BYTE)))
+		return;
+
+	if (out)
+		*out = c->base[c->pos];
+	c->pos += sizeof(BYTE);
+}
+
+static inline void
+GetBlob_BOOL(struct blob_cursor *c, TSS_BOOL *out)
+{
+	if (!blob_cursor_fits(c, sizeof(BYTE)))
+		return;
+
+	if (out)
+		*out = c->base[c->pos];
+	c->pos += sizeof(BYTE);
+}
+
+static inline void
+GetBlob_UINT16(struct blob_cursor *c, UINT16 *out)
+{
+	BYTE *p;
+
+	if (!blob_cursor_fits(c, sizeof(UINT16)))
+		return;
+
+	if (out) {
+		p = &c->base[c->pos];
+		*out = ((UINT16)p[0] << 8) | p[1];
+	}
+	c->pos += sizeof(UINT16);
+}
+
+static inline void
+GetBlob_UINT32(struct blob_cursor *c, UINT32 *out)
+{
+	BYTE *p;
+
+	if (!blob_cursor_fits(c, sizeof(UINT32)))
+		return;
+
+	if (out) {
+		p = &c->base[c->pos];
+		*out = ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | p[3];
+	}
+	c->pos += sizeof(UINT32);
+}
+
+static inline void
+GetBlob_UINT64(struct blob_cursor *c, UINT64 *out)
+{
+	UINT32 hi, lo;
+
+	if (!blob_cursor_fits(c, sizeof(UINT64)))
+		return;
+
+	GetBlob_UINT32(c, &hi);
+	GetBlob_UINT32(c, &lo);
+	if (out)
+		*out = ((UINT64)hi << 32) | lo;
+}
+
+/*
+ * Encoded sizes of the structures that get marshalled the most, so that buffers can be sized
+ * without running the encoder with a NULL blob first.
+ */
+#define BLOB_SIZEOF_VERSION		(4 * sizeof(BYTE))
+#define BLOB_SIZEOF_UUID		(sizeof(UINT32) + (2 * sizeof(UINT16)) + (2 * sizeof(BYTE)) + 6)
+#define BLOB_SIZEOF_PCR_SELECTION(s)	(sizeof(UINT16) + (s)->sizeOfSelect)
+#define BLOB_SIZEOF_PCR_INFO(p)		(BLOB_SIZEOF_PCR_SELECTION(&(p)->pcrSelection) + \
+					 (2 * TPM_SHA1_160_HASH_LEN))
+#define BLOB_SIZEOF_PCR_INFO_LONG(p)	(sizeof(UINT16) + (2 * sizeof(BYTE)) + \
+					 BLOB_SIZEOF_PCR_SELECTION(&(p)->creationPCRSelection) + \
+					 BLOB_SIZEOF_PCR_SELECTION(&(p)->releasePCRSelection) + \
+					 (2 * TPM_SHA1_160_HASH_LEN))
+#define BLOB_SIZEOF_PCR_INFO_SHORT(p)	(BLOB_SIZEOF_PCR_SELECTION(&(p)->pcrSelection) + \
+					 sizeof(BYTE) + TPM_SHA1_160_HASH_LEN)
+#define BLOB_SIZEOF_KEY_PARMS(p)	((2 * sizeof(UINT32)) + (2 * sizeof(UINT16)) + (p)->parmSize)
+#define BLOB_SIZEOF_STORE_PUBKEY(k)	(sizeof(UINT32) + (k)->keyLength)
+/* TPM_KEY12 and TCPA_KEY differ only in how their first 4 bytes are used */
+#define BLOB_SIZEOF_KEY(k)		(BLOB_SIZEOF_VERSION + sizeof(UINT16) + sizeof(UINT32) + \
+					 sizeof(BYTE) + BLOB_SIZEOF_KEY_PARMS(&(k)->algorithmParms) + \
+					 sizeof(UINT32) + (k)->PCRInfoSize + \
+					 BLOB_SIZEOF_STORE_PUBKEY(&(k)->pubKey) + \
+					 sizeof(UINT32) + (k)->encSize)
+#define BLOB_SIZEOF_KEY12(k)		BLOB_SIZEOF_KEY(k)
+#define BLOB_SIZEOF_PCR_EVENT(e)	(BLOB_SIZEOF_VERSION + (4 * sizeof(UINT32)) + \
+					 (e)->ulPcrValueLength + (e)->ulEventLength)
+#define BLOB_SIZEOF_KM_KEYINFO(i)	(BLOB_SIZEOF_VERSION + (2 * BLOB_SIZEOF_UUID) + \
+					 (2 * sizeof(BYTE)) + sizeof(UINT32) + \
+					 (i)->ulVendorDataLength)
+#define BLOB_SIZEOF_KM_KEYINFO2(i)	(BLOB_SIZEOF_KM_KEYINFO(i) + (2 * sizeof(UINT32)))
+
+#endif
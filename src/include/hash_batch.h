@@ -0,0 +1,21 @@
+
+/*
+ * Licensed Materials - Property of IBM
+ *
+ * trousers - An open source TCG Software Stack
+ *
+ * (C) Copyright International Business Machines Corp. 2004-2007
+ *
+ */
+
+#ifndef _HASH_BATCH_H_
+#define _HASH_BATCH_H_
+
+/* The multi-buffer SHA-1 kernels shared by Trspi_HashBatch() and the TCS's HashBatch().
+ * hash_batch_lanes() returns how many buffers this CPU hashes side by side, or 0 if it can't,
+ * in which case the callers hash the buffers one at a time. hash_batch_sha1() takes a lane
+ * count no bigger than that and writes one TPM_SHA1_160_HASH_LEN digest per buffer. */
+UINT32 hash_batch_lanes(void);
+void   hash_batch_sha1(UINT32 lanes, UINT32 count, UINT32 *sizes, BYTE **bufs, BYTE *digests);
+
+#endif
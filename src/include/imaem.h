@@ -15,6 +15,7 @@ int ima_open(void *, FILE **);
 TSS_RESULT ima_get_entries_by_pcr(FILE *, UINT32, UINT32, UINT32 *, TSS_PCR_EVENT **);
 TSS_RESULT ima_get_entry(FILE *, UINT32, UINT32 *, TSS_PCR_EVENT **);
 int ima_close(FILE *);
+void ima_index_free();
 
 extern struct ext_log_source ima_source;
 
@@ -24,6 +25,8 @@ extern struct ext_log_source ima_source;
  * 255 bytes of ascii (MAX) [event name]
  * 1   byte -> '\0'         [separator ]
  */
+#define IMA_MAX_NAME_LEN 255
+
 #define IMA_MIN_EVENT_SIZE 29
 #define IMA_MAX_EVENT_SIZE 284
 
@@ -1,4 +1,3 @@
-
 /*
  * Licensed Materials - Property of IBM
  *
@@ -12,26 +11,56 @@
 #define _MEMMGR_H_
 
 /*
- * For each TSP context, there is one memTable, which holds a list of memEntry's,
- * each of which holds a pointer to some malloc'd memory that's been returned to
- * the user. The memTable also can point to other memTable's which would be
- * created if multiple TSP contexts were opened.
+ * For each TSP context, there is one memTable, which indexes every pointer that's been
+ * returned to the user in a hash table keyed by the pointer value. Small allocations are
+ * carved out of per-context arena chunks, which are released in bulk when the context's
+ * memory is freed. A small block given back before then goes on a free list for its size
+ * class and is handed out again by the next allocation of that class. Larger allocations
+ * (and memory handed to us by __tspi_add_mem_entry) are individually malloc'd. The memTables themselves are hashed by context handle, since
+ * multiple TSP contexts can be open at once.
  *
  */
 
+/* allocations up to this size are bump-allocated out of the context's arena */
+#define MEM_ARENA_SMALL_MAX		256
+#define MEM_ARENA_CHUNK_SIZE		4096
+#define MEM_ARENA_ALIGN			16
+/* one free list per MEM_ARENA_ALIGN multiple up to MEM_ARENA_SMALL_MAX */
+#define MEM_ARENA_CLASSES		(MEM_ARENA_SMALL_MAX / MEM_ARENA_ALIGN)
+
+#define MEM_ENTRY_HASH_INIT		64
+#define MEM_TABLE_HASH_SIZE		32
+
+#define MEM_ENTRY_FLAG_ARENA		0x1
+
 struct memEntry {
 	void *memPointer;
+	UINT32 flags;
+	UINT32 size;		/* arena allocations only, rounded up to MEM_ARENA_ALIGN */
 	struct memEntry *nextEntry;
 };
 
+struct memChunk {
+	struct memChunk *next;
+	UINT32 used;
+	UINT32 size;
+	/* chunk data follows, aligned to MEM_ARENA_ALIGN */
+};
+
 struct memTable {
 	TSS_HCONTEXT tspContext;
-	struct memEntry *entries;
+	struct memEntry **entries;
+	UINT32 num_buckets;
+	UINT32 num_entries;
+	struct memEntry *free_entries;
+	struct memChunk *chunks;
+	void *free_blocks[MEM_ARENA_CLASSES];	/* freed arena blocks, linked through their
+						 * first word */
 	struct memTable *nextTable;
 };
 
 MUTEX_DECLARE_INIT(memtable_lock);
 
-struct memTable *SpiMemoryTable = NULL;
+struct memTable *SpiMemoryTable[MEM_TABLE_HASH_SIZE];
 
 #endif
@@ -42,6 +42,9 @@ struct tr_context_obj {
 	TPM_TRANSPORT_LOG_IN transLogIn;
 	TPM_TRANSPORT_LOG_OUT transLogOut;
 	TPM_DIGEST transLogDigest;
+	Trspi_SymKey transCipher;
+	BYTE *transBuf;
+	UINT32 transBufSize;
 #endif
 };
 
@@ -20,6 +20,9 @@ struct tr_policy_obj {
 	UINT32 SecretTimeStamp;
 	UINT32 SecretSize;
 	BYTE Secret[20];
+	/* HMAC key schedule derived from Secret on first use. Must be dropped whenever
+	 * Secret changes */
+	Trspi_HmacKey SecretHmacKey;
 	UINT32 type;
 	BYTE *popupString;
 	UINT32 popupStringLength;
@@ -120,6 +123,8 @@ TSS_RESULT obj_policy_get_tsp_context(TSS_HPOLICY, TSS_HCONTEXT *);
 #define TR_SECRET_CTX_NOT_NEW	FALSE
 TSS_RESULT obj_policy_get_secret(TSS_HPOLICY, TSS_BOOL, TCPA_SECRET *);
 TSS_RESULT obj_policy_flush_secret(TSS_HPOLICY);
+TSS_RESULT obj_policy_get_hmac_key(struct tr_policy_obj *, TSS_BOOL, Trspi_HmacKey **);
+TSS_RESULT obj_policy_hmac_auth(TSS_HPOLICY, TSS_BOOL, BYTE *, TPM_AUTH *);
 TSS_RESULT obj_policy_set_secret_object(TSS_HPOLICY, TSS_FLAG, UINT32,
 					TCPA_DIGEST *, TSS_BOOL);
 TSS_RESULT obj_policy_set_secret(TSS_HPOLICY, TSS_FLAG, UINT32, BYTE *);
@@ -17,10 +17,13 @@
 struct tpm_req_mgr
 {
 	MUTEX_DECLARE(queue_lock);
+	MUTEX_DECLARE(pending_lock);
+	UINT32 pending;		/* requests waiting for or holding queue_lock */
 };
 
 TSS_RESULT req_mgr_init();
 TSS_RESULT req_mgr_final();
 TSS_RESULT req_mgr_submit_req(BYTE *);
+TSS_RESULT req_mgr_submit_idle_req(BYTE *, TSS_BOOL *);
 
 #endif
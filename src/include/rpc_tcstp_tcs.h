@@ -104,6 +104,8 @@ DECLARE_TCSTP_FUNC(OwnerClear);
 #ifdef TSS_BUILD_PS
 DECLARE_TCSTP_FUNC(RegisterKey);
 DECLARE_TCSTP_FUNC(UnregisterKey);
+DECLARE_TCSTP_FUNC(RegisterKeys);
+DECLARE_TCSTP_FUNC(UnregisterKeys);
 DECLARE_TCSTP_FUNC(GetRegisteredKeyBlob);
 DECLARE_TCSTP_FUNC(LoadKeyByUUID);
 DECLARE_TCSTP_FUNC(GetRegisteredKeyByPublicInfo);
@@ -112,6 +114,8 @@ DECLARE_TCSTP_FUNC(EnumRegisteredKeys2);
 #else
 #define tcs_wrap_RegisterKey			tcs_wrap_Error
 #define tcs_wrap_UnregisterKey			tcs_wrap_Error
+#define tcs_wrap_RegisterKeys			tcs_wrap_Error
+#define tcs_wrap_UnregisterKeys			tcs_wrap_Error
 #define tcs_wrap_GetRegisteredKeyBlob		tcs_wrap_Error
 #define tcs_wrap_LoadKeyByUUID			tcs_wrap_Error
 #define tcs_wrap_GetRegisteredKeyByPublicInfo	tcs_wrap_Error
@@ -178,11 +182,15 @@ DECLARE_TCSTP_FUNC(LogPcrEvent);
 DECLARE_TCSTP_FUNC(GetPcrEvent);
 DECLARE_TCSTP_FUNC(GetPcrEventsByPcr);
 DECLARE_TCSTP_FUNC(GetPcrEventLog);
+DECLARE_TCSTP_FUNC(GetPcrEventLogPage);
+DECLARE_TCSTP_FUNC(GetPcrEventsSince);
 #else
 #define tcs_wrap_LogPcrEvent		tcs_wrap_Error
 #define tcs_wrap_GetPcrEvent		tcs_wrap_Error
 #define tcs_wrap_GetPcrEventsByPcr	tcs_wrap_Error
 #define tcs_wrap_GetPcrEventLog		tcs_wrap_Error
+#define tcs_wrap_GetPcrEventLogPage	tcs_wrap_Error
+#define tcs_wrap_GetPcrEventsSince	tcs_wrap_Error
 #endif
 
 #ifdef TSS_BUILD_SELFTEST
@@ -382,14 +390,19 @@ DECLARE_TCSTP_FUNC(CMK_ConvertMigration);
 
 DECLARE_TCSTP_FUNC(dispatchCommand);
 
+void PutBlob_Auth_Special(struct blob_cursor *, TPM_AUTH *);
 void LoadBlob_Auth_Special(UINT64 *, BYTE *, TPM_AUTH *);
 void UnloadBlob_Auth_Special(UINT64 *, BYTE *, TPM_AUTH *);
+void PutBlob_KM_KEYINFO(struct blob_cursor *, TSS_KM_KEYINFO *);
 void LoadBlob_KM_KEYINFO(UINT64 *, BYTE *, TSS_KM_KEYINFO *);
+void PutBlob_KM_KEYINFO2(struct blob_cursor *, TSS_KM_KEYINFO2 *);
 void LoadBlob_KM_KEYINFO2(UINT64 *, BYTE *, TSS_KM_KEYINFO2 *);
 void UnloadBlob_KM_KEYINFO(UINT64 *, BYTE *, TSS_KM_KEYINFO *);
 void UnloadBlob_KM_KEYINFO2(UINT64 *, BYTE *, TSS_KM_KEYINFO2 *);
+void PutBlob_LOADKEY_INFO(struct blob_cursor *, TCS_LOADKEY_INFO *);
 void LoadBlob_LOADKEY_INFO(UINT64 *, BYTE *, TCS_LOADKEY_INFO *);
 void UnloadBlob_LOADKEY_INFO(UINT64 *, BYTE *, TCS_LOADKEY_INFO *);
+void PutBlob_PCR_EVENT(struct blob_cursor *, TSS_PCR_EVENT *);
 void LoadBlob_PCR_EVENT(UINT64 *, BYTE *, TSS_PCR_EVENT *);
 TSS_RESULT UnloadBlob_PCR_EVENT(UINT64 *, BYTE *, TSS_PCR_EVENT *);
 int setData(TCSD_PACKET_TYPE, unsigned int, void *, int, struct tcsd_comm_data *);
@@ -398,8 +411,8 @@ void initData(struct tcsd_comm_data *, int);
 int recv_from_socket(int, void *, int);
 int send_to_socket(int, void *, int);
 TSS_RESULT getTCSDPacket(struct tcsd_thread_data *);
+int access_control_init(struct tcsd_thread_data *, struct sockaddr_in *);
 
-MUTEX_DECLARE_EXTERN(tcsp_lock);
 
 #endif
 
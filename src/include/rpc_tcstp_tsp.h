@@ -23,6 +23,7 @@ TSS_RESULT sendTCSDPacket(struct host_table_entry *);
 TSS_RESULT send_init(struct host_table_entry *);
 TSS_RESULT tcs_sendit(struct host_table_entry *);
 short get_port();
+UINT32 get_tcsd_device(void);
 
 /* Context commands always included */
 TSS_RESULT RPC_OpenContext_TP(struct host_table_entry *, UINT32 *, TCS_CONTEXT_HANDLE *);
@@ -42,17 +43,23 @@ TSS_RESULT RPC_LogPcrEvent_TP(struct host_table_entry *,TSS_PCR_EVENT,UINT32 *);
 TSS_RESULT RPC_GetPcrEvent_TP(struct host_table_entry *,UINT32,UINT32 *,TSS_PCR_EVENT **);
 TSS_RESULT RPC_GetPcrEventLog_TP(struct host_table_entry *,UINT32 *,TSS_PCR_EVENT **);
 TSS_RESULT RPC_GetPcrEventsByPcr_TP(struct host_table_entry *,UINT32,UINT32,UINT32 *,TSS_PCR_EVENT **);
+TSS_RESULT RPC_GetPcrEventLogPage_TP(struct host_table_entry *,UINT32 *,UINT32 *,UINT32,UINT32 *,TSS_PCR_EVENT **);
+TSS_RESULT RPC_GetPcrEventsSince_TP(struct host_table_entry *,UINT32,UINT32,UINT32 *,TSS_PCR_EVENT **,TCPA_DIGEST *);
 #else
 #define RPC_LogPcrEvent_TP(...)		TSPERR(TSS_E_INTERNAL_ERROR)
 #define RPC_GetPcrEvent_TP(...)		TSPERR(TSS_E_INTERNAL_ERROR)
 #define RPC_GetPcrEventLog_TP(...)	TSPERR(TSS_E_INTERNAL_ERROR)
 #define RPC_GetPcrEventsByPcr_TP(...)	TSPERR(TSS_E_INTERNAL_ERROR)
+#define RPC_GetPcrEventLogPage_TP(...)	TSPERR(TSS_E_INTERNAL_ERROR)
+#define RPC_GetPcrEventsSince_TP(...)	TSPERR(TSS_E_INTERNAL_ERROR)
 #endif
 
 #ifdef TSS_BUILD_PS
 TSS_RESULT RPC_GetRegisteredKeyByPublicInfo_TP(struct host_table_entry * tcsContext,TCPA_ALGORITHM_ID algID,UINT32,BYTE *,UINT32 *,BYTE **);
 TSS_RESULT RPC_RegisterKey_TP(struct host_table_entry *,TSS_UUID,TSS_UUID,UINT32,BYTE *,UINT32,BYTE *);
 TSS_RESULT RPC_UnregisterKey_TP(struct host_table_entry *,TSS_UUID);
+TSS_RESULT RPC_RegisterKeys_TP(struct host_table_entry *,UINT32,TSS_UUID *,TSS_UUID *,UINT32 *,BYTE **,UINT32,BYTE *,UINT32 *);
+TSS_RESULT RPC_UnregisterKeys_TP(struct host_table_entry *,UINT32,TSS_UUID *,UINT32 *);
 TSS_RESULT RPC_EnumRegisteredKeys_TP(struct host_table_entry *,TSS_UUID *,UINT32 *,TSS_KM_KEYINFO **);
 TSS_RESULT RPC_EnumRegisteredKeys2_TP(struct host_table_entry *,TSS_UUID *,UINT32 *,TSS_KM_KEYINFO2 **);
 TSS_RESULT RPC_GetRegisteredKey_TP(struct host_table_entry *,TSS_UUID,TSS_KM_KEYINFO **);
@@ -62,6 +69,8 @@ TSS_RESULT RPC_LoadKeyByUUID_TP(struct host_table_entry *,TSS_UUID,TCS_LOADKEY_I
 #define RPC_GetRegisteredKeyByPublicInfo_TP(...)	TSPERR(TSS_E_INTERNAL_ERROR)
 #define RPC_RegisterKey_TP(...)				TSPERR(TSS_E_INTERNAL_ERROR)
 #define RPC_UnregisterKey_TP(...)			TSPERR(TSS_E_INTERNAL_ERROR)
+#define RPC_RegisterKeys_TP(...)			TSPERR(TSS_E_INTERNAL_ERROR)
+#define RPC_UnregisterKeys_TP(...)			TSPERR(TSS_E_INTERNAL_ERROR)
 #define RPC_EnumRegisteredKeys_TP(...)			TSPERR(TSS_E_INTERNAL_ERROR)
 #define RPC_EnumRegisteredKeys2_TP(...)			TSPERR(TSS_E_INTERNAL_ERROR)
 #define RPC_GetRegisteredKey_TP(...)			TSPERR(TSS_E_INTERNAL_ERROR)
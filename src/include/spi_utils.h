@@ -17,6 +17,7 @@
 
 #include "trousers_types.h"
 #include "trousers/trousers.h"
+#include "blob_cursor.h"
 
 struct key_mem_cache
 {
@@ -85,6 +86,7 @@ TSS_RESULT owner_get_pubek(TSS_HCONTEXT, TSS_HTPM, TSS_HKEY *);
 /* spi_utils.c */
 
 UINT16 get_num_pcrs(TSS_HCONTEXT);
+TSS_BOOL tcs_lacks_ordinal(TSS_RESULT);
 void   free_key_refs(TSS_KEY *);
 
 #define UI_MAX_SECRET_STRING_LENGTH	256
@@ -142,6 +144,8 @@ TSS_RESULT __tspi_rsa_verify(TSS_HKEY, UINT32, UINT32, BYTE*, UINT32, BYTE*);
 TSS_RESULT Init_AuthNonce(TCS_CONTEXT_HANDLE, TSS_BOOL, TPM_AUTH *);
 TSS_BOOL validateReturnAuth(BYTE *, BYTE *, TPM_AUTH *);
 void HMAC_Auth(BYTE *, BYTE *, TPM_AUTH *);
+TSS_BOOL validateReturnAuth_Keyed(Trspi_HmacKey *, BYTE *, TPM_AUTH *);
+TSS_RESULT HMAC_Auth_Keyed(Trspi_HmacKey *, BYTE *, TPM_AUTH *);
 TSS_RESULT OSAP_Calc(TCS_CONTEXT_HANDLE, UINT16, UINT32, BYTE *, BYTE *, BYTE *,
 			TCPA_ENCAUTH *, TCPA_ENCAUTH *, BYTE *, TPM_AUTH *);
 
@@ -159,10 +163,27 @@ TSS_RESULT pcrs_calc_composite(TCPA_PCR_SELECTION *, TCPA_PCRVALUE *, TCPA_DIGES
 struct tr_pcrs_obj;
 TSS_RESULT pcrs_sanity_check_selection(TCS_CONTEXT_HANDLE, struct tr_pcrs_obj *, TPM_PCR_SELECTION *);
 
+/* trousers.c, cursor forms of the Trspi_LoadBlob_* encoders */
+void Trspi_PutBlob_TCPA_VERSION(struct blob_cursor *, TCPA_VERSION *);
+void Trspi_PutBlob_PCR_SELECTION(struct blob_cursor *, TCPA_PCR_SELECTION *);
+void Trspi_PutBlob_PCR_INFO(struct blob_cursor *, TCPA_PCR_INFO *);
+void Trspi_PutBlob_PCR_INFO_LONG(struct blob_cursor *, TPM_PCR_INFO_LONG *);
+void Trspi_PutBlob_PCR_INFO_SHORT(struct blob_cursor *, TPM_PCR_INFO_SHORT *);
+void Trspi_PutBlob_KEY_PARMS(struct blob_cursor *, TCPA_KEY_PARMS *);
+void Trspi_PutBlob_STORE_PUBKEY(struct blob_cursor *, TCPA_STORE_PUBKEY *);
+void Trspi_PutBlob_KEY(struct blob_cursor *, TCPA_KEY *);
+void Trspi_PutBlob_KEY12(struct blob_cursor *, TPM_KEY12 *);
+void Trspi_PutBlob_UUID(struct blob_cursor *, TSS_UUID *);
+void Trspi_PutBlob_PCR_EVENT(struct blob_cursor *, TSS_PCR_EVENT *);
+void Trspi_PutBlob_COUNTER_VALUE(struct blob_cursor *, TPM_COUNTER_VALUE *);
+
+void PutBlob_AUTH(struct blob_cursor *, TPM_AUTH *);
 void LoadBlob_AUTH(UINT64 *, BYTE *, TPM_AUTH *);
 void UnloadBlob_AUTH(UINT64 *, BYTE *, TPM_AUTH *);
+void PutBlob_LOADKEY_INFO(struct blob_cursor *, TCS_LOADKEY_INFO *);
 void LoadBlob_LOADKEY_INFO(UINT64 *, BYTE *, TCS_LOADKEY_INFO *);
 void UnloadBlob_LOADKEY_INFO(UINT64 *, BYTE *, TCS_LOADKEY_INFO *);
+void PutBlob_TSS_KEY(struct blob_cursor *, TSS_KEY *);
 void LoadBlob_TSS_KEY(UINT64 *, BYTE *, TSS_KEY *);
 TSS_RESULT UnloadBlob_TSS_KEY(UINT64 *, BYTE *, TSS_KEY *);
 TSS_RESULT Hash_TSS_KEY(Trspi_HashCtx *, TSS_KEY *);
@@ -192,6 +213,9 @@ TSS_RESULT RPC_GetRegisteredKey(TSS_HCONTEXT, TSS_UUID, TSS_KM_KEYINFO **);
 TSS_RESULT RPC_GetRegisteredKeyBlob(TSS_HCONTEXT, TSS_UUID, UINT32 *, BYTE **);
 TSS_RESULT RPC_RegisterKey(TSS_HCONTEXT, TSS_UUID, TSS_UUID, UINT32, BYTE *, UINT32, BYTE *);
 TSS_RESULT RPC_UnregisterKey(TSS_HCONTEXT, TSS_UUID);
+TSS_RESULT RPC_RegisterKeys(TSS_HCONTEXT, UINT32, TSS_UUID *, TSS_UUID *, UINT32 *, BYTE **, UINT32,
+			    BYTE *, UINT32 *);
+TSS_RESULT RPC_UnregisterKeys(TSS_HCONTEXT, UINT32, TSS_UUID *, UINT32 *);
 TSS_RESULT RPC_EnumRegisteredKeys(TSS_HCONTEXT, TSS_UUID *, UINT32 *, TSS_KM_KEYINFO **);
 TSS_RESULT RPC_EnumRegisteredKeys2(TSS_HCONTEXT, TSS_UUID *, UINT32 *, TSS_KM_KEYINFO2 **);
 TSS_RESULT RPC_ChangeAuth(TSS_HCONTEXT, TCS_KEY_HANDLE, TCPA_PROTOCOL_ID, TCPA_ENCAUTH *,
@@ -325,6 +349,10 @@ TSS_RESULT Transport_AuthorizeMigrationKey(TSS_HCONTEXT, TCPA_MIGRATE_SCHEME, UI
 TSS_RESULT RPC_GetPcrEvent(TSS_HCONTEXT, UINT32, UINT32 *, TSS_PCR_EVENT **);
 TSS_RESULT RPC_GetPcrEventsByPcr(TSS_HCONTEXT, UINT32, UINT32, UINT32 *, TSS_PCR_EVENT **);
 TSS_RESULT RPC_GetPcrEventLog(TSS_HCONTEXT, UINT32 *, TSS_PCR_EVENT **);
+TSS_RESULT RPC_GetPcrEventLogPage(TSS_HCONTEXT, UINT32 *, UINT32 *, UINT32, UINT32 *,
+				  TSS_PCR_EVENT **);
+TSS_RESULT RPC_GetPcrEventsSince(TSS_HCONTEXT, UINT32, UINT32, UINT32 *, TSS_PCR_EVENT **,
+				 TCPA_DIGEST *);
 TSS_RESULT RPC_Quote(TSS_HCONTEXT, TCS_KEY_HANDLE, TCPA_NONCE *, UINT32, BYTE *, TPM_AUTH *,
 			UINT32 *, BYTE **, UINT32 *, BYTE **);
 TSS_RESULT Transport_Quote(TSS_HCONTEXT, TCS_KEY_HANDLE, TCPA_NONCE *, UINT32, BYTE *, TPM_AUTH *,
@@ -27,6 +27,7 @@ struct tcs_context {
 	TSS_FLAG flags;
 	TPM_TRANSHANDLE transHandle;
 	TCS_CONTEXT_HANDLE handle;
+	UINT32 device; /* the TPM it was opened on, see struct tcs_device */
 	COND_VAR cond; /* used in waiting for an auth ctx to become available */
 	struct keys_loaded *keys;
 	struct tcs_context *next;
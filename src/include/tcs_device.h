@@ -0,0 +1,48 @@
+
+/*
+ * Licensed Materials - Property of IBM
+ *
+ * trousers - An open source TCG Software Stack
+ *
+ * (C) Copyright International Business Machines Corp. 2004-2007
+ *
+ */
+
+#ifndef _TCS_DEVICE_H_
+#define _TCS_DEVICE_H_
+
+#include "threads.h"
+#include "req_mgr.h"
+#include "auth_mgr.h"
+
+/*
+ * A TPM the TCS serves, one per node of the tpm_device option. It holds everything that belongs
+ * to one particular TPM: its request queue, the keys and auth sessions loaded in it and the
+ * properties it reported. A TCS context is bound to a device when it's opened and the thread
+ * serving it works on that device, see tcs_device_select(). Threads that never select one, such
+ * as the tcsd's background threads, work on device 0.
+ */
+struct tcs_device
+{
+	UINT32 index;
+	struct tpm_req_mgr req_mgr;
+	struct tpm_properties metrics;
+	struct key_mem_cache *key_cache;
+	MUTEX_DECLARE(key_cache_lock);
+	struct _auth_mgr auth;
+	MUTEX_DECLARE(auth_lock);
+	MUTEX_DECLARE(rpc_lock);	/* serializes the TCSP calls made on the device */
+};
+
+TSS_RESULT         tcs_devices_init(UINT32);
+UINT32             tcs_device_count(void);
+struct tcs_device *tcs_device_current(void);
+TSS_RESULT         tcs_device_select(UINT32);
+
+/* the current thread's TPM, under the names its parts had when the TCS served only one */
+#define tpm_metrics		(tcs_device_current()->metrics)
+#define key_mem_cache_head	(tcs_device_current()->key_cache)
+#define mem_cache_lock		(tcs_device_current()->key_cache_lock)
+#define tcsp_lock		(tcs_device_current()->rpc_lock)
+
+#endif
@@ -11,6 +11,7 @@
 #ifndef _TCS_KEY_PS_H_
 #define _TCS_KEY_PS_H_
 
+TSS_RESULT ps_open_disk_cache();
 TSS_RESULT ps_init_disk_cache();
 void       ps_close_disk_cache();
 TSS_BOOL   ps_is_key_registered(TCPA_STORE_PUBKEY *);
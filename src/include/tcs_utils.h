@@ -17,6 +17,7 @@
 #include "tcs_context.h"
 #include "tcs_tsp.h"
 #include "trousers_types.h"
+#include "blob_cursor.h"
 
 struct key_mem_cache
 {
@@ -32,9 +33,6 @@ struct key_mem_cache
 	struct key_mem_cache *next, *prev;
 };
 
-extern struct key_mem_cache *key_mem_cache_head;
-MUTEX_DECLARE_EXTERN(mem_cache_lock);
-
 struct tpm_properties
 {
 	UINT32 num_pcrs;
@@ -47,7 +45,7 @@ struct tpm_properties
 	BYTE manufacturer[16];
 };
 
-extern struct tpm_properties tpm_metrics;
+#include "tcs_device.h"
 
 #define TPM_VERSION_IS(maj, min) \
 	((tpm_metrics.version.major == maj) && (tpm_metrics.version.minor == min))
@@ -92,6 +90,17 @@ TSS_RESULT owner_evict_init();
 #define EVENT_LOG_final()
 #endif
 
+TSS_RESULT random_pool_init();
+void       random_pool_final();
+
+#ifdef TSS_BUILD_RANDOM
+#define RANDOM_POOL_init()	random_pool_init()
+#define RANDOM_POOL_final()	random_pool_final()
+#else
+#define RANDOM_POOL_init()	(TSS_SUCCESS)
+#define RANDOM_POOL_final()
+#endif
+
 #define next( x ) x = x->next
 
 TSS_RESULT key_mgr_dec_ref_count(TCS_KEY_HANDLE);
@@ -157,6 +166,7 @@ TSS_BOOL ctx_has_key_loaded(TCS_CONTEXT_HANDLE, TCS_KEY_HANDLE);
 void       ctx_ref_count_keys(struct tcs_context *);
 struct tcs_context *get_context(TCS_CONTEXT_HANDLE);
 TSS_RESULT ctx_req_exclusive_transport(TCS_CONTEXT_HANDLE);
+TSS_BOOL   ctx_has_exclusive_transport(UINT32);
 TSS_RESULT ctx_set_transport_enabled(TCS_CONTEXT_HANDLE, TPM_TRANSHANDLE);
 TSS_RESULT ctx_set_transport_disabled(TCS_CONTEXT_HANDLE, TCS_HANDLE *);
 
@@ -210,6 +220,8 @@ TSS_RESULT LogUnloadBlob_Header(BYTE *, UINT32 *, char *, int);
 TSS_RESULT UnloadBlob_Header(BYTE *, UINT32 *);
 #endif
 TSS_RESULT UnloadBlob_MIGRATIONKEYAUTH(UINT64 *, BYTE *, TCPA_MIGRATIONKEYAUTH *);
+void PutBlob_Auth(struct blob_cursor *, TPM_AUTH *);
+void GetBlob_Auth(struct blob_cursor *, TPM_AUTH *);
 void LoadBlob_Auth(UINT64 *, BYTE *, TPM_AUTH *);
 void UnloadBlob_Auth(UINT64 *, BYTE *, TPM_AUTH *);
 void LoadBlob_KEY_PARMS(UINT64 *, BYTE *, TCPA_KEY_PARMS *);
@@ -217,6 +229,7 @@ TSS_RESULT UnloadBlob_KEY_PARMS(UINT64 *, BYTE *, TCPA_KEY_PARMS *);
 TSS_RESULT UnloadBlob_STORE_PUBKEY(UINT64 *, BYTE *, TCPA_STORE_PUBKEY *);
 void LoadBlob_STORE_PUBKEY(UINT64 *, BYTE *, TCPA_STORE_PUBKEY *);
 void UnloadBlob_VERSION(UINT64 *, BYTE *, TPM_VERSION *);
+void PutBlob_VERSION(struct blob_cursor *, TPM_VERSION *);
 void LoadBlob_VERSION(UINT64 *, BYTE *, TPM_VERSION *);
 void UnloadBlob_TCPA_VERSION(UINT64 *, BYTE *, TCPA_VERSION *);
 void LoadBlob_TCPA_VERSION(UINT64 *, BYTE *, TCPA_VERSION *);
@@ -237,6 +250,7 @@ void LoadBlob_KEY_FLAGS(UINT64 *, BYTE *, TCPA_KEY_FLAGS *);
 void UnloadBlob_KEY_FLAGS(UINT64 *, BYTE *, TCPA_KEY_FLAGS *);
 TSS_RESULT UnloadBlob_CERTIFY_INFO(UINT64 *, BYTE *, TCPA_CERTIFY_INFO *);
 TSS_RESULT UnloadBlob_KEY_HANDLE_LIST(UINT64 *, BYTE *, TCPA_KEY_HANDLE_LIST *);
+void PutBlob_UUID(struct blob_cursor *, TSS_UUID *);
 void LoadBlob_UUID(UINT64 *, BYTE *, TSS_UUID);
 void UnloadBlob_UUID(UINT64 *, BYTE *, TSS_UUID *);
 void LoadBlob_COUNTER_VALUE(UINT64 *, BYTE *, TPM_COUNTER_VALUE *);
@@ -254,6 +268,7 @@ void UnloadBlob_CURRENT_TICKS(UINT64 *, BYTE *, TPM_CURRENT_TICKS *);
 TSS_RESULT UnloadBlob_PCR_INFO_SHORT(UINT64 *, BYTE *, TPM_PCR_INFO_SHORT *);
 
 TSS_RESULT Hash(UINT32, UINT32, BYTE *, BYTE *);
+TSS_RESULT HashBatch(UINT32, UINT32, UINT32 *, BYTE **, BYTE *);
 void free_external_events(UINT32, TSS_PCR_EVENT *);
 
 TSS_RESULT internal_TerminateHandle(TCS_AUTHHANDLE handle);
@@ -263,6 +278,7 @@ TSS_RESULT fill_key_info2(struct key_disk_cache *, struct key_mem_cache *, TSS_K
 
 char platform_get_runlevel();
 TSS_RESULT tpm_rsp_parse(TPM_COMMAND_CODE, BYTE *, UINT32, ...);
+TSS_RESULT tpm_rsp_parse_view(TPM_COMMAND_CODE, BYTE *, UINT32, ...);
 TSS_RESULT tpm_rqu_build(TPM_COMMAND_CODE, UINT64 *, BYTE *, ...);
 TSS_RESULT tpm_preload_check(TCS_CONTEXT_HANDLE, TPM_COMMAND_CODE ordinal, ...);
 TSS_RESULT getKeyByCacheEntry(struct key_disk_cache *, BYTE *, UINT16 *);
@@ -314,6 +330,22 @@ TSS_RESULT TCSP_FlushSpecific_Common(UINT32, TPM_RESOURCE_TYPE);
 						TSS_PCR_EVENT ** ppEvents	/* out */
 	    );
 
+	TSS_RESULT TCS_GetPcrEventLogPage_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
+						    UINT32 * pPcrIndex,	/* in, out */
+						    UINT32 * pSequence,	/* in, out */
+						    UINT32 ulMaxSize,	/* in */
+						    UINT32 * pEventCount,	/* out */
+						    TSS_PCR_EVENT ** ppEvents	/* out */
+	    );
+
+	TSS_RESULT TCS_GetPcrEventsSince_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
+						   UINT32 PcrIndex,	/* in */
+						   UINT32 Since,	/* in */
+						   UINT32 * pEventCount,	/* out */
+						   TSS_PCR_EVENT ** ppEvents,	/* out */
+						   TCPA_DIGEST * pAggregate	/* out */
+	    );
+
 	TSS_RESULT TCS_RegisterKey_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 					     TSS_UUID *WrappingKeyUUID,	/* in */
 					     TSS_UUID *KeyUUID,	/* in  */
@@ -327,6 +359,21 @@ TSS_RESULT TCSP_FlushSpecific_Common(UINT32, TPM_RESOURCE_TYPE);
 						TSS_UUID KeyUUID	/* in  */
 	    );
 
+	TSS_RESULT TCS_RegisterKeys_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
+					      UINT32 ulKeyCount,	/* in */
+					      TSS_UUID *WrappingKeyUUIDs,	/* in */
+					      TSS_UUID *KeyUUIDs,	/* in */
+					      UINT32 *cKeySizes,	/* in */
+					      BYTE ** rgbKeys,	/* in */
+					      UINT32 cVendorData,	/* in */
+					      BYTE * gbVendorData	/* in */
+	    );
+
+	TSS_RESULT TCS_UnregisterKeys_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
+						UINT32 ulKeyCount,	/* in */
+						TSS_UUID *KeyUUIDs	/* in */
+	    );
+
 	TSS_RESULT TCS_EnumRegisteredKeys_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 						    TSS_UUID * pKeyUUID,	/* in    */
 						    UINT32 * pcKeyHierarchySize,	/* out */
@@ -13,6 +13,7 @@
 #define _TCSD_H_
 
 #include <signal.h>
+#include <netinet/in.h>
 
 #include "rpc_tcstp.h"
 
@@ -25,6 +26,18 @@ struct platform_class
 	struct platform_class *next;
 };
 
+/* sets of TCSD ordinals, one bit per ordinal */
+#define TCSD_ORD_MAP_WORDS		((TCSD_MAX_NUM_ORDS + 31) / 32)
+#define TCSD_ORD_MAP_SET(map, ord)	((map)[(ord) / 32] |= (1U << ((ord) % 32)))
+#define TCSD_ORD_MAP_TEST(map, ord)	((map)[(ord) / 32] & (1U << ((ord) % 32)))
+
+/* an IPv4 network remote connections are accepted from, in host byte order */
+struct tcsd_remote_host
+{
+	UINT32 addr;
+	UINT32 mask;
+};
+
 /* config structures */
 struct tcsd_config
 {
@@ -34,22 +47,32 @@ struct tcsd_config
 	char *system_ps_file;	/* the name of the system PS file */
 	char *firmware_log_file;/* the name of the firmware PCR event file */
 	char *kernel_log_file;	/* the name of the kernel PCR event file */
+	char *event_log_file;	/* the name of the file the TCSD logs PCR events to */
 	unsigned int kernel_pcrs;	/* bitmask of PCRs the kernel controls */
 	unsigned int firmware_pcrs;	/* bitmask of PCRs the firmware controls */
 	char *platform_cred;		/* location of the platform credential */
 	char *conformance_cred;		/* location of the conformance credential */
 	char *endorsement_cred;		/* location of the endorsement credential */
 	int remote_ops[TCSD_MAX_NUM_ORDS];	/* array of ordinals executable by remote hosts */
+	UINT32 remote_ops_map[TCSD_ORD_MAP_WORDS];	/* the same ordinals, as a bitmap */
+	struct tcsd_remote_host *remote_hosts;	/* networks remote hosts may connect from, */
+	unsigned int num_remote_hosts;		/* or any network if there are none */
 	unsigned int unset;	/* bitmask of options which are still unset */
 	int exclusive_transport; /* allow applications to open exclusive transport sessions with
 				    the TPM and enforce their exclusivity (possible DOS issue) */
 	struct platform_class *host_platform_class; /* Host platform class of this TCS System */
 	struct platform_class *all_platform_classes;	/* List of platform classes
 							of this TCS System */
+	char **tpm_devices;	/* device nodes of the TPMs this TCSD serves, the first is the
+				   default one. NULL to probe the usual nodes for a single TPM */
+	unsigned int num_tpm_devices;
+	unsigned int random_pool_size;	/* bytes of TPM randomness kept ready for GetRandom */
+	unsigned int refs;	/* threads that have this config pinned, see tcsd_conf_pin() */
 };
 
 #define TCSD_DEFAULT_CONFIG_FILE	ETC_PREFIX "/tcsd.conf"
 extern char *tcsd_config_file;
+extern TSS_BOOL tcsd_remote_listen;	/* the tcsd accepts connections from other hosts */
 
 #define TSS_USER_NAME		"tss"
 #define TSS_GROUP_NAME		"tss"
@@ -59,9 +82,15 @@ extern char *tcsd_config_file;
 #define TCSD_DEFAULT_SYSTEM_PS_DIR	VAR_PREFIX "/lib/tpm"
 #define TCSD_DEFAULT_FIRMWARE_LOG_FILE	"/sys/kernel/security/tpm0/binary_bios_measurements"
 #define TCSD_DEFAULT_KERNEL_LOG_FILE	"/sys/kernel/security/ima/binary_runtime_measurements"
+#define TCSD_DEFAULT_EVENT_LOG_FILE	VAR_PREFIX "/lib/tpm/event_log.data"
+#define TCSD_DEFAULT_RANDOM_POOL_SIZE	0
+#define TCSD_MAX_RANDOM_POOL_SIZE	(1024 * 1024)
 #define TCSD_DEFAULT_FIRMWARE_PCRS	0x00000000
 #define TCSD_DEFAULT_KERNEL_PCRS	0x00000000
 
+/* the most TPMs the tpm_device option can list */
+#define TCSD_MAX_TPM_DEVICES		8
+
 /* This will change when a system with more than 32 PCR's exists */
 #define TCSD_MAX_PCRS			32
 
@@ -97,8 +126,14 @@ struct tcg_platform_spec {
 #define TCSD_OPTION_REMOTE_OPS		0x0400
 #define TCSD_OPTION_EXCLUSIVE_TRANSPORT	0x0800
 #define TCSD_OPTION_HOST_PLATFORM_CLASS	0x1000
+#define TCSD_OPTION_EVENT_LOGFILE	0x2000
+#define TCSD_OPTION_TPM_DEVICE		0x4000
+#define TCSD_OPTION_RANDOM_POOL_SIZE	0x8000
+#define TCSD_OPTION_REMOTE_HOSTS	0x10000
 
 #define TSS_TCP_RPC_MAX_DATA_LEN	1048576
+/* the most event data returned by one TCSD_ORD_GETPCREVENTLOGPAGE call */
+#define TSS_TCP_RPC_EVLOG_PAGE_MAX	(TSS_TCP_RPC_MAX_DATA_LEN / 2)
 #define TSS_TCP_RPC_BAD_PACKET_TYPE	0x10000000
 
 enum tcsd_config_option_code {
@@ -115,7 +150,11 @@ enum tcsd_config_option_code {
 	opt_remote_ops,
 	opt_exclusive_transport,
 	opt_host_platform_class,
-	opt_all_platform_classes
+	opt_all_platform_classes,
+	opt_event_log,
+	opt_tpm_device,
+	opt_random_pool_size,
+	opt_remote_hosts
 };
 
 struct tcsd_config_options {
@@ -123,12 +162,20 @@ struct tcsd_config_options {
 	enum tcsd_config_option_code option;
 };
 
-extern struct tcsd_config tcsd_options;
+/* the config in effect for the calling thread. It's replaced as a whole when the config file
+ * is reloaded, see tcsd_conf_pin() */
+#define tcsd_options	(*tcsd_conf_get())
 
+struct tcsd_config *tcsd_conf_get();
+void	   tcsd_conf_pin();
+void	   tcsd_conf_unpin();
+void	   tcsd_conf_final();
 TSS_RESULT conf_file_init(struct tcsd_config *);
+TSS_RESULT conf_file_reload();
 void	   conf_file_final(struct tcsd_config *);
 TSS_RESULT ps_dirs_init();
 void	   tcsd_signal_handler(int);
+TSS_RESULT tcsd_wait_ready();
 
 /* threading structures */
 struct tcsd_thread_data
@@ -136,23 +183,26 @@ struct tcsd_thread_data
 	int sock;
 	UINT32 context;
 	THREAD_TYPE *thread_id;
-	char *hostname;
+	char *hostname;		/* the peer's address */
+	UINT32 ops[TCSD_ORD_MAP_WORDS];	/* ordinals the peer may call, see access_control_init() */
 	struct tcsd_comm_data comm;
 };
 
 struct tcsd_thread_mgr
 {
 	MUTEX_DECLARE(lock);
-	struct tcsd_thread_data *thread_data;
+	struct tcsd_thread_data **thread_data;
 
 	int shutdown;
 	UINT32 num_active_threads;
 	UINT32 max_threads;
+	UINT32 num_slots;	/* of thread_data, which can be more than max_threads */
 };
 
 TSS_RESULT tcsd_threads_init();
 TSS_RESULT tcsd_threads_final();
-TSS_RESULT tcsd_thread_create(int, char *);
+TSS_RESULT tcsd_threads_resize(UINT32);
+TSS_RESULT tcsd_thread_create(int, struct sockaddr_in *);
 void	   *tcsd_thread_run(void *);
 void	   thread_signal_init();
 
@@ -20,6 +20,8 @@
 #define TCSGETCAPABILITY		TCSD_ORD_TCSGETCAPABILITY
 #define REGISTERKEY			TCSD_ORD_REGISTERKEY
 #define UNREGISTERKEY			TCSD_ORD_UNREGISTERKEY
+#define REGISTERKEYS			TCSD_ORD_REGISTERKEYS
+#define UNREGISTERKEYS			TCSD_ORD_UNREGISTERKEYS
 #define GETREGISTEREDKEYBLOB		TCSD_ORD_GETREGISTEREDKEYBLOB
 #define GETREGISTEREDKEYBYPUBLICINFO	TCSD_ORD_GETREGISTEREDKEYBYPUBLICINFO
 #define GETPUBKEY			TCSD_ORD_GETPUBKEY
@@ -110,8 +112,8 @@
 #define TCSD_OP_GETREGISTEREDKEYBYPUBLICINFO	GETREGISTEREDKEYBYPUBLICINFO, SUBOP_CONTEXT, 0
 #define TCSD_OP_GETPUBKEY			GETPUBKEY, SUBOP_RANDOM, SUBOP_AUTHSESS, SUBOP_CONTEXT, 0
 #define TCSD_OP_LOADKEY				LOADKEYBYBLOB, SUBOP_LOADKEYBYUUID, SUBOP_CONTEXT, SUBOP_AUTHSESS, SUBOP_RANDOM, 0
-#define TCSD_OP_REGISTERKEY			REGISTERKEY, SUBOP_CONTEXT, SUBOP_LOADKEYBYUUID, LOADKEYBYBLOB, 0
-#define TCSD_OP_UNREGISTERKEY			UNREGISTERKEY, SUBOP_CONTEXT, 0
+#define TCSD_OP_REGISTERKEY			REGISTERKEY, REGISTERKEYS, SUBOP_CONTEXT, SUBOP_LOADKEYBYUUID, LOADKEYBYBLOB, 0
+#define TCSD_OP_UNREGISTERKEY			UNREGISTERKEY, UNREGISTERKEYS, SUBOP_CONTEXT, 0
 #define TCSD_OP_CREATEKEY			CREATEWRAPKEY, SUBOP_CONTEXT, SUBOP_AUTHSESS, SUBOP_LOADKEYBYUUID, SUBOP_RANDOM, 0
 #define TCSD_OP_SIGN				SIGN, SUBOP_CONTEXT, SUBOP_AUTHSESS, SUBOP_RANDOM, FREEMEMORY, 0
 #define TCSD_OP_RANDOM				SUBOP_RANDOM, SUBOP_CONTEXT, FREEMEMORY, 0
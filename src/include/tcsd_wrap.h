@@ -184,8 +184,16 @@ enum TCSD_ORD {
 	TCSD_ORD_KEYCONTROLOWNER = 121,
 	TCSD_ORD_DSAP = 122,
 
+	/* Event log paging */
+	TCSD_ORD_GETPCREVENTLOGPAGE = 123,
+	TCSD_ORD_GETPCREVENTSSINCE = 124,
+
+	/* Bulk key registration */
+	TCSD_ORD_REGISTERKEYS = 125,
+	TCSD_ORD_UNREGISTERKEYS = 126,
+
 	/* Last */
-	TCSD_LAST_ORD = 123
+	TCSD_LAST_ORD = 127
 };
 #define TCSD_MAX_NUM_ORDS TCSD_LAST_ORD
 
@@ -23,11 +23,25 @@ struct event_wrapper {
 	struct event_wrapper *next;
 };
 
+/* The events logged to one TCSD controlled PCR, in order */
+struct event_list {
+	TSS_PCR_EVENT *events;
+	UINT32 num;
+	UINT32 size;
+};
+
+/* The result of replaying the first @num events of a PCR's log into a zeroed PCR */
+struct event_aggregate {
+	UINT32 num;
+	TCPA_DIGEST digest;
+};
+
 struct event_log {
 	MUTEX_DECLARE(lock);
 	struct ext_log_source *firmware_source;
 	struct ext_log_source *kernel_source;
-	struct event_wrapper **lists;
+	struct event_list *lists;
+	struct event_aggregate *aggregates;
 };
 
 /* include the compiled-in log sources and struct references here */
@@ -51,11 +65,21 @@ TSS_RESULT event_log_init();
 TSS_RESULT event_log_final();
 TSS_RESULT copy_pcr_event(TSS_PCR_EVENT *, TSS_PCR_EVENT *);
 TSS_RESULT event_log_add(TSS_PCR_EVENT *, UINT32 *);
+TSS_RESULT event_log_insert(TSS_PCR_EVENT *, UINT32 *);
+TSS_RESULT event_log_append(TSS_PCR_EVENT *, UINT32 *);
 TSS_PCR_EVENT *get_pcr_event(UINT32, UINT32);
 UINT32 get_num_events(UINT32);
+UINT32 copy_pcr_events(TSS_PCR_EVENT *, UINT32, UINT32, UINT32);
 TSS_PCR_EVENT *concat_pcr_events(TSS_PCR_EVENT **, UINT32, TSS_PCR_EVENT *, UINT32);
 UINT32 get_pcr_event_size(TSS_PCR_EVENT *);
 void free_external_events(UINT32, TSS_PCR_EVENT *);
+TSS_RESULT event_aggregate_extend(UINT32, TSS_PCR_EVENT *);
+TSS_RESULT event_aggregate_catch_up();
+
+TSS_RESULT evlog_file_init(char *);
+void evlog_file_final();
+TSS_BOOL evlog_file_contains(void *);
+TSS_RESULT evlog_file_append(TSS_PCR_EVENT *);
 
 extern struct event_log *tcs_event_log;
 
@@ -13,13 +13,74 @@
 
 #include "threads.h"
 
+/*
+ * Version 2 of the system PS file. The user PS and system PS files from older versions of
+ * TrouSerS are in the version 1 format described in tcs_tsp.h.
+ *
+ * [struct tssps2_header          ]
+ * [UINT32   uuid_index[num_buckets]] offset of the first record in each UUID hash chain
+ * [UINT32   pub_index[num_buckets] ] offset of the first record in each pub key hash chain
+ * [struct tssps2_record  record0  ]
+ * [BYTE[]   pub_data0              ]
+ * [BYTE[]   blob0                  ]
+ * [BYTE[]   vendor_data0           ]
+ * [...]
+ *
+ * Records are chained through their headers, an offset of 0 ends a chain. A removed key's
+ * record goes on the free list, chained through next_uuid, and is reused by the next key
+ * that fits in it. All integers are little endian.
+ *
+ * Changes to the file go through the write-ahead journal in ps_journal.c.
+ */
+#define TSSPS_VERSION_2			2
+#define TSSPS2_MAGIC			"TSS-PS"
+#define TSSPS2_MIN_BUCKETS		128
+
+struct tssps2_header {
+	BYTE version;
+	BYTE magic[7];
+	UINT32 num_keys;
+	UINT32 num_buckets;
+	UINT32 generation;	/* bumped on every change to the file */
+	UINT32 free_head;
+	UINT32 end;		/* end of the allocated records */
+	UINT32 reserved;
+};
+
+struct tssps2_record {
+	TSS_UUID uuid;
+	TSS_UUID parent_uuid;
+	BYTE pub_digest[TPM_SHA1_160_HASH_LEN];
+	UINT32 rec_size;	/* including the header and any unused space at the end */
+	UINT32 vendor_data_size;
+	UINT16 pub_data_size;
+	UINT16 blob_size;
+	UINT16 flags;
+	UINT16 reserved;
+	UINT32 next_uuid;
+	UINT32 next_pub;
+	UINT32 reserved2;
+};
+
+#define TSSPS2_INDEX_UUID		0
+#define TSSPS2_INDEX_PUB		1
+
+#define TSSPS2_INDEX_OFFSET(i, n)	(sizeof(struct tssps2_header) + (i) * (n) * sizeof(UINT32))
+#define TSSPS2_DATA_OFFSET(n)		TSSPS2_INDEX_OFFSET(2, n)
+#define TSSPS2_PUB_DATA_OFFSET(c)	((c)->offset + sizeof(struct tssps2_record))
+#define TSSPS2_BLOB_DATA_OFFSET(c)	(TSSPS2_PUB_DATA_OFFSET(c) + (c)->pub_data_size)
+#define TSSPS2_VENDOR_DATA_OFFSET(c)	(TSSPS2_BLOB_DATA_OFFSET(c) + (c)->blob_size)
+
 extern struct key_disk_cache *key_disk_cache_head;
+/* bytes taken up by removed keys' records in the system PS file */
+extern UINT32 psfile_free_bytes;
 /* file handles for the persistent stores */
 extern int system_ps_fd;
 /* The lock that surrounds all manipulations of the disk cache */
 MUTEX_DECLARE_EXTERN(disk_cache_lock);
 
 int		   get_file();
+int		   get_file_nolock();
 int		   put_file(int);
 void		   close_file(int);
 void		   ps_destroy();
@@ -30,7 +91,37 @@ TSS_RESULT  write_data(int, void *, UINT32);
 inline TSS_RESULT  read_data(int, void *, UINT32);
 inline TSS_RESULT  write_data(int, void *, UINT32);
 #endif
-int		   write_key_init(int, UINT32, UINT32, UINT32);
+TSS_RESULT	   read_data_at(int, UINT32, void *, UINT32);
+TSS_RESULT	   write_data_at(int, UINT32, void *, UINT32);
+void		   psfile_map_sync(int);
+void		   psfile_map_drop();
+BYTE		  *psfile_map_ptr(int, UINT32, UINT32);
+TSS_RESULT	   psfile_read_at(int, UINT32, void *, UINT32);
+TSS_RESULT	   psfile_write_at(int, UINT32, void *, UINT32);
+TSS_RESULT	   psjournal_open_file();
+TSS_RESULT	   psjournal_open(int, TSS_BOOL);
+void		   psjournal_close(int);
+TSS_RESULT	   psjournal_checkpoint(int);
+void		   psfile_txn_begin(int);
+UINT32		   psfile_txn_savepoint();
+void		   psfile_txn_rollback(UINT32);
+void		   psfile_txn_abort();
+TSS_BOOL	   psfile_txn_active(int);
+void		   psfile_txn_overlay(int, UINT32, BYTE *, UINT32);
+TSS_RESULT	   psfile_txn_commit(int);
+void		   psfile_swap_header(struct tssps2_header *);
+void		   psfile_swap_record(struct tssps2_record *);
+TSS_RESULT	   psfile_read_header(int, struct tssps2_header *);
+TSS_RESULT	   psfile_write_header(int, struct tssps2_header *);
+TSS_RESULT	   psfile_read_record(int, UINT32, struct tssps2_record *);
+TSS_RESULT	   psfile_write_record(int, UINT32, struct tssps2_record *);
+UINT32		   psfile_uuid_bucket(TSS_UUID *, UINT32);
+UINT32		   psfile_pub_bucket(BYTE *, UINT32);
+TSS_RESULT	   psfile_read_bucket(int, struct tssps2_header *, int, UINT32, UINT32 *);
+TSS_RESULT	   psfile_write_bucket(int, struct tssps2_header *, int, UINT32, UINT32);
+TSS_RESULT	   psfile_rebuild(int, struct key_disk_cache *, BYTE, UINT32);
+UINT32		   psfile_num_buckets(UINT32);
+void		   free_cache_list(struct key_disk_cache *);
 TSS_RESULT	   cache_key(UINT32, UINT16, TSS_UUID *, TSS_UUID *, UINT16, UINT32, UINT32);
 TSS_RESULT	   UnloadBlob_KEY_PS(UINT16 *, BYTE *, TSS_KEY *);
 TSS_RESULT	   psfile_get_parent_uuid_by_uuid(int, TSS_UUID *, TSS_UUID *);
@@ -42,7 +133,10 @@ TSS_RESULT	   psfile_get_vendor_data(int, struct key_disk_cache *, UINT32 *, BYT
 TSS_RESULT	   psfile_is_pub_registered(int, TCPA_STORE_PUBKEY *, TSS_BOOL *);
 TSS_RESULT	   psfile_get_uuid_by_pub(int, TCPA_STORE_PUBKEY *, TSS_UUID **);
 TSS_RESULT	   psfile_write_key(int, TSS_UUID *, TSS_UUID *, UINT32 *, BYTE *, UINT32, BYTE *, UINT16);
+TSS_RESULT	   psfile_write_keys(int, UINT32, TSS_UUID *, TSS_UUID *, BYTE *, UINT32, BYTE **,
+				     UINT16 *);
 TSS_RESULT	   psfile_remove_key(int, struct key_disk_cache *);
+TSS_RESULT	   psfile_remove_keys(int, UINT32, struct key_disk_cache **);
 TCPA_STORE_PUBKEY *psfile_get_pub_by_tpm_handle(int, TCPA_KEY_HANDLE);
 TSS_RESULT	   psfile_get_tpm_handle_by_pub(int, TCPA_STORE_PUBKEY *, TCPA_KEY_HANDLE *);
 TSS_RESULT	   psfile_get_tcs_handle_by_pub(int, TCPA_STORE_PUBKEY *, TCS_KEY_HANDLE *);
@@ -50,22 +144,28 @@ TSS_RESULT	   psfile_get_parent_tcs_handle_by_pub(int, TCPA_STORE_PUBKEY *, TCS_
 TCPA_STORE_PUBKEY *psfile_get_pub_by_tcs_handle(int, TCS_KEY_HANDLE);
 TSS_RESULT	   psfile_get_key_by_pub(int, TCPA_STORE_PUBKEY *, UINT32 *, BYTE **);
 TSS_RESULT	   ps_remove_key(TSS_UUID *);
+TSS_RESULT	   ps_remove_keys(UINT32, TSS_UUID *);
 int		   init_disk_cache(int);
 int		   close_disk_cache(int);
-TSS_RESULT	   clean_disk_cache(int);
+void		   psfile_compact_final();
 
 TSS_RESULT	   ps_write_key(TSS_UUID *, TSS_UUID *, BYTE *, UINT32, BYTE *, UINT32);
+TSS_RESULT	   ps_write_keys(UINT32, TSS_UUID *, TSS_UUID *, BYTE *, UINT32, BYTE **, UINT32 *);
 TSS_RESULT	   ps_get_key_by_uuid(TSS_UUID *, BYTE *, UINT16 *);
 TSS_RESULT	   ps_get_key_by_cache_entry(struct key_disk_cache *, BYTE *, UINT16 *);
 TSS_RESULT	   ps_get_vendor_data(struct key_disk_cache *, UINT32 *, BYTE **);
+TSS_RESULT	   ps_open_disk_cache();
 TSS_RESULT	   ps_init_disk_cache();
 void		   ps_close_disk_cache();
 TSS_RESULT	   ps_get_key_by_pub(TCPA_STORE_PUBKEY *, UINT32 *, BYTE **);
+TSS_RESULT	   ps_check_device();
 
 #ifdef TSS_BUILD_PS
+#define PS_open_disk_cache()	ps_open_disk_cache()
 #define PS_init_disk_cache()	ps_init_disk_cache()
 #define PS_close_disk_cache()	ps_close_disk_cache()
 #else
+#define PS_open_disk_cache()	(TSS_SUCCESS)
 #define PS_init_disk_cache()	(TSS_SUCCESS)
 #define PS_close_disk_cache()
 #endif
@@ -27,6 +27,15 @@ struct tpm_device_node {
 #define TDDL_TXBUF_SIZE		2048
 #define TDDL_UNDEF		-1
 
+/* TPM command duration classes, see TPM_CAP_PROP_DURATION */
+#define TDDL_DURATION_SHORT	0
+#define TDDL_DURATION_MEDIUM	1
+#define TDDL_DURATION_LONG	2
+#define TDDL_DURATION_CLASSES	3
+
+/* set by the TCSD before Tddli_Open(), for the tpm_device option */
+extern struct tcsd_config *_tcsd_options;
+
 TSS_RESULT Tddli_Open(void);
 
 TSS_RESULT Tddli_TransmitData(BYTE *pTransmitBuf,
@@ -36,4 +45,25 @@ TSS_RESULT Tddli_TransmitData(BYTE *pTransmitBuf,
 
 TSS_RESULT Tddli_Close(void);
 
+TSS_RESULT Tddli_Cancel(void);
+
+TSS_RESULT Tddli_GetStatus(UINT32 ReqStatusType, UINT32 *pStatus);
+
+void Tddli_SetDurations(UINT32 shortDuration, UINT32 mediumDuration, UINT32 longDuration);
+
+/*
+ * The TDDL drives up to TCSD_MAX_TPM_DEVICES TPMs, the ones listed by the tpm_device option. The
+ * functions above work on the first of them, these on the one at index @device of the list.
+ * Requests for different devices can be made at the same time, requests for the same device
+ * must not.
+ */
+TSS_RESULT Tddli_OpenDevice(UINT32 device);
+TSS_RESULT Tddli_CloseDevice(UINT32 device);
+TSS_RESULT Tddli_TransmitDataDevice(UINT32 device, BYTE *pTransmitBuf, UINT32 TransmitBufLen,
+				    BYTE *pReceiveBuf, UINT32 *pReceiveBufLen);
+TSS_RESULT Tddli_CancelDevice(UINT32 device);
+TSS_RESULT Tddli_GetStatusDevice(UINT32 device, UINT32 ReqStatusType, UINT32 *pStatus);
+void Tddli_SetDurationsDevice(UINT32 device, UINT32 shortDuration, UINT32 mediumDuration,
+			      UINT32 longDuration);
+
 #endif
@@ -25,10 +25,12 @@
 
 /* condition variable abstractions */
 #define COND_DECLARE(c)		pthread_cond_t c
+#define COND_DECLARE_INIT(c)	pthread_cond_t c = PTHREAD_COND_INITIALIZER
 #define COND_INIT(c)		pthread_cond_init(&c, NULL)
 #define COND_VAR		pthread_cond_t
 #define COND_WAIT(c,m)		pthread_cond_wait(c,m)
 #define COND_SIGNAL(c)		pthread_cond_signal(c)
+#define COND_BROADCAST(c)	pthread_cond_broadcast(c)
 
 /* thread abstractions */
 #define THREAD_ID			((THREAD_TYPE)pthread_self())
@@ -43,6 +45,14 @@
 #define THREAD_SET_SIGNAL_MASK		pthread_sigmask
 #define THREAD_NULL			(THREAD_TYPE *)0
 
+/* thread specific data abstractions */
+#define THREAD_KEY_DECLARE(k)		pthread_key_t k
+#define THREAD_KEY_CREATE(k,d)		pthread_key_create(&k, d)
+#define THREAD_KEY_GET(k)		pthread_getspecific(k)
+#define THREAD_KEY_SET(k,v)		pthread_setspecific(k, v)
+#define THREAD_ONCE_DECLARE_INIT(o)	pthread_once_t o = PTHREAD_ONCE_INIT
+#define THREAD_ONCE(o,f)		pthread_once(&o, f)
+
 #else
 
 #error No threading library defined! (Cannot find pthread.h)
@@ -135,6 +135,14 @@ void Trspi_LoadBlob_CAP_VERSION_INFO(UINT64 *offset, BYTE *blob, TPM_CAP_VERSION
  * TSS_HASH_SHA1 is a suported type, so 20 bytes will be written to @Digest */
 TSS_RESULT Trspi_Hash(UINT32 HashType, UINT32 BufSize, BYTE *Buf, BYTE *Digest);
 
+/* Hash each of the @Count buffers in @Bufs, of sizes @BufSizes, independently. The digests
+ * are written back to back to @Digests, which must hold @Count digests. Where the CPU
+ * supports it, several buffers are hashed in parallel, which makes this much faster than
+ * calling Trspi_Hash in a loop when replaying event logs. Currently only TSS_HASH_SHA1 is
+ * supported */
+TSS_RESULT Trspi_HashBatch(UINT32 HashType, UINT32 Count, UINT32 *BufSizes, BYTE **Bufs,
+			   BYTE *Digests);
+
 typedef struct _Trspi_HashCtx {
 	void *ctx;
 } Trspi_HashCtx;
@@ -162,6 +170,10 @@ TSS_RESULT Trspi_Hash_KEY_PARMS(Trspi_HashCtx *c, TCPA_KEY_PARMS *keyInfo);
 TSS_RESULT Trspi_Hash_STORE_PUBKEY(Trspi_HashCtx *c, TCPA_STORE_PUBKEY *store);
 TSS_RESULT Trspi_Hash_UUID(Trspi_HashCtx *c, TSS_UUID uuid);
 TSS_RESULT Trspi_Hash_PCR_EVENT(Trspi_HashCtx *c, TSS_PCR_EVENT *event);
+/* Compute the digest Trspi_Hash_PCR_EVENT would give each of the @Count events in @Events,
+ * hashing them together with Trspi_HashBatch. The digests are written back to back to
+ * @Digests */
+TSS_RESULT Trspi_HashBatch_PCR_EVENT(UINT32 Count, TSS_PCR_EVENT *Events, BYTE *Digests);
 TSS_RESULT Trspi_Hash_PRIVKEY_DIGEST(Trspi_HashCtx *c, TCPA_KEY *key);
 TSS_RESULT Trspi_Hash_PRIVKEY_DIGEST12(Trspi_HashCtx *c, TPM_KEY12 *key);
 TSS_RESULT Trspi_Hash_SYMMETRIC_KEY(Trspi_HashCtx *c, TCPA_SYMMETRIC_KEY *key);
@@ -185,6 +197,17 @@ TSS_RESULT Trspi_Hash_MSA_COMPOSITE(Trspi_HashCtx *c, TPM_MSA_COMPOSITE *m);
 
 UINT32 Trspi_HMAC(UINT32 HashType, UINT32 SecretSize, BYTE*Secret, UINT32 BufSize, BYTE*Buf, BYTE*hmacOut);
 
+/* A precomputed HMAC key schedule. Trspi_HMAC_KeyInit derives the inner and outer padded
+ * hash states from @Secret once, so that each HMAC done with the key afterwards costs only
+ * the hashing of the message itself. Currently only TSS_HASH_SHA1 is supported. */
+typedef struct _Trspi_HmacKey {
+	void *key;
+} Trspi_HmacKey;
+
+TSS_RESULT Trspi_HMAC_KeyInit(Trspi_HmacKey *k, UINT32 HashType, UINT32 SecretSize, BYTE *Secret);
+void Trspi_HMAC_KeyFree(Trspi_HmacKey *k);
+TSS_RESULT Trspi_HMAC_Keyed(Trspi_HmacKey *k, UINT32 BufSize, BYTE *Buf, BYTE *hmacOut);
+
 /* RSA encrypt @dataToEncryptLen bytes at location @dataToEncrypt using public key
  * @publicKey of size @keysize. This data will be encrypted using OAEP padding in
  * the openssl library using the OAEP padding parameter "TCPA".  This will allow
@@ -236,7 +259,22 @@ TSS_RESULT Trspi_SymEncrypt(UINT16 alg, UINT16 mode, BYTE *key, BYTE *iv, BYTE *
 TSS_RESULT Trspi_SymDecrypt(UINT16 alg, UINT16 mode, BYTE *key, BYTE *iv, BYTE *in, UINT32 in_len,
 			    BYTE *out, UINT32 *out_len);
 
+/* A symmetric key whose cipher context is set up once and reused for every message encrypted
+ * with it, only the IV changing between them. Only stream modes (TPM_ES_SYM_OFB) are
+ * supported, so the output is as long as the input and @in may equal @out. */
+typedef struct _Trspi_SymKey {
+	void *ctx;
+} Trspi_SymKey;
+
+TSS_RESULT Trspi_SymKey_Init(Trspi_SymKey *k, UINT16 alg, UINT16 mode, BYTE *key);
+void Trspi_SymKey_Free(Trspi_SymKey *k);
+TSS_RESULT Trspi_SymKey_Crypt(Trspi_SymKey *k, BYTE *iv, UINT32 len, BYTE *in, BYTE *out);
+
 TSS_RESULT Trspi_MGF1(UINT32 alg, UINT32 seedLen, BYTE *seed, UINT32 outLen, BYTE *out);
+/* XOR the MGF1 mask of @seed over @len bytes of @in into @out, which may be the same buffer,
+ * a hash block at a time rather than generating the whole mask first */
+TSS_RESULT Trspi_MGF1_Xor(UINT32 alg, UINT32 seedLen, BYTE *seed, UINT32 len, BYTE *in,
+			  BYTE *out);
 
 /* String Functions */
 
@@ -251,6 +289,42 @@ BYTE *Trspi_Native_To_UNICODE(BYTE *string, unsigned *len);
  * is non-NULL, *len will be set to the size of the returned buffer. */
 BYTE *Trspi_UNICODE_To_Native(BYTE *string, unsigned *len);
 
+/* Event log paging */
+
+/* Read the event log a page at a time, starting with event number *pulSequence of PCR
+ * *pulPcrIndex and returning at most about ulMaxSize bytes of events (0 for the TCS's limit).
+ * On return, the pair names the next event to read, and *pulPcrIndex is the number of PCRs
+ * once the whole log has been read. Free the events with Tspi_Context_FreeMemory. */
+TSS_RESULT Tspi_TPM_GetEventLogPage(TSS_HTPM hTPM, UINT32 *pulPcrIndex, UINT32 *pulSequence,
+				    UINT32 ulMaxSize, UINT32 *pulEventNumber,
+				    TSS_PCR_EVENT **prgbPcrEvents);
+
+/* Get the events of PCR ulPcrIndex numbered ulSequence and up, and the digest that replaying
+ * all of the PCR's events into a zeroed PCR gives. A poller that remembers the number of
+ * events it has seen only has to fetch and hash the new ones. Free the events with
+ * Tspi_Context_FreeMemory. */
+TSS_RESULT Tspi_TPM_GetEventsSince(TSS_HTPM hTPM, UINT32 ulPcrIndex, UINT32 ulSequence,
+				   UINT32 *pulEventNumber, TSS_PCR_EVENT **prgbPcrEvents,
+				   TPM_DIGEST *pAggregate);
+
+/* Bulk key registration */
+
+/* Register ulKeyCount keys at once. Each key's parent must either be registered already or
+ * come earlier in the arrays. On system PS the keys are written together with one sync, and
+ * if any of them can't be registered, none are. */
+TSS_RESULT Tspi_Context_RegisterKeys(TSS_HCONTEXT hContext, UINT32 ulKeyCount,
+				     TSS_HKEY *rghKeys, TSS_FLAG persistentStorageType,
+				     TSS_UUID *rgUuidKeys, TSS_FLAG persistentStorageTypeParent,
+				     TSS_UUID *rgUuidParentKeys);
+
+/* Unregister ulKeyCount keys at once. Unlike Tspi_Context_UnregisterKey, no key handles are
+ * returned. On user PS, if any of the keys can't be unregistered, the ones that were are
+ * registered again. On system PS, a TCS that knows the bulk ordinal removes each batch it
+ * accepts together, but a TCS that predates it is asked for the keys one by one, and the keys
+ * removed before a failure stay removed. */
+TSS_RESULT Tspi_Context_UnregisterKeys(TSS_HCONTEXT hContext, TSS_FLAG persistentStorageType,
+				       UINT32 ulKeyCount, TSS_UUID *rgUuidKeys);
+
 /* Error Functions */
 
 /* return a human readable string based on the result */
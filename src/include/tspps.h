@@ -39,6 +39,7 @@ TSS_RESULT	   psfile_get_cache_entry_by_pub(int, UINT32, BYTE *, struct key_disk
 void		   psfile_close(int);
 
 TSS_RESULT	   ps_remove_key(TSS_UUID *);
+TSS_RESULT	   ps_remove_keys(UINT32, TSS_UUID *);
 TSS_RESULT	   ps_write_key(TSS_UUID *, TSS_UUID *, UINT32, UINT32, BYTE *);
 TSS_RESULT	   ps_get_key_by_uuid(TSS_HCONTEXT, TSS_UUID *, TSS_HKEY *);
 TSS_RESULT	   ps_init_disk_cache();
@@ -34,6 +34,17 @@ TPM Device Driver Library interface
 #define TDDL_CAP_PROP_MODULE_TYPE  0x0202
 #define TDDL_CAP_PROP_GLOBAL_STATE  0x0203
 
+#define TDDL_DRIVER_STATUS   0x0010
+#define TDDL_DRIVER_OK   0x0010
+#define TDDL_DRIVER_FAILED   0x0011
+#define TDDL_DRIVER_NOT_OPENED   0x0012
+
+#define TDDL_DEVICE_STATUS   0x0020
+#define TDDL_DEVICE_OK   0x0020
+#define TDDL_DEVICE_UNRECOVERABLE   0x0021
+#define TDDL_DEVICE_RECOVERABLE   0x0022
+#define TDDL_DEVICE_NOT_FOUND   0x0023
+
 
 //--------------------------------------------------------------------
 // TDDL specific helper redefinitions
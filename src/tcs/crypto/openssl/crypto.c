@@ -15,12 +15,20 @@
 #include <fcntl.h>
 #include <errno.h>
 
+#include <openssl/opensslv.h>
 #include <openssl/evp.h>
 
 #include "trousers/tss.h"
 #include "trousers_types.h"
+#include "threads.h"
 #include "tcs_tsp.h"
 #include "tcslog.h"
+#include "hash_batch.h"
+
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+#define EVP_MD_CTX_new()	EVP_MD_CTX_create()
+#define EVP_MD_CTX_free(c)	EVP_MD_CTX_destroy(c)
+#endif
 
 /*
  * Hopefully this will make the code clearer since
@@ -28,16 +36,63 @@
  */
 #define EVP_SUCCESS 1
 
+/* Each tcsd thread reuses one digest context for all of its hashing */
+static THREAD_KEY_DECLARE(md_ctx_key);
+static THREAD_ONCE_DECLARE_INIT(md_ctx_once);
+static TSS_BOOL md_ctx_key_enabled = FALSE;
+
+static void
+md_ctx_destroy(void *data)
+{
+	EVP_MD_CTX_free((EVP_MD_CTX *)data);
+}
+
+static void
+md_ctx_key_init(void)
+{
+	if (THREAD_KEY_CREATE(md_ctx_key, md_ctx_destroy) == 0)
+		md_ctx_key_enabled = TRUE;
+}
+
+static EVP_MD_CTX *
+md_ctx_get(void)
+{
+	EVP_MD_CTX *md_ctx = NULL;
+
+	THREAD_ONCE(md_ctx_once, md_ctx_key_init);
+
+	if (md_ctx_key_enabled)
+		md_ctx = (EVP_MD_CTX *)THREAD_KEY_GET(md_ctx_key);
+
+	if (md_ctx == NULL)
+		md_ctx = EVP_MD_CTX_new();
+
+	return md_ctx;
+}
+
+static void
+md_ctx_put(EVP_MD_CTX *md_ctx)
+{
+	if (md_ctx_key_enabled && THREAD_KEY_GET(md_ctx_key) == md_ctx)
+		return;
+
+	if (!md_ctx_key_enabled || THREAD_KEY_SET(md_ctx_key, md_ctx))
+		EVP_MD_CTX_free(md_ctx);
+}
+
 TSS_RESULT
 Hash(UINT32 HashType, UINT32 BufSize, BYTE* Buf, BYTE* Digest)
 {
-	EVP_MD_CTX md_ctx;
+	EVP_MD_CTX *md_ctx;
 	unsigned int result_size;
 	int rv;
 
+	if ((md_ctx = md_ctx_get()) == NULL)
+		return TCSERR(TSS_E_OUTOFMEMORY);
+
 	switch (HashType) {
 		case TSS_HASH_SHA1:
-			rv = EVP_DigestInit(&md_ctx, EVP_sha1());
+			rv = EVP_DigestInit_ex(md_ctx, EVP_sha1(), NULL);
 			break;
 		default:
 			rv = TCSERR(TSS_E_BAD_PARAMETER);
@@ -50,19 +105,44 @@ Hash(UINT32 HashType, UINT32 BufSize, BYTE* Buf, BYTE* Digest)
 		goto out;
 	}
 
-	rv = EVP_DigestUpdate(&md_ctx, Buf, BufSize);
+	rv = EVP_DigestUpdate(md_ctx, Buf, BufSize);
 	if (rv != EVP_SUCCESS) {
 		rv = TCSERR(TSS_E_INTERNAL_ERROR);
 		goto out;
 	}
 
-	result_size = EVP_MD_CTX_size(&md_ctx);
-	rv = EVP_DigestFinal(&md_ctx, Digest, &result_size);
+	result_size = EVP_MD_CTX_size(md_ctx);
+	rv = EVP_DigestFinal_ex(md_ctx, Digest, &result_size);
 	if (rv != EVP_SUCCESS) {
 		rv = TCSERR(TSS_E_INTERNAL_ERROR);
 	} else
 		rv = TSS_SUCCESS;
 
 out:
+	md_ctx_put(md_ctx);
 	return rv;
 }
+
+/* Hash @Count independent buffers, see Trspi_HashBatch() */
+TSS_RESULT
+HashBatch(UINT32 HashType, UINT32 Count, UINT32 *BufSizes, BYTE **Bufs, BYTE *Digests)
+{
+	TSS_RESULT result;
+	UINT32 i, lanes;
+
+	if (HashType != TSS_HASH_SHA1)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	if (Count > 1 && (lanes = hash_batch_lanes())) {
+		hash_batch_sha1(lanes, Count, BufSizes, Bufs, Digests);
+		return TSS_SUCCESS;
+	}
+
+	for (i = 0; i < Count; i++) {
+		if ((result = Hash(HashType, BufSizes[i], Bufs[i],
+				   &Digests[i * TPM_SHA1_160_HASH_LEN])))
+			return result;
+	}
+
+	return TSS_SUCCESS;
+}
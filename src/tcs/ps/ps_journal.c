@@ -0,0 +1,487 @@
+/*
+ * Licensed Materials - Property of IBM
+ *
+ * trousers - An open source TCG Software Stack
+ *
+ * (C) Copyright International Business Machines Corp. 2004-2006
+ *
+ */
+
+/*
+ * ps_journal.c
+ *
+ * The write-ahead journal of the system PS file. Changes to the PS file are staged in a
+ * transaction instead of being written out right away, and reads made while the transaction
+ * is open see the staged data. At commit, the staged writes are appended to the journal as
+ * a single record, the journal is synced, and only then are the writes made to the PS file.
+ * Once the journal grows past PSJOURNAL_CHECKPOINT_SIZE, the PS file is synced and the
+ * journal emptied.
+ *
+ * The journal is a series of records:
+ *
+ *   struct psjournal_rec
+ *   { UINT32 offset, UINT32 size, BYTE data[size] } x num_writes
+ *
+ * all little endian. Each record carries a checksum, so a record that was only partly
+ * written when the tcsd died is thrown away at the next start, along with everything after
+ * it. The complete records are written to the PS file again, which is harmless for writes
+ * that had already made it there.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(HAVE_BYTEORDER_H)
+#include <sys/byteorder.h>
+#elif defined(HTOLE_DEFINED)
+#include <endian.h>
+#define LE_16 htole16
+#define LE_32 htole32
+#define LE_64 htole64
+#else
+#define LE_16(x) (x)
+#define LE_32(x) (x)
+#define LE_64(x) (x)
+#endif
+
+#include "trousers/tss.h"
+#include "trousers_types.h"
+#include "tcsps.h"
+#include "tcs_tsp.h"
+#include "tcs_utils.h"
+#include "tcsd_wrap.h"
+#include "tcsd.h"
+#include "tcslog.h"
+
+#define PSJOURNAL_SUFFIX		".journal"
+#define PSJOURNAL_REC_MAGIC		0x4c4a5350	/* "PSJL" */
+#define PSJOURNAL_CHECKPOINT_SIZE	(1024 * 1024)
+
+struct psjournal_rec {
+	UINT32 magic;
+	UINT32 seq;
+	UINT32 num_writes;
+	UINT32 size;		/* of the writes following this header */
+	UINT32 checksum;
+	UINT32 reserved;
+};
+
+/* one write staged by the open transaction */
+struct psfile_txn_write {
+	UINT32 offset;
+	UINT32 size;
+	BYTE *data;
+	struct psfile_txn_write *next;
+};
+
+static struct {
+	int fd;
+	UINT32 size;
+	UINT32 seq;
+} ps_journal = { -1, 0, 0 };
+
+static struct {
+	int fd;			/* the PS file the transaction is open on, or -1 */
+	struct psfile_txn_write *head, *tail;
+	UINT32 num_writes;
+	UINT32 size;
+} ps_txn = { -1, NULL, NULL, 0, 0 };
+
+/* FNV-1a */
+static UINT32
+psjournal_checksum(UINT32 sum, BYTE *data, UINT32 len)
+{
+	UINT32 i;
+
+	for (i = 0; i < len; i++) {
+		sum ^= data[i];
+		sum *= 16777619;
+	}
+
+	return sum;
+}
+
+static UINT32
+psjournal_rec_checksum(struct psjournal_rec *rec, BYTE *writes)
+{
+	struct psjournal_rec tmp;
+
+	memcpy(&tmp, rec, sizeof(tmp));
+	tmp.checksum = 0;
+
+	return psjournal_checksum(psjournal_checksum(2166136261U, (BYTE *)&tmp, sizeof(tmp)),
+				  writes, LE_32(rec->size));
+}
+
+/*
+ * Write the complete records in the journal to the PS file open on @ps_fd, stopping at the
+ * first one that doesn't check out. Returns the number of records written.
+ */
+static UINT32
+psjournal_replay(int ps_fd, BYTE *buf, UINT32 len)
+{
+	struct psjournal_rec rec;
+	UINT32 pos = 0, w, off, offset, size, num = 0;
+
+	while (len - pos >= sizeof(rec)) {
+		memcpy(&rec, buf + pos, sizeof(rec));
+
+		if (LE_32(rec.magic) != PSJOURNAL_REC_MAGIC ||
+		    LE_32(rec.size) > len - pos - sizeof(rec) ||
+		    LE_32(rec.checksum) != psjournal_rec_checksum(&rec, buf + pos + sizeof(rec)))
+			break;
+
+		/* the writes were checked against the record size when they were staged, but
+		 * don't trust that the journal hasn't been tampered with */
+		for (w = 0, off = pos + sizeof(rec); w < LE_32(rec.num_writes); w++) {
+			if (pos + sizeof(rec) + LE_32(rec.size) - off < 2 * sizeof(UINT32))
+				break;
+
+			memcpy(&offset, buf + off, sizeof(UINT32));
+			memcpy(&size, buf + off + sizeof(UINT32), sizeof(UINT32));
+			offset = LE_32(offset);
+			size = LE_32(size);
+			off += 2 * sizeof(UINT32);
+
+			if (size > pos + sizeof(rec) + LE_32(rec.size) - off)
+				break;
+
+			if (write_data_at(ps_fd, offset, buf + off, size))
+				return num;
+
+			off += size;
+		}
+
+		num++;
+		pos += sizeof(rec) + LE_32(rec.size);
+	}
+
+	if (pos < len)
+		LogInfo("Dropped %u bytes of incomplete writes from the system PS journal.",
+			len - pos);
+
+	return num;
+}
+
+/*
+ * Open the journal of the system PS file without reading it, so that it can be opened while the
+ * tcsd still has the privileges to and read later. psjournal_open() does this if it hasn't been.
+ */
+TSS_RESULT
+psjournal_open_file(void)
+{
+	char *path;
+
+	if (ps_journal.fd >= 0)
+		return TSS_SUCCESS;
+
+	if ((path = malloc(strlen(tcsd_options.system_ps_file) + sizeof(PSJOURNAL_SUFFIX)))
+	    == NULL) {
+		LogError("malloc of %zd bytes failed.",
+			 strlen(tcsd_options.system_ps_file) + sizeof(PSJOURNAL_SUFFIX));
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+	sprintf(path, "%s%s", tcsd_options.system_ps_file, PSJOURNAL_SUFFIX);
+
+	ps_journal.fd = open(path, O_CREAT|O_RDWR, 0600);
+	if (ps_journal.fd < 0) {
+		LogError("system PS journal: open() of %s failed: %s", path, strerror(errno));
+		free(path);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+	free(path);
+
+	return TSS_SUCCESS;
+}
+
+/*
+ * Open the journal of the system PS file open on @ps_fd, and if @replay is set, bring the PS
+ * file up to date with whatever the last run of the tcsd left in the journal.
+ */
+TSS_RESULT
+psjournal_open(int ps_fd, TSS_BOOL replay)
+{
+	struct stat stat_buf;
+	TSS_RESULT rc;
+	BYTE *buf;
+	UINT32 num;
+
+	if ((rc = psjournal_open_file()))
+		return rc;
+
+	if (fstat(ps_journal.fd, &stat_buf)) {
+		LogError("fstat: %s", strerror(errno));
+		goto err;
+	}
+
+	ps_journal.size = stat_buf.st_size;
+	ps_journal.seq = 0;
+	if (ps_journal.size == 0)
+		return TSS_SUCCESS;
+
+	if (!replay) {
+		if (ftruncate(ps_journal.fd, 0)) {
+			LogError("truncating the system PS journal failed: %s", strerror(errno));
+			goto err;
+		}
+		ps_journal.size = 0;
+		return TSS_SUCCESS;
+	}
+
+	if ((buf = malloc(ps_journal.size)) == NULL) {
+		LogError("malloc of %u bytes failed.", ps_journal.size);
+		goto err;
+	}
+
+	if (read_data_at(ps_journal.fd, 0, buf, ps_journal.size)) {
+		free(buf);
+		goto err;
+	}
+
+	if ((num = psjournal_replay(ps_fd, buf, ps_journal.size))) {
+		LogInfo("Replayed %u record(s) from the system PS journal.", num);
+	}
+	free(buf);
+
+	if (psjournal_checkpoint(ps_fd))
+		goto err;
+
+	return TSS_SUCCESS;
+err:
+	close(ps_journal.fd);
+	ps_journal.fd = -1;
+	return TCSERR(TSS_E_INTERNAL_ERROR);
+}
+
+void
+psjournal_close(int ps_fd)
+{
+	if (ps_journal.fd < 0)
+		return;
+
+	psjournal_checkpoint(ps_fd);
+	close(ps_journal.fd);
+	ps_journal.fd = -1;
+}
+
+/*
+ * Make the writes in the journal durable in the PS file open on @ps_fd, and empty the
+ * journal. Must be done before the PS file is replaced, since the journal refers to offsets
+ * in it. The disk cache must be locked by the caller.
+ */
+TSS_RESULT
+psjournal_checkpoint(int ps_fd)
+{
+	if (ps_journal.fd < 0 || ps_journal.size == 0)
+		return TSS_SUCCESS;
+
+	if (fsync(ps_fd)) {
+		LogError("fsync of the system PS file failed: %s", strerror(errno));
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	if (ftruncate(ps_journal.fd, 0) || fsync(ps_journal.fd)) {
+		LogError("truncating the system PS journal failed: %s", strerror(errno));
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+	ps_journal.size = 0;
+
+	return TSS_SUCCESS;
+}
+
+/* Start staging writes to the PS file open on @fd. The disk cache must be locked by the
+ * caller until the transaction is committed or aborted. */
+void
+psfile_txn_begin(int fd)
+{
+	ps_txn.fd = fd;
+	ps_txn.head = ps_txn.tail = NULL;
+	ps_txn.num_writes = 0;
+	ps_txn.size = 0;
+}
+
+/* return a mark that psfile_txn_rollback() can return the transaction to */
+UINT32
+psfile_txn_savepoint()
+{
+	return ps_txn.num_writes;
+}
+
+/* drop the writes staged since @savepoint */
+void
+psfile_txn_rollback(UINT32 savepoint)
+{
+	struct psfile_txn_write *w, *next, *last = NULL;
+	UINT32 i;
+
+	for (w = ps_txn.head, i = 0; w && i < savepoint; last = w, w = w->next, i++)
+		;
+
+	for (; w; w = next) {
+		next = w->next;
+		ps_txn.size -= 2 * sizeof(UINT32) + w->size;
+		free(w);
+	}
+
+	if (last)
+		last->next = NULL;
+	else
+		ps_txn.head = NULL;
+	ps_txn.tail = last;
+	ps_txn.num_writes = savepoint;
+}
+
+void
+psfile_txn_abort()
+{
+	psfile_txn_rollback(0);
+	ps_txn.fd = -1;
+}
+
+TSS_BOOL
+psfile_txn_active(int fd)
+{
+	return (ps_txn.fd >= 0 && ps_txn.fd == fd);
+}
+
+/*
+ * write_data_at() for the system PS file. With a transaction open on @fd, the write is only
+ * staged.
+ */
+TSS_RESULT
+psfile_write_at(int fd, UINT32 offset, void *data, UINT32 size)
+{
+	struct psfile_txn_write *w;
+
+	if (ps_txn.fd < 0 || ps_txn.fd != fd)
+		return write_data_at(fd, offset, data, size);
+
+	if (ps_txn.size > UINT_MAX - sizeof(struct psjournal_rec) - 2 * sizeof(UINT32) - size) {
+		LogError("System PS transaction is too large.");
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	if ((w = malloc(sizeof(struct psfile_txn_write) + size)) == NULL) {
+		LogError("malloc of %zd bytes failed.", sizeof(struct psfile_txn_write) + size);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	w->offset = offset;
+	w->size = size;
+	w->data = (BYTE *)(w + 1);
+	w->next = NULL;
+	memcpy(w->data, data, size);
+
+	if (ps_txn.tail)
+		ps_txn.tail->next = w;
+	else
+		ps_txn.head = w;
+	ps_txn.tail = w;
+	ps_txn.num_writes++;
+	ps_txn.size += 2 * sizeof(UINT32) + size;
+
+	return TSS_SUCCESS;
+}
+
+/* Lay the writes staged on @fd over @size bytes just read from @offset, oldest first */
+void
+psfile_txn_overlay(int fd, UINT32 offset, BYTE *data, UINT32 size)
+{
+	struct psfile_txn_write *w;
+	UINT64 start, end;
+
+	if (ps_txn.fd < 0 || ps_txn.fd != fd)
+		return;
+
+	for (w = ps_txn.head; w; w = w->next) {
+		start = MAX((UINT64)offset, (UINT64)w->offset);
+		end = MIN((UINT64)offset + size, (UINT64)w->offset + w->size);
+		if (start >= end)
+			continue;
+
+		memcpy(data + (start - offset), w->data + (start - w->offset), end - start);
+	}
+}
+
+/*
+ * Make the staged writes durable in the journal, then write them to the PS file. Without a
+ * journal, the writes just go to the PS file. The transaction is closed either way.
+ */
+TSS_RESULT
+psfile_txn_commit(int fd)
+{
+	struct psjournal_rec *rec;
+	struct psfile_txn_write *w;
+	TSS_RESULT result = TSS_SUCCESS;
+	BYTE *buf = NULL, *p;
+	UINT32 u32, len;
+
+	if (ps_txn.num_writes == 0)
+		goto done;
+
+	if (ps_journal.fd >= 0) {
+		len = sizeof(struct psjournal_rec) + ps_txn.size;
+		if ((buf = malloc(len)) == NULL) {
+			LogError("malloc of %u bytes failed.", len);
+			result = TCSERR(TSS_E_OUTOFMEMORY);
+			goto done;
+		}
+
+		rec = (struct psjournal_rec *)buf;
+		rec->magic = LE_32(PSJOURNAL_REC_MAGIC);
+		rec->seq = LE_32(ps_journal.seq);
+		rec->num_writes = LE_32(ps_txn.num_writes);
+		rec->size = LE_32(ps_txn.size);
+		rec->reserved = 0;
+
+		for (w = ps_txn.head, p = buf + sizeof(struct psjournal_rec); w; w = w->next) {
+			u32 = LE_32(w->offset);
+			memcpy(p, &u32, sizeof(UINT32));
+			u32 = LE_32(w->size);
+			memcpy(p + sizeof(UINT32), &u32, sizeof(UINT32));
+			memcpy(p + 2 * sizeof(UINT32), w->data, w->size);
+			p += 2 * sizeof(UINT32) + w->size;
+		}
+
+		rec->checksum = LE_32(psjournal_rec_checksum(rec, buf +
+							      sizeof(struct psjournal_rec)));
+
+		if ((result = write_data_at(ps_journal.fd, ps_journal.size, buf, len)))
+			goto err;
+
+		if (fdatasync(ps_journal.fd)) {
+			LogError("fdatasync of the system PS journal failed: %s", strerror(errno));
+			result = TCSERR(TSS_E_INTERNAL_ERROR);
+			goto err;
+		}
+
+		ps_journal.size += len;
+		ps_journal.seq++;
+	}
+
+	/* the change is durable now, a failure from here on is fixed by the replay at the
+	 * next start */
+	for (w = ps_txn.head; w; w = w->next) {
+		if ((result = write_data_at(fd, w->offset, w->data, w->size)))
+			goto done;
+	}
+
+	if (ps_journal.size > PSJOURNAL_CHECKPOINT_SIZE)
+		result = psjournal_checkpoint(fd);
+done:
+	free(buf);
+	psfile_txn_abort();
+
+	return result;
+err:
+	/* don't leave part of a record behind for the next commit to be appended to */
+	if (ftruncate(ps_journal.fd, ps_journal.size))
+		LogError("truncating the system PS journal failed: %s", strerror(errno));
+	goto done;
+}
@@ -13,6 +13,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #if defined(HAVE_BYTEORDER_H)
 #include <sys/byteorder.h>
 #elif defined(HTOLE_DEFINED)
@@ -37,9 +38,20 @@
 #include "tcsps.h"
 #include "tcs_tsp.h"
 #include "tcs_utils.h"
+#include "tcsd_wrap.h"
+#include "tcsd.h"
 #include "tcslog.h"
 
 struct key_disk_cache *key_disk_cache_head = NULL;
+UINT32 psfile_free_bytes = 0;
+
+/* the read-only mapping of the system PS file that lookups go through */
+static struct {
+	BYTE *addr;
+	size_t size;
+	int fd;
+	UINT32 generation;
+} ps_map = { NULL, 0, -1, 0 };
 
 
 #ifdef SOLARIS
@@ -85,140 +97,316 @@ write_data(int fd, void *data, UINT32 size)
 	return TSS_SUCCESS;
 }
 
-/*
- * called by write_key_init to find the next available location in the PS file to
- * write a new key to.
- */
-int
-find_write_offset(UINT32 pub_data_size, UINT32 blob_size, UINT32 vendor_data_size)
+#ifdef SOLARIS
+TSS_RESULT
+#else
+inline TSS_RESULT
+#endif
+read_data_at(int fd, UINT32 offset, void *data, UINT32 size)
 {
-	struct key_disk_cache *tmp;
-	unsigned int offset;
+	ssize_t rc;
 
-	MUTEX_LOCK(disk_cache_lock);
+	rc = pread(fd, data, size, offset);
+	if (rc == -1) {
+		LogError("read of %u bytes at offset %u: %s", size, offset, strerror(errno));
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	} else if ((size_t)rc != size) {
+		LogError("read of %u bytes at offset %u (only %zd read)", size, offset, rc);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
 
-	tmp = key_disk_cache_head;
-	while (tmp) {
-		/* if we find a deleted key of the right size, return its offset */
-		if (!(tmp->flags & CACHE_FLAG_VALID) &&
-		    tmp->pub_data_size == pub_data_size &&
-		    tmp->blob_size == blob_size &&
-		    tmp->vendor_data_size == vendor_data_size) {
-			offset = tmp->offset;
-			MUTEX_UNLOCK(disk_cache_lock);
-			return offset;
-		}
-		tmp = tmp->next;
+	return TSS_SUCCESS;
+}
+
+#ifdef SOLARIS
+TSS_RESULT
+#else
+inline TSS_RESULT
+#endif
+write_data_at(int fd, UINT32 offset, void *data, UINT32 size)
+{
+	ssize_t rc;
+
+	rc = pwrite(fd, data, size, offset);
+	if (rc == -1) {
+		LogError("write of %u bytes at offset %u: %s", size, offset, strerror(errno));
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	} else if ((size_t)rc != size) {
+		LogError("write of %u bytes at offset %u (only %zd written)", size, offset, rc);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
 	}
 
-	MUTEX_UNLOCK(disk_cache_lock);
+	return TSS_SUCCESS;
+}
 
-	/* no correctly sized holes */
-	return -1;
+/*
+ * The system PS file is only written by this process, with the disk cache locked, and every
+ * write bumps the generation in the file's header. Since the mapping is shared, that header
+ * is always current, so a generation that differs from the one the file was mapped at means
+ * the file may have grown and needs mapping again. A rebuild swaps in a new file, which
+ * psfile_map_drop() has to be told about.
+ */
+
+void
+psfile_map_drop()
+{
+	if (ps_map.addr != NULL)
+		munmap(ps_map.addr, ps_map.size);
+
+	ps_map.addr = NULL;
+	ps_map.size = 0;
+	ps_map.fd = -1;
 }
 
 /*
- * move the file pointer to the point where the next key can be written and return
- * that offset
+ * Make sure the mapping of the system PS file open on @fd covers the whole file. If the file
+ * can't be mapped, reads fall back to pread(). The disk cache must be locked by the caller.
  */
-int
-write_key_init(int fd, UINT32 pub_data_size, UINT32 blob_size, UINT32 vendor_data_size)
+void
+psfile_map_sync(int fd)
 {
-	UINT32 num_keys;
-	BYTE version;
-	int rc, offset;
+	struct stat stat_buf;
+	struct tssps2_header *hdr;
+	void *addr;
+
+	if (ps_map.addr != NULL && ps_map.fd == fd) {
+		hdr = (struct tssps2_header *)ps_map.addr;
+		if (LE_32(hdr->generation) == ps_map.generation)
+			return;
+	}
+
+	psfile_map_drop();
 
-	/* seek to the PS version */
-	rc = lseek(fd, TSSPS_VERSION_OFFSET, SEEK_SET);
-	if (rc == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		return -1;
+	if (fstat(fd, &stat_buf)) {
+		LogError("fstat of the system PS file failed: %s", strerror(errno));
+		return;
 	}
 
-	/* go to NUM_KEYS */
-	rc = lseek(fd, TSSPS_NUM_KEYS_OFFSET, SEEK_SET);
-	if (rc == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		return -1;
+	if ((size_t)stat_buf.st_size < sizeof(struct tssps2_header) ||
+	    stat_buf.st_size > UINT_MAX)
+		return;
+
+	addr = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		LogError("mmap of the system PS file failed: %s", strerror(errno));
+		return;
 	}
 
-	/* read the number of keys */
-	rc = read(fd, &num_keys, sizeof(UINT32));
-	num_keys = LE_32(num_keys);
-	if (rc == -1) {
-		LogError("read of %zd bytes: %s", sizeof(UINT32), strerror(errno));
-		return -1;
-	} else if (rc == 0) {
-		/* This is the first key being written */
-		num_keys = 1;
-		version = 1;
-
-		/* seek to the PS version */
-		rc = lseek(fd, TSSPS_VERSION_OFFSET, SEEK_SET);
-		if (rc == ((off_t) - 1)) {
-			LogError("lseek: %s", strerror(errno));
-			return -1;
-		}
+	hdr = (struct tssps2_header *)addr;
+	if (hdr->version != TSSPS_VERSION_2) {
+		munmap(addr, stat_buf.st_size);
+		return;
+	}
 
-		/* write out the version info byte */
-		if ((rc = write_data(fd, &version, sizeof(BYTE)))) {
-			LogError("%s", __FUNCTION__);
-			return rc;
-		}
+	ps_map.addr = addr;
+	ps_map.size = stat_buf.st_size;
+	ps_map.fd = fd;
+	ps_map.generation = LE_32(hdr->generation);
+}
 
-		rc = lseek(fd, TSSPS_NUM_KEYS_OFFSET, SEEK_SET);
-		if (rc == ((off_t) - 1)) {
-			LogError("lseek: %s", strerror(errno));
-			return -1;
-		}
+/*
+ * Return a pointer to @size bytes at @offset in the mapping of the file open on @fd, or NULL
+ * if they aren't mapped. The disk cache must be locked by the caller.
+ */
+BYTE *
+psfile_map_ptr(int fd, UINT32 offset, UINT32 size)
+{
+	if (ps_map.addr == NULL || ps_map.fd != fd || size > ps_map.size ||
+	    offset > ps_map.size - size)
+		return NULL;
 
-                num_keys = LE_32(num_keys);
-		if ((rc = write_data(fd, &num_keys, sizeof(UINT32)))) {
-			LogError("%s", __FUNCTION__);
-			return rc;
+	return ps_map.addr + offset;
+}
+
+/* read_data_at() for the system PS file, copying out of the mapping when it's there. Writes
+ * staged by an open transaction are seen as if they'd been made. */
+TSS_RESULT
+psfile_read_at(int fd, UINT32 offset, void *data, UINT32 size)
+{
+	TSS_RESULT result;
+	ssize_t rc;
+	BYTE *p;
+
+	if ((p = psfile_map_ptr(fd, offset, size)) != NULL) {
+		memcpy(data, p, size);
+	} else if (psfile_txn_active(fd)) {
+		/* records staged by the transaction can lie past the end of the file */
+		if ((rc = pread(fd, data, size, offset)) == -1) {
+			LogError("read of %u bytes at offset %u: %s", size, offset,
+				 strerror(errno));
+			return TCSERR(TSS_E_INTERNAL_ERROR);
 		}
+		memset((BYTE *)data + rc, 0, size - rc);
+	} else if ((result = read_data_at(fd, offset, data, size)))
+		return result;
+
+	psfile_txn_overlay(fd, offset, data, size);
+
+	return TSS_SUCCESS;
+}
+
+/* convert a version 2 header to or from its on-disk byte order */
+void
+psfile_swap_header(struct tssps2_header *hdr)
+{
+	hdr->num_keys = LE_32(hdr->num_keys);
+	hdr->num_buckets = LE_32(hdr->num_buckets);
+	hdr->generation = LE_32(hdr->generation);
+	hdr->free_head = LE_32(hdr->free_head);
+	hdr->end = LE_32(hdr->end);
+}
+
+/* convert a version 2 record header to or from its on-disk byte order */
+void
+psfile_swap_record(struct tssps2_record *rec)
+{
+	rec->rec_size = LE_32(rec->rec_size);
+	rec->vendor_data_size = LE_32(rec->vendor_data_size);
+	rec->pub_data_size = LE_16(rec->pub_data_size);
+	rec->blob_size = LE_16(rec->blob_size);
+	rec->flags = LE_16(rec->flags);
+	rec->next_uuid = LE_32(rec->next_uuid);
+	rec->next_pub = LE_32(rec->next_pub);
+}
+
+TSS_RESULT
+psfile_read_header(int fd, struct tssps2_header *hdr)
+{
+	TSS_RESULT result;
+
+	if ((result = psfile_read_at(fd, 0, hdr, sizeof(struct tssps2_header))))
+		return result;
 
-		/* return the offset */
-		return (TSSPS_NUM_KEYS_OFFSET + sizeof(UINT32));
+	psfile_swap_header(hdr);
+
+	if (hdr->version != TSSPS_VERSION_2 ||
+	    memcmp(hdr->magic, TSSPS2_MAGIC, sizeof(TSSPS2_MAGIC)) ||
+	    hdr->num_buckets == 0 || (hdr->num_buckets & (hdr->num_buckets - 1))) {
+		LogError("System PS file is not a valid version %d PS file.", TSSPS_VERSION_2);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
 	}
 
-	/* if there is a hole in the file we can write to, find it */
-	offset = find_write_offset(pub_data_size, blob_size, vendor_data_size);
-
-	if (offset != -1) {
-		/* we found a hole, seek to it and don't increment the # of keys on disk */
-		rc = lseek(fd, offset, SEEK_SET);
-	} else {
-		/* we didn't find a hole, increment the number of keys on disk and seek
-		 * to the end of the file
-		 */
-		num_keys++;
-
-		/* go to the beginning */
-		rc = lseek(fd, TSSPS_NUM_KEYS_OFFSET, SEEK_SET);
-		if (rc == ((off_t) - 1)) {
-			LogError("lseek: %s", strerror(errno));
-			return -1;
-		}
-                num_keys = LE_32(num_keys);
-		if ((rc = write_data(fd, &num_keys, sizeof(UINT32)))) {
-			LogError("%s", __FUNCTION__);
-			return rc;
-		}
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+psfile_write_header(int fd, struct tssps2_header *hdr)
+{
+	struct tssps2_header tmp;
+
+	memcpy(&tmp, hdr, sizeof(tmp));
+	psfile_swap_header(&tmp);
+
+	return psfile_write_at(fd, 0, &tmp, sizeof(tmp));
+}
+
+TSS_RESULT
+psfile_read_record(int fd, UINT32 offset, struct tssps2_record *rec)
+{
+	TSS_RESULT result;
+
+	if ((result = psfile_read_at(fd, offset, rec, sizeof(struct tssps2_record))))
+		return result;
+
+	psfile_swap_record(rec);
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+psfile_write_record(int fd, UINT32 offset, struct tssps2_record *rec)
+{
+	struct tssps2_record tmp;
 
-		rc = lseek(fd, 0, SEEK_END);
+	memcpy(&tmp, rec, sizeof(tmp));
+	psfile_swap_record(&tmp);
+
+	return psfile_write_at(fd, offset, &tmp, sizeof(tmp));
+}
+
+/* FNV-1a over the UUID */
+UINT32
+psfile_uuid_bucket(TSS_UUID *uuid, UINT32 num_buckets)
+{
+	BYTE *p = (BYTE *)uuid;
+	UINT32 i, h = 2166136261U;
+
+	for (i = 0; i < sizeof(TSS_UUID); i++) {
+		h ^= p[i];
+		h *= 16777619;
 	}
-	if (rc == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		return -1;
+
+	return h & (num_buckets - 1);
+}
+
+/* the digest is already uniformly distributed, just take some of it */
+UINT32
+psfile_pub_bucket(BYTE *digest, UINT32 num_buckets)
+{
+	UINT32 h = digest[0] | (digest[1] << 8) | (digest[2] << 16) | ((UINT32)digest[3] << 24);
+
+	return h & (num_buckets - 1);
+}
+
+TSS_RESULT
+psfile_read_bucket(int fd, struct tssps2_header *hdr, int index, UINT32 bucket, UINT32 *head)
+{
+	TSS_RESULT result;
+
+	if ((result = psfile_read_at(fd, TSSPS2_INDEX_OFFSET(index, hdr->num_buckets) +
+				   bucket * sizeof(UINT32), head, sizeof(UINT32))))
+		return result;
+
+	*head = LE_32(*head);
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+psfile_write_bucket(int fd, struct tssps2_header *hdr, int index, UINT32 bucket, UINT32 head)
+{
+	head = LE_32(head);
+
+	return psfile_write_at(fd, TSSPS2_INDEX_OFFSET(index, hdr->num_buckets) +
+			     bucket * sizeof(UINT32), &head, sizeof(UINT32));
+}
+
+/* smallest power of two number of buckets that keeps the chains shorter than 1 on average
+ * with room to grow */
+UINT32
+psfile_num_buckets(UINT32 num_keys)
+{
+	UINT32 n = TSSPS2_MIN_BUCKETS;
+
+	while (n < 2 * num_keys)
+		n *= 2;
+
+	return n;
+}
+
+/* turn an empty file into an empty version 2 PS file */
+static TSS_RESULT
+psfile_create(int fd)
+{
+	struct tssps2_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = TSSPS_VERSION_2;
+	memcpy(hdr.magic, TSSPS2_MAGIC, sizeof(TSSPS2_MAGIC));
+	hdr.num_buckets = TSSPS2_MIN_BUCKETS;
+	hdr.end = TSSPS2_DATA_OFFSET(hdr.num_buckets);
+
+	/* the empty index is all zeroes */
+	if (ftruncate(fd, hdr.end)) {
+		LogError("ftruncate: %s", strerror(errno));
+		return TCSERR(TSS_E_INTERNAL_ERROR);
 	}
 
-	/* lseek returns the number of bytes of offset from the beginning of the file */
-	return rc;
+	return psfile_write_header(fd, &hdr);
 }
 
 /*
- * add a new cache entry for a written key
+ * add a new cache entry for a written key. The disk cache must be locked by the caller.
  */
 TSS_RESULT
 cache_key(UINT32 offset, UINT16 flags,
@@ -228,31 +416,15 @@ cache_key(UINT32 offset, UINT16 flags,
 {
 	struct key_disk_cache *tmp;
 
-	MUTEX_LOCK(disk_cache_lock);
-
-	tmp = key_disk_cache_head;
-
-	for (; tmp; tmp = tmp->next) {
-		/* reuse an invalidated key cache entry */
-		if (!(tmp->flags & CACHE_FLAG_VALID))
-			goto fill_cache_entry;
-	}
-
 	tmp = malloc(sizeof(struct key_disk_cache));
 	if (tmp == NULL) {
 		LogError("malloc of %zd bytes failed.", sizeof(struct key_disk_cache));
-		MUTEX_UNLOCK(disk_cache_lock);
 		return TCSERR(TSS_E_OUTOFMEMORY);
 	}
 	tmp->next = key_disk_cache_head;
 	key_disk_cache_head = tmp;
 
-fill_cache_entry:
 	tmp->offset = offset;
-#ifdef TSS_DEBUG
-	if (offset == 0)
-		LogDebug("Storing key with file offset==0!!!");
-#endif
 	tmp->flags = flags;
 	tmp->blob_size = blob_size;
 	tmp->pub_data_size = pub_data_size;
@@ -260,38 +432,9 @@ fill_cache_entry:
 	memcpy(&tmp->uuid, uuid, sizeof(TSS_UUID));
 	memcpy(&tmp->parent_uuid, parent_uuid, sizeof(TSS_UUID));
 
-	MUTEX_UNLOCK(disk_cache_lock);
 	return TSS_SUCCESS;
 }
 
-/*
- * read into the PS file and return the number of keys
- */
-int
-get_num_keys_in_file(int fd)
-{
-	UINT32 num_keys;
-	int rc;
-
-	/* go to the number of keys */
-	rc = lseek(fd, TSSPS_NUM_KEYS_OFFSET, SEEK_SET);
-	if (rc == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		return 0;
-	}
-
-	rc = read(fd, &num_keys, sizeof(UINT32));
-	if (rc < 0) {
-		LogError("read of %zd bytes: %s", sizeof(UINT32), strerror(errno));
-		return 0;
-	} else if ((unsigned)rc < sizeof(UINT32)) {
-		num_keys = 0;
-	}
-        num_keys = LE_32(num_keys);
-
-	return num_keys;
-}
-
 /*
  * count the number of valid keys in the cache
  */
@@ -314,223 +457,254 @@ get_num_keys()
 	return num_keys;
 }
 
+/* append @c to the list whose last entry is *@tail */
+static void
+cache_list_append(struct key_disk_cache **head, struct key_disk_cache **tail,
+		  struct key_disk_cache *c)
+{
+	c->next = NULL;
+	if (*tail)
+		(*tail)->next = c;
+	else
+		*head = c;
+	*tail = c;
+}
+
+void
+free_cache_list(struct key_disk_cache *list)
+{
+	struct key_disk_cache *next;
+
+	for (; list; list = next) {
+		next = list->next;
+		free(list);
+	}
+}
+
 /*
- * disk store format:
- *
- * TrouSerS 0.2.0 and before:
- * Version 0:                  cached?
- * [UINT32   num_keys_on_disk]
- * [TSS_UUID uuid0           ] yes
- * [TSS_UUID uuid_parent0    ] yes
- * [UINT16   pub_data_size0  ] yes
- * [UINT16   blob_size0      ] yes
- * [UINT16   cache_flags0    ] yes
- * [BYTE[]   pub_data0       ]
- * [BYTE[]   blob0           ]
- * [...]
- *
- * TrouSerS 0.2.1+
- * Version 1:                  cached?
- * [BYTE     PS version = '\1']
- * [UINT32   num_keys_on_disk ]
- * [TSS_UUID uuid0            ] yes
- * [TSS_UUID uuid_parent0     ] yes
- * [UINT16   pub_data_size0   ] yes
- * [UINT16   blob_size0       ] yes
- * [UINT32   vendor_data_size0] yes
- * [UINT16   cache_flags0     ] yes
- * [BYTE[]   pub_data0        ]
- * [BYTE[]   blob0            ]
- * [BYTE[]   vendor_data0     ]
- * [...]
- *
- */
-/*
- * read the PS file pointed to by fd and create a cache based on it
+ * Read the keys of a version 1 PS file (see tcs_tsp.h) into @list, so that it can be written
+ * back out in the current format. Keys that were marked invalid are left out.
  */
-int
-init_disk_cache(int fd)
+static int
+psfile_v1_load(int fd, struct key_disk_cache **list, UINT32 *num)
 {
-	UINT32 num_keys = get_num_keys_in_file(fd);
-	UINT16 i;
-	UINT64 tmp_offset;
-	int rc = 0, offset;
-	struct key_disk_cache *tmp, *prev = NULL;
-	BYTE srk_blob[2048];
-	TSS_KEY srk_key;
-#ifdef TSS_DEBUG
-	int valid_keys = 0;
-#endif
+	BYTE buf[(2 * sizeof(TSS_UUID)) + (3 * sizeof(UINT16)) + sizeof(UINT32)];
+	struct key_disk_cache *tmp, *tail = NULL;
+	UINT32 num_keys, offset = TSSPS_KEYS_OFFSET, i;
+	UINT16 u16;
+	UINT32 u32;
+	int rc;
 
-	MUTEX_LOCK(disk_cache_lock);
+	*list = NULL;
+	*num = 0;
 
-	if (num_keys == 0) {
-		key_disk_cache_head = NULL;
-		MUTEX_UNLOCK(disk_cache_lock);
-		return 0;
-	} else {
-		key_disk_cache_head = tmp = calloc(1, sizeof(struct key_disk_cache));
-		if (tmp == NULL) {
-			LogError("malloc of %zd bytes failed.",
-						sizeof(struct key_disk_cache));
-			rc = -1;
-			goto err_exit;
-		}
-	}
+	if ((rc = read_data_at(fd, TSSPS_NUM_KEYS_OFFSET, &num_keys, sizeof(UINT32))))
+		return rc;
+	num_keys = LE_32(num_keys);
 
-	/* make sure the file pointer is where we expect, just after the number
-	 * of keys on disk at the head of the file
-	 */
-	offset = lseek(fd, TSSPS_KEYS_OFFSET, SEEK_SET);
-	if (offset == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		rc = -1;
-		goto err_exit;
-	}
+	for (i = 0; i < num_keys; i++) {
+		if ((rc = read_data_at(fd, offset, buf, sizeof(buf))))
+			goto err_exit;
 
-	for (i=0; i<num_keys; i++) {
-		offset = lseek(fd, 0, SEEK_CUR);
-		if (offset == ((off_t) - 1)) {
-			LogError("lseek: %s", strerror(errno));
-			rc = -1;
+		if ((tmp = calloc(1, sizeof(struct key_disk_cache))) == NULL) {
+			LogError("malloc of %zd bytes failed.", sizeof(struct key_disk_cache));
+			rc = TCSERR(TSS_E_OUTOFMEMORY);
 			goto err_exit;
 		}
+
 		tmp->offset = offset;
-#ifdef TSS_DEBUG
-		if (offset == 0)
-			LogDebug("Storing key with file offset==0!!!");
-#endif
-		/* read UUID */
-		if ((rc = read_data(fd, (void *)&tmp->uuid, sizeof(TSS_UUID)))) {
-			LogError("%s", __FUNCTION__);
-			goto err_exit;
+		memcpy(&tmp->uuid, buf, sizeof(TSS_UUID));
+		memcpy(&tmp->parent_uuid, &buf[sizeof(TSS_UUID)], sizeof(TSS_UUID));
+		memcpy(&u16, &buf[2 * sizeof(TSS_UUID)], sizeof(UINT16));
+		tmp->pub_data_size = LE_16(u16);
+		memcpy(&u16, &buf[(2 * sizeof(TSS_UUID)) + sizeof(UINT16)], sizeof(UINT16));
+		tmp->blob_size = LE_16(u16);
+		memcpy(&u32, &buf[(2 * sizeof(TSS_UUID)) + (2 * sizeof(UINT16))], sizeof(UINT32));
+		tmp->vendor_data_size = LE_32(u32);
+		memcpy(&u16, &buf[(2 * sizeof(TSS_UUID)) + (2 * sizeof(UINT16)) + sizeof(UINT32)],
+		       sizeof(UINT16));
+		tmp->flags = LE_16(u16);
+
+		offset = TSSPS_VENDOR_DATA_OFFSET(tmp) + tmp->vendor_data_size;
+
+		if (!(tmp->flags & CACHE_FLAG_VALID)) {
+			free(tmp);
+			continue;
 		}
 
-		/* read parent UUID */
-		if ((rc = read_data(fd, (void *)&tmp->parent_uuid, sizeof(TSS_UUID)))) {
-			LogError("%s", __FUNCTION__);
-			goto err_exit;
-		}
+		cache_list_append(list, &tail, tmp);
+		(*num)++;
+	}
 
-		/* pub data size */
-		if ((rc = read_data(fd, &tmp->pub_data_size, sizeof(UINT16)))) {
-			LogError("%s", __FUNCTION__);
-			goto err_exit;
-		}
-                tmp->pub_data_size = LE_16(tmp->pub_data_size);
+	return 0;
 
-		DBG_ASSERT(tmp->pub_data_size <= 2048 && tmp->pub_data_size > 0);
+err_exit:
+	free_cache_list(*list);
+	*list = NULL;
+	return rc;
+}
 
-		/* blob size */
-		if ((rc = read_data(fd, &tmp->blob_size, sizeof(UINT16)))) {
-			LogError("%s", __FUNCTION__);
+/* The SRK is already loaded in the chip, so put it in the mem cache */
+static int
+psfile_cache_srk(int fd, struct key_disk_cache *c)
+{
+	BYTE srk_blob[2048];
+	TSS_KEY srk_key;
+	UINT64 tmp_offset = 0;
+	int rc;
+
+	if (c->blob_size > sizeof(srk_blob)) {
+		LogError("SRK blob size %u is too large.", c->blob_size);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	if ((rc = psfile_read_at(fd, TSSPS2_BLOB_DATA_OFFSET(c), srk_blob, c->blob_size)))
+		return rc;
+
+	if ((rc = UnloadBlob_TSS_KEY(&tmp_offset, srk_blob, &srk_key)))
+		return rc;
+
+	if ((rc = mc_add_entry_init(SRK_TPM_HANDLE, SRK_TPM_HANDLE, &srk_key, &SRK_UUID)))
+		LogError("Error adding SRK to mem cache.");
+
+	destroy_key_refs(&srk_key);
+
+	return rc;
+}
+
+/*
+ * Read the keys of a version 2 PS file into the disk cache. Removed keys' records are on
+ * the free list and are skipped.
+ */
+static int
+psfile_v2_load(int fd)
+{
+	struct tssps2_header hdr;
+	struct tssps2_record rec;
+	struct key_disk_cache *tmp, *tail = NULL;
+	UINT32 offset;
+	int rc;
+
+	psfile_map_sync(fd);
+	psfile_free_bytes = 0;
+
+	if ((rc = psfile_read_header(fd, &hdr)))
+		return rc;
+
+	for (offset = TSSPS2_DATA_OFFSET(hdr.num_buckets); offset < hdr.end;
+	     offset += rec.rec_size) {
+		if ((rc = psfile_read_record(fd, offset, &rec)))
 			goto err_exit;
-		}
-                tmp->blob_size = LE_16(tmp->blob_size);
-		DBG_ASSERT(tmp->blob_size <= 4096 && tmp->blob_size > 0);
 
-		/* vendor data size */
-		if ((rc = read_data(fd, &tmp->vendor_data_size, sizeof(UINT32)))) {
-			LogError("%s", __FUNCTION__);
+		if (rec.rec_size > hdr.end - offset ||
+		    rec.rec_size < sizeof(rec) + rec.pub_data_size + rec.blob_size +
+				   rec.vendor_data_size) {
+			LogError("Corrupt record at offset %u of the system PS file.", offset);
+			rc = TCSERR(TSS_E_INTERNAL_ERROR);
 			goto err_exit;
 		}
-                tmp->vendor_data_size = LE_32(tmp->vendor_data_size);
 
-		/* cache flags */
-		if ((rc = read_data(fd, &tmp->flags, sizeof(UINT16)))) {
-			LogError("%s", __FUNCTION__);
-			goto err_exit;
+		if (!(rec.flags & CACHE_FLAG_VALID)) {
+			psfile_free_bytes += rec.rec_size;
+			continue;
 		}
-                tmp->flags = LE_16(tmp->flags);
 
-#ifdef TSS_DEBUG
-		if (tmp->flags & CACHE_FLAG_VALID)
-			valid_keys++;
-#endif
-		/* fast forward over the pub key */
-		offset = lseek(fd, tmp->pub_data_size, SEEK_CUR);
-		if (offset == ((off_t) - 1)) {
-			LogError("lseek: %s", strerror(errno));
-			rc = -1;
+		if ((tmp = calloc(1, sizeof(struct key_disk_cache))) == NULL) {
+			LogError("malloc of %zd bytes failed.", sizeof(struct key_disk_cache));
+			rc = TCSERR(TSS_E_OUTOFMEMORY);
 			goto err_exit;
 		}
 
-		/* if this is the SRK, load it into memory, since its already loaded in
-		 * the chip */
-		if (!memcmp(&SRK_UUID, &tmp->uuid, sizeof(TSS_UUID))) {
-			/* read SRK blob from disk */
-			if ((rc = read_data(fd, srk_blob, tmp->blob_size))) {
-				LogError("%s", __FUNCTION__);
-				goto err_exit;
-			}
-
-			tmp_offset = 0;
-			if ((rc = UnloadBlob_TSS_KEY(&tmp_offset, srk_blob, &srk_key)))
-				goto err_exit;
-			/* add to the mem cache */
-			if ((rc = mc_add_entry_init(SRK_TPM_HANDLE, SRK_TPM_HANDLE, &srk_key,
-						    &SRK_UUID))) {
-				LogError("Error adding SRK to mem cache.");
-				destroy_key_refs(&srk_key);
-				goto err_exit;
-			}
-			destroy_key_refs(&srk_key);
-		} else {
-			/* fast forward over the blob */
-			offset = lseek(fd, tmp->blob_size, SEEK_CUR);
-			if (offset == ((off_t) - 1)) {
-				LogError("lseek: %s", strerror(errno));
-				rc = -1;
-				goto err_exit;
-			}
-
-			/* fast forward over the vendor data */
-			offset = lseek(fd, tmp->vendor_data_size, SEEK_CUR);
-			if (offset == ((off_t) - 1)) {
-				LogError("lseek: %s", strerror(errno));
-				rc = -1;
-				goto err_exit;
-			}
-		}
+		tmp->offset = offset;
+		tmp->pub_data_size = rec.pub_data_size;
+		tmp->blob_size = rec.blob_size;
+		tmp->vendor_data_size = rec.vendor_data_size;
+		tmp->flags = rec.flags;
+		memcpy(&tmp->uuid, &rec.uuid, sizeof(TSS_UUID));
+		memcpy(&tmp->parent_uuid, &rec.parent_uuid, sizeof(TSS_UUID));
 
-		tmp->next = calloc(1, sizeof(struct key_disk_cache));
-		if (tmp->next == NULL) {
-			LogError("malloc of %zd bytes failed.",
-					sizeof(struct key_disk_cache));
-			rc = -1;
+		cache_list_append(&key_disk_cache_head, &tail, tmp);
+
+		if (!memcmp(&SRK_UUID, &tmp->uuid, sizeof(TSS_UUID)) &&
+		    (rc = psfile_cache_srk(fd, tmp)))
 			goto err_exit;
-		}
-		prev = tmp;
-		tmp = tmp->next;
 	}
 
-	/* delete the dangling, unfilled cache entry */
-	free(tmp);
-	prev->next = NULL;
-	rc = 0;
-	LogDebug("%s: found %d valid key(s) on disk.\n", __FUNCTION__, valid_keys);
+	LogDebug("%s: found %u valid key(s) on disk.\n", __FUNCTION__, hdr.num_keys);
+
+	return 0;
 
 err_exit:
-	MUTEX_UNLOCK(disk_cache_lock);
+	free_cache_list(key_disk_cache_head);
+	key_disk_cache_head = NULL;
 	return rc;
 }
 
+/*
+ * read the PS file pointed to by fd and create a cache based on it. A PS file written by an
+ * older version of the tcsd is upgraded to version 2 first, use ps_convert to go back. The
+ * PS file's journal is replayed before anything else.
+ */
 int
-close_disk_cache(int fd)
+init_disk_cache(int fd)
 {
-	struct key_disk_cache *tmp, *tmp_next;
+	struct key_disk_cache *list;
+	struct stat stat_buf;
+	UINT32 num_keys;
+	BYTE version;
+	int rc;
+
+	if (fstat(fd, &stat_buf)) {
+		LogError("fstat: %s", strerror(errno));
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	/* finish off the writes that were in flight when the tcsd last stopped. A journal
+	 * left behind by a PS file that's since been deleted is thrown away */
+	if ((rc = psjournal_open(fd, stat_buf.st_size != 0)))
+		return rc;
+
+	if (stat_buf.st_size == 0) {
+		key_disk_cache_head = NULL;
+		return psfile_create(fd);
+	}
+
+	if ((rc = read_data_at(fd, TSSPS_VERSION_OFFSET, &version, sizeof(BYTE))))
+		return rc;
 
-	if (key_disk_cache_head == NULL)
-		return 0;
+	if (version == TSSPS_VERSION) {
+		LogInfo("Upgrading system PS file %s to version %d.", tcsd_options.system_ps_file,
+			TSSPS_VERSION_2);
+
+		if ((rc = psfile_v1_load(fd, &list, &num_keys)))
+			return rc;
+
+		rc = psfile_rebuild(fd, list, TSSPS_VERSION, psfile_num_buckets(num_keys));
+		free_cache_list(list);
+		if (rc)
+			return rc;
+	} else if (version != TSSPS_VERSION_2) {
+		LogError("System PS file %s has unknown version %u. Use ps_convert to update it.",
+			 tcsd_options.system_ps_file, version);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
 
 	MUTEX_LOCK(disk_cache_lock);
-	tmp = key_disk_cache_head;
+	rc = psfile_v2_load(fd);
+	MUTEX_UNLOCK(disk_cache_lock);
+
+	return rc;
+}
+
+int
+close_disk_cache(int fd)
+{
+	MUTEX_LOCK(disk_cache_lock);
 
-	do {
-		tmp_next = tmp->next;
-		free(tmp);
-		tmp = tmp_next;
-	} while (tmp);
+	free_cache_list(key_disk_cache_head);
+	key_disk_cache_head = NULL;
+	psfile_map_drop();
+	psjournal_close(fd);
 
 	MUTEX_UNLOCK(disk_cache_lock);
 
@@ -99,6 +99,27 @@ put_file(int fd)
 	return rc;
 }
 
+/*
+ * Lookups read the system PS file through its mapping with the disk cache locked, and since
+ * the writers in this process hold that lock too, they can skip the file lock. The fcntl lock
+ * is still what keeps writers in other processes out.
+ */
+int
+get_file_nolock()
+{
+	int fd;
+
+	if (system_ps_fd != -1)
+		return system_ps_fd;
+
+	if ((fd = get_file()) < 0)
+		return -1;
+
+	put_file(fd);
+
+	return fd;
+}
+
 void
 close_file(int fd)
 {
@@ -106,44 +127,135 @@ close_file(int fd)
 	system_ps_fd = -1;
 }
 
+/* The offset of the record that links to the next one in a hash chain */
+#define TSSPS2_NEXT(rec, index)	(*((index) == TSSPS2_INDEX_UUID ? &(rec)->next_uuid : \
+							 &(rec)->next_pub))
+
+/*
+ * Find the record of the registered key @uuid through the file's UUID index. The disk cache
+ * must be locked by the caller.
+ */
+static TSS_RESULT
+psfile_find_by_uuid(int fd, struct tssps2_header *hdr, TSS_UUID *uuid, UINT32 *offset,
+		    struct tssps2_record *rec)
+{
+	TSS_RESULT result;
+	UINT32 off, hops = 0;
+
+	if ((result = psfile_read_bucket(fd, hdr, TSSPS2_INDEX_UUID,
+					 psfile_uuid_bucket(uuid, hdr->num_buckets), &off)))
+		return result;
+
+	for (; off; off = rec->next_uuid) {
+		if (hops++ > hdr->num_keys) {
+			LogError("Loop in the UUID index of the system PS file.");
+			return TCSERR(TSS_E_INTERNAL_ERROR);
+		}
+
+		if ((result = psfile_read_record(fd, off, rec)))
+			return result;
+
+		if ((rec->flags & CACHE_FLAG_VALID) &&
+		    !memcmp(uuid, &rec->uuid, sizeof(TSS_UUID))) {
+			*offset = off;
+			return TSS_SUCCESS;
+		}
+	}
+
+	return TCSERR(TSS_E_PS_KEY_NOTFOUND);
+}
+
+/*
+ * Find the record of the registered key with public key @pub through the file's public key
+ * index. Only a record whose digest matches has its public key read back to compare. The
+ * disk cache must be locked by the caller.
+ */
+static TSS_RESULT
+psfile_find_by_pub(int fd, struct tssps2_header *hdr, TCPA_STORE_PUBKEY *pub, UINT32 *offset,
+		   struct tssps2_record *rec)
+{
+	TSS_RESULT result;
+	BYTE digest[TPM_SHA1_160_HASH_LEN], *tmp_buffer, *p;
+	UINT32 off, hops = 0;
+
+	if ((result = Hash(TSS_HASH_SHA1, pub->keyLength, pub->key, digest)))
+		return result;
+
+	if ((result = psfile_read_bucket(fd, hdr, TSSPS2_INDEX_PUB,
+					 psfile_pub_bucket(digest, hdr->num_buckets), &off)))
+		return result;
+
+	for (; off; off = rec->next_pub) {
+		if (hops++ > hdr->num_keys) {
+			LogError("Loop in the public key index of the system PS file.");
+			return TCSERR(TSS_E_INTERNAL_ERROR);
+		}
+
+		if ((result = psfile_read_record(fd, off, rec)))
+			return result;
+
+		if (!(rec->flags & CACHE_FLAG_VALID) || rec->pub_data_size != pub->keyLength ||
+		    memcmp(digest, rec->pub_digest, sizeof(digest)))
+			continue;
+
+		/* do the compare, in place if the record is mapped and no transaction has writes
+		 * staged over it */
+		if (!psfile_txn_active(fd) &&
+		    (p = psfile_map_ptr(fd, off + sizeof(struct tssps2_record),
+					rec->pub_data_size)) != NULL) {
+			if (memcmp(p, pub->key, rec->pub_data_size))
+				continue;
+
+			*offset = off;
+			return TSS_SUCCESS;
+		}
+
+		if ((tmp_buffer = malloc(rec->pub_data_size)) == NULL) {
+			LogError("malloc of %u bytes failed.", rec->pub_data_size);
+			return TCSERR(TSS_E_OUTOFMEMORY);
+		}
+
+		if ((result = psfile_read_at(fd, off + sizeof(struct tssps2_record), tmp_buffer,
+					     rec->pub_data_size))) {
+			free(tmp_buffer);
+			return result;
+		}
+
+		if (memcmp(tmp_buffer, pub->key, rec->pub_data_size)) {
+			free(tmp_buffer);
+			continue;
+		}
+
+		free(tmp_buffer);
+		*offset = off;
+		return TSS_SUCCESS;
+	}
+
+	return TCSERR(TSS_E_PS_KEY_NOTFOUND);
+}
+
 TSS_RESULT
 psfile_get_parent_uuid_by_uuid(int fd, TSS_UUID *uuid, TSS_UUID *ret_uuid)
 {
-        int rc;
-        UINT32 file_offset = 0;
-        struct key_disk_cache *tmp;
-
-        MUTEX_LOCK(disk_cache_lock);
-        tmp = key_disk_cache_head;
-
-        while (tmp) {
-                if (memcmp(uuid, &tmp->uuid, sizeof(TSS_UUID)) || !(tmp->flags & CACHE_FLAG_VALID)) {
-                        tmp = tmp->next;
-                        continue;
-                }
-
-                /* jump to the location of the parent uuid */
-                file_offset = TSSPS_PARENT_UUID_OFFSET(tmp);
-
-                rc = lseek(fd, file_offset, SEEK_SET);
-                if (rc == ((off_t) - 1)) {
-                        LogError("lseek: %s", strerror(errno));
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return -1;
-                }
-
-                if ((rc = read_data(fd, ret_uuid, sizeof(TSS_UUID)))) {
-			LogError("%s", __FUNCTION__);
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return rc;
-                }
-
-                MUTEX_UNLOCK(disk_cache_lock);
-                return TSS_SUCCESS;
-        }
-        MUTEX_UNLOCK(disk_cache_lock);
-        /* key not found */
-        return -2;
+	struct tssps2_header hdr;
+	struct tssps2_record rec;
+	UINT32 offset;
+	TSS_RESULT result;
+
+	MUTEX_LOCK(disk_cache_lock);
+	psfile_map_sync(fd);
+
+	if ((result = psfile_read_header(fd, &hdr)) ||
+	    (result = psfile_find_by_uuid(fd, &hdr, uuid, &offset, &rec))) {
+		MUTEX_UNLOCK(disk_cache_lock);
+		/* key not found */
+		return (TSS_ERROR_CODE(result) == TSS_E_PS_KEY_NOTFOUND) ? -2 : -1;
+	}
+
+	memcpy(ret_uuid, &rec.parent_uuid, sizeof(TSS_UUID));
+
+	MUTEX_UNLOCK(disk_cache_lock);
+	return TSS_SUCCESS;
 }
 
 /*
@@ -152,49 +264,38 @@ psfile_get_parent_uuid_by_uuid(int fd, TSS_UUID *uuid, TSS_UUID *ret_uuid)
 TSS_RESULT
 psfile_get_key_by_uuid(int fd, TSS_UUID *uuid, BYTE *ret_buffer, UINT16 *ret_buffer_size)
 {
-        int rc;
-        UINT32 file_offset = 0;
-        struct key_disk_cache *tmp;
-
-        MUTEX_LOCK(disk_cache_lock);
-        tmp = key_disk_cache_head;
-
-        while (tmp) {
-                if (memcmp(uuid, &tmp->uuid, sizeof(TSS_UUID)) || !(tmp->flags & CACHE_FLAG_VALID)) {
-                        tmp = tmp->next;
-                        continue;
-                }
-
-                /* jump to the location of the key blob */
-                file_offset = TSSPS_BLOB_DATA_OFFSET(tmp);
-
-                rc = lseek(fd, file_offset, SEEK_SET);
-                if (rc == ((off_t) - 1)) {
-                        LogError("lseek: %s", strerror(errno));
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return TCSERR(TSS_E_INTERNAL_ERROR);
-                }
-
-                /* we found the key; file ptr is pointing at the blob */
-                if (*ret_buffer_size < tmp->blob_size) {
-                        /* not enough room */
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return TCSERR(TSS_E_FAIL);
-                }
-
-                if ((rc = read_data(fd, ret_buffer, tmp->blob_size))) {
-			LogError("%s", __FUNCTION__);
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return rc;
-                }
-		*ret_buffer_size = tmp->blob_size;
-		LogDebugUnrollKey(ret_buffer);
-                MUTEX_UNLOCK(disk_cache_lock);
-                return TSS_SUCCESS;
-        }
-        MUTEX_UNLOCK(disk_cache_lock);
-        /* key not found */
-        return TCSERR(TSS_E_FAIL);
+	struct tssps2_header hdr;
+	struct tssps2_record rec;
+	UINT32 offset;
+	TSS_RESULT result;
+
+	MUTEX_LOCK(disk_cache_lock);
+	psfile_map_sync(fd);
+
+	if ((result = psfile_read_header(fd, &hdr)) ||
+	    (result = psfile_find_by_uuid(fd, &hdr, uuid, &offset, &rec))) {
+		MUTEX_UNLOCK(disk_cache_lock);
+		/* key not found */
+		return TCSERR(TSS_E_FAIL);
+	}
+
+	if (*ret_buffer_size < rec.blob_size) {
+		/* not enough room */
+		MUTEX_UNLOCK(disk_cache_lock);
+		return TCSERR(TSS_E_FAIL);
+	}
+
+	if ((result = psfile_read_at(fd, offset + sizeof(rec) + rec.pub_data_size, ret_buffer,
+				   rec.blob_size))) {
+		LogError("%s", __FUNCTION__);
+		MUTEX_UNLOCK(disk_cache_lock);
+		return result;
+	}
+	*ret_buffer_size = rec.blob_size;
+	LogDebugUnrollKey(ret_buffer);
+
+	MUTEX_UNLOCK(disk_cache_lock);
+	return TSS_SUCCESS;
 }
 
 /*
@@ -205,19 +306,6 @@ TSS_RESULT
 psfile_get_key_by_cache_entry(int fd, struct key_disk_cache *c, BYTE *ret_buffer,
 			  UINT16 *ret_buffer_size)
 {
-        int rc;
-        UINT32 file_offset = 0;
-
-	/* jump to the location of the key blob */
-	file_offset = TSSPS_BLOB_DATA_OFFSET(c);
-
-	rc = lseek(fd, file_offset, SEEK_SET);
-	if (rc == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		return TCSERR(TSS_E_INTERNAL_ERROR);
-	}
-
-	/* we found the key; file ptr is pointing at the blob */
 	if (*ret_buffer_size < c->blob_size) {
 		/* not enough room */
 		LogError("%s: Buf size too small. Needed %d bytes, passed %d", __FUNCTION__,
@@ -225,7 +313,9 @@ psfile_get_key_by_cache_entry(int fd, struct key_disk_cache *c, BYTE *ret_buffer
 		return TCSERR(TSS_E_INTERNAL_ERROR);
 	}
 
-	if ((rc = read_data(fd, ret_buffer, c->blob_size))) {
+	psfile_map_sync(fd);
+
+	if (psfile_read_at(fd, TSSPS2_BLOB_DATA_OFFSET(c), ret_buffer, c->blob_size)) {
 		LogError("%s: error reading %d bytes", __FUNCTION__, c->blob_size);
 		return TCSERR(TSS_E_INTERNAL_ERROR);
 	}
@@ -241,24 +331,14 @@ psfile_get_key_by_cache_entry(int fd, struct key_disk_cache *c, BYTE *ret_buffer
 TSS_RESULT
 psfile_get_vendor_data(int fd, struct key_disk_cache *c, UINT32 *size, BYTE **data)
 {
-        int rc;
-        UINT32 file_offset;
-
-	/* jump to the location of the data */
-	file_offset = TSSPS_VENDOR_DATA_OFFSET(c);
-
-	rc = lseek(fd, file_offset, SEEK_SET);
-	if (rc == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		return TCSERR(TSS_E_INTERNAL_ERROR);
-	}
-
 	if ((*data = malloc(c->vendor_data_size)) == NULL) {
 		LogError("malloc of %u bytes failed", c->vendor_data_size);
 		return TCSERR(TSS_E_OUTOFMEMORY);
 	}
 
-	if ((rc = read_data(fd, *data, c->vendor_data_size))) {
+	psfile_map_sync(fd);
+
+	if (psfile_read_at(fd, TSSPS2_VENDOR_DATA_OFFSET(c), *data, c->vendor_data_size)) {
 		LogError("%s: error reading %u bytes", __FUNCTION__, c->vendor_data_size);
 		free(*data);
 		*data = NULL;
@@ -272,27 +352,20 @@ psfile_get_vendor_data(int fd, struct key_disk_cache *c, UINT32 *size, BYTE **da
 TSS_RESULT
 psfile_get_ps_type_by_uuid(int fd, TSS_UUID *uuid, UINT32 *ret_ps_type)
 {
-	struct key_disk_cache *tmp;
+	struct tssps2_header hdr;
+	struct tssps2_record rec;
+	UINT32 offset;
 
 	MUTEX_LOCK(disk_cache_lock);
-	tmp = key_disk_cache_head;
-
-        while (tmp) {
-		if (memcmp(uuid, &tmp->uuid, sizeof(TSS_UUID)) ||
-		    !(tmp->flags & CACHE_FLAG_VALID)) {
-			tmp = tmp->next;
-			continue;
-                }
+	psfile_map_sync(fd);
 
-		if (tmp->flags & CACHE_FLAG_PARENT_PS_SYSTEM) {
-			*ret_ps_type = TSS_PS_TYPE_SYSTEM;
-			goto done;
-		} else
-			break;
-        }
+	if (!psfile_read_header(fd, &hdr) &&
+	    !psfile_find_by_uuid(fd, &hdr, uuid, &offset, &rec) &&
+	    (rec.flags & CACHE_FLAG_PARENT_PS_SYSTEM))
+		*ret_ps_type = TSS_PS_TYPE_SYSTEM;
+	else
+		*ret_ps_type = TSS_PS_TYPE_USER;
 
-	*ret_ps_type = TSS_PS_TYPE_USER;
-done:
 	MUTEX_UNLOCK(disk_cache_lock);
 	return TSS_SUCCESS;
 }
@@ -300,257 +373,410 @@ done:
 TSS_RESULT
 psfile_is_pub_registered(int fd, TCPA_STORE_PUBKEY *pub, TSS_BOOL *is_reg)
 {
-        int rc;
-        UINT32 file_offset = 0;
-        struct key_disk_cache *tmp;
-	char tmp_buffer[2048];
-
-        MUTEX_LOCK(disk_cache_lock);
-        tmp = key_disk_cache_head;
-
-        while (tmp) {
-		/* if the key is of the wrong size or is invalid, try the next one */
-                if (pub->keyLength != tmp->pub_data_size || !(tmp->flags & CACHE_FLAG_VALID)) {
-                        tmp = tmp->next;
-                        continue;
-                }
-
-		/* we have a valid key with the same key size as the one we're looking for.
-		 * grab the pub key data off disk and compare it. */
-
-                /* jump to the location of the public key */
-                file_offset = TSSPS_PUB_DATA_OFFSET(tmp);
-
-                rc = lseek(fd, file_offset, SEEK_SET);
-                if (rc == ((off_t) - 1)) {
-                        LogError("lseek: %s", strerror(errno));
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return TCSERR(TSS_E_INTERNAL_ERROR);
-                }
-
-		DBG_ASSERT(tmp->pub_data_size < 2048);
-
-		/* read in the key */
-                if ((rc = read_data(fd, tmp_buffer, tmp->pub_data_size))) {
-			LogError("%s", __FUNCTION__);
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return rc;
-                }
+	struct tssps2_header hdr;
+	struct tssps2_record rec;
+	UINT32 offset;
+	TSS_RESULT result;
 
-		/* do the compare */
-		if (memcmp(tmp_buffer, pub->key, tmp->pub_data_size)) {
-			tmp = tmp->next;
-			continue;
-		}
+	MUTEX_LOCK(disk_cache_lock);
+	psfile_map_sync(fd);
 
-		/* the key matches, copy the uuid out */
-		*is_reg = TRUE;
+	if ((result = psfile_read_header(fd, &hdr)))
+		goto done;
 
-                MUTEX_UNLOCK(disk_cache_lock);
-                return TSS_SUCCESS;
-        }
-        MUTEX_UNLOCK(disk_cache_lock);
-        /* key not found */
-	*is_reg = FALSE;
-        return TSS_SUCCESS;
+	result = psfile_find_by_pub(fd, &hdr, pub, &offset, &rec);
+	if (result == TSS_SUCCESS) {
+		*is_reg = TRUE;
+	} else if (TSS_ERROR_CODE(result) == TSS_E_PS_KEY_NOTFOUND) {
+		/* key not found */
+		*is_reg = FALSE;
+		result = TSS_SUCCESS;
+	}
+done:
+	MUTEX_UNLOCK(disk_cache_lock);
+	return result;
 }
 
-
 TSS_RESULT
 psfile_get_uuid_by_pub(int fd, TCPA_STORE_PUBKEY *pub, TSS_UUID **ret_uuid)
 {
-        int rc;
-        UINT32 file_offset = 0;
-        struct key_disk_cache *tmp;
-	char tmp_buffer[2048];
-
-        MUTEX_LOCK(disk_cache_lock);
-        tmp = key_disk_cache_head;
-
-        while (tmp) {
-		/* if the key is of the wrong size or is invalid, try the next one */
-                if (pub->keyLength != tmp->pub_data_size || !(tmp->flags & CACHE_FLAG_VALID)) {
-                        tmp = tmp->next;
-                        continue;
-                }
-
-		/* we have a valid key with the same key size as the one we're looking for.
-		 * grab the pub key data off disk and compare it. */
-
-                /* jump to the location of the public key */
-                file_offset = TSSPS_PUB_DATA_OFFSET(tmp);
-
-                rc = lseek(fd, file_offset, SEEK_SET);
-                if (rc == ((off_t) - 1)) {
-                        LogError("lseek: %s", strerror(errno));
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return TCSERR(TSS_E_INTERNAL_ERROR);
-                }
-
-		DBG_ASSERT(tmp->pub_data_size < 2048);
-
-		if (tmp->pub_data_size > sizeof(tmp_buffer)) {
-			LogError("Source buffer size too big! Size:  %d",
-				 tmp->pub_data_size);
-			MUTEX_UNLOCK(disk_cache_lock);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-		/* read in the key */
-                if ((rc = read_data(fd, tmp_buffer, tmp->pub_data_size))) {
-			LogError("%s", __FUNCTION__);
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return rc;
-                }
+	struct tssps2_header hdr;
+	struct tssps2_record rec;
+	UINT32 offset;
+	TSS_RESULT result;
 
-		/* do the compare */
-		if (memcmp(tmp_buffer, pub->key, tmp->pub_data_size)) {
-			tmp = tmp->next;
-			continue;
-		}
+	MUTEX_LOCK(disk_cache_lock);
+	psfile_map_sync(fd);
 
-		*ret_uuid = (TSS_UUID *)malloc(sizeof(TSS_UUID));
-		if (*ret_uuid == NULL) {
-			LogError("malloc of %zd bytes failed.", sizeof(TSS_UUID));
-                        MUTEX_UNLOCK(disk_cache_lock);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
+	if ((result = psfile_read_header(fd, &hdr)) ||
+	    (result = psfile_find_by_pub(fd, &hdr, pub, &offset, &rec))) {
+		MUTEX_UNLOCK(disk_cache_lock);
+		return result;
+	}
+
+	*ret_uuid = (TSS_UUID *)malloc(sizeof(TSS_UUID));
+	if (*ret_uuid == NULL) {
+		LogError("malloc of %zd bytes failed.", sizeof(TSS_UUID));
+		MUTEX_UNLOCK(disk_cache_lock);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
 
-		/* the key matches, copy the uuid out */
-		memcpy(*ret_uuid, &tmp->uuid, sizeof(TSS_UUID));
+	/* the key matches, copy the uuid out */
+	memcpy(*ret_uuid, &rec.uuid, sizeof(TSS_UUID));
 
-                MUTEX_UNLOCK(disk_cache_lock);
-                return TSS_SUCCESS;
-        }
-        MUTEX_UNLOCK(disk_cache_lock);
-        /* key not found */
-        return TCSERR(TSS_E_PS_KEY_NOTFOUND);
+	MUTEX_UNLOCK(disk_cache_lock);
+	return TSS_SUCCESS;
 }
 
 TSS_RESULT
 psfile_get_key_by_pub(int fd, TCPA_STORE_PUBKEY *pub, UINT32 *size, BYTE **ret_key)
 {
-        int rc;
-        UINT32 file_offset = 0;
-        struct key_disk_cache *tmp;
-	BYTE tmp_buffer[4096];
-
-        MUTEX_LOCK(disk_cache_lock);
-        tmp = key_disk_cache_head;
-
-        while (tmp) {
-		/* if the key is of the wrong size or is invalid, try the next one */
-                if (pub->keyLength != tmp->pub_data_size || !(tmp->flags & CACHE_FLAG_VALID)) {
-                        tmp = tmp->next;
-                        continue;
-                }
-
-		/* we have a valid key with the same key size as the one we're looking for.
-		 * grab the pub key data off disk and compare it. */
-
-                /* jump to the location of the public key */
-                file_offset = TSSPS_PUB_DATA_OFFSET(tmp);
-
-                rc = lseek(fd, file_offset, SEEK_SET);
-                if (rc == ((off_t) - 1)) {
-                        LogError("lseek: %s", strerror(errno));
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return TCSERR(TSS_E_INTERNAL_ERROR);
-                }
-
-		DBG_ASSERT(tmp->pub_data_size < 2048);
-		if (tmp->pub_data_size > sizeof(tmp_buffer)) {
-			LogError("Source buffer size too big! Size:  %d",
-				 tmp->pub_data_size);
-			MUTEX_UNLOCK(disk_cache_lock);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
+	struct tssps2_header hdr;
+	struct tssps2_record rec;
+	UINT32 offset;
+	TSS_RESULT result;
+
+	MUTEX_LOCK(disk_cache_lock);
+	psfile_map_sync(fd);
+
+	if ((result = psfile_read_header(fd, &hdr)) ||
+	    (result = psfile_find_by_pub(fd, &hdr, pub, &offset, &rec))) {
+		MUTEX_UNLOCK(disk_cache_lock);
+		/* key not found */
+		return (TSS_ERROR_CODE(result) == TSS_E_PS_KEY_NOTFOUND) ? (TSS_RESULT)-2 : result;
+	}
+
+	*ret_key = malloc(rec.blob_size);
+	if (*ret_key == NULL) {
+		LogError("malloc of %d bytes failed.", rec.blob_size);
+		MUTEX_UNLOCK(disk_cache_lock);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	/* read in the key blob */
+	if ((result = psfile_read_at(fd, offset + sizeof(rec) + rec.pub_data_size, *ret_key,
+				   rec.blob_size))) {
+		LogError("%s", __FUNCTION__);
+		free(*ret_key);
+		*ret_key = NULL;
+		MUTEX_UNLOCK(disk_cache_lock);
+		return result;
+	}
+	*size = rec.blob_size;
+
+	MUTEX_UNLOCK(disk_cache_lock);
+	return TSS_SUCCESS;
+}
+
+/*
+ * Take a record of at least @size bytes for a new key, reusing the first removed key's
+ * record that's large enough, or else growing the file. The disk cache must be locked by the
+ * caller.
+ */
+static TSS_RESULT
+psfile_alloc_record(int fd, struct tssps2_header *hdr, UINT32 size, UINT32 *offset,
+		    UINT32 *rec_size)
+{
+	struct tssps2_record rec, prev_rec;
+	UINT32 off, prev = 0;
+	TSS_RESULT result;
+
+	for (off = hdr->free_head; off; prev = off, off = rec.next_uuid) {
+		if ((result = psfile_read_record(fd, off, &rec)))
+			return result;
+
+		if (rec.rec_size < size) {
+			memcpy(&prev_rec, &rec, sizeof(rec));
+			continue;
 		}
 
-		/* read in the key */
-                if ((rc = read_data(fd, tmp_buffer, tmp->pub_data_size))) {
+		/* take it off the free list */
+		if (prev) {
+			prev_rec.next_uuid = rec.next_uuid;
+			if ((result = psfile_write_record(fd, prev, &prev_rec)))
+				return result;
+		} else
+			hdr->free_head = rec.next_uuid;
+
+		*offset = off;
+		*rec_size = rec.rec_size;
+		return TSS_SUCCESS;
+	}
+
+	if (hdr->end > UINT_MAX - size) {
+		LogError("System PS file is full.");
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	*offset = hdr->end;
+	*rec_size = size;
+	hdr->end += size;
+
+	return TSS_SUCCESS;
+}
+
+/*
+ * Remove the record at @offset from hash chain @index. The disk cache must be locked by the
+ * caller.
+ */
+static TSS_RESULT
+psfile_unlink_record(int fd, struct tssps2_header *hdr, int index, UINT32 bucket,
+		     UINT32 offset, UINT32 next)
+{
+	struct tssps2_record rec;
+	UINT32 off, hops = 0;
+	TSS_RESULT result;
+
+	if ((result = psfile_read_bucket(fd, hdr, index, bucket, &off)))
+		return result;
+
+	if (off == offset)
+		return psfile_write_bucket(fd, hdr, index, bucket, next);
+
+	for (; off; off = TSSPS2_NEXT(&rec, index)) {
+		if (hops++ > hdr->num_keys)
+			break;
+
+		if ((result = psfile_read_record(fd, off, &rec)))
+			return result;
+
+		if (TSSPS2_NEXT(&rec, index) == offset) {
+			TSSPS2_NEXT(&rec, index) = next;
+			return psfile_write_record(fd, off, &rec);
+		}
+	}
+
+	LogError("Record at offset %u missing from the system PS index.", offset);
+	return TCSERR(TSS_E_INTERNAL_ERROR);
+}
+
+/* a key waiting for the group commit leader to write it, see psfile_write_key() */
+struct psfile_write_req {
+	TSS_UUID *uuid;
+	TSS_UUID *parent_uuid;
+	BYTE *vendor_data;
+	BYTE *key_blob;
+	TSS_KEY key;
+	struct tssps2_record rec;
+	UINT32 offset;
+	UINT32 reused;		/* size of the removed key's record that was taken, if any */
+	TSS_RESULT result;
+	TSS_BOOL done;
+	TSS_BOOL check_parent;	/* resolve the parent's PS type at staging time */
+	struct psfile_write_req *next;
+};
+
+static MUTEX_DECLARE_INIT(ps_commit_lock);
+static COND_DECLARE_INIT(ps_commit_cond);
+static struct psfile_write_req *ps_commit_queue = NULL, *ps_commit_tail = NULL;
+static TSS_BOOL ps_commit_busy = FALSE;
+
+/* a rebuilt system PS file waiting to be swapped in, see psfile_rebuild() */
+struct psfile_shadow {
+	char *path;
+	int fd;
+	UINT32 *offsets;
+	UINT32 num_keys;
+};
+
+/* don't bother compacting the file for less than this much space */
+#define PSFILE_COMPACT_MIN	(64 * 1024)
+
+/* the compaction thread, see psfile_maybe_compact(). It's joined before the file is closed */
+static struct {
+	TSS_BOOL running;	/* ps_compact.tid has yet to be joined */
+	TSS_BOOL stop;		/* the file is being closed, don't start or swap in anything */
+	THREAD_TYPE tid;
+} ps_compact;
+
+static TSS_BOOL ps_compacting = FALSE;
+
+static void psfile_maybe_compact(int);
+
+/*
+ * Stage the writes that add the key in @r to the file. The disk cache must be locked and a
+ * transaction open by the caller.
+ */
+static TSS_RESULT
+psfile_stage_key(int fd, struct psfile_write_req *r)
+{
+	struct tssps2_header hdr;
+	struct tssps2_record *rec = &r->rec, tmp;
+	UINT32 uuid_bucket, pub_bucket, size, end;
+	TSS_RESULT rc;
+
+	size = sizeof(*rec) + rec->pub_data_size + rec->blob_size + rec->vendor_data_size;
+
+	if ((rc = psfile_read_header(fd, &hdr)))
+		return rc;
+
+	/* the parent has to be registered already, possibly by a key staged earlier in the
+	 * same transaction, which the lookup sees through the transaction's overlay */
+	if (r->check_parent && memcmp(r->parent_uuid, &NULL_UUID, sizeof(TSS_UUID))) {
+		if (psfile_find_by_uuid(fd, &hdr, r->parent_uuid, &end, &tmp))
+			return TCSERR(TSS_E_PS_KEY_NOTFOUND);
+
+		if (tmp.flags & CACHE_FLAG_PARENT_PS_SYSTEM)
+			rec->flags |= CACHE_FLAG_PARENT_PS_SYSTEM;
+	}
+
+	/* another key in the same batch may have taken the UUID */
+	if (!psfile_find_by_uuid(fd, &hdr, r->uuid, &end, &tmp))
+		return TCSERR(TSS_E_KEY_ALREADY_REGISTERED);
+
+	end = hdr.end;
+	if ((rc = psfile_alloc_record(fd, &hdr, size, &r->offset, &rec->rec_size)))
+		return rc;
+	r->reused = (hdr.end == end) ? rec->rec_size : 0;
+
+	uuid_bucket = psfile_uuid_bucket(r->uuid, hdr.num_buckets);
+	pub_bucket = psfile_pub_bucket(rec->pub_digest, hdr.num_buckets);
+
+	if ((rc = psfile_read_bucket(fd, &hdr, TSSPS2_INDEX_UUID, uuid_bucket, &rec->next_uuid)) ||
+	    (rc = psfile_read_bucket(fd, &hdr, TSSPS2_INDEX_PUB, pub_bucket, &rec->next_pub)))
+		return rc;
+
+	/* write the record out, then account for it in the header and only then make it
+	 * reachable through the index */
+	if ((rc = psfile_write_record(fd, r->offset, rec)) ||
+	    (rc = psfile_write_at(fd, r->offset + sizeof(*rec), r->key.pubKey.key,
+				  rec->pub_data_size)) ||
+	    (rc = psfile_write_at(fd, r->offset + sizeof(*rec) + rec->pub_data_size,
+				  r->key_blob, rec->blob_size))) {
+		LogError("%s", __FUNCTION__);
+		return rc;
+	}
+
+	if (rec->vendor_data_size > 0) {
+		if ((rc = psfile_write_at(fd, r->offset + sizeof(*rec) + rec->pub_data_size +
+					  rec->blob_size, r->vendor_data,
+					  rec->vendor_data_size))) {
 			LogError("%s", __FUNCTION__);
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return rc;
-                }
+			return rc;
+		}
+	}
+
+	hdr.num_keys++;
+	hdr.generation++;
+	if ((rc = psfile_write_header(fd, &hdr)))
+		return rc;
+
+	if ((rc = psfile_write_bucket(fd, &hdr, TSSPS2_INDEX_UUID, uuid_bucket, r->offset)) ||
+	    (rc = psfile_write_bucket(fd, &hdr, TSSPS2_INDEX_PUB, pub_bucket, r->offset)))
+		return rc;
+
+	return TSS_SUCCESS;
+}
+
+/*
+ * Write all the keys in @batch in a single transaction, so that they share one sync of the
+ * journal. Unless @atomic is set, a key that can't be staged fails on its own and the rest
+ * still go in. With @atomic, the first failure aborts the whole batch.
+ */
+static void
+psfile_commit_keys(int fd, struct psfile_write_req *batch, TSS_BOOL atomic)
+{
+	struct tssps2_header hdr;
+	struct psfile_write_req *r;
+	TSS_RESULT result;
+	UINT32 savepoint;
 
-		/* do the compare */
-		if (memcmp(tmp_buffer, pub->key, tmp->pub_data_size)) {
-			tmp = tmp->next;
+	MUTEX_LOCK(disk_cache_lock);
+
+	psfile_txn_begin(fd);
+	for (r = batch; r; r = r->next) {
+		savepoint = psfile_txn_savepoint();
+		if ((r->result = psfile_stage_key(fd, r)) == TSS_SUCCESS)
+			continue;
+
+		if (!atomic) {
+			psfile_txn_rollback(savepoint);
 			continue;
 		}
 
-                /* jump to the location of the key blob */
-                file_offset = TSSPS_BLOB_DATA_OFFSET(tmp);
-
-                rc = lseek(fd, file_offset, SEEK_SET);
-                if (rc == ((off_t) - 1)) {
-                        LogError("lseek: %s", strerror(errno));
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return TCSERR(TSS_E_INTERNAL_ERROR);
-                }
-
-		DBG_ASSERT(tmp->blob_size < 4096);
-		if (tmp->blob_size > sizeof(tmp_buffer)) {
-			LogError("Blob size greater than 4096! Size:  %d",
-				 tmp->blob_size);
-			MUTEX_UNLOCK(disk_cache_lock);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
+		psfile_txn_abort();
+		result = r->result;
+		for (r = batch; r; r = r->next)
+			r->result = result;
+		goto unlock;
+	}
+
+	if ((result = psfile_txn_commit(fd))) {
+		for (r = batch; r; r = r->next) {
+			if (!r->result)
+				r->result = result;
 		}
+		goto unlock;
+	}
 
-		/* read in the key blob */
-                if ((rc = read_data(fd, tmp_buffer, tmp->blob_size))) {
-			LogError("%s", __FUNCTION__);
-                        MUTEX_UNLOCK(disk_cache_lock);
-                        return rc;
-                }
-
-		*ret_key = malloc(tmp->blob_size);
-		if (*ret_key == NULL) {
-			LogError("malloc of %d bytes failed.", tmp->blob_size);
-                        MUTEX_UNLOCK(disk_cache_lock);
-			return TCSERR(TSS_E_OUTOFMEMORY);
+	for (r = batch; r; r = r->next) {
+		if (r->result)
+			continue;
+
+		psfile_free_bytes -= MIN(psfile_free_bytes, r->reused);
+		r->result = cache_key(r->offset, r->rec.flags, r->uuid, r->parent_uuid,
+				      r->rec.pub_data_size, r->rec.blob_size,
+				      r->rec.vendor_data_size);
+	}
+
+	/* keep the hash chains short */
+	if (!psfile_read_header(fd, &hdr) && hdr.num_keys > hdr.num_buckets) {
+		if (psfile_rebuild(fd, key_disk_cache_head, TSSPS_VERSION_2,
+				   psfile_num_buckets(hdr.num_keys))) {
+			LogError("Failed to grow the system PS index, lookups will slow down.");
 		}
+	}
+unlock:
+	MUTEX_UNLOCK(disk_cache_lock);
+}
+
+/*
+ * Fill out @req for a key that's about to be written. On success, the caller has to free the
+ * unloaded key with destroy_key_refs().
+ */
+static TSS_RESULT
+psfile_init_write_req(struct psfile_write_req *req,
+		      TSS_UUID *uuid,
+		      TSS_UUID *parent_uuid,
+		      BYTE *vendor_data,
+		      UINT32 vendor_size,
+		      BYTE *key_blob,
+		      UINT16 key_blob_size)
+{
+	UINT64 blob_offset;
+	TSS_RESULT rc;
+
+	memset(req, 0, sizeof(*req));
+	req->uuid = uuid;
+	req->parent_uuid = parent_uuid;
+	req->vendor_data = vendor_data;
+	req->key_blob = key_blob;
+
+	/* Unload the blob to get the public key */
+	blob_offset = 0;
+	if ((rc = UnloadBlob_TSS_KEY(&blob_offset, key_blob, &req->key)))
+		return rc;
 
-		memcpy(*ret_key, tmp_buffer, tmp->blob_size);
-		*size = tmp->blob_size;
+	memcpy(&req->rec.uuid, uuid, sizeof(TSS_UUID));
+	memcpy(&req->rec.parent_uuid, parent_uuid, sizeof(TSS_UUID));
+	req->rec.pub_data_size = req->key.pubKey.keyLength;
+	req->rec.blob_size = key_blob_size;
+	req->rec.vendor_data_size = vendor_size;
+	req->rec.flags = CACHE_FLAG_VALID;
 
-                MUTEX_UNLOCK(disk_cache_lock);
-                return rc;
-        }
-        MUTEX_UNLOCK(disk_cache_lock);
-        /* key not found */
-        return -2;
+	if ((rc = Hash(TSS_HASH_SHA1, req->key.pubKey.keyLength, req->key.pubKey.key,
+		       req->rec.pub_digest))) {
+		destroy_key_refs(&req->key);
+		return rc;
+	}
+
+	return TSS_SUCCESS;
 }
 
 /*
- * disk store format:
- *
- * TrouSerS 0.2.0 and before:
- * Version 0:                  cached?
- * [UINT32   num_keys_on_disk]
- * [TSS_UUID uuid0           ] yes
- * [TSS_UUID uuid_parent0    ] yes
- * [UINT16   pub_data_size0  ] yes
- * [UINT16   blob_size0      ] yes
- * [UINT16   cache_flags0    ] yes
- * [BYTE[]   pub_data0       ]
- * [BYTE[]   blob0           ]
- * [...]
- *
- * TrouSerS 0.2.1+
- * Version 1:                  cached?
- * [BYTE     PS version = '\1']
- * [UINT32   num_keys_on_disk ]
- * [TSS_UUID uuid0            ] yes
- * [TSS_UUID uuid_parent0     ] yes
- * [UINT16   pub_data_size0   ] yes
- * [UINT16   blob_size0       ] yes
- * [UINT32   vendor_data_size0] yes
- * [UINT16   cache_flags0     ] yes
- * [BYTE[]   pub_data0        ]
- * [BYTE[]   blob0            ]
- * [BYTE[]   vendor_data0     ]
- * [...]
- *
+ * Add a key to the system PS file. Keys written by concurrent callers are committed
+ * together: the first caller to find no commit in progress becomes the leader and writes out
+ * every key queued up to that point, while the others wait for it.
  */
 TSS_RESULT
 psfile_write_key(int fd,
@@ -562,223 +788,534 @@ psfile_write_key(int fd,
 		BYTE *key_blob,
 		UINT16 key_blob_size)
 {
-	TSS_KEY key;
-	UINT16 pub_key_size, cache_flags = CACHE_FLAG_VALID;
-	UINT64 offset;
+	struct psfile_write_req req, *batch, *r, *next;
 	int rc = 0;
 
+	if ((rc = psfile_init_write_req(&req, uuid, parent_uuid, vendor_data, vendor_size,
+					key_blob, key_blob_size)))
+		return rc;
+
 	/* leaving the cache flag for parent ps type as 0 implies TSS_PS_TYPE_USER */
 	if (*parent_ps == TSS_PS_TYPE_SYSTEM)
-		cache_flags |= CACHE_FLAG_PARENT_PS_SYSTEM;
+		req.rec.flags |= CACHE_FLAG_PARENT_PS_SYSTEM;
 
-	/* Unload the blob to get the public key */
-	offset = 0;
-	if ((rc = UnloadBlob_TSS_KEY(&offset, key_blob, &key)))
-		return rc;
+	MUTEX_LOCK(ps_commit_lock);
 
-	pub_key_size = key.pubKey.keyLength;
+	if (ps_commit_tail)
+		ps_commit_tail->next = &req;
+	else
+		ps_commit_queue = &req;
+	ps_commit_tail = &req;
 
-        if ((rc = write_key_init(fd, pub_key_size, key_blob_size, vendor_size)) < 0)
-                goto done;
+	while (!req.done) {
+		if (ps_commit_busy) {
+			COND_WAIT(&ps_commit_cond, &ps_commit_lock);
+			continue;
+		}
 
-	/* offset now holds the number of bytes from the beginning of the file
-	 * the key will be stored at
-	 */
-	offset = rc;
+		ps_commit_busy = TRUE;
+		batch = ps_commit_queue;
+		ps_commit_queue = ps_commit_tail = NULL;
 
-#ifdef TSS_DEBUG
-	if (offset == 0)
-		LogDebug("ERROR: key being written with offset 0!!");
-#endif
+		MUTEX_UNLOCK(ps_commit_lock);
+		psfile_commit_keys(fd, batch, FALSE);
+		MUTEX_LOCK(ps_commit_lock);
 
-	/* [TSS_UUID uuid0           ] yes */
-        if ((rc = write_data(fd, (void *)uuid, sizeof(TSS_UUID)))) {
-		LogError("%s", __FUNCTION__);
-                goto done;
+		/* the waiters can't return before the lock is dropped, so they're still
+		 * around to be marked done */
+		for (r = batch; r; r = next) {
+			next = r->next;
+			r->done = TRUE;
+		}
+
+		ps_commit_busy = FALSE;
+		COND_BROADCAST(&ps_commit_cond);
 	}
 
-	/* [TSS_UUID uuid_parent0    ] yes */
-        if ((rc = write_data(fd, (void *)parent_uuid, sizeof(TSS_UUID)))) {
-		LogError("%s", __FUNCTION__);
-                goto done;
+	MUTEX_UNLOCK(ps_commit_lock);
+
+	rc = req.result;
+	destroy_key_refs(&req.key);
+
+	return rc;
+}
+
+/*
+ * Add @num keys to the system PS file in one transaction. Each key's parent must either be
+ * registered already or come earlier in the batch, and the keys are written all or not at
+ * all. The batch doesn't need to wait for the group commit, it already shares one sync.
+ */
+TSS_RESULT
+psfile_write_keys(int fd,
+		  UINT32 num,
+		  TSS_UUID *uuids,
+		  TSS_UUID *parent_uuids,
+		  BYTE *vendor_data,
+		  UINT32 vendor_size,
+		  BYTE **key_blobs,
+		  UINT16 *key_blob_sizes)
+{
+	struct psfile_write_req *reqs;
+	TSS_RESULT rc = TSS_SUCCESS;
+	UINT32 i, j;
+
+	if ((reqs = calloc(num, sizeof(struct psfile_write_req))) == NULL) {
+		LogError("malloc of %zd bytes failed.", num * sizeof(struct psfile_write_req));
+		return TCSERR(TSS_E_OUTOFMEMORY);
 	}
 
-	/* [UINT16   pub_data_size0  ] yes */
-	pub_key_size = LE_16(pub_key_size);
-        if ((rc = write_data(fd, &pub_key_size, sizeof(UINT16)))) {
-		LogError("%s", __FUNCTION__);
-                goto done;
+	for (i = 0; i < num; i++) {
+		if ((rc = psfile_init_write_req(&reqs[i], &uuids[i], &parent_uuids[i],
+						vendor_data, vendor_size, key_blobs[i],
+						key_blob_sizes[i])))
+			break;
+
+		reqs[i].check_parent = TRUE;
+		if (i > 0)
+			reqs[i - 1].next = &reqs[i];
 	}
-	/* Swap it back for later */
-	pub_key_size = LE_16(pub_key_size);
 
-	/* [UINT16   blob_size0      ] yes */
-	key_blob_size = LE_16(key_blob_size);
-        if ((rc = write_data(fd, &key_blob_size, sizeof(UINT16)))) {
-		LogError("%s", __FUNCTION__);
-                goto done;
+	if (i == num) {
+		/* a parentless key is the root of its own hierarchy */
+		for (j = 0; j < num; j++) {
+			if (!memcmp(&parent_uuids[j], &NULL_UUID, sizeof(TSS_UUID)))
+				reqs[j].rec.flags |= CACHE_FLAG_PARENT_PS_SYSTEM;
+		}
+
+		psfile_commit_keys(fd, reqs, TRUE);
+		for (j = 0; j < num && rc == TSS_SUCCESS; j++)
+			rc = reqs[j].result;
 	}
-	/* Swap it back for later */
-	key_blob_size = LE_16(key_blob_size);
 
-	/* [UINT32   vendor_data_size0 ] yes */
-	vendor_size = LE_32(vendor_size);
-        if ((rc = write_data(fd, &vendor_size, sizeof(UINT32)))) {
-		LogError("%s", __FUNCTION__);
-                goto done;
+	for (j = 0; j < i; j++)
+		destroy_key_refs(&reqs[j].key);
+	free(reqs);
+
+	return rc;
+}
+
+/*
+ * Stage the writes that unlink a key's record from the index and put it on the free list.
+ * The disk cache must be locked and a transaction open by the caller.
+ */
+static TSS_RESULT
+psfile_stage_remove(int fd, struct key_disk_cache *c, UINT32 *rec_size)
+{
+	struct tssps2_header hdr;
+	struct tssps2_record rec;
+	TSS_RESULT result;
+
+	if ((result = psfile_read_header(fd, &hdr)) ||
+	    (result = psfile_read_record(fd, c->offset, &rec)))
+		return result;
+
+	if ((result = psfile_unlink_record(fd, &hdr, TSSPS2_INDEX_UUID,
+					   psfile_uuid_bucket(&rec.uuid, hdr.num_buckets),
+					   c->offset, rec.next_uuid)) ||
+	    (result = psfile_unlink_record(fd, &hdr, TSSPS2_INDEX_PUB,
+					   psfile_pub_bucket(rec.pub_digest, hdr.num_buckets),
+					   c->offset, rec.next_pub)))
+		return result;
+
+	rec.flags = 0;
+	rec.next_uuid = hdr.free_head;
+	rec.next_pub = 0;
+	if ((result = psfile_write_record(fd, c->offset, &rec)))
+		return result;
+
+	hdr.free_head = c->offset;
+	hdr.num_keys--;
+	hdr.generation++;
+
+	if ((result = psfile_write_header(fd, &hdr)))
+		return result;
+
+	*rec_size = rec.rec_size;
+
+	return TSS_SUCCESS;
+}
+
+/*
+ * Remove a key from the system PS file. The disk cache must be locked by the caller.
+ */
+TSS_RESULT
+psfile_remove_key(int fd, struct key_disk_cache *c)
+{
+	return psfile_remove_keys(fd, 1, &c);
+}
+
+/*
+ * Remove @num keys from the system PS file in one transaction, all or none of them. The
+ * disk cache must be locked by the caller.
+ */
+TSS_RESULT
+psfile_remove_keys(int fd, UINT32 num, struct key_disk_cache **c)
+{
+	TSS_RESULT result;
+	UINT32 i, rec_size, freed = 0;
+
+	psfile_txn_begin(fd);
+
+	for (i = 0; i < num; i++) {
+		if ((result = psfile_stage_remove(fd, c[i], &rec_size))) {
+			psfile_txn_abort();
+			return result;
+		}
+		freed += rec_size;
 	}
-	/* Swap it back for later */
-	vendor_size = LE_32(vendor_size);
 
-	/* [UINT16   cache_flags0    ] yes */
-	cache_flags = LE_16(cache_flags);
-        if ((rc = write_data(fd, &cache_flags, sizeof(UINT16)))) {
-		LogError("%s", __FUNCTION__);
-                goto done;
+	if ((result = psfile_txn_commit(fd)))
+		return result;
+
+	psfile_free_bytes += freed;
+	psfile_maybe_compact(fd);
+
+	return TSS_SUCCESS;
+}
+
+static void
+psfile_shadow_discard(struct psfile_shadow *shadow)
+{
+	if (shadow->fd >= 0) {
+		close(shadow->fd);
+		unlink(shadow->path);
 	}
-	/* Swap it back for later */
-	cache_flags = LE_16(cache_flags);
+	free(shadow->path);
+	free(shadow->offsets);
+	memset(shadow, 0, sizeof(*shadow));
+	shadow->fd = -1;
+}
 
-	/* [BYTE[]   pub_data0       ] no */
-        if ((rc = write_data(fd, (void *)key.pubKey.key, pub_key_size))) {
-		LogError("%s", __FUNCTION__);
-                goto done;
+/*
+ * Write the keys in @list out to a new version 2 PS file named after the system PS file with
+ * @suffix appended. The keys are read from @fd, a PS file of format @version. Removed keys'
+ * records are dropped. Only pread() is used on @fd, so the disk cache doesn't have to be
+ * locked if @list is a private copy.
+ */
+static TSS_RESULT
+psfile_shadow_write(int fd, struct key_disk_cache *list, BYTE version, UINT32 num_buckets,
+		    UINT32 generation, char *suffix, struct psfile_shadow *shadow)
+{
+	struct tssps2_header hdr;
+	struct tssps2_record rec;
+	struct key_disk_cache *c;
+	UINT32 *index = NULL, offset, data_size, i;
+	BYTE *data = NULL;
+	TSS_RESULT result = TCSERR(TSS_E_INTERNAL_ERROR);
+
+	memset(shadow, 0, sizeof(*shadow));
+	shadow->fd = -1;
+
+	for (c = list; c; c = c->next)
+		shadow->num_keys++;
+
+	index = calloc(2 * num_buckets, sizeof(UINT32));
+	shadow->offsets = calloc(shadow->num_keys ? shadow->num_keys : 1, sizeof(UINT32));
+	shadow->path = malloc(strlen(tcsd_options.system_ps_file) + strlen(suffix) + 1);
+	if (index == NULL || shadow->offsets == NULL || shadow->path == NULL) {
+		LogError("malloc of %zd bytes failed.", 2 * num_buckets * sizeof(UINT32));
+		result = TCSERR(TSS_E_OUTOFMEMORY);
+		goto err;
 	}
+	sprintf(shadow->path, "%s%s", tcsd_options.system_ps_file, suffix);
 
-	/* [BYTE[]   blob0           ] no */
-        if ((rc = write_data(fd, (void *)key_blob, key_blob_size))) {
-		LogError("%s", __FUNCTION__);
-                goto done;
+	if ((shadow->fd = open(shadow->path, O_CREAT|O_TRUNC|O_RDWR, 0600)) < 0) {
+		LogError("system PS: open() of %s failed: %s", shadow->path, strerror(errno));
+		goto err;
 	}
 
-	/* [BYTE[]   vendor_data0    ] no */
-	if (vendor_size > 0) {
-		if ((rc = write_data(fd, (void *)vendor_data, vendor_size))) {
-			LogError("%s", __FUNCTION__);
-			goto done;
+	offset = TSSPS2_DATA_OFFSET(num_buckets);
+	for (c = list, i = 0; c; c = c->next, i++) {
+		data_size = c->pub_data_size + c->blob_size + c->vendor_data_size;
+		if ((data = malloc(data_size)) == NULL) {
+			LogError("malloc of %u bytes failed.", data_size);
+			result = TCSERR(TSS_E_OUTOFMEMORY);
+			goto err;
 		}
+
+		/* the public key, blob and vendor data are together in either version */
+		if ((result = read_data_at(fd, version == TSSPS_VERSION_2 ?
+						TSSPS2_PUB_DATA_OFFSET(c) :
+						TSSPS_PUB_DATA_OFFSET(c), data, data_size)))
+			goto err;
+
+		memset(&rec, 0, sizeof(rec));
+		memcpy(&rec.uuid, &c->uuid, sizeof(TSS_UUID));
+		memcpy(&rec.parent_uuid, &c->parent_uuid, sizeof(TSS_UUID));
+		rec.rec_size = sizeof(rec) + data_size;
+		rec.vendor_data_size = c->vendor_data_size;
+		rec.pub_data_size = c->pub_data_size;
+		rec.blob_size = c->blob_size;
+		rec.flags = c->flags;
+
+		if ((result = Hash(TSS_HASH_SHA1, c->pub_data_size, data, rec.pub_digest)))
+			goto err;
+
+		rec.next_uuid = index[psfile_uuid_bucket(&c->uuid, num_buckets)];
+		index[psfile_uuid_bucket(&c->uuid, num_buckets)] = offset;
+		rec.next_pub = index[num_buckets + psfile_pub_bucket(rec.pub_digest, num_buckets)];
+		index[num_buckets + psfile_pub_bucket(rec.pub_digest, num_buckets)] = offset;
+
+		/* psfile_write_record() would look at the transaction, which the compaction
+		 * thread can't do without the disk cache locked */
+		psfile_swap_record(&rec);
+		if ((result = write_data_at(shadow->fd, offset, &rec, sizeof(rec))) ||
+		    (result = write_data_at(shadow->fd, offset + sizeof(rec), data, data_size)))
+			goto err;
+
+		free(data);
+		data = NULL;
+
+		shadow->offsets[i] = offset;
+		offset += sizeof(rec) + data_size;
+	}
+
+	for (i = 0; i < 2 * num_buckets; i++)
+		index[i] = LE_32(index[i]);
+
+	if ((result = write_data_at(shadow->fd, TSSPS2_INDEX_OFFSET(0, num_buckets), index,
+				    2 * num_buckets * sizeof(UINT32))))
+		goto err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = TSSPS_VERSION_2;
+	memcpy(hdr.magic, TSSPS2_MAGIC, sizeof(TSSPS2_MAGIC));
+	hdr.num_keys = shadow->num_keys;
+	hdr.num_buckets = num_buckets;
+	hdr.generation = generation;
+	hdr.end = offset;
+
+	psfile_swap_header(&hdr);
+	if ((result = write_data_at(shadow->fd, 0, &hdr, sizeof(hdr))))
+		goto err;
+
+	if (fsync(shadow->fd)) {
+		LogError("fsync of %s failed: %s", shadow->path, strerror(errno));
+		result = TCSERR(TSS_E_INTERNAL_ERROR);
+		goto err;
 	}
 
-	if ((rc = cache_key((UINT32)offset, cache_flags, uuid, parent_uuid, pub_key_size,
-					key_blob_size, vendor_size)))
-                goto done;
+	free(index);
+	return TSS_SUCCESS;
+err:
+	free(data);
+	free(index);
+	psfile_shadow_discard(shadow);
+	return result;
+}
+
+/*
+ * Swap the file written by psfile_shadow_write() in for the system PS file open on @fd,
+ * which stays locked, and point the entries of @list at the keys' new offsets. @list must
+ * hold the same keys in the same order as the list the shadow was written from. The disk
+ * cache must be locked by the caller.
+ */
+static TSS_RESULT
+psfile_shadow_swap(int fd, struct key_disk_cache *list, struct psfile_shadow *shadow)
+{
+	struct key_disk_cache *c;
+	TSS_RESULT result = TCSERR(TSS_E_INTERNAL_ERROR);
+	UINT32 i;
+
+	/* the journal refers to offsets in the file that's going away */
+	if ((result = psjournal_checkpoint(fd)))
+		goto done;
+
+	result = TCSERR(TSS_E_INTERNAL_ERROR);
+
+	if (rename(shadow->path, tcsd_options.system_ps_file)) {
+		LogError("rename of %s failed: %s", shadow->path, strerror(errno));
+		goto done;
+	}
+
+	/* everyone holding @fd now gets the new file. Closing any descriptor of a file drops
+	 * the process' locks on it, so the lock is taken once the shadow's fd is gone */
+	psfile_map_drop();
+	if (dup2(shadow->fd, fd) < 0) {
+		LogError("dup2 failed: %s", strerror(errno));
+		goto done;
+	}
+	close(shadow->fd);
+	shadow->fd = -1;
+
+	fl.l_type = F_WRLCK;
+	if (fcntl(fd, F_SETLKW, &fl)) {
+		LogError("failed to get system PS lock: %s", strerror(errno));
+		goto done;
+	}
+
+	for (c = list, i = 0; c && i < shadow->num_keys; c = c->next, i++)
+		c->offset = shadow->offsets[i];
+
+	psfile_free_bytes = 0;
+	result = TSS_SUCCESS;
 done:
-	destroy_key_refs(&key);
+	psfile_shadow_discard(shadow);
 
-        return rc;
+	return result;
 }
 
+/*
+ * Write the keys in @list out to a new version 2 PS file with @num_buckets index buckets and
+ * swap it in for the system PS file open on @fd, which stays locked. @version is the format
+ * of the file @list was read from. Removed keys' records are dropped, and the cache entries
+ * are pointed at the keys' new offsets. The disk cache must be locked by the caller if @list
+ * is the disk cache.
+ */
 TSS_RESULT
-psfile_remove_key(int fd, struct key_disk_cache *c)
+psfile_rebuild(int fd, struct key_disk_cache *list, BYTE version, UINT32 num_buckets)
 {
-        TSS_RESULT result;
-        UINT32 head_offset = 0, tail_offset, num_keys;
-	BYTE buf[4096];
-	struct stat stat_buf;
-	int rc, size = 0;
+	struct tssps2_header hdr;
+	struct psfile_shadow shadow;
+	UINT32 generation = 0;
+	TSS_RESULT result;
 
-	if ((rc = fstat(fd, &stat_buf)) != 0) {
-		LogError("fstat: %s", strerror(errno));
-		return TSS_E_INTERNAL_ERROR;
+	if (version == TSSPS_VERSION_2) {
+		if ((result = psfile_read_header(fd, &hdr)))
+			return result;
+		generation = hdr.generation + 1;
 	}
 
-	/* head_offset is the offset the beginning of the key */
-	head_offset = TSSPS_UUID_OFFSET(c);
+	if ((result = psfile_shadow_write(fd, list, version, num_buckets, generation, ".tmp",
+					  &shadow)))
+		return result;
 
-	/* tail_offset is the offset the beginning of the next key */
-	tail_offset = TSSPS_VENDOR_DATA_OFFSET(c) + c->vendor_data_size;
+	if ((result = psfile_shadow_swap(fd, list, &shadow)))
+		return result;
 
-	rc = lseek(fd, tail_offset, SEEK_SET);
-	if (rc == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		return TCSERR(TSS_E_INTERNAL_ERROR);
-	}
+	LogDebug("Rebuilt the system PS file with %u keys and %u buckets", shadow.num_keys,
+		 num_buckets);
 
-	/* read in from tail, write out to head to fill the gap */
-	while ((rc = read(fd, buf, sizeof(buf))) > 0) {
-		size = rc;
-		tail_offset += size;
+	return TSS_SUCCESS;
+}
 
-		/* set the file pointer to where we want to write */
-		rc = lseek(fd, head_offset, SEEK_SET);
-		if (rc == ((off_t) - 1)) {
-			LogError("lseek: %s", strerror(errno));
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
+/*
+ * Rewrite the system PS file without the holes left by removed keys. The new file is written
+ * from a copy of the disk cache without holding any locks, and only swapped in if nothing
+ * was written to the old one in the meantime. Otherwise a later removal will try again.
+ */
+static void *
+psfile_compact_thread(void *arg)
+{
+	struct key_disk_cache *copy = NULL, *tail = NULL, *c, *tmp;
+	struct tssps2_header hdr;
+	struct psfile_shadow shadow;
+	UINT32 generation, num_keys = 0;
+	int fd;
 
-		/* write the data */
-		if ((result = write_data(fd, (void *)buf, size))) {
-			LogError("%s", __FUNCTION__);
-			return result;
-		}
-		head_offset += size;
+	/* leave SIGHUP to the main thread, and keep the config a reload would free, since
+	 * writing and swapping the file read system_ps_file from it */
+	thread_signal_init();
+	tcsd_conf_pin();
 
-		/* set the file pointer to where we want to read in the next
-		 * loop */
-		rc = lseek(fd, tail_offset, SEEK_SET);
-		if (rc == ((off_t) - 1)) {
-			LogError("lseek: %s", strerror(errno));
-			return TCSERR(TSS_E_INTERNAL_ERROR);
+	MUTEX_LOCK(disk_cache_lock);
+
+	if ((fd = system_ps_fd) < 0 || psfile_read_header(fd, &hdr))
+		goto unlock;
+	generation = hdr.generation;
+
+	for (c = key_disk_cache_head; c; c = c->next) {
+		if ((tmp = malloc(sizeof(struct key_disk_cache))) == NULL) {
+			LogError("malloc of %zd bytes failed.", sizeof(struct key_disk_cache));
+			goto unlock;
 		}
-	}
 
-	if (rc < 0) {
-		LogError("read: %s", strerror(errno));
-		return TCSERR(TSS_E_INTERNAL_ERROR);
+		memcpy(tmp, c, sizeof(struct key_disk_cache));
+		tmp->next = NULL;
+		if (tail)
+			tail->next = tmp;
+		else
+			copy = tmp;
+		tail = tmp;
+		num_keys++;
 	}
 
-	/* set the file pointer to where we want to write */
-	rc = lseek(fd, head_offset, SEEK_SET);
-	if (rc == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		return TCSERR(TSS_E_INTERNAL_ERROR);
+	MUTEX_UNLOCK(disk_cache_lock);
+
+	if (psfile_shadow_write(fd, copy, TSSPS_VERSION_2, psfile_num_buckets(num_keys),
+				generation + 1, ".compact", &shadow)) {
+		MUTEX_LOCK(disk_cache_lock);
+		goto unlock;
 	}
 
-	/* head_offset now contains a pointer to where we want to truncate the
-	 * file. Zero out the old tail end of the file and truncate it. */
+	MUTEX_LOCK(disk_cache_lock);
 
-	memset(buf, 0, sizeof(buf));
+	if (ps_compact.stop) {
+		psfile_shadow_discard(&shadow);
+		goto unlock;
+	}
 
-	/* Zero out the old tail end of the file */
-	if ((result = write_data(fd, (void *)buf, tail_offset - head_offset))) {
-		LogError("%s", __FUNCTION__);
-		return result;
+	if (system_ps_fd != fd || psfile_read_header(fd, &hdr) || hdr.generation != generation) {
+		LogDebug("System PS file changed during compaction, will try again later.");
+		psfile_shadow_discard(&shadow);
+		goto unlock;
 	}
 
-	if ((rc = ftruncate(fd, head_offset)) < 0) {
-		LogError("ftruncate: %s", strerror(errno));
-		return TCSERR(TSS_E_INTERNAL_ERROR);
+	if (get_file() < 0) {
+		psfile_shadow_discard(&shadow);
+		goto unlock;
 	}
 
-	/* we succeeded in removing a key from the disk. Decrement the number
-	 * of keys in the file */
-	rc = lseek(fd, TSSPS_NUM_KEYS_OFFSET, SEEK_SET);
-	if (rc == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		return TCSERR(TSS_E_INTERNAL_ERROR);
+	if (!psfile_shadow_swap(fd, key_disk_cache_head, &shadow)) {
+		LogDebug("Compacted the system PS file to %u keys", num_keys);
 	}
 
-	rc = read(fd, &num_keys, sizeof(UINT32));
-	num_keys = LE_32(num_keys);
-	if (rc != sizeof(UINT32)) {
-		LogError("read of %zd bytes: %s", sizeof(UINT32), strerror(errno));
-		return TCSERR(TSS_E_INTERNAL_ERROR);
+	put_file(fd);
+unlock:
+	ps_compacting = FALSE;
+	MUTEX_UNLOCK(disk_cache_lock);
+	free_cache_list(copy);
+	tcsd_conf_unpin();
+
+	return NULL;
+}
+
+/*
+ * Start compacting the file in the background once removed keys take up more than half of
+ * the space used by records. The disk cache must be locked by the caller.
+ */
+static void
+psfile_maybe_compact(int fd)
+{
+	struct tssps2_header hdr;
+
+	if (ps_compacting || ps_compact.stop || psfile_free_bytes < PSFILE_COMPACT_MIN ||
+	    psfile_read_header(fd, &hdr) ||
+	    psfile_free_bytes < (hdr.end - TSSPS2_DATA_OFFSET(hdr.num_buckets)) / 2)
+		return;
+
+	/* the last compaction cleared ps_compacting on its way out, so this doesn't wait on the
+	 * disk cache */
+	if (ps_compact.running) {
+		THREAD_JOIN(ps_compact.tid, NULL);
+		ps_compact.running = FALSE;
 	}
 
-	rc = lseek(fd, TSSPS_NUM_KEYS_OFFSET, SEEK_SET);
-	if (rc == ((off_t) - 1)) {
-		LogError("lseek: %s", strerror(errno));
-		return TCSERR(TSS_E_INTERNAL_ERROR);
+	ps_compacting = TRUE;
+	if (THREAD_CREATE(&ps_compact.tid, NULL, psfile_compact_thread, NULL)) {
+		LogError("Failed to start compacting the system PS file.");
+		ps_compacting = FALSE;
+		return;
 	}
+	ps_compact.running = TRUE;
+}
 
-	/* decrement, then write back out to disk */
-	num_keys--;
+/*
+ * Wait for a compaction in progress to finish, and keep new ones from starting. It writes the
+ * new file from the system PS file's descriptor without holding the disk cache lock, so this
+ * has to be called before the file is closed, and without the file locked.
+ */
+void
+psfile_compact_final()
+{
+	TSS_BOOL running;
 
-	num_keys = LE_32(num_keys);
-	if ((result = write_data(fd, (void *)&num_keys, sizeof(UINT32)))) {
-		LogError("%s", __FUNCTION__);
-		return result;
-	}
+	MUTEX_LOCK(disk_cache_lock);
+	ps_compact.stop = TRUE;
+	running = ps_compact.running;
+	ps_compact.running = FALSE;
+	MUTEX_UNLOCK(disk_cache_lock);
 
-	return TSS_SUCCESS;
+	if (running)
+		THREAD_JOIN(ps_compact.tid, NULL);
 }
@@ -0,0 +1,887 @@
+
+/*
+ * Licensed Materials - Property of IBM
+ *
+ * trousers - An open source TCG Software Stack
+ *
+ * (C) Copyright International Business Machines Corp. 2004-2007
+ *
+ */
+
+/*
+ * tcsps_test.c - check the system PS file
+ *
+ * A version 1 file, with a few of its keys marked removed, is upgraded to version 2, and
+ * every key is read back through both indexes before and after the upgraded file is reopened.
+ *
+ * The journal written by a run of single key commits is cut off at each record boundary and
+ * one byte short of it, and replayed over the file as it was before the first commit. The keys
+ * of the complete records, and only those, have to be there afterwards.
+ *
+ * Writers racing for the same UUIDs are queued up behind a held disk cache lock, so that the
+ * group commit leader gets them all in one batch. Exactly one of them wins each UUID.
+ *
+ * Keys are removed while other threads write, until the file is compacted in the background,
+ * and once more without the writers until a compaction gets swapped in. No key may be lost or
+ * come back, and the reopened file can't have any removed keys' records left in it. This one
+ * runs last, since the compaction can't be started again once psfile_compact_final() is done.
+ *
+ * The PS file and its journal are kept in a directory created under the current one.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "trousers/tss.h"
+#include "trousers_types.h"
+#include "tcs_tsp.h"
+#include "tcs_utils.h"
+#include "tcs_int_literals.h"
+#include "capabilities.h"
+#include "tcsps.h"
+#include "tcsd_wrap.h"
+#include "tcsd.h"
+#include "tcslog.h"
+
+#define PUB_SIZE	256
+#define ENC_SIZE	300
+#define BLOB_MAX	1024
+#define VENDOR_SIZE	8
+
+#define NUM_V1_KEYS	150
+#define V1_ID(i)	(1000 + (i))
+/* the keys of the version 1 file that are marked removed, and the ones with vendor data */
+#define V1_REMOVED(i)	((i) % 7 == 3)
+#define V1_VENDOR(i)	((i) % 5 == 0)
+
+#define NUM_JOURNAL_KEYS	8
+#define JOURNAL_ID(i)		(2000 + (i))
+
+#define NUM_RACERS		16
+#define NUM_RACED_UUIDS		4
+#define RACE_ID(i)		(3000 + (i) % NUM_RACED_UUIDS)
+
+#define NUM_OLD_KEYS		300
+#define NUM_SPARE_KEYS		100
+#define NUM_WRITERS		4
+#define MAX_KEYS_PER_WRITER	100
+#define OLD_ID(i)		(4000 + (i))
+#define SPARE_ID(i)		(5000 + (i))
+#define NEW_ID(w, i)		(6000 + (w) * MAX_KEYS_PER_WRITER + (i))
+/* the writers put in one key for this many removals, few enough for the removed keys' records
+ * to take up half the file at the end, which starts a compaction */
+#define REMOVALS_PER_KEY	20
+/* and this many more each once the removals are done, while the last compaction runs */
+#define KEYS_AFTER_REMOVALS	5
+/* psfile_maybe_compact() won't compact the file for less than this */
+#define COMPACT_MIN		(64 * 1024)
+
+static struct tcsd_config conf;
+static char dir[] = "tcsps_test.XXXXXX", ps_path[64], journal_path[80];
+
+static int errors;
+
+/* the config and the thread setup of the tcsd, which the PS code calls into */
+struct tcsd_config *
+tcsd_conf_get()
+{
+	return &conf;
+}
+
+void
+tcsd_conf_pin()
+{
+}
+
+void
+tcsd_conf_unpin()
+{
+}
+
+void
+thread_signal_init()
+{
+}
+
+static void
+put16(BYTE *p, UINT16 v)
+{
+	p[0] = (BYTE)v;
+	p[1] = (BYTE)(v >> 8);
+}
+
+static void
+put32(BYTE *p, UINT32 v)
+{
+	put16(p, (UINT16)v);
+	put16(p + 2, (UINT16)(v >> 16));
+}
+
+static void
+make_uuid(UINT32 id, TSS_UUID *uuid)
+{
+	memset(uuid, 0, sizeof(TSS_UUID));
+	uuid->ulTimeLow = id;
+	uuid->usTimeMid = 0x7e57;
+}
+
+/* every key's public key is different, so that the public key index can tell them apart */
+static void
+make_pub(UINT32 id, BYTE *pub)
+{
+	UINT32 i;
+
+	for (i = 0; i < PUB_SIZE; i++)
+		pub[i] = (BYTE)(id * 7 + i);
+	put32(pub, id);
+}
+
+/* Write out a key blob for key @id. Keys written under the same UUID by different writers
+ * have a different @variant of the encrypted part. */
+static UINT16
+make_blob(UINT32 id, UINT32 variant, BYTE *blob)
+{
+	TSS_KEY key;
+	BYTE pub[PUB_SIZE], enc[ENC_SIZE];
+	UINT64 offset = 0;
+	UINT32 i;
+
+	make_pub(id, pub);
+	for (i = 0; i < ENC_SIZE; i++)
+		enc[i] = (BYTE)(id + variant * 13 + i);
+
+	memset(&key, 0, sizeof(key));
+	key.hdr.key11.ver.major = 1;
+	key.hdr.key11.ver.minor = 1;
+	key.keyUsage = TPM_KEY_STORAGE;
+	key.authDataUsage = TPM_AUTH_ALWAYS;
+	key.algorithmParms.algorithmID = TCPA_ALG_RSA;
+	key.algorithmParms.encScheme = TCPA_ES_RSAESOAEP_SHA1_MGF1;
+	key.algorithmParms.sigScheme = TCPA_SS_NONE;
+	key.pubKey.keyLength = PUB_SIZE;
+	key.pubKey.key = pub;
+	key.encSize = ENC_SIZE;
+	key.encData = enc;
+
+	LoadBlob_TSS_KEY(&offset, blob, &key);
+
+	return (UINT16)offset;
+}
+
+static void
+make_vendor_data(UINT32 id, BYTE *data)
+{
+	memset(data, (BYTE)id, VENDOR_SIZE);
+}
+
+static int
+write_file(char *path, BYTE *data, UINT32 size)
+{
+	int fd;
+
+	if ((fd = open(path, O_CREAT|O_TRUNC|O_WRONLY, 0600)) < 0)
+		return -1;
+
+	if (size && write(fd, data, size) != (ssize_t)size) {
+		close(fd);
+		return -1;
+	}
+
+	return close(fd);
+}
+
+static void
+remove_files()
+{
+	unlink(ps_path);
+	unlink(journal_path);
+}
+
+static int
+open_ps(const char *what)
+{
+	if (ps_open_disk_cache() || ps_init_disk_cache()) {
+		printf("FAIL %s: opening the system PS\n", what);
+		errors++;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+close_ps()
+{
+	int fd;
+
+	if ((fd = get_file()) < 0)
+		return;
+
+	close_disk_cache(fd);
+	put_file(fd);
+	close_file(fd);
+}
+
+/* the number of keys in the disk cache */
+static UINT32
+num_cached()
+{
+	struct key_disk_cache *c;
+	UINT32 num = 0;
+
+	MUTEX_LOCK(disk_cache_lock);
+	for (c = key_disk_cache_head; c; c = c->next) {
+		if (c->flags & CACHE_FLAG_VALID)
+			num++;
+	}
+	MUTEX_UNLOCK(disk_cache_lock);
+
+	return num;
+}
+
+/* Check that key @id is registered with the blob written by @variant, or if @present isn't
+ * set, that it isn't registered at all */
+static void
+check_key(const char *what, UINT32 id, UINT32 variant, TSS_BOOL present)
+{
+	BYTE blob[BLOB_MAX], expected[BLOB_MAX];
+	UINT16 size = sizeof(blob), expected_size;
+	TSS_UUID uuid;
+	TSS_RESULT result;
+
+	make_uuid(id, &uuid);
+	result = ps_get_key_by_uuid(&uuid, blob, &size);
+
+	if (!present) {
+		if (result == TSS_SUCCESS) {
+			printf("FAIL %s: key %u is registered\n", what, id);
+			errors++;
+		}
+		return;
+	}
+
+	expected_size = make_blob(id, variant, expected);
+	if (result || size != expected_size || memcmp(blob, expected, size)) {
+		printf("FAIL %s: key %u read back wrong (0x%x)\n", what, id, result);
+		errors++;
+	}
+}
+
+static void
+check_v1_keys(const char *what)
+{
+	struct key_disk_cache *c;
+	TCPA_STORE_PUBKEY pub;
+	TSS_UUID uuid, parent, found, *by_pub;
+	BYTE pub_data[PUB_SIZE], vendor[VENDOR_SIZE], *data;
+	UINT32 i, size, num_keys = 0;
+
+	for (i = 0; i < NUM_V1_KEYS; i++) {
+		check_key(what, V1_ID(i), 0, !V1_REMOVED(i));
+		if (V1_REMOVED(i))
+			continue;
+		num_keys++;
+
+		make_uuid(V1_ID(i), &uuid);
+		if (i > 0)
+			make_uuid(V1_ID(i - 1), &parent);
+		else
+			memset(&parent, 0, sizeof(TSS_UUID));
+
+		if (psfile_get_parent_uuid_by_uuid(system_ps_fd, &uuid, &found) ||
+		    memcmp(&found, &parent, sizeof(TSS_UUID))) {
+			printf("FAIL %s: parent of key %u\n", what, V1_ID(i));
+			errors++;
+		}
+
+		make_pub(V1_ID(i), pub_data);
+		pub.keyLength = PUB_SIZE;
+		pub.key = pub_data;
+		if (psfile_get_uuid_by_pub(system_ps_fd, &pub, &by_pub)) {
+			printf("FAIL %s: public key of key %u not found\n", what, V1_ID(i));
+			errors++;
+		} else {
+			if (memcmp(by_pub, &uuid, sizeof(TSS_UUID))) {
+				printf("FAIL %s: public key of key %u found another key\n", what,
+				       V1_ID(i));
+				errors++;
+			}
+			free(by_pub);
+		}
+
+		MUTEX_LOCK(disk_cache_lock);
+		for (c = key_disk_cache_head; c; c = c->next) {
+			if (!memcmp(&c->uuid, &uuid, sizeof(TSS_UUID)))
+				break;
+		}
+
+		if (c == NULL) {
+			printf("FAIL %s: key %u isn't cached\n", what, V1_ID(i));
+			errors++;
+		} else if (!V1_VENDOR(i)) {
+			if (c->vendor_data_size != 0) {
+				printf("FAIL %s: key %u has vendor data\n", what, V1_ID(i));
+				errors++;
+			}
+		} else if (ps_get_vendor_data(c, &size, &data)) {
+			printf("FAIL %s: vendor data of key %u\n", what, V1_ID(i));
+			errors++;
+		} else {
+			make_vendor_data(V1_ID(i), vendor);
+			if (size != VENDOR_SIZE || memcmp(data, vendor, VENDOR_SIZE)) {
+				printf("FAIL %s: vendor data of key %u read back wrong\n", what,
+				       V1_ID(i));
+				errors++;
+			}
+			free(data);
+		}
+		MUTEX_UNLOCK(disk_cache_lock);
+	}
+
+	if (num_cached() != num_keys) {
+		printf("FAIL %s: %u keys cached, expected %u\n", what, num_cached(), num_keys);
+		errors++;
+	}
+}
+
+/* Write a version 1 PS file (see tcs_tsp.h) with each key the child of the one before it */
+static void
+test_upgrade()
+{
+	BYTE *buf, *p, version;
+	TSS_UUID uuid, parent;
+	UINT32 i;
+	UINT16 size, flags;
+	int fd;
+
+	if ((buf = malloc(sizeof(BYTE) + sizeof(UINT32) +
+			  NUM_V1_KEYS * (2 * sizeof(TSS_UUID) + 3 * sizeof(UINT16) +
+					 sizeof(UINT32) + PUB_SIZE + BLOB_MAX + VENDOR_SIZE)))
+	    == NULL) {
+		printf("FAIL upgrade: out of memory\n");
+		errors++;
+		return;
+	}
+
+	p = buf;
+	*p++ = TSSPS_VERSION;
+	put32(p, NUM_V1_KEYS);
+	p += sizeof(UINT32);
+
+	memset(&parent, 0, sizeof(TSS_UUID));
+	for (i = 0; i < NUM_V1_KEYS; i++) {
+		make_uuid(V1_ID(i), &uuid);
+		memcpy(p, &uuid, sizeof(TSS_UUID));
+		memcpy(p + sizeof(TSS_UUID), &parent, sizeof(TSS_UUID));
+		p += 2 * sizeof(TSS_UUID);
+
+		/* the blob goes after the header and the public key */
+		size = make_blob(V1_ID(i), 0, p + 3 * sizeof(UINT16) + sizeof(UINT32) + PUB_SIZE);
+		flags = V1_REMOVED(i) ? 0 : CACHE_FLAG_VALID | CACHE_FLAG_PARENT_PS_SYSTEM;
+
+		put16(p, PUB_SIZE);
+		put16(p + sizeof(UINT16), size);
+		put32(p + 2 * sizeof(UINT16), V1_VENDOR(i) ? VENDOR_SIZE : 0);
+		put16(p + 2 * sizeof(UINT16) + sizeof(UINT32), flags);
+		p += 3 * sizeof(UINT16) + sizeof(UINT32);
+
+		make_pub(V1_ID(i), p);
+		p += PUB_SIZE + size;
+
+		if (V1_VENDOR(i)) {
+			make_vendor_data(V1_ID(i), p);
+			p += VENDOR_SIZE;
+		}
+
+		memcpy(&parent, &uuid, sizeof(TSS_UUID));
+	}
+
+	remove_files();
+	if (write_file(ps_path, buf, p - buf)) {
+		printf("FAIL upgrade: writing the version 1 file\n");
+		errors++;
+		free(buf);
+		return;
+	}
+	free(buf);
+
+	if (open_ps("upgrade"))
+		return;
+
+	if ((fd = open(ps_path, O_RDONLY)) < 0 || read(fd, &version, 1) != 1 ||
+	    version != TSSPS_VERSION_2) {
+		printf("FAIL upgrade: the file wasn't rewritten as version 2\n");
+		errors++;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	check_v1_keys("upgrade");
+	close_ps();
+
+	/* the second time around, the file is read as version 2 */
+	if (open_ps("upgraded"))
+		return;
+	check_v1_keys("upgraded");
+	close_ps();
+}
+
+static TSS_RESULT
+write_key(UINT32 id, UINT32 variant)
+{
+	BYTE blob[BLOB_MAX];
+	TSS_UUID uuid, parent;
+	UINT16 size;
+
+	make_uuid(id, &uuid);
+	memset(&parent, 0, sizeof(TSS_UUID));
+	size = make_blob(id, variant, blob);
+
+	return ps_write_key(&uuid, &parent, NULL, 0, blob, size);
+}
+
+static TSS_RESULT
+remove_key(UINT32 id)
+{
+	TSS_UUID uuid;
+
+	make_uuid(id, &uuid);
+
+	return ps_remove_key(&uuid);
+}
+
+static int
+read_file(char *path, BYTE **data, UINT32 *size)
+{
+	struct stat stat_buf;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	if (fstat(fd, &stat_buf) || (*data = malloc(stat_buf.st_size + 1)) == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	*size = stat_buf.st_size;
+	if (read(fd, *data, *size) != (ssize_t)*size) {
+		free(*data);
+		*data = NULL;
+		close(fd);
+		return -1;
+	}
+
+	return close(fd);
+}
+
+/*
+ * Commit the keys one at a time, so that each one is a record of its own in the journal, and
+ * replay every complete prefix of the journal over the file as it was before the commits.
+ */
+static void
+test_journal()
+{
+	struct stat stat_buf;
+	BYTE *empty = NULL, *journal = NULL;
+	UINT32 bounds[NUM_JOURNAL_KEYS + 1], cuts[2], empty_size, journal_size, i, j, k;
+	char what[64];
+
+	remove_files();
+	if (open_ps("journal"))
+		return;
+
+	if (read_file(ps_path, &empty, &empty_size)) {
+		printf("FAIL journal: reading the new file\n");
+		errors++;
+		close_ps();
+		return;
+	}
+
+	bounds[0] = 0;
+	for (i = 0; i < NUM_JOURNAL_KEYS; i++) {
+		if (write_key(JOURNAL_ID(i), 0) || stat(journal_path, &stat_buf) ||
+		    stat_buf.st_size <= bounds[i]) {
+			printf("FAIL journal: commit of key %u\n", JOURNAL_ID(i));
+			errors++;
+			close_ps();
+			goto done;
+		}
+		bounds[i + 1] = stat_buf.st_size;
+	}
+
+	if (read_file(journal_path, &journal, &journal_size) ||
+	    journal_size != bounds[NUM_JOURNAL_KEYS]) {
+		printf("FAIL journal: reading the journal\n");
+		errors++;
+		close_ps();
+		goto done;
+	}
+
+	/* this empties the journal, which gets written back over for each replay below */
+	close_ps();
+
+	for (k = 0; k <= NUM_JOURNAL_KEYS; k++) {
+		/* the first k records, and then also the next one short of its last byte */
+		cuts[0] = bounds[k];
+		if (k < NUM_JOURNAL_KEYS)
+			cuts[1] = bounds[k + 1] - 1;
+
+		for (j = 0; j < (k < NUM_JOURNAL_KEYS ? 2 : 1); j++) {
+			sprintf(what, "journal cut at %u of %u bytes", cuts[j], journal_size);
+
+			if (write_file(ps_path, empty, empty_size) ||
+			    write_file(journal_path, journal, cuts[j])) {
+				printf("FAIL %s: writing the files\n", what);
+				errors++;
+				continue;
+			}
+
+			if (open_ps(what))
+				continue;
+
+			for (i = 0; i < NUM_JOURNAL_KEYS; i++)
+				check_key(what, JOURNAL_ID(i), 0, i < k);
+
+			if (num_cached() != k) {
+				printf("FAIL %s: %u keys cached, expected %u\n", what, num_cached(),
+				       k);
+				errors++;
+			}
+
+			if (stat(journal_path, &stat_buf) || stat_buf.st_size != 0) {
+				printf("FAIL %s: the journal wasn't emptied\n", what);
+				errors++;
+			}
+
+			close_ps();
+		}
+	}
+done:
+	free(empty);
+	free(journal);
+}
+
+struct racer {
+	UINT32 variant;
+	TSS_RESULT result;
+	THREAD_TYPE tid;
+};
+
+static void *
+racer_thread(void *arg)
+{
+	struct racer *r = (struct racer *)arg;
+
+	r->result = write_key(RACE_ID(r->variant), r->variant);
+
+	return NULL;
+}
+
+static void
+check_race_winners(const char *what, UINT32 *winners)
+{
+	UINT32 i;
+
+	for (i = 0; i < NUM_RACED_UUIDS; i++)
+		check_key(what, RACE_ID(i), winners[i], TRUE);
+
+	if (num_cached() != NUM_RACED_UUIDS) {
+		printf("FAIL %s: %u keys cached, expected %u\n", what, num_cached(),
+		       NUM_RACED_UUIDS);
+		errors++;
+	}
+}
+
+/*
+ * The first writer to lead a group commit waits for the disk cache lock held here, and the
+ * others queue up behind it for the next leader, which takes them all in one batch.
+ */
+static void
+test_group_commit()
+{
+	struct racer racers[NUM_RACERS];
+	UINT32 winners[NUM_RACED_UUIDS], num, wins, i, j;
+
+	remove_files();
+	if (open_ps("group commit"))
+		return;
+
+	MUTEX_LOCK(disk_cache_lock);
+	for (num = 0; num < NUM_RACERS; num++) {
+		racers[num].variant = num;
+		if (THREAD_CREATE(&racers[num].tid, NULL, racer_thread, &racers[num]))
+			break;
+	}
+	usleep(200000);
+	MUTEX_UNLOCK(disk_cache_lock);
+
+	for (i = 0; i < num; i++)
+		THREAD_JOIN(racers[i].tid, NULL);
+
+	if (num != NUM_RACERS) {
+		printf("FAIL group commit: only %u writers started\n", num);
+		errors++;
+		close_ps();
+		return;
+	}
+
+	for (i = 0; i < NUM_RACED_UUIDS; i++) {
+		winners[i] = i;
+		for (j = i, wins = 0; j < NUM_RACERS; j += NUM_RACED_UUIDS) {
+			if (racers[j].result == TSS_SUCCESS) {
+				winners[i] = j;
+				wins++;
+			} else if (TSS_ERROR_CODE(racers[j].result) !=
+				   TSS_E_KEY_ALREADY_REGISTERED) {
+				printf("FAIL group commit: writer %u failed (0x%x)\n", j,
+				       racers[j].result);
+				errors++;
+			}
+		}
+
+		if (wins != 1) {
+			printf("FAIL group commit: %u writers registered key %u\n", wins,
+			       RACE_ID(i));
+			errors++;
+		}
+	}
+
+	check_race_winners("group commit", winners);
+	close_ps();
+
+	if (open_ps("group commit reopened"))
+		return;
+	check_race_winners("group commit reopened", winners);
+	close_ps();
+}
+
+static struct {
+	UINT32 removed;
+	TSS_BOOL stop;
+} race;
+
+static MUTEX_DECLARE_INIT(race_lock);
+static COND_DECLARE_INIT(race_cond);
+
+struct writer {
+	UINT32 index;
+	UINT32 written;
+	UINT32 failed;
+	THREAD_TYPE tid;
+};
+
+static void *
+writer_thread(void *arg)
+{
+	struct writer *w = (struct writer *)arg;
+	TSS_BOOL stop = FALSE;
+
+	while (w->written < MAX_KEYS_PER_WRITER) {
+		MUTEX_LOCK(race_lock);
+		while (!race.stop && race.removed < (w->written + 1) * REMOVALS_PER_KEY)
+			COND_WAIT(&race_cond, &race_lock);
+		/* the keys the removals made room for still go in */
+		stop = race.removed < (w->written + 1) * REMOVALS_PER_KEY;
+		MUTEX_UNLOCK(race_lock);
+
+		if (stop)
+			break;
+
+		if (write_key(NEW_ID(w->index, w->written), 0))
+			w->failed++;
+		w->written++;
+	}
+
+	return NULL;
+}
+
+static void
+race_advance(UINT32 removed, TSS_BOOL stop)
+{
+	MUTEX_LOCK(race_lock);
+	race.removed += removed;
+	race.stop = stop;
+	COND_BROADCAST(&race_cond);
+	MUTEX_UNLOCK(race_lock);
+}
+
+static UINT32
+free_bytes()
+{
+	UINT32 size;
+
+	MUTEX_LOCK(disk_cache_lock);
+	size = psfile_free_bytes;
+	MUTEX_UNLOCK(disk_cache_lock);
+
+	return size;
+}
+
+/* whether the removed keys take up enough of the file for psfile_maybe_compact() to start */
+static TSS_BOOL
+compaction_due()
+{
+	struct tssps2_header hdr;
+	TSS_BOOL due;
+
+	MUTEX_LOCK(disk_cache_lock);
+	psfile_map_sync(system_ps_fd);
+	due = !psfile_read_header(system_ps_fd, &hdr) && psfile_free_bytes >= COMPACT_MIN &&
+	      psfile_free_bytes >= (hdr.end - TSSPS2_DATA_OFFSET(hdr.num_buckets)) / 2;
+	MUTEX_UNLOCK(disk_cache_lock);
+
+	return due;
+}
+
+static void
+check_compacted_keys(const char *what, struct writer *writers, UINT32 spares_removed)
+{
+	UINT32 i, w, num_keys = NUM_SPARE_KEYS - spares_removed;
+
+	for (i = 0; i < NUM_OLD_KEYS; i++)
+		check_key(what, OLD_ID(i), 0, FALSE);
+
+	for (i = 0; i < NUM_SPARE_KEYS; i++)
+		check_key(what, SPARE_ID(i), 0, i >= spares_removed);
+
+	for (w = 0; w < NUM_WRITERS; w++) {
+		for (i = 0; i < writers[w].written; i++)
+			check_key(what, NEW_ID(w, i), 0, TRUE);
+		num_keys += writers[w].written;
+	}
+
+	if (num_cached() != num_keys) {
+		printf("FAIL %s: %u keys cached, expected %u\n", what, num_cached(), num_keys);
+		errors++;
+	}
+}
+
+/*
+ * Remove keys while the writers add new ones, which starts compactions that race them. Then,
+ * with the writers stopped, remove the spare keys until a compaction is swapped in.
+ */
+static void
+test_compaction()
+{
+	struct writer writers[NUM_WRITERS];
+	struct stat stat_buf;
+	char compact_path[80];
+	UINT32 num, spares_removed, i, j;
+
+	remove_files();
+	if (open_ps("compaction"))
+		return;
+
+	for (i = 0; i < NUM_OLD_KEYS + NUM_SPARE_KEYS; i++) {
+		if (write_key(i < NUM_OLD_KEYS ? OLD_ID(i) : SPARE_ID(i - NUM_OLD_KEYS), 0)) {
+			printf("FAIL compaction: writing key %u\n", i);
+			errors++;
+			close_ps();
+			return;
+		}
+	}
+
+	memset(writers, 0, sizeof(writers));
+	for (num = 0; num < NUM_WRITERS; num++) {
+		writers[num].index = num;
+		if (THREAD_CREATE(&writers[num].tid, NULL, writer_thread, &writers[num]))
+			break;
+	}
+
+	for (i = 0; i < NUM_OLD_KEYS; i++) {
+		if (remove_key(OLD_ID(i))) {
+			printf("FAIL compaction: removing key %u\n", OLD_ID(i));
+			errors++;
+		}
+		race_advance(1, FALSE);
+	}
+
+	race_advance(KEYS_AFTER_REMOVALS * REMOVALS_PER_KEY, FALSE);
+	race_advance(0, TRUE);
+
+	for (i = 0; i < num; i++) {
+		THREAD_JOIN(writers[i].tid, NULL);
+		if (writers[i].failed) {
+			printf("FAIL compaction: writer %u failed %u times\n", i,
+			       writers[i].failed);
+			errors++;
+		}
+	}
+
+	if (num != NUM_WRITERS) {
+		printf("FAIL compaction: only %u writers started\n", num);
+		errors++;
+	}
+
+	/* a compaction that was still running when the writers stopped is thrown away by the
+	 * first of these, which didn't start one of its own. The next one does */
+	for (spares_removed = 0; spares_removed < NUM_SPARE_KEYS && free_bytes();
+	     spares_removed++) {
+		if (remove_key(SPARE_ID(spares_removed))) {
+			printf("FAIL compaction: removing key %u\n", SPARE_ID(spares_removed));
+			errors++;
+		}
+
+		for (j = 0; j < 200 && compaction_due(); j++)
+			usleep(10000);
+	}
+
+	if (free_bytes()) {
+		printf("FAIL compaction: %u bytes of removed keys are left\n", free_bytes());
+		errors++;
+	}
+
+	check_compacted_keys("compaction", writers, spares_removed);
+
+	psfile_compact_final();
+	close_ps();
+
+	sprintf(compact_path, "%s.compact", ps_path);
+	if (!stat(compact_path, &stat_buf)) {
+		printf("FAIL compaction: %s was left behind\n", compact_path);
+		errors++;
+		unlink(compact_path);
+	}
+
+	if (open_ps("compaction reopened"))
+		return;
+
+	check_compacted_keys("compaction reopened", writers, spares_removed);
+	if (psfile_free_bytes) {
+		printf("FAIL compaction reopened: the file has %u bytes of removed keys\n",
+		       psfile_free_bytes);
+		errors++;
+	}
+
+	close_ps();
+}
+
+int
+main(void)
+{
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	sprintf(ps_path, "%s/system.data", dir);
+	sprintf(journal_path, "%s.journal", ps_path);
+	conf.system_ps_file = ps_path;
+
+	test_upgrade();
+	test_journal();
+	test_group_commit();
+	test_compaction();
+
+	remove_files();
+	rmdir(dir);
+
+	printf("%s\n", errors ? "FAILED" : "PASSED");
+
+	return errors ? 1 : 0;
+}
@@ -12,7 +12,7 @@
 #include <stdio.h>
 #include <syslog.h>
 #include <string.h>
-#include <netdb.h>
+#include <netinet/in.h>
 #if (defined (__OpenBSD__) || defined (__FreeBSD__))
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -31,16 +31,22 @@
 #include "rpc_tcstp_tcs.h"
 
 
-/* Lock is not static because we need to reference it in the auth manager */
-MUTEX_DECLARE_INIT(tcsp_lock);
-
+void
+PutBlob_Auth_Special(struct blob_cursor *c, TPM_AUTH *auth)
+{
+	PutBlob(c, TCPA_SHA1BASED_NONCE_LEN, auth->NonceEven.nonce);
+	PutBlob_BOOL(c, auth->fContinueAuthSession);
+	PutBlob(c, TCPA_SHA1BASED_NONCE_LEN, (BYTE *)&auth->HMAC);
+}
 
 void
 LoadBlob_Auth_Special(UINT64 *offset, BYTE *blob, TPM_AUTH *auth)
 {
-	LoadBlob(offset, TCPA_SHA1BASED_NONCE_LEN, blob, auth->NonceEven.nonce);
-	LoadBlob_BOOL(offset, auth->fContinueAuthSession, blob);
-	LoadBlob(offset, TCPA_SHA1BASED_NONCE_LEN, blob, (BYTE *)&auth->HMAC);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_Auth_Special(&c, auth);
+	*offset = c.pos;
 }
 
 void
@@ -109,66 +115,64 @@ initData(struct tcsd_comm_data *comm, int parm_count)
 	memset(comm->buf, 0, comm->buf_size);
 }
 
-int
-loadData(UINT64 *offset, TCSD_PACKET_TYPE data_type, void *data, int data_size, BYTE *blob)
+static TSS_RESULT
+loadData(struct blob_cursor *c, TCSD_PACKET_TYPE data_type, void *data, int data_size)
 {
 	switch (data_type) {
 		case TCSD_PACKET_TYPE_BYTE:
-			LoadBlob_BYTE(offset, *((BYTE *) (data)), blob);
+			PutBlob_BYTE(c, *((BYTE *) (data)));
 			break;
 		case TCSD_PACKET_TYPE_BOOL:
-			LoadBlob_BOOL(offset, *((TSS_BOOL *) (data)), blob);
+			PutBlob_BOOL(c, *((TSS_BOOL *) (data)));
 			break;
 		case TCSD_PACKET_TYPE_UINT16:
-			LoadBlob_UINT16(offset, *((UINT16 *) (data)), blob);
+			PutBlob_UINT16(c, *((UINT16 *) (data)));
 			break;
 		case TCSD_PACKET_TYPE_UINT32:
-			LoadBlob_UINT32(offset, *((UINT32 *) (data)), blob);
+			PutBlob_UINT32(c, *((UINT32 *) (data)));
 			break;
 		case TCSD_PACKET_TYPE_UINT64:
-			LoadBlob_UINT64(offset, *((UINT64 *) (data)), blob);
+			PutBlob_UINT64(c, *((UINT64 *) (data)));
 			break;
 		case TCSD_PACKET_TYPE_PBYTE:
-			LoadBlob(offset, data_size, blob, data);
+			PutBlob(c, data_size, data);
 			break;
 		case TCSD_PACKET_TYPE_NONCE:
-			LoadBlob(offset, sizeof(TCPA_NONCE), blob, ((TCPA_NONCE *)data)->nonce);
+			PutBlob(c, sizeof(TCPA_NONCE), ((TCPA_NONCE *)data)->nonce);
 			break;
 		case TCSD_PACKET_TYPE_DIGEST:
-			LoadBlob(offset, sizeof(TCPA_DIGEST), blob, ((TCPA_DIGEST *)data)->digest);
+			PutBlob(c, sizeof(TCPA_DIGEST), ((TCPA_DIGEST *)data)->digest);
 			break;
 		case TCSD_PACKET_TYPE_AUTH:
-			LoadBlob_Auth_Special(offset, blob, ((TPM_AUTH *)data));
+			PutBlob_Auth_Special(c, ((TPM_AUTH *)data));
 			break;
 #ifdef TSS_BUILD_PS
 		case TCSD_PACKET_TYPE_UUID:
-			LoadBlob_UUID(offset, blob, *((TSS_UUID *)data));
+			PutBlob_UUID(c, ((TSS_UUID *)data));
 			break;
 		case TCSD_PACKET_TYPE_KM_KEYINFO:
-			LoadBlob_KM_KEYINFO(offset, blob, ((TSS_KM_KEYINFO *)data));
+			PutBlob_KM_KEYINFO(c, ((TSS_KM_KEYINFO *)data));
 			break;
 		case TCSD_PACKET_TYPE_KM_KEYINFO2:
-			LoadBlob_KM_KEYINFO2(offset, blob, ((TSS_KM_KEYINFO2 *)data));
+			PutBlob_KM_KEYINFO2(c, ((TSS_KM_KEYINFO2 *)data));
 			break;
 		case TCSD_PACKET_TYPE_LOADKEY_INFO:
-			LoadBlob_LOADKEY_INFO(offset, blob, ((TCS_LOADKEY_INFO *)data));
+			PutBlob_LOADKEY_INFO(c, ((TCS_LOADKEY_INFO *)data));
 			break;
 #endif
 		case TCSD_PACKET_TYPE_ENCAUTH:
-			LoadBlob(offset, sizeof(TCPA_ENCAUTH), blob,
-				 ((TCPA_ENCAUTH *)data)->authdata);
+			PutBlob(c, sizeof(TCPA_ENCAUTH), ((TCPA_ENCAUTH *)data)->authdata);
 			break;
 		case TCSD_PACKET_TYPE_VERSION:
-			LoadBlob_VERSION(offset, blob, ((TPM_VERSION *)data));
+			PutBlob_VERSION(c, ((TPM_VERSION *)data));
 			break;
 #ifdef TSS_BUILD_PCR_EVENTS
 		case TCSD_PACKET_TYPE_PCR_EVENT:
-			LoadBlob_PCR_EVENT(offset, blob, ((TSS_PCR_EVENT *)data));
+			PutBlob_PCR_EVENT(c, ((TSS_PCR_EVENT *)data));
 			break;
 #endif
 		case TCSD_PACKET_TYPE_SECRET:
-			LoadBlob(offset, sizeof(TCPA_SECRET), blob,
-				 ((TCPA_SECRET *)data)->authdata);
+			PutBlob(c, sizeof(TCPA_SECRET), ((TCPA_SECRET *)data)->authdata);
 			break;
 		default:
 			LogError("TCSD packet type unknown! (0x%x)", data_type & 0xff);
@@ -186,20 +190,28 @@ setData(TCSD_PACKET_TYPE dataType,
 	int theDataSize,
 	struct tcsd_comm_data *comm)
 {
-	UINT64 old_offset, offset;
+	UINT64 old_offset;
 	TSS_RESULT result;
 	TCSD_PACKET_TYPE *type;
+	struct blob_cursor c;
 
-	/* Calculate the size of the area needed (use NULL for blob address) */
-	offset = 0;
-	if ((result = loadData(&offset, dataType, theData, theDataSize, NULL)) != TSS_SUCCESS)
+	/* Encode straight into the packet buffer. If the parameter doesn't fit, size it, grow
+	 * the buffer and encode it again */
+	old_offset = comm->hdr.parm_offset + comm->hdr.parm_size;
+	blob_cursor_init(&c, comm->buf, comm->buf_size, old_offset);
+	if ((result = loadData(&c, dataType, theData, theDataSize)) != TSS_SUCCESS)
 		return result;
 
-	if ((comm->hdr.packet_size + offset) > comm->buf_size) {
-		/* reallocate the buffer */
+	if (!blob_cursor_ok(&c)) {
 		BYTE *buffer;
-		int buffer_size = comm->hdr.packet_size + offset;
+		int buffer_size;
 
+		blob_cursor_init_sizer(&c, old_offset);
+		if ((result = loadData(&c, dataType, theData, theDataSize)) != TSS_SUCCESS)
+			return result;
+
+		/* reallocate the buffer */
+		buffer_size = c.pos;
 		LogDebug("Increasing communication buffer to %d bytes.", buffer_size);
 		buffer = realloc(comm->buf, buffer_size);
 		if (buffer == NULL) {
@@ -208,17 +220,18 @@ setData(TCSD_PACKET_TYPE dataType,
 		}
 		comm->buf_size = buffer_size;
 		comm->buf = buffer;
+
+		blob_cursor_init(&c, comm->buf, comm->buf_size, old_offset);
+		if ((result = loadData(&c, dataType, theData, theDataSize)) != TSS_SUCCESS)
+			return result;
 	}
 
-	offset = old_offset = comm->hdr.parm_offset + comm->hdr.parm_size;
-	if ((result = loadData(&offset, dataType, theData, theDataSize, comm->buf)) != TSS_SUCCESS)
-		return result;
 	type = (TCSD_PACKET_TYPE *)(comm->buf + comm->hdr.type_offset) + index;
 	*type = dataType;
 	comm->hdr.type_size += sizeof(TCSD_PACKET_TYPE);
-	comm->hdr.parm_size += (offset - old_offset);
+	comm->hdr.parm_size += (c.pos - old_offset);
 
-	comm->hdr.packet_size = offset;
+	comm->hdr.packet_size = c.pos;
 	comm->hdr.num_parms++;
 
 	return TSS_SUCCESS;
@@ -512,58 +525,109 @@ DispatchTable tcs_func_table[TCSD_MAX_NUM_ORDS] = {
 	{tcs_wrap_CMK_ConvertMigration,"CMK_ConvertMigration"},
 	{tcs_wrap_FlushSpecific,"FlushSpecific"}, /* 120 */
 	{tcs_wrap_KeyControlOwner, "KeyControlOwner"},
-	{tcs_wrap_DSAP, "DSAP"}
+	{tcs_wrap_DSAP, "DSAP"},
+	{tcs_wrap_GetPcrEventLogPage, "GetPcrEventLogPage"},
+	{tcs_wrap_GetPcrEventsSince, "GetPcrEventsSince"}, /* 124 */
+	{tcs_wrap_RegisterKeys, "RegisterKeys"},
+	{tcs_wrap_UnregisterKeys, "UnregisterKeys"}
 };
 
+/*
+ * Work out which ordinals the peer at @addr may call. This is done once, when it connects, so
+ * that each request only has to test a bit. Local peers may call any ordinal. Remote ones may
+ * call the remote_ops ordinals, if they connect from one of the remote_hosts networks. Returns
+ * nonzero if the peer may call nothing at all.
+ */
 int
-access_control(struct tcsd_thread_data *thread_data)
+access_control_init(struct tcsd_thread_data *data, struct sockaddr_in *addr)
 {
-	int i = 0;
-	struct hostent *local_hostent = NULL;
-	static char *localhostname = NULL;
-	static int localhostname_len = 0;
-
-	if (!localhostname) {
-		if ((local_hostent = gethostbyname("localhost")) == NULL) {
-			LogError("Error resolving localhost: %s", hstrerror(h_errno));
-			return 1;
-		}
+	UINT32 peer = ntohl(addr->sin_addr.s_addr), i;
 
-		LogDebugFn("Cached local hostent:");
-		LogDebugFn("h_name: %s", local_hostent->h_name);
-		for (i = 0; local_hostent->h_aliases[i]; i++) {
-			LogDebugFn("h_aliases[%d]: %s", i, local_hostent->h_aliases[i]);
+	if (addr->sin_family == AF_INET && (peer >> 24) == IN_LOOPBACKNET) {
+		memset(data->ops, 0xff, sizeof(data->ops));
+		return 0;
+	}
+
+	memset(data->ops, 0, sizeof(data->ops));
+
+	if (addr->sin_family != AF_INET)
+		return 1;
+
+	if (tcsd_options.num_remote_hosts) {
+		for (i = 0; i < tcsd_options.num_remote_hosts; i++) {
+			if ((peer & tcsd_options.remote_hosts[i].mask) ==
+			    tcsd_options.remote_hosts[i].addr)
+				break;
 		}
-		LogDebugFn("h_addrtype: %s",
-			   (local_hostent->h_addrtype == AF_INET6 ? "AF_INET6" : "AF_INET"));
 
-		localhostname_len = strlen(local_hostent->h_name);
-		if ((localhostname = strdup(local_hostent->h_name)) == NULL) {
-			LogError("malloc of %d bytes failed.", localhostname_len);
-			return TCSERR(TSS_E_OUTOFMEMORY);
+		if (i == tcsd_options.num_remote_hosts) {
+			LogWarn("%s is not on any of the remote_hosts networks", data->hostname);
+			return 1;
 		}
 	}
 
-	/* if the request comes from localhost, or is in the accepted ops list,
-	 * approve it */
-	if (!strncmp(thread_data->hostname, localhostname,
-		     MIN((size_t)localhostname_len, strlen(thread_data->hostname)))) {
-		return 0;
-	} else {
-		while (tcsd_options.remote_ops[i]) {
-			if ((UINT32)tcsd_options.remote_ops[i] == thread_data->comm.hdr.u.ordinal) {
-				LogInfo("Accepted %s operation from %s",
-					tcs_func_table[thread_data->comm.hdr.u.ordinal].name,
-					thread_data->hostname);
-				return 0;
-			}
-			i++;
-		}
+	memcpy(data->ops, tcsd_options.remote_ops_map, sizeof(data->ops));
+
+	for (i = 0; i < TCSD_ORD_MAP_WORDS; i++) {
+		if (data->ops[i])
+			return 0;
 	}
 
 	return 1;
 }
 
+/* The ordinals that don't touch the key caches, which can be served before tcsd_wait_ready()
+ * returns */
+static TSS_BOOL
+ordinal_is_early(UINT32 ordinal)
+{
+	switch (ordinal) {
+		case TCSD_ORD_OPENCONTEXT:
+		case TCSD_ORD_FREEMEMORY:
+		case TCSD_ORD_TCSGETCAPABILITY:
+		case TCSD_ORD_LOGPCREVENT:
+		case TCSD_ORD_GETPCREVENT:
+		case TCSD_ORD_GETPCREVENTBYPCR:
+		case TCSD_ORD_GETPCREVENTLOG:
+		case TCSD_ORD_GETPCREVENTLOGPAGE:
+		case TCSD_ORD_GETPCREVENTSSINCE:
+		case TCSD_ORD_OIAP:
+		case TCSD_ORD_EXTEND:
+		case TCSD_ORD_PCRREAD:
+		case TCSD_ORD_PCRRESET:
+		case TCSD_ORD_GETRANDOM:
+		case TCSD_ORD_STIRRANDOM:
+		case TCSD_ORD_GETCAPABILITY:
+		case TCSD_ORD_READPUBEK:
+		case TCSD_ORD_SELFTESTFULL:
+		case TCSD_ORD_GETTESTRESULT:
+		case TCSD_ORD_READCOUNTER:
+		case TCSD_ORD_READCURRENTTICKS:
+		case TCSD_ORD_NVREADVALUE:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/* Answer the request with just @result */
+static void
+set_result_packet(struct tcsd_thread_data *data, TSS_RESULT result)
+{
+	UINT64 offset;
+
+	/* set platform header */
+	memset(&data->comm.hdr, 0, sizeof(data->comm.hdr));
+	data->comm.hdr.packet_size = sizeof(struct tcsd_packet_hdr);
+	data->comm.hdr.u.result = result;
+
+	/* set the comm buffer */
+	memset(data->comm.buf, 0, data->comm.buf_size);
+	offset = 0;
+	LoadBlob_UINT32(&offset, data->comm.hdr.packet_size, data->comm.buf);
+	LoadBlob_UINT32(&offset, data->comm.hdr.u.result, data->comm.buf);
+}
+
 TSS_RESULT
 dispatchCommand(struct tcsd_thread_data *data)
 {
@@ -577,22 +641,17 @@ dispatchCommand(struct tcsd_thread_data *data)
 	}
 
 	LogDebug("Dispatching ordinal %u", data->comm.hdr.u.ordinal);
-	/* We only need to check access_control if there are remote operations that are defined
-	 * in the config file, which means we allow remote connections */
-	if (tcsd_options.remote_ops[0] && access_control(data)) {
+	if (!TCSD_ORD_MAP_TEST(data->ops, data->comm.hdr.u.ordinal)) {
 		LogWarn("Denied %s operation from %s",
 			tcs_func_table[data->comm.hdr.u.ordinal].name, data->hostname);
+		/* not TSS_E_FAIL, which is the answer to an ordinal the tcsd doesn't know */
+		set_result_packet(data, TCSERR(TSS_E_INVALID_OBJ_ACCESS));
 
-		/* set platform header */
-		memset(&data->comm.hdr, 0, sizeof(data->comm.hdr));
-		data->comm.hdr.packet_size = sizeof(struct tcsd_packet_hdr);
-		data->comm.hdr.u.result = TCSERR(TSS_E_FAIL);
+		return TSS_SUCCESS;
+	}
 
-		/* set the comm buffer */
-		memset(data->comm.buf, 0, data->comm.buf_size);
-		offset = 0;
-		LoadBlob_UINT32(&offset, data->comm.hdr.packet_size, data->comm.buf);
-		LoadBlob_UINT32(&offset, data->comm.hdr.u.result, data->comm.buf);
+	if (!ordinal_is_early(data->comm.hdr.u.ordinal) && (result = tcsd_wait_ready())) {
+		set_result_packet(data, result);
 
 		return TSS_SUCCESS;
 	}
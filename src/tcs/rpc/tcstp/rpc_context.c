@@ -27,24 +27,45 @@
 #include "rpc_tcstp_tcs.h"
 
 
+/*
+ * A TSP that wants a TPM other than the first one the tcsd serves sends the index of its node in
+ * the tpm_device option. The context is bound to that TPM, and so is the thread serving the
+ * connection from then on. The index is sent back, which a tcsd that serves a single TPM and
+ * ignores the request doesn't do.
+ */
 TSS_RESULT
 tcs_wrap_OpenContext(struct tcsd_thread_data *data)
 {
 	TCS_CONTEXT_HANDLE hContext;
 	TSS_RESULT result;
-	UINT32 tpm_version = tpm_metrics.version.minor;
+	UINT32 tpm_version, device = 0;
+	int num_parms = 2;
 
 	LogDebugFn("thread %ld", THREAD_ID);
 
-	result = TCS_OpenContext_Internal(&hContext);
+	if (data->comm.hdr.num_parms > 0) {
+		if (getData(TCSD_PACKET_TYPE_UINT32, 0, &device, 0, &data->comm))
+			return TCSERR(TSS_E_INTERNAL_ERROR);
+		num_parms = 3;
+	}
+
+	if ((result = tcs_device_select(device)) == TSS_SUCCESS)
+		result = TCS_OpenContext_Internal(&hContext);
+
 	if (result == TSS_SUCCESS) {
-		initData(&data->comm, 2);
+		tpm_version = tpm_metrics.version.minor;
+
+		initData(&data->comm, num_parms);
 		if (setData(TCSD_PACKET_TYPE_UINT32, 0, &hContext, 0, &data->comm))
 			return TCSERR(TSS_E_INTERNAL_ERROR);
 
 		if (setData(TCSD_PACKET_TYPE_UINT32, 1, &tpm_version, 0, &data->comm))
 			return TCSERR(TSS_E_INTERNAL_ERROR);
 
+		if (num_parms == 3 &&
+		    setData(TCSD_PACKET_TYPE_UINT32, 2, &device, 0, &data->comm))
+			return TCSERR(TSS_E_INTERNAL_ERROR);
+
 		/* Set the context in the thread's object. Later, if something goes wrong
 		 * and the connection can't be closed cleanly, we'll still have a reference
 		 * to what resources need to be freed. */
@@ -187,6 +187,114 @@ tcs_wrap_GetPcrEventLog(struct tcsd_thread_data *data)
 	return TSS_SUCCESS;
 }
 
+TSS_RESULT
+tcs_wrap_GetPcrEventLogPage(struct tcsd_thread_data *data)
+{
+	TCS_CONTEXT_HANDLE hContext;
+	TSS_PCR_EVENT *ppEvents = NULL;
+	TSS_RESULT result;
+	UINT32 pcrIndex, sequence, maxSize, eventCount, i, j;
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 0, &hContext, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	LogDebugFn("thread %ld context %x", THREAD_ID, hContext);
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 1, &pcrIndex, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 2, &sequence, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 3, &maxSize, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	result = TCS_GetPcrEventLogPage_Internal(hContext, &pcrIndex, &sequence, maxSize,
+						 &eventCount, &ppEvents);
+	/* TSS_E_FAIL tells the TSP that this tcsd doesn't know the ordinal */
+	if (result == TCSERR(TSS_E_FAIL))
+		result = TCSERR(TSS_E_INTERNAL_ERROR);
+
+	if (result == TSS_SUCCESS) {
+		initData(&data->comm, eventCount + 3);
+		if (setData(TCSD_PACKET_TYPE_UINT32, 0, &pcrIndex, 0, &data->comm) ||
+		    setData(TCSD_PACKET_TYPE_UINT32, 1, &sequence, 0, &data->comm) ||
+		    setData(TCSD_PACKET_TYPE_UINT32, 2, &eventCount, 0, &data->comm)) {
+			free_external_events(eventCount, ppEvents);
+			free(ppEvents);
+			return TCSERR(TSS_E_INTERNAL_ERROR);
+		}
+
+		i = 3;
+		for (j = 0; j < eventCount; j++) {
+			if (setData(TCSD_PACKET_TYPE_PCR_EVENT, i++, &(ppEvents[j]), 0, &data->comm)) {
+				free_external_events(eventCount, ppEvents);
+				free(ppEvents);
+				return TCSERR(TSS_E_INTERNAL_ERROR);
+			}
+		}
+
+		free_external_events(eventCount, ppEvents);
+		free(ppEvents);
+	} else
+		initData(&data->comm, 0);
+
+	data->comm.hdr.u.result = result;
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+tcs_wrap_GetPcrEventsSince(struct tcsd_thread_data *data)
+{
+	TCS_CONTEXT_HANDLE hContext;
+	TSS_PCR_EVENT *ppEvents = NULL;
+	TCPA_DIGEST aggregate;
+	TSS_RESULT result;
+	UINT32 pcrIndex, since, eventCount, i, j;
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 0, &hContext, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	LogDebugFn("thread %ld context %x", THREAD_ID, hContext);
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 1, &pcrIndex, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 2, &since, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	result = TCS_GetPcrEventsSince_Internal(hContext, pcrIndex, since, &eventCount,
+						&ppEvents, &aggregate);
+
+	if (result == TSS_SUCCESS) {
+		initData(&data->comm, eventCount + 2);
+		if (setData(TCSD_PACKET_TYPE_UINT32, 0, &eventCount, 0, &data->comm) ||
+		    setData(TCSD_PACKET_TYPE_DIGEST, 1, &aggregate, 0, &data->comm)) {
+			free_external_events(eventCount, ppEvents);
+			free(ppEvents);
+			return TCSERR(TSS_E_INTERNAL_ERROR);
+		}
+
+		i = 2;
+		for (j = 0; j < eventCount; j++) {
+			if (setData(TCSD_PACKET_TYPE_PCR_EVENT, i++, &(ppEvents[j]), 0, &data->comm)) {
+				free_external_events(eventCount, ppEvents);
+				free(ppEvents);
+				return TCSERR(TSS_E_INTERNAL_ERROR);
+			}
+		}
+
+		free_external_events(eventCount, ppEvents);
+		free(ppEvents);
+	} else
+		initData(&data->comm, 0);
+
+	data->comm.hdr.u.result = result;
+
+	return TSS_SUCCESS;
+}
+
 TSS_RESULT
 tcs_wrap_LogPcrEvent(struct tcsd_thread_data *data)
 {
@@ -220,20 +328,25 @@ tcs_wrap_LogPcrEvent(struct tcsd_thread_data *data)
 }
 
 void
-LoadBlob_PCR_EVENT(UINT64 *offset, BYTE *blob, TSS_PCR_EVENT *event)
+PutBlob_PCR_EVENT(struct blob_cursor *c, TSS_PCR_EVENT *event)
 {
-	LoadBlob_VERSION(offset, blob, (TPM_VERSION *)&(event->versionInfo));
-	LoadBlob_UINT32(offset, event->ulPcrIndex, blob);
-	LoadBlob_UINT32(offset, event->eventType, blob);
-
-	LoadBlob_UINT32(offset, event->ulPcrValueLength, blob);
-	if (event->ulPcrValueLength > 0)
-		LoadBlob(offset, event->ulPcrValueLength, blob, event->rgbPcrValue);
+	PutBlob_VERSION(c, (TPM_VERSION *)&(event->versionInfo));
+	PutBlob_UINT32(c, event->ulPcrIndex);
+	PutBlob_UINT32(c, event->eventType);
+	PutBlob_UINT32(c, event->ulPcrValueLength);
+	PutBlob(c, event->ulPcrValueLength, event->rgbPcrValue);
+	PutBlob_UINT32(c, event->ulEventLength);
+	PutBlob(c, event->ulEventLength, event->rgbEvent);
+}
 
-	LoadBlob_UINT32(offset, event->ulEventLength, blob);
-	if (event->ulEventLength > 0)
-		LoadBlob(offset, event->ulEventLength, blob, event->rgbEvent);
+void
+LoadBlob_PCR_EVENT(UINT64 *offset, BYTE *blob, TSS_PCR_EVENT *event)
+{
+	struct blob_cursor c;
 
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_PCR_EVENT(&c, event);
+	*offset = c.pos;
 }
 
 TSS_RESULT
@@ -116,6 +116,144 @@ tcs_wrap_UnregisterKey(struct tcsd_thread_data *data)
 	return TSS_SUCCESS;
 }
 
+/* TCSD_ORD_REGISTERKEYS carries the context, the key count and the vendor data, followed by
+ * the parent UUID, UUID, blob size and blob of each key */
+TSS_RESULT
+tcs_wrap_RegisterKeys(struct tcsd_thread_data *data)
+{
+	TCS_CONTEXT_HANDLE hContext;
+	UINT32 count, cVendorData, i, *cKeySizes = NULL;
+	TSS_UUID *WrappingKeyUUIDs = NULL, *KeyUUIDs = NULL;
+	BYTE **rgbKeys = NULL, *gbVendorData = NULL;
+	TSS_RESULT result;
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 0, &hContext, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	LogDebugFn("thread %ld context %x", THREAD_ID, hContext);
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 1, &count, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	if (getData(TCSD_PACKET_TYPE_UINT32, 2, &cVendorData, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	/* the count has to agree with the number of parameters actually sent */
+	if (count == 0 || data->comm.hdr.num_parms < 4 ||
+	    count != (data->comm.hdr.num_parms - 4) / 4 ||
+	    (data->comm.hdr.num_parms - 4) % 4)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	if (cVendorData) {
+		if ((gbVendorData = calloc(1, cVendorData)) == NULL) {
+			LogError("malloc of %u bytes failed.", cVendorData);
+			return TCSERR(TSS_E_OUTOFMEMORY);
+		}
+
+		if (getData(TCSD_PACKET_TYPE_PBYTE, 3, gbVendorData, cVendorData, &data->comm)) {
+			free(gbVendorData);
+			return TCSERR(TSS_E_INTERNAL_ERROR);
+		}
+	}
+
+	WrappingKeyUUIDs = calloc(count, sizeof(TSS_UUID));
+	KeyUUIDs = calloc(count, sizeof(TSS_UUID));
+	cKeySizes = calloc(count, sizeof(UINT32));
+	rgbKeys = calloc(count, sizeof(BYTE *));
+	if (!WrappingKeyUUIDs || !KeyUUIDs || !cKeySizes || !rgbKeys) {
+		LogError("malloc of %zd bytes failed.",
+			 count * ((2 * sizeof(TSS_UUID)) + sizeof(UINT32) + sizeof(BYTE *)));
+		result = TCSERR(TSS_E_OUTOFMEMORY);
+		goto done;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (getData(TCSD_PACKET_TYPE_UUID, 4 + (4 * i), &WrappingKeyUUIDs[i], 0,
+			    &data->comm) ||
+		    getData(TCSD_PACKET_TYPE_UUID, 5 + (4 * i), &KeyUUIDs[i], 0, &data->comm) ||
+		    getData(TCSD_PACKET_TYPE_UINT32, 6 + (4 * i), &cKeySizes[i], 0,
+			    &data->comm)) {
+			result = TCSERR(TSS_E_INTERNAL_ERROR);
+			goto done;
+		}
+
+		if ((rgbKeys[i] = calloc(1, cKeySizes[i])) == NULL) {
+			LogError("malloc of %u bytes failed.", cKeySizes[i]);
+			result = TCSERR(TSS_E_OUTOFMEMORY);
+			goto done;
+		}
+		if (getData(TCSD_PACKET_TYPE_PBYTE, 7 + (4 * i), rgbKeys[i], cKeySizes[i],
+			    &data->comm)) {
+			result = TCSERR(TSS_E_INTERNAL_ERROR);
+			goto done;
+		}
+	}
+
+	result = TCS_RegisterKeys_Internal(hContext, count, WrappingKeyUUIDs, KeyUUIDs,
+					   cKeySizes, rgbKeys, cVendorData, gbVendorData);
+	/* TSS_E_FAIL tells the TSP that this tcsd doesn't know the ordinal */
+	if (result == TCSERR(TSS_E_FAIL))
+		result = TCSERR(TSS_E_INTERNAL_ERROR);
+
+	initData(&data->comm, 0);
+	data->comm.hdr.u.result = result;
+	result = TSS_SUCCESS;
+done:
+	if (rgbKeys) {
+		for (i = 0; i < count; i++)
+			free(rgbKeys[i]);
+	}
+	free(rgbKeys);
+	free(cKeySizes);
+	free(KeyUUIDs);
+	free(WrappingKeyUUIDs);
+	free(gbVendorData);
+
+	return result;
+}
+
+TSS_RESULT
+tcs_wrap_UnregisterKeys(struct tcsd_thread_data *data)
+{
+	TCS_CONTEXT_HANDLE hContext;
+	TSS_UUID *uuids;
+	UINT32 count, i;
+	TSS_RESULT result;
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 0, &hContext, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	LogDebugFn("thread %ld context %x", THREAD_ID, hContext);
+
+	if (getData(TCSD_PACKET_TYPE_UINT32, 1, &count, 0, &data->comm))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	if (count == 0 || data->comm.hdr.num_parms < 2 || count != data->comm.hdr.num_parms - 2)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	if ((uuids = calloc(count, sizeof(TSS_UUID))) == NULL) {
+		LogError("malloc of %zd bytes failed.", count * sizeof(TSS_UUID));
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (getData(TCSD_PACKET_TYPE_UUID, 2 + i, &uuids[i], 0, &data->comm)) {
+			free(uuids);
+			return TCSERR(TSS_E_INTERNAL_ERROR);
+		}
+	}
+
+	result = TCS_UnregisterKeys_Internal(hContext, count, uuids);
+	free(uuids);
+	/* TSS_E_FAIL tells the TSP that this tcsd doesn't know the ordinal */
+	if (result == TCSERR(TSS_E_FAIL))
+		result = TCSERR(TSS_E_INTERNAL_ERROR);
+
+	initData(&data->comm, 0);
+	data->comm.hdr.u.result = result;
+
+	return TSS_SUCCESS;
+}
+
 TSS_RESULT
 tcs_wrap_GetRegisteredKeyBlob(struct tcsd_thread_data *data)
 {
@@ -362,17 +500,27 @@ tcs_wrap_GetRegisteredKeyByPublicInfo(struct tcsd_thread_data *data)
 	return TSS_SUCCESS;
 }
 
+void
+PutBlob_LOADKEY_INFO(struct blob_cursor *c, TCS_LOADKEY_INFO *info)
+{
+	PutBlob_UUID(c, &info->keyUUID);
+	PutBlob_UUID(c, &info->parentKeyUUID);
+	PutBlob(c, TCPA_DIGEST_SIZE, info->paramDigest.digest);
+	PutBlob_UINT32(c, info->authData.AuthHandle);
+	PutBlob(c, TCPA_NONCE_SIZE, info->authData.NonceOdd.nonce);
+	PutBlob(c, TCPA_NONCE_SIZE, info->authData.NonceEven.nonce);
+	PutBlob_BOOL(c, info->authData.fContinueAuthSession);
+	PutBlob(c, TCPA_AUTHDATA_SIZE, (BYTE *)&info->authData.HMAC);
+}
+
 void
 LoadBlob_LOADKEY_INFO(UINT64 *offset, BYTE *blob, TCS_LOADKEY_INFO *info)
 {
-	LoadBlob_UUID(offset, blob, info->keyUUID);
-	LoadBlob_UUID(offset, blob, info->parentKeyUUID);
-	LoadBlob(offset, TCPA_DIGEST_SIZE, blob, info->paramDigest.digest);
-	LoadBlob_UINT32(offset, info->authData.AuthHandle, blob);
-	LoadBlob(offset, TCPA_NONCE_SIZE, blob, info->authData.NonceOdd.nonce);
-	LoadBlob(offset, TCPA_NONCE_SIZE, blob, info->authData.NonceEven.nonce);
-	LoadBlob_BOOL(offset, info->authData.fContinueAuthSession, blob);
-	LoadBlob(offset, TCPA_AUTHDATA_SIZE, blob, (BYTE *)&info->authData.HMAC);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_LOADKEY_INFO(&c, info);
+	*offset = c.pos;
 }
 
 void
@@ -401,15 +549,25 @@ UnloadBlob_LOADKEY_INFO(UINT64 *offset, BYTE *blob, TCS_LOADKEY_INFO *info)
 	UnloadBlob(offset, TCPA_DIGEST_SIZE, blob, (BYTE *)&info->authData.HMAC);
 }
 
+void
+PutBlob_UUID(struct blob_cursor *c, TSS_UUID *uuid)
+{
+	PutBlob_UINT32(c, uuid->ulTimeLow);
+	PutBlob_UINT16(c, uuid->usTimeMid);
+	PutBlob_UINT16(c, uuid->usTimeHigh);
+	PutBlob_BYTE(c, uuid->bClockSeqHigh);
+	PutBlob_BYTE(c, uuid->bClockSeqLow);
+	PutBlob(c, 6, uuid->rgbNode);
+}
+
 void
 LoadBlob_UUID(UINT64 *offset, BYTE * blob, TSS_UUID uuid)
 {
-        LoadBlob_UINT32(offset, uuid.ulTimeLow, blob);
-        LoadBlob_UINT16(offset, uuid.usTimeMid, blob);
-        LoadBlob_UINT16(offset, uuid.usTimeHigh, blob);
-        LoadBlob_BYTE(offset, uuid.bClockSeqHigh, blob);
-        LoadBlob_BYTE(offset, uuid.bClockSeqLow, blob);
-        LoadBlob(offset, 6, blob, uuid.rgbNode);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_UUID(&c, &uuid);
+	*offset = c.pos;
 }
 
 void
@@ -435,32 +593,52 @@ UnloadBlob_UUID(UINT64 *offset, BYTE * blob, TSS_UUID *uuid)
         UnloadBlob(offset, 6, blob, uuid->rgbNode);
 }
 
+void
+PutBlob_KM_KEYINFO(struct blob_cursor *c, TSS_KM_KEYINFO *info)
+{
+	PutBlob_VERSION(c, (TPM_VERSION *)&(info->versionInfo));
+	PutBlob_UUID(c, &info->keyUUID);
+	PutBlob_UUID(c, &info->parentKeyUUID);
+	PutBlob_BYTE(c, info->bAuthDataUsage);
+	PutBlob_BOOL(c, info->fIsLoaded);
+	PutBlob_UINT32(c, info->ulVendorDataLength);
+	PutBlob(c, info->ulVendorDataLength, info->rgbVendorData);
+}
+
 void
 LoadBlob_KM_KEYINFO(UINT64 *offset, BYTE *blob, TSS_KM_KEYINFO *info)
 {
-	LoadBlob_VERSION(offset, blob, (TPM_VERSION *)&(info->versionInfo));
-	LoadBlob_UUID(offset, blob, info->keyUUID);
-	LoadBlob_UUID(offset, blob, info->parentKeyUUID);
-	LoadBlob_BYTE(offset, info->bAuthDataUsage, blob);
-	LoadBlob_BOOL(offset, info->fIsLoaded, blob);
-	LoadBlob_UINT32(offset, info->ulVendorDataLength, blob);
-	LoadBlob(offset, info->ulVendorDataLength, blob, info->rgbVendorData);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_KM_KEYINFO(&c, info);
+	*offset = c.pos;
 }
 
 void
-LoadBlob_KM_KEYINFO2(UINT64 *offset, BYTE *blob, TSS_KM_KEYINFO2 *info)
+PutBlob_KM_KEYINFO2(struct blob_cursor *c, TSS_KM_KEYINFO2 *info)
 {
-	LoadBlob_VERSION(offset, blob, (TPM_VERSION *)&(info->versionInfo));
-	LoadBlob_UUID(offset, blob, info->keyUUID);
-	LoadBlob_UUID(offset, blob, info->parentKeyUUID);
-	LoadBlob_BYTE(offset, info->bAuthDataUsage, blob);
+	PutBlob_VERSION(c, (TPM_VERSION *)&(info->versionInfo));
+	PutBlob_UUID(c, &info->keyUUID);
+	PutBlob_UUID(c, &info->parentKeyUUID);
+	PutBlob_BYTE(c, info->bAuthDataUsage);
 	/* Load the infos of the blob regarding the new data type TSS_KM_KEYINFO2 */
-	LoadBlob_UINT32(offset,info->persistentStorageType,blob);
-	LoadBlob_UINT32(offset, info->persistentStorageTypeParent,blob);
+	PutBlob_UINT32(c, info->persistentStorageType);
+	PutBlob_UINT32(c, info->persistentStorageTypeParent);
+
+	PutBlob_BOOL(c, info->fIsLoaded);
+	PutBlob_UINT32(c, info->ulVendorDataLength);
+	PutBlob(c, info->ulVendorDataLength, info->rgbVendorData);
+}
+
+void
+LoadBlob_KM_KEYINFO2(UINT64 *offset, BYTE *blob, TSS_KM_KEYINFO2 *info)
+{
+	struct blob_cursor c;
 
-	LoadBlob_BOOL(offset, info->fIsLoaded, blob);
-	LoadBlob_UINT32(offset, info->ulVendorDataLength, blob);
-	LoadBlob(offset, info->ulVendorDataLength, blob, info->rgbVendorData);
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_KM_KEYINFO2(&c, info);
+	*offset = c.pos;
 }
 
 void
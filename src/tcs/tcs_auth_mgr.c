@@ -26,7 +26,9 @@
 #include "req_mgr.h"
 
 
-MUTEX_DECLARE_EXTERN(tcsp_lock);
+/* the auth sessions of the current thread's TPM */
+#define auth_mgr	(tcs_device_current()->auth)
+#define auth_mgr_lock	(tcs_device_current()->auth_lock)
 
 /* Note: The after taking the auth_mgr_lock in any of the functions below, the
  * mem_cache_lock cannot be taken without risking a deadlock. So, the auth_mgr
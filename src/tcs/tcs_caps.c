@@ -29,33 +29,49 @@
 #include "tcslog.h"
 #include "tddl.h"
 #include "req_mgr.h"
+#include "tcsd.h"
 
 
+/* Read the TPM's version information, the 1.2 way if it understands that. @capArea says which
+ * way it was read */
+static TSS_RESULT
+get_version_cap(TCPA_CAPABILITY_AREA *capArea, UINT32 *respSize, BYTE **resp)
+{
+	TSS_RESULT result;
+
+	/* try the 1.2 way first */
+	*capArea = TPM_CAP_VERSION_VAL;
+	result = TCSP_GetCapability_Internal(InternalContext, *capArea, 0, NULL, respSize, resp);
+	if (result == TCPA_E_BAD_MODE) {
+		/* if the TPM doesn't understand VERSION_VAL, try the 1.1 way */
+		*capArea = TCPA_CAP_VERSION;
+		result = TCSP_GetCapability_Internal(InternalContext, *capArea, 0, NULL, respSize,
+						     resp);
+	}
+
+	return result;
+}
+
+static void
+unload_version_cap(TCPA_CAPABILITY_AREA capArea, BYTE *resp, TPM_VERSION *version)
+{
+	UINT64 offset;
+
+	offset = (capArea == TPM_CAP_VERSION_VAL) ? sizeof(UINT16) : 0; // XXX hack
+	UnloadBlob_VERSION(&offset, resp, version);
+}
+
 TSS_RESULT
 get_current_version(TPM_VERSION *version)
 {
-	TCPA_CAPABILITY_AREA capArea = TPM_CAP_VERSION_VAL;
+	TCPA_CAPABILITY_AREA capArea;
 	UINT32 respSize;
 	BYTE *resp;
 	TSS_RESULT result;
-	UINT64 offset;
 
-	/* try the 1.2 way first */
-	result = TCSP_GetCapability_Internal(InternalContext, capArea, 0, NULL, &respSize, &resp);
-	if (result == TSS_SUCCESS) {
-		offset = sizeof(UINT16); // XXX hack
-		UnloadBlob_VERSION(&offset, resp, version);
+	if ((result = get_version_cap(&capArea, &respSize, &resp)) == TSS_SUCCESS) {
+		unload_version_cap(capArea, resp, version);
 		free(resp);
-	} else if (result == TCPA_E_BAD_MODE) {
-		/* if the TPM doesn't understand VERSION_VAL, try the 1.1 way */
-		capArea = TCPA_CAP_VERSION;
-		result = TCSP_GetCapability_Internal(InternalContext, capArea, 0, NULL, &respSize,
-						     &resp);
-		if (result == TSS_SUCCESS) {
-			offset = 0;
-			UnloadBlob_VERSION(&offset, resp, version);
-			free(resp);
-		}
 	}
 
 	return result;
@@ -142,16 +158,181 @@ get_max_auths(UINT32 *auths)
 	return result;
 }
 
+/* Hand the TPM's command durations to the TDDL so it can time out commands that never finish.
+ * 1.1 TPMs don't report any, in which case the TDDL's defaults stay and @d is zeroed */
+static void
+get_tpm_durations(UINT32 *d)
+{
+	UINT32 respSize, subCap;
+	BYTE *resp;
+	UINT64 offset = 0;
+	int i;
+
+	memset(d, 0, TDDL_DURATION_CLASSES * sizeof(UINT32));
+
+	UINT32ToArray(TPM_CAP_PROP_DURATION, (BYTE *)&subCap);
+	if (TCSP_GetCapability_Internal(InternalContext, TCPA_CAP_PROPERTY, sizeof(UINT32),
+					(BYTE *)&subCap, &respSize, &resp))
+		return;
+
+	if (respSize == TDDL_DURATION_CLASSES * sizeof(UINT32)) {
+		for (i = 0; i < TDDL_DURATION_CLASSES; i++)
+			UnloadBlob_UINT32(&offset, &d[i], resp);
+
+		Tddli_SetDurationsDevice(tcs_device_current()->index, d[TDDL_DURATION_SHORT],
+					 d[TDDL_DURATION_MEDIUM], d[TDDL_DURATION_LONG]);
+	}
+
+	free(resp);
+}
+
+/*
+ * The properties get_tpm_metrics() reads off the TPM only change when the TPM does, so they're
+ * kept in a snapshot next to the system PS file and at startup the TPM is only asked for its
+ * version information. A snapshot taken of a TPM that reports different version information,
+ * e.g. after a firmware update, is ignored and replaced.
+ */
+#define TPM_METRICS_SUFFIX	".metrics"
+#define TPM_METRICS_MAGIC	0x5443534d	/* "TCSM" */
+#define TPM_METRICS_MAX_SIZE	1024
+#define TPM_METRICS_SIZE(v)	((2 * sizeof(UINT32)) + (v) + (4 * sizeof(UINT32)) + \
+				 (2 * sizeof(BYTE)) + sizeof(((struct tpm_properties *)0)->manufacturer) + \
+				 (TDDL_DURATION_CLASSES * sizeof(UINT32)))
+
+/* the first TPM's snapshot has no number, the others' have their device index appended */
+static char *
+tpm_metrics_path(char *suffix)
+{
+	UINT32 device = tcs_device_current()->index;
+	size_t len = strlen(tcsd_options.system_ps_file) + strlen(suffix) + 12;
+	char *path;
+
+	if ((path = malloc(len)) == NULL) {
+		LogError("malloc of %zd bytes failed.", len);
+		return NULL;
+	}
+
+	if (device)
+		sprintf(path, "%s%s.%u", tcsd_options.system_ps_file, suffix, device);
+	else
+		sprintf(path, "%s%s", tcsd_options.system_ps_file, suffix);
+
+	return path;
+}
+
+static TSS_BOOL
+tpm_metrics_load(UINT32 verSize, BYTE *ver, struct tpm_properties *p, UINT32 *d)
+{
+	struct blob_cursor c;
+	BYTE buf[TPM_METRICS_MAX_SIZE];
+	UINT32 magic = 0, size = 0;
+	ssize_t len;
+	char *path;
+	int fd, i;
+
+	if ((path = tpm_metrics_path(TPM_METRICS_SUFFIX)) == NULL)
+		return FALSE;
+
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return FALSE;
+
+	len = read(fd, buf, sizeof(buf));
+	close(fd);
+	if (len < 0 || (UINT64)len != TPM_METRICS_SIZE(verSize))
+		return FALSE;
+
+	blob_cursor_init(&c, buf, len, 0);
+	GetBlob_UINT32(&c, &magic);
+	GetBlob_UINT32(&c, &size);
+	if (magic != TPM_METRICS_MAGIC || size != verSize || memcmp(&buf[c.pos], ver, verSize))
+		return FALSE;
+	GetBlob(&c, verSize, NULL);
+
+	GetBlob_UINT32(&c, &p->num_pcrs);
+	GetBlob_UINT32(&c, &p->num_dirs);
+	GetBlob_UINT32(&c, &p->num_keys);
+	GetBlob_UINT32(&c, &p->num_auths);
+	GetBlob_BOOL(&c, &p->authctx_swap);
+	GetBlob_BOOL(&c, &p->keyctx_swap);
+	GetBlob(&c, sizeof(p->manufacturer), p->manufacturer);
+	for (i = 0; i < TDDL_DURATION_CLASSES; i++)
+		GetBlob_UINT32(&c, &d[i]);
+
+	return blob_cursor_ok(&c);
+}
+
+/* Failing to save the snapshot only costs the next startup some time, so it's not an error */
+static void
+tpm_metrics_save(UINT32 verSize, BYTE *ver, struct tpm_properties *p, UINT32 *d)
+{
+	struct blob_cursor c;
+	BYTE buf[TPM_METRICS_MAX_SIZE];
+	char *path, *tmp_path;
+	int fd = -1, i;
+
+	if (TPM_METRICS_SIZE(verSize) > sizeof(buf))
+		return;
+
+	blob_cursor_init(&c, buf, sizeof(buf), 0);
+	PutBlob_UINT32(&c, TPM_METRICS_MAGIC);
+	PutBlob_UINT32(&c, verSize);
+	PutBlob(&c, verSize, ver);
+	PutBlob_UINT32(&c, p->num_pcrs);
+	PutBlob_UINT32(&c, p->num_dirs);
+	PutBlob_UINT32(&c, p->num_keys);
+	PutBlob_UINT32(&c, p->num_auths);
+	PutBlob_BOOL(&c, p->authctx_swap);
+	PutBlob_BOOL(&c, p->keyctx_swap);
+	PutBlob(&c, sizeof(p->manufacturer), p->manufacturer);
+	for (i = 0; i < TDDL_DURATION_CLASSES; i++)
+		PutBlob_UINT32(&c, d[i]);
+
+	if ((path = tpm_metrics_path(TPM_METRICS_SUFFIX)) == NULL)
+		return;
+	if ((tmp_path = tpm_metrics_path(TPM_METRICS_SUFFIX ".tmp")) == NULL) {
+		free(path);
+		return;
+	}
+
+	/* write a copy and rename it over the old snapshot, so a half-written one is never
+	 * picked up */
+	if ((fd = open(tmp_path, O_CREAT|O_TRUNC|O_WRONLY, 0600)) < 0 ||
+	    write(fd, buf, c.pos) != (ssize_t)c.pos || close(fd) ||
+	    rename(tmp_path, path)) {
+		LogInfo("Couldn't save the TPM metrics to %s: %s", path, strerror(errno));
+		if (fd >= 0)
+			unlink(tmp_path);
+	}
+
+	free(tmp_path);
+	free(path);
+}
+
 /* This is only called from init paths, so printing an error message is
  * appropriate if something goes wrong */
 TSS_RESULT
 get_tpm_metrics(struct tpm_properties *p)
 {
+	TCPA_CAPABILITY_AREA capArea;
 	TSS_RESULT result;
-	UINT32 subCap, rv = 0;
+	UINT32 subCap, rv = 0, verSize, d[TDDL_DURATION_CLASSES];
+	BYTE *ver = NULL;
 
-	if ((result = get_current_version(&p->version)))
+	if ((result = get_version_cap(&capArea, &verSize, &ver)))
 		goto err;
+	unload_version_cap(capArea, ver, &p->version);
+
+	if (tpm_metrics_load(verSize, ver, p, d)) {
+		LogDebug("Using the saved metrics of this TPM");
+		if (d[TDDL_DURATION_SHORT])
+			Tddli_SetDurationsDevice(tcs_device_current()->index,
+						 d[TDDL_DURATION_SHORT], d[TDDL_DURATION_MEDIUM],
+						 d[TDDL_DURATION_LONG]);
+		free(ver);
+		return TSS_SUCCESS;
+	}
 
 	UINT32ToArray(TPM_ORD_SaveKeyContext, (BYTE *)&subCap);
 	if ((result = get_cap_uint32(TCPA_CAP_ORD, (BYTE *)&subCap, sizeof(UINT32), &rv)))
@@ -184,12 +365,14 @@ get_tpm_metrics(struct tpm_properties *p)
 					(UINT32 *)&p->manufacturer)))
 		goto err;
 
-	result = get_max_auths(&(p->num_auths));
+	get_tpm_durations(d);
 
+	if ((result = get_max_auths(&(p->num_auths))) == TSS_SUCCESS)
+		tpm_metrics_save(verSize, ver, p, d);
 err:
 	if (result)
 		LogError("TCS GetCapability failed with result = 0x%x", result);
 
+	free(ver);
 	return result;
 }
-
@@ -71,6 +71,7 @@ create_tcs_context()
 
 	if (ret != NULL) {
 		ret->handle = getNextHandle();
+		ret->device = tcs_device_current()->index;
 		COND_INIT(ret->cond);
 	}
 	return ret;
@@ -198,6 +199,12 @@ ctx_verify_context(TCS_CONTEXT_HANDLE tcsContext)
 		return TCSERR(TCS_E_INVALID_CONTEXTHANDLE);
 	}
 
+	/* the caches the request would use are another TPM's */
+	if (c->device != tcs_device_current()->index) {
+		LogDebug("Fail: Context %x belongs to TPM device %u", tcsContext, c->device);
+		return TCSERR(TCS_E_INVALID_CONTEXTHANDLE);
+	}
+
 	return TSS_SUCCESS;
 }
 
@@ -221,8 +228,8 @@ ctx_get_cond_var(TCS_CONTEXT_HANDLE tcs_handle)
 }
 
 /* the only transport flag at the TCS level is whether the session is exclusive or not. If the app
- * is requesting an exclusive transport session, check that no other exclusive sessions exist and
- * if not, flag this context as being the one. If so, return internal error. */
+ * is requesting an exclusive transport session, check that no other exclusive sessions exist on
+ * its TPM and if not, flag this context as being the one. If so, return internal error. */
 TSS_RESULT
 ctx_req_exclusive_transport(TCS_CONTEXT_HANDLE tcsContext)
 {
@@ -236,29 +243,49 @@ ctx_req_exclusive_transport(TCS_CONTEXT_HANDLE tcsContext)
 
 	MUTEX_LOCK(tcs_ctx_lock);
 
-	tmp = tcs_context_table;
-	while (tmp) {
-		if (tmp->flags & TSS_CONTEXT_FLAG_TRANSPORT_EXCLUSIVE) {
+	if ((self = get_context(tcsContext)) == NULL) {
+		result = TCSERR(TCS_E_INVALID_CONTEXTHANDLE);
+		goto done;
+	}
+
+	for (tmp = tcs_context_table; tmp; tmp = tmp->next) {
+		if (tmp->device == self->device &&
+		    (tmp->flags & TSS_CONTEXT_FLAG_TRANSPORT_EXCLUSIVE)) {
 			result = TCSERR(TSS_E_INTERNAL_ERROR);
 			goto done;
 		}
-
-		if (tmp->handle == tcsContext)
-			self = tmp;
-
-		tmp = tmp->next;
 	}
 
-	if (self)
-		self->flags |= TSS_CONTEXT_FLAG_TRANSPORT_EXCLUSIVE;
-	else
-		result = TCSERR(TCS_E_INVALID_CONTEXTHANDLE);
+	self->flags |= TSS_CONTEXT_FLAG_TRANSPORT_EXCLUSIVE;
 done:
 	MUTEX_UNLOCK(tcs_ctx_lock);
 
 	return result;
 }
 
+/* Whether some context holds an exclusive transport session on TPM @device, which any other
+ * command sent to that TPM would end */
+TSS_BOOL
+ctx_has_exclusive_transport(UINT32 device)
+{
+	struct tcs_context *tmp;
+	TSS_BOOL found = FALSE;
+
+	MUTEX_LOCK(tcs_ctx_lock);
+
+	for (tmp = tcs_context_table; tmp; tmp = tmp->next) {
+		if (tmp->device == device &&
+		    (tmp->flags & TSS_CONTEXT_FLAG_TRANSPORT_EXCLUSIVE)) {
+			found = TRUE;
+			break;
+		}
+	}
+
+	MUTEX_UNLOCK(tcs_ctx_lock);
+
+	return found;
+}
+
 TSS_RESULT
 ctx_set_transport_enabled(TCS_CONTEXT_HANDLE tcsContext, UINT32 hTransHandle)
 {
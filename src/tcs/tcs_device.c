@@ -0,0 +1,94 @@
+
+/*
+ * Licensed Materials - Property of IBM
+ *
+ * trousers - An open source TCG Software Stack
+ *
+ * (C) Copyright International Business Machines Corp. 2004-2007
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "trousers/tss.h"
+#include "trousers_types.h"
+#include "tcs_tsp.h"
+#include "tcs_utils.h"
+#include "tcsd_wrap.h"
+#include "tcsd.h"
+#include "tcslog.h"
+
+static struct tcs_device tcs_devices[TCSD_MAX_TPM_DEVICES];
+static UINT32 num_tcs_devices = 1;
+static THREAD_KEY_DECLARE(tcs_device_key);
+
+/* no locking done in init since it's called by only a single thread */
+TSS_RESULT
+tcs_devices_init(UINT32 count)
+{
+	UINT32 i;
+	int rc;
+
+	if (count == 0)
+		count = 1;
+
+	if (count > TCSD_MAX_TPM_DEVICES) {
+		LogError("%u TPM devices configured, only %d can be served", count,
+			 TCSD_MAX_TPM_DEVICES);
+		return TCSERR(TSS_E_BAD_PARAMETER);
+	}
+
+	if ((rc = THREAD_KEY_CREATE(tcs_device_key, NULL))) {
+		LogError("Creating the TPM device key failed: %d", rc);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	for (i = 0; i < count; i++) {
+		memset(&tcs_devices[i], 0, sizeof(struct tcs_device));
+		tcs_devices[i].index = i;
+		MUTEX_INIT(tcs_devices[i].key_cache_lock);
+		MUTEX_INIT(tcs_devices[i].auth_lock);
+		MUTEX_INIT(tcs_devices[i].rpc_lock);
+	}
+	num_tcs_devices = count;
+
+	return TSS_SUCCESS;
+}
+
+UINT32
+tcs_device_count(void)
+{
+	return num_tcs_devices;
+}
+
+struct tcs_device *
+tcs_device_current(void)
+{
+	struct tcs_device *d;
+
+	/* nobody can have selected another one */
+	if (num_tcs_devices == 1)
+		return &tcs_devices[0];
+
+	if ((d = THREAD_KEY_GET(tcs_device_key)) == NULL)
+		d = &tcs_devices[0];
+
+	return d;
+}
+
+/* Make the TPM at @index the one the calling thread's requests go to */
+TSS_RESULT
+tcs_device_select(UINT32 index)
+{
+	if (index >= num_tcs_devices) {
+		LogDebug("TPM device %u requested, %u are served", index, num_tcs_devices);
+		return TCSERR(TSS_E_BAD_PARAMETER);
+	}
+
+	if (num_tcs_devices > 1)
+		THREAD_KEY_SET(tcs_device_key, &tcs_devices[index]);
+
+	return TSS_SUCCESS;
+}
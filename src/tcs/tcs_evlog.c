@@ -43,10 +43,19 @@ event_log_init()
 	MUTEX_INIT(tcs_event_log->lock);
 
 	/* allocate as many event lists as there are PCR's */
-	tcs_event_log->lists = calloc(tpm_metrics.num_pcrs, sizeof(struct event_wrapper *));
+	tcs_event_log->lists = calloc(tpm_metrics.num_pcrs, sizeof(struct event_list));
 	if (tcs_event_log->lists == NULL) {
 		LogError("malloc of %zd bytes failed.",
-				tpm_metrics.num_pcrs * sizeof(struct event_wrapper *));
+				tpm_metrics.num_pcrs * sizeof(struct event_list));
+		free(tcs_event_log);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	tcs_event_log->aggregates = calloc(tpm_metrics.num_pcrs, sizeof(struct event_aggregate));
+	if (tcs_event_log->aggregates == NULL) {
+		LogError("malloc of %zd bytes failed.",
+				tpm_metrics.num_pcrs * sizeof(struct event_aggregate));
+		free(tcs_event_log->lists);
 		free(tcs_event_log);
 		return TCSERR(TSS_E_OUTOFMEMORY);
 	}
@@ -56,31 +65,45 @@ event_log_init()
 	tcs_event_log->firmware_source = EVLOG_BIOS_SOURCE;
 	tcs_event_log->kernel_source = EVLOG_IMA_SOURCE;
 
+	/* pick up the events logged before the tcsd was last restarted */
+	if (tcsd_options.event_log_file)
+		return evlog_file_init(tcsd_options.event_log_file);
+
 	return TSS_SUCCESS;
 }
 
 TSS_RESULT
 event_log_final()
 {
-	struct event_wrapper *cur, *next;
-	UINT32 i;
+	struct event_list *list;
+	UINT32 i, j;
 
 	MUTEX_LOCK(tcs_event_log->lock);
 
 	for (i = 0; i < tpm_metrics.num_pcrs; i++) {
-		cur = tcs_event_log->lists[i];
-		while (cur != NULL) {
-			next = cur->next;
-			free(cur->event.rgbPcrValue);
-			free(cur->event.rgbEvent);
-			free(cur);
-			cur = next;
+		list = &tcs_event_log->lists[i];
+		for (j = 0; j < list->num; j++) {
+			if (!evlog_file_contains(list->events[j].rgbPcrValue))
+				free(list->events[j].rgbPcrValue);
+			if (!evlog_file_contains(list->events[j].rgbEvent))
+				free(list->events[j].rgbEvent);
 		}
+		free(list->events);
 	}
 
+	evlog_file_final();
+
+#ifdef EVLOG_SOURCE_IMA
+	ima_index_free();
+#endif
+#ifdef EVLOG_SOURCE_BIOS
+	bios_index_free();
+#endif
+
 	MUTEX_UNLOCK(tcs_event_log->lock);
 
 	free(tcs_event_log->lists);
+	free(tcs_event_log->aggregates);
 	free(tcs_event_log);
 
 	return TSS_SUCCESS;
@@ -93,83 +116,115 @@ copy_pcr_event(TSS_PCR_EVENT *dest, TSS_PCR_EVENT *source)
 	return TSS_SUCCESS;
 }
 
+/* Make room for one more event in @list */
+static TSS_RESULT
+event_list_reserve(struct event_list *list)
+{
+	TSS_PCR_EVENT *events;
+	UINT32 size;
+
+	if (list->num == list->size) {
+		size = list->size ? list->size * 2 : 16;
+		if ((events = realloc(list->events, size * sizeof(TSS_PCR_EVENT))) == NULL) {
+			LogError("malloc of %zd bytes failed.", size * sizeof(TSS_PCR_EVENT));
+			return TCSERR(TSS_E_OUTOFMEMORY);
+		}
+		list->events = events;
+		list->size = size;
+	}
+
+	return TSS_SUCCESS;
+}
+
+/* Put @event at the end of its PCR's list. The lock should be held before calling this
+ * function. */
 TSS_RESULT
-event_log_add(TSS_PCR_EVENT *event, UINT32 *pNumber)
+event_log_insert(TSS_PCR_EVENT *event, UINT32 *pNumber)
 {
-	struct event_wrapper *new, *tmp;
+	struct event_list *list = &tcs_event_log->lists[event->ulPcrIndex];
 	TSS_RESULT result;
-	UINT32 i;
-
-	MUTEX_LOCK(tcs_event_log->lock);
 
-	new = calloc(1, sizeof(struct event_wrapper));
-	if (new == NULL) {
-		LogError("malloc of %zd bytes failed.", sizeof(struct event_wrapper));
-		MUTEX_UNLOCK(tcs_event_log->lock);
-		return TCSERR(TSS_E_OUTOFMEMORY);
-	}
+	if ((result = event_list_reserve(list)))
+		return result;
 
-	if ((result = copy_pcr_event(&(new->event), event))) {
-		free(new);
-		MUTEX_UNLOCK(tcs_event_log->lock);
+	if ((result = event_aggregate_extend(event->ulPcrIndex, event)))
 		return result;
-	}
 
-	/* go to the end of the list to add the element, so that they're in order */
-	i = 0;
-	if (tcs_event_log->lists[event->ulPcrIndex] == NULL) {
-		tcs_event_log->lists[event->ulPcrIndex] = new;
-	} else {
-		i++;
-		tmp = tcs_event_log->lists[event->ulPcrIndex];
-		while (tmp->next != NULL) {
-			i++;
-			tmp = tmp->next;
-		}
-		tmp->next = new;
-	}
+	copy_pcr_event(&list->events[list->num], event);
+	*pNumber = ++list->num;
 
-	*pNumber = ++i;
+	return TSS_SUCCESS;
+}
 
-	MUTEX_UNLOCK(tcs_event_log->lock);
+/* Like event_log_insert(), but the PCR's aggregate is left for event_aggregate_catch_up() to
+ * bring up to date */
+TSS_RESULT
+event_log_append(TSS_PCR_EVENT *event, UINT32 *pNumber)
+{
+	struct event_list *list = &tcs_event_log->lists[event->ulPcrIndex];
+	TSS_RESULT result;
+
+	if ((result = event_list_reserve(list)))
+		return result;
+
+	copy_pcr_event(&list->events[list->num], event);
+	*pNumber = ++list->num;
 
 	return TSS_SUCCESS;
 }
 
-TSS_PCR_EVENT *
-get_pcr_event(UINT32 pcrIndex, UINT32 eventNumber)
+/* The event's rgbPcrValue and rgbEvent buffers are owned by the log from here on */
+TSS_RESULT
+event_log_add(TSS_PCR_EVENT *event, UINT32 *pNumber)
 {
-	struct event_wrapper *tmp;
-	UINT32 counter = 0;
+	struct event_list *list = &tcs_event_log->lists[event->ulPcrIndex];
+	TSS_RESULT result;
 
 	MUTEX_LOCK(tcs_event_log->lock);
 
-	tmp = tcs_event_log->lists[pcrIndex];
-	for (; tmp; tmp = tmp->next) {
-		if (counter == eventNumber) {
-			break;
-		}
-		counter++;
-	}
+	result = event_log_insert(event, pNumber);
+
+	/* if the event can't be written out, it's kept in memory only */
+	if (result == TSS_SUCCESS && tcsd_options.event_log_file)
+		(void)evlog_file_append(&list->events[*pNumber - 1]);
 
 	MUTEX_UNLOCK(tcs_event_log->lock);
 
-	return (tmp ? &(tmp->event) : NULL);
+	return result;
+}
+
+/* the lock should be held before calling this function, and the returned event is only valid
+ * while it is */
+TSS_PCR_EVENT *
+get_pcr_event(UINT32 pcrIndex, UINT32 eventNumber)
+{
+	struct event_list *list = &tcs_event_log->lists[pcrIndex];
+
+	return (eventNumber < list->num ? &list->events[eventNumber] : NULL);
 }
 
 /* the lock should be held before calling this function */
 UINT32
 get_num_events(UINT32 pcrIndex)
 {
-	struct event_wrapper *tmp;
-	UINT32 counter = 0;
+	return tcs_event_log->lists[pcrIndex].num;
+}
 
-	tmp = tcs_event_log->lists[pcrIndex];
-	for (; tmp; tmp = tmp->next) {
-		counter++;
-	}
+/* Copy up to @count events of @pcrIndex, starting at @first, into @dest and return the number
+ * copied. The events' buffers still belong to the log. The lock should be held before calling
+ * this function. */
+UINT32
+copy_pcr_events(TSS_PCR_EVENT *dest, UINT32 pcrIndex, UINT32 first, UINT32 count)
+{
+	struct event_list *list = &tcs_event_log->lists[pcrIndex];
+
+	if (first >= list->num)
+		return 0;
+
+	count = MIN(count, list->num - first);
+	memcpy(dest, &list->events[first], count * sizeof(TSS_PCR_EVENT));
 
-	return counter;
+	return count;
 }
 
 TSS_PCR_EVENT *
@@ -189,6 +244,108 @@ concat_pcr_events(TSS_PCR_EVENT **list_so_far, UINT32 list_size, TSS_PCR_EVENT *
 	return ret;
 }
 
+/* Fold @event into the running aggregate of its PCR, the same way the TPM would have extended
+ * it. Events whose digest isn't a SHA1 can't have been extended into a PCR, so they're only
+ * counted. The lock should be held before calling this function. */
+TSS_RESULT
+event_aggregate_extend(UINT32 pcrIndex, TSS_PCR_EVENT *event)
+{
+	struct event_aggregate *agg = &tcs_event_log->aggregates[pcrIndex];
+	BYTE buf[2 * TPM_SHA1_160_HASH_LEN];
+	TSS_RESULT result;
+
+	if (event->ulPcrValueLength == TPM_SHA1_160_HASH_LEN) {
+		memcpy(buf, agg->digest.digest, TPM_SHA1_160_HASH_LEN);
+		memcpy(&buf[TPM_SHA1_160_HASH_LEN], event->rgbPcrValue, TPM_SHA1_160_HASH_LEN);
+
+		if ((result = Hash(TSS_HASH_SHA1, sizeof(buf), buf, agg->digest.digest)))
+			return result;
+	}
+
+	agg->num++;
+
+	return TSS_SUCCESS;
+}
+
+/* Extend the aggregates of the TCSD controlled PCRs with the events appended to their lists
+ * by event_log_append(). One PCR's chain of extends can't be split up, but the chains of
+ * different PCRs don't depend on each other, so each round takes the next event of every PCR
+ * that's behind and hashes them all at once. An aggregate is only moved on once its round has
+ * been hashed, so on failure none is left half extended. The lock should be held before
+ * calling this function. */
+TSS_RESULT
+event_aggregate_catch_up()
+{
+	struct event_aggregate *agg;
+	struct event_list *list;
+	TSS_PCR_EVENT *event;
+	UINT32 i, n, num_pcrs = tpm_metrics.num_pcrs, *sizes, *pcrs;
+	BYTE *data, **bufs, *digests;
+	TSS_BOOL behind;
+	TSS_RESULT result = TSS_SUCCESS;
+
+	sizes = calloc(num_pcrs, sizeof(UINT32));
+	pcrs = calloc(num_pcrs, sizeof(UINT32));
+	bufs = calloc(num_pcrs, sizeof(BYTE *));
+	data = calloc(num_pcrs, 2 * TPM_SHA1_160_HASH_LEN);
+	digests = calloc(num_pcrs, TPM_SHA1_160_HASH_LEN);
+	if (!sizes || !pcrs || !bufs || !data || !digests) {
+		LogError("malloc of %zd bytes failed.", num_pcrs * (2 * sizeof(UINT32) +
+			 sizeof(BYTE *) + 3 * TPM_SHA1_160_HASH_LEN));
+		result = TCSERR(TSS_E_OUTOFMEMORY);
+		goto done;
+	}
+
+	for (i = 0; i < num_pcrs; i++) {
+		sizes[i] = 2 * TPM_SHA1_160_HASH_LEN;
+		bufs[i] = &data[i * 2 * TPM_SHA1_160_HASH_LEN];
+	}
+
+	do {
+		behind = FALSE;
+
+		for (i = 0, n = 0; i < num_pcrs; i++) {
+			agg = &tcs_event_log->aggregates[i];
+			list = &tcs_event_log->lists[i];
+			if (agg->num >= list->num)
+				continue;
+
+			if (agg->num + 1 < list->num)
+				behind = TRUE;
+
+			/* see event_aggregate_extend() */
+			event = &list->events[agg->num];
+			if (event->ulPcrValueLength != TPM_SHA1_160_HASH_LEN) {
+				agg->num++;
+				continue;
+			}
+
+			memcpy(bufs[n], agg->digest.digest, TPM_SHA1_160_HASH_LEN);
+			memcpy(&bufs[n][TPM_SHA1_160_HASH_LEN], event->rgbPcrValue,
+			       TPM_SHA1_160_HASH_LEN);
+			pcrs[n++] = i;
+		}
+
+		if ((result = HashBatch(TSS_HASH_SHA1, n, sizes, bufs, digests)))
+			goto done;
+
+		for (i = 0; i < n; i++) {
+			agg = &tcs_event_log->aggregates[pcrs[i]];
+			memcpy(agg->digest.digest, &digests[i * TPM_SHA1_160_HASH_LEN],
+			       TPM_SHA1_160_HASH_LEN);
+			agg->num++;
+		}
+	} while (behind);
+done:
+	free(sizes);
+	free(pcrs);
+	free(bufs);
+	free(data);
+	free(digests);
+
+	return result;
+}
+
 /* XXX make this a macro */
 UINT32
 get_pcr_event_size(TSS_PCR_EVENT *e)
@@ -214,6 +371,12 @@ free_external_events(UINT32 eventCount, TSS_PCR_EVENT *ppEvents)
 		 * will happen at shutdown time only. So, for each PCR index that's
 		 * read from securityfs, we need to free its pointers after that data has
 		 * been set in the packet to send back to the TSP. */
+#ifdef EVLOG_SOURCE_BIOS
+		/* except for the firmware log, which is only parsed once and whose events
+		 * point into its index */
+		if (bios_index_contains(ppEvents[j].rgbPcrValue))
+			continue;
+#endif
 		if ((tcsd_options.kernel_pcrs & (1 << ppEvents[j].ulPcrIndex)) ||
 		    (tcsd_options.firmware_pcrs & (1 << ppEvents[j].ulPcrIndex))) {
 			free(ppEvents[j].rgbPcrValue);
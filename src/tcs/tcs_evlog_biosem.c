@@ -17,6 +17,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -44,254 +45,360 @@ struct ext_log_source bios_source = {
 	bios_close
 };
 
+/*
+ * The firmware's log doesn't change after boot, so it's read and indexed only once, the
+ * first time it's asked for. Everything lives in one allocation:
+ *
+ *   struct bios_pcr_index[num_pcrs]	where each PCR's events start in the array below
+ *   TSS_PCR_EVENT[num_events]		grouped by PCR, in log order
+ *   the raw log			which the events' rgbPcrValue and rgbEvent point into
+ *
+ * so a query is just a copy of a slice of the event array. Queries happen with
+ * tcs_event_log->lock held.
+ *
+ * When firmware_log_file is changed by a config reload, the index of the old file is retired
+ * rather than freed: requests that started before the reload may still be sending events that
+ * point into it, and free them through bios_index_contains() after the lock is dropped. Retired
+ * indexes are kept until shutdown, and picked up again if the setting changes back.
+ */
+struct bios_pcr_index {
+	UINT32 first;
+	UINT32 num;
+};
+
+struct bios_log_index {
+	char *source;
+	BYTE *block;
+	UINT32 block_size;
+	struct bios_pcr_index *pcrs;
+	TSS_PCR_EVENT *events;
+	struct bios_log_index *next;
+};
+
+static struct bios_log_index bios_index;
+static struct bios_log_index *bios_retired;
+/* guards the blocks of bios_index and bios_retired, for bios_index_contains() */
+static MUTEX_DECLARE_INIT(bios_index_lock);
+
+void
+bios_index_free()
+{
+	struct bios_log_index *tmp;
+
+	MUTEX_LOCK(bios_index_lock);
+	while ((tmp = bios_retired)) {
+		bios_retired = tmp->next;
+		free(tmp->block);
+		free(tmp->source);
+		free(tmp);
+	}
+
+	free(bios_index.block);
+	free(bios_index.source);
+	memset(&bios_index, 0, sizeof(bios_index));
+	MUTEX_UNLOCK(bios_index_lock);
+}
+
+static TSS_BOOL
+bios_block_contains(struct bios_log_index *index, BYTE *p)
+{
+	return (index->block && p >= index->block && p < index->block + index->block_size);
+}
+
+/* Is @p part of an event handed out from the index, or one it has replaced? */
+TSS_BOOL
+bios_index_contains(void *p)
+{
+	struct bios_log_index *tmp;
+	TSS_BOOL found;
+
+	MUTEX_LOCK(bios_index_lock);
+	found = bios_block_contains(&bios_index, p);
+	for (tmp = bios_retired; !found && tmp; tmp = tmp->next)
+		found = bios_block_contains(tmp, p);
+	MUTEX_UNLOCK(bios_index_lock);
+
+	return found;
+}
+
+/* Retire the current index, making the retired index of @source current in its place if there
+ * is one. If there isn't, there's no current index afterwards */
+static TSS_RESULT
+bios_index_switch(char *source)
+{
+	struct bios_log_index *found, *old, **prev, tmp;
+
+	for (prev = &bios_retired; (found = *prev); prev = &found->next) {
+		if (!strcmp(found->source, source))
+			break;
+	}
+
+	/* the current index is retired into the node of the one picked up, or a new one */
+	if ((old = found) == NULL && (old = malloc(sizeof(*old))) == NULL) {
+		LogError("malloc of %zd bytes failed.", sizeof(*old));
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	MUTEX_LOCK(bios_index_lock);
+	if (found) {
+		*prev = found->next;
+		tmp = *found;
+		*old = bios_index;
+		bios_index = tmp;
+	} else {
+		*old = bios_index;
+		memset(&bios_index, 0, sizeof(bios_index));
+	}
+	bios_index.next = NULL;
+	old->next = bios_retired;
+	bios_retired = old;
+	MUTEX_UNLOCK(bios_index_lock);
+
+	return TSS_SUCCESS;
+}
+
+/* Read all of @fp into a buffer. securityfs files don't have a size, so this can't stat */
+static BYTE *
+bios_read_log(FILE *fp, UINT32 *size)
+{
+	BYTE *buf = NULL, *tmp;
+	UINT32 len = 0, alloc = 0;
+	size_t rc;
+
+	do {
+		if (len == alloc) {
+			if ((tmp = realloc(buf, alloc + BIOS_READ_SIZE)) == NULL) {
+				LogError("malloc of %u bytes failed.", alloc + BIOS_READ_SIZE);
+				free(buf);
+				return NULL;
+			}
+			buf = tmp;
+			alloc += BIOS_READ_SIZE;
+		}
+
+		rc = fread(buf + len, 1, alloc - len, fp);
+		len += rc;
+	} while (rc > 0);
+
+	if (ferror(fp)) {
+		LogError("read from event source failed: %s", strerror(errno));
+		free(buf);
+		return NULL;
+	}
+
+	*size = len;
+	return buf;
+}
+
+/* Walk the events in @log, counting the events of each PCR into @pcrs. Returns the length of
+ * the log up to the last complete event */
+static UINT32
+bios_count_events(BYTE *log, UINT32 size, struct bios_pcr_index *pcrs, UINT32 *num_events)
+{
+	TCG_PCClientPCREventStruc event;
+	UINT32 offset = 0;
+
+	*num_events = 0;
+
+	while (size - offset >= sizeof(event)) {
+		memcpy(&event, log + offset, sizeof(event));
+
+		if (event.eventDataSize > size - offset - sizeof(event))
+			break;
+
+		if (event.pcrIndex < tpm_metrics.num_pcrs) {
+			pcrs[event.pcrIndex].num++;
+			(*num_events)++;
+		}
+
+		offset += sizeof(event) + event.eventDataSize;
+	}
+
+	return offset;
+}
+
+static TSS_RESULT
+bios_index_build(char *source)
+{
+	struct bios_pcr_index *pcrs, *pcr;
+	struct bios_log_index idx;
+	TCG_PCClientPCREventStruc event;
+	TSS_PCR_EVENT *e;
+	FILE *fp;
+	BYTE *log, *block, *data;
+	UINT32 log_size, size, num_events, offset, i;
+
+	if ((fp = fopen(source, "r")) == NULL) {
+		LogError("Error opening BIOS Eventlog file %s: %s", source, strerror(errno));
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	log = bios_read_log(fp, &log_size);
+	fclose(fp);
+	if (log == NULL)
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	if ((pcrs = calloc(tpm_metrics.num_pcrs, sizeof(struct bios_pcr_index))) == NULL) {
+		LogError("malloc of %zd bytes failed.",
+			 tpm_metrics.num_pcrs * sizeof(struct bios_pcr_index));
+		free(log);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	log_size = bios_count_events(log, log_size, pcrs, &num_events);
+
+	size = tpm_metrics.num_pcrs * sizeof(struct bios_pcr_index) +
+	       num_events * sizeof(TSS_PCR_EVENT) + log_size;
+	if ((block = malloc(size)) == NULL) {
+		LogError("malloc of %u bytes failed.", size);
+		free(pcrs);
+		free(log);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	if ((idx.source = strdup(source)) == NULL) {
+		LogError("malloc of %zd bytes failed.", strlen(source) + 1);
+		free(block);
+		free(pcrs);
+		free(log);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	idx.block = block;
+	idx.block_size = size;
+	idx.pcrs = (struct bios_pcr_index *)block;
+	idx.events = (TSS_PCR_EVENT *)&idx.pcrs[tpm_metrics.num_pcrs];
+	idx.next = NULL;
+	data = (BYTE *)&idx.events[num_events];
+	memcpy(data, log, log_size);
+	free(log);
+
+	/* lay the PCRs out one after the other, then use num as the fill cursor */
+	for (i = 0, offset = 0; i < tpm_metrics.num_pcrs; i++) {
+		idx.pcrs[i].first = offset;
+		idx.pcrs[i].num = 0;
+		offset += pcrs[i].num;
+	}
+	free(pcrs);
+
+	for (offset = 0; offset < log_size; offset += sizeof(event) + event.eventDataSize) {
+		memcpy(&event, data + offset, sizeof(event));
+
+		if (event.pcrIndex >= tpm_metrics.num_pcrs)
+			continue;
+
+		pcr = &idx.pcrs[event.pcrIndex];
+		e = &idx.events[pcr->first + pcr->num++];
+
+		memset(e, 0, sizeof(TSS_PCR_EVENT));
+		e->ulPcrIndex = event.pcrIndex;
+		e->eventType = event.eventType;
+
+		/* XXX endianess ignored */
+		e->ulPcrValueLength = 20;
+		e->rgbPcrValue = data + offset + offsetof(TCG_PCClientPCREventStruc, digest);
+
+		e->ulEventLength = event.eventDataSize;
+		e->rgbEvent = event.eventDataSize ? data + offset + sizeof(event) : NULL;
+	}
+
+	MUTEX_LOCK(bios_index_lock);
+	bios_index = idx;
+	MUTEX_UNLOCK(bios_index_lock);
+
+	LogDebug("Indexed %u events from %s", num_events, source);
+
+	return TSS_SUCCESS;
+}
+
+/* There's nothing to keep open, the index stands in for the file */
 int
 bios_open(void *source, FILE **handle)
 {
-	FILE *fd;
+	/* the log file has been reconfigured */
+	if (bios_index.source && strcmp(bios_index.source, (char *)source) &&
+	    bios_index_switch((char *)source))
+		return -1;
 
-	if ((fd = fopen((char *)source, "r")) == NULL ) {
-		LogError("Error opening BIOS Eventlog file %s: %s", (char *)source,
-			 strerror(errno));
+	if (bios_index.block == NULL && bios_index_build((char *)source))
 		return -1;
-	}
 
-	*handle = fd;
+	*handle = NULL;
 
 	return 0;
 }
 
+/* The returned events point into the index, so only the array itself is the caller's to
+ * free, see free_external_events() */
 TSS_RESULT
 bios_get_entries_by_pcr(FILE *handle, UINT32 pcr_index, UINT32 first,
 			UINT32 *count, TSS_PCR_EVENT **events)
 {
-	char page[BIOS_READ_SIZE];
-	int error_path = 1;
-	UINT32 seen_indices = 0, copied_events = 0, i;
-	struct event_wrapper *list = calloc(1, sizeof(struct event_wrapper));
-	struct event_wrapper *cur = list;
-	TSS_RESULT result = TSS_E_INTERNAL_ERROR;
-	TCG_PCClientPCREventStruc *event = NULL;
-	int num=0;
-
-	if (list == NULL) {
-		LogError("malloc of %zd bytes failed.", sizeof(struct event_wrapper));
-		return TSS_E_OUTOFMEMORY;
-	}
+	struct bios_pcr_index *pcr;
+	UINT32 num;
 
-	if (*count == 0) {
-		result = TSS_SUCCESS;
-		goto free_list;
-	}
+	if (*count == 0)
+		return TSS_SUCCESS;
 
-	while (1) {
-		/* read event header from the file */
-		if ((fread(page, 32, 1, handle)) <= 0) {
-			goto copy_events;
-		}
+	if (pcr_index >= tpm_metrics.num_pcrs)
+		return TCSERR(TSS_E_BAD_PARAMETER);
 
-		event = (TCG_PCClientPCREventStruc *)page;
-
-		/* if the index is the one we're looking for, grab the entry */
-		if (pcr_index == event->pcrIndex) {
-			if (seen_indices >= first) {
-				/* grab this entry */
-				cur->event.rgbPcrValue = malloc(20);
-				if (cur->event.rgbPcrValue == NULL) {
-					LogError("malloc of %d bytes failed.", 20);
-					result = TSS_E_OUTOFMEMORY;
-					goto free_list;
-				}
-
-				cur->event.ulPcrIndex = pcr_index;
-				cur->event.eventType = event->eventType;
-				cur->event.ulPcrValueLength = 20;
-
-				/* copy the SHA1 XXX endianess ignored */
-				memcpy(cur->event.rgbPcrValue, event->digest, 20);
-
-				/* copy the event name XXX endianess ignored */
-				cur->event.ulEventLength = event->eventDataSize;
-
-				if (event->eventDataSize>0) {
-					cur->event.rgbEvent = malloc(event->eventDataSize);
-					if (cur->event.rgbEvent == NULL) {
-						LogError("malloc of %d bytes failed.",
-							 event->eventDataSize);
-						free(cur->event.rgbPcrValue);
-						result = TSS_E_OUTOFMEMORY;
-						goto free_list;
-					}
-					if ((fread(cur->event.rgbEvent,
-						   event->eventDataSize, 1, handle)) <= 0) {
-						LogError("read from event source failed: %s",
-							 strerror(errno));
-						return result;
-					}
-				} else {
-					cur->event.rgbEvent = NULL;
-				}
-
-				copied_events++;
-				if (copied_events == *count)
-					goto copy_events;
-
-				cur->next = calloc(1, sizeof(struct event_wrapper));
-				if (cur->next == NULL) {
-					LogError("malloc of %zd bytes failed.",
-						 sizeof(struct event_wrapper));
-					result = TSS_E_OUTOFMEMORY;
-					goto free_list;
-				}
-				cur = cur->next;
-			} else {
-				/* skip */
-				if (event->eventDataSize > 0)
-					fseek(handle,event->eventDataSize,SEEK_CUR);
-			}
-			seen_indices++;
-		} else {
-			if (event->eventDataSize > 0)
-				fseek(handle,event->eventDataSize,SEEK_CUR);
-			}
-		num++;
+	pcr = &bios_index.pcrs[pcr_index];
+
+	if (first >= pcr->num) {
+		*count = 0;
+		return TSS_SUCCESS;
 	}
 
-copy_events:
+	num = MIN(*count, pcr->num - first);
 
-	/* we've copied all the events we need to from this PCR, now
-	 * copy them all into one contiguous memory block
-	 */
-	*events = calloc(copied_events, sizeof(TSS_PCR_EVENT));
-	if (*events == NULL) {
-		LogError("malloc of %zd bytes failed.", copied_events * sizeof(TSS_PCR_EVENT));
-		result = TSS_E_OUTOFMEMORY;
-		goto free_list;
+	if ((*events = malloc(num * sizeof(TSS_PCR_EVENT))) == NULL) {
+		LogError("malloc of %zd bytes failed.", num * sizeof(TSS_PCR_EVENT));
+		return TCSERR(TSS_E_OUTOFMEMORY);
 	}
 
-	cur = list;
-	for (i = 0; i < copied_events; i++) {
-		memcpy(&((*events)[i]), &(cur->event), sizeof(TSS_PCR_EVENT));
-		cur = cur->next;
-	}
+	memcpy(*events, &bios_index.events[pcr->first + first], num * sizeof(TSS_PCR_EVENT));
+	*count = num;
 
-	*count = copied_events;
-	/* assume we're in an error path until we get here */
-	error_path = 0;
-	result = TSS_SUCCESS;
-
-free_list:
-	cur = list->next;
-	while (cur != NULL) {
-		if (error_path) {
-			free(cur->event.rgbEvent);
-			free(cur->event.rgbPcrValue);
-		}
-		free(list);
-		list = cur;
-		cur = list->next;
-	}
-	free(list);
-	return result;
+	return TSS_SUCCESS;
 }
 
 TSS_RESULT
 bios_get_entry(FILE *handle, UINT32 pcr_index, UINT32 *num, TSS_PCR_EVENT **ppEvent)
 {
-	char page[BIOS_READ_SIZE];
-	UINT32 seen_indices = 0;
-	TSS_RESULT result = TSS_E_INTERNAL_ERROR;
-	TSS_PCR_EVENT *e = NULL;
-	TCG_PCClientPCREventStruc *event = NULL;
-
-	while (1) {
-		/* read event header from the file */
-		if ((fread(page, 32, 1, handle)) == 0) {
-			goto done;
-		}
+	struct bios_pcr_index *pcr;
+	TSS_PCR_EVENT *e;
 
-		event = (TCG_PCClientPCREventStruc *)page;
-
-		if (pcr_index == event->pcrIndex) {
-			if (ppEvent && !*ppEvent && seen_indices == *num) {
-				*ppEvent = calloc(1, sizeof(TSS_PCR_EVENT));
-				if (*ppEvent == NULL) {
-					LogError("malloc of %zd bytes failed.",
-						 sizeof(TSS_PCR_EVENT));
-					return TSS_E_INTERNAL_ERROR;
-				}
-
-				e = *ppEvent;
-
-				e->rgbPcrValue = malloc(20);
-				if (e->rgbPcrValue == NULL) {
-					LogError("malloc of %d bytes failed.", 20);
-					free(e);
-					e = NULL;
-					break;
-				}
-
-				e->ulPcrIndex = pcr_index;
-				e->eventType = event->eventType;
-				e->ulPcrValueLength = 20;
-
-				/* copy the SHA1 XXX endianess ignored */
-				memcpy(e->rgbPcrValue, event->digest, 20);
-
-				e->ulEventLength = event->eventDataSize;
-
-				if (event->eventDataSize>0) {
-					e->rgbEvent = malloc(e->ulEventLength);
-					if (e->rgbEvent == NULL) {
-						LogError("malloc of %d bytes failed.",
-							 e->ulEventLength);
-						free(e->rgbPcrValue);
-						free(e);
-						e = NULL;
-						break;
-					}
-					if ((fread(e->rgbEvent,
-						   event->eventDataSize,
-						   1, handle)) <= 0) {
-						LogError("read from event source failed: %s",
-							 strerror(errno));
-						return result;
-					}
-				} else {
-					e->rgbEvent = NULL;
-				}
-				result = TSS_SUCCESS;
-
-				break;
-			} else {
-				/* skip */
-				if (event->eventDataSize > 0) {
-					fseek(handle,event->eventDataSize,SEEK_CUR);
-				}
-			}
-			seen_indices++;
-		} else {
-			/* skip */
-			if (event->eventDataSize > 0) {
-				fseek(handle,event->eventDataSize,SEEK_CUR);
-			}
-		}
+	if (pcr_index >= tpm_metrics.num_pcrs)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	pcr = &bios_index.pcrs[pcr_index];
+
+	/* just the number of events for this PCR is being asked for */
+	if (ppEvent == NULL) {
+		*num = pcr->num;
+		return TSS_SUCCESS;
 	}
 
-done:
-	if (!ppEvent) {
-		*num = seen_indices;
-		result = TSS_SUCCESS;
-	} else if (e == NULL)
+	if (*num >= pcr->num) {
 		*ppEvent = NULL;
+		return TCSERR(TSS_E_BAD_PARAMETER);
+	}
+
+	if ((e = malloc(sizeof(TSS_PCR_EVENT))) == NULL) {
+		LogError("malloc of %zd bytes failed.", sizeof(TSS_PCR_EVENT));
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	memcpy(e, &bios_index.events[pcr->first + *num], sizeof(TSS_PCR_EVENT));
+	*ppEvent = e;
 
-	return result;
+	return TSS_SUCCESS;
 }
 
 int
 bios_close(FILE *handle)
 {
-	fclose(handle);
-
 	return 0;
 }
 
@@ -0,0 +1,384 @@
+
+/*
+ * Licensed Materials - Property of IBM
+ *
+ * trousers - An open source TCG Software Stack
+ *
+ * (C) Copyright International Business Machines Corp. 2004-2006
+ *
+ */
+
+/*
+ * tcs_evlog_file.c
+ *
+ * The on-disk copy of the TCSD controlled PCR event log. Events are appended to the file
+ * as they're logged and the file is mapped read-only, so that the in-memory log can point
+ * straight at the event data on disk instead of keeping its own copy. At startup, the
+ * events of the current boot are read back in, so a restart of the tcsd doesn't lose them.
+ *
+ * The file is a header followed by records:
+ *
+ *   struct evlog_file_rec
+ *   rgbPcrValue (ulPcrValueLength bytes)
+ *   rgbEvent (ulEventLength bytes)
+ *   padding to EVLOG_FILE_ALIGN
+ *
+ * Each record carries a checksum, so a record that was only partly written when the tcsd
+ * died is found and cut off at the next start. Since the PCRs are reset at boot, a log
+ * written during an earlier boot is thrown away.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "trousers/tss.h"
+#include "trousers_types.h"
+#include "tcs_tsp.h"
+#include "tcs_utils.h"
+#include "tcs_int_literals.h"
+#include "capabilities.h"
+#include "tcsd_wrap.h"
+#include "tcsd.h"
+#include "tcslog.h"
+#include "tcsem.h"
+
+#define EVLOG_FILE_MAGIC	"TSSEVLOG"
+#define EVLOG_FILE_VERSION	1
+#define EVLOG_FILE_REC_MAGIC	0x524c5645	/* "EVLR" */
+#define EVLOG_FILE_ALIGN	8
+/* the mapping is reserved up front so that the event pointers handed out stay valid */
+#define EVLOG_FILE_MAX		(64 * 1024 * 1024)
+#define EVLOG_BOOT_ID_FILE	"/proc/sys/kernel/random/boot_id"
+#define EVLOG_BOOT_ID_LEN	40
+
+struct evlog_file_hdr {
+	BYTE magic[8];
+	UINT32 version;
+	UINT32 num_pcrs;
+	BYTE boot_id[EVLOG_BOOT_ID_LEN];
+	BYTE reserved[8];
+};
+
+struct evlog_file_rec {
+	UINT32 magic;
+	UINT32 pcr_index;
+	UINT32 event_type;
+	UINT32 pcr_value_len;
+	UINT32 event_len;
+	UINT32 checksum;
+	TSS_VERSION version;
+	UINT32 reserved;
+};
+
+#define EVLOG_FILE_PAD(x)	(((x) + (EVLOG_FILE_ALIGN - 1)) & ~(EVLOG_FILE_ALIGN - 1))
+
+static struct {
+	int fd;
+	BYTE *map;
+	UINT32 tail;		/* end of the last good record */
+	TSS_BOOL full;
+} evlog_file = { -1, NULL, 0, FALSE };
+
+/* FNV-1a */
+static UINT32
+evlog_file_checksum(UINT32 sum, BYTE *data, UINT32 len)
+{
+	UINT32 i;
+
+	for (i = 0; i < len; i++) {
+		sum ^= data[i];
+		sum *= 16777619;
+	}
+
+	return sum;
+}
+
+static UINT32
+evlog_file_rec_checksum(struct evlog_file_rec *rec, BYTE *pcr_value, BYTE *event)
+{
+	struct evlog_file_rec tmp;
+	UINT32 sum = 2166136261U;
+
+	memcpy(&tmp, rec, sizeof(tmp));
+	tmp.checksum = 0;
+
+	sum = evlog_file_checksum(sum, (BYTE *)&tmp, sizeof(tmp));
+	sum = evlog_file_checksum(sum, pcr_value, rec->pcr_value_len);
+
+	return evlog_file_checksum(sum, event, rec->event_len);
+}
+
+static int
+evlog_file_get_boot_id(BYTE *boot_id)
+{
+	FILE *f;
+
+	memset(boot_id, 0, EVLOG_BOOT_ID_LEN);
+
+	if ((f = fopen(EVLOG_BOOT_ID_FILE, "r")) == NULL)
+		return -1;
+
+	if (fgets((char *)boot_id, EVLOG_BOOT_ID_LEN, f) == NULL) {
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static int
+evlog_file_write(UINT32 offset, void *data, UINT32 len)
+{
+	ssize_t rc;
+	BYTE *p = data;
+
+	while (len) {
+		if ((rc = pwrite(evlog_file.fd, p, len, offset)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += rc;
+		offset += rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+/* Throw away the contents of the file and start a log for this boot */
+static int
+evlog_file_reset(BYTE *boot_id)
+{
+	struct evlog_file_hdr hdr;
+
+	if (ftruncate(evlog_file.fd, 0))
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, EVLOG_FILE_MAGIC, sizeof(hdr.magic));
+	hdr.version = EVLOG_FILE_VERSION;
+	hdr.num_pcrs = tpm_metrics.num_pcrs;
+	memcpy(hdr.boot_id, boot_id, EVLOG_BOOT_ID_LEN);
+
+	if (evlog_file_write(0, &hdr, sizeof(hdr)))
+		return -1;
+
+	evlog_file.tail = sizeof(hdr);
+
+	return 0;
+}
+
+/* Read back the records of the current log into the in-memory log, stopping at the first
+ * one that's damaged, then compute the PCRs' aggregates in one pass. Returns the offset just
+ * past the last good record, or the start of the log if the aggregates couldn't be computed
+ * and the log has to be started over. */
+static UINT32
+evlog_file_replay(UINT32 size)
+{
+	struct evlog_file_rec rec;
+	TSS_PCR_EVENT event;
+	UINT32 offset = sizeof(struct evlog_file_hdr), rec_size, number, i;
+	BYTE *pcr_value, *data;
+
+	while (offset + sizeof(rec) <= size) {
+		memcpy(&rec, evlog_file.map + offset, sizeof(rec));
+
+		if (rec.magic != EVLOG_FILE_REC_MAGIC || rec.pcr_index >= tpm_metrics.num_pcrs)
+			break;
+
+		if (rec.pcr_value_len > size || rec.event_len > size)
+			break;
+
+		rec_size = EVLOG_FILE_PAD(sizeof(rec) + rec.pcr_value_len + rec.event_len);
+		if (rec_size > size - offset)
+			break;
+
+		pcr_value = evlog_file.map + offset + sizeof(rec);
+		data = pcr_value + rec.pcr_value_len;
+
+		if (rec.checksum != evlog_file_rec_checksum(&rec, pcr_value, data))
+			break;
+
+		/* PCRs that have been handed to the kernel or firmware since aren't the
+		 * TCSD's to log to any more */
+		if (!(tcsd_options.kernel_pcrs & (1 << rec.pcr_index)) &&
+		    !(tcsd_options.firmware_pcrs & (1 << rec.pcr_index))) {
+			memset(&event, 0, sizeof(event));
+			memcpy(&event.versionInfo, &rec.version, sizeof(TSS_VERSION));
+			event.ulPcrIndex = rec.pcr_index;
+			event.eventType = rec.event_type;
+			event.ulPcrValueLength = rec.pcr_value_len;
+			event.rgbPcrValue = rec.pcr_value_len ? pcr_value : NULL;
+			event.ulEventLength = rec.event_len;
+			event.rgbEvent = rec.event_len ? data : NULL;
+
+			if (event_log_append(&event, &number))
+				break;
+		}
+
+		offset += rec_size;
+	}
+
+	if (event_aggregate_catch_up()) {
+		LogError("Error replaying the event log, it will be started over");
+		for (i = 0; i < tpm_metrics.num_pcrs; i++) {
+			tcs_event_log->lists[i].num = 0;
+			memset(&tcs_event_log->aggregates[i], 0, sizeof(struct event_aggregate));
+		}
+		return sizeof(struct evlog_file_hdr);
+	}
+
+	return offset;
+}
+
+/* Open the on-disk log at @path and load the events it holds for this boot. If the file
+ * can't be used, the log is kept in memory only. Called once at startup. */
+TSS_RESULT
+evlog_file_init(char *path)
+{
+	struct evlog_file_hdr hdr;
+	BYTE boot_id[EVLOG_BOOT_ID_LEN];
+	struct stat st;
+	UINT32 tail;
+
+	if (evlog_file_get_boot_id(boot_id)) {
+		LogInfo("Can't tell one boot from the next, event log %s won't be used.", path);
+		return TSS_SUCCESS;
+	}
+
+	if ((evlog_file.fd = open(path, O_RDWR|O_CREAT, 0600)) < 0) {
+		LogError("Error opening event log file %s: %s", path, strerror(errno));
+		return TSS_SUCCESS;
+	}
+
+	if (fstat(evlog_file.fd, &st))
+		goto err;
+
+	if (st.st_size < (off_t)sizeof(hdr) || st.st_size > EVLOG_FILE_MAX ||
+	    pread(evlog_file.fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, EVLOG_FILE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != EVLOG_FILE_VERSION || hdr.num_pcrs != tpm_metrics.num_pcrs ||
+	    memcmp(hdr.boot_id, boot_id, EVLOG_BOOT_ID_LEN)) {
+		LogDebug("Starting a new event log in %s", path);
+		if (evlog_file_reset(boot_id))
+			goto err;
+		st.st_size = sizeof(hdr);
+	}
+
+	evlog_file.map = mmap(NULL, EVLOG_FILE_MAX, PROT_READ, MAP_SHARED, evlog_file.fd, 0);
+	if (evlog_file.map == MAP_FAILED) {
+		evlog_file.map = NULL;
+		goto err;
+	}
+
+	tail = evlog_file_replay(st.st_size);
+	if (tail != st.st_size) {
+		LogWarn("Discarding %lu bytes of damaged records at the end of event log %s",
+			(unsigned long)(st.st_size - tail), path);
+		if (ftruncate(evlog_file.fd, tail))
+			goto err;
+	}
+	evlog_file.tail = tail;
+
+	return TSS_SUCCESS;
+err:
+	LogError("Error using event log file %s: %s. PCR events will not survive a restart.",
+		 path, strerror(errno));
+	evlog_file_final();
+	return TSS_SUCCESS;
+}
+
+void
+evlog_file_final()
+{
+	if (evlog_file.map)
+		munmap(evlog_file.map, EVLOG_FILE_MAX);
+	if (evlog_file.fd >= 0)
+		close(evlog_file.fd);
+
+	evlog_file.fd = -1;
+	evlog_file.map = NULL;
+	evlog_file.tail = 0;
+}
+
+/* Is @p part of the on-disk log? */
+TSS_BOOL
+evlog_file_contains(void *p)
+{
+	return (evlog_file.map && (BYTE *)p >= evlog_file.map &&
+		(BYTE *)p < evlog_file.map + EVLOG_FILE_MAX);
+}
+
+/* Append @event to the on-disk log. On success, the event's buffers are freed and it's
+ * pointed at its copy on disk instead. On failure the event is left alone, and just won't
+ * be there after a restart. The lock should be held before calling this function. */
+TSS_RESULT
+evlog_file_append(TSS_PCR_EVENT *event)
+{
+	struct evlog_file_rec rec;
+	UINT32 rec_size;
+	BYTE *buf;
+
+	if (evlog_file.map == NULL)
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	rec_size = EVLOG_FILE_PAD(sizeof(rec) + event->ulPcrValueLength + event->ulEventLength);
+	if (event->ulPcrValueLength > EVLOG_FILE_MAX || event->ulEventLength > EVLOG_FILE_MAX ||
+	    rec_size > EVLOG_FILE_MAX - evlog_file.tail) {
+		if (!evlog_file.full)
+			LogError("Event log file is full, new PCR events will not survive a "
+				 "restart.");
+		evlog_file.full = TRUE;
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	if ((buf = calloc(1, rec_size)) == NULL) {
+		LogError("malloc of %u bytes failed.", rec_size);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = EVLOG_FILE_REC_MAGIC;
+	rec.pcr_index = event->ulPcrIndex;
+	rec.event_type = event->eventType;
+	rec.pcr_value_len = event->ulPcrValueLength;
+	rec.event_len = event->ulEventLength;
+	memcpy(&rec.version, &event->versionInfo, sizeof(TSS_VERSION));
+	rec.checksum = evlog_file_rec_checksum(&rec, event->rgbPcrValue, event->rgbEvent);
+
+	memcpy(buf, &rec, sizeof(rec));
+	if (rec.pcr_value_len)
+		memcpy(buf + sizeof(rec), event->rgbPcrValue, rec.pcr_value_len);
+	if (rec.event_len)
+		memcpy(buf + sizeof(rec) + rec.pcr_value_len, event->rgbEvent, rec.event_len);
+
+	if (evlog_file_write(evlog_file.tail, buf, rec_size)) {
+		LogError("Error writing to event log file: %s", strerror(errno));
+		/* don't leave half a record for the next one to be appended after */
+		if (ftruncate(evlog_file.fd, evlog_file.tail))
+			LogError("Error truncating event log file: %s", strerror(errno));
+		free(buf);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+	free(buf);
+
+	free(event->rgbPcrValue);
+	free(event->rgbEvent);
+	event->rgbPcrValue = rec.pcr_value_len ?
+			     evlog_file.map + evlog_file.tail + sizeof(rec) : NULL;
+	event->rgbEvent = rec.event_len ?
+			  evlog_file.map + evlog_file.tail + sizeof(rec) + rec.pcr_value_len : NULL;
+
+	evlog_file.tail += rec_size;
+
+	return TSS_SUCCESS;
+}
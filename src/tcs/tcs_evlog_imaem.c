@@ -57,296 +57,413 @@ struct ext_log_source ima_source = {
 	ima_close
 };
 
+/*
+ * The measurement log is append-only, so rather than rescanning it for every request, the
+ * tcsd keeps it open and remembers the file offset of every event, per PCR. Each request
+ * only parses the bytes the kernel appended since the last one. All access happens with
+ * tcs_event_log->lock held.
+ */
+struct ima_pcr_index {
+	UINT32 num;
+	UINT32 size;
+	long *offsets;
+};
+
+static struct {
+	char *source;
+	FILE *fp;
+	long parsed;	/* offset just past the last complete event that's been indexed */
+	struct ima_pcr_index *pcrs;
+} ima_index;
+
+void
+ima_index_free()
+{
+	UINT32 i;
+
+	if (ima_index.fp)
+		fclose(ima_index.fp);
+
+	if (ima_index.pcrs) {
+		for (i = 0; i < tpm_metrics.num_pcrs; i++)
+			free(ima_index.pcrs[i].offsets);
+		free(ima_index.pcrs);
+	}
+
+	free(ima_index.source);
+	memset(&ima_index, 0, sizeof(ima_index));
+}
+
 int
 ima_open(void *source, FILE **handle)
 {
  	FILE *fd;
 
-	if ((fd = fopen((char *)source, "r")) == NULL) {
-		LogError("Error opening PCR log file %s: %s",
-			(char *)source, strerror(errno));
-		return -1;
+	/* the log file has been reconfigured, start over */
+	if (ima_index.fp && strcmp(ima_index.source, (char *)source))
+		ima_index_free();
+
+	if (ima_index.fp == NULL) {
+		if ((fd = fopen((char *)source, "r")) == NULL) {
+			LogError("Error opening PCR log file %s: %s",
+				(char *)source, strerror(errno));
+			return -1;
+		}
+
+		ima_index.pcrs = calloc(tpm_metrics.num_pcrs, sizeof(struct ima_pcr_index));
+		ima_index.source = strdup((char *)source);
+		if (ima_index.pcrs == NULL || ima_index.source == NULL) {
+			LogError("malloc of %zd bytes failed.",
+				 tpm_metrics.num_pcrs * sizeof(struct ima_pcr_index));
+			fclose(fd);
+			free(ima_index.pcrs);
+			free(ima_index.source);
+			memset(&ima_index, 0, sizeof(ima_index));
+			return -1;
+		}
+
+		ima_index.fp = fd;
 	}
 
-	*handle =  fd;
+	*handle = ima_index.fp;
 	return 0;
 }
 
-TSS_RESULT
-ima_get_entries_by_pcr(FILE *handle, UINT32 pcr_index, UINT32 first,
-			UINT32 *count, TSS_PCR_EVENT **events)
+/* read past @len bytes. Reading rather than seeking lets us notice an event that has only
+ * been partially written */
+static int
+ima_skip(FILE *fp, UINT32 len)
 {
-	int pcr_value;
-	char page[IMA_READ_SIZE];
-	int error_path = 1, ptr = 0;
-	UINT32 copied_events = 0, i;
-	struct event_wrapper *list = calloc(1, sizeof(struct event_wrapper));
-	struct event_wrapper *cur = list;
-	TSS_RESULT result = TCSERR(TSS_E_INTERNAL_ERROR);
-	FILE *fp = (FILE *) handle;
-	uint len;
-	char name[255];
-
-	if (list == NULL) {
-		LogError("malloc of %zd bytes failed.", sizeof(struct event_wrapper));
-		return TCSERR(TSS_E_OUTOFMEMORY);
+	char buf[IMA_READ_SIZE];
+	UINT32 chunk;
+
+	while (len) {
+		chunk = MIN(len, sizeof(buf));
+		if (fread(buf, 1, chunk, fp) != chunk)
+			return -1;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+static TSS_RESULT
+ima_index_add(UINT32 pcr_index, long offset)
+{
+	struct ima_pcr_index *pcr = &ima_index.pcrs[pcr_index];
+	long *offsets;
+	UINT32 size;
+
+	if (pcr->num == pcr->size) {
+		size = pcr->size ? pcr->size * 2 : 64;
+		if ((offsets = realloc(pcr->offsets, size * sizeof(long))) == NULL) {
+			LogError("malloc of %zd bytes failed.", size * sizeof(long));
+			return TCSERR(TSS_E_OUTOFMEMORY);
+		}
+		pcr->offsets = offsets;
+		pcr->size = size;
 	}
 
-	if (*count == 0) {
-		result = TSS_SUCCESS;
-		goto free_list;
+	pcr->offsets[pcr->num++] = offset;
+
+	return TSS_SUCCESS;
+}
+
+/*
+ * The template digest of an event recorded with the original "ima" template is the SHA1 of the
+ * file data SHA1 followed by the file name, zero padded to IMA_MAX_NAME_LEN + 1 bytes. New
+ * events are checked against it as they're indexed, IMA_HASH_BATCH at a time so that their
+ * digests can be computed together.
+ */
+#define IMA_TEMPLATE_NAME	"ima"
+#define IMA_TEMPLATE_DATA_LEN	(TPM_SHA1_160_HASH_LEN + IMA_MAX_NAME_LEN + 1)
+#define IMA_HASH_BATCH		64
+
+struct ima_pending {
+	UINT32 num;
+	UINT32 pcr[IMA_HASH_BATCH];
+	long end[IMA_HASH_BATCH];	/* offset just past the event */
+	TSS_BOOL check[IMA_HASH_BATCH];
+	BYTE digest[IMA_HASH_BATCH][TPM_SHA1_160_HASH_LEN];
+	BYTE data[IMA_HASH_BATCH][IMA_TEMPLATE_DATA_LEN];
+};
+
+/* Check the template digests of the pending events and index them. An event whose digest
+ * doesn't match is logged and indexed anyway */
+static TSS_RESULT
+ima_index_flush(struct ima_pending *p)
+{
+	BYTE *bufs[IMA_HASH_BATCH], digests[IMA_HASH_BATCH * TPM_SHA1_160_HASH_LEN];
+	UINT32 sizes[IMA_HASH_BATCH], i, n;
+	TSS_RESULT result;
+
+	for (i = 0, n = 0; i < p->num; i++) {
+		if (!p->check[i])
+			continue;
+
+		sizes[n] = IMA_TEMPLATE_DATA_LEN;
+		bufs[n++] = p->data[i];
 	}
 
-	if (!fp) {
-		perror("unable to open file\n");
-		return 1;
+	if ((result = HashBatch(TSS_HASH_SHA1, n, sizes, bufs, digests)))
+		return result;
+
+	for (i = 0, n = 0; i < p->num; i++) {
+		/* the entry is still returned, a verifier replaying the log will see it doesn't
+		 * match */
+		if (p->check[i] && memcmp(p->digest[i], &digests[n++ * TPM_SHA1_160_HASH_LEN],
+					  TPM_SHA1_160_HASH_LEN))
+			LogError("Event log file: template digest mismatch at offset %ld",
+				 ima_index.parsed);
+
+		if ((result = ima_index_add(p->pcr[i], ima_index.parsed)))
+			return result;
+
+		ima_index.parsed = p->end[i];
 	}
-	rewind(fp);
-
-        while (fread(page, 24, 1, fp)) {
-		/* copy the initial 4 bytes (PCR index) XXX endianess ignored */
-		ptr = 0;
-		memcpy(&pcr_value, &page[ptr], sizeof(int));
-		cur->event.ulPcrIndex = pcr_value;
-		ptr += sizeof(int);
-
-		/* grab this entry */
-		cur->event.ulPcrValueLength = 20;
-		cur->event.rgbPcrValue = malloc(cur->event.ulPcrValueLength);
-		if (cur->event.rgbPcrValue == NULL) {
-			LogError("malloc of %d bytes failed.", 20);
-			result = TCSERR(TSS_E_OUTOFMEMORY);
-			goto free_list;
-		}
 
-		/* copy the template SHA1 XXX endianess ignored */
-		memcpy(cur->event.rgbPcrValue, &page[ptr],
-		       cur->event.ulPcrValueLength);
+	p->num = 0;
+
+	return TSS_SUCCESS;
+}
 
-/* Get the template name size, template name */
+/* Index any events appended to the log since the last call */
+static TSS_RESULT
+ima_index_update(FILE *fp)
 {
-		char digest[20];
+	static struct ima_pending pending;
+	static const BYTE violation[TPM_SHA1_160_HASH_LEN];
+	UINT32 pcr_value, len;
+	BYTE name[IMA_MAX_NAME_LEN], *data;
+	TSS_BOOL check;
+	TSS_RESULT result;
+
+	if (fp != ima_index.fp)
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	/* also clears EOF from the last time we caught up with the kernel */
+	if (fseek(fp, ima_index.parsed, SEEK_SET)) {
+		LogError("Failed to seek in event log file: %s", strerror(errno));
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	pending.num = 0;
+
+	while (fread(&pcr_value, sizeof(UINT32), 1, fp) == 1) {
+		data = pending.data[pending.num];
 
-		if (fread(&len, 1, sizeof(len), fp) != (sizeof(len))) {
-			LogError("Failed to read event log file");
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			goto free_list;
+		/* template SHA1 */
+		if (fread(pending.digest[pending.num], 1, TPM_SHA1_160_HASH_LEN, fp) !=
+		    TPM_SHA1_160_HASH_LEN)
+			break;
+
+		/* template name */
+		if (fread(&len, sizeof(UINT32), 1, fp) != 1)
+			break;
+		if (len > IMA_MAX_NAME_LEN) {
+			LogError("Corrupt event log file: template name length %u", len);
+			return TCSERR(TSS_E_INTERNAL_ERROR);
 		}
-		
-		memset(name, 0, sizeof name);
-		if (fread(name, 1, len, fp) != len) {
-			LogError("Failed to read event log file");
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			goto free_list;
+		if (fread(name, 1, len, fp) != len)
+			break;
+
+		check = (len == strlen(IMA_TEMPLATE_NAME) &&
+			 !memcmp(name, IMA_TEMPLATE_NAME, len));
+
+		/* file data SHA1 */
+		if (fread(data, 1, TPM_SHA1_160_HASH_LEN, fp) != TPM_SHA1_160_HASH_LEN)
+			break;
+
+		/* template data */
+		if (fread(&len, sizeof(UINT32), 1, fp) != 1)
+			break;
+		if (check && len <= IMA_MAX_NAME_LEN) {
+			memset(&data[TPM_SHA1_160_HASH_LEN], 0, IMA_MAX_NAME_LEN + 1);
+			if (fread(&data[TPM_SHA1_160_HASH_LEN], 1, len, fp) != len)
+				break;
+		} else {
+			check = FALSE;
+			if (ima_skip(fp, len))
+				break;
 		}
-		if (fread(digest, 1, sizeof digest, fp) != (sizeof(digest))) {
-			LogError("Failed to read event log file");
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			goto free_list;
+
+		if (pcr_value >= tpm_metrics.num_pcrs) {
+			LogError("Corrupt event log file: PCR index %u", pcr_value);
+			return TCSERR(TSS_E_INTERNAL_ERROR);
 		}
+
+		/* a violation is recorded with a zeroed template digest */
+		if (check && !memcmp(pending.digest[pending.num], violation,
+				     TPM_SHA1_160_HASH_LEN))
+			check = FALSE;
+
+		pending.pcr[pending.num] = pcr_value;
+		pending.end[pending.num] = ftell(fp);
+		pending.check[pending.num] = check;
+
+		if (++pending.num == IMA_HASH_BATCH && (result = ima_index_flush(&pending)))
+			return result;
+	}
+
+	/* anything after ima_index.parsed is an event the kernel hasn't finished writing, it'll
+	 * be picked up next time */
+	return ima_index_flush(&pending);
 }
-		/* Get the template data namelen and data */
-		if (fread(&cur->event.ulEventLength, 1, sizeof(int), fp) != sizeof(int)) {
-			LogError("Failed to read event log file");
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			goto free_list;
-		}
-		cur->event.rgbEvent = malloc(cur->event.ulEventLength + 1);
-		if (cur->event.rgbEvent == NULL) {
-			free(cur->event.rgbPcrValue);
-			LogError("malloc of %u bytes failed.",
-				 cur->event.ulEventLength);
-			result = TCSERR(TSS_E_OUTOFMEMORY);
-			goto free_list;
-		}
-		memset(cur->event.rgbEvent, 0, cur->event.ulEventLength);
-		if (fread(cur->event.rgbEvent, 1, cur->event.ulEventLength, fp) != cur->event.ulEventLength) {
-			free(cur->event.rgbPcrValue);
-			LogError("Failed to read event log file");
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			goto free_list;
-		}
 
-		copied_events++;
-printf("%d %s ", copied_events, name);
+/* Read the event starting at @offset into @event */
+static TSS_RESULT
+ima_read_event(FILE *fp, long offset, TSS_PCR_EVENT *event)
+{
+	UINT32 pcr_value, len;
+
+	memset(event, 0, sizeof(TSS_PCR_EVENT));
 
-printf("%s\n", cur->event.rgbEvent);
-		if (copied_events == *count)
-			goto copy_events;
+	if (fseek(fp, offset, SEEK_SET))
+		goto read_error;
 
-		cur->next = calloc(1, sizeof(struct event_wrapper));
-		if (cur->next == NULL) {
-			LogError("malloc of %zd bytes failed.",
-				 sizeof(struct event_wrapper));
-			result = TCSERR(TSS_E_OUTOFMEMORY);
-			goto free_list;
-		}
-		cur = cur->next;
+	/* copy the initial 4 bytes (PCR index) XXX endianess ignored */
+	if (fread(&pcr_value, sizeof(UINT32), 1, fp) != 1)
+		goto read_error;
+	event->ulPcrIndex = pcr_value;
+
+	event->ulPcrValueLength = TPM_SHA1_160_HASH_LEN;
+	event->rgbPcrValue = malloc(event->ulPcrValueLength);
+	if (event->rgbPcrValue == NULL) {
+		LogError("malloc of %d bytes failed.", TPM_SHA1_160_HASH_LEN);
+		return TCSERR(TSS_E_OUTOFMEMORY);
 	}
 
-copy_events:
-	/* we've copied all the events we need to from this PCR, now
-	 * copy them all into one contiguous memory block
-	 */
-printf("copied_events: %d\n", copied_events);
-	*events = calloc(copied_events, sizeof(TSS_PCR_EVENT));
-	if (*events == NULL) {
-		LogError("malloc of %zd bytes failed.", copied_events * sizeof(TSS_PCR_EVENT));
-		result = TCSERR(TSS_E_OUTOFMEMORY);
-		goto free_list;
+	/* copy the template SHA1 XXX endianess ignored */
+	if (fread(event->rgbPcrValue, 1, event->ulPcrValueLength, fp) !=
+	    event->ulPcrValueLength)
+		goto free_event;
+
+	/* skip the template name and file data SHA1 */
+	if (fread(&len, sizeof(UINT32), 1, fp) != 1)
+		goto free_event;
+	if (fseek(fp, len + TPM_SHA1_160_HASH_LEN, SEEK_CUR))
+		goto free_event;
+
+	/* Get the template data namelen and data */
+	if (fread(&event->ulEventLength, sizeof(UINT32), 1, fp) != 1)
+		goto free_event;
+
+	event->rgbEvent = calloc(1, event->ulEventLength + 1);
+	if (event->rgbEvent == NULL) {
+		LogError("malloc of %u bytes failed.", event->ulEventLength + 1);
+		free(event->rgbPcrValue);
+		event->rgbPcrValue = NULL;
+		return TCSERR(TSS_E_OUTOFMEMORY);
 	}
 
-	cur = list;
-	for (i = 0; i < copied_events; i++) {
-		memcpy(&((*events)[i]), &(cur->event), sizeof(TSS_PCR_EVENT));
-		cur = cur->next;
+	if (fread(event->rgbEvent, 1, event->ulEventLength, fp) != event->ulEventLength) {
+		free(event->rgbEvent);
+		event->rgbEvent = NULL;
+		goto free_event;
 	}
 
-	*count = copied_events;
-	/* assume we're in an error path until we get here */
-	error_path = 0;
-	result = TSS_SUCCESS;
-
-free_list:
-	cur = list->next;
-	while (cur != NULL) {
-		if (error_path) {
-			free(cur->event.rgbEvent);
-			free(cur->event.rgbPcrValue);
+	return TSS_SUCCESS;
+
+free_event:
+	free(event->rgbPcrValue);
+	event->rgbPcrValue = NULL;
+read_error:
+	LogError("Failed to read event log file");
+	return TCSERR(TSS_E_INTERNAL_ERROR);
+}
+
+TSS_RESULT
+ima_get_entries_by_pcr(FILE *handle, UINT32 pcr_index, UINT32 first,
+			UINT32 *count, TSS_PCR_EVENT **events)
+{
+	struct ima_pcr_index *pcr;
+	UINT32 num, i;
+	TSS_RESULT result;
+
+	if (*count == 0)
+		return TSS_SUCCESS;
+
+	if (pcr_index >= tpm_metrics.num_pcrs)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	if ((result = ima_index_update(handle)))
+		return result;
+
+	pcr = &ima_index.pcrs[pcr_index];
+
+	if (first >= pcr->num) {
+		*count = 0;
+		return TSS_SUCCESS;
+	}
+
+	num = MIN(*count, pcr->num - first);
+
+	*events = calloc(num, sizeof(TSS_PCR_EVENT));
+	if (*events == NULL) {
+		LogError("malloc of %zd bytes failed.", num * sizeof(TSS_PCR_EVENT));
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	for (i = 0; i < num; i++) {
+		if ((result = ima_read_event(handle, pcr->offsets[first + i], &(*events)[i]))) {
+			while (i--) {
+				free((*events)[i].rgbPcrValue);
+				free((*events)[i].rgbEvent);
+			}
+			free(*events);
+			*events = NULL;
+			return result;
 		}
-		free(list);
-		list = cur;
-		cur = list->next;
 	}
-	free(list);
-	return result;
+
+	*count = num;
+
+	return TSS_SUCCESS;
 }
 
 TSS_RESULT
 ima_get_entry(FILE *handle, UINT32 pcr_index, UINT32 *num, TSS_PCR_EVENT **ppEvent)
 {
-	int pcr_value, ptr = 0;
-	uint len;
-	char page[IMA_READ_SIZE];
-	UINT32 seen_indices = 0;
-	TSS_RESULT result = TCSERR(TSS_E_INTERNAL_ERROR);
-	TSS_PCR_EVENT *event = NULL;
-	FILE *fp = (FILE *) handle;
-	char name[255];
-
-	rewind(fp);
-	while (fread(page, 24, 1, fp)) {
-		/* copy the initial 4 bytes (PCR index) XXX endianess ignored */
-		ptr = 0;
-		memcpy(&pcr_value, &page[ptr], sizeof(int));
-
-		if (pcr_index == (UINT32)pcr_value) {
-			event = calloc(1, sizeof(TSS_PCR_EVENT));
-			event->ulPcrIndex = pcr_value;
-			ptr += sizeof(int);
-			/* This is the case where we're looking for a specific event number in a
-			 * specific PCR index. When we've reached the correct event, malloc
-			 * space for it, copy it in, then break out of the while loop */
-			if (ppEvent && seen_indices == *num) {
-				/* grab this entry */
-				event->ulPcrValueLength = 20;
-				event->rgbPcrValue = malloc(event->ulPcrValueLength);
-				if (event->rgbPcrValue == NULL) {
-					LogError("malloc of %d bytes failed.", 20);
-					free(event);
-					result = TCSERR(TSS_E_OUTOFMEMORY);
-					goto done;
-				}
-
-				/* copy the template SHA1 XXX endianess ignored */
-				memcpy(event->rgbPcrValue, &page[ptr],
-						event->ulPcrValueLength);
-
-				/* Get the template name size, template name */
-				{
-					char digest[20];
-
-					if (fread(&len, 1, sizeof(len), fp) != sizeof(len)) {
-						free(event);
-						LogError("Failed to read event log file");
-						result = TCSERR(TSS_E_INTERNAL_ERROR);
-						goto done;
-					}
-					memset(name, 0, sizeof name);
-					if (fread(name, 1, len, fp) != len) {
-						free(event);
-						LogError("Failed to read event log file");
-						result = TCSERR(TSS_E_INTERNAL_ERROR);
-						goto done;
-					}
-					if (fread(digest, 1, sizeof(digest), fp) != sizeof(digest)) {
-						free(event);
-						LogError("Failed to read event log file");
-						result = TCSERR(TSS_E_INTERNAL_ERROR);
-						goto done;
-					}
-				}
-				/* Get the template data namelen and data */
-				if (fread(&event->ulEventLength, 1, sizeof(int), fp) != sizeof(int)) {
-					free(event);
-					LogError("Failed to read event log file");
-					result = TCSERR(TSS_E_INTERNAL_ERROR);
-					goto done;
-				}
-				event->rgbEvent = malloc(event->ulEventLength + 1);
-				if (event->rgbEvent == NULL) {
-					free(event->rgbPcrValue);
-					free(event);
-					LogError("malloc of %u bytes failed.",
-							event->ulEventLength);
-					result = TCSERR(TSS_E_OUTOFMEMORY);
-					goto done;
-				}
-				memset(event->rgbEvent, 0, event->ulEventLength);
-				if (fread(event->rgbEvent, 1, event->ulEventLength, fp) != event->ulEventLength ) {
-					free(event->rgbPcrValue);
-					free(event);
-					LogError("Failed to read event log file");
-					result = TCSERR(TSS_E_INTERNAL_ERROR);
-					goto done;
-				}
-				
-				*ppEvent = event;
-				result = TSS_SUCCESS;
-				break;
-			}
-		}
-		if (fread(&len, 1, sizeof(len), fp) != sizeof(len)) {
-			free(event->rgbPcrValue);
-			free(event);
-			LogError("Failed to read event log file");
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			goto done;
-		}
-		fseek(fp, len + 20, SEEK_CUR);
-		if (fread(&len, 1, sizeof(len), fp) != sizeof(len)) {
-			free(event->rgbPcrValue);
-			free(event);
-			LogError("Failed to read event log file");
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			goto done;
-		}
-		fseek(fp, len, SEEK_CUR);
-		seen_indices++;
-		printf("%d - index\n", seen_indices);
+	struct ima_pcr_index *pcr;
+	TSS_PCR_EVENT *event;
+	TSS_RESULT result;
+
+	if (pcr_index >= tpm_metrics.num_pcrs)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	if ((result = ima_index_update(handle)))
+		return result;
+
+	pcr = &ima_index.pcrs[pcr_index];
+
+	/* just the number of events for this PCR is being asked for */
+	if (ppEvent == NULL) {
+		*num = pcr->num;
+		return TSS_SUCCESS;
 	}
-done:
-	if (ppEvent == NULL)
-		*num = seen_indices;
 
-	return result;
+	if (*num >= pcr->num)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	if ((event = calloc(1, sizeof(TSS_PCR_EVENT))) == NULL) {
+		LogError("malloc of %zd bytes failed.", sizeof(TSS_PCR_EVENT));
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	if ((result = ima_read_event(handle, pcr->offsets[*num], event))) {
+		free(event);
+		return result;
+	}
+
+	*ppEvent = event;
+
+	return TSS_SUCCESS;
 }
 
+/* The log file stays open for the next request, see ima_index_free() */
 int
 ima_close(FILE *handle)
 {
-	fclose((FILE *)handle);
-
 	return 0;
 }
 #endif
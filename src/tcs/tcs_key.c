@@ -19,8 +19,6 @@
 #include "tcs_utils.h"
 #include "tcs_int_literals.h"
 
-struct key_mem_cache *key_mem_cache_head = NULL;
-
 TSS_UUID NULL_UUID = { 0, 0, 0, 0, 0, { 0, 0, 0, 0, 0, 0 } };
 
 
@@ -29,10 +29,10 @@
 #include "tcs_key_ps.h"
 
 /*
- * mem_cache_lock will be responsible for protecting the key_mem_cache_head list. This is a
- * TCSD global linked list of all keys which have been loaded into the TPM at some time.
+ * mem_cache_lock will be responsible for protecting the key_mem_cache_head list. Each TPM the
+ * TCSD serves has its own list of all keys which have been loaded into it at some time, see
+ * struct tcs_device.
  */
-MUTEX_DECLARE_INIT(mem_cache_lock);
 
 /*
  * tcs_keyhandle_lock is only used to make TCS keyhandle generation atomic for all TCSD
@@ -1046,7 +1046,7 @@ LoadKeyShim(TCS_CONTEXT_HANDLE hContext, TCPA_STORE_PUBKEY *pubKey,
 		TSS_UUID *uuid;
 
 		/* check registered */
-		if (ps_is_pub_registered(pubKey) == FALSE)
+		if (ps_check_device() || ps_is_pub_registered(pubKey) == FALSE)
 			return TCSERR(TCS_E_KM_LOADFAILED);
 		//uuid = mc_get_uuid_by_pub(pubKey); // XXX pub is not in MC
 		if ((result = ps_get_uuid_by_pub(pubKey, &uuid)))
@@ -14,6 +14,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "trousers/tss.h"
 #include "trousers_types.h"
@@ -27,8 +28,10 @@
 #include "req_mgr.h"
 
 
+/* Open the system PS file and its journal while the tcsd still has the privileges to. Reading
+ * them is left to ps_init_disk_cache(), which is slower and can be done later */
 TSS_RESULT
-ps_init_disk_cache(void)
+ps_open_disk_cache(void)
 {
 	int fd;
 	TSS_RESULT rc;
@@ -38,23 +41,45 @@ ps_init_disk_cache(void)
 	if ((fd = get_file()) < 0)
 		return TCSERR(TSS_E_INTERNAL_ERROR);
 
-	if ((rc = init_disk_cache(fd)))
-		return rc;
-
-	/* this is temporary, to clear out a PS file from trousers
-	 * versions before 0.2.1 */
-	if ((rc = clean_disk_cache(fd)))
-		return rc;
+	rc = psjournal_open_file();
 
 	put_file(fd);
+	return rc;
+}
+
+/* The system PS holds the key hierarchy of the first TPM, the one wrapped by its SRK. The other
+ * TPMs the tcsd serves have no PS: only the keys already loaded in them are reachable */
+TSS_RESULT
+ps_check_device(void)
+{
+	if (tcs_device_current()->index != 0)
+		return TCSERR(TSS_E_NOTIMPL);
+
 	return TSS_SUCCESS;
 }
 
+TSS_RESULT
+ps_init_disk_cache(void)
+{
+	int fd;
+	TSS_RESULT rc;
+
+	if ((fd = get_file()) < 0)
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+
+	rc = init_disk_cache(fd);
+
+	put_file(fd);
+	return rc;
+}
+
 void
 ps_close_disk_cache(void)
 {
 	int fd;
 
+	psfile_compact_final();
+
 	if ((fd = get_file()) < 0) {
 		LogError("get_file() failed while trying to close disk cache.");
 		return;
@@ -73,15 +98,11 @@ ps_is_key_registered(TCPA_STORE_PUBKEY *pub)
 	TSS_RESULT rc;
 	TSS_BOOL is_reg = FALSE;
 
-	if ((fd = get_file()) < 0)
+	if ((fd = get_file_nolock()) < 0)
 		return FALSE;
 
-	if ((rc = psfile_get_uuid_by_pub(fd, pub, &uuid))) {
-		put_file(fd);
+	if ((rc = psfile_get_uuid_by_pub(fd, pub, &uuid)))
 		return FALSE;
-	}
-
-	put_file(fd);
 
 	if ((isUUIDRegistered(uuid, &is_reg)))
 		is_reg = FALSE;
@@ -133,30 +154,6 @@ isUUIDRegistered(TSS_UUID *uuid, TSS_BOOL *is_reg)
 	return TSS_SUCCESS;
 }
 
-void
-disk_cache_shift(struct key_disk_cache *c)
-{
-	UINT32 key_size, offset;
-	struct key_disk_cache *tmp = key_disk_cache_head;
-
-	/* offset is the end of the key location in the file */
-	offset = TSSPS_VENDOR_DATA_OFFSET(c) + c->vendor_data_size;
-	/* key_size is the size of the key entry on disk */
-	key_size = offset - TSSPS_UUID_OFFSET(c);
-
-	/* for each disk cache entry, if the data for that entry is at an
-	 * offset greater than the key beign removed, then the entry needs to
-	 * be decremented by the size of key's disk footprint (the key_size
-	 * variable) */
-	while (tmp) {
-		if (tmp->offset >= offset) {
-			tmp->offset -= key_size;
-		}
-
-		tmp = tmp->next;
-	}
-}
-
 TSS_RESULT
 ps_remove_key(TSS_UUID *uuid)
 {
@@ -179,12 +176,9 @@ ps_remove_key(TSS_UUID *uuid)
 
 			put_file(fd);
 
-			/* if moving the file contents around succeeded, then
-			 * change the offsets of the keys in the cache in
-			 * mem_cache_shift() and remove the key from the
-			 * cache. */
+			/* the key's record is only unlinked on disk, the other keys
+			 * stay where they are */
 			if (!rc) {
-				disk_cache_shift(tmp);
 				if (prev) {
 					prev->next = tmp->next;
 				} else {
@@ -205,58 +199,17 @@ ps_remove_key(TSS_UUID *uuid)
 	return TCSERR(TCSERR(TSS_E_PS_KEY_NOTFOUND));
 }
 
-/*
- * temporary function to clean out blanked keys from a PS file from
- * trousers 0.2.0 and before
- */
-TSS_RESULT
-clean_disk_cache(int fd)
-{
-	struct key_disk_cache *tmp, *prev = NULL;
-	TSS_RESULT rc;
-
-	MUTEX_LOCK(disk_cache_lock);
-	tmp = key_disk_cache_head;
-
-	for (; tmp; prev = tmp, tmp = tmp->next) {
-		if (!(tmp->flags & CACHE_FLAG_VALID)) {
-			rc = psfile_remove_key(fd, tmp);
-
-			/* if moving the file contents around succeeded, then
-			 * change the offsets of the keys in the cache in
-			 * mem_cache_shift() and remove the key from the
-			 * cache. */
-			if (!rc) {
-				disk_cache_shift(tmp);
-				if (prev) {
-					prev->next = tmp->next;
-				}
-				free(tmp);
-			} else {
-				LogError("Error removing blank key.");
-			}
-
-			MUTEX_UNLOCK(disk_cache_lock);
-			return rc;
-		}
-	}
-
-	MUTEX_UNLOCK(disk_cache_lock);
-	return TSS_SUCCESS;
-}
-
 TSS_RESULT
 ps_get_key_by_uuid(TSS_UUID *uuid, BYTE *blob, UINT16 *blob_size)
 {
         int fd = -1;
         TSS_RESULT rc = TSS_SUCCESS;
 
-        if ((fd = get_file()) < 0)
+        if ((fd = get_file_nolock()) < 0)
                 return TCSERR(TSS_E_INTERNAL_ERROR);
 
         rc = psfile_get_key_by_uuid(fd, uuid, blob, blob_size);
 
-        put_file(fd);
         return rc;
 }
 
@@ -266,12 +219,11 @@ ps_get_key_by_cache_entry(struct key_disk_cache *c, BYTE *blob, UINT16 *blob_siz
         int fd = -1;
         TSS_RESULT rc = TSS_SUCCESS;
 
-        if ((fd = get_file()) < 0)
+        if ((fd = get_file_nolock()) < 0)
                 return TCSERR(TSS_E_INTERNAL_ERROR);
 
         rc = psfile_get_key_by_cache_entry(fd, c, blob, blob_size);
 
-        put_file(fd);
         return rc;
 }
 
@@ -281,12 +233,11 @@ ps_get_vendor_data(struct key_disk_cache *c, UINT32 *size, BYTE **data)
         int fd = -1;
         TSS_RESULT rc;
 
-        if ((fd = get_file()) < 0)
+        if ((fd = get_file_nolock()) < 0)
                 return TCSERR(TSS_E_INTERNAL_ERROR);
 
         rc = psfile_get_vendor_data(fd, c, size, data);
 
-        put_file(fd);
         return rc;
 }
 
@@ -296,15 +247,12 @@ ps_is_pub_registered(TCPA_STORE_PUBKEY *key)
         int fd = -1;
         TSS_BOOL answer;
 
-        if ((fd = get_file()) < 0)
+        if ((fd = get_file_nolock()) < 0)
                 return FALSE;
 
-        if (psfile_is_pub_registered(fd, key, &answer)) {
-                put_file(fd);
+        if (psfile_is_pub_registered(fd, key, &answer))
                 return FALSE;
-        }
 
-        put_file(fd);
         return answer;
 }
 
@@ -314,12 +262,11 @@ ps_get_uuid_by_pub(TCPA_STORE_PUBKEY *pub, TSS_UUID **uuid)
         int fd = -1;
 	TSS_RESULT ret;
 
-        if ((fd = get_file()) < 0)
+        if ((fd = get_file_nolock()) < 0)
                 return TCSERR(TSS_E_INTERNAL_ERROR);
 
         ret = psfile_get_uuid_by_pub(fd, pub, uuid);
 
-        put_file(fd);
         return ret;
 }
 
@@ -329,12 +276,11 @@ ps_get_key_by_pub(TCPA_STORE_PUBKEY *pub, UINT32 *size, BYTE **key)
         int fd = -1;
 	TSS_RESULT ret;
 
-        if ((fd = get_file()) < 0)
+        if ((fd = get_file_nolock()) < 0)
                 return TCSERR(TSS_E_INTERNAL_ERROR);
 
         ret = psfile_get_key_by_pub(fd, pub, size, key);
 
-        put_file(fd);
         return ret;
 }
 
@@ -355,13 +301,127 @@ ps_write_key(TSS_UUID *uuid, TSS_UUID *parent_uuid, BYTE *vendor_data,
 	if (!memcmp(parent_uuid, &NULL_UUID, sizeof(TSS_UUID))) {
 		parent_ps = TSS_PS_TYPE_SYSTEM;
 	} else {
-		if ((rc = psfile_get_ps_type_by_uuid(fd, parent_uuid, &parent_ps)))
+		if ((rc = psfile_get_ps_type_by_uuid(fd, parent_uuid, &parent_ps))) {
+			put_file(fd);
 			return rc;
+		}
 	}
 
         rc = psfile_write_key(fd, uuid, parent_uuid, &parent_ps, vendor_data,
 			      vendor_size, blob, short_blob_size);
 
         put_file(fd);
-        return TSS_SUCCESS;
+        return rc;
+}
+
+TSS_RESULT
+ps_write_keys(UINT32 num, TSS_UUID *uuids, TSS_UUID *parent_uuids, BYTE *vendor_data,
+	      UINT32 vendor_size, BYTE **blobs, UINT32 *blob_sizes)
+{
+	int fd = -1;
+	TSS_RESULT rc;
+	UINT16 *short_blob_sizes;
+	UINT32 i;
+
+	if ((short_blob_sizes = calloc(num, sizeof(UINT16))) == NULL) {
+		LogError("malloc of %zd bytes failed.", num * sizeof(UINT16));
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (blob_sizes[i] > USHRT_MAX) {
+			free(short_blob_sizes);
+			return TCSERR(TSS_E_BAD_PARAMETER);
+		}
+		short_blob_sizes[i] = (UINT16)blob_sizes[i];
+	}
+
+	if ((fd = get_file()) < 0) {
+		free(short_blob_sizes);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	rc = psfile_write_keys(fd, num, uuids, parent_uuids, vendor_data, vendor_size, blobs,
+			       short_blob_sizes);
+
+	put_file(fd);
+	free(short_blob_sizes);
+	return rc;
+}
+
+TSS_RESULT
+ps_remove_keys(UINT32 num, TSS_UUID *uuids)
+{
+	struct key_disk_cache *tmp, *prev, *next, **c;
+	TSS_RESULT rc = TSS_SUCCESS;
+	UINT32 i, j;
+	int fd = -1;
+
+	if ((c = calloc(num, sizeof(struct key_disk_cache *))) == NULL) {
+		LogError("malloc of %zd bytes failed.", num * sizeof(struct key_disk_cache *));
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	MUTEX_LOCK(disk_cache_lock);
+
+	for (i = 0; i < num; i++) {
+		for (tmp = key_disk_cache_head; tmp; tmp = tmp->next) {
+			if ((tmp->flags & CACHE_FLAG_VALID) &&
+			    !memcmp(&uuids[i], &tmp->uuid, sizeof(TSS_UUID)))
+				break;
+		}
+
+		if (tmp == NULL) {
+			rc = TCSERR(TSS_E_PS_KEY_NOTFOUND);
+			goto done;
+		}
+
+		/* a key listed twice would be unlinked twice */
+		for (j = 0; j < i; j++) {
+			if (c[j] == tmp) {
+				rc = TCSERR(TSS_E_BAD_PARAMETER);
+				goto done;
+			}
+		}
+		c[i] = tmp;
+	}
+
+	if ((fd = get_file()) < 0) {
+		rc = TCSERR(TSS_E_INTERNAL_ERROR);
+		goto done;
+	}
+
+	rc = psfile_remove_keys(fd, num, c);
+
+	put_file(fd);
+
+	if (rc) {
+		LogError("Error removing registered keys.");
+		goto done;
+	}
+
+	for (prev = NULL, tmp = key_disk_cache_head; tmp; tmp = next) {
+		next = tmp->next;
+
+		for (j = 0; j < num; j++) {
+			if (c[j] == tmp)
+				break;
+		}
+
+		if (j == num) {
+			prev = tmp;
+			continue;
+		}
+
+		if (prev)
+			prev->next = next;
+		else
+			key_disk_cache_head = next;
+		free(tmp);
+	}
+done:
+	MUTEX_UNLOCK(disk_cache_lock);
+	free(c);
+
+	return rc;
 }
@@ -1,4 +1,3 @@
-
 /*
  * Licensed Materials - Property of IBM
  *
@@ -31,2171 +30,712 @@
 
 
 #define TSS_TPM_RSP_BLOB_AUTH_LEN	(sizeof(TPM_NONCE) + sizeof(TPM_DIGEST) + sizeof(TPM_BOOL))
+#define TSS_TPM_RQU_BLOB_AUTH_LEN	(sizeof(TPM_AUTHHANDLE) + TSS_TPM_RSP_BLOB_AUTH_LEN)
 
-TSS_RESULT
-tpm_rsp_parse(TPM_COMMAND_CODE ordinal, BYTE *b, UINT32 len, ...)
-{
-	TSS_RESULT result = TSS_SUCCESS;
-	UINT64 offset1, offset2;
-	va_list ap;
-
-	DBG_ASSERT(ordinal);
-	DBG_ASSERT(b);
-
-	va_start(ap, len);
-
-	switch (ordinal) {
-	case TPM_ORD_ExecuteTransport:
-	{
-		UINT32 *val1 = va_arg(ap, UINT32 *);
-		UINT32 *val2 = va_arg(ap, UINT32 *);
-		UINT32 *len1 = va_arg(ap, UINT32 *);
-		BYTE **blob1 = va_arg(ap, BYTE **);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (auth1 && auth2) {
-			offset1 = offset2 = len - (2 * TSS_TPM_RSP_BLOB_AUTH_LEN);
-			UnloadBlob_Auth(&offset1, b, auth1);
-			UnloadBlob_Auth(&offset1, b, auth2);
-		} else if (auth1) {
-			offset1 = offset2 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth1);
-		} else if (auth2) {
-			offset1 = offset2 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth2);
-		} else
-			offset2 = len;
-
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		if (val1)
-			UnloadBlob_UINT32(&offset1, val1, b);
-		if (val2)
-			UnloadBlob_UINT32(&offset1, val2, b);
-
-		*len1 = offset2 - offset1;
-		if (*len1) {
-			if ((*blob1 = malloc(*len1)) == NULL) {
-				LogError("malloc of %u bytes failed", *len1);
-				return TCSERR(TSS_E_OUTOFMEMORY);
-			}
-			UnloadBlob(&offset1, *len1, b, *blob1);
-		} else
-			*blob1 = NULL;
+/*
+ * Every TPM command the TCS sends and every response it parses is described by one row of the
+ * tables below: the fields in wire order, and the AUTHs that follow them. The varargs of
+ * tpm_rqu_build() and tpm_rsp_parse() are the fields in table order followed by one TPM_AUTH *
+ * per AUTH, the way the per-ordinal switch used to take them.
+ */
+#define PBG_MAX_FIELDS		10
+
+/* OR'd into a field: a value may not be 0, or a pointer may not be NULL */
+#define PBG_REQ			0x80
+#define PBG_KIND(f)		((f) & ~PBG_REQ)
+
+/* Request fields, and the varargs each of them takes */
+#define PBG_RQU_END		0
+#define PBG_RQU_UINT16		1	/* int */
+#define PBG_RQU_UINT32		2	/* UINT32 */
+#define PBG_RQU_HANDLE		3	/* UINT32, a key handle. Not part of the param digest */
+#define PBG_RQU_BOOL		4	/* int, also used for single BYTEs */
+#define PBG_RQU_PBOOL		5	/* TSS_BOOL * */
+#define PBG_RQU_PHANDLE		6	/* UINT32 *, left out of the command if NULL */
+#define PBG_RQU_DIGEST		7	/* BYTE *, 20 bytes */
+#define PBG_RQU_DIGEST3		8	/* BYTE *, 60 bytes */
+#define PBG_RQU_BLOB		9	/* UINT32, BYTE *; loaded as is */
+#define PBG_RQU_SZBLOB		10	/* UINT32, BYTE *; loaded behind its UINT32 size */
+#define PBG_RQU_ORDINAL		11	/* UINT32, the ordinal to put in the header */
+
+/* Response fields, and the varargs each of them takes */
+#define PBG_RSP_END		0
+#define PBG_RSP_UINT32		1	/* UINT32 * */
+#define PBG_RSP_PUINT32		2	/* UINT32 *, not in the response if NULL */
+#define PBG_RSP_BOOL		3	/* TSS_BOOL * */
+#define PBG_RSP_DIGEST		4	/* TPM_DIGEST * */
+#define PBG_RSP_VERSION		5	/* TPM_VERSION * */
+#define PBG_RSP_COUNTER		6	/* TPM_COUNTER_VALUE * */
+#define PBG_RSP_IGNORE		7	/* any pointer, nothing is read for it */
+#define PBG_RSP_TDIGEST		8	/* BYTE *, 20 bytes in front of the AUTHs */
+/* Everything from here on is returned as a UINT32 *, BYTE ** pair */
+#define PBG_RSP_SZBLOB		9	/* UINT32 size, then the bytes */
+#define PBG_RSP_REST		10	/* everything up to the trailing digests and AUTHs */
+#define PBG_RSP_TICKS		11	/* a TPM_CURRENT_TICKS */
+#define PBG_RSP_COUNTER_BLOB	12	/* a TPM_COUNTER_VALUE */
+#define PBG_RSP_PCR_COMPOSITE	13
+#define PBG_RSP_PCR_INFO_SHORT	14
+#define PBG_RSP_CERTIFY_INFO	15
+#define PBG_RSP_KEY		16
+
+#define PBG_RSP_IS_BLOB(f)	(PBG_KIND(f) >= PBG_RSP_SZBLOB)
+
+#define PBG_NUM_LAYOUTS(t)	(sizeof(t) / sizeof(t[0]))
+
+#define PBG_SIZEOF_CURRENT_TICKS	(sizeof(UINT16) + sizeof(UINT64) + sizeof(UINT16) + \
+					 sizeof(TPM_NONCE))
+#define PBG_SIZEOF_COUNTER_VALUE	(sizeof(UINT16) + 4 + sizeof(UINT32))
 
-		break;
-	}
+/*
+ * @num_auths is how many TPM_AUTH *s follow the fields; each one may be NULL unless its bit
+ * is set in @req_auths. The AUTHs that are present go on the wire in order, so a command with
+ * two optional AUTHs is sent with AUTH1 if only one of them is passed in.
+ */
+struct pbg_layout
+{
+	TPM_COMMAND_CODE ordinal;
+	BYTE num_auths;
+	BYTE req_auths;
+	BYTE fields[PBG_MAX_FIELDS];
+};
+
+#define H	PBG_RQU_HANDLE
+#define U16	PBG_RQU_UINT16
+#define U32	PBG_RQU_UINT32
+#define DIG	PBG_RQU_DIGEST
+#define SZ	PBG_RQU_SZBLOB
+#define RAW	PBG_RQU_BLOB
+#define R	PBG_REQ
+
+static const struct pbg_layout rqu_layouts[] = {
+#ifdef TSS_BUILD_DELEGATION
+	{ TPM_ORD_DSAP, 0, 0, { U16, U32, DIG, SZ|R } },
+	{ TPM_ORD_Delegate_CreateOwnerDelegation, 1, 0, { PBG_RQU_BOOL, RAW|R, DIG } },
+	{ TPM_ORD_Delegate_CreateKeyDelegation, 1, 0, { H|R, RAW|R, DIG } },
+#endif
+#ifdef TSS_BUILD_TRANSPORT
+	{ TPM_ORD_ExecuteTransport, 2, 0,
+	  { PBG_RQU_ORDINAL, PBG_RQU_PHANDLE, PBG_RQU_PHANDLE, RAW } },
+#endif
+	{ TPM_ORD_CreateMigrationBlob, 2, 0x2, { H, U16, RAW|R, SZ|R } },
+	{ TPM_ORD_ChangeAuth, 2, 0x3, { H, U16, DIG, U16, SZ|R } },
+	{ TPM_ORD_MakeIdentity, 2, 0x2, { DIG, DIG, RAW|R } },
+#if (TSS_BUILD_NV || TSS_BUILD_DELEGATION)
+	{ TPM_ORD_NV_WriteValue, 1, 0, { U32, U32, SZ|R } },
+	{ TPM_ORD_NV_WriteValueAuth, 1, 0, { U32, U32, SZ|R } },
+	{ TPM_ORD_Delegate_Manage, 1, 0, { U32, U32, SZ|R } },
+#endif
+	{ TPM_ORD_NV_ReadValue, 1, 0, { U32, U32, U32 } },
+	{ TPM_ORD_NV_ReadValueAuth, 1, 0, { U32, U32, U32 } },
+	{ TPM_ORD_SetRedirection, 1, 0, { H, U32, U32 } },
+	{ TPM_ORD_CreateEndorsementKeyPair, 0, 0, { DIG, RAW|R } },
+#ifdef TSS_BUILD_TSS12
+	{ TPM_ORD_CreateRevocableEK, 0, 0, { DIG, RAW|R, PBG_RQU_BOOL, DIG } },
+	{ TPM_ORD_RevokeTrust, 0, 0, { DIG } },
+#endif
+#ifdef TSS_BUILD_COUNTER
+	{ TPM_ORD_CreateCounter, 1, 0x1, { DIG, RAW|R } },
+#endif
+#ifdef TSS_BUILD_DAA
+	{ TPM_ORD_DAA_Sign, 1, 0x1, { H|R, PBG_RQU_BOOL, SZ|R, SZ } },
+	{ TPM_ORD_DAA_Join, 1, 0x1, { H|R, PBG_RQU_BOOL, SZ|R, SZ } },
+#endif
+	{ TPM_ORD_ConvertMigrationBlob, 1, 0, { H|R, SZ|R, SZ|R } },
+	{ TPM_ORD_SetCapability, 1, 0, { U32|R, SZ|R, SZ|R } },
+	{ TPM_ORD_CertifyKey, 2, 0, { H|R, H|R, DIG } },
+	{ TPM_ORD_Delegate_LoadOwnerDelegation, 1, 0, { U32, SZ } },
+	{ TPM_ORD_GetCapability, 1, 0, { U32, SZ } },
+	{ TPM_ORD_UnBind, 1, 0, { H, SZ } },
+	{ TPM_ORD_Sign, 1, 0, { H, SZ } },
+	{ TPM_ORD_Seal, 1, 0x1, { H|R, DIG, SZ, SZ|R } },
+	{ TPM_ORD_Sealx, 1, 0x1, { H|R, DIG, SZ, SZ|R } },
+	{ TPM_ORD_ActivateIdentity, 2, 0x2, { H|R, SZ|R } },
+	{ TPM_ORD_Quote, 1, 0, { H|R, DIG, RAW|R } },
+#ifdef TSS_BUILD_TSS12
+	{ TPM_ORD_Quote2, 1, 0, { H|R, DIG, RAW|R, PBG_RQU_PBOOL } },
+#endif
+	{ TPM_ORD_CreateWrapKey, 1, 0, { H|R, DIG, DIG, RAW|R } },
+	{ TPM_ORD_NV_DefineSpace, 1, 0, { RAW|R, RAW|R } },
+	{ TPM_ORD_LoadManuMaintPub, 1, 0, { RAW|R, RAW|R } },
 #ifdef TSS_BUILD_TICK
-	/* TPM BLOB: TPM_CURRENT_TICKS, UINT32, BLOB, optional AUTH */
-	case TPM_ORD_TickStampBlob:
-	{
-		UINT32 *len1 = va_arg(ap, UINT32 *);
-		BYTE **blob1 = va_arg(ap, BYTE **);
-		UINT32 *len2 = va_arg(ap, UINT32 *);
-		BYTE **blob2 = va_arg(ap, BYTE **);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!len1 || !blob1 || !len2 || !blob2) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		if (auth1) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth1);
-		}
-
-		offset1 = offset2 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_CURRENT_TICKS(&offset2, b, NULL);
-		*len1 = (UINT32)offset2 - offset1;
-
-		if ((*blob1 = malloc(*len1)) == NULL) {
-			LogError("malloc of %u bytes failed", *len1);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-
-		UnloadBlob(&offset1, *len1, b, *blob1);
-                UnloadBlob_UINT32(&offset1, len2, b);
-
-		if ((*blob2 = malloc(*len2)) == NULL) {
-			LogError("malloc of %u bytes failed", *len2);
-			free(*blob1);
-			*blob1 = NULL;
-			*len1 = 0;
-			*len2 = 0;
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len2, b, *blob2);
-
-		break;
-	}
+	{ TPM_ORD_TickStampBlob, 1, 0, { H|R, DIG, DIG } },
+#endif
+	{ TPM_ORD_ReadManuMaintPub, 0, 0, { RAW|R } },
+	{ TPM_ORD_ReadPubek, 0, 0, { RAW|R } },
+	{ TPM_ORD_PCR_Reset, 0, 0, { RAW|R } },
+	{ TPM_ORD_SetOperatorAuth, 0, 0, { RAW|R } },
+	{ TPM_ORD_LoadKey, 2, 0, { H, RAW } },
+	{ TPM_ORD_LoadKey2, 2, 0, { H, RAW } },
+	{ TPM_ORD_CertifySelfTest, 2, 0, { H, RAW } },
+	{ TPM_ORD_Unseal, 2, 0, { H, RAW } },
+	{ TPM_ORD_DirWriteAuth, 2, 0, { U32, RAW } },
+	{ TPM_ORD_Extend, 2, 0, { U32, RAW } },
+	{ TPM_ORD_StirRandom, 2, 0, { U32, RAW } },
+	{ TPM_ORD_LoadMaintenanceArchive, 2, 0, { U32, RAW } }, /* XXX */
+	{ TPM_ORD_FieldUpgrade, 2, 0, { U32, RAW } },
+	{ TPM_ORD_Delegate_UpdateVerification, 2, 0, { U32, RAW } },
+	{ TPM_ORD_Delegate_VerifyDelegation, 2, 0, { U32, RAW } },
+	{ TPM_ORD_AuthorizeMigrationKey, 1, 0x1, { U16, RAW|R } },
+	{ TPM_ORD_TakeOwnership, 1, 0x1, { U16, SZ|R, SZ|R, RAW|R } },
+#ifdef TSS_BUILD_AUDIT
+	{ TPM_ORD_GetAuditDigestSigned, 1, 0, { H, PBG_RQU_BOOL, DIG } },
+#endif
+	{ TPM_ORD_OSAP, 0, 0, { U16, U32, DIG } },
+	{ TPM_ORD_ChangeAuthOwner, 1, 0x1, { U16, DIG, U16 } },
+#ifdef TSS_BUILD_AUDIT
+	{ TPM_ORD_SetOrdinalAuditStatus, 1, 0x1, { U32, PBG_RQU_BOOL } },
+#endif
+	{ TPM_ORD_OwnerSetDisable, 1, 0, { PBG_RQU_BOOL } },
+	{ TPM_ORD_PhysicalSetDeactivated, 1, 0, { PBG_RQU_BOOL } },
+	{ TPM_ORD_CreateMaintenanceArchive, 1, 0, { PBG_RQU_BOOL } },
+	{ TPM_ORD_SetOwnerInstall, 1, 0, { PBG_RQU_BOOL } },
+	{ TPM_ORD_OwnerClear, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_DisablePubekRead, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_GetCapabilityOwner, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_ResetLockValue, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_DisableOwnerClear, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_SetTempDeactivated, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_OIAP, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_OwnerReadPubek, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_SelfTestFull, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_GetTicks, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_GetTestResult, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_KillMaintenanceFeature, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_Delegate_ReadTable, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_PhysicalEnable, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_DisableForceClear, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_ForceClear, 1, 0, { PBG_RQU_END } },
+	{ TPM_ORD_OwnerReadInternalPub, 1, 0, { U32 } },
+	{ TPM_ORD_GetPubKey, 1, 0, { H } },
+	{ TPM_ORD_ReleaseCounterOwner, 1, 0, { U32 } },
+	{ TPM_ORD_ReleaseCounter, 1, 0, { U32 } },
+	{ TPM_ORD_IncrementCounter, 1, 0, { U32 } },
+	{ TPM_ORD_PcrRead, 1, 0, { U32 } },
+	{ TPM_ORD_DirRead, 1, 0, { U32 } },
+	{ TPM_ORD_ReadCounter, 1, 0, { U32 } },
+	{ TPM_ORD_Terminate_Handle, 1, 0, { U32 } },
+	{ TPM_ORD_GetAuditDigest, 1, 0, { U32 } },
+	{ TPM_ORD_GetRandom, 1, 0, { U32 } },
+	{ TPM_ORD_CMK_SetRestrictions, 1, 0, { U32 } },
+	{ TSC_ORD_PhysicalPresence, 0, 0, { U16 } },
+#ifdef TSS_BUILD_CMK
+	{ TPM_ORD_CMK_ApproveMA, 1, 0, { DIG } },
+	{ TPM_ORD_CMK_CreateKey, 1, 0, { H, DIG, RAW|R, DIG, DIG } },
+	{ TPM_ORD_CMK_CreateTicket, 1, 0, { RAW|R, DIG, SZ|R } },
+	{ TPM_ORD_CMK_CreateBlob, 1, 0, { H, U16, RAW|R, DIG, SZ|R, SZ|R, SZ|R, SZ|R } },
+	{ TPM_ORD_CMK_ConvertMigration, 1, 0,
+	  { H, PBG_RQU_DIGEST3, DIG, RAW|R, SZ|R, SZ|R } },
+#endif
+#ifdef TSS_BUILD_TSS12
+	{ TPM_ORD_FlushSpecific, 0, 0, { U32, U32 } },
+	{ TPM_ORD_KeyControlOwner, 1, 0x1, { H, RAW, U32, PBG_RQU_BOOL } },
+#endif
+};
+
+#undef H
+#undef U16
+#undef U32
+#undef DIG
+#undef SZ
+#undef RAW
+
+#define U32	PBG_RSP_UINT32
+#define PU32	PBG_RSP_PUINT32
+#define DIG	PBG_RSP_DIGEST
+#define SZ	PBG_RSP_SZBLOB
+#define REST	PBG_RSP_REST
+
+static const struct pbg_layout rsp_layouts[] = {
+	{ TPM_ORD_ExecuteTransport, 2, 0, { PU32, PU32, REST } },
+#ifdef TSS_BUILD_TICK
+	{ TPM_ORD_TickStampBlob, 1, 0, { PBG_RSP_TICKS, SZ } },
 #endif
 #ifdef TSS_BUILD_QUOTE
-	/* TPM BLOB: TPM_PCR_COMPOSITE, UINT32, BLOB, 1 optional AUTH
-	 * return UINT32*, BYTE**, UINT32*, BYTE**, 1 optional AUTH */
-	case TPM_ORD_Quote:
-	{
-		UINT32 *len1 = va_arg(ap, UINT32 *);
-		BYTE **blob1 = va_arg(ap, BYTE **);
-		UINT32 *len2 = va_arg(ap, UINT32 *);
-		BYTE **blob2 = va_arg(ap, BYTE **);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!len1 || !blob1 || !len2 || !blob2) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		if (auth1) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth1);
-		}
-
-		offset1 = offset2 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_PCR_COMPOSITE(&offset2, b, NULL);
-		*len1 = offset2 - offset1;
-
-		if ((*blob1 = malloc(*len1)) == NULL) {
-			LogError("malloc of %u bytes failed", *len1);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len1, b, *blob1);
-                UnloadBlob_UINT32(&offset1, len2, b);
-
-		if ((*blob2 = malloc(*len2)) == NULL) {
-			LogError("malloc of %u bytes failed", *len2);
-			free(*blob1);
-			*blob1 = NULL;
-			*len1 = 0;
-			*len2 = 0;
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len2, b, *blob2);
-
-		break;
-	}
+	{ TPM_ORD_Quote, 1, 0, { PBG_RSP_PCR_COMPOSITE, SZ } },
 #endif
 #ifdef TSS_BUILD_TSS12
-	/* TPM BLOB: TPM_PCR_INFO_SHORT, (UINT32, BLOB,) UINT32, BLOB, 1 optional AUTH */
-	case TPM_ORD_Quote2:
-	{
-		UINT32 *len1 = va_arg(ap, UINT32 *); /* pcrDataSizeOut */
-		BYTE **blob1 = va_arg(ap, BYTE **);  /* pcrDataOut */
-		TSS_BOOL *addVersion = va_arg(ap, TSS_BOOL *); /* addVersion */
-		UINT32 *len2 = va_arg(ap, UINT32 *); /* versionInfoSize */
-		BYTE **blob2 = va_arg(ap, BYTE **);  /* versionInfo */
-		UINT32 *len3 = va_arg(ap, UINT32 *); /* sigSize */
-		BYTE **blob3 = va_arg(ap, BYTE **);  /* sig */
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *); /* privAuth */
-		va_end(ap);
-
-		if (!len1 || !blob1 || !len2 || !blob2 || !len3 || !blob3 || !addVersion) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		if (auth1) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth1);
-		}
-
-		offset1 = offset2 = TSS_TPM_TXBLOB_HDR_LEN;
-		/* Adjust the offset to take the TPM_PCR_INFO_SHORT size:
-		 * need to allocate this size into blob1
-		 */
-		UnloadBlob_PCR_INFO_SHORT(&offset2, b, NULL);
-
-		/* Get the size of the TSS_TPM_INFO_SHORT
-		 * and copy it into blob1 */
-		*len1 = offset2 - offset1;
-		LogDebugFn("QUOTE2 Core: PCR_INFO_SHORT is %u size", *len1);
-		if ((*blob1 = malloc(*len1)) == NULL) {
-			LogError("malloc of %u bytes failed", *len1);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len1, b, *blob1); /* TPM_PCR_INFO_SHORT */
-
-		UnloadBlob_UINT32(&offset1, len2,b); /* versionInfoSize */
-		LogDebugFn("QUOTE2 Core: versionInfoSize=%u", *len2);
-		if ((*blob2 = malloc(*len2)) == NULL) {
-			LogError("malloc of %u bytes failed", *len2);
-			free(*blob1);
-			*blob1 = NULL;
-			*len1 = 0;
-			*len2 = 0;
-			*len3 = 0;
-			*blob3 = NULL;
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len2, b, *blob2);
-
-		/* Take the sigSize */
-		UnloadBlob_UINT32(&offset1, len3, b);
-		LogDebugFn("QUOTE2 Core: sigSize=%u", *len3);
-		/* sig */
-		if ((*blob3 = malloc(*len3)) == NULL) {
-			LogError("malloc of %u bytes failed", *len3);
-			free(*blob1);
-			*blob1 = NULL;
-			if (*len2 > 0){
-				free(*blob2);
-				*blob2 = NULL;
-			}
-			*len1 = 0;
-			*len2 = 0;
-			*len3 = 0;
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len3, b, *blob3);
-		break;
-	}
+	{ TPM_ORD_Quote2, 1, 0, { PBG_RSP_PCR_INFO_SHORT, PBG_RSP_IGNORE, SZ, SZ } },
 #endif
-	/* TPM BLOB: TPM_CERTIFY_INFO, UINT32, BLOB, 2 optional AUTHs
-	 * return UINT32*, BYTE**, UINT32*, BYTE**, 2 optional AUTHs */
-	case TPM_ORD_CertifyKey:
-	{
-		UINT32 *len1 = va_arg(ap, UINT32 *);
-		BYTE **blob1 = va_arg(ap, BYTE **);
-		UINT32 *len2 = va_arg(ap, UINT32 *);
-		BYTE **blob2 = va_arg(ap, BYTE **);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!len1 || !blob1 || !len2 || !blob2) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		if (auth1 && auth2) {
-			offset1 = len - (2 * TSS_TPM_RSP_BLOB_AUTH_LEN);
-			UnloadBlob_Auth(&offset1, b, auth1);
-			UnloadBlob_Auth(&offset1, b, auth2);
-		} else if (auth1) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth1);
-		} else if (auth2) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth2);
-		}
-
-		offset1 = offset2 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_CERTIFY_INFO(&offset2, b, NULL);
-		*len1 = offset2 - offset1;
-
-		if ((*blob1 = malloc(*len1)) == NULL) {
-			LogError("malloc of %u bytes failed", *len1);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len1, b, *blob1);
-                UnloadBlob_UINT32(&offset1, len2, b);
-
-		if ((*blob2 = malloc(*len2)) == NULL) {
-			LogError("malloc of %u bytes failed", *len2);
-			free(*blob1);
-			*blob1 = NULL;
-			*len1 = 0;
-			*len2 = 0;
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len2, b, *blob2);
-
-		break;
-	}
+	{ TPM_ORD_CertifyKey, 2, 0, { PBG_RSP_CERTIFY_INFO, SZ } },
 #ifdef TSS_BUILD_AUDIT
-	/* TPM_BLOB: TPM_COUNTER_VALUE, DIGEST, DIGEST, UINT32, BLOB, optional AUTH
-	 * return: UINT32*, BYTE**, DIGEST*, DIGEST*, UINT32*, BYTE**, optional AUTH */
-	case TPM_ORD_GetAuditDigestSigned:
-	{
-		UINT32 *len1 = va_arg(ap, UINT32 *);
-		BYTE **blob1 = va_arg(ap, BYTE **);
-		TPM_DIGEST *digest1 = va_arg(ap, TPM_DIGEST *);
-		TPM_DIGEST *digest2 = va_arg(ap, TPM_DIGEST *);
-		UINT32 *len2 = va_arg(ap, UINT32 *);
-		BYTE **blob2 = va_arg(ap, BYTE **);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!digest1 || !digest2 || !len1 || !blob1 || !len2 || !blob2) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		offset1 = offset2 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_COUNTER_VALUE(&offset2, b, NULL);
-		*len1 = offset2 - offset1;
-
-		if ((*blob1 = malloc(*len1)) == NULL) {
-			LogError("malloc of %u bytes failed", *len1);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len1, b, *blob1);
-
-		UnloadBlob_DIGEST(&offset1, b, digest1);
-		UnloadBlob_DIGEST(&offset1, b, digest2);
-                UnloadBlob_UINT32(&offset1, len2, b);
-
-		if ((*blob2 = malloc(*len2)) == NULL) {
-			LogError("malloc of %u bytes failed", *len2);
-			free(*blob1);
-			*blob1 = NULL;
-			*len1 = 0;
-			*len2 = 0;
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len2, b, *blob2);
-
-		if (auth1)
-			UnloadBlob_Auth(&offset1, b, auth1);
+	{ TPM_ORD_GetAuditDigestSigned, 1, 0, { PBG_RSP_COUNTER_BLOB, DIG, DIG, SZ } },
+	{ TPM_ORD_GetAuditDigest, 0, 0, { PBG_RSP_COUNTER_BLOB, DIG, PBG_RSP_BOOL, SZ } },
+#endif
+#ifdef TSS_BUILD_COUNTER
+	{ TPM_ORD_ReadCounter, 1, 0, { PU32, PBG_RSP_COUNTER } },
+	{ TPM_ORD_CreateCounter, 1, 0, { PU32, PBG_RSP_COUNTER } },
+	{ TPM_ORD_IncrementCounter, 1, 0, { PU32, PBG_RSP_COUNTER } },
+#endif
+	{ TPM_ORD_CreateMaintenanceArchive, 2, 0, { SZ, SZ } },
+	{ TPM_ORD_CreateMigrationBlob, 2, 0, { SZ, SZ } },
+	{ TPM_ORD_Delegate_ReadTable, 2, 0, { SZ, SZ } },
+	{ TPM_ORD_CMK_CreateBlob, 2, 0, { SZ, SZ } },
+	{ TPM_ORD_ActivateIdentity, 2, 0x2, { REST } },
+	{ TPM_ORD_MakeIdentity, 2, 0x2, { PBG_RSP_KEY, SZ } },
+	{ TPM_ORD_GetCapabilityOwner, 1, 0, { PBG_RSP_VERSION, U32, U32 } },
+	{ TPM_ORD_Sign, 2, 0, { SZ } },
+	{ TPM_ORD_GetTestResult, 2, 0, { SZ } },
+	{ TPM_ORD_CertifySelfTest, 2, 0, { SZ } },
+	{ TPM_ORD_Unseal, 2, 0, { SZ } },
+	{ TPM_ORD_GetRandom, 2, 0, { SZ } },
+	{ TPM_ORD_DAA_Join, 2, 0, { SZ } },
+	{ TPM_ORD_DAA_Sign, 2, 0, { SZ } },
+	{ TPM_ORD_ChangeAuth, 2, 0, { SZ } },
+	{ TPM_ORD_GetCapability, 2, 0, { SZ } },
+	{ TPM_ORD_LoadMaintenanceArchive, 2, 0, { SZ } },
+	{ TPM_ORD_ConvertMigrationBlob, 2, 0, { SZ } },
+	{ TPM_ORD_NV_ReadValue, 2, 0, { SZ } },
+	{ TPM_ORD_NV_ReadValueAuth, 2, 0, { SZ } },
+	{ TPM_ORD_Delegate_Manage, 2, 0, { SZ } },
+	{ TPM_ORD_Delegate_CreateKeyDelegation, 2, 0, { SZ } },
+	{ TPM_ORD_Delegate_CreateOwnerDelegation, 2, 0, { SZ } },
+	{ TPM_ORD_Delegate_UpdateVerification, 2, 0, { SZ } },
+	{ TPM_ORD_CMK_ConvertMigration, 2, 0, { SZ } },
+	{ TPM_ORD_UnBind, 1, 0, { SZ } },
+	{ TPM_ORD_GetTicks, 1, 0, { REST } },
+	{ TPM_ORD_Seal, 1, 0, { REST } },
+	{ TPM_ORD_Sealx, 1, 0, { REST } },
+	{ TPM_ORD_FieldUpgrade, 1, 0, { REST } },
+	{ TPM_ORD_CreateWrapKey, 1, 0, { REST } },
+	{ TPM_ORD_GetPubKey, 1, 0, { REST } },
+	{ TPM_ORD_OwnerReadPubek, 1, 0, { REST } },
+	{ TPM_ORD_OwnerReadInternalPub, 1, 0, { REST } },
+	{ TPM_ORD_AuthorizeMigrationKey, 1, 0, { REST } },
+	{ TPM_ORD_TakeOwnership, 1, 0, { REST } },
+	{ TPM_ORD_CMK_CreateKey, 1, 0, { REST } },
+	{ TPM_ORD_CreateEndorsementKeyPair, 0, 0, { REST, PBG_RSP_TDIGEST } },
+	{ TPM_ORD_ReadPubek, 0, 0, { REST, PBG_RSP_TDIGEST } },
+#ifdef TSS_BUILD_TSS12
+	{ TPM_ORD_CreateRevocableEK, 0, 0, { REST, PBG_RSP_TDIGEST|R, PBG_RSP_TDIGEST|R } },
+#endif
+	{ TPM_ORD_LoadKey, 1, 0, { U32 } },
+	{ TPM_ORD_LoadKey2, 1, 0, { U32 } },
+	{ TPM_ORD_DirRead, 0, 0, { PU32, DIG } },
+	{ TPM_ORD_OIAP, 0, 0, { PU32, DIG } },
+	{ TPM_ORD_LoadManuMaintPub, 0, 0, { PU32, DIG } },
+	{ TPM_ORD_ReadManuMaintPub, 0, 0, { PU32, DIG } },
+	{ TPM_ORD_Extend, 0, 0, { PU32, DIG } },
+	{ TPM_ORD_PcrRead, 0, 0, { PU32, DIG } },
+	{ TPM_ORD_OSAP, 0, 0, { U32, DIG, DIG } },
+	{ TPM_ORD_DSAP, 0, 0, { U32, DIG, DIG } },
+#ifdef TSS_BUILD_CMK
+	{ TPM_ORD_CMK_ApproveMA, 1, 0, { DIG } },
+	{ TPM_ORD_CMK_CreateTicket, 1, 0, { DIG } },
+#endif
+	{ TPM_ORD_DisablePubekRead, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_DirWriteAuth, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_ReleaseCounter, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_ReleaseCounterOwner, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_ChangeAuthOwner, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_SetCapability, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_SetOrdinalAuditStatus, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_ResetLockValue, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_SetRedirection, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_DisableOwnerClear, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_OwnerSetDisable, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_SetTempDeactivated, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_KillMaintenanceFeature, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_NV_DefineSpace, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_NV_WriteValue, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_NV_WriteValueAuth, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_OwnerClear, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_Delegate_LoadOwnerDelegation, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_CMK_SetRestrictions, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_FlushSpecific, 1, 0, { PBG_RSP_END } },
+	{ TPM_ORD_KeyControlOwner, 1, 0, { PBG_RSP_END } },
+};
+
+#undef U32
+#undef PU32
+#undef DIG
+#undef SZ
+#undef REST
+#undef R
+
+static const struct pbg_layout *
+pbg_layout_find(const struct pbg_layout *table, UINT32 n, TPM_COMMAND_CODE ordinal)
+{
+	UINT32 i;
 
-		break;
+	for (i = 0; i < n; i++) {
+		if (table[i].ordinal == ordinal)
+			return &table[i];
 	}
-	/* TPM_BLOB: TPM_COUNTER_VALUE, DIGEST, BOOL, UINT32, BLOB
-	 * return: DIGEST*, UINT32*, BYTE**, BOOL, UINT32*, BYTE** */
-	case TPM_ORD_GetAuditDigest:
-	{
-		TPM_DIGEST *digest1 = va_arg(ap, TPM_DIGEST *);
-		UINT32 *len1 = va_arg(ap, UINT32 *);
-		BYTE **blob1 = va_arg(ap, BYTE **);
-		TSS_BOOL *bool1 = va_arg(ap, TSS_BOOL *);
-		UINT32 *len2 = va_arg(ap, UINT32 *);
-		BYTE **blob2 = va_arg(ap, BYTE **);
-		va_end(ap);
-
-		if (!digest1 || !len1 || !blob1 || !len2 || !blob2 || !bool1) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		offset1 = offset2 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_COUNTER_VALUE(&offset2, b, NULL);
-		*len1 = offset2 - offset1;
-
-		if ((*blob1 = malloc(*len1)) == NULL) {
-			LogError("malloc of %u bytes failed", *len1);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len1, b, *blob1);
 
-		UnloadBlob_DIGEST(&offset1, b, digest1);
-                UnloadBlob_BOOL(&offset1, bool1, b);
-                UnloadBlob_UINT32(&offset1, len2, b);
+	LogError("Unknown ordinal: 0x%x", ordinal);
+	return NULL;
+}
 
-		if ((*blob2 = malloc(*len2)) == NULL) {
-			LogError("malloc of %u bytes failed", *len2);
-			free(*blob1);
-			*blob1 = NULL;
-			*len1 = 0;
-			*len2 = 0;
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		UnloadBlob(&offset1, *len2, b, *blob2);
+/* Move past a TPM structure of variable size, which is returned to the caller as a blob */
+static TSS_RESULT
+pbg_struct_skip(BYTE kind, UINT64 *offset, BYTE *b)
+{
+	TSS_RESULT result = TSS_SUCCESS;
 
+	switch (kind) {
+	case PBG_RSP_TICKS:
+		*offset += PBG_SIZEOF_CURRENT_TICKS;
+		break;
+	case PBG_RSP_COUNTER_BLOB:
+		*offset += PBG_SIZEOF_COUNTER_VALUE;
+		break;
+#ifdef TSS_BUILD_QUOTE
+	case PBG_RSP_PCR_COMPOSITE:
+		result = UnloadBlob_PCR_COMPOSITE(offset, b, NULL);
 		break;
-	}
 #endif
-#ifdef TSS_BUILD_COUNTER
-	/* optional UINT32, TPM_COUNTER_VALUE, optional AUTH */
-	case TPM_ORD_ReadCounter:
-	case TPM_ORD_CreateCounter:
-	case TPM_ORD_IncrementCounter:
-	{
-		UINT32 *val1 = va_arg(ap, UINT32 *);
-		TPM_COUNTER_VALUE *ctr = va_arg(ap, TPM_COUNTER_VALUE *);
-		TPM_AUTH * auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!ctr) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		if (auth1) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth1);
-		}
-
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		if (val1)
-			UnloadBlob_UINT32(&offset1, val1, b);
-		UnloadBlob_COUNTER_VALUE(&offset1, b, ctr);
-
+#ifdef TSS_BUILD_TSS12
+	case PBG_RSP_PCR_INFO_SHORT:
+		result = UnloadBlob_PCR_INFO_SHORT(offset, b, NULL);
 		break;
-	}
 #endif
-	/* TPM BLOB: UINT32, BLOB, UINT32, BLOB, optional AUTH, optional AUTH */
-	case TPM_ORD_CreateMaintenanceArchive:
-	case TPM_ORD_CreateMigrationBlob:
-	case TPM_ORD_Delegate_ReadTable:
-	case TPM_ORD_CMK_CreateBlob:
-	{
-		UINT32 *len1 = va_arg(ap, UINT32 *);
-		BYTE **blob1 = va_arg(ap, BYTE **);
-		UINT32 *len2 = va_arg(ap, UINT32 *);
-		BYTE **blob2 = va_arg(ap, BYTE **);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!len1 || !blob1 || !len2 || !blob2) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		if (auth1 && auth2) {
-			offset1 = len - (2 * TSS_TPM_RSP_BLOB_AUTH_LEN);
-			UnloadBlob_Auth(&offset1, b, auth1);
-			UnloadBlob_Auth(&offset1, b, auth2);
-		} else if (auth1) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth1);
-		} else if (auth2) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth2);
-		}
-
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_UINT32(&offset1, len1, b);
-		if ((*blob1 = malloc(*len1)) == NULL) {
-			LogError("malloc of %u bytes failed", *len1);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-
-		UnloadBlob(&offset1, *len1, b, *blob1);
-
-		UnloadBlob_UINT32(&offset1, len2, b);
-		if ((*blob2 = malloc(*len2)) == NULL) {
-			free(*blob1);
-			LogError("malloc of %u bytes failed", *len2);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-
-		UnloadBlob(&offset1, *len2, b, *blob2);
-
+	case PBG_RSP_CERTIFY_INFO:
+		result = UnloadBlob_CERTIFY_INFO(offset, b, NULL);
 		break;
-	}
-	/* TPM BLOB: BLOB, optional AUTH, AUTH
-	 * return:   UINT32 *, BYTE **, optional AUTH, AUTH */
-	case TPM_ORD_ActivateIdentity:
-	{
-		UINT32 *len1 = va_arg(ap, UINT32 *);
-		BYTE **blob1 = va_arg(ap, BYTE **);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!len1 || !blob1 || !auth2) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		if (auth1 && auth2) {
-			offset1 = offset2 = len - (2 * TSS_TPM_RSP_BLOB_AUTH_LEN);
-			UnloadBlob_Auth(&offset1, b, auth1);
-			UnloadBlob_Auth(&offset1, b, auth2);
-		} else if (auth2) {
-			offset1 = offset2 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth2);
-		} else
-			offset2 = len;
-
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		offset2 -= TSS_TPM_TXBLOB_HDR_LEN;
-		if ((*blob1 = malloc(offset2)) == NULL) {
-			LogError("malloc of %zd bytes failed", (size_t)offset2);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		*len1 = offset2;
-		UnloadBlob(&offset1, *len1, b, *blob1);
-
+	case PBG_RSP_KEY:
+		result = UnloadBlob_TSS_KEY(offset, b, NULL);
+		break;
+	default:
+		result = TCSERR(TSS_E_INTERNAL_ERROR);
 		break;
 	}
-	/* TPM BLOB: TPM_KEY, UINT32, BLOB, optional AUTH, AUTH
-	 * return:   UINT32 *, BYTE **, UINT32 *, BYTE **, optional AUTH, AUTH */
-	case TPM_ORD_MakeIdentity:
-	{
-		UINT32 *len1, *len2;
-		BYTE **blob1, **blob2;
-		TPM_AUTH *auth1, *auth2;
-
-		len1 = va_arg(ap, UINT32 *);
-		blob1 = va_arg(ap, BYTE **);
-		len2 = va_arg(ap, UINT32 *);
-		blob2 = va_arg(ap, BYTE **);
-		auth1 = va_arg(ap, TPM_AUTH *);
-		auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
 
-		if (!len1 || !blob1 || !len2 || !blob2 || !auth2) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		offset1 = offset2 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_TSS_KEY(&offset1, b, NULL);
-		offset1 -= TSS_TPM_TXBLOB_HDR_LEN;
-
-		if ((*blob1 = malloc(offset1)) == NULL) {
-			LogError("malloc of %zd bytes failed", (size_t)offset1);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-		*len1 = offset1;
+	return result;
+}
 
-		UnloadBlob(&offset2, offset1, b, *blob1);
+/*
+ * Hand @size bytes at the cursor to the caller, either copied into a new buffer or, for a view,
+ * as a pointer into the response itself.
+ */
+static TSS_RESULT
+pbg_take_blob(struct blob_cursor *c, UINT32 size, BYTE **out, TSS_BOOL view)
+{
+	if (!blob_cursor_fits(c, size))
+		return TCSERR(TSS_E_INTERNAL_ERROR);
 
-		/* offset2 points to the stuff after the key */
-		UnloadBlob_UINT32(&offset2, len2, b);
+	if (size == 0)
+		return TSS_SUCCESS;
 
-		if ((*blob2 = malloc(*len2)) == NULL) {
-			free(*blob1);
-			LogError("malloc of %u bytes failed", *len2);
+	if (view)
+		*out = &c->base[c->pos];
+	else {
+		if ((*out = malloc(size)) == NULL) {
+			LogError("malloc of %u bytes failed", size);
 			return TCSERR(TSS_E_OUTOFMEMORY);
 		}
-
-		UnloadBlob(&offset2, *len2, b, *blob2);
-
-		if (auth1)
-			UnloadBlob_Auth(&offset2, b, auth1);
-		UnloadBlob_Auth(&offset2, b, auth2);
-
-		break;
+		memcpy(*out, &c->base[c->pos], size);
 	}
-	/* 1 TPM_VERSION, 2 UINT32s, 1 optional AUTH */
-	case TPM_ORD_GetCapabilityOwner:
-	{
-		TPM_VERSION *ver1 = va_arg(ap, TPM_VERSION *);
-		UINT32 *data1 = va_arg(ap, UINT32 *);
-		UINT32 *data2 = va_arg(ap, UINT32 *);
-		TPM_AUTH *auth = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!data1 || !data2 || !ver1) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
+	c->pos += size;
 
-		if (auth) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth);
-		}
+	return TSS_SUCCESS;
+}
 
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_VERSION(&offset1, b, ver1);
-		UnloadBlob_UINT32(&offset1, data1, b);
-		UnloadBlob_UINT32(&offset1, data2, b);
-		break;
-	}
-	/* TPM BLOB: 1 UINT32, 1 BLOB, 2 optional AUTHs
-	 * return: UINT32 *, BYTE**, 2 optional AUTHs */
-	case TPM_ORD_Sign:
-	case TPM_ORD_GetTestResult:
-	case TPM_ORD_CertifySelfTest:
-	case TPM_ORD_Unseal:
-	case TPM_ORD_GetRandom:
-	case TPM_ORD_DAA_Join:
-	case TPM_ORD_DAA_Sign:
-	case TPM_ORD_ChangeAuth:
-	case TPM_ORD_GetCapability:
-	case TPM_ORD_LoadMaintenanceArchive:
-	case TPM_ORD_ConvertMigrationBlob:
-	case TPM_ORD_NV_ReadValue:
-	case TPM_ORD_NV_ReadValueAuth:
-	case TPM_ORD_Delegate_Manage:
-	case TPM_ORD_Delegate_CreateKeyDelegation:
-	case TPM_ORD_Delegate_CreateOwnerDelegation:
-	case TPM_ORD_Delegate_UpdateVerification:
-	case TPM_ORD_CMK_ConvertMigration:
-	{
-		UINT32 *data_len = va_arg(ap, UINT32 *);
-		BYTE **data = va_arg(ap, BYTE **);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
+static TSS_RESULT
+pbg_rsp_parse(TPM_COMMAND_CODE ordinal, BYTE *b, UINT32 len, TSS_BOOL view, va_list ap)
+{
+	TSS_RESULT result = TSS_SUCCESS;
+	const struct pbg_layout *l;
+	void *args[2 * PBG_MAX_FIELDS];
+	TPM_AUTH *auths[2];
+	struct blob_cursor c;
+	UINT32 i, n, num_auths = 0, num_digests = 0, size;
+	UINT64 offset, end;
+	BYTE field, kind;
 
-		if (!data || !data_len) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
+	DBG_ASSERT(ordinal);
+	DBG_ASSERT(b);
 
-		if (auth1 && auth2) {
-			offset1 = len - (2 * TSS_TPM_RSP_BLOB_AUTH_LEN);
-			UnloadBlob_Auth(&offset1, b, auth1);
-			UnloadBlob_Auth(&offset1, b, auth2);
-		} else if (auth1) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth1);
-		} else if (auth2) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth2);
-		}
+	if ((l = pbg_layout_find(rsp_layouts, PBG_NUM_LAYOUTS(rsp_layouts), ordinal)) == NULL)
+		return TCSERR(TSS_E_INTERNAL_ERROR);
 
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_UINT32(&offset1, data_len, b);
-		if ((*data = malloc(*data_len)) == NULL) {
-			LogError("malloc of %u bytes failed", *data_len);
-			return TCSERR(TSS_E_OUTOFMEMORY);
+	for (i = 0, n = 0; (field = l->fields[i]) != PBG_RSP_END; i++) {
+		kind = PBG_KIND(field);
+		if (PBG_RSP_IS_BLOB(field)) {
+			args[n++] = va_arg(ap, UINT32 *);
+			args[n++] = va_arg(ap, BYTE **);
+			if (!args[n - 2] || !args[n - 1])
+				goto bad_args;
+			*(UINT32 *)args[n - 2] = 0;
+			*(BYTE **)args[n - 1] = NULL;
+			continue;
+		}
+
+		args[n++] = va_arg(ap, void *);
+		if (args[n - 1] == NULL) {
+			if (kind == PBG_RSP_PUINT32 ||
+			    (kind == PBG_RSP_TDIGEST && !(field & PBG_REQ)))
+				continue;
+			goto bad_args;
+		}
+		if (kind == PBG_RSP_TDIGEST)
+			num_digests++;
+	}
+	for (i = 0; i < l->num_auths; i++) {
+		auths[num_auths] = va_arg(ap, TPM_AUTH *);
+		if (auths[num_auths])
+			num_auths++;
+		else if (l->req_auths & (1 << i))
+			goto bad_args;
+	}
+
+	/* The AUTHs and any digests in front of them are found from the end of the response */
+	end = num_auths * TSS_TPM_RSP_BLOB_AUTH_LEN + num_digests * TPM_DIGEST_SIZE;
+	if (len > TSS_TPM_TXBLOB_SIZE || len < TSS_TPM_TXBLOB_HDR_LEN + end) {
+		LogError("Malformed response to ordinal 0x%x", ordinal);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+	end = len - end;
+
+	offset = len - num_auths * TSS_TPM_RSP_BLOB_AUTH_LEN;
+	for (i = 0; i < num_auths; i++)
+		UnloadBlob_Auth(&offset, b, auths[i]);
+
+	offset = end;
+	for (i = 0, n = 0; (field = l->fields[i]) != PBG_RSP_END; i++) {
+		if (PBG_KIND(field) == PBG_RSP_TDIGEST && args[n]) {
+			memcpy(args[n], &b[offset], TPM_DIGEST_SIZE);
+			offset += TPM_DIGEST_SIZE;
+		}
+		n += PBG_RSP_IS_BLOB(field) ? 2 : 1;
+	}
+
+	blob_cursor_init(&c, b, end, TSS_TPM_TXBLOB_HDR_LEN);
+	for (i = 0, n = 0; (field = l->fields[i]) != PBG_RSP_END && !result; i++) {
+		kind = PBG_KIND(field);
+		size = 0;
+		switch (kind) {
+		case PBG_RSP_UINT32:
+		case PBG_RSP_PUINT32:
+			if (args[n])
+				GetBlob_UINT32(&c, args[n]);
+			break;
+		case PBG_RSP_BOOL:
+			GetBlob_BOOL(&c, args[n]);
+			break;
+		case PBG_RSP_DIGEST:
+			GetBlob(&c, TPM_DIGEST_SIZE, args[n]);
+			break;
+		case PBG_RSP_VERSION:
+		{
+			TPM_VERSION *ver = args[n];
+
+			GetBlob_BYTE(&c, &ver->major);
+			GetBlob_BYTE(&c, &ver->minor);
+			GetBlob_BYTE(&c, &ver->revMajor);
+			GetBlob_BYTE(&c, &ver->revMinor);
+			break;
+		}
+		case PBG_RSP_COUNTER:
+		{
+			TPM_COUNTER_VALUE *ctr = args[n];
+
+			GetBlob_UINT16(&c, &ctr->tag);
+			GetBlob(&c, sizeof(ctr->label), ctr->label);
+			GetBlob_UINT32(&c, &ctr->counter);
+			break;
+		}
+		case PBG_RSP_IGNORE:
+		case PBG_RSP_TDIGEST:
+			break;
+		case PBG_RSP_SZBLOB:
+			GetBlob_UINT32(&c, &size);
+			if (blob_cursor_ok(&c))
+				result = pbg_take_blob(&c, size, args[n + 1], view);
+			*(UINT32 *)args[n] = size;
+			break;
+		case PBG_RSP_REST:
+			size = c.pos < c.cap ? c.cap - c.pos : 0;
+			result = pbg_take_blob(&c, size, args[n + 1], view);
+			*(UINT32 *)args[n] = size;
+			break;
+		default:
+			offset = c.pos;
+			if ((result = pbg_struct_skip(kind, &offset, b)))
+				break;
+			if (offset > c.cap) {
+				result = TCSERR(TSS_E_INTERNAL_ERROR);
+				break;
+			}
+			size = offset - c.pos;
+			result = pbg_take_blob(&c, size, args[n + 1], view);
+			*(UINT32 *)args[n] = size;
+			break;
 		}
-
-		UnloadBlob(&offset1, *data_len, b, *data);
-		break;
+		n += PBG_RSP_IS_BLOB(field) ? 2 : 1;
 	}
-	/* TPM BLOB: 1 UINT32, 1 BLOB, 1 optional AUTH
-	* return: UINT32 *, BYTE**, 1 optional AUTH*/
-	case TPM_ORD_UnBind:
-	{
-		UINT32 *data_len = va_arg(ap, UINT32 *);
-		BYTE **data = va_arg(ap, BYTE **);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!data || !data_len) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
 
-		if (auth1) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth1);
-		} 
+	if (!result && !blob_cursor_ok(&c))
+		result = TCSERR(TSS_E_INTERNAL_ERROR);
 
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_UINT32(&offset1, data_len, b);
-		if ((*data = malloc(*data_len)) == NULL) {
-			LogError("malloc of %u bytes failed", *data_len);
-			return TCSERR(TSS_E_OUTOFMEMORY);
+	if (result) {
+		LogError("Failed to parse the response to ordinal 0x%x", ordinal);
+		/* undo any blobs handed out so far */
+		for (i = 0, n = 0; (field = l->fields[i]) != PBG_RSP_END; i++) {
+			if (PBG_RSP_IS_BLOB(field)) {
+				if (!view)
+					free(*(BYTE **)args[n + 1]);
+				*(BYTE **)args[n + 1] = NULL;
+				*(UINT32 *)args[n] = 0;
+			}
+			n += PBG_RSP_IS_BLOB(field) ? 2 : 1;
 		}
-
-		UnloadBlob(&offset1, *data_len, b, *data);
-		break;
 	}
-	/* TPM BLOB: 1 BLOB, 1 optional AUTH
-	 * return: UINT32 *, BYTE**, 1 optional AUTH*/
-	case TPM_ORD_GetTicks:
-	case TPM_ORD_Seal:
-	case TPM_ORD_Sealx:
-	case TPM_ORD_FieldUpgrade:
-	case TPM_ORD_CreateWrapKey:
-	case TPM_ORD_GetPubKey:
-	case TPM_ORD_OwnerReadPubek:
-	case TPM_ORD_OwnerReadInternalPub:
-	case TPM_ORD_AuthorizeMigrationKey:
-	case TPM_ORD_TakeOwnership:
-	case TPM_ORD_CMK_CreateKey:
-	{
-		UINT32 *data_len = va_arg(ap, UINT32 *);
-		BYTE **data = va_arg(ap, BYTE **);
-		TPM_AUTH *auth = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!data || !data_len) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
 
-		/* remove the auth data from the back end of the data */
-		if (auth) {
-			offset1 = offset2 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth);
-		} else
-			offset2 = len;
-
-		/* everything after the header is returned as the blob */
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		offset2 -= offset1;
-		if ((*data = malloc((size_t)offset2)) == NULL) {
-			LogError("malloc of %zd bytes failed", (size_t)offset2);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
+	return result;
 
-		if ((offset1 + offset2) > TSS_TPM_TXBLOB_SIZE)
-			return TCSERR(TSS_E_INTERNAL_ERROR);
+bad_args:
+	LogError("Internal error for ordinal 0x%x", ordinal);
+	return TCSERR(TSS_E_INTERNAL_ERROR);
+}
 
-		memcpy(*data, &b[offset1], offset2);
-		*data_len = offset2;
-		break;
-	}
-	/* TPM BLOB: BLOB, optional DIGEST */
-	case TPM_ORD_CreateEndorsementKeyPair:
-	case TPM_ORD_ReadPubek:
-	{
-		UINT32 *data_len = va_arg(ap, UINT32 *);
-		BYTE **data = va_arg(ap, BYTE **);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		va_end(ap);
+/*
+ * Parse a TPM response into the caller's variables, per the layout of @ordinal. Blobs are
+ * returned in newly allocated buffers which the caller frees.
+ */
+TSS_RESULT
+tpm_rsp_parse(TPM_COMMAND_CODE ordinal, BYTE *b, UINT32 len, ...)
+{
+	TSS_RESULT result;
+	va_list ap;
 
-		if (!data || !data_len) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
+	va_start(ap, len);
+	result = pbg_rsp_parse(ordinal, b, len, FALSE, ap);
+	va_end(ap);
 
-		if ((offset2 + TPM_DIGEST_SIZE) > TSS_TPM_TXBLOB_SIZE)
-			return TCSERR(TSS_E_INTERNAL_ERROR);
+	return result;
+}
 
-		if (digest1) {
-			offset1 = offset2 = len - TPM_DIGEST_SIZE;
-			memcpy(digest1, &b[offset2], TPM_DIGEST_SIZE);
-		} else
-			offset2 = len;
+/*
+ * Like tpm_rsp_parse(), but the blobs returned point into @b rather than being copied out of
+ * it. They are only good for as long as @b is.
+ */
+TSS_RESULT
+tpm_rsp_parse_view(TPM_COMMAND_CODE ordinal, BYTE *b, UINT32 len, ...)
+{
+	TSS_RESULT result;
+	va_list ap;
 
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		offset2 -= offset1;
-		if ((*data = malloc((size_t)offset2)) == NULL) {
-			LogError("malloc of %zd bytes failed", (size_t)offset2);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
+	va_start(ap, len);
+	result = pbg_rsp_parse(ordinal, b, len, TRUE, ap);
+	va_end(ap);
 
-		UnloadBlob(&offset1, offset2, b, *data);
-		*data_len = offset2;
-		break;
-	}
-#ifdef TSS_BUILD_TSS12
-	/* TPM BLOB: BLOB, DIGEST, DIGEST
-	 * return: UINT32 *, BYTE**, DIGEST, DIGEST */
-	case TPM_ORD_CreateRevocableEK:
-	{
-		UINT32 *data_len = va_arg(ap, UINT32 *);
-		BYTE **data = va_arg(ap, BYTE **);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		BYTE *digest2 = va_arg(ap, BYTE *);
-		va_end(ap);
+	return result;
+}
 
-		if (!data || !data_len || !digest1 || !digest2) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
+TSS_RESULT
+tpm_rqu_build(TPM_COMMAND_CODE ordinal, UINT64 *outOffset, BYTE *out_blob, ...)
+{
+	const struct pbg_layout *l;
+	TPM_COMMAND_CODE hdr_ordinal = ordinal;
+	TPM_AUTH *auths[2];
+	struct blob_cursor c;
+	UINT32 i, num_auths = 0, val, in_len;
+	BYTE field, *ptr;
+	UINT16 tag;
+	va_list ap;
 
-		if (len > TSS_TPM_TXBLOB_SIZE)
-			return TCSERR(TSS_E_INTERNAL_ERROR);
+	DBG_ASSERT(ordinal);
+	DBG_ASSERT(outOffset);
+	DBG_ASSERT(out_blob);
 
-		offset2 = len - TPM_DIGEST_SIZE;
-		memcpy(digest2, &b[offset2], TPM_DIGEST_SIZE);
+	if ((l = pbg_layout_find(rqu_layouts, PBG_NUM_LAYOUTS(rqu_layouts), ordinal)) == NULL)
+		return TCSERR(TSS_E_INTERNAL_ERROR);
 
-		offset2 -= TPM_DIGEST_SIZE;
-		memcpy(digest1, &b[offset2], TPM_DIGEST_SIZE);
-
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		offset2 -= offset1;
-		if ((*data = malloc((size_t)offset2)) == NULL) {
-			LogError("malloc of %zd bytes failed", (size_t)offset2);
-			return TCSERR(TSS_E_OUTOFMEMORY);
-		}
-
-		UnloadBlob(&offset1, offset2, b, *data);
-		*data_len = offset2;
-		break;
-	}
-#endif
-	/* 1 UINT32, 1 optional AUTH */
-	case TPM_ORD_LoadKey:
-	case TPM_ORD_LoadKey2:
-	{
-		UINT32 *handle;
-		TPM_AUTH *auth;
-
-		handle = va_arg(ap, UINT32 *);
-		auth = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!handle) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		if (auth) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth);
-		}
-
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_UINT32(&offset1, handle, b);
-		break;
-	}
-	/* 1 optional UINT32, 1 20 byte value */
-	case TPM_ORD_DirRead:
-	case TPM_ORD_OIAP:
-	case TPM_ORD_LoadManuMaintPub:
-	case TPM_ORD_ReadManuMaintPub:
-	case TPM_ORD_Extend:
-	case TPM_ORD_PcrRead:
-	{
-		UINT32 *handle = va_arg(ap, UINT32 *);
-		BYTE *nonce = va_arg(ap, BYTE *);
-		va_end(ap);
-
-		if (!nonce) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		if (handle)
-			UnloadBlob_UINT32(&offset1, handle, b);
-		UnloadBlob(&offset1, TPM_NONCE_SIZE, b, nonce);
-		break;
-	}
-	/* 1 UINT32, 2 20 byte values */
-	case TPM_ORD_OSAP:
-	case TPM_ORD_DSAP:
-	{
-		UINT32 *handle = va_arg(ap, UINT32 *);
-		BYTE *nonce1 = va_arg(ap, BYTE *);
-		BYTE *nonce2 = va_arg(ap, BYTE *);
-		va_end(ap);
-
-		if (!handle || !nonce1 || !nonce2) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob_UINT32(&offset1, handle, b);
-		UnloadBlob(&offset1, TPM_NONCE_SIZE, b, nonce1);
-		UnloadBlob(&offset1, TPM_NONCE_SIZE, b, nonce2);
-		break;
-	}
-#ifdef TSS_BUILD_CMK
-	/* 1 20 byte value, 1 optional AUTH */
-	case TPM_ORD_CMK_ApproveMA:
-	case TPM_ORD_CMK_CreateTicket:
-	{
-		BYTE *hmac1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!hmac1) {
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			return TCSERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		offset1 = TSS_TPM_TXBLOB_HDR_LEN;
-		UnloadBlob(&offset1, TPM_SHA1_160_HASH_LEN, b, hmac1);
-		if (auth) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth);
-		}
-		break;
-	}
-#endif
-	/* 1 optional AUTH */
-	case TPM_ORD_DisablePubekRead:
-	case TPM_ORD_DirWriteAuth:
-	case TPM_ORD_ReleaseCounter:
-	case TPM_ORD_ReleaseCounterOwner:
-	case TPM_ORD_ChangeAuthOwner:
-	case TPM_ORD_SetCapability:
-	case TPM_ORD_SetOrdinalAuditStatus:
-	case TPM_ORD_ResetLockValue:
-	case TPM_ORD_SetRedirection:
-	case TPM_ORD_DisableOwnerClear:
-	case TPM_ORD_OwnerSetDisable:
-	case TPM_ORD_SetTempDeactivated:
-	case TPM_ORD_KillMaintenanceFeature:
-	case TPM_ORD_NV_DefineSpace:
-	case TPM_ORD_NV_WriteValue:
-	case TPM_ORD_NV_WriteValueAuth:
-	case TPM_ORD_OwnerClear:
-	case TPM_ORD_Delegate_LoadOwnerDelegation:
-	case TPM_ORD_CMK_SetRestrictions:
-	case TPM_ORD_FlushSpecific:
-	case TPM_ORD_KeyControlOwner:
-	{
-		TPM_AUTH *auth = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (auth) {
-			offset1 = len - TSS_TPM_RSP_BLOB_AUTH_LEN;
-			UnloadBlob_Auth(&offset1, b, auth);
-		}
-		break;
-	}
-	default:
-		LogError("Unknown ordinal: 0x%x", ordinal);
-		result = TCSERR(TSS_E_INTERNAL_ERROR);
-		break;
-	}
-
-	return result;
-}
-
-/* XXX optimize these cases by always passing in lengths for blobs, no more "20 byte values" */
-TSS_RESULT
-tpm_rqu_build(TPM_COMMAND_CODE ordinal, UINT64 *outOffset, BYTE *out_blob, ...)
-{
-	TSS_RESULT result = TSS_SUCCESS;
-	UINT64 blob_size;
-	va_list ap;
-
-	DBG_ASSERT(ordinal);
-	DBG_ASSERT(outOffset);
-	DBG_ASSERT(out_blob);
+	blob_cursor_init(&c, out_blob, TSS_TPM_TXBLOB_SIZE, *outOffset + TSS_TPM_TXBLOB_HDR_LEN);
 
 	va_start(ap, out_blob);
-
-	switch (ordinal) {
-#ifdef TSS_BUILD_DELEGATION
-	/* 1 UINT16, 1 UINT32, 1 20 bytes value, 1 UINT32, 1 BLOB */
-	case TPM_ORD_DSAP:
-	{
-		UINT16 val1 = va_arg(ap, int);
-		UINT32 handle1 = va_arg(ap, UINT32);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		va_end(ap);
-
-		if (!digest1 || !in_blob1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT16(outOffset, val1, out_blob);
-		LoadBlob_UINT32(outOffset, handle1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob_UINT32(outOffset, in_len1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-	/* 1 BOOL, 1 UINT32, 1 BLOB, 1 20 byte value, 1 AUTH */
-	case TPM_ORD_Delegate_CreateOwnerDelegation:
-	{
-		TSS_BOOL bool1 = va_arg(ap, int);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!in_len1 || !in_blob1 || !digest1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_BOOL(outOffset, bool1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-	/* 2 UINT32's, 1 BLOB, 1 20 byte value, 1 AUTH */
-	case TPM_ORD_Delegate_CreateKeyDelegation:
-	{
-		UINT32 keyslot1 = va_arg(ap, UINT32);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!keyslot1 || !in_len1 || !in_blob1 || !digest1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keyslot1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#endif
-#ifdef TSS_BUILD_TRANSPORT
-	/* 3 UINT32's, 1 BLOB, 2 AUTHs */
-	case TPM_ORD_ExecuteTransport:
-	{
-		UINT32 ord1 = va_arg(ap, UINT32);
-		UINT32 *keyslot1 = va_arg(ap, UINT32 *);
-		UINT32 *keyslot2 = va_arg(ap, UINT32 *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		if (keyslot1)
-			LoadBlob_UINT32(outOffset, *keyslot1, out_blob);
-		if (keyslot2)
-			LoadBlob_UINT32(outOffset, *keyslot2, out_blob);
-		//LoadBlob_UINT32(outOffset, in_len1, out_blob);
-		if (in_blob1)
-			LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-
-		if (auth1 && auth2) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH2_COMMAND, *outOffset, ord1, out_blob);
-		} else if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ord1, out_blob);
-		} else if (auth2) {
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ord1, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ord1, out_blob);
-		}
-
-		break;
-	}
-#endif
-	/* 1 UINT32, 1 UINT16, 1 BLOB, 1 UINT32, 1 BLOB, 1 options AUTH, 1 AUTH */
-	case TPM_ORD_CreateMigrationBlob:
-	{
-		UINT32 keyslot1 = va_arg(ap, UINT32);
-		UINT16 type1 = va_arg(ap, int);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		UINT32 in_len2 = va_arg(ap, UINT32);
-		BYTE *in_blob2 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!in_blob1 || !in_blob2 || !auth2) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keyslot1, out_blob);
-		LoadBlob_UINT16(outOffset, type1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_UINT32(outOffset, in_len2, out_blob);
-		LoadBlob(outOffset, in_len2, out_blob, in_blob2);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH2_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 1 UINT32, 1 UINT16, 1 20 byte value, 1 UINT16, 1 UINT32, 1 BLOB, 2 AUTHs */
-	case TPM_ORD_ChangeAuth:
-	{
-		UINT32 keyslot1 = va_arg(ap, UINT32);
-		UINT16 proto1 = va_arg(ap, int);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT16 entity1 = va_arg(ap, int);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!digest1 || !in_blob1 || !auth1 || !auth2) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keyslot1, out_blob);
-		LoadBlob_UINT16(outOffset, proto1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob_UINT16(outOffset, entity1, out_blob);
-		LoadBlob_UINT32(outOffset, in_len1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_Auth(outOffset, out_blob, auth1);
-		LoadBlob_Auth(outOffset, out_blob, auth2);
-		LoadBlob_Header(TPM_TAG_RQU_AUTH2_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-	/* 2 DIGEST/ENCAUTH's, 1 UINT32, 1 BLOB, 1 optional AUTH, 1 AUTH */
-	case TPM_ORD_MakeIdentity:
-	{
-		BYTE *dig1, *dig2, *blob1;
-		UINT32 len1;
-		TPM_AUTH *auth1, *auth2;
-
-		dig1 = va_arg(ap, BYTE *);
-		dig2 = va_arg(ap, BYTE *);
-		len1 = va_arg(ap, UINT32);
-		blob1 = va_arg(ap, BYTE *);
-		auth1 = va_arg(ap, TPM_AUTH *);
-		auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!dig1 || !dig2 || !blob1 || !auth2) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, dig1);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, dig2);
-		LoadBlob(outOffset, len1, out_blob, blob1);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH2_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-#if (TSS_BUILD_NV || TSS_BUILD_DELEGATION)
-	/* 3 UINT32's, 1 BLOB, 1 optional AUTH */
-	case TPM_ORD_NV_WriteValue:
-	case TPM_ORD_NV_WriteValueAuth:
-	case TPM_ORD_Delegate_Manage:
-	{
-		UINT32 i = va_arg(ap, UINT32);
-		UINT32 j = va_arg(ap, UINT32);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!in_blob1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, i, out_blob);
-		LoadBlob_UINT32(outOffset, j, out_blob);
-		LoadBlob_UINT32(outOffset, in_len1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-#endif
-	/* 3 UINT32's, 1 optional AUTH */
-	case TPM_ORD_NV_ReadValue:
-	case TPM_ORD_NV_ReadValueAuth:
-	case TPM_ORD_SetRedirection:
-	{
-		UINT32 i = va_arg(ap, UINT32);
-		UINT32 j = va_arg(ap, UINT32);
-		UINT32 k = va_arg(ap, UINT32);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, i, out_blob);
-		LoadBlob_UINT32(outOffset, j, out_blob);
-		LoadBlob_UINT32(outOffset, k, out_blob);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 1 20 byte value, 1 UINT32, 1 BLOB */
-	case TPM_ORD_CreateEndorsementKeyPair:
-	{
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		va_end(ap);
-
-		if (!digest1 || !in_blob1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#ifdef TSS_BUILD_TSS12
-	/* 1 20 byte value, 1 UINT32, 1 BLOB, 1 BOOL, 1 20 byte value */
-	case TPM_ORD_CreateRevocableEK:
-	{
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TSS_BOOL in_bool1 = va_arg(ap, int);
-		BYTE *digest2 = va_arg(ap, BYTE *);
-		va_end(ap);
-
-		if (!digest1 || !in_blob1 || !digest2) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_BOOL(outOffset, in_bool1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest2);
-		LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-	/* 1 20 byte value */
-	case TPM_ORD_RevokeTrust:
-	{
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		va_end(ap);
-
-		if (!digest1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#endif
-#ifdef TSS_BUILD_COUNTER
-	/* 1 20 byte value, 1 UINT32, 1 BLOB, 1 AUTH */
-	case TPM_ORD_CreateCounter:
-	{
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!digest1 || !in_blob1 || !auth1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_Auth(outOffset, out_blob, auth1);
-		LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#endif
-#ifdef TSS_BUILD_DAA
-	/* 1 UINT32, 1 BYTE, 1 UINT32, 1 BLOB, 1 UINT32, 1 BLOB, 1 AUTH */
-	case TPM_ORD_DAA_Sign:
-	case TPM_ORD_DAA_Join:
-	{
-		UINT32 keySlot1 = va_arg(ap, UINT32);
-		BYTE stage1 = va_arg(ap, int);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		UINT32 in_len2 = va_arg(ap, UINT32);
-		BYTE *in_blob2 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!keySlot1 || !in_blob1 || !auth1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keySlot1, out_blob);
-		LoadBlob_BOOL(outOffset, stage1, out_blob);
-		LoadBlob_UINT32(outOffset, in_len1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_UINT32(outOffset, in_len2, out_blob);
-		LoadBlob(outOffset, in_len2, out_blob, in_blob2);
-		LoadBlob_Auth(outOffset, out_blob, auth1);
-		LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#endif
-	/* 2 UINT32's, 1 BLOB, 1 UINT32, 1 BLOB, 1 optional AUTH */
-	case TPM_ORD_ConvertMigrationBlob:
-	case TPM_ORD_SetCapability:
-	{
-		UINT32 keySlot1 = va_arg(ap, UINT32);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		UINT32 in_len2 = va_arg(ap, UINT32);
-		BYTE *in_blob2 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!keySlot1 || !in_blob1 || !in_blob2) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keySlot1, out_blob);
-		LoadBlob_UINT32(outOffset, in_len1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_UINT32(outOffset, in_len2, out_blob);
-		LoadBlob(outOffset, in_len2, out_blob, in_blob2);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 2 UINT32's, 1 20 byte value, 2 optional AUTHs */
-	case TPM_ORD_CertifyKey:
-	{
-		UINT32 keySlot1 = va_arg(ap, UINT32);
-		UINT32 keySlot2 = va_arg(ap, UINT32);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!keySlot1 || !keySlot2 || !digest1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keySlot1, out_blob);
-		LoadBlob_UINT32(outOffset, keySlot2, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		if (auth1 && auth2) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH2_COMMAND, *outOffset, ordinal, out_blob);
-		} else if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else if (auth2) {
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 2 UINT32's, 1 BLOB, 1 optional AUTH */
-	case TPM_ORD_Delegate_LoadOwnerDelegation:
-	case TPM_ORD_GetCapability:
-	case TPM_ORD_UnBind:
-	case TPM_ORD_Sign:
-	{
-		UINT32 keySlot1 = va_arg(ap, UINT32);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (in_len1 && !in_blob1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keySlot1, out_blob);
-		LoadBlob_UINT32(outOffset, in_len1, out_blob);
-		if (in_len1)
-			LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 1 UINT32, 1 20 byte value, 1 UINT32, 1 optional BLOB, 1 UINT32, 1 BLOB, 1 AUTH */
-	case TPM_ORD_Seal:
-	case TPM_ORD_Sealx:
-	{
-		UINT32 keySlot1 = va_arg(ap, UINT32);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		UINT32 in_len2 = va_arg(ap, UINT32);
-		BYTE *in_blob2 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		blob_size = in_len1 + in_len2 + TPM_DIGEST_SIZE + sizeof(TPM_AUTH);
-		if (blob_size > TSS_TPM_TXBLOB_SIZE) {
-			result = TCSERR(TSS_E_BAD_PARAMETER);
-			LogError("Oversized input when building ordinal 0x%x", ordinal);
-			break;
-		}
-				
-		if (!keySlot1 || !in_blob2 || !auth1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keySlot1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob_UINT32(outOffset, in_len1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_UINT32(outOffset, in_len2, out_blob);
-		LoadBlob(outOffset, in_len2, out_blob, in_blob2);
-		LoadBlob_Auth(outOffset, out_blob, auth1);
-		LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-	/* 2 UINT32's, 1 BLOB, 1 optional AUTH, 1 AUTH */
-	case TPM_ORD_ActivateIdentity:
-	{
-		UINT32 keySlot1 = va_arg(ap, UINT32);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!keySlot1 || !in_blob1 || !auth2) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keySlot1, out_blob);
-		LoadBlob_UINT32(outOffset, in_len1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH2_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 1 UINT32, 1 20-byte blob, 1 BLOB, 1 optional AUTH */
-	case TPM_ORD_Quote:
-	{
-		UINT32 keySlot1 = va_arg(ap, UINT32);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!keySlot1 || !digest1 || !in_blob1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keySlot1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#ifdef TSS_BUILD_TSS12
-	/* 1 UINT32, 1 20-byte blob, 1 BLOB, 1 BOOL, 1 optional AUTH */
-	case TPM_ORD_Quote2:
-	{
-		/* Input vars */
-		UINT32 keySlot1 = va_arg(ap, UINT32);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TSS_BOOL* addVersion = va_arg(ap,TSS_BOOL *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!keySlot1 || !digest1 || !in_blob1 || !addVersion) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keySlot1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-
-		/* Load the addVersion Bool */
-		LoadBlob_BOOL(outOffset,*addVersion,out_blob);
-
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#endif
-	/* 1 UINT32, 2 20-byte blobs, 1 BLOB, 1 optional AUTH */
-	case TPM_ORD_CreateWrapKey:
-	{
-		UINT32 keySlot1 = va_arg(ap, UINT32);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		BYTE *digest2 = va_arg(ap, BYTE *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!keySlot1 || !digest1 || !digest2 || !in_blob1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keySlot1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest2);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-	/* 2 BLOBs, 1 optional AUTH */
-	case TPM_ORD_NV_DefineSpace:
-	case TPM_ORD_LoadManuMaintPub:
-	{
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		UINT32 in_len2 = va_arg(ap, UINT32);
-		BYTE *in_blob2 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!in_blob1 || !in_blob2) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob(outOffset, in_len2, out_blob, in_blob2);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-#ifdef TSS_BUILD_TICK
-	/* 1 UINT32, 2 20-byte blobs, 1 optional AUTH */
-	case TPM_ORD_TickStampBlob:
-	{
-		UINT32 keySlot1 = va_arg(ap, UINT32);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		BYTE *digest2 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!keySlot1 || !digest1 || !digest2) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keySlot1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest2);
-
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#endif
-	/* 1 BLOB */
-	case TPM_ORD_ReadManuMaintPub:
-	case TPM_ORD_ReadPubek:
-	case TPM_ORD_PCR_Reset:
-	case TPM_ORD_SetOperatorAuth:
-	{
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		va_end(ap);
-
-		if (!in_blob1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-	/* 1 UINT32, 1 BLOB, 2 optional AUTHs */
-	case TPM_ORD_LoadKey:
-	case TPM_ORD_LoadKey2:
-	case TPM_ORD_DirWriteAuth:
-	case TPM_ORD_CertifySelfTest:
-	case TPM_ORD_Unseal:
-	case TPM_ORD_Extend:
-	case TPM_ORD_StirRandom:
-	case TPM_ORD_LoadMaintenanceArchive: /* XXX */
-	case TPM_ORD_FieldUpgrade:
-	case TPM_ORD_Delegate_UpdateVerification:
-	case TPM_ORD_Delegate_VerifyDelegation:
-	{
-		UINT32 val1 = va_arg(ap, UINT32);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		TPM_AUTH *auth2 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (in_len1 && !in_blob1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, val1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		if (auth1 && auth2) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH2_COMMAND, *outOffset, ordinal, out_blob);
-		} else if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else if (auth2) {
-			LoadBlob_Auth(outOffset, out_blob, auth2);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 1 UINT16, 1 BLOB, 1 AUTH */
-	case TPM_ORD_AuthorizeMigrationKey:
-	{
-		UINT16 scheme1 = va_arg(ap, int);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!in_blob1 || !auth1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT16(outOffset, scheme1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_Auth(outOffset, out_blob, auth1);
-		LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-	/* 1 UINT16, 1 UINT32, 1 BLOB, 1 UINT32, 2 BLOBs, 1 AUTH */
-	case TPM_ORD_TakeOwnership:
-	{
-		UINT16 scheme1 = va_arg(ap, int);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		UINT32 in_len2 = va_arg(ap, UINT32);
-		BYTE *in_blob2 = va_arg(ap, BYTE *);
-		UINT32 in_len3 = va_arg(ap, UINT32);
-		BYTE *in_blob3 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!in_blob1 || !in_blob2 || !in_blob3 || !auth1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT16(outOffset, scheme1, out_blob);
-		LoadBlob_UINT32(outOffset, in_len1, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_UINT32(outOffset, in_len2, out_blob);
-		LoadBlob(outOffset, in_len2, out_blob, in_blob2);
-		LoadBlob(outOffset, in_len3, out_blob, in_blob3);
-		LoadBlob_Auth(outOffset, out_blob, auth1);
-		LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#ifdef TSS_BUILD_AUDIT
-	/* 1 UINT32, 1 BOOL, 1 20 byte value, 1 optional AUTH */
-	case TPM_ORD_GetAuditDigestSigned:
-	{
-		UINT32 keyslot1 = va_arg(ap, UINT32);
-		TSS_BOOL bool1 = va_arg(ap, int);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!digest1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, keyslot1, out_blob);
-		LoadBlob_BOOL(outOffset, bool1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-#endif
-	/* 1 UINT16, 1 UINT32, 1 20 byte value */
-	case TPM_ORD_OSAP:
-	{
-		UINT16 type1 = va_arg(ap, int);
-		UINT32 value1 = va_arg(ap, UINT32);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		va_end(ap);
-
-		if (!digest1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT16(outOffset, type1, out_blob);
-		LoadBlob_UINT32(outOffset, value1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-	/* 1 UINT16, 1 20 byte value, 1 UINT16, 1 AUTH */
-	case TPM_ORD_ChangeAuthOwner:
-	{
-		UINT16 type1 = va_arg(ap, int);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT16 type2 = va_arg(ap, int);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!digest1 || !auth1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT16(outOffset, type1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob_UINT16(outOffset, type2, out_blob);
-		LoadBlob_Auth(outOffset, out_blob, auth1);
-		LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#ifdef TSS_BUILD_AUDIT
-	/* 1 UINT32, 1 BOOL, 1 AUTH */
-	case TPM_ORD_SetOrdinalAuditStatus:
-	{
-		UINT32 ord1 = va_arg(ap, UINT32);
-		TSS_BOOL bool1 = va_arg(ap, int);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!auth1) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, ord1, out_blob);
-		LoadBlob_BOOL(outOffset, bool1, out_blob);
-		LoadBlob_Auth(outOffset, out_blob, auth1);
-		LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#endif
-	/* 1 BOOL, 1 optional AUTH */
-	case TPM_ORD_OwnerSetDisable:
-	case TPM_ORD_PhysicalSetDeactivated:
-	case TPM_ORD_CreateMaintenanceArchive:
-	case TPM_ORD_SetOwnerInstall:
-	{
-		TSS_BOOL bool1 = va_arg(ap, int);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_BOOL(outOffset, bool1, out_blob);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 1 optional AUTH */
-	case TPM_ORD_OwnerClear:
-	case TPM_ORD_DisablePubekRead:
-	case TPM_ORD_GetCapabilityOwner:
-	case TPM_ORD_ResetLockValue:
-	case TPM_ORD_DisableOwnerClear:
-	case TPM_ORD_SetTempDeactivated:
-	case TPM_ORD_OIAP:
-	case TPM_ORD_OwnerReadPubek:
-	case TPM_ORD_SelfTestFull:
-	case TPM_ORD_GetTicks:
-	case TPM_ORD_GetTestResult:
-	case TPM_ORD_KillMaintenanceFeature:
-	case TPM_ORD_Delegate_ReadTable:
-	case TPM_ORD_PhysicalEnable:
-	case TPM_ORD_DisableForceClear:
-	case TPM_ORD_ForceClear:
-	{
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 1 UINT32, 1 optional AUTH */
-	case TPM_ORD_OwnerReadInternalPub:
-	case TPM_ORD_GetPubKey:
-	case TPM_ORD_ReleaseCounterOwner:
-	case TPM_ORD_ReleaseCounter:
-	case TPM_ORD_IncrementCounter:
-	case TPM_ORD_PcrRead:
-	case TPM_ORD_DirRead:
-	case TPM_ORD_ReadCounter:
-	case TPM_ORD_Terminate_Handle:
-	case TPM_ORD_GetAuditDigest:
-	case TPM_ORD_GetRandom:
-	case TPM_ORD_CMK_SetRestrictions:
-	{
-		UINT32 i = va_arg(ap, UINT32);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, i, out_blob);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-#ifdef TSS_BUILD_CMK
-	/* 1 20 byte value, 1 optional AUTH */
-	case TPM_ORD_CMK_ApproveMA:
-	{
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-#endif
-	/* 1 UINT16 only */
-	case TSC_ORD_PhysicalPresence:
-	{
-		UINT16 i = va_arg(ap, int);
-		va_end(ap);
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT16(outOffset, i, out_blob);
-		LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#ifdef TSS_BUILD_CMK
-	/* 1 UINT32, 1 20 byte value, 1 BLOB, 2 20 byte values, 1 optional AUTH */
-	case TPM_ORD_CMK_CreateKey:
-	{
-		UINT32 key1 = va_arg(ap, UINT32);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		BYTE *digest2 = va_arg(ap, BYTE *);
-		BYTE *digest3 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!digest1 || !in_blob1 || !digest2 || !digest3) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, key1, out_blob);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest2);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest3);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 1 BLOB, 1 20 byte value, 1 UINT32, 1 BLOB, 1 optional AUTH */
-	case TPM_ORD_CMK_CreateTicket:
-	{
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len2 = va_arg(ap, UINT32);
-		BYTE *in_blob2 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!digest1 || !in_blob1 || !in_blob2) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob_UINT32(outOffset, in_len2, out_blob);
-		LoadBlob(outOffset, in_len2, out_blob, in_blob2);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 1 UINT32, 1 UINT16, 1 BLOB, 1 20 byte value, 4 x (1 UINT32, 1 BLOB), 1 optional AUTH */
-	case TPM_ORD_CMK_CreateBlob:
-	{
-		UINT32 in_key1 = va_arg(ap, UINT32);
-		UINT16 i = va_arg(ap, int);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len2 = va_arg(ap, UINT32);
-		BYTE *in_blob2 = va_arg(ap, BYTE *);
-		UINT32 in_len3 = va_arg(ap, UINT32);
-		BYTE *in_blob3 = va_arg(ap, BYTE *);
-		UINT32 in_len4 = va_arg(ap, UINT32);
-		BYTE *in_blob4 = va_arg(ap, BYTE *);
-		UINT32 in_len5 = va_arg(ap, UINT32);
-		BYTE *in_blob5 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!digest1 || !in_blob1 || !in_blob2 || !in_blob3 || !in_blob4 || !in_blob5) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, in_key1, out_blob);
-		LoadBlob_UINT16(outOffset, i, out_blob);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob_UINT32(outOffset, in_len2, out_blob);
-		LoadBlob(outOffset, in_len2, out_blob, in_blob2);
-		LoadBlob_UINT32(outOffset, in_len3, out_blob);
-		LoadBlob(outOffset, in_len3, out_blob, in_blob3);
-		LoadBlob_UINT32(outOffset, in_len4, out_blob);
-		LoadBlob(outOffset, in_len4, out_blob, in_blob4);
-		LoadBlob_UINT32(outOffset, in_len5, out_blob);
-		LoadBlob(outOffset, in_len5, out_blob, in_blob5);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-	/* 1 UINT32, 1 60 byte value, 1 20 byte value, 1 BLOB, 2 x (1 UINT32, 1 BLOB),
-	 * 1 optional AUTH */
-	case TPM_ORD_CMK_ConvertMigration:
-	{
-		UINT32 key1 = va_arg(ap, UINT32);
-		BYTE *cmkauth1 = va_arg(ap, BYTE *);
-		BYTE *digest1 = va_arg(ap, BYTE *);
-		UINT32 in_len1 = va_arg(ap, UINT32);
-		BYTE *in_blob1 = va_arg(ap, BYTE *);
-		UINT32 in_len2 = va_arg(ap, UINT32);
-		BYTE *in_blob2 = va_arg(ap, BYTE *);
-		UINT32 in_len3 = va_arg(ap, UINT32);
-		BYTE *in_blob3 = va_arg(ap, BYTE *);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-		va_end(ap);
-
-		if (!cmkauth1 || !digest1 || !in_blob1 || !in_blob2 || !in_blob3) {
-			result = TCSERR(TSS_E_INTERNAL_ERROR);
-			LogError("Internal error for ordinal 0x%x", ordinal);
-			break;
-		}
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, key1, out_blob);
-		LoadBlob(outOffset, 3 * TPM_SHA1_160_HASH_LEN, out_blob, cmkauth1);
-		LoadBlob(outOffset, TPM_SHA1_160_HASH_LEN, out_blob, digest1);
-		LoadBlob(outOffset, in_len1, out_blob, in_blob1);
-		LoadBlob_UINT32(outOffset, in_len2, out_blob);
-		LoadBlob(outOffset, in_len2, out_blob, in_blob2);
-		LoadBlob_UINT32(outOffset, in_len3, out_blob);
-		LoadBlob(outOffset, in_len3, out_blob, in_blob3);
-		if (auth1) {
-			LoadBlob_Auth(outOffset, out_blob, auth1);
-			LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-		} else {
-			LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-		}
-
-		break;
-	}
-#endif
-#ifdef TSS_BUILD_TSS12
-	case TPM_ORD_FlushSpecific:
-	{
-		UINT32 val1 = va_arg(ap, UINT32);
-		UINT32 val2 = va_arg(ap, UINT32);
-		va_end(ap);
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, val1, out_blob);
-		LoadBlob_UINT32(outOffset, val2, out_blob);
-		LoadBlob_Header(TPM_TAG_RQU_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-	/* 1 UINT32, 1 BLOB, 1 UINT32, 1 BOOL, 1 AUTH */
-	case TPM_ORD_KeyControlOwner:
-	{
-		UINT32 i = va_arg(ap, UINT32);
-		UINT32 len1 = va_arg(ap, UINT32);
-		BYTE *blob1 = va_arg(ap, BYTE *);
-		UINT32 j = va_arg(ap, UINT32);
-		TSS_BOOL bool1 = va_arg(ap, int);
-		TPM_AUTH *auth1 = va_arg(ap, TPM_AUTH *);
-	        va_end(ap);
-
-		*outOffset += TSS_TPM_TXBLOB_HDR_LEN;
-		LoadBlob_UINT32(outOffset, i, out_blob);
-		LoadBlob(outOffset, len1, out_blob, blob1);
-		LoadBlob_UINT32(outOffset, j, out_blob);
-		LoadBlob_BOOL(outOffset, bool1, out_blob);
-		LoadBlob_Auth(outOffset, out_blob, auth1);
-		LoadBlob_Header(TPM_TAG_RQU_AUTH1_COMMAND, *outOffset, ordinal, out_blob);
-
-		break;
-	}
-#endif
-	default:
-		LogError("Unknown ordinal: 0x%x", ordinal);
-		break;
-	}
-
-	return result;
+	for (i = 0; (field = l->fields[i]) != PBG_RQU_END; i++) {
+		switch (PBG_KIND(field)) {
+		case PBG_RQU_UINT16:
+			val = (UINT16)va_arg(ap, int);
+			if ((field & PBG_REQ) && !val)
+				goto bad_args;
+			PutBlob_UINT16(&c, val);
+			break;
+		case PBG_RQU_UINT32:
+		case PBG_RQU_HANDLE:
+			val = va_arg(ap, UINT32);
+			if ((field & PBG_REQ) && !val)
+				goto bad_args;
+			PutBlob_UINT32(&c, val);
+			break;
+		case PBG_RQU_BOOL:
+			PutBlob_BOOL(&c, (TSS_BOOL)va_arg(ap, int));
+			break;
+		case PBG_RQU_PBOOL:
+		{
+			TSS_BOOL *b = va_arg(ap, TSS_BOOL *);
+
+			if (!b)
+				goto bad_args;
+			PutBlob_BOOL(&c, *b);
+			break;
+		}
+		case PBG_RQU_PHANDLE:
+		{
+			UINT32 *h = va_arg(ap, UINT32 *);
+
+			if (h)
+				PutBlob_UINT32(&c, *h);
+			break;
+		}
+		case PBG_RQU_DIGEST:
+		case PBG_RQU_DIGEST3:
+			if ((ptr = va_arg(ap, BYTE *)) == NULL)
+				goto bad_args;
+			PutBlob(&c, PBG_KIND(field) == PBG_RQU_DIGEST ? TPM_SHA1_160_HASH_LEN :
+				3 * TPM_SHA1_160_HASH_LEN, ptr);
+			break;
+		case PBG_RQU_BLOB:
+		case PBG_RQU_SZBLOB:
+			in_len = va_arg(ap, UINT32);
+			ptr = va_arg(ap, BYTE *);
+			if (!ptr && ((field & PBG_REQ) ||
+				     (in_len && PBG_KIND(field) == PBG_RQU_SZBLOB)))
+				goto bad_args;
+			if (PBG_KIND(field) == PBG_RQU_SZBLOB)
+				PutBlob_UINT32(&c, in_len);
+			if (ptr)
+				PutBlob(&c, in_len, ptr);
+			break;
+		case PBG_RQU_ORDINAL:
+			hdr_ordinal = va_arg(ap, UINT32);
+			break;
+		default:
+			goto bad_args;
+		}
+	}
+	for (i = 0; i < l->num_auths; i++) {
+		auths[num_auths] = va_arg(ap, TPM_AUTH *);
+		if (auths[num_auths])
+			num_auths++;
+		else if (l->req_auths & (1 << i))
+			goto bad_args;
+	}
+	va_end(ap);
+
+	for (i = 0; i < num_auths; i++)
+		PutBlob_Auth(&c, auths[i]);
+
+	if (!blob_cursor_ok(&c)) {
+		LogError("Oversized input when building ordinal 0x%x", ordinal);
+		return TCSERR(TSS_E_BAD_PARAMETER);
+	}
+
+	if (num_auths == 2)
+		tag = TPM_TAG_RQU_AUTH2_COMMAND;
+	else if (num_auths == 1)
+		tag = TPM_TAG_RQU_AUTH1_COMMAND;
+	else
+		tag = TPM_TAG_RQU_COMMAND;
+
+	*outOffset = c.pos;
+	LoadBlob_Header(tag, c.pos, hdr_ordinal, out_blob);
+
+	return TSS_SUCCESS;
+
+bad_args:
+	va_end(ap);
+	LogError("Internal error for ordinal 0x%x", ordinal);
+	return TCSERR(TSS_E_INTERNAL_ERROR);
 }
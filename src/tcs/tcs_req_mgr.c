@@ -24,28 +24,26 @@
 #include "req_mgr.h"
 #include "tcslog.h"
 
-static struct tpm_req_mgr *trm;
-
 #ifdef TSS_DEBUG
 #define TSS_TPM_DEBUG
 #endif
 
-TSS_RESULT
-req_mgr_submit_req(BYTE *blob)
+/* send @blob to @d's TPM and put the response in its place. Its queue_lock must be held */
+static TSS_RESULT
+req_mgr_transmit(struct tcs_device *d, BYTE *blob)
 {
 	TSS_RESULT result;
 	BYTE loc_buf[TSS_TPM_TXBLOB_SIZE];
 	UINT32 size = TSS_TPM_TXBLOB_SIZE;
 	UINT32 retry = TSS_REQ_MGR_MAX_RETRIES;
 
-	MUTEX_LOCK(trm->queue_lock);
-
 #ifdef TSS_TPM_DEBUG
 	LogBlobData("To TPM:", Decode_UINT32(&blob[2]), blob);
 #endif
 
 	do {
-		result = Tddli_TransmitData(blob, Decode_UINT32(&blob[2]), loc_buf, &size);
+		result = Tddli_TransmitDataDevice(d->index, blob, Decode_UINT32(&blob[2]), loc_buf,
+						  &size);
 	} while (!result && (Decode_UINT32(&loc_buf[6]) == TCPA_E_RETRY) && --retry);
 
 	if (!result)
@@ -55,29 +53,120 @@ req_mgr_submit_req(BYTE *blob)
 	LogBlobData("From TPM:", size, loc_buf);
 #endif
 
+	return result;
+}
+
+/* Each TPM has a queue of its own, so requests for different TPMs don't wait for each other */
+TSS_RESULT
+req_mgr_submit_req(BYTE *blob)
+{
+	struct tcs_device *d = tcs_device_current();
+	struct tpm_req_mgr *trm = &d->req_mgr;
+	TSS_RESULT result;
+
+	MUTEX_LOCK(trm->pending_lock);
+	trm->pending++;
+	MUTEX_UNLOCK(trm->pending_lock);
+
+	MUTEX_LOCK(trm->queue_lock);
+	result = req_mgr_transmit(d, blob);
+	MUTEX_UNLOCK(trm->queue_lock);
+
+	MUTEX_LOCK(trm->pending_lock);
+	trm->pending--;
+	MUTEX_UNLOCK(trm->pending_lock);
+
+	return result;
+}
+
+/*
+ * Submit a background request, but only if the TPM has nothing else to do and nobody holds an
+ * exclusive transport session on it, which the command would end. Background work is the lowest
+ * priority this way: it never makes a request from an application wait behind more than the one
+ * command it may have just sent. The check is made holding the queue lock, so
+ * an exclusive session can't be established between it and the command: EstablishTransport has
+ * to wait for the lock like any other command. *@sent is set FALSE if the request wasn't sent.
+ */
+TSS_RESULT
+req_mgr_submit_idle_req(BYTE *blob, TSS_BOOL *sent)
+{
+	struct tcs_device *d = tcs_device_current();
+	struct tpm_req_mgr *trm = &d->req_mgr;
+	TSS_RESULT result;
+
+	*sent = FALSE;
+
+	MUTEX_LOCK(trm->queue_lock);
+
+	if (ctx_has_exclusive_transport(d->index)) {
+		MUTEX_UNLOCK(trm->queue_lock);
+		return TSS_SUCCESS;
+	}
+
+	MUTEX_LOCK(trm->pending_lock);
+	if (trm->pending) {
+		MUTEX_UNLOCK(trm->pending_lock);
+		MUTEX_UNLOCK(trm->queue_lock);
+		return TSS_SUCCESS;
+	}
+	trm->pending++;
+	MUTEX_UNLOCK(trm->pending_lock);
+
+	result = req_mgr_transmit(d, blob);
+	*sent = TRUE;
+
 	MUTEX_UNLOCK(trm->queue_lock);
 
+	MUTEX_LOCK(trm->pending_lock);
+	trm->pending--;
+	MUTEX_UNLOCK(trm->pending_lock);
+
 	return result;
 }
 
+/* open every TPM the tcsd serves. tcs_devices_init() must have been called */
 TSS_RESULT
 req_mgr_init()
 {
-	if ((trm = calloc(1, sizeof(struct tpm_req_mgr))) == NULL) {
-		LogError("malloc of %zd bytes failed.", sizeof(struct tpm_req_mgr));
-		return TSS_E_OUTOFMEMORY;
+	struct tcs_device *d;
+	TSS_RESULT result = TSS_SUCCESS;
+	UINT32 i;
+
+	_tcsd_options = &tcsd_options;
+
+	for (i = 0; i < tcs_device_count(); i++) {
+		if ((result = tcs_device_select(i)))
+			break;
+		d = tcs_device_current();
+
+		MUTEX_INIT(d->req_mgr.queue_lock);
+		MUTEX_INIT(d->req_mgr.pending_lock);
+
+		if ((result = Tddli_OpenDevice(i))) {
+			LogError("Opening TPM device %u failed", i);
+			break;
+		}
 	}
+	(void)tcs_device_select(0);
 
-	MUTEX_INIT(trm->queue_lock);
+	if (result) {
+		while (i--)
+			(void)Tddli_CloseDevice(i);
+	}
 
-	return Tddli_Open();
+	return result;
 }
 
 TSS_RESULT
 req_mgr_final()
 {
-	free(trm);
+	TSS_RESULT result = TSS_SUCCESS, rc;
+	UINT32 i;
 
-	return Tddli_Close();
-}
+	for (i = 0; i < tcs_device_count(); i++) {
+		if ((rc = Tddli_CloseDevice(i)))
+			result = rc;
+	}
 
+	return result;
+}
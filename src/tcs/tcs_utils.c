@@ -120,106 +120,129 @@ Decode_UINT64(BYTE *y)
 	return x;
 }
 
+/*
+ * The fixed width fields have never been bounded here; callers such as the event log code
+ * walk buffers larger than a TPM command. Only the byte copies below keep the
+ * TSS_TPM_TXBLOB_SIZE limit.
+ */
 void
 LoadBlob_UINT64(UINT64 *offset, UINT64 in, BYTE * blob)
 {
-	if (blob)
-		UINT64ToArray(in, &blob[*offset]);
-	*offset += sizeof(UINT64);
+	struct blob_cursor c;
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, *offset);
+	PutBlob_UINT64(&c, in);
+	*offset = c.pos;
 }
 
 void
 LoadBlob_UINT32(UINT64 *offset, UINT32 in, BYTE * blob)
 {
-	if (blob)
-		UINT32ToArray(in, &blob[*offset]);
-	*offset += sizeof(UINT32);
+	struct blob_cursor c;
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, *offset);
+	PutBlob_UINT32(&c, in);
+	*offset = c.pos;
 }
 
 void
 LoadBlob_UINT16(UINT64 *offset, UINT16 in, BYTE * blob)
 {
-	if (blob)
-		UINT16ToArray(in, &blob[*offset]);
-	*offset += sizeof(UINT16);
+	struct blob_cursor c;
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, *offset);
+	PutBlob_UINT16(&c, in);
+	*offset = c.pos;
 }
 
 void
 UnloadBlob_UINT64(UINT64 *offset, UINT64 * out, BYTE * blob)
 {
-	if (out)
-		*out = Decode_UINT64(&blob[*offset]);
-	*offset += sizeof(UINT64);
+	struct blob_cursor c;
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, *offset);
+	GetBlob_UINT64(&c, out);
+	*offset = c.pos;
 }
 
 void
 UnloadBlob_UINT32(UINT64 *offset, UINT32 * out, BYTE * blob)
 {
-	if (out)
-		*out = Decode_UINT32(&blob[*offset]);
-	*offset += sizeof(UINT32);
+	struct blob_cursor c;
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, *offset);
+	GetBlob_UINT32(&c, out);
+	*offset = c.pos;
 }
 
 void
 UnloadBlob_UINT16(UINT64 *offset, UINT16 * out, BYTE * blob)
 {
-	if (out)
-		*out = Decode_UINT16(&blob[*offset]);
-	*offset += sizeof(UINT16);
+	struct blob_cursor c;
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, *offset);
+	GetBlob_UINT16(&c, out);
+	*offset = c.pos;
 }
 
 void
 LoadBlob_BYTE(UINT64 *offset, BYTE data, BYTE * blob)
 {
-	if (blob)
-		blob[*offset] = data;
-	(*offset)++;
+	struct blob_cursor c;
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, *offset);
+	PutBlob_BYTE(&c, data);
+	*offset = c.pos;
 }
 
 void
 UnloadBlob_BYTE(UINT64 *offset, BYTE * dataOut, BYTE * blob)
 {
-	if (dataOut)
-		*dataOut = blob[*offset];
-	(*offset)++;
+	struct blob_cursor c;
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, *offset);
+	GetBlob_BYTE(&c, dataOut);
+	*offset = c.pos;
 }
 
 void
 LoadBlob_BOOL(UINT64 *offset, TSS_BOOL data, BYTE * blob)
 {
-	if (blob)
-		blob[*offset] = data;
-	(*offset)++;
+	struct blob_cursor c;
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, *offset);
+	PutBlob_BOOL(&c, data);
+	*offset = c.pos;
 }
 
 void
 UnloadBlob_BOOL(UINT64 *offset, TSS_BOOL *dataOut, BYTE * blob)
 {
-	if (dataOut)
-		*dataOut = blob[*offset];
-	(*offset)++;
+	struct blob_cursor c;
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, *offset);
+	GetBlob_BOOL(&c, dataOut);
+	*offset = c.pos;
 }
 
 void
 LoadBlob(UINT64 *offset, UINT32 size, BYTE *container, BYTE *object)
 {
-	if ((size == 0) || ((*offset + size) > TSS_TPM_TXBLOB_SIZE))
-		return;
+	struct blob_cursor c;
 
-	if (container)
-		memcpy(&container[*offset], object, size);
-	(*offset) += (UINT64) size;
+	blob_cursor_init_offset(&c, offset, container);
+	PutBlob(&c, size, object);
+	*offset = c.pos;
 }
 
 void
 UnloadBlob(UINT64 *offset, UINT32 size, BYTE *container, BYTE *object)
 {
-	if ((size == 0) || ((*offset + size) > TSS_TPM_TXBLOB_SIZE))
-		return;
+	struct blob_cursor c;
 
-	if (object)
-		memcpy(object, &container[*offset], size);
-	(*offset) += (UINT64) size;
+	blob_cursor_init_offset(&c, offset, container);
+	GetBlob(&c, size, object);
+	*offset = c.pos;
 }
 
 void
@@ -269,28 +292,48 @@ UnloadBlob_Header(BYTE * blob, UINT32 * size)
 #endif
 
 void
-LoadBlob_Auth(UINT64 *offset, BYTE * blob, TPM_AUTH * auth)
+PutBlob_Auth(struct blob_cursor *c, TPM_AUTH *auth)
 {
-	LoadBlob_UINT32(offset, auth->AuthHandle, blob);
-	LoadBlob(offset, TCPA_NONCE_SIZE, blob, auth->NonceOdd.nonce);
-	LoadBlob_BOOL(offset, auth->fContinueAuthSession, blob);
-	LoadBlob(offset, TCPA_AUTHDATA_SIZE, blob, (BYTE *)&auth->HMAC);
+	PutBlob_UINT32(c, auth->AuthHandle);
+	PutBlob(c, TCPA_NONCE_SIZE, auth->NonceOdd.nonce);
+	PutBlob_BOOL(c, auth->fContinueAuthSession);
+	PutBlob(c, TCPA_AUTHDATA_SIZE, (BYTE *)&auth->HMAC);
 }
 
 void
-UnloadBlob_Auth(UINT64 *offset, BYTE * blob, TPM_AUTH * auth)
+GetBlob_Auth(struct blob_cursor *c, TPM_AUTH *auth)
 {
 	if (!auth) {
-		UnloadBlob(offset, TCPA_NONCE_SIZE, blob, NULL);
-		UnloadBlob_BOOL(offset, NULL, blob);
-		UnloadBlob(offset, TCPA_DIGEST_SIZE, blob, NULL);
+		GetBlob(c, TCPA_NONCE_SIZE, NULL);
+		GetBlob_BOOL(c, NULL);
+		GetBlob(c, TCPA_DIGEST_SIZE, NULL);
 
 		return;
 	}
 
-	UnloadBlob(offset, TCPA_NONCE_SIZE, blob, auth->NonceEven.nonce);
-	UnloadBlob_BOOL(offset, &auth->fContinueAuthSession, blob);
-	UnloadBlob(offset, TCPA_DIGEST_SIZE, blob, (BYTE *)&auth->HMAC);
+	GetBlob(c, TCPA_NONCE_SIZE, auth->NonceEven.nonce);
+	GetBlob_BOOL(c, &auth->fContinueAuthSession);
+	GetBlob(c, TCPA_DIGEST_SIZE, (BYTE *)&auth->HMAC);
+}
+
+void
+LoadBlob_Auth(UINT64 *offset, BYTE * blob, TPM_AUTH * auth)
+{
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_Auth(&c, auth);
+	*offset = c.pos;
+}
+
+void
+UnloadBlob_Auth(UINT64 *offset, BYTE * blob, TPM_AUTH * auth)
+{
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	GetBlob_Auth(&c, auth);
+	*offset = c.pos;
 }
 
 void
@@ -307,13 +350,23 @@ UnloadBlob_VERSION(UINT64 *offset, BYTE *blob, TPM_VERSION *out)
 	UnloadBlob_BYTE(offset, &out->revMinor, blob);
 }
 
+void
+PutBlob_VERSION(struct blob_cursor *c, TPM_VERSION *ver)
+{
+	PutBlob_BYTE(c, ver->major);
+	PutBlob_BYTE(c, ver->minor);
+	PutBlob_BYTE(c, ver->revMajor);
+	PutBlob_BYTE(c, ver->revMinor);
+}
+
 void
 LoadBlob_VERSION(UINT64 *offset, BYTE *blob, TPM_VERSION *ver)
 {
-	LoadBlob_BYTE(offset, ver->major, blob);
-	LoadBlob_BYTE(offset, ver->minor, blob);
-	LoadBlob_BYTE(offset, ver->revMajor, blob);
-	LoadBlob_BYTE(offset, ver->revMinor, blob);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_VERSION(&c, ver);
+	*offset = c.pos;
 }
 
 void
@@ -471,7 +524,7 @@ UnloadBlob_KEY_HANDLE_LIST(UINT64 *offset, BYTE *blob, TCPA_KEY_HANDLE_LIST *lis
 	UINT16 i;
 
 	if (!list) {
-		UINT16 size;
+		UINT16 size = 0;
 
 		UnloadBlob_UINT16(offset, &size, blob);
 
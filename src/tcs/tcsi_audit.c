@@ -88,9 +88,9 @@ TCSP_GetAuditDigest_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 
 	result = UnloadBlob_Header(txBlob, &paramSize);
 	if (!result) {
-		if ((result = tpm_rsp_parse(TPM_ORD_GetAuditDigest, txBlob, paramSize, auditDigest,
-					    counterValueSize, counterValue, more, ordSize,
-					    ordList)))
+		if ((result = tpm_rsp_parse(TPM_ORD_GetAuditDigest, txBlob, paramSize,
+					    counterValueSize, counterValue, auditDigest, more,
+					    ordSize, ordList)))
 			goto done;
 
 		/* ordSize is returned from the TPM as the number of bytes in ordList
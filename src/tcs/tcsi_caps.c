@@ -25,8 +25,6 @@
 #include "tcsd_wrap.h"
 #include "tcsd.h"
 
-extern struct tcsd_config tcsd_options;
-
 TSS_RESULT
 internal_TCSGetCap(TCS_CONTEXT_HANDLE hContext,
 		   TCPA_CAPABILITY_AREA capArea,
@@ -26,6 +26,22 @@
 #include "tcsem.h"
 
 
+/* The event log is the first TPM's, the one the firmware and the kernel measure into. Contexts
+ * of the other TPMs the tcsd serves have none */
+static TSS_RESULT
+evlog_verify_context(TCS_CONTEXT_HANDLE hContext)
+{
+	TSS_RESULT result;
+
+	if ((result = ctx_verify_context(hContext)))
+		return result;
+
+	if (tcs_device_current()->index != 0)
+		return TCSERR(TSS_E_NOTIMPL);
+
+	return TSS_SUCCESS;
+}
+
 TSS_RESULT
 TCS_LogPcrEvent_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 			 TSS_PCR_EVENT Event,		/* in */
@@ -33,7 +49,7 @@ TCS_LogPcrEvent_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 {
 	TSS_RESULT result;
 
-	if((result = ctx_verify_context(hContext)))
+	if ((result = evlog_verify_context(hContext)))
 		return result;
 
 	if(Event.ulPcrIndex >= tpm_metrics.num_pcrs)
@@ -125,7 +141,7 @@ TCS_GetPcrEvent_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 	TSS_RESULT result;
 	TSS_PCR_EVENT *event;
 
-	if ((result = ctx_verify_context(hContext)))
+	if ((result = evlog_verify_context(hContext)))
 		return result;
 
 	if(PcrIndex >= tpm_metrics.num_pcrs)
@@ -154,16 +170,18 @@ TCS_GetPcrEvent_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 			return TCSERR(TSS_E_OUTOFMEMORY);
 		}
 
+		MUTEX_LOCK(tcs_event_log->lock);
+
 		event = get_pcr_event(PcrIndex, *pNumber);
 		if (event == NULL) {
+			MUTEX_UNLOCK(tcs_event_log->lock);
 			free(*ppEvent);
 			return TCSERR(TSS_E_BAD_PARAMETER);
 		}
 
-		if ((result = copy_pcr_event(*ppEvent, event))) {
-			free(*ppEvent);
-			return result;
-		}
+		copy_pcr_event(*ppEvent, event);
+
+		MUTEX_UNLOCK(tcs_event_log->lock);
 	}
 
 	return TSS_SUCCESS;
@@ -238,11 +256,10 @@ TCS_GetPcrEventsByPcr_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 				UINT32 *pEventCount,		/* in, out */
 				TSS_PCR_EVENT **ppEvents)	/* out */
 {
-	UINT32 lastEventNumber, i, eventIndex;
+	UINT32 lastEventNumber;
 	TSS_RESULT result;
-	struct event_wrapper *tmp;
 
-	if ((result = ctx_verify_context(hContext)))
+	if ((result = evlog_verify_context(hContext)))
 		return result;
 
 	if (PcrIndex >= tpm_metrics.num_pcrs)
@@ -273,7 +290,7 @@ TCS_GetPcrEventsByPcr_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 	if (FirstEvent > lastEventNumber)
 		return TCSERR(TSS_E_BAD_PARAMETER);
 
-	if (lastEventNumber == 0) {
+	if (lastEventNumber == FirstEvent) {
 		*pEventCount = 0;
 		*ppEvents = NULL;
 		return TSS_SUCCESS;
@@ -289,24 +306,14 @@ TCS_GetPcrEventsByPcr_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 		return TCSERR(TSS_E_OUTOFMEMORY);
 	}
 
+	/* copy events from the first requested to the last requested */
 	MUTEX_LOCK(tcs_event_log->lock);
 
-	tmp = tcs_event_log->lists[PcrIndex];
-
-	/* move through the list until we get to the first event requested */
-	for (i = 0; i < FirstEvent; i++)
-		tmp = tmp->next;
-
-	/* copy events from the first requested to the last requested */
-	for (eventIndex = 0; i < lastEventNumber; eventIndex++, i++) {
-		copy_pcr_event(&((*ppEvents)[eventIndex]), &(tmp->event));
-		tmp = tmp->next;
-	}
+	*pEventCount = copy_pcr_events(*ppEvents, PcrIndex, FirstEvent,
+				       lastEventNumber - FirstEvent);
 
 	MUTEX_UNLOCK(tcs_event_log->lock);
 
-	*pEventCount = eventIndex;
-
 	return TSS_SUCCESS;
 }
 
@@ -316,73 +323,292 @@ TCS_GetPcrEventLog_Internal(TCS_CONTEXT_HANDLE hContext,/* in  */
 			    TSS_PCR_EVENT **ppEvents)	/* out */
 {
 	TSS_RESULT result;
-	UINT32 i, j, event_count, aggregate_count = 0;
-	struct event_wrapper *tmp;
-	TSS_PCR_EVENT *event_list = NULL, *aggregate_list = NULL;
+	UINT32 i, event_count, aggregate_count = 0;
+	TSS_PCR_EVENT *event_list = NULL, *aggregate_list = NULL, *tmp;
+	TSS_BOOL external;
 
-	if ((result = ctx_verify_context(hContext)))
+	if ((result = evlog_verify_context(hContext)))
 		return result;
 
 	MUTEX_LOCK(tcs_event_log->lock);
 
 	/* for each PCR index, if its externally controlled, get the total number of events
-	 * externally, else copy the events from the TCSD list. Then tack that list onto a
+	 * externally, else use the events in the TCSD list. Then tack that list onto a
 	 * master list to returned. */
 	for (i = 0; i < tpm_metrics.num_pcrs; i++) {
-		if ((tcsd_options.kernel_pcrs & (1 << i)) ||
-		    (tcsd_options.firmware_pcrs & (1 << i))) {
+		external = (tcsd_options.kernel_pcrs & (1 << i)) ||
+			   (tcsd_options.firmware_pcrs & (1 << i));
+		if (external) {
 			/* A kernel or firmware controlled PCR event list */
 			event_count = UINT_MAX;
 			if ((result = TCS_GetExternalPcrEventsByPcr(i, 0, &event_count,
 								    &event_list))) {
 				LogDebug("Getting External event list for PCR %u failed", i);
-				free(aggregate_list);
 				goto error;
 			}
 			LogDebug("Retrieved %u events from PCR %u (external)", event_count, i);
 		} else {
-			/* A TCSD controlled PCR event list */
+			/* A TCSD controlled PCR event list, copied straight out of the log */
 			event_count = get_num_events(i);
-
-			if (event_count == 0)
-				continue;
-
-			if ((event_list = calloc(event_count, sizeof(TSS_PCR_EVENT))) == NULL) {
-				LogError("malloc of %zd bytes failed",
-					 event_count * sizeof(TSS_PCR_EVENT));
-				result = TCSERR(TSS_E_OUTOFMEMORY);
-				free(aggregate_list);
-				goto error;
-			}
-
-			tmp = tcs_event_log->lists[i];
-			for (j = 0; j < event_count; j++) {
-				copy_pcr_event(&event_list[j], &(tmp->event));
-				tmp = tmp->next;
-			}
+			event_list = tcs_event_log->lists[i].events;
 		}
 
 		if (event_count == 0)
 			continue;
 
 		/* Tack the list onto the aggregate_list */
-		aggregate_list = concat_pcr_events(&aggregate_list, aggregate_count, event_list,
-						   event_count);
-		if (aggregate_list == NULL) {
-			free(event_list);
+		tmp = concat_pcr_events(&aggregate_list, aggregate_count, event_list, event_count);
+		if (tmp == NULL) {
+			if (external)
+				free_external_events(event_count, event_list);
 			result = TCSERR(TSS_E_OUTOFMEMORY);
-			goto error;
 		}
+		if (external)
+			free(event_list);
+		if (result)
+			goto error;
+		aggregate_list = tmp;
 		aggregate_count += event_count;
-		free(event_list);
 	}
 
+	MUTEX_UNLOCK(tcs_event_log->lock);
+
 	*ppEvents = aggregate_list;
 	*pEventCount = aggregate_count;
-	result = TSS_SUCCESS;
+
+	return TSS_SUCCESS;
 error:
 	MUTEX_UNLOCK(tcs_event_log->lock);
 
+	free_external_events(aggregate_count, aggregate_list);
+	free(aggregate_list);
+
+	return result;
+}
+
+
+/* A page of events being built by TCS_GetPcrEventLogPage_Internal */
+struct evlog_page {
+	TSS_PCR_EVENT *events;
+	UINT32 num;
+	UINT32 size;
+	UINT32 bytes_left;
+};
+
+/* Returns TRUE if @event was added. The first event always goes in, even if it alone is over
+ * the size limit, so that the caller can always make progress through the log. */
+static TSS_BOOL
+evlog_page_add(struct evlog_page *page, TSS_PCR_EVENT *event, TSS_RESULT *result)
+{
+	TSS_PCR_EVENT *events;
+	UINT32 event_size = get_pcr_event_size(event), size;
+
+	*result = TSS_SUCCESS;
+
+	if (page->num && event_size > page->bytes_left)
+		return FALSE;
+
+	if (page->num == page->size) {
+		size = page->size ? page->size * 2 : 32;
+		if ((events = realloc(page->events, size * sizeof(TSS_PCR_EVENT))) == NULL) {
+			LogError("malloc of %zd bytes failed", size * sizeof(TSS_PCR_EVENT));
+			*result = TCSERR(TSS_E_OUTOFMEMORY);
+			return FALSE;
+		}
+		page->events = events;
+		page->size = size;
+	}
+
+	copy_pcr_event(&page->events[page->num++], event);
+	page->bytes_left -= MIN(event_size, page->bytes_left);
+
+	return TRUE;
+}
+
+/* Fill @page with the events of an externally controlled PCR, starting at *pSequence. On
+ * return, *pSequence is the first event that didn't fit. The lock should be held. */
+static TSS_RESULT
+evlog_page_fill_external(struct evlog_page *page, UINT32 PcrIndex, UINT32 *pSequence,
+			 TSS_BOOL *full)
+{
+	TSS_PCR_EVENT *events = NULL;
+	UINT32 count, requested, i;
+	TSS_RESULT result;
+
+	/* every event costs at least sizeof(TSS_PCR_EVENT), so there's no point asking for more
+	 * than could possibly fit */
+	requested = count = page->bytes_left / sizeof(TSS_PCR_EVENT) + 1;
+
+	if ((result = TCS_GetExternalPcrEventsByPcr(PcrIndex, *pSequence, &count, &events)))
+		return result;
+
+	for (i = 0; i < count; i++) {
+		if (!evlog_page_add(page, &events[i], &result))
+			break;
+	}
+
+	if (i < count) {
+		/* the events that were copied into the page are owned by it now */
+		free_external_events(count - i, &events[i]);
+		*full = TRUE;
+	} else if (count == requested) {
+		/* there may be more events for this PCR, pick them up next time */
+		*full = TRUE;
+	}
+
+	*pSequence += i;
+	free(events);
+
 	return result;
 }
 
+/* Return the events following the cursor (*pPcrIndex, *pSequence), in PCR order, until about
+ * ulMaxSize bytes have been collected. The cursor is advanced past the returned events, and
+ * *pPcrIndex is set to the number of PCRs once the whole log has been read. */
+TSS_RESULT
+TCS_GetPcrEventLogPage_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
+				UINT32 *pPcrIndex,		/* in, out */
+				UINT32 *pSequence,		/* in, out */
+				UINT32 ulMaxSize,		/* in */
+				UINT32 *pEventCount,		/* out */
+				TSS_PCR_EVENT **ppEvents)	/* out */
+{
+	struct evlog_page page;
+	struct event_list *list;
+	TSS_BOOL full = FALSE;
+	UINT32 pcr = *pPcrIndex, seq = *pSequence;
+	TSS_RESULT result = TSS_SUCCESS;
+
+	if ((result = evlog_verify_context(hContext)))
+		return result;
+
+	if (pcr > tpm_metrics.num_pcrs)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	memset(&page, 0, sizeof(page));
+	page.bytes_left = (ulMaxSize == 0 || ulMaxSize > TSS_TCP_RPC_EVLOG_PAGE_MAX) ?
+			  TSS_TCP_RPC_EVLOG_PAGE_MAX : ulMaxSize;
+
+	MUTEX_LOCK(tcs_event_log->lock);
+
+	for (; pcr < tpm_metrics.num_pcrs; pcr++, seq = 0) {
+		if ((tcsd_options.kernel_pcrs & (1 << pcr)) ||
+		    (tcsd_options.firmware_pcrs & (1 << pcr))) {
+			if ((result = evlog_page_fill_external(&page, pcr, &seq, &full)))
+				break;
+		} else {
+			list = &tcs_event_log->lists[pcr];
+			for (; seq < list->num; seq++) {
+				if (!evlog_page_add(&page, &list->events[seq], &result)) {
+					full = TRUE;
+					break;
+				}
+			}
+		}
+
+		if (result || full)
+			break;
+	}
+
+	MUTEX_UNLOCK(tcs_event_log->lock);
+
+	if (result) {
+		free_external_events(page.num, page.events);
+		free(page.events);
+		return result;
+	}
+
+	*pPcrIndex = pcr;
+	*pSequence = (pcr < tpm_metrics.num_pcrs) ? seq : 0;
+	*pEventCount = page.num;
+	*ppEvents = page.events;
+
+	return TSS_SUCCESS;
+}
+
+/* Return the events of PcrIndex numbered Since and up, along with the aggregate of the PCR's
+ * whole log. A verifier that has already replayed the first Since events only needs to check
+ * that extending its own aggregate with the returned events matches. */
+TSS_RESULT
+TCS_GetPcrEventsSince_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
+			       UINT32 PcrIndex,			/* in */
+			       UINT32 Since,			/* in */
+			       UINT32 *pEventCount,		/* out */
+			       TSS_PCR_EVENT **ppEvents,	/* out */
+			       TCPA_DIGEST *pAggregate)		/* out */
+{
+	struct event_aggregate *agg;
+	TSS_PCR_EVENT *events = NULL;
+	UINT32 start, count, skip, i;
+	TSS_RESULT result;
+
+	if ((result = evlog_verify_context(hContext)))
+		return result;
+
+	if (PcrIndex >= tpm_metrics.num_pcrs)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	MUTEX_LOCK(tcs_event_log->lock);
+
+	agg = &tcs_event_log->aggregates[PcrIndex];
+
+	if ((tcsd_options.kernel_pcrs & (1 << PcrIndex)) ||
+	    (tcsd_options.firmware_pcrs & (1 << PcrIndex))) {
+		/* the external logs grow beneath us, so catch the aggregate up with whatever's
+		 * been added since the last time it was asked for. The events the caller wants
+		 * are read in the same pass. */
+		start = MIN(Since, agg->num);
+		count = UINT_MAX;
+		if ((result = TCS_GetExternalPcrEventsByPcr(PcrIndex, start, &count, &events)))
+			goto done;
+
+		for (i = agg->num - start; i < count; i++) {
+			if ((result = event_aggregate_extend(PcrIndex, &events[i]))) {
+				free_external_events(count, events);
+				free(events);
+				goto done;
+			}
+		}
+
+		if (Since > start + count) {
+			free_external_events(count, events);
+			free(events);
+			result = TCSERR(TSS_E_BAD_PARAMETER);
+			goto done;
+		}
+
+		skip = Since - start;
+		free_external_events(skip, events);
+		count -= skip;
+		if (count == 0) {
+			free(events);
+			events = NULL;
+		} else if (skip)
+			memmove(events, &events[skip], count * sizeof(TSS_PCR_EVENT));
+	} else {
+		/* the aggregate of a TCSD controlled PCR is kept current by event_log_add() */
+		if (Since > agg->num) {
+			result = TCSERR(TSS_E_BAD_PARAMETER);
+			goto done;
+		}
+
+		count = agg->num - Since;
+		if (count) {
+			if ((events = calloc(count, sizeof(TSS_PCR_EVENT))) == NULL) {
+				LogError("malloc of %zd bytes failed.", count * sizeof(TSS_PCR_EVENT));
+				result = TCSERR(TSS_E_OUTOFMEMORY);
+				goto done;
+			}
+
+			copy_pcr_events(events, PcrIndex, Since, count);
+		}
+	}
+
+	*pEventCount = count;
+	*ppEvents = events;
+	memcpy(pAggregate, &agg->digest, sizeof(TCPA_DIGEST));
+done:
+	MUTEX_UNLOCK(tcs_event_log->lock);
+
+	return result;
+}
@@ -85,7 +85,8 @@ TCSP_TakeOwnership_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 		}
 
 #ifdef TSS_BUILD_PS
-		{
+		/* only the first TPM's SRK is kept in the system PS, see ps_check_device() */
+		if (ps_check_device() == TSS_SUCCESS) {
 			BYTE *save;
 
 			/* Once the key file is created, it stays forever. There could be
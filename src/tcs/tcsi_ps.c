@@ -22,6 +22,19 @@
 #include "tcslog.h"
 #include "tcsps.h"
 
+
+/* Only the first TPM's contexts have a system PS, see ps_check_device() */
+static TSS_RESULT
+ps_verify_context(TCS_CONTEXT_HANDLE hContext)
+{
+	TSS_RESULT result;
+
+	if ((result = ctx_verify_context(hContext)))
+		return result;
+
+	return ps_check_device();
+}
+
 TSS_RESULT
 TCS_RegisterKey_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 			 TSS_UUID *WrappingKeyUUID,	/* in */
@@ -34,7 +47,7 @@ TCS_RegisterKey_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 	TSS_RESULT result;
 	TSS_BOOL is_reg;
 
-	if ((result = ctx_verify_context(hContext)))
+	if ((result = ps_verify_context(hContext)))
 		return result;
 
 	/* Check if key is already regisitered */
@@ -66,12 +79,67 @@ TCS_UnregisterKey_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 {
 	TSS_RESULT result;
 
-	if ((result = ctx_verify_context(hContext)))
+	if ((result = ps_verify_context(hContext)))
 		return result;
 
 	return ps_remove_key(&KeyUUID);
 }
 
+/* Register a batch of keys, checking each parent against the keys already in system PS and
+ * those earlier in the batch. The keys are written in one transaction, all or none of them. */
+TSS_RESULT
+TCS_RegisterKeys_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
+			  UINT32 ulKeyCount,		/* in */
+			  TSS_UUID *WrappingKeyUUIDs,	/* in */
+			  TSS_UUID *KeyUUIDs,		/* in */
+			  UINT32 *cKeySizes,		/* in */
+			  BYTE ** rgbKeys,		/* in */
+			  UINT32 cVendorData,		/* in */
+			  BYTE * gbVendorData)		/* in */
+{
+	TSS_RESULT result;
+	TSS_UUID *uuid;
+	UINT32 i;
+
+	if ((result = ps_verify_context(hContext)))
+		return result;
+
+	if (ulKeyCount == 0)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	for (i = 0; i < ulKeyCount; i++) {
+		uuid = &KeyUUIDs[i];
+		if (TSS_UUID_IS_OWNEREVICT(uuid)) {
+			LogDebug("UUID is reserved for owner evict keys");
+			return TCSERR(TSS_E_KEY_ALREADY_REGISTERED);
+		}
+	}
+
+	if ((result = ps_write_keys(ulKeyCount, KeyUUIDs, WrappingKeyUUIDs, gbVendorData,
+				    cVendorData, rgbKeys, cKeySizes))) {
+		LogDebug("Error writing %u keys to file", ulKeyCount);
+		return result;
+	}
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+TCS_UnregisterKeys_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
+			    UINT32 ulKeyCount,		/* in */
+			    TSS_UUID *KeyUUIDs)		/* in */
+{
+	TSS_RESULT result;
+
+	if ((result = ps_verify_context(hContext)))
+		return result;
+
+	if (ulKeyCount == 0)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	return ps_remove_keys(ulKeyCount, KeyUUIDs);
+}
+
 TSS_RESULT
 TCS_EnumRegisteredKeys_Internal(TCS_CONTEXT_HANDLE hContext,		/* in */
 				TSS_UUID * pKeyUUID,			/* in */
@@ -91,7 +159,7 @@ TCS_EnumRegisteredKeys_Internal(TCS_CONTEXT_HANDLE hContext,		/* in */
 	if (pcKeyHierarchySize == NULL || ppKeyHierarchy == NULL)
 		return TCSERR(TSS_E_BAD_PARAMETER);
 
-	if ((result = ctx_verify_context(hContext)))
+	if ((result = ps_verify_context(hContext)))
 		return result;
 
 	if (pKeyUUID != NULL) {
@@ -258,7 +326,7 @@ TCS_EnumRegisteredKeys_Internal2(TCS_CONTEXT_HANDLE hContext,		/* in */
 	if (pcKeyHierarchySize == NULL || ppKeyHierarchy == NULL)
 		return TCSERR(TSS_E_BAD_PARAMETER);
 
-	if ((result = ctx_verify_context(hContext)))
+	if ((result = ps_verify_context(hContext)))
 		return result;
 
 	if (pKeyUUID != NULL) {
@@ -421,7 +489,7 @@ TCS_GetRegisteredKey_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 	/* This should be set in case we return before the malloc */
 	*ppKeyInfo = NULL;
 
-	if ((result = ctx_verify_context(hContext)))
+	if ((result = ps_verify_context(hContext)))
 		return result;
 
 	if ((result = ps_get_key_by_uuid(KeyUUID, tcpaKeyBlob, &keySize))) {
@@ -475,7 +543,7 @@ TCS_GetRegisteredKeyBlob_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 	BYTE buffer[4096];
 	TSS_RESULT result;
 
-	if ((result = ctx_verify_context(hContext)))
+	if ((result = ps_verify_context(hContext)))
 		return result;
 
 	keySize = sizeof(buffer);
@@ -524,6 +592,9 @@ TCSP_LoadKeyByUUID_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 
 	if (pLoadKeyInfo &&
 	    memcmp(&pLoadKeyInfo->parentKeyUUID, &parentUuid, sizeof(TSS_UUID))) {
+		if ((result = ps_check_device()))
+			return result;
+
 		if (ps_get_key_by_uuid(&pLoadKeyInfo->keyUUID, keyBlob, &blobSize))
 			return TCSERR(TSS_E_PS_KEY_NOTFOUND);
 
@@ -552,6 +623,10 @@ TCSP_LoadKeyByUUID_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 	 *		that we get it all from either the keyfile or the keyCache
 	 *		also, it's important to return if the key is already loaded
 	 ***********************************************************************/
+	/* keys that aren't loaded yet can only come from the first TPM's PS */
+	if ((result = ps_check_device()))
+		return result;
+
 	LogDebugFn("calling ps_get_key_by_uuid");
 	if (ps_get_key_by_uuid(KeyUUID, keyBlob, &blobSize))
 		return TCSERR(TSS_E_PS_KEY_NOTFOUND);
@@ -610,7 +685,7 @@ TCSP_GetRegisteredKeyByPublicInfo_Internal(TCS_CONTEXT_HANDLE tcsContext,	/* in
 	TCPA_STORE_PUBKEY pubKey;
 	TSS_RESULT result = TCSERR(TSS_E_FAIL);
 
-	if ((result = ctx_verify_context(tcsContext)))
+	if ((result = ps_verify_context(tcsContext)))
 		return result;
 
 	if (algID == TCPA_ALG_RSA) {
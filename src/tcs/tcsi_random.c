@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
 
 #include "trousers/tss.h"
 #include "trousers_types.h"
@@ -27,88 +28,242 @@
 #include "tcsd.h"
 
 
+/*
+ * Pool of TPM random bytes, filled in the background while the TPM has nothing else to do so that
+ * GetRandom requests don't have to wait for a string of TPM_GetRandom commands. Its size is set
+ * by the random_pool_size option, and it's not used at all if that's 0. Bytes are taken off the
+ * end of the pool and wiped as they're handed out, so each one goes to exactly one caller. The
+ * refill thread works on the first TPM, so only that TPM's contexts are served from the pool.
+ */
+static struct {
+	BYTE *buf;
+	UINT32 size, fill;
+	UINT32 generation;	/* bumped by StirRandom, see random_pool_flush() */
+	TSS_BOOL stop;
+	THREAD_TYPE tid;
+} pool;
+
+static MUTEX_DECLARE_INIT(pool_lock);
+static COND_DECLARE_INIT(pool_cond);
+
+/* how long the refill thread backs off while the TPM is busy, in microseconds, and after the TPM
+ * failed to give it anything, in seconds */
+#define RANDOM_POOL_BACKOFF	10000
+#define RANDOM_POOL_RETRY	1
+
+/* Ask the TPM for up to @len random bytes, which are copied to @out. If @sent isn't NULL, this
+ * is background work, and the request is only sent if the TPM is free for it, see
+ * req_mgr_submit_idle_req(). */
+static TSS_RESULT
+tpm_get_random(UINT32 len, BYTE *out, UINT32 *outLen, TSS_BOOL *sent)
+{
+	UINT64 offset = 0;
+	UINT32 paramSize;
+	TSS_RESULT result;
+	BYTE txBlob[TSS_TPM_TXBLOB_SIZE], *rnd;
+
+	if ((result = tpm_rqu_build(TPM_ORD_GetRandom, &offset, txBlob, len, NULL)))
+		return result;
+
+	*outLen = 0;
+	if (sent) {
+		if ((result = req_mgr_submit_idle_req(txBlob, sent)) || !*sent)
+			return result;
+	} else if ((result = req_mgr_submit_req(txBlob)))
+		return result;
+
+	if ((result = UnloadBlob_Header(txBlob, &paramSize)))
+		return result;
+
+	/* rnd points into txBlob, so copy straight out of the response */
+	if ((result = tpm_rsp_parse_view(TPM_ORD_GetRandom, txBlob, paramSize, outLen, &rnd, NULL,
+					 NULL)))
+		return result;
+
+	if (*outLen > len) {
+		LogError("TPM returned %u random bytes, %u were requested", *outLen, len);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	memcpy(out, rnd, *outLen);
+
+	return TSS_SUCCESS;
+}
+
+static void *
+random_pool_thread(void *arg)
+{
+	BYTE rnd[TSS_TPM_TXBLOB_SIZE];
+	UINT32 want, got, generation, n;
+	TSS_BOOL sent;
+	TSS_RESULT result;
+
+	thread_signal_init();
+
+	MUTEX_LOCK(pool_lock);
+	while (!pool.stop) {
+		if (pool.fill == pool.size) {
+			COND_WAIT(&pool_cond, &pool_lock);
+			continue;
+		}
+
+		want = MIN(pool.size - pool.fill, sizeof(rnd) - TSS_TPM_TXBLOB_HDR_LEN -
+			   sizeof(UINT32));
+		generation = pool.generation;
+		MUTEX_UNLOCK(pool_lock);
+
+		/* lowest priority: only use the TPM when nobody else is, and stay off it while
+		 * someone holds an exclusive transport session */
+		result = tpm_get_random(want, rnd, &got, &sent);
+		if (!result && !sent) {
+			usleep(RANDOM_POOL_BACKOFF);
+			MUTEX_LOCK(pool_lock);
+			continue;
+		}
+
+		if (result || got == 0) {
+			sleep(RANDOM_POOL_RETRY);
+			MUTEX_LOCK(pool_lock);
+			continue;
+		}
+
+		MUTEX_LOCK(pool_lock);
+		/* bytes the TPM produced before a StirRandom don't go in */
+		if (generation == pool.generation) {
+			n = MIN(got, pool.size - pool.fill);
+			memcpy(&pool.buf[pool.fill], rnd, n);
+			pool.fill += n;
+		}
+		memset(rnd, 0, got);
+	}
+	MUTEX_UNLOCK(pool_lock);
+
+	return NULL;
+}
+
+TSS_RESULT
+random_pool_init()
+{
+	if (tcsd_options.random_pool_size == 0)
+		return TSS_SUCCESS;
+
+	if ((pool.buf = calloc(1, tcsd_options.random_pool_size)) == NULL) {
+		LogError("malloc of %u bytes failed.", tcsd_options.random_pool_size);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+	pool.size = tcsd_options.random_pool_size;
+
+	if (THREAD_CREATE(&pool.tid, NULL, random_pool_thread, NULL)) {
+		LogError("Failed to start the random pool thread.");
+		free(pool.buf);
+		pool.buf = NULL;
+		pool.size = 0;
+		return TCSERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	return TSS_SUCCESS;
+}
+
+void
+random_pool_final()
+{
+	if (pool.buf == NULL)
+		return;
+
+	MUTEX_LOCK(pool_lock);
+	pool.stop = TRUE;
+	COND_SIGNAL(&pool_cond);
+	MUTEX_UNLOCK(pool_lock);
+
+	THREAD_JOIN(pool.tid, NULL);
+
+	memset(pool.buf, 0, pool.size);
+	free(pool.buf);
+	pool.buf = NULL;
+}
+
+/* Take up to @len bytes from the pool, returning how many were taken */
+static UINT32
+random_pool_take(UINT32 len, BYTE *out)
+{
+	UINT32 n;
+
+	if (pool.buf == NULL || tcs_device_current()->index != 0)
+		return 0;
+
+	MUTEX_LOCK(pool_lock);
+	n = MIN(len, pool.fill);
+	pool.fill -= n;
+	memcpy(out, &pool.buf[pool.fill], n);
+	memset(&pool.buf[pool.fill], 0, n);
+	COND_SIGNAL(&pool_cond);
+	MUTEX_UNLOCK(pool_lock);
+
+	return n;
+}
+
+/* Throw away everything in the pool, along with anything the refill thread has in flight */
+static void
+random_pool_flush()
+{
+	if (pool.buf == NULL || tcs_device_current()->index != 0)
+		return;
+
+	MUTEX_LOCK(pool_lock);
+	memset(pool.buf, 0, pool.fill);
+	pool.fill = 0;
+	pool.generation++;
+	COND_SIGNAL(&pool_cond);
+	MUTEX_UNLOCK(pool_lock);
+}
+
 /*
  * Get a random number generated by the TPM.  Most (all?) TPMs return a maximum number of random
  * bytes that's less than the max allowed to be returned at the TSP level, which is 4K bytes.
  * According to the TPM compliance work posted here: http://www.prosec.rub.de/tpmcompliance.html,
  * some TPMs return as little as 132 bytes per query, which would require about 30 loops to get 4K.
  * We'll be extremely conservative here and loop 50 times, since it won't affect performance on
- * TPMs that return more bytes.
+ * TPMs that return more bytes. Whatever the random pool holds is used first.
  */
 TSS_RESULT
 TCSP_GetRandom_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 			UINT32 * bytesRequested,	/* in, out */
 			BYTE ** randomBytes)	/* out */
 {
-	UINT64 offset;
 	TSS_RESULT result;
-	UINT32 paramSize, totalReturned = 0, bytesReturned, retries = 50;
-	BYTE txBlob[TSS_TPM_TXBLOB_SIZE], *rnd_tmp = NULL, *rnd_tmp2 = NULL;
+	UINT32 totalReturned, bytesReturned, retries = 50;
 
 	LogDebugFn("%u bytes", *bytesRequested);
 
 	if ((result = ctx_verify_context(hContext)))
 		return result;
 
-	do {
-		offset = 0;
-		if ((result = tpm_rqu_build(TPM_ORD_GetRandom, &offset, txBlob,
-					    *bytesRequested - totalReturned, NULL)))
+	if ((*randomBytes = malloc(*bytesRequested ? *bytesRequested : 1)) == NULL) {
+		LogError("malloc of %u bytes failed.", *bytesRequested);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	totalReturned = random_pool_take(*bytesRequested, *randomBytes);
+
+	while (totalReturned < *bytesRequested && retries--) {
+		if ((result = tpm_get_random(*bytesRequested - totalReturned,
+					     *randomBytes + totalReturned, &bytesReturned, NULL)))
 			break;
 
-		if ((result = req_mgr_submit_req(txBlob)))
-			break;;
-
-		result = UnloadBlob_Header(txBlob, &paramSize);
-		if (!result) {
-#if 0
-			offset = 10;
-			UnloadBlob_UINT32(&offset, &bytesReturned, txBlob);
-
-			LogDebugFn("received %u bytes from the TPM", bytesReturned);
-
-			rnd_tmp = realloc(rnd_tmp, totalReturned + bytesReturned);
-			if (rnd_tmp == NULL) {
-				LogError("malloc of %u bytes failed.", bytesReturned);
-				return TCSERR(TSS_E_OUTOFMEMORY);
-			}
-			UnloadBlob(&offset, bytesReturned, txBlob, &rnd_tmp[totalReturned]);
-#else
-			/* XXX */
-			if ((result = tpm_rsp_parse(TPM_ORD_GetRandom, txBlob, paramSize,
-						    &bytesReturned, &rnd_tmp, NULL, NULL)))
-				break;
-
-			rnd_tmp2 = realloc(*randomBytes, totalReturned + bytesReturned);
-			if (rnd_tmp2 == NULL) {
-				free(rnd_tmp);
-				rnd_tmp = NULL;
-				LogError("malloc of %u bytes failed.", bytesReturned);
-				result = TCSERR(TSS_E_OUTOFMEMORY);
-				break;
-			}
-			*randomBytes = rnd_tmp2;
-			memcpy(*randomBytes + totalReturned, rnd_tmp, bytesReturned);
-			free(rnd_tmp);
-			rnd_tmp = NULL;
-#endif
-			totalReturned += bytesReturned;
-		} else {
-			free(rnd_tmp);
-			return result;
-		}
-	} while (totalReturned < *bytesRequested && retries--);
+		LogDebugFn("received %u bytes from the TPM", bytesReturned);
+		totalReturned += bytesReturned;
+	}
 
-	if (totalReturned != *bytesRequested) {
+	if (!result && totalReturned != *bytesRequested) {
 		LogDebugFn("Only %u random bytes recieved from TPM.", totalReturned);
-		free(rnd_tmp);
 		result = TCSERR(TSS_E_FAIL);
-#if 0
-	} else
-		*randomBytes = rnd_tmp;
-#else
 	}
-#endif
+
+	if (result) {
+		memset(*randomBytes, 0, totalReturned);
+		free(*randomBytes);
+		*randomBytes = NULL;
+	}
 
 	return result;
 }
@@ -142,6 +297,11 @@ TCSP_StirRandom_Internal(TCS_CONTEXT_HANDLE hContext,	/* in */
 
 	result = UnloadBlob_Header(txBlob, &paramSize);
 	LogResult("Stir random", result);
+
+	/* what's in the pool was generated before the stir */
+	if (!result)
+		random_pool_flush();
+
 	return result;
 }
 
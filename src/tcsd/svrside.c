@@ -19,7 +19,6 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
-#include <netdb.h>
 #include <pwd.h>
 #if (defined (__OpenBSD__) || defined (__FreeBSD__))
 #include <netinet/in.h>
@@ -39,24 +38,119 @@
 #include "tcsd.h"
 #include "req_mgr.h"
 
-struct tcsd_config tcsd_options;
-struct tpm_properties tpm_metrics;
+TSS_BOOL tcsd_remote_listen = FALSE;
 static volatile int hup = 0, term = 0;
 extern char *optarg;
 int sd;
 char *tcsd_config_file = NULL;
 
+/*
+ * Reading the system PS file and finding the owner evict keys takes a while, and many requests,
+ * such as reading PCRs or the event log, need neither. So they're done on a thread of their own
+ * once the tcsd is listening, and the requests that need them wait in tcsd_wait_ready().
+ */
+static struct {
+	TSS_BOOL started;
+	TSS_BOOL done;
+	TSS_RESULT result;
+	THREAD_TYPE tid;
+} tcsd_ready;
+static MUTEX_DECLARE_INIT(tcsd_ready_lock);
+static COND_DECLARE_INIT(tcsd_ready_cond);
+
+static void *
+tcsd_ready_thread(void *arg)
+{
+	TSS_RESULT result;
+	UINT32 i;
+
+	thread_signal_init();
+
+	tcsd_conf_pin();
+	if ((result = PS_init_disk_cache()) == TSS_SUCCESS) {
+		/* every TPM has owner evict keys of its own */
+		for (i = 0; i < tcs_device_count() && !result; i++) {
+			if ((result = tcs_device_select(i)) == TSS_SUCCESS)
+				result = owner_evict_init();
+		}
+	}
+	tcsd_conf_unpin();
+
+	if (result)
+		LogError("Loading the key caches failed: 0x%x. Requests that need them will fail.",
+			 result);
+
+	MUTEX_LOCK(tcsd_ready_lock);
+	tcsd_ready.result = result;
+	tcsd_ready.done = TRUE;
+	COND_BROADCAST(&tcsd_ready_cond);
+	MUTEX_UNLOCK(tcsd_ready_lock);
+
+	return NULL;
+}
+
+TSS_RESULT
+tcsd_wait_ready(void)
+{
+	TSS_RESULT result;
+
+	MUTEX_LOCK(tcsd_ready_lock);
+	while (!tcsd_ready.done)
+		COND_WAIT(&tcsd_ready_cond, &tcsd_ready_lock);
+	result = tcsd_ready.result;
+	MUTEX_UNLOCK(tcsd_ready_lock);
+
+	return result;
+}
+
+/* Read the properties of each TPM and set up its auth session manager */
+static TSS_RESULT
+tcsd_devices_startup(void)
+{
+	TSS_RESULT result = TSS_SUCCESS;
+	UINT32 i;
+
+	for (i = 0; i < tcs_device_count() && !result; i++) {
+		if ((result = tcs_device_select(i)))
+			break;
+
+		if ((result = get_tpm_metrics(&tpm_metrics)))
+			break;
+
+		/* must happen after get_tpm_metrics() */
+		result = auth_mgr_init();
+	}
+	(void)tcs_device_select(0);
+
+	return result;
+}
+
+static void
+tcsd_devices_shutdown(void)
+{
+	UINT32 i;
+
+	for (i = 0; i < tcs_device_count(); i++) {
+		(void)tcs_device_select(i);
+		auth_mgr_final();
+	}
+	(void)tcs_device_select(0);
+}
+
 static void
 tcsd_shutdown(void)
 {
 	/* order is important here:
 	 * allow all threads to complete their current request */
 	tcsd_threads_final();
+	if (tcsd_ready.started)
+		THREAD_JOIN(tcsd_ready.tid, NULL);
+	RANDOM_POOL_final();
 	PS_close_disk_cache();
-	auth_mgr_final();
+	tcsd_devices_shutdown();
 	(void)req_mgr_final();
-	conf_file_final(&tcsd_options);
 	EVENT_LOG_final();
+	tcsd_conf_final();
 }
 
 static void
@@ -132,33 +226,31 @@ tcsd_startup(void)
 		return result;
 	}
 
-	if ((result = req_mgr_init())) {
+	if ((result = tcs_devices_init(tcsd_options.num_tpm_devices))) {
 		conf_file_final(&tcsd_options);
 		return result;
 	}
 
-	if ((result = ps_dirs_init())) {
+	if ((result = req_mgr_init())) {
 		conf_file_final(&tcsd_options);
-		(void)req_mgr_final();
 		return result;
 	}
 
-	result = PS_init_disk_cache();
-	if (result != TSS_SUCCESS) {
+	if ((result = ps_dirs_init())) {
 		conf_file_final(&tcsd_options);
 		(void)req_mgr_final();
 		return result;
 	}
 
-	if ((result = get_tpm_metrics(&tpm_metrics))) {
+	result = PS_open_disk_cache();
+	if (result != TSS_SUCCESS) {
 		conf_file_final(&tcsd_options);
-		PS_close_disk_cache();
 		(void)req_mgr_final();
 		return result;
 	}
 
-	/* must happen after get_tpm_metrics() */
-	if ((result = auth_mgr_init())) {
+	if ((result = tcsd_devices_startup())) {
+		tcsd_devices_shutdown();
 		conf_file_final(&tcsd_options);
 		PS_close_disk_cache();
 		(void)req_mgr_final();
@@ -167,23 +259,30 @@ tcsd_startup(void)
 
 	result = EVENT_LOG_init();
 	if (result != TSS_SUCCESS) {
-		auth_mgr_final();
+		tcsd_devices_shutdown();
 		conf_file_final(&tcsd_options);
 		PS_close_disk_cache();
 		(void)req_mgr_final();
 		return result;
 	}
 
-	result = owner_evict_init();
-	if (result != TSS_SUCCESS) {
-		auth_mgr_final();
-		conf_file_final(&tcsd_options);
-		PS_close_disk_cache();
-		(void)req_mgr_final();
-		return result;
+	return TSS_SUCCESS;
+}
+
+/* Start the rest of the tcsd's threads. Threads don't survive daemon(), so this has to come
+ * after it */
+static TSS_RESULT
+tcsd_startup_threads(void)
+{
+	int rc;
+
+	if ((rc = THREAD_CREATE(&tcsd_ready.tid, NULL, tcsd_ready_thread, NULL))) {
+		LogError("Thread create failed: %d", rc);
+		return TCSERR(TSS_E_INTERNAL_ERROR);
 	}
+	tcsd_ready.started = TRUE;
 
-	return TSS_SUCCESS;
+	return RANDOM_POOL_init();
 }
 
 
@@ -202,13 +301,9 @@ usage(void)
 static TSS_RESULT
 reload_config(void)
 {
-	TSS_RESULT result;
 	hup = 0;
 
-	// FIXME: reload the config - work in progress
-	result = TSS_SUCCESS;
-
-	return result;
+	return conf_file_reload();
 }
 
 
@@ -219,9 +314,7 @@ main(int argc, char **argv)
 	TSS_RESULT result;
 	int newsd, c, option_index = 0;
 	unsigned client_len;
-	char *hostname = NULL;
 	struct passwd *pwd;
-	struct hostent *client_hostent = NULL;
 	struct option long_options[] = {
 		{"help", 0, NULL, 'h'},
 		{"foreground", 0, NULL, 'f'},
@@ -270,8 +363,10 @@ main(int argc, char **argv)
 	 * only at the socket. */
 	if (tcsd_options.remote_ops[0] == 0)
 		serv_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-	else
+	else {
 		serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		tcsd_remote_listen = TRUE;
+	}
 
 	c = 1;
 	setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &c, sizeof(c));
@@ -306,6 +401,11 @@ main(int argc, char **argv)
 		}
 	}
 
+	if ((result = tcsd_startup_threads())) {
+		tcsd_shutdown();
+		return (int)result;
+	}
+
 	LogInfo("%s: TCSD up and running.", PACKAGE_STRING);
 	do {
 		newsd = accept(sd, (struct sockaddr *) &client_addr, &client_len);
@@ -325,24 +425,7 @@ main(int argc, char **argv)
 		}
 		LogDebug("accepted socket %i", newsd);
 
-		if ((client_hostent = gethostbyaddr((char *) &client_addr.sin_addr,
-						    sizeof(client_addr.sin_addr),
-						    AF_INET)) == NULL) {
-			char buf[16];
-                        uint32_t addr = htonl(client_addr.sin_addr.s_addr);
-
-                        snprintf(buf, 16, "%d.%d.%d.%d", (addr & 0xff000000) >> 24,
-                                 (addr & 0x00ff0000) >> 16, (addr & 0x0000ff00) >> 8,
-                                 addr & 0x000000ff);
-
-			LogWarn("Host name for connecting IP %s could not be resolved", buf);
-			hostname = strdup(buf);
-		} else {
-			hostname = strdup(client_hostent->h_name);
-		}
-
-		tcsd_thread_create(newsd, hostname);
-		hostname = NULL;
+		tcsd_thread_create(newsd, &client_addr);
 		if (hup) {
 			if (reload_config() != TSS_SUCCESS)
 				LogError("Failed reloading config");
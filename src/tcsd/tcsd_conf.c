@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <grp.h>
 #include <stdlib.h>
+#include <arpa/inet.h>
 
 #ifdef SOLARIS
 #include <libscf.h>
@@ -44,6 +45,7 @@ struct tcsd_config_options options_list[] = {
 	{"firmware_pcrs", opt_firmware_pcrs},
 	{"kernel_log_file", opt_kernel_log},
 	{"kernel_pcrs", opt_kernel_pcrs},
+	{"event_log_file", opt_event_log},
 	{"platform_cred", opt_platform_cred},
 	{"conformance_cred", opt_conformance_cred},
 	{"endorsement_cred", opt_endorsement_cred},
@@ -51,6 +53,9 @@ struct tcsd_config_options options_list[] = {
 	{"enforce_exclusive_transport", opt_exclusive_transport},
 	{"host_platform_class", opt_host_platform_class},
 	{"all_platform_classes", opt_all_platform_classes},
+	{"tpm_device", opt_tpm_device},
+	{"random_pool_size", opt_random_pool_size},
+	{"remote_hosts", opt_remote_hosts},
 	{NULL, 0}
 };
 
@@ -75,14 +80,22 @@ init_tcsd_config(struct tcsd_config *conf)
 	conf->firmware_pcrs = 0;
 	conf->kernel_log_file = NULL;
 	conf->kernel_pcrs = 0;
+	conf->event_log_file = NULL;
 	conf->platform_cred = NULL;
 	conf->conformance_cred = NULL;
 	conf->endorsement_cred = NULL;
 	memset(conf->remote_ops, 0, sizeof(conf->remote_ops));
+	memset(conf->remote_ops_map, 0, sizeof(conf->remote_ops_map));
+	conf->remote_hosts = NULL;
+	conf->num_remote_hosts = 0;
 	conf->unset = 0xffffffff;
 	conf->exclusive_transport = 0;
 	conf->host_platform_class = NULL;
 	conf->all_platform_classes = NULL;
+	conf->tpm_devices = NULL;
+	conf->num_tpm_devices = 0;
+	conf->random_pool_size = 0;
+	conf->refs = 0;
 }
 
 TSS_RESULT
@@ -147,6 +160,9 @@ config_set_defaults(struct tcsd_config *conf)
 	if (conf->unset & TCSD_OPTION_KERNEL_PCRS)
 		conf->kernel_pcrs = TCSD_DEFAULT_KERNEL_PCRS;
 
+	if (conf->unset & TCSD_OPTION_RANDOM_POOL_SIZE)
+		conf->random_pool_size = TCSD_DEFAULT_RANDOM_POOL_SIZE;
+
 	/* these are strdup'd so we know we can free them at shutdown time */
 	if (conf->unset & TCSD_OPTION_SYSTEM_PSFILE) {
 		conf->system_ps_file = strdup(TCSD_DEFAULT_SYSTEM_PS_FILE);
@@ -159,6 +175,9 @@ config_set_defaults(struct tcsd_config *conf)
 	if (conf->unset & TCSD_OPTION_KERNEL_LOGFILE)
 		conf->kernel_log_file = strdup(TCSD_DEFAULT_KERNEL_LOG_FILE);
 
+	if (conf->unset & TCSD_OPTION_EVENT_LOGFILE)
+		conf->event_log_file = strdup(TCSD_DEFAULT_EVENT_LOG_FILE);
+
 	if (conf->unset & TCSD_OPTION_HOST_PLATFORM_CLASS)
 		platform_class_list_append(conf, "PC_12", TRUE);
 }
@@ -246,12 +265,14 @@ tcsd_add_op(int *remote_ops, int *op)
 int
 tcsd_set_remote_op(struct tcsd_config *conf, char *op_name)
 {
-	int i = 0;
+	int i = 0, j;
 
 	while(tcsd_ops[i]) {
 		if (!strcasecmp(tcsd_ops[i]->name, op_name)) {
 			/* match found */
 			tcsd_add_op(conf->remote_ops, tcsd_ops[i]->op);
+			for (j = 0; tcsd_ops[i]->op[j]; j++)
+				TCSD_ORD_MAP_SET(conf->remote_ops_map, tcsd_ops[i]->op[j]);
 			return 0;
 		}
 		i++;
@@ -261,6 +282,66 @@ tcsd_set_remote_op(struct tcsd_config *conf, char *op_name)
 	return 1;
 }
 
+/* add a network, given as a.b.c.d/bits or a single a.b.c.d address, to the ones remote hosts may
+ * connect from */
+TSS_RESULT
+tcsd_add_remote_host(struct tcsd_config *conf, char *net)
+{
+	struct tcsd_remote_host *hosts;
+	struct in_addr addr;
+	char *slash, *end;
+	long bits = 32;
+	int rc;
+
+	while (*net == ' ' || *net == '\t')
+		net++;
+	for (end = net + strlen(net); end > net && (end[-1] == ' ' || end[-1] == '\t'); end--)
+		;
+	*end = '\0';
+
+	if ((slash = index(net, '/'))) {
+		bits = strtol(slash + 1, &end, 10);
+		if (end == slash + 1 || *end != '\0' || bits < 0 || bits > 32)
+			return TCSERR(TSS_E_BAD_PARAMETER);
+		*slash = '\0';
+	}
+
+	rc = inet_pton(AF_INET, net, &addr);
+	if (slash)
+		*slash = '/';
+	if (rc != 1)
+		return TCSERR(TSS_E_BAD_PARAMETER);
+
+	hosts = realloc(conf->remote_hosts,
+			(conf->num_remote_hosts + 1) * sizeof(struct tcsd_remote_host));
+	if (hosts == NULL) {
+		LogError("malloc of %zd bytes failed.",
+			 (conf->num_remote_hosts + 1) * sizeof(struct tcsd_remote_host));
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+	conf->remote_hosts = hosts;
+
+	hosts[conf->num_remote_hosts].mask = bits ? 0xffffffff << (32 - bits) : 0;
+	hosts[conf->num_remote_hosts].addr = ntohl(addr.s_addr) &
+					     hosts[conf->num_remote_hosts].mask;
+	conf->num_remote_hosts++;
+
+	return TSS_SUCCESS;
+}
+
+static void
+free_tpm_devices(struct tcsd_config *conf)
+{
+	unsigned int i;
+
+	for (i = 0; i < conf->num_tpm_devices; i++)
+		free(conf->tpm_devices[i]);
+	free(conf->tpm_devices);
+
+	conf->tpm_devices = NULL;
+	conf->num_tpm_devices = 0;
+}
+
 TSS_RESULT
 read_conf_line(char *buf, int line_num, struct tcsd_config *conf)
 {
@@ -304,6 +385,17 @@ read_conf_line(char *buf, int line_num, struct tcsd_config *conf)
 			conf->unset &= ~TCSD_OPTION_MAX_THREADS;
 		}
 		break;
+	case opt_random_pool_size:
+		tmp_int = atoi(arg);
+		if (tmp_int < 0 || tmp_int > TCSD_MAX_RANDOM_POOL_SIZE) {
+			LogError("Config option \"random_pool_size\" out of range. %s:%d: \"%d\"",
+					tcsd_config_file, line_num, tmp_int);
+			return TCSERR(TSS_E_INTERNAL_ERROR);
+		} else {
+			conf->random_pool_size = tmp_int;
+			conf->unset &= ~TCSD_OPTION_RANDOM_POOL_SIZE;
+		}
+		break;
 	case opt_firmware_pcrs:
 		conf->unset &= ~TCSD_OPTION_FIRMWARE_PCRS;
 		while (1) {
@@ -431,6 +523,87 @@ read_conf_line(char *buf, int line_num, struct tcsd_config *conf)
 			conf->unset &= ~TCSD_OPTION_KERNEL_LOGFILE;
 		}
 		break;
+	case opt_event_log:
+		if (*arg != '/') {
+			LogError("Config option \"event_log_file\" must be an absolute path name."
+				 " %s:%d: \"%s\"", tcsd_config_file, line_num, arg);
+		} else {
+			int rc;
+
+			if ((rc = get_file_path(arg, &tmp_ptr)) < 0) {
+				LogError("Config option \"event_log_file\" is invalid. %s:%d: \"%s\"",
+					 tcsd_config_file, line_num, arg);
+				return TCSERR(TSS_E_INTERNAL_ERROR);
+			} else if (rc > 0) {
+				LogError("Config option \"event_log_file\" is invalid. %s:%d: \"%s\"",
+					 tcsd_config_file, line_num, tmp_ptr);
+				return TCSERR(TSS_E_INTERNAL_ERROR);
+			}
+			if (tmp_ptr == NULL)
+				return TCSERR(TSS_E_OUTOFMEMORY);
+
+			if (conf->event_log_file)
+				free(conf->event_log_file);
+
+			conf->event_log_file = tmp_ptr;
+			conf->unset &= ~TCSD_OPTION_EVENT_LOGFILE;
+		}
+		break;
+	case opt_tpm_device:
+		/* a comma separated list of device nodes, ending at the first comment */
+		free_tpm_devices(conf);
+		while (1) {
+			int rc;
+
+			while (*arg == ' ' || *arg == '\t')
+				arg++;
+
+			if ((comma = index(arg, ',')) != NULL) {
+				if ((tmp_ptr = index(arg, '#')) != NULL && tmp_ptr < comma)
+					comma = NULL;
+				else
+					*comma = '\n';
+			}
+
+			if (*arg != '/') {
+				LogError("Config option \"tpm_device\" must list absolute path names."
+					 " %s:%d: \"%s\"", tcsd_config_file, line_num, arg);
+				return TCSERR(TSS_E_INTERNAL_ERROR);
+			}
+
+			if (conf->num_tpm_devices == TCSD_MAX_TPM_DEVICES) {
+				LogError("Config option \"tpm_device\" lists more than %d devices."
+					 " %s:%d", TCSD_MAX_TPM_DEVICES, tcsd_config_file, line_num);
+				return TCSERR(TSS_E_INTERNAL_ERROR);
+			}
+
+			if ((rc = get_file_path(arg, &tmp_ptr)) < 0) {
+				LogError("Config option \"tpm_device\" is invalid. %s:%d: \"%s\"",
+					 tcsd_config_file, line_num, arg);
+				return TCSERR(TSS_E_INTERNAL_ERROR);
+			} else if (rc > 0) {
+				LogError("Config option \"tpm_device\" is invalid. %s:%d: \"%s\"",
+					 tcsd_config_file, line_num, tmp_ptr);
+				return TCSERR(TSS_E_INTERNAL_ERROR);
+			}
+			if (tmp_ptr == NULL)
+				return TCSERR(TSS_E_OUTOFMEMORY);
+
+			if (conf->tpm_devices == NULL &&
+			    (conf->tpm_devices = calloc(TCSD_MAX_TPM_DEVICES, sizeof(char *))) == NULL) {
+				LogError("malloc of %zd bytes failed",
+					 TCSD_MAX_TPM_DEVICES * sizeof(char *));
+				free(tmp_ptr);
+				return TCSERR(TSS_E_OUTOFMEMORY);
+			}
+			conf->tpm_devices[conf->num_tpm_devices++] = tmp_ptr;
+
+			if (comma == NULL)
+				break;
+			arg = comma + 1;
+		}
+		conf->unset &= ~TCSD_OPTION_TPM_DEVICE;
+		break;
 	case opt_firmware_log:
 		if (*arg != '/') {
 			LogError("Config option \"firmware_log\" must be an absolute path name."
@@ -562,6 +735,28 @@ read_conf_line(char *buf, int line_num, struct tcsd_config *conf)
 			}
 		}
 		break;
+	case opt_remote_hosts:
+		conf->unset &= ~TCSD_OPTION_REMOTE_HOSTS;
+		if ((comma = index(arg, '#')) || (comma = rindex(arg, '\n')))
+			*comma = '\0';
+		/* an entry that can't be read would otherwise leave remote hosts less restricted */
+		while (1) {
+			comma = rindex(arg, ',');
+			if (comma == NULL)
+				comma = arg;
+			else
+				*comma++ = '\0';
+
+			if ((result = tcsd_add_remote_host(conf, comma))) {
+				LogError("Config option \"remote_hosts\" is invalid. %s:%d: \"%s\"",
+					 tcsd_config_file, line_num, comma);
+				return result;
+			}
+
+			if (comma == arg)
+				break;
+		}
+		break;
         case opt_exclusive_transport:
 		tmp_int = atoi(arg);
 		if (tmp_int < 0 || tmp_int > 1) {
@@ -671,13 +866,208 @@ conf_file_final(struct tcsd_config *conf)
 	free(conf->system_ps_dir);
 	free(conf->kernel_log_file);
 	free(conf->firmware_log_file);
+	free(conf->event_log_file);
+	free_tpm_devices(conf);
 	free(conf->platform_cred);
 	free(conf->conformance_cred);
 	free(conf->endorsement_cred);
+	free(conf->remote_hosts);
 	free_platform_lists(conf->host_platform_class);
 	free_platform_lists(conf->all_platform_classes);
 }
 
+/*
+ * tcsd_options is a snapshot of the config. When the config file is reloaded on SIGHUP, a new
+ * snapshot is read and swapped in whole, so the old one can't be changed under the threads using
+ * it. A thread serving a request pins the snapshot that's current when the request comes in, and
+ * sees only that one until it unpins it. A replaced snapshot is freed when the last thread
+ * pinning it lets go. Threads that haven't pinned one see the current snapshot, which only the
+ * main thread should do, since it's the one that replaces it.
+ *
+ * The snapshot read at startup is never freed: the options that can't be reloaded are shared
+ * with it by the snapshots that replace it, and the TDDL holds on to it.
+ */
+static struct tcsd_config tcsd_boot_conf;
+static struct tcsd_config *tcsd_conf_current = &tcsd_boot_conf;
+static MUTEX_DECLARE_INIT(tcsd_conf_lock);
+static THREAD_KEY_DECLARE(tcsd_conf_key);
+static THREAD_ONCE_DECLARE_INIT(tcsd_conf_once);
+
+static void
+tcsd_conf_key_init(void)
+{
+	THREAD_KEY_CREATE(tcsd_conf_key, NULL);
+}
+
+struct tcsd_config *
+tcsd_conf_get(void)
+{
+	struct tcsd_config *conf;
+
+	THREAD_ONCE(tcsd_conf_once, tcsd_conf_key_init);
+	if ((conf = THREAD_KEY_GET(tcsd_conf_key)) == NULL)
+		conf = tcsd_conf_current;
+
+	return conf;
+}
+
+static void
+tcsd_conf_free(struct tcsd_config *conf)
+{
+	if (conf == &tcsd_boot_conf)
+		return;
+
+	/* these belong to the startup snapshot, see conf_keep_fixed() */
+	conf->system_ps_file = NULL;
+	conf->system_ps_dir = NULL;
+	conf->event_log_file = NULL;
+	conf->tpm_devices = NULL;
+	conf->num_tpm_devices = 0;
+
+	conf_file_final(conf);
+	free(conf);
+}
+
+void
+tcsd_conf_pin(void)
+{
+	struct tcsd_config *conf;
+
+	THREAD_ONCE(tcsd_conf_once, tcsd_conf_key_init);
+
+	MUTEX_LOCK(tcsd_conf_lock);
+	conf = tcsd_conf_current;
+	conf->refs++;
+	MUTEX_UNLOCK(tcsd_conf_lock);
+
+	THREAD_KEY_SET(tcsd_conf_key, conf);
+}
+
+void
+tcsd_conf_unpin(void)
+{
+	struct tcsd_config *conf;
+
+	if ((conf = THREAD_KEY_GET(tcsd_conf_key)) == NULL)
+		return;
+	THREAD_KEY_SET(tcsd_conf_key, NULL);
+
+	MUTEX_LOCK(tcsd_conf_lock);
+	if (--conf->refs || conf == tcsd_conf_current)
+		conf = NULL;
+	MUTEX_UNLOCK(tcsd_conf_lock);
+
+	if (conf)
+		tcsd_conf_free(conf);
+}
+
+/* called at shutdown, once all the threads that could pin a snapshot are gone */
+void
+tcsd_conf_final(void)
+{
+	tcsd_conf_free(tcsd_conf_current);
+	tcsd_conf_current = &tcsd_boot_conf;
+
+	conf_file_final(&tcsd_boot_conf);
+}
+
+static TSS_BOOL
+conf_str_changed(char *a, char *b)
+{
+	if (a == NULL || b == NULL)
+		return (a != b);
+
+	return (strcmp(a, b) != 0);
+}
+
+static TSS_BOOL
+conf_devices_changed(struct tcsd_config *a, struct tcsd_config *b)
+{
+	unsigned int i;
+
+	if (a->num_tpm_devices != b->num_tpm_devices)
+		return TRUE;
+
+	for (i = 0; i < a->num_tpm_devices; i++) {
+		if (conf_str_changed(a->tpm_devices[i], b->tpm_devices[i]))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Some options only take effect at startup. @conf, which is replacing @cur, gets the values of
+ * those that the tcsd is running with, and shares their memory with @cur */
+static void
+conf_keep_fixed(struct tcsd_config *cur, struct tcsd_config *conf)
+{
+	if (conf->port != cur->port ||
+	    conf_str_changed(conf->system_ps_file, cur->system_ps_file) ||
+	    conf_str_changed(conf->event_log_file, cur->event_log_file) ||
+	    conf_devices_changed(conf, cur) ||
+	    conf->random_pool_size != cur->random_pool_size)
+		LogWarn("Changes to port, system_ps_file, event_log_file, tpm_device and "
+			"random_pool_size take effect when the TCSD is restarted.");
+
+	if (!conf->remote_ops[0] != !tcsd_remote_listen)
+		LogWarn("The TCSD keeps listening %s until it's restarted.",
+			tcsd_remote_listen ? "on all addresses" : "on localhost only");
+
+	conf->port = cur->port;
+	conf->random_pool_size = cur->random_pool_size;
+
+	free(conf->system_ps_file);
+	conf->system_ps_file = cur->system_ps_file;
+	free(conf->system_ps_dir);
+	conf->system_ps_dir = cur->system_ps_dir;
+	free(conf->event_log_file);
+	conf->event_log_file = cur->event_log_file;
+	free_tpm_devices(conf);
+	conf->tpm_devices = cur->tpm_devices;
+	conf->num_tpm_devices = cur->num_tpm_devices;
+}
+
+/* Read the config file again and make it current. If it can't be read, the config in effect
+ * stays */
+TSS_RESULT
+conf_file_reload(void)
+{
+	struct tcsd_config *conf, *old;
+	TSS_RESULT result;
+
+	if ((conf = calloc(1, sizeof(struct tcsd_config))) == NULL) {
+		LogError("malloc of %zd bytes failed.", sizeof(struct tcsd_config));
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+	if ((result = conf_file_init(conf))) {
+		conf_file_final(conf);
+		free(conf);
+		return result;
+	}
+
+	conf_keep_fixed(tcsd_conf_current, conf);
+
+	if ((result = tcsd_threads_resize(conf->num_threads))) {
+		tcsd_conf_free(conf);
+		return result;
+	}
+
+	MUTEX_LOCK(tcsd_conf_lock);
+	old = tcsd_conf_current;
+	tcsd_conf_current = conf;
+	if (old->refs)
+		old = NULL;
+	MUTEX_UNLOCK(tcsd_conf_lock);
+
+	if (old)
+		tcsd_conf_free(old);
+
+	LogInfo("Reloaded the TCSD config from %s.", tcsd_config_file);
+
+	return TSS_SUCCESS;
+}
+
 #ifdef SOLARIS
 static int
 get_smf_prop(const char *var, boolean_t def_val)
@@ -794,6 +1184,7 @@ conf_file_init(struct tcsd_config *conf)
 	*/
 if (get_smf_prop("local_only", B_TRUE)) {
 		(void) memset(conf->remote_ops, 0, sizeof(conf->remote_ops));
+		(void) memset(conf->remote_ops_map, 0, sizeof(conf->remote_ops_map));
 		conf->unset |= TCSD_OPTION_REMOTE_OPS;
 	
 	}
@@ -17,6 +17,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
 
 #include "trousers/tss.h"
 #include "trousers_types.h"
@@ -43,12 +44,13 @@ tcsd_threads_final()
 	MUTEX_UNLOCK(tm->lock);
 
 	/* wait for all currently running threads to exit */
-	for (i = 0; i < tm->max_threads; i++) {
-		if (tm->thread_data[i].thread_id != THREAD_NULL) {
-			if ((rc = THREAD_JOIN(*(tm->thread_data[i].thread_id), NULL))) {
+	for (i = 0; i < tm->num_slots; i++) {
+		if (tm->thread_data[i]->thread_id != THREAD_NULL) {
+			if ((rc = THREAD_JOIN(*(tm->thread_data[i]->thread_id), NULL))) {
 				LogError("Thread join failed: error: %d", rc);
 			}
 		}
+		free(tm->thread_data[i]);
 	}
 
 	free(tm->thread_data);
@@ -60,6 +62,8 @@ tcsd_threads_final()
 TSS_RESULT
 tcsd_threads_init(void)
 {
+	TSS_RESULT result;
+
 	/* allocate the thread mgmt structure */
 	tm = calloc(1, sizeof(struct tcsd_thread_mgr));
 	if (tm == NULL) {
@@ -69,29 +73,80 @@ tcsd_threads_init(void)
 	/* initialize mutex */
 	MUTEX_INIT(tm->lock);
 
-	/* set the max threads variable from config */
-	tm->max_threads = tcsd_options.num_threads;
-
-	/* allocate each thread's data structure */
-	tm->thread_data = calloc(tcsd_options.num_threads, sizeof(struct tcsd_thread_data));
-	if (tm->thread_data == NULL) {
-		LogError("malloc of %zu bytes failed.",
-			 tcsd_options.num_threads * sizeof(struct tcsd_thread_data));
+	/* set the max threads variable from config and allocate each thread's data structure */
+	if ((result = tcsd_threads_resize(tcsd_options.num_threads))) {
 		free(tm);
-		return TCSERR(TSS_E_OUTOFMEMORY);
+		return result;
 	}
 
 	return TSS_SUCCESS;
 }
 
+/*
+ * Change the number of connections served at once. Each running thread holds on to its slot's
+ * data, so slots are allocated one by one and never freed before shutdown. With a lower limit,
+ * connections over it are served until they close, and new ones are refused until the number
+ * drops below it.
+ */
+TSS_RESULT
+tcsd_threads_resize(UINT32 num_threads)
+{
+	struct tcsd_thread_data **slots;
+	TSS_RESULT result = TSS_SUCCESS;
+
+	MUTEX_LOCK(tm->lock);
+
+	if (num_threads > tm->num_slots) {
+		slots = realloc(tm->thread_data, num_threads * sizeof(struct tcsd_thread_data *));
+		if (slots == NULL) {
+			LogError("malloc of %zu bytes failed.",
+				 num_threads * sizeof(struct tcsd_thread_data *));
+			result = TCSERR(TSS_E_OUTOFMEMORY);
+			goto done;
+		}
+		tm->thread_data = slots;
+
+		for (; tm->num_slots < num_threads; tm->num_slots++) {
+			slots[tm->num_slots] = calloc(1, sizeof(struct tcsd_thread_data));
+			if (slots[tm->num_slots] == NULL) {
+				LogError("malloc of %zd bytes failed.",
+					 sizeof(struct tcsd_thread_data));
+				result = TCSERR(TSS_E_OUTOFMEMORY);
+				goto done;
+			}
+		}
+	}
+
+	if (tm->max_threads && tm->max_threads != num_threads)
+		LogInfo("Serving up to %u connections, was %u.", num_threads, tm->max_threads);
+	tm->max_threads = num_threads;
+done:
+	MUTEX_UNLOCK(tm->lock);
+
+	return result;
+}
+
 
 TSS_RESULT
-tcsd_thread_create(int socket, char *hostname)
+tcsd_thread_create(int socket, struct sockaddr_in *addr)
 {
 	UINT32 thread_num = -1;
 	int rc = TCS_SUCCESS;
+	char buf[INET_ADDRSTRLEN], *hostname;
 #ifndef TCSD_SINGLE_THREAD_DEBUG
 	THREAD_ATTR_DECLARE(tcsd_thread_attr);
+#endif
+
+	/* peers are only known by address, so that accepting doesn't wait on DNS */
+	if (inet_ntop(AF_INET, &addr->sin_addr, buf, sizeof(buf)) == NULL)
+		strcpy(buf, "unknown");
+	if ((hostname = strdup(buf)) == NULL) {
+		LogError("malloc of %zd bytes failed.", strlen(buf) + 1);
+		close(socket);
+		return TCSERR(TSS_E_OUTOFMEMORY);
+	}
+
+#ifndef TCSD_SINGLE_THREAD_DEBUG
 
 	/* init the thread attribute */
 	if ((rc = THREAD_ATTR_INIT(tcsd_thread_attr))) {
@@ -108,14 +163,9 @@ tcsd_thread_create(int socket, char *hostname)
 
 	MUTEX_LOCK(tm->lock);
 #endif
-	if (tm->num_active_threads == tm->max_threads) {
-		if (hostname != NULL) {
-			LogError("max number of connections reached (%d), new connection"
-				 " from %s refused.", tm->max_threads, hostname);
-		} else {
-			LogError("max number of connections reached (%d), new connection"
-				 " refused.", tm->max_threads);
-		}
+	if (tm->num_active_threads >= tm->max_threads) {
+		LogError("max number of connections reached (%d), new connection"
+			 " from %s refused.", tm->max_threads, hostname);
 		rc = TCSERR(TSS_E_CONNECTION_FAILED);
 #ifndef TCSD_SINGLE_THREAD_DEBUG
 		goto out_unlock;
@@ -124,33 +174,44 @@ tcsd_thread_create(int socket, char *hostname)
 #endif
 	}
 
-	/* search for an open slot to store the thread data in */
-	for (thread_num = 0; thread_num < tm->max_threads; thread_num++) {
-		if (tm->thread_data[thread_num].thread_id == THREAD_NULL)
+	/* search for an open slot to store the thread data in. There's always one, since there
+	 * are at least max_threads slots */
+	for (thread_num = 0; thread_num < tm->num_slots; thread_num++) {
+		if (tm->thread_data[thread_num]->thread_id == THREAD_NULL)
 			break;
 	}
 
-	DBG_ASSERT(thread_num != tm->max_threads);
+	DBG_ASSERT(thread_num != tm->num_slots);
+
+	tm->thread_data[thread_num]->hostname = hostname;
+	if (access_control_init(tm->thread_data[thread_num], addr)) {
+		LogWarn("New connection from %s refused, it may not use any TCS operations.",
+			hostname);
+		rc = TCSERR(TSS_E_CONNECTION_FAILED);
+#ifndef TCSD_SINGLE_THREAD_DEBUG
+		goto out_unlock;
+#else
+		goto out;
+#endif
+	}
 
-	tm->thread_data[thread_num].sock = socket;
-	tm->thread_data[thread_num].context = NULL_TCS_HANDLE;
-	if (hostname != NULL)
-		tm->thread_data[thread_num].hostname = hostname;
+	tm->thread_data[thread_num]->sock = socket;
+	tm->thread_data[thread_num]->context = NULL_TCS_HANDLE;
 
 #ifdef TCSD_SINGLE_THREAD_DEBUG
-	(void)tcsd_thread_run((void *)(&(tm->thread_data[thread_num])));
+	(void)tcsd_thread_run((void *)(tm->thread_data[thread_num]));
 #else
-	tm->thread_data[thread_num].thread_id = calloc(1, sizeof(THREAD_TYPE));
-	if (tm->thread_data[thread_num].thread_id == NULL) {
+	tm->thread_data[thread_num]->thread_id = calloc(1, sizeof(THREAD_TYPE));
+	if (tm->thread_data[thread_num]->thread_id == NULL) {
 		rc = TCSERR(TSS_E_OUTOFMEMORY);
 		LogError("malloc of %zd bytes failed.", sizeof(THREAD_TYPE));
 		goto out_unlock;
 	}
 
-	if ((rc = THREAD_CREATE(tm->thread_data[thread_num].thread_id,
+	if ((rc = THREAD_CREATE(tm->thread_data[thread_num]->thread_id,
 				 &tcsd_thread_attr,
 				 tcsd_thread_run,
-				 (void *)(&(tm->thread_data[thread_num]))))) {
+				 (void *)(tm->thread_data[thread_num])))) {
 		LogError("Thread create failed: %d", rc);
 		rc = TCSERR(TSS_E_INTERNAL_ERROR);
 		goto out_unlock;
@@ -164,10 +225,10 @@ out_unlock:
 out:
 	/* cleanup in case of error */
 	if (rc != TCS_SUCCESS) {
-		if (hostname != NULL) {
-			tm->thread_data[thread_num].hostname = NULL;
-			free(hostname);
-		}
+		/* thread_num is still -1 if no slot was picked */
+		if (thread_num < tm->num_slots)
+			tm->thread_data[thread_num]->hostname = NULL;
+		free(hostname);
 		close(socket);
 	}
 	return rc;
@@ -390,7 +451,11 @@ tcsd_thread_run(void *v)
 		UnloadBlob_UINT32(&offset, &data->comm.hdr.parm_size, data->comm.buf);
 		UnloadBlob_UINT32(&offset, &data->comm.hdr.parm_offset, data->comm.buf);
 
-		if ((result = getTCSDPacket(data)) != TSS_SUCCESS) {
+		/* the whole request sees one config, even if it's reloaded meanwhile */
+		tcsd_conf_pin();
+		result = getTCSDPacket(data);
+		tcsd_conf_unpin();
+		if (result != TSS_SUCCESS) {
 			/* something internal to the TCSD went wrong in preparing the packet
 			 * to return to the TSP.  Use our already allocated buffer to return a
 			 * TSS_E_INTERNAL_ERROR return code to the TSP. In the non-error path,
@@ -427,7 +492,9 @@ tcsd_thread_run(void *v)
 	data->comm.buf_size = -1;
 	/* If the connection was not shut down cleanly, free TCS resources here */
 	if (data->context != NULL_TCS_HANDLE) {
+		tcsd_conf_pin();
 		TCS_CloseContext_Internal(data->context);
+		tcsd_conf_unpin();
 		data->context = NULL_TCS_HANDLE;
 	}
 	if(data->hostname != NULL) {
@@ -14,6 +14,8 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/ioctl.h>
 
 #include "trousers/tss.h"
@@ -29,12 +31,219 @@ struct tpm_device_node tpm_device_nodes[] = {
 	{NULL, 0, 0}
 };
 
-struct tpm_device_node *opened_device = NULL;
-
-BYTE txBuffer[TDDL_TXBUF_SIZE];
-TSS_BOOL use_in_socket = FALSE;
 struct tcsd_config *_tcsd_options = NULL;
 
+/*
+ * Maximum command durations in milliseconds for the TPM's short, medium and long duration
+ * classes. These are generous defaults until the TPM reports its own through
+ * TPM_CAP_PROP_DURATION, see Tddli_SetDurations().
+ */
+static const UINT32 default_durations[TDDL_DURATION_CLASSES] = { 2000, 20000, 300000 };
+
+/*
+ * Health of a device. A command that runs past its deadline leaves the TPM (or the driver)
+ * busy with it, and everything sent after it would just queue up behind it, so until the late
+ * response has been collected requests fail straight away. Every TDDL_PROBE_INTERVAL seconds one
+ * request checks whether the response has shown up in the meantime.
+ */
+#define TDDL_PROBE_INTERVAL	5
+
+/* One TPM. Device 0 is the one the TCG interface, Tddli_Open() and the rest, works on */
+struct tddl_device {
+	struct tpm_device_node node;	/* the node named by the tpm_device option, if any */
+	struct tpm_device_node *opened;	/* the node in use, NULL while the device is closed */
+	BYTE txBuffer[TDDL_TXBUF_SIZE];
+	TSS_BOOL use_in_socket;
+	char cancel_path[64];		/* sysfs file that cancels the command in progress on the
+					   opened node, if it has one */
+	UINT32 durations[TDDL_DURATION_CLASSES];
+	int health;
+	time_t next_probe;
+};
+
+static struct tddl_device tddl_devices[TCSD_MAX_TPM_DEVICES];
+
+/*
+ * Ordinals that aren't in the short class, sorted by ordinal. Taken from the duration column of
+ * the TPM 1.2 main specification's ordinal table.
+ */
+static const struct {
+	UINT32 ordinal;
+	int class;
+} ordinal_durations[] = {
+	{ TPM_ORD_ChangeAuth,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_TakeOwnership,		TDDL_DURATION_LONG },
+	{ TPM_ORD_ChangeAuthAsymStart,		TDDL_DURATION_LONG },
+	{ TPM_ORD_ChangeAuthAsymFinish,		TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_CMK_CreateKey,		TDDL_DURATION_LONG },
+	{ TPM_ORD_Quote,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_Seal,				TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_Unseal,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_CMK_CreateBlob,		TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_UnBind,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_CreateWrapKey,		TDDL_DURATION_LONG },
+	{ TPM_ORD_LoadKey,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_CMK_ConvertMigration,		TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_MigrateKey,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_CreateMigrationBlob,		TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_DAA_Join,			TDDL_DURATION_LONG },
+	{ TPM_ORD_ConvertMigrationBlob,		TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_CreateMaintenanceArchive,	TDDL_DURATION_LONG },
+	{ TPM_ORD_LoadMaintenanceArchive,	TDDL_DURATION_LONG },
+	{ TPM_ORD_DAA_Sign,			TDDL_DURATION_LONG },
+	{ TPM_ORD_CertifyKey,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_CertifyKey2,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_Sign,				TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_Sealx,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_Quote2,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_LoadKey2,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_GetRandom,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_SelfTestFull,			TDDL_DURATION_LONG },
+	{ TPM_ORD_CertifySelfTest,		TDDL_DURATION_LONG },
+	{ TPM_ORD_ContinueSelfTest,		TDDL_DURATION_LONG },
+	{ TPM_ORD_OwnerClear,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_ForceClear,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_CreateEndorsementKeyPair,	TDDL_DURATION_LONG },
+	{ TPM_ORD_MakeIdentity,			TDDL_DURATION_LONG },
+	{ TPM_ORD_ActivateIdentity,		TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_CreateRevocableEK,		TDDL_DURATION_LONG },
+	{ TPM_ORD_GetAuditDigestSigned,		TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_SaveState,			TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_Delegate_CreateKeyDelegation,	TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_EstablishTransport,		TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_ExecuteTransport,		TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_ReleaseTransportSigned,	TDDL_DURATION_MEDIUM },
+	{ TPM_ORD_TickStampBlob,		TDDL_DURATION_MEDIUM },
+	{ 0, 0 }
+};
+
+static UINT32
+get_uint32(BYTE *b)
+{
+	return ((UINT32)b[0] << 24) | ((UINT32)b[1] << 16) | ((UINT32)b[2] << 8) | b[3];
+}
+
+static int
+ordinal_duration_class(UINT32 ordinal)
+{
+	int i;
+
+	for (i = 0; ordinal_durations[i].ordinal; i++) {
+		if (ordinal_durations[i].ordinal == ordinal)
+			return ordinal_durations[i].class;
+		if (ordinal_durations[i].ordinal > ordinal)
+			break;
+	}
+
+	return TDDL_DURATION_SHORT;
+}
+
+/* How long the command in @buf may take, in milliseconds */
+static UINT32
+command_duration(struct tddl_device *d, BYTE *buf, UINT32 len)
+{
+	UINT32 ordinal, inner;
+	int class;
+
+	if (len < TSS_TPM_TXBLOB_HDR_LEN)
+		return d->durations[TDDL_DURATION_SHORT];
+
+	ordinal = get_uint32(&buf[6]);
+	class = ordinal_duration_class(ordinal);
+
+	/* a wrapped command takes as long as the command inside it, at least */
+	if (ordinal == TPM_ORD_ExecuteTransport &&
+	    len >= TSS_TPM_TXBLOB_HDR_LEN + sizeof(UINT32) + TSS_TPM_TXBLOB_HDR_LEN) {
+		inner = get_uint32(&buf[TSS_TPM_TXBLOB_HDR_LEN + sizeof(UINT32) + 6]);
+		if (ordinal_duration_class(inner) > class)
+			class = ordinal_duration_class(inner);
+	}
+
+	return d->durations[class];
+}
+
+static UINT32
+elapsed_ms(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Wait until the response to the command sent at @start is ready or @timeout ms have passed */
+static TSS_RESULT
+wait_for_response(struct tddl_device *d, struct timespec *start, UINT32 timeout)
+{
+	struct pollfd pfd;
+	UINT32 elapsed;
+	int rc;
+
+	pfd.fd = d->opened->fd;
+	pfd.events = POLLIN;
+
+	while ((elapsed = elapsed_ms(start)) < timeout) {
+		if ((rc = poll(&pfd, 1, timeout - elapsed)) > 0)
+			return TSS_SUCCESS;
+		if (rc < 0 && errno != EINTR) {
+			LogError("poll on device %s failed: %s", d->opened->path,
+				 strerror(errno));
+			return TDDLERR(TDDL_E_IOERROR);
+		}
+	}
+
+	return TDDLERR(TDDL_E_TIMEOUT);
+}
+
+/*
+ * Called with the device marked stuck. Fails fast until the next probe is due, then collects and
+ * throws away the late response if it has arrived.
+ */
+static TSS_RESULT
+probe_device(struct tddl_device *d)
+{
+	struct pollfd pfd;
+	time_t now = time(NULL);
+
+	if (now < d->next_probe)
+		return TDDLERR(TDDL_E_TIMEOUT);
+
+	/* a socket connection is opened anew for every command, so there's nothing to collect */
+	if (!d->use_in_socket) {
+		pfd.fd = d->opened->fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) != 1) {
+			d->next_probe = now + TDDL_PROBE_INTERVAL;
+			return TDDLERR(TDDL_E_TIMEOUT);
+		}
+
+		(void)read(d->opened->fd, d->txBuffer, TDDL_TXBUF_SIZE);
+	}
+
+	LogInfo("TPM device %s is responding again", d->opened->path);
+	d->health = TDDL_DEVICE_OK;
+
+	return TSS_SUCCESS;
+}
+
+static void
+find_cancel_path(struct tddl_device *d, const char *dev)
+{
+	const char *name = strrchr(dev, '/') ? strrchr(dev, '/') + 1 : dev;
+
+	snprintf(d->cancel_path, sizeof(d->cancel_path), "/sys/class/tpm/%s/device/cancel", name);
+	if (access(d->cancel_path, W_OK) == 0)
+		return;
+
+	snprintf(d->cancel_path, sizeof(d->cancel_path), "/sys/class/misc/%s/device/cancel",
+		 name);
+	if (access(d->cancel_path, W_OK) == 0)
+		return;
+
+	d->cancel_path[0] = '\0';
+}
+
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <netinet/in.h>
@@ -43,15 +252,17 @@ struct tcsd_config *_tcsd_options = NULL;
 #include <fcntl.h>
 
 
-int
-open_device()
+static int
+open_device(struct tddl_device *d, UINT32 device)
 {
 	int i = 0, fd = -1, tcp_device_port;
+	struct tpm_device_node *node = NULL;
 	char *tcp_device_hostname = NULL;
 	char *un_socket_device_path = NULL;
 	char *tcp_device_port_string = NULL;
 	
-	if (getenv("TCSD_USE_TCP_DEVICE")) {
+	/* a software TPM reached through a socket can only stand in for the first device */
+	if (device == 0 && getenv("TCSD_USE_TCP_DEVICE")) {
 		if ((tcp_device_hostname = getenv("TCSD_TCP_DEVICE_HOSTNAME")) == NULL)
 			tcp_device_hostname = "localhost";
 		if ((un_socket_device_path = getenv("TCSD_UN_SOCKET_DEVICE_PATH")) == NULL)
@@ -78,7 +289,7 @@ open_device()
 					close(fd);
 					fd = -1;
 				} else
-					use_in_socket = TRUE;
+					d->use_in_socket = TRUE;
 			} else {
 				close (fd);
 				fd = -1;
@@ -101,33 +312,78 @@ open_device()
 		}
 	} 
 	
-	if (fd < 0) {
+	if (fd < 0 && _tcsd_options && _tcsd_options->num_tpm_devices) {
+		if (device >= _tcsd_options->num_tpm_devices) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		/* open the configured device only, falling back to another TPM would be wrong */
+		node = &d->node;
+		node->path = _tcsd_options->tpm_devices[device];
+		if ((fd = open(node->path, O_RDWR | O_NONBLOCK)) >= 0)
+			find_cancel_path(d, node->path);
+		else
+			LogError("Could not open the configured TPM device %s: %s", node->path,
+				 strerror(errno));
+	} else if (fd < 0 && device > 0) {
+		/* without a tpm_device list there's only the one TPM found below */
+		errno = ENOENT;
+		return -1;
+	} else if (fd < 0) {
 		/* tpm_device_paths is filled out in tddl.h */
 		for (i = 0; tpm_device_nodes[i].path != NULL; i++) {
 			errno = 0;
-			if ((fd = open(tpm_device_nodes[i].path, O_RDWR)) >= 0)
+			/* drivers that support it queue the command on write and signal the
+			 * response through poll, so a command can be given up on */
+			if ((fd = open(tpm_device_nodes[i].path, O_RDWR | O_NONBLOCK)) >= 0) {
+				find_cancel_path(d, tpm_device_nodes[i].path);
 				break;
+			}
 		}
 	}
 	
 	if (fd > 0) {
-		opened_device = &(tpm_device_nodes[i]);
-		tpm_device_nodes[i].fd = fd;
+		if (node == NULL)
+			node = &(tpm_device_nodes[i]);
+		d->opened = node;
+		node->fd = fd;
 	}
 	return fd;
 }
 
+
+static struct tddl_device *
+get_device(UINT32 device)
+{
+	if (device >= TCSD_MAX_TPM_DEVICES)
+		return NULL;
+
+	return &tddl_devices[device];
+}
+
 TSS_RESULT
-Tddli_Open()
+Tddli_OpenDevice(UINT32 device)
 {
+	struct tddl_device *d;
 	int rc;
 
-	if (opened_device != NULL) {
+	if ((d = get_device(device)) == NULL)
+		return TDDLERR(TDDL_E_COMPONENT_NOT_FOUND);
+
+	if (d->opened != NULL) {
 		LogDebug("attempted to re-open the TPM driver!");
 		return TDDLERR(TDDL_E_ALREADY_OPENED);
 	}
 
-	rc = open_device();
+	/* the socket device is reopened for every command, which mustn't lose what the TPM
+	 * reported */
+	if (d->durations[TDDL_DURATION_SHORT] == 0) {
+		memcpy(d->durations, default_durations, sizeof(d->durations));
+		d->health = TDDL_DEVICE_OK;
+	}
+
+	rc = open_device(d, device);
 	if (rc < 0) {
 		LogError("Could not find a device to open!");
 		if (errno == ENOENT) {
@@ -142,69 +398,150 @@ Tddli_Open()
 }
 
 TSS_RESULT
-Tddli_Close()
+Tddli_Open()
+{
+	return Tddli_OpenDevice(0);
+}
+
+TSS_RESULT
+Tddli_CloseDevice(UINT32 device)
 {
-	if (opened_device == NULL) {
+	struct tddl_device *d;
+
+	if ((d = get_device(device)) == NULL || d->opened == NULL) {
 		LogDebug("attempted to re-close the TPM driver!");
 		return TDDLERR(TDDL_E_ALREADY_CLOSED);
 	}
 
-	close(opened_device->fd);
-	opened_device->fd = TDDL_UNDEF;
-	opened_device = NULL;
+	close(d->opened->fd);
+	d->opened->fd = TDDL_UNDEF;
+	d->opened = NULL;
 
 	return TSS_SUCCESS;
 }
 
 TSS_RESULT
-Tddli_TransmitData(BYTE * pTransmitBuf, UINT32 TransmitBufLen, BYTE * pReceiveBuf,
-		   UINT32 * pReceiveBufLen)
+Tddli_Close()
+{
+	return Tddli_CloseDevice(0);
+}
+
+/*
+ * Set the duration classes from the TPM_CAP_PROP_DURATION values the TPM reported, which are in
+ * microseconds.
+ */
+void
+Tddli_SetDurationsDevice(UINT32 device, UINT32 shortDuration, UINT32 mediumDuration,
+			 UINT32 longDuration)
+{
+	UINT32 reported[TDDL_DURATION_CLASSES] = { shortDuration, mediumDuration, longDuration };
+	UINT32 scale = 1;
+	struct tddl_device *d;
+	int i;
+
+	if ((d = get_device(device)) == NULL)
+		return;
+
+	/* some TPMs report milliseconds instead. No real TPM finishes a command in under 10ms */
+	if (shortDuration && shortDuration < 10000)
+		scale = 1000;
+
+	for (i = 0; i < TDDL_DURATION_CLASSES; i++) {
+		/* keep the default for a class the TPM left out */
+		if (reported[i] == 0)
+			continue;
+
+		if ((d->durations[i] = reported[i] * scale / 1000) == 0)
+			d->durations[i] = 1;
+	}
+
+	LogDebug("TPM %u command durations: short %ums, medium %ums, long %ums", device,
+		 d->durations[TDDL_DURATION_SHORT], d->durations[TDDL_DURATION_MEDIUM],
+		 d->durations[TDDL_DURATION_LONG]);
+}
+
+void
+Tddli_SetDurations(UINT32 shortDuration, UINT32 mediumDuration, UINT32 longDuration)
+{
+	Tddli_SetDurationsDevice(0, shortDuration, mediumDuration, longDuration);
+}
+
+TSS_RESULT
+Tddli_TransmitDataDevice(UINT32 device, BYTE * pTransmitBuf, UINT32 TransmitBufLen,
+			 BYTE * pReceiveBuf, UINT32 * pReceiveBufLen)
 {
 	int sizeResult;
+	UINT32 timeout;
+	struct timespec start;
+	struct tddl_device *d;
+	TSS_RESULT result;
+
+	if ((d = get_device(device)) == NULL || d->opened == NULL)
+		return TDDLERR(TDDL_E_FAIL);
 
 	if (TransmitBufLen > TDDL_TXBUF_SIZE) {
 		LogError("buffer size handed to TDDL is too large! (%u bytes)", TransmitBufLen);
 		return TDDLERR(TDDL_E_FAIL);
 	}
 
-	memcpy(txBuffer, pTransmitBuf, TransmitBufLen);
+	if (d->health != TDDL_DEVICE_OK && (result = probe_device(d)))
+		return result;
+
+	timeout = command_duration(d, pTransmitBuf, TransmitBufLen);
+	memcpy(d->txBuffer, pTransmitBuf, TransmitBufLen);
 	LogDebug("Calling write to driver");
 
-	if (use_in_socket) {
-		Tddli_Close();
-		if (Tddli_Open())
+	if (d->use_in_socket) {
+		Tddli_CloseDevice(device);
+		if (Tddli_OpenDevice(device))
 			return TDDLERR(TDDL_E_IOERROR);
 	}
 
-	switch (opened_device->transmit) {
+	switch (d->opened->transmit) {
 		case TDDL_UNDEF:
 			/* fall through */
 		case TDDL_TRANSMIT_IOCTL:
+			/* the transmit ioctl blocks until the TPM is done, there's no deadline
+			 * on this path */
 			errno = 0;
-			if ((sizeResult = ioctl(opened_device->fd, TPMIOC_TRANSMIT, txBuffer)) != -1) {
-				opened_device->transmit = TDDL_TRANSMIT_IOCTL;
+			if ((sizeResult = ioctl(d->opened->fd, TPMIOC_TRANSMIT,
+						d->txBuffer)) != -1) {
+				d->opened->transmit = TDDL_TRANSMIT_IOCTL;
 				break;
 			}
 			LogWarn("ioctl: (%d) %s", errno, strerror(errno));
 			LogInfo("Falling back to Read/Write device support.");
 			/* fall through */
 		case TDDL_TRANSMIT_RW:
-			if ((sizeResult = write(opened_device->fd,
-						txBuffer,
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			if ((sizeResult = write(d->opened->fd,
+						d->txBuffer,
 						TransmitBufLen)) == (int)TransmitBufLen) {
-				opened_device->transmit = TDDL_TRANSMIT_RW;
-				sizeResult = read(opened_device->fd, txBuffer,
+				d->opened->transmit = TDDL_TRANSMIT_RW;
+				if ((result = wait_for_response(d, &start, timeout))) {
+					if (result == TDDLERR(TDDL_E_TIMEOUT)) {
+						LogError("TPM ordinal 0x%x did not complete "
+							 "within %ums",
+							 get_uint32(&d->txBuffer[6]),
+							 timeout);
+						(void)Tddli_CancelDevice(device);
+						d->health = TDDL_DEVICE_RECOVERABLE;
+						d->next_probe = time(NULL) + TDDL_PROBE_INTERVAL;
+					}
+					return result;
+				}
+				sizeResult = read(d->opened->fd, d->txBuffer,
 						  TDDL_TXBUF_SIZE);
 				break;
 			} else {
 				if (sizeResult == -1) {
 					LogError("write to device %s failed: %s",
-						 opened_device->path,
+						 d->opened->path,
 						 strerror(errno));
 				} else {
 					LogError("wrote %d bytes to %s (tried "
 						 "to write %d)", sizeResult,
-						 opened_device->path,
+						 d->opened->path,
 						 TransmitBufLen);
 				}
 			}
@@ -214,29 +551,59 @@ Tddli_TransmitData(BYTE * pTransmitBuf, UINT32 TransmitBufLen, BYTE * pReceiveBu
 	}
 
 	if (sizeResult < 0) {
-		LogError("read from device %s failed: %s", opened_device->path, strerror(errno));
+		LogError("read from device %s failed: %s", d->opened->path, strerror(errno));
 		return TDDLERR(TDDL_E_IOERROR);
 	} else if (sizeResult == 0) {
-		LogError("Zero bytes read from device %s", opened_device->path);
+		LogError("Zero bytes read from device %s", d->opened->path);
 		return TDDLERR(TDDL_E_IOERROR);
 	}
 
 	if ((unsigned)sizeResult > *pReceiveBufLen) {
 		LogError("read %d bytes from device %s, (only room for %d)", sizeResult,
-				opened_device->path, *pReceiveBufLen);
+				d->opened->path, *pReceiveBufLen);
 		return TDDLERR(TDDL_E_INSUFFICIENT_BUFFER);
 	}
 
 	*pReceiveBufLen = sizeResult;
 
-	memcpy(pReceiveBuf, txBuffer, *pReceiveBufLen);
+	memcpy(pReceiveBuf, d->txBuffer, *pReceiveBufLen);
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+Tddli_TransmitData(BYTE * pTransmitBuf, UINT32 TransmitBufLen, BYTE * pReceiveBuf,
+		   UINT32 * pReceiveBufLen)
+{
+	return Tddli_TransmitDataDevice(0, pTransmitBuf, TransmitBufLen, pReceiveBuf,
+					pReceiveBufLen);
+}
+
+TSS_RESULT
+Tddli_GetStatusDevice(UINT32 device, UINT32 ReqStatusType, UINT32 *pStatus)
+{
+	struct tddl_device *d;
+
+	if ((d = get_device(device)) == NULL)
+		return TDDLERR(TSS_E_BAD_PARAMETER);
+
+	switch (ReqStatusType) {
+		case TDDL_DRIVER_STATUS:
+			*pStatus = d->opened ? TDDL_DRIVER_OK : TDDL_DRIVER_NOT_OPENED;
+			break;
+		case TDDL_DEVICE_STATUS:
+			*pStatus = d->opened ? (UINT32)d->health : TDDL_DEVICE_NOT_FOUND;
+			break;
+		default:
+			return TDDLERR(TSS_E_BAD_PARAMETER);
+	}
+
 	return TSS_SUCCESS;
 }
 
 TSS_RESULT
 Tddli_GetStatus(UINT32 ReqStatusType, UINT32 *pStatus)
 {
-	return TDDLERR(TSS_E_NOTIMPL);
+	return Tddli_GetStatusDevice(0, ReqStatusType, pStatus);
 }
 
 TSS_RESULT
@@ -253,12 +620,17 @@ Tddli_GetCapability(UINT32 CapArea, UINT32 SubCap,
 	return TDDLERR(TSS_E_NOTIMPL);
 }
 
-TSS_RESULT Tddli_Cancel(void)
+TSS_RESULT
+Tddli_CancelDevice(UINT32 device)
 {
+	struct tddl_device *d;
 	int rc;
 
-	if (opened_device->transmit == TDDL_TRANSMIT_IOCTL) {
-		if ((rc = ioctl(opened_device->fd, TPMIOC_CANCEL, NULL)) == -1) {
+	if ((d = get_device(device)) == NULL || d->opened == NULL)
+		return TDDLERR(TDDL_E_FAIL);
+
+	if (d->opened->transmit == TDDL_TRANSMIT_IOCTL) {
+		if ((rc = ioctl(d->opened->fd, TPMIOC_CANCEL, NULL)) == -1) {
 			LogError("ioctl: (%d) %s", errno, strerror(errno));
 			return TDDLERR(TDDL_E_FAIL);
 		} else if (rc == -EIO) {
@@ -266,8 +638,30 @@ TSS_RESULT Tddli_Cancel(void)
 			return TDDLERR(TDDL_E_COMMAND_COMPLETED);
 		}
 
+		return TSS_SUCCESS;
+	} else if (d->cancel_path[0]) {
+		int fd;
+
+		/* read/write driver: cancel through sysfs */
+		if ((fd = open(d->cancel_path, O_WRONLY)) < 0) {
+			LogError("open of %s failed: %s", d->cancel_path, strerror(errno));
+			return TDDLERR(TDDL_E_FAIL);
+		}
+
+		rc = write(fd, "1", 1);
+		close(fd);
+		if (rc != 1) {
+			LogError("write to %s failed: %s", d->cancel_path, strerror(errno));
+			return TDDLERR(TDDL_E_FAIL);
+		}
+
 		return TSS_SUCCESS;
 	} else {
 		return TDDLERR(TSS_E_NOTIMPL);
 	}
 }
+
+TSS_RESULT Tddli_Cancel(void)
+{
+	return Tddli_CancelDevice(0);
+}
@@ -15,6 +15,7 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <openssl/opensslv.h>
@@ -47,42 +48,169 @@ int MGF1(unsigned char *, long, const unsigned char *, long);
 #define OpenSSL_MGF1(m,mlen,s,slen,md)	MGF1(m,mlen,s,slen)
 #endif
 
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+#define EVP_MD_CTX_new()	EVP_MD_CTX_create()
+#define EVP_MD_CTX_free(c)	EVP_MD_CTX_destroy(c)
+#endif
+
 /*
  * Hopefully this will make the code clearer since
  * OpenSSL returns 1 on success
  */
 #define EVP_SUCCESS 1
 
+/* The state behind a Trspi_HashCtx. Updates smaller than the buffer, such as the ones made by
+ * the Trspi_Hash_UINT32 style helpers, are collected in @buf and handed to OpenSSL together */
+#define TRSPI_HASH_BUF_SIZE	128
+
+struct trspi_hash_state {
+	EVP_MD_CTX *md_ctx;
+	UINT32 used;
+	BYTE buf[TRSPI_HASH_BUF_SIZE];
+	struct trspi_hash_state *next;
+};
+
+/* Each thread keeps a few idle hash states around, so that a digest doesn't cost an
+ * allocation and an OpenSSL context setup every time. More than one is needed since digests
+ * are often nested, for instance a parameter digest computed while hashing a key blob */
+#define TRSPI_HASH_CACHE_MAX	4
+
+struct trspi_hash_cache {
+	UINT32 num;
+	struct trspi_hash_state *head;
+};
+
+static THREAD_KEY_DECLARE(hash_cache_key);
+static THREAD_ONCE_DECLARE_INIT(hash_cache_once);
+static TSS_BOOL hash_cache_enabled = FALSE;
+
+static void
+hash_state_free(struct trspi_hash_state *state)
+{
+	EVP_MD_CTX_free(state->md_ctx);
+	free(state);
+}
+
+static void
+hash_cache_destroy(void *data)
+{
+	struct trspi_hash_cache *cache = (struct trspi_hash_cache *)data;
+	struct trspi_hash_state *state, *next;
+
+	for (state = cache->head; state; state = next) {
+		next = state->next;
+		hash_state_free(state);
+	}
+
+	free(cache);
+}
+
+static void
+hash_cache_init(void)
+{
+	if (THREAD_KEY_CREATE(hash_cache_key, hash_cache_destroy) == 0)
+		hash_cache_enabled = TRUE;
+}
+
+static struct trspi_hash_state *
+hash_state_get(void)
+{
+	struct trspi_hash_cache *cache = NULL;
+	struct trspi_hash_state *state;
+
+	THREAD_ONCE(hash_cache_once, hash_cache_init);
+
+	if (hash_cache_enabled)
+		cache = (struct trspi_hash_cache *)THREAD_KEY_GET(hash_cache_key);
+
+	if (cache && cache->head) {
+		state = cache->head;
+		cache->head = state->next;
+		cache->num--;
+		state->used = 0;
+		return state;
+	}
+
+	if ((state = malloc(sizeof(struct trspi_hash_state))) == NULL)
+		return NULL;
+
+	if ((state->md_ctx = EVP_MD_CTX_new()) == NULL) {
+		free(state);
+		return NULL;
+	}
+	state->used = 0;
+
+	return state;
+}
+
+static void
+hash_state_put(struct trspi_hash_state *state)
+{
+	struct trspi_hash_cache *cache = NULL;
+
+	/* the buffer may have held secrets */
+	memset(state->buf, 0, sizeof(state->buf));
+
+	if (hash_cache_enabled) {
+		cache = (struct trspi_hash_cache *)THREAD_KEY_GET(hash_cache_key);
+		if (cache == NULL && (cache = calloc(1, sizeof(struct trspi_hash_cache)))) {
+			if (THREAD_KEY_SET(hash_cache_key, cache)) {
+				free(cache);
+				cache = NULL;
+			}
+		}
+	}
+
+	if (cache == NULL || cache->num >= TRSPI_HASH_CACHE_MAX) {
+		hash_state_free(state);
+		return;
+	}
+
+	state->next = cache->head;
+	cache->head = state;
+	cache->num++;
+}
+
+static int
+hash_state_flush(struct trspi_hash_state *state)
+{
+	int rv = EVP_SUCCESS;
+
+	if (state->used) {
+		rv = EVP_DigestUpdate(state->md_ctx, state->buf, state->used);
+		state->used = 0;
+	}
+
+	return rv;
+}
+
 TSS_RESULT
 Trspi_Hash(UINT32 HashType, UINT32 BufSize, BYTE* Buf, BYTE* Digest)
 {
-	EVP_MD_CTX md_ctx;
+	struct trspi_hash_state *state;
 	unsigned int result_size;
 	int rv;
 
-	switch (HashType) {
-		case TSS_HASH_SHA1:
-			rv = EVP_DigestInit(&md_ctx, EVP_sha1());
-			break;
-		default:
-			rv = TSPERR(TSS_E_BAD_PARAMETER);
-			goto out;
-			break;
-	}
+	if (HashType != TSS_HASH_SHA1)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	if ((state = hash_state_get()) == NULL)
+		return TSPERR(TSS_E_OUTOFMEMORY);
 
+	rv = EVP_DigestInit_ex(state->md_ctx, EVP_sha1(), NULL);
 	if (rv != EVP_SUCCESS) {
 		rv = TSPERR(TSS_E_INTERNAL_ERROR);
 		goto err;
 	}
 
-	rv = EVP_DigestUpdate(&md_ctx, Buf, BufSize);
+	rv = EVP_DigestUpdate(state->md_ctx, Buf, BufSize);
 	if (rv != EVP_SUCCESS) {
 		rv = TSPERR(TSS_E_INTERNAL_ERROR);
 		goto err;
 	}
 
-	result_size = EVP_MD_CTX_size(&md_ctx);
-	rv = EVP_DigestFinal(&md_ctx, Digest, &result_size);
+	result_size = EVP_MD_CTX_size(state->md_ctx);
+	rv = EVP_DigestFinal_ex(state->md_ctx, Digest, &result_size);
 	if (rv != EVP_SUCCESS) {
 		rv = TSPERR(TSS_E_INTERNAL_ERROR);
 		goto err;
@@ -94,6 +222,7 @@ Trspi_Hash(UINT32 HashType, UINT32 BufSize, BYTE* Buf, BYTE* Digest)
 err:
 	DEBUG_print_openssl_errors();
 out:
+	hash_state_put(state);
         return rv;
 }
 
@@ -102,6 +231,7 @@ Trspi_HashInit(Trspi_HashCtx *ctx, UINT32 HashType)
 {
 	int rv;
 	EVP_MD *md;
+	struct trspi_hash_state *state;
 
 	switch (HashType) {
 		case TSS_HASH_SHA1:
@@ -112,23 +242,28 @@ Trspi_HashInit(Trspi_HashCtx *ctx, UINT32 HashType)
 			break;
 	}
 
-	if ((ctx->ctx = malloc(sizeof(EVP_MD_CTX))) == NULL)
+	if ((state = hash_state_get()) == NULL)
 		return TSPERR(TSS_E_OUTOFMEMORY);
 
-	rv = EVP_DigestInit((EVP_MD_CTX *)ctx->ctx, (const EVP_MD *)md);
+	rv = EVP_DigestInit_ex(state->md_ctx, (const EVP_MD *)md, NULL);
 
 	if (rv != EVP_SUCCESS) {
 		DEBUG_print_openssl_errors();
+		hash_state_put(state);
+		ctx->ctx = NULL;
 		return TSPERR(TSS_E_INTERNAL_ERROR);
 	}
 
+	ctx->ctx = state;
+
 	return TSS_SUCCESS;
 }
 
 TSS_RESULT
 Trspi_HashUpdate(Trspi_HashCtx *ctx, UINT32 size, BYTE *data)
 {
-	int rv;
+	struct trspi_hash_state *state;
+	int rv = EVP_SUCCESS;
 
 	if (ctx == NULL || ctx->ctx == NULL)
 		return TSPERR(TSS_E_INTERNAL_ERROR);
@@ -139,10 +274,26 @@ Trspi_HashUpdate(Trspi_HashCtx *ctx, UINT32 size, BYTE *data)
 	if (!size)
 		return TSS_SUCCESS;
 
-	rv = EVP_DigestUpdate(ctx->ctx, data, size);
+	state = (struct trspi_hash_state *)ctx->ctx;
+
+	if (size <= TRSPI_HASH_BUF_SIZE - state->used) {
+		memcpy(&state->buf[state->used], data, size);
+		state->used += size;
+		return TSS_SUCCESS;
+	}
+
+	rv = hash_state_flush(state);
+	if (rv == EVP_SUCCESS) {
+		if (size < TRSPI_HASH_BUF_SIZE) {
+			memcpy(state->buf, data, size);
+			state->used = size;
+		} else
+			rv = EVP_DigestUpdate(state->md_ctx, data, size);
+	}
+
 	if (rv != EVP_SUCCESS) {
 		DEBUG_print_openssl_errors();
-		free(ctx->ctx);
+		hash_state_put(state);
 		ctx->ctx = NULL;
 		return TSPERR(TSS_E_INTERNAL_ERROR);
 	}
@@ -153,20 +304,25 @@ Trspi_HashUpdate(Trspi_HashCtx *ctx, UINT32 size, BYTE *data)
 TSS_RESULT
 Trspi_HashFinal(Trspi_HashCtx *ctx, BYTE *digest)
 {
+	struct trspi_hash_state *state;
 	int rv;
 	UINT32 result_size;
 
 	if (ctx == NULL || ctx->ctx == NULL)
 		return TSPERR(TSS_E_INTERNAL_ERROR);
 
-	result_size = EVP_MD_CTX_size((EVP_MD_CTX *)ctx->ctx);
-	rv = EVP_DigestFinal(ctx->ctx, digest, &result_size);
-	if (rv != EVP_SUCCESS)
-		return TSPERR(TSS_E_INTERNAL_ERROR);
+	state = (struct trspi_hash_state *)ctx->ctx;
 
-	free(ctx->ctx);
+	result_size = EVP_MD_CTX_size(state->md_ctx);
+	if ((rv = hash_state_flush(state)) == EVP_SUCCESS)
+		rv = EVP_DigestFinal_ex(state->md_ctx, digest, &result_size);
+
+	hash_state_put(state);
 	ctx->ctx = NULL;
 
+	if (rv != EVP_SUCCESS)
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
 	return TSS_SUCCESS;
 }
 
@@ -195,6 +351,145 @@ out:
 	return rv;
 }
 
+/* The key schedule for an HMAC-SHA1 key: the hash states after absorbing the key XOR'd with
+ * the inner and outer pads. Starting a new HMAC from the schedule is an EVP_MD_CTX_copy_ex()
+ * into one of the thread's cached hash states */
+struct hmac_sha1_key {
+	EVP_MD_CTX *inner;
+	EVP_MD_CTX *outer;
+};
+
+#define HMAC_SHA1_BLOCK_SIZE	64
+
+static void
+hmac_sha1_key_free(struct hmac_sha1_key *hk)
+{
+	if (hk->inner)
+		EVP_MD_CTX_free(hk->inner);
+	if (hk->outer)
+		EVP_MD_CTX_free(hk->outer);
+	free(hk);
+}
+
+/* Absorb @Secret XOR'd with @padByte into a new SHA1 context */
+static EVP_MD_CTX *
+hmac_sha1_pad_ctx(BYTE padByte, UINT32 SecretSize, BYTE *Secret)
+{
+	BYTE pad[HMAC_SHA1_BLOCK_SIZE];
+	EVP_MD_CTX *md_ctx;
+	UINT32 i;
+
+	if ((md_ctx = EVP_MD_CTX_new()) == NULL)
+		return NULL;
+
+	memset(pad, padByte, sizeof(pad));
+	for (i = 0; i < SecretSize; i++)
+		pad[i] ^= Secret[i];
+
+	if (EVP_DigestInit_ex(md_ctx, EVP_sha1(), NULL) != EVP_SUCCESS ||
+	    EVP_DigestUpdate(md_ctx, pad, sizeof(pad)) != EVP_SUCCESS) {
+		DEBUG_print_openssl_errors();
+		EVP_MD_CTX_free(md_ctx);
+		md_ctx = NULL;
+	}
+
+	memset(pad, 0, sizeof(pad));
+
+	return md_ctx;
+}
+
+TSS_RESULT
+Trspi_HMAC_KeyInit(Trspi_HmacKey *k, UINT32 HashType, UINT32 SecretSize, BYTE *Secret)
+{
+	struct hmac_sha1_key *hk;
+	BYTE keyDigest[TPM_SHA1_160_HASH_LEN];
+	TSS_RESULT result = TSS_SUCCESS;
+
+	if (HashType != TSS_HASH_SHA1)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	if (Secret == NULL && SecretSize)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	/* keys longer than the block size are hashed first, per RFC 2104 */
+	if (SecretSize > HMAC_SHA1_BLOCK_SIZE) {
+		if ((result = Trspi_Hash(TSS_HASH_SHA1, SecretSize, Secret, keyDigest)))
+			return result;
+		Secret = keyDigest;
+		SecretSize = sizeof(keyDigest);
+	}
+
+	if ((hk = calloc(1, sizeof(struct hmac_sha1_key))) == NULL) {
+		result = TSPERR(TSS_E_OUTOFMEMORY);
+		goto done;
+	}
+
+	if ((hk->inner = hmac_sha1_pad_ctx(0x36, SecretSize, Secret)) == NULL ||
+	    (hk->outer = hmac_sha1_pad_ctx(0x5c, SecretSize, Secret)) == NULL) {
+		hmac_sha1_key_free(hk);
+		result = TSPERR(TSS_E_INTERNAL_ERROR);
+		goto done;
+	}
+
+	k->key = hk;
+done:
+	memset(keyDigest, 0, sizeof(keyDigest));
+
+	return result;
+}
+
+void
+Trspi_HMAC_KeyFree(Trspi_HmacKey *k)
+{
+	if (k->key == NULL)
+		return;
+
+	/* EVP_MD_CTX_free() cleanses the padded key states */
+	hmac_sha1_key_free((struct hmac_sha1_key *)k->key);
+	k->key = NULL;
+}
+
+TSS_RESULT
+Trspi_HMAC_Keyed(Trspi_HmacKey *k, UINT32 BufSize, BYTE *Buf, BYTE *hmacOut)
+{
+	struct hmac_sha1_key *hk;
+	struct trspi_hash_state *state;
+	BYTE innerDigest[TPM_SHA1_160_HASH_LEN];
+	unsigned int len;
+	int rv;
+
+	if (k == NULL || k->key == NULL)
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	hk = (struct hmac_sha1_key *)k->key;
+
+	if ((state = hash_state_get()) == NULL)
+		return TSPERR(TSS_E_OUTOFMEMORY);
+
+	/* EVP_DigestFinal_ex() cleanses the copied state once it's done with it */
+	rv = EVP_MD_CTX_copy_ex(state->md_ctx, hk->inner);
+	if (rv == EVP_SUCCESS)
+		rv = EVP_DigestUpdate(state->md_ctx, Buf, BufSize);
+	if (rv == EVP_SUCCESS)
+		rv = EVP_DigestFinal_ex(state->md_ctx, innerDigest, &len);
+	if (rv == EVP_SUCCESS)
+		rv = EVP_MD_CTX_copy_ex(state->md_ctx, hk->outer);
+	if (rv == EVP_SUCCESS)
+		rv = EVP_DigestUpdate(state->md_ctx, innerDigest, sizeof(innerDigest));
+	if (rv == EVP_SUCCESS)
+		rv = EVP_DigestFinal_ex(state->md_ctx, hmacOut, &len);
+
+	memset(innerDigest, 0, sizeof(innerDigest));
+	hash_state_put(state);
+
+	if (rv != EVP_SUCCESS) {
+		DEBUG_print_openssl_errors();
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	return TSS_SUCCESS;
+}
+
 TSS_RESULT
 Trspi_MGF1(UINT32 alg, UINT32 seedLen, BYTE *seed, UINT32 outLen, BYTE *out)
 {
@@ -216,3 +511,83 @@ Trspi_MGF1(UINT32 alg, UINT32 seedLen, BYTE *seed, UINT32 outLen, BYTE *out)
 out:
 	return rv;
 }
+
+/* XOR @len bytes of @mask into @in, storing the result in @out. Done a machine word at a time;
+ * the memcpy()s let the compiler use unaligned loads and stores where the CPU has them */
+static void
+mgf1_xor(BYTE *out, BYTE *in, BYTE *mask, UINT32 len)
+{
+	UINT64 a, b;
+
+	for (; len >= sizeof(UINT64); len -= sizeof(UINT64)) {
+		memcpy(&a, in, sizeof(UINT64));
+		memcpy(&b, mask, sizeof(UINT64));
+		a ^= b;
+		memcpy(out, &a, sizeof(UINT64));
+		in += sizeof(UINT64);
+		mask += sizeof(UINT64);
+		out += sizeof(UINT64);
+	}
+
+	while (len--)
+		*out++ = *in++ ^ *mask++;
+}
+
+TSS_RESULT
+Trspi_MGF1_Xor(UINT32 alg, UINT32 seedLen, BYTE *seed, UINT32 len, BYTE *in, BYTE *out)
+{
+	struct trspi_hash_state *seedState, *state;
+	BYTE counter[sizeof(UINT32)], mask[TPM_SHA1_160_HASH_LEN];
+	UINT32 i, chunk;
+	unsigned int maskLen;
+	TSS_BOOL seeded;
+	int rv;
+
+	if (alg != TSS_HASH_SHA1)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	if ((seedState = hash_state_get()) == NULL)
+		return TSPERR(TSS_E_OUTOFMEMORY);
+
+	if ((state = hash_state_get()) == NULL) {
+		hash_state_put(seedState);
+		return TSPERR(TSS_E_OUTOFMEMORY);
+	}
+
+	/* every block of the mask is SHA1(seed || counter), so absorb the seed only once */
+	rv = EVP_DigestInit_ex(seedState->md_ctx, EVP_sha1(), NULL);
+	seeded = (rv == EVP_SUCCESS);
+	if (rv == EVP_SUCCESS)
+		rv = EVP_DigestUpdate(seedState->md_ctx, seed, seedLen);
+
+	for (i = 0; rv == EVP_SUCCESS && len; i++) {
+		UINT32ToArray(i, counter);
+		rv = EVP_MD_CTX_copy_ex(state->md_ctx, seedState->md_ctx);
+		if (rv == EVP_SUCCESS)
+			rv = EVP_DigestUpdate(state->md_ctx, counter, sizeof(counter));
+		if (rv == EVP_SUCCESS)
+			rv = EVP_DigestFinal_ex(state->md_ctx, mask, &maskLen);
+		if (rv != EVP_SUCCESS)
+			break;
+
+		chunk = len < sizeof(mask) ? len : sizeof(mask);
+		mgf1_xor(out, in, mask, chunk);
+		in += chunk;
+		out += chunk;
+		len -= chunk;
+	}
+
+	memset(mask, 0, sizeof(mask));
+	/* the seed is the transport session secret, don't leave it in the cached state */
+	if (seeded && EVP_DigestFinal_ex(seedState->md_ctx, mask, &maskLen) == EVP_SUCCESS)
+		memset(mask, 0, sizeof(mask));
+	hash_state_put(seedState);
+	hash_state_put(state);
+
+	if (rv != EVP_SUCCESS) {
+		DEBUG_print_openssl_errors();
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	return TSS_SUCCESS;
+}
@@ -386,3 +386,65 @@ done:
 	EVP_CIPHER_CTX_cleanup(&ctx);
 	return result;
 }
+
+TSS_RESULT
+Trspi_SymKey_Init(Trspi_SymKey *k, UINT16 alg, UINT16 mode, BYTE *key)
+{
+	EVP_CIPHER_CTX *ctx;
+	EVP_CIPHER *cipher;
+
+	if ((cipher = get_openssl_cipher(alg, mode)) == NULL)
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	/* a block mode would pad, and the output wouldn't fit back into the input */
+	if (EVP_CIPHER_block_size(cipher) != 1) {
+		LogDebug("Cipher mode 0x%x is not a stream mode", mode);
+		return TSPERR(TSS_E_BAD_PARAMETER);
+	}
+
+	if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
+		return TSPERR(TSS_E_OUTOFMEMORY);
+
+	/* expand the key schedule now; each message later only sets its IV */
+	if (!EVP_EncryptInit_ex(ctx, (const EVP_CIPHER *)cipher, NULL, key, NULL)) {
+		DEBUG_print_openssl_errors();
+		EVP_CIPHER_CTX_free(ctx);
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	k->ctx = ctx;
+
+	return TSS_SUCCESS;
+}
+
+void
+Trspi_SymKey_Free(Trspi_SymKey *k)
+{
+	if (k->ctx == NULL)
+		return;
+
+	EVP_CIPHER_CTX_free((EVP_CIPHER_CTX *)k->ctx);
+	k->ctx = NULL;
+}
+
+TSS_RESULT
+Trspi_SymKey_Crypt(Trspi_SymKey *k, BYTE *iv, UINT32 len, BYTE *in, BYTE *out)
+{
+	EVP_CIPHER_CTX *ctx = (EVP_CIPHER_CTX *)k->ctx;
+	int outLen;
+
+	if (ctx == NULL || len > INT_MAX)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	if (!EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv)) {
+		DEBUG_print_openssl_errors();
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	if (!EVP_EncryptUpdate(ctx, out, &outLen, in, (int)len) || (UINT32)outLen != len) {
+		DEBUG_print_openssl_errors();
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	return TSS_SUCCESS;
+}
@@ -0,0 +1,304 @@
+/*
+ * Licensed Materials - Property of IBM
+ *
+ * trousers - An open source TCG Software Stack
+ *
+ * (C) Copyright International Business Machines Corp. 2004-2007
+ *
+ */
+
+/*
+ * hash_batch.c - SHA-1 over many independent buffers at once
+ *
+ * Replaying a measurement log means hashing thousands of small, unrelated buffers. The
+ * kernels here run one SHA-1 computation per SIMD lane (4 lanes with SSE2, 8 with AVX2),
+ * refilling a lane with the next buffer as soon as the one it was working on is done.
+ *
+ * Nothing in here is specific to the TSP or the TCS, so both Trspi_HashBatch() and the tcsd's
+ * HashBatch() are built on it. They fall back to their usual one buffer at a time hash when
+ * hash_batch_lanes() says there's no vector unit to use.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "trousers/tss.h"
+#include "trousers_types.h"
+#include "hash_batch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HASH_BATCH_SIMD
+#include <immintrin.h>
+#endif
+
+#define SHA1_BLOCK_SIZE		64
+#define SHA1_DIGEST_WORDS	5
+
+#ifdef HASH_BATCH_SIMD
+
+#define SHA1_MB_MAX_LANES	8
+
+/* per lane bookkeeping for the multi-buffer scheduler */
+struct sha1_mb_lane {
+	UINT32 job;		/* index of the buffer being hashed, or -1 if idle */
+	BYTE *data;		/* next full block of the message */
+	UINT32 full_blocks;	/* full message blocks left */
+	UINT32 tail_blocks;	/* padding blocks left */
+	UINT32 tail_used;	/* padding blocks consumed */
+	BYTE tail[2 * SHA1_BLOCK_SIZE];
+};
+
+struct sha1_mb_job_queue {
+	UINT32 next;
+	UINT32 count;
+	UINT32 *sizes;
+	BYTE **bufs;
+	BYTE *digests;
+};
+
+static const UINT32 sha1_iv[SHA1_DIGEST_WORDS] = {
+	0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+static inline UINT32
+sha1_mb_load_be32(const BYTE *p)
+{
+	return ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | (UINT32)p[3];
+}
+
+/* Put the next waiting buffer into @lane, resetting the lane's chaining state. Returns FALSE
+ * if there's nothing left to hash */
+static TSS_BOOL
+sha1_mb_lane_load(struct sha1_mb_job_queue *q, struct sha1_mb_lane *lane,
+		  UINT32 (*state)[SHA1_MB_MAX_LANES], UINT32 l)
+{
+	UINT32 len, rem, i;
+	UINT64 bits;
+
+	if (q->next == q->count) {
+		lane->job = (UINT32)-1;
+		return FALSE;
+	}
+
+	lane->job = q->next++;
+	len = q->sizes[lane->job];
+	rem = len % SHA1_BLOCK_SIZE;
+
+	lane->data = q->bufs[lane->job];
+	lane->full_blocks = len / SHA1_BLOCK_SIZE;
+	lane->tail_blocks = (rem + 9 <= SHA1_BLOCK_SIZE) ? 1 : 2;
+	lane->tail_used = 0;
+
+	memset(lane->tail, 0, sizeof(lane->tail));
+	if (rem)
+		memcpy(lane->tail, lane->data + lane->full_blocks * SHA1_BLOCK_SIZE, rem);
+	lane->tail[rem] = 0x80;
+
+	bits = (UINT64)len * 8;
+	for (i = 0; i < 8; i++)
+		lane->tail[lane->tail_blocks * SHA1_BLOCK_SIZE - 1 - i] = (BYTE)(bits >> (8 * i));
+
+	for (i = 0; i < SHA1_DIGEST_WORDS; i++)
+		state[i][l] = sha1_iv[i];
+
+	return TRUE;
+}
+
+static inline const BYTE *
+sha1_mb_lane_block(struct sha1_mb_lane *lane)
+{
+	if (lane->full_blocks)
+		return lane->data;
+
+	return &lane->tail[lane->tail_used * SHA1_BLOCK_SIZE];
+}
+
+/* Advance @lane past the block just compressed. When the lane's message is finished, its
+ * digest is written out and the lane picks up the next buffer. Returns FALSE once the lane
+ * has gone idle */
+static TSS_BOOL
+sha1_mb_lane_advance(struct sha1_mb_job_queue *q, struct sha1_mb_lane *lane,
+		     UINT32 (*state)[SHA1_MB_MAX_LANES], UINT32 l)
+{
+	BYTE *digest;
+	UINT32 i;
+
+	if (lane->job == (UINT32)-1)
+		return FALSE;
+
+	if (lane->full_blocks) {
+		lane->full_blocks--;
+		lane->data += SHA1_BLOCK_SIZE;
+		return TRUE;
+	}
+
+	if (++lane->tail_used < lane->tail_blocks)
+		return TRUE;
+
+	digest = &q->digests[lane->job * TPM_SHA1_160_HASH_LEN];
+	for (i = 0; i < SHA1_DIGEST_WORDS; i++) {
+		digest[4 * i] = (BYTE)(state[i][l] >> 24);
+		digest[4 * i + 1] = (BYTE)(state[i][l] >> 16);
+		digest[4 * i + 2] = (BYTE)(state[i][l] >> 8);
+		digest[4 * i + 3] = (BYTE)state[i][l];
+	}
+
+	return sha1_mb_lane_load(q, lane, state, l);
+}
+
+/*
+ * The SHA-1 rounds, written once against a small set of vector operations and instantiated
+ * for each instruction set below. @W holds the 16 message words of every lane, already
+ * converted from big endian.
+ */
+#define SHA1_MB_ROUNDS(VT, LOAD, STORE, ADD, XOR, AND, OR, ANDNOT, SET1, SLLI, SRLI)	\
+do {											\
+	VT a, b, c, d, e, f, k, t, w[16], s[SHA1_DIGEST_WORDS];				\
+	int r;										\
+											\
+	for (r = 0; r < SHA1_DIGEST_WORDS; r++)						\
+		s[r] = LOAD((VT *)state[r]);						\
+	for (r = 0; r < 16; r++)							\
+		w[r] = LOAD((VT *)W[r]);						\
+											\
+	a = s[0]; b = s[1]; c = s[2]; d = s[3]; e = s[4];				\
+											\
+	for (r = 0; r < 80; r++) {							\
+		if (r >= 16) {								\
+			t = XOR(XOR(w[(r - 3) & 15], w[(r - 8) & 15]),			\
+				XOR(w[(r - 14) & 15], w[r & 15]));			\
+			w[r & 15] = OR(SLLI(t, 1), SRLI(t, 31));			\
+		}									\
+											\
+		if (r < 20) {								\
+			f = OR(AND(b, c), ANDNOT(b, d));				\
+			k = SET1(0x5A827999);						\
+		} else if (r < 40) {							\
+			f = XOR(XOR(b, c), d);						\
+			k = SET1(0x6ED9EBA1);						\
+		} else if (r < 60) {							\
+			f = OR(OR(AND(b, c), AND(b, d)), AND(c, d));			\
+			k = SET1(0x8F1BBCDC);						\
+		} else {								\
+			f = XOR(XOR(b, c), d);						\
+			k = SET1(0xCA62C1D6);						\
+		}									\
+											\
+		t = ADD(ADD(OR(SLLI(a, 5), SRLI(a, 27)), f), ADD(ADD(e, k), w[r & 15]));\
+		e = d;									\
+		d = c;									\
+		c = OR(SLLI(b, 30), SRLI(b, 2));					\
+		b = a;									\
+		a = t;									\
+	}										\
+											\
+	STORE((VT *)state[0], ADD(s[0], a));						\
+	STORE((VT *)state[1], ADD(s[1], b));						\
+	STORE((VT *)state[2], ADD(s[2], c));						\
+	STORE((VT *)state[3], ADD(s[3], d));						\
+	STORE((VT *)state[4], ADD(s[4], e));						\
+} while (0)
+
+#define SSE2_SET1(x)	_mm_set1_epi32((int)(x))
+
+__attribute__((target("sse2")))
+static void
+sha1_mb_compress_sse2(UINT32 (*state)[SHA1_MB_MAX_LANES], UINT32 (*W)[SHA1_MB_MAX_LANES])
+{
+	SHA1_MB_ROUNDS(__m128i, _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi32,
+		       _mm_xor_si128, _mm_and_si128, _mm_or_si128, _mm_andnot_si128,
+		       SSE2_SET1, _mm_slli_epi32, _mm_srli_epi32);
+}
+
+#define AVX2_SET1(x)	_mm256_set1_epi32((int)(x))
+
+__attribute__((target("avx2")))
+static void
+sha1_mb_compress_avx2(UINT32 (*state)[SHA1_MB_MAX_LANES], UINT32 (*W)[SHA1_MB_MAX_LANES])
+{
+	SHA1_MB_ROUNDS(__m256i, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi32,
+		       _mm256_xor_si256, _mm256_and_si256, _mm256_or_si256, _mm256_andnot_si256,
+		       AVX2_SET1, _mm256_slli_epi32, _mm256_srli_epi32);
+}
+
+static void
+sha1_mb_run(struct sha1_mb_job_queue *q, UINT32 lanes,
+	    void (*compress)(UINT32 (*)[SHA1_MB_MAX_LANES], UINT32 (*)[SHA1_MB_MAX_LANES]))
+{
+	struct sha1_mb_lane lane[SHA1_MB_MAX_LANES];
+	UINT32 state[SHA1_DIGEST_WORDS][SHA1_MB_MAX_LANES];
+	UINT32 W[16][SHA1_MB_MAX_LANES];
+	const BYTE *block;
+	UINT32 l, i, active = 0;
+
+	memset(state, 0, sizeof(state));
+	memset(W, 0, sizeof(W));
+
+	for (l = 0; l < lanes; l++) {
+		if (sha1_mb_lane_load(q, &lane[l], state, l))
+			active++;
+	}
+
+	while (active) {
+		/* idle lanes keep whatever is in their slots, their results are ignored */
+		for (l = 0; l < lanes; l++) {
+			if (lane[l].job == (UINT32)-1)
+				continue;
+
+			block = sha1_mb_lane_block(&lane[l]);
+			for (i = 0; i < 16; i++)
+				W[i][l] = sha1_mb_load_be32(&block[4 * i]);
+		}
+
+		compress(state, W);
+
+		for (l = 0; l < lanes; l++) {
+			if (lane[l].job == (UINT32)-1)
+				continue;
+
+			if (!sha1_mb_lane_advance(q, &lane[l], state, l))
+				active--;
+		}
+	}
+}
+
+UINT32
+hash_batch_lanes(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return 8;
+	else if (__builtin_cpu_supports("sse2"))
+		return 4;
+
+	return 0;
+}
+
+void
+hash_batch_sha1(UINT32 lanes, UINT32 count, UINT32 *sizes, BYTE **bufs, BYTE *digests)
+{
+	struct sha1_mb_job_queue q;
+
+	q.next = 0;
+	q.count = count;
+	q.sizes = sizes;
+	q.bufs = bufs;
+	q.digests = digests;
+
+	if (lanes == 8)
+		sha1_mb_run(&q, 8, sha1_mb_compress_avx2);
+	else
+		sha1_mb_run(&q, 4, sha1_mb_compress_sse2);
+}
+#else
+UINT32
+hash_batch_lanes(void)
+{
+	return 0;
+}
+
+void
+hash_batch_sha1(UINT32 lanes, UINT32 count, UINT32 *sizes, BYTE **bufs, BYTE *digests)
+{
+}
+#endif
@@ -29,6 +29,7 @@
 #include "tsplog.h"
 #include "obj.h"
 #include "tcs_tsp.h"
+#include "hash_batch.h"
 
 void
 Trspi_UnloadBlob_NONCE(UINT64 *offset, BYTE *blob, TPM_NONCE *n)
@@ -101,133 +102,121 @@ Trspi_UnloadBlob_PUBKEY(UINT64 *offset, BYTE *blob, TCPA_PUBKEY *pubKey)
 void
 Trspi_LoadBlob(UINT64 *offset, size_t size, BYTE *to, BYTE *from)
 {
-	if (size == 0)
-		return;
-
-	if ((*offset + size) > TSS_TPM_TXBLOB_SIZE)
-		return;
+	struct blob_cursor c;
 
-	if (to)
-		memcpy(&to[(*offset)], from, size);
-	(*offset) += size;
+	blob_cursor_init_offset(&c, offset, to);
+	PutBlob(&c, size, from);
+	*offset = c.pos;
 }
 
 void
 Trspi_UnloadBlob(UINT64 *offset, size_t size, BYTE *from, BYTE *to)
 {
-	if (size <= 0)
-		return;
+	struct blob_cursor c;
 
-	if ((*offset + size) > TSS_TPM_TXBLOB_SIZE)
-		return;
-
-	if (to)
-		memcpy(to, &from[*offset], size);
-	(*offset) += size;
+	blob_cursor_init_offset(&c, offset, from);
+	GetBlob(&c, size, to);
+	*offset = c.pos;
 }
 
 void
 Trspi_LoadBlob_BYTE(UINT64 *offset, BYTE data, BYTE *blob)
 {
-	if ((*offset + sizeof(BYTE)) > TSS_TPM_TXBLOB_SIZE)
-		return;
+	struct blob_cursor c;
 
-	if (blob)
-		blob[*offset] = data;
-	(*offset)++;
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_BYTE(&c, data);
+	*offset = c.pos;
 }
 
 void
 Trspi_UnloadBlob_BYTE(UINT64 *offset, BYTE *dataOut, BYTE *blob)
 {
-	if ((*offset + sizeof(BYTE)) > TSS_TPM_TXBLOB_SIZE)
-		return;
+	struct blob_cursor c;
 
-	if (dataOut)
-		*dataOut = blob[*offset];
-	(*offset)++;
+	blob_cursor_init_offset(&c, offset, blob);
+	GetBlob_BYTE(&c, dataOut);
+	*offset = c.pos;
 }
 
 void
 Trspi_LoadBlob_BOOL(UINT64 *offset, TSS_BOOL data, BYTE *blob)
 {
-	if (blob)
-		blob[*offset] = (BYTE) data;
-	(*offset)++;
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_BOOL(&c, data);
+	*offset = c.pos;
 }
 
 void
 Trspi_UnloadBlob_BOOL(UINT64 *offset, TSS_BOOL *dataOut, BYTE *blob)
 {
-	if (dataOut)
-		*dataOut = blob[*offset];
-	(*offset)++;
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	GetBlob_BOOL(&c, dataOut);
+	*offset = c.pos;
 }
 
 void
 Trspi_LoadBlob_UINT64(UINT64 *offset, UINT64 in, BYTE *blob)
 {
-	if ((*offset + sizeof(UINT64)) > TSS_TPM_TXBLOB_SIZE)
-		return;
+	struct blob_cursor c;
 
-	if (blob)
-		UINT64ToArray(in, &blob[*offset]);
-	(*offset) += sizeof(UINT64);
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_UINT64(&c, in);
+	*offset = c.pos;
 }
 
 void
 Trspi_LoadBlob_UINT32(UINT64 *offset, UINT32 in, BYTE *blob)
 {
-	if ((*offset + sizeof(UINT32)) > TSS_TPM_TXBLOB_SIZE)
-		return;
+	struct blob_cursor c;
 
-	if (blob)
-		UINT32ToArray(in, &blob[*offset]);
-	(*offset) += sizeof(UINT32);
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_UINT32(&c, in);
+	*offset = c.pos;
 }
 
 void
 Trspi_LoadBlob_UINT16(UINT64 *offset, UINT16 in, BYTE *blob)
 {
-	if ((*offset + sizeof(UINT16)) > TSS_TPM_TXBLOB_SIZE)
-		return;
+	struct blob_cursor c;
 
-	if (blob)
-		UINT16ToArray(in, &blob[*offset]);
-	(*offset) += sizeof(UINT16);
+	blob_cursor_init_offset(&c, offset, blob);
+	PutBlob_UINT16(&c, in);
+	*offset = c.pos;
 }
 
 void
 Trspi_UnloadBlob_UINT64(UINT64 *offset, UINT64 *out, BYTE *blob)
 {
-	if ((*offset + sizeof(UINT64)) > TSS_TPM_TXBLOB_SIZE)
-		return;
+	struct blob_cursor c;
 
-	if (out)
-		*out = Decode_UINT64(&blob[*offset]);
-	(*offset) += sizeof(UINT64);
+	blob_cursor_init_offset(&c, offset, blob);
+	GetBlob_UINT64(&c, out);
+	*offset = c.pos;
 }
 
 void
 Trspi_UnloadBlob_UINT32(UINT64 *offset, UINT32 *out, BYTE *blob)
 {
-	if ((*offset + sizeof(UINT32)) > TSS_TPM_TXBLOB_SIZE)
-		return;
+	struct blob_cursor c;
 
-	if (out)
-		*out = Decode_UINT32(&blob[*offset]);
-	(*offset) += sizeof(UINT32);
+	blob_cursor_init_offset(&c, offset, blob);
+	GetBlob_UINT32(&c, out);
+	*offset = c.pos;
 }
 
 void
 Trspi_UnloadBlob_UINT16(UINT64 *offset, UINT16 *out, BYTE *blob)
 {
-	if ((*offset + sizeof(UINT16)) > TSS_TPM_TXBLOB_SIZE)
-		return;
+	struct blob_cursor c;
 
-	if (out)
-		*out = Decode_UINT16(&blob[*offset]);
-	(*offset) += sizeof(UINT16);
+	blob_cursor_init_offset(&c, offset, blob);
+	GetBlob_UINT16(&c, out);
+	*offset = c.pos;
 }
 
 void
@@ -286,13 +275,23 @@ Trspi_UnloadBlob_TCPA_VERSION(UINT64 *offset, BYTE *blob, TCPA_VERSION *out)
 	Trspi_UnloadBlob_BYTE(offset, &out->revMinor, blob);
 }
 
+void
+Trspi_PutBlob_TCPA_VERSION(struct blob_cursor *c, TCPA_VERSION *version)
+{
+	PutBlob_BYTE(c, version->major);
+	PutBlob_BYTE(c, version->minor);
+	PutBlob_BYTE(c, version->revMajor);
+	PutBlob_BYTE(c, version->revMinor);
+}
+
 void
 Trspi_LoadBlob_TCPA_VERSION(UINT64 *offset, BYTE *blob, TCPA_VERSION version)
 {
-	Trspi_LoadBlob_BYTE(offset, version.major, blob);
-	Trspi_LoadBlob_BYTE(offset, version.minor, blob);
-	Trspi_LoadBlob_BYTE(offset, version.revMajor, blob);
-	Trspi_LoadBlob_BYTE(offset, version.revMinor, blob);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_TCPA_VERSION(&c, &version);
+	*offset = c.pos;
 }
 
 TSS_RESULT
@@ -316,12 +315,22 @@ Trspi_UnloadBlob_PCR_INFO(UINT64 *offset, BYTE *blob, TCPA_PCR_INFO *pcr)
 	return TSS_SUCCESS;
 }
 
+void
+Trspi_PutBlob_PCR_INFO(struct blob_cursor *c, TCPA_PCR_INFO *pcr)
+{
+	Trspi_PutBlob_PCR_SELECTION(c, &pcr->pcrSelection);
+	PutBlob(c, TPM_SHA1_160_HASH_LEN, pcr->digestAtRelease.digest);
+	PutBlob(c, TPM_SHA1_160_HASH_LEN, pcr->digestAtCreation.digest);
+}
+
 void
 Trspi_LoadBlob_PCR_INFO(UINT64 *offset, BYTE *blob, TCPA_PCR_INFO *pcr)
 {
-	Trspi_LoadBlob_PCR_SELECTION(offset, blob, &pcr->pcrSelection);
-	Trspi_LoadBlob_DIGEST(offset, blob, &pcr->digestAtRelease);
-	Trspi_LoadBlob_DIGEST(offset, blob, &pcr->digestAtCreation);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_PCR_INFO(&c, pcr);
+	*offset = c.pos;
 }
 
 TSS_RESULT
@@ -354,16 +363,26 @@ Trspi_UnloadBlob_PCR_INFO_LONG(UINT64 *offset, BYTE *blob, TPM_PCR_INFO_LONG *pc
 	return TSS_SUCCESS;
 }
 
+void
+Trspi_PutBlob_PCR_INFO_LONG(struct blob_cursor *c, TPM_PCR_INFO_LONG *pcr)
+{
+	PutBlob_UINT16(c, pcr->tag);
+	PutBlob_BYTE(c, pcr->localityAtCreation);
+	PutBlob_BYTE(c, pcr->localityAtRelease);
+	Trspi_PutBlob_PCR_SELECTION(c, &pcr->creationPCRSelection);
+	Trspi_PutBlob_PCR_SELECTION(c, &pcr->releasePCRSelection);
+	PutBlob(c, TPM_SHA1_160_HASH_LEN, pcr->digestAtCreation.digest);
+	PutBlob(c, TPM_SHA1_160_HASH_LEN, pcr->digestAtRelease.digest);
+}
+
 void
 Trspi_LoadBlob_PCR_INFO_LONG(UINT64 *offset, BYTE *blob, TPM_PCR_INFO_LONG *pcr)
 {
-	Trspi_LoadBlob_UINT16(offset, pcr->tag, blob);
-	Trspi_LoadBlob_BYTE(offset, pcr->localityAtCreation, blob);
-	Trspi_LoadBlob_BYTE(offset, pcr->localityAtRelease, blob);
-	Trspi_LoadBlob_PCR_SELECTION(offset, blob, &pcr->creationPCRSelection);
-	Trspi_LoadBlob_PCR_SELECTION(offset, blob, &pcr->releasePCRSelection);
-	Trspi_LoadBlob_DIGEST(offset, blob, &pcr->digestAtCreation);
-	Trspi_LoadBlob_DIGEST(offset, blob, &pcr->digestAtRelease);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_PCR_INFO_LONG(&c, pcr);
+	*offset = c.pos;
 }
 
 TSS_RESULT
@@ -387,12 +406,22 @@ Trspi_UnloadBlob_PCR_INFO_SHORT(UINT64 *offset, BYTE *blob, TPM_PCR_INFO_SHORT *
 	return TSS_SUCCESS;
 }
 
+void
+Trspi_PutBlob_PCR_INFO_SHORT(struct blob_cursor *c, TPM_PCR_INFO_SHORT *pcr)
+{
+	Trspi_PutBlob_PCR_SELECTION(c, &pcr->pcrSelection);
+	PutBlob_BYTE(c, pcr->localityAtRelease);
+	PutBlob(c, TPM_SHA1_160_HASH_LEN, pcr->digestAtRelease.digest);
+}
+
 void
 Trspi_LoadBlob_PCR_INFO_SHORT(UINT64 *offset, BYTE *blob, TPM_PCR_INFO_SHORT *pcr)
 {
-	Trspi_LoadBlob_PCR_SELECTION(offset, blob, &pcr->pcrSelection);
-	Trspi_LoadBlob_BYTE(offset, pcr->localityAtRelease, blob);
-	Trspi_LoadBlob_DIGEST(offset, blob, &pcr->digestAtRelease);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_PCR_INFO_SHORT(&c, pcr);
+	*offset = c.pos;
 }
 
 TSS_RESULT
@@ -424,45 +453,72 @@ Trspi_UnloadBlob_PCR_SELECTION(UINT64 *offset, BYTE *blob, TCPA_PCR_SELECTION *p
 	return TSS_SUCCESS;
 }
 
+void
+Trspi_PutBlob_PCR_SELECTION(struct blob_cursor *c, TCPA_PCR_SELECTION *pcr)
+{
+	PutBlob_UINT16(c, pcr->sizeOfSelect);
+	PutBlob(c, pcr->sizeOfSelect, pcr->pcrSelect);
+}
+
 void
 Trspi_LoadBlob_PCR_SELECTION(UINT64 *offset, BYTE *blob, TCPA_PCR_SELECTION *pcr)
 {
-	UINT16 i;
+	struct blob_cursor c;
 
-	Trspi_LoadBlob_UINT16(offset, pcr->sizeOfSelect, blob);
-	for (i = 0; i < pcr->sizeOfSelect; i++)
-		Trspi_LoadBlob_BYTE(offset, pcr->pcrSelect[i], blob);
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_PCR_SELECTION(&c, pcr);
+	*offset = c.pos;
+}
+
+void
+Trspi_PutBlob_KEY12(struct blob_cursor *c, TPM_KEY12 *key)
+{
+	PutBlob_UINT16(c, key->tag);
+	PutBlob_UINT16(c, key->fill);
+	PutBlob_UINT16(c, key->keyUsage);
+	PutBlob_UINT32(c, key->keyFlags);
+	PutBlob_BYTE(c, key->authDataUsage);
+	Trspi_PutBlob_KEY_PARMS(c, &key->algorithmParms);
+	PutBlob_UINT32(c, key->PCRInfoSize);
+	PutBlob(c, key->PCRInfoSize, key->PCRInfo);
+	Trspi_PutBlob_STORE_PUBKEY(c, &key->pubKey);
+	PutBlob_UINT32(c, key->encSize);
+	PutBlob(c, key->encSize, key->encData);
 }
 
 void
 Trspi_LoadBlob_KEY12(UINT64 *offset, BYTE *blob, TPM_KEY12 *key)
 {
-	Trspi_LoadBlob_UINT16(offset, key->tag, blob);
-	Trspi_LoadBlob_UINT16(offset, key->fill, blob);
-	Trspi_LoadBlob_UINT16(offset, key->keyUsage, blob);
-	Trspi_LoadBlob_KEY_FLAGS(offset, blob, &key->keyFlags);
-	Trspi_LoadBlob_BYTE(offset, key->authDataUsage, blob);
-	Trspi_LoadBlob_KEY_PARMS(offset, blob, &key->algorithmParms);
-	Trspi_LoadBlob_UINT32(offset, key->PCRInfoSize, blob);
-	Trspi_LoadBlob(offset, key->PCRInfoSize, blob, key->PCRInfo);
-	Trspi_LoadBlob_STORE_PUBKEY(offset, blob, &key->pubKey);
-	Trspi_LoadBlob_UINT32(offset, key->encSize, blob);
-	Trspi_LoadBlob(offset, key->encSize, blob, key->encData);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_KEY12(&c, key);
+	*offset = c.pos;
+}
+
+void
+Trspi_PutBlob_KEY(struct blob_cursor *c, TCPA_KEY *key)
+{
+	Trspi_PutBlob_TCPA_VERSION(c, &key->ver);
+	PutBlob_UINT16(c, key->keyUsage);
+	PutBlob_UINT32(c, key->keyFlags);
+	PutBlob_BYTE(c, key->authDataUsage);
+	Trspi_PutBlob_KEY_PARMS(c, &key->algorithmParms);
+	PutBlob_UINT32(c, key->PCRInfoSize);
+	PutBlob(c, key->PCRInfoSize, key->PCRInfo);
+	Trspi_PutBlob_STORE_PUBKEY(c, &key->pubKey);
+	PutBlob_UINT32(c, key->encSize);
+	PutBlob(c, key->encSize, key->encData);
 }
 
 void
 Trspi_LoadBlob_KEY(UINT64 *offset, BYTE *blob, TCPA_KEY *key)
 {
-	Trspi_LoadBlob_TCPA_VERSION(offset, blob, key->ver);
-	Trspi_LoadBlob_UINT16(offset, key->keyUsage, blob);
-	Trspi_LoadBlob_KEY_FLAGS(offset, blob, &key->keyFlags);
-	Trspi_LoadBlob_BYTE(offset, key->authDataUsage, blob);
-	Trspi_LoadBlob_KEY_PARMS(offset, blob, &key->algorithmParms);
-	Trspi_LoadBlob_UINT32(offset, key->PCRInfoSize, blob);
-	Trspi_LoadBlob(offset, key->PCRInfoSize, blob, key->PCRInfo);
-	Trspi_LoadBlob_STORE_PUBKEY(offset, blob, &key->pubKey);
-	Trspi_LoadBlob_UINT32(offset, key->encSize, blob);
-	Trspi_LoadBlob(offset, key->encSize, blob, key->encData);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_KEY(&c, key);
+	*offset = c.pos;
 }
 
 void
@@ -477,34 +533,62 @@ Trspi_UnloadBlob_KEY_FLAGS(UINT64 *offset, BYTE *blob, TCPA_KEY_FLAGS *flags)
 	Trspi_UnloadBlob_UINT32(offset, flags, blob);
 }
 
+void
+Trspi_PutBlob_KEY_PARMS(struct blob_cursor *c, TCPA_KEY_PARMS *keyInfo)
+{
+	PutBlob_UINT32(c, keyInfo->algorithmID);
+	PutBlob_UINT16(c, keyInfo->encScheme);
+	PutBlob_UINT16(c, keyInfo->sigScheme);
+	PutBlob_UINT32(c, keyInfo->parmSize);
+	PutBlob(c, keyInfo->parmSize, keyInfo->parms);
+}
+
 void
 Trspi_LoadBlob_KEY_PARMS(UINT64 *offset, BYTE *blob, TCPA_KEY_PARMS *keyInfo)
 {
-	Trspi_LoadBlob_UINT32(offset, keyInfo->algorithmID, blob);
-	Trspi_LoadBlob_UINT16(offset, keyInfo->encScheme, blob);
-	Trspi_LoadBlob_UINT16(offset, keyInfo->sigScheme, blob);
-	Trspi_LoadBlob_UINT32(offset, keyInfo->parmSize, blob);
+	struct blob_cursor c;
 
-	if (keyInfo->parmSize > 0)
-		Trspi_LoadBlob(offset, keyInfo->parmSize, blob, keyInfo->parms);
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_KEY_PARMS(&c, keyInfo);
+	*offset = c.pos;
+}
+
+void
+Trspi_PutBlob_STORE_PUBKEY(struct blob_cursor *c, TCPA_STORE_PUBKEY *store)
+{
+	PutBlob_UINT32(c, store->keyLength);
+	PutBlob(c, store->keyLength, store->key);
 }
 
 void
 Trspi_LoadBlob_STORE_PUBKEY(UINT64 *offset, BYTE *blob, TCPA_STORE_PUBKEY *store)
 {
-	Trspi_LoadBlob_UINT32(offset, store->keyLength, blob);
-	Trspi_LoadBlob(offset, store->keyLength, blob, store->key);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_STORE_PUBKEY(&c, store);
+	*offset = c.pos;
+}
+
+void
+Trspi_PutBlob_UUID(struct blob_cursor *c, TSS_UUID *uuid)
+{
+	PutBlob_UINT32(c, uuid->ulTimeLow);
+	PutBlob_UINT16(c, uuid->usTimeMid);
+	PutBlob_UINT16(c, uuid->usTimeHigh);
+	PutBlob_BYTE(c, uuid->bClockSeqHigh);
+	PutBlob_BYTE(c, uuid->bClockSeqLow);
+	PutBlob(c, 6, uuid->rgbNode);
 }
 
 void
 Trspi_LoadBlob_UUID(UINT64 *offset, BYTE *blob, TSS_UUID uuid)
 {
-	Trspi_LoadBlob_UINT32(offset, uuid.ulTimeLow, blob);
-	Trspi_LoadBlob_UINT16(offset, uuid.usTimeMid, blob);
-	Trspi_LoadBlob_UINT16(offset, uuid.usTimeHigh, blob);
-	Trspi_LoadBlob_BYTE(offset, uuid.bClockSeqHigh, blob);
-	Trspi_LoadBlob_BYTE(offset, uuid.bClockSeqLow, blob);
-	Trspi_LoadBlob(offset, 6, blob, uuid.rgbNode);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_UUID(&c, &uuid);
+	*offset = c.pos;
 }
 
 void
@@ -815,20 +899,25 @@ Trspi_UnloadBlob_KM_KEYINFO2(UINT64 *offset, BYTE *blob, TSS_KM_KEYINFO2 *info)
 }
 
 void
-Trspi_LoadBlob_PCR_EVENT(UINT64 *offset, BYTE *blob, TSS_PCR_EVENT *event)
+Trspi_PutBlob_PCR_EVENT(struct blob_cursor *c, TSS_PCR_EVENT *event)
 {
-	Trspi_LoadBlob_TCPA_VERSION(offset, blob, *(TCPA_VERSION *)(&event->versionInfo));
-	Trspi_LoadBlob_UINT32(offset, event->ulPcrIndex, blob);
-	Trspi_LoadBlob_UINT32(offset, event->eventType, blob);
-
-	Trspi_LoadBlob_UINT32(offset, event->ulPcrValueLength, blob);
-	if (event->ulPcrValueLength > 0)
-		Trspi_LoadBlob(offset, event->ulPcrValueLength, blob, event->rgbPcrValue);
+	Trspi_PutBlob_TCPA_VERSION(c, (TCPA_VERSION *)&event->versionInfo);
+	PutBlob_UINT32(c, event->ulPcrIndex);
+	PutBlob_UINT32(c, event->eventType);
+	PutBlob_UINT32(c, event->ulPcrValueLength);
+	PutBlob(c, event->ulPcrValueLength, event->rgbPcrValue);
+	PutBlob_UINT32(c, event->ulEventLength);
+	PutBlob(c, event->ulEventLength, event->rgbEvent);
+}
 
-	Trspi_LoadBlob_UINT32(offset, event->ulEventLength, blob);
-	if (event->ulEventLength > 0)
-		Trspi_LoadBlob(offset, event->ulEventLength, blob, event->rgbEvent);
+void
+Trspi_LoadBlob_PCR_EVENT(UINT64 *offset, BYTE *blob, TSS_PCR_EVENT *event)
+{
+	struct blob_cursor c;
 
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_PCR_EVENT(&c, event);
+	*offset = c.pos;
 }
 
 TSS_RESULT
@@ -1897,6 +1986,41 @@ Trspi_Hash_UUID(Trspi_HashCtx *c, TSS_UUID uuid)
 	return result;
 }
 
+TSS_RESULT
+Trspi_HashBatch(UINT32 HashType, UINT32 Count, UINT32 *BufSizes, BYTE **Bufs, BYTE *Digests)
+{
+	TSS_RESULT result;
+	UINT32 i, lanes;
+
+	if (HashType != TSS_HASH_SHA1)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	if (Count == 0)
+		return TSS_SUCCESS;
+
+	if (BufSizes == NULL || Bufs == NULL || Digests == NULL)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	for (i = 0; i < Count; i++) {
+		if (Bufs[i] == NULL && BufSizes[i])
+			return TSPERR(TSS_E_BAD_PARAMETER);
+	}
+
+	/* with a single buffer there's nothing to interleave */
+	if (Count > 1 && (lanes = hash_batch_lanes())) {
+		hash_batch_sha1(lanes, Count, BufSizes, Bufs, Digests);
+		return TSS_SUCCESS;
+	}
+
+	for (i = 0; i < Count; i++) {
+		if ((result = Trspi_Hash(HashType, BufSizes[i], Bufs[i],
+					 &Digests[i * TPM_SHA1_160_HASH_LEN])))
+			return result;
+	}
+
+	return TSS_SUCCESS;
+}
+
 TSS_RESULT
 Trspi_Hash_PCR_EVENT(Trspi_HashCtx *c, TSS_PCR_EVENT *event)
 {
@@ -1918,6 +2042,53 @@ Trspi_Hash_PCR_EVENT(Trspi_HashCtx *c, TSS_PCR_EVENT *event)
 	return result;
 }
 
+/* The digests Trspi_Hash_PCR_EVENT would produce for each of @Count events, computed together
+ * with Trspi_HashBatch */
+TSS_RESULT
+Trspi_HashBatch_PCR_EVENT(UINT32 Count, TSS_PCR_EVENT *Events, BYTE *Digests)
+{
+	struct blob_cursor c;
+	UINT32 *sizes, i;
+	BYTE **bufs, *blob;
+	TSS_RESULT result;
+
+	if (Count == 0)
+		return TSS_SUCCESS;
+
+	if (Events == NULL || Digests == NULL)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	/* the hashed form of an event is the same as its blob */
+	blob_cursor_init_sizer(&c, 0);
+	for (i = 0; i < Count; i++)
+		Trspi_PutBlob_PCR_EVENT(&c, &Events[i]);
+
+	sizes = malloc(Count * sizeof(UINT32));
+	bufs = malloc(Count * sizeof(BYTE *));
+	blob = malloc(c.pos ? c.pos : 1);
+	if (sizes == NULL || bufs == NULL || blob == NULL) {
+		LogError("malloc of %zd bytes failed.",
+			 (size_t)c.pos + Count * (sizeof(UINT32) + sizeof(BYTE *)));
+		result = TSPERR(TSS_E_OUTOFMEMORY);
+		goto done;
+	}
+
+	blob_cursor_init(&c, blob, BLOB_CURSOR_UNBOUNDED, 0);
+	for (i = 0; i < Count; i++) {
+		bufs[i] = &blob[c.pos];
+		Trspi_PutBlob_PCR_EVENT(&c, &Events[i]);
+		sizes[i] = (UINT32)(&blob[c.pos] - bufs[i]);
+	}
+
+	result = Trspi_HashBatch(TSS_HASH_SHA1, Count, sizes, bufs, Digests);
+done:
+	free(sizes);
+	free(bufs);
+	free(blob);
+
+	return result;
+}
+
 TSS_RESULT
 Trspi_Hash_PRIVKEY_DIGEST12(Trspi_HashCtx *c, TPM_KEY12 *key)
 {
@@ -2120,12 +2291,22 @@ Trspi_UnloadBlob_COUNTER_VALUE(UINT64 *offset, BYTE *blob, TPM_COUNTER_VALUE *ct
 	Trspi_UnloadBlob_UINT32(offset, &ctr->counter, blob);
 }
 
+void
+Trspi_PutBlob_COUNTER_VALUE(struct blob_cursor *c, TPM_COUNTER_VALUE *ctr)
+{
+	PutBlob_UINT16(c, ctr->tag);
+	PutBlob(c, 4, (BYTE *)&ctr->label);
+	PutBlob_UINT32(c, ctr->counter);
+}
+
 void
 Trspi_LoadBlob_COUNTER_VALUE(UINT64 *offset, BYTE *blob, TPM_COUNTER_VALUE *ctr)
 {
-	Trspi_LoadBlob_UINT16(offset, ctr->tag, blob);
-	Trspi_LoadBlob(offset, 4, blob, (BYTE *)&ctr->label);
-	Trspi_LoadBlob_UINT32(offset, ctr->counter, blob);
+	struct blob_cursor c;
+
+	blob_cursor_init_offset(&c, offset, blob);
+	Trspi_PutBlob_COUNTER_VALUE(&c, ctr);
+	*offset = c.pos;
 }
 
 void
@@ -0,0 +1,154 @@
+
+/*
+ * Licensed Materials - Property of IBM
+ *
+ * trousers - An open source TCG Software Stack
+ *
+ * (C) Copyright International Business Machines Corp. 2004-2007
+ *
+ */
+
+/*
+ * hash_batch_test.c - check Trspi_HashBatch against Trspi_Hash
+ *
+ * The buffer sizes straddle the SHA-1 padding boundaries: a 55 byte message still fits its
+ * length in the last block, 56 doesn't, 64 fills a block exactly. Every kernel the CPU
+ * supports is run, and the batch sizes vary so that lanes go idle and get refilled at
+ * different points.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trousers/tss.h"
+#include "trousers/trousers.h"
+#include "trousers_types.h"
+#include "hash_batch.h"
+
+#define NUM_BUFS	200
+
+static UINT32 fixed_sizes[] = { 0, 1, 55, 56, 57, 63, 64, 65, 119, 120, 127, 128, 129, 1000,
+				4097 };
+
+static int errors;
+
+static void
+check_digests(const char *what, UINT32 count, UINT32 *sizes, BYTE **bufs, BYTE *digests)
+{
+	BYTE digest[TPM_SHA1_160_HASH_LEN];
+	UINT32 i;
+
+	for (i = 0; i < count; i++) {
+		if (Trspi_Hash(TSS_HASH_SHA1, sizes[i], bufs[i], digest)) {
+			printf("FAIL %s: Trspi_Hash of buffer %u\n", what, i);
+			errors++;
+			continue;
+		}
+
+		if (memcmp(digest, &digests[i * TPM_SHA1_160_HASH_LEN], TPM_SHA1_160_HASH_LEN)) {
+			printf("FAIL %s: buffer %u of %u, %u bytes\n", what, i, count, sizes[i]);
+			errors++;
+		}
+	}
+}
+
+static void
+test_events(void)
+{
+	TSS_PCR_EVENT events[20];
+	Trspi_HashCtx c;
+	BYTE pcr_value[TPM_SHA1_160_HASH_LEN], data[300];
+	BYTE digests[20 * TPM_SHA1_160_HASH_LEN], digest[TPM_SHA1_160_HASH_LEN];
+	UINT32 i;
+
+	memset(events, 0, sizeof(events));
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (BYTE)(i * 7);
+	memset(pcr_value, 0x5a, sizeof(pcr_value));
+
+	for (i = 0; i < 20; i++) {
+		events[i].versionInfo.bMajor = 1;
+		events[i].versionInfo.bMinor = 2;
+		events[i].ulPcrIndex = i % 24;
+		events[i].eventType = i;
+		events[i].ulPcrValueLength = (i % 3) ? TPM_SHA1_160_HASH_LEN : 0;
+		events[i].rgbPcrValue = (i % 3) ? pcr_value : NULL;
+		events[i].ulEventLength = (i * 17) % sizeof(data);
+		events[i].rgbEvent = events[i].ulEventLength ? data : NULL;
+	}
+
+	if (Trspi_HashBatch_PCR_EVENT(20, events, digests)) {
+		printf("FAIL Trspi_HashBatch_PCR_EVENT\n");
+		errors++;
+		return;
+	}
+
+	for (i = 0; i < 20; i++) {
+		if (Trspi_HashInit(&c, TSS_HASH_SHA1) || Trspi_Hash_PCR_EVENT(&c, &events[i]) ||
+		    Trspi_HashFinal(&c, digest)) {
+			printf("FAIL Trspi_Hash_PCR_EVENT %u\n", i);
+			errors++;
+			continue;
+		}
+
+		if (memcmp(digest, &digests[i * TPM_SHA1_160_HASH_LEN], TPM_SHA1_160_HASH_LEN)) {
+			printf("FAIL Trspi_HashBatch_PCR_EVENT: event %u\n", i);
+			errors++;
+		}
+	}
+}
+
+int
+main(void)
+{
+	UINT32 sizes[NUM_BUFS], i, j, count, lanes;
+	BYTE *bufs[NUM_BUFS], *digests;
+
+	srand(1);
+
+	for (i = 0; i < NUM_BUFS; i++) {
+		if (i < sizeof(fixed_sizes) / sizeof(fixed_sizes[0]))
+			sizes[i] = fixed_sizes[i];
+		else
+			sizes[i] = rand() % 600;
+
+		bufs[i] = malloc(sizes[i] + 1);
+		for (j = 0; j < sizes[i]; j++)
+			bufs[i][j] = (BYTE)rand();
+	}
+	/* an empty buffer doesn't need any memory behind it */
+	free(bufs[0]);
+	bufs[0] = NULL;
+
+	if ((digests = malloc(NUM_BUFS * TPM_SHA1_160_HASH_LEN)) == NULL)
+		return 1;
+
+	for (count = 1; count <= NUM_BUFS; count = count * 2 + 1) {
+		memset(digests, 0, NUM_BUFS * TPM_SHA1_160_HASH_LEN);
+		if (Trspi_HashBatch(TSS_HASH_SHA1, count, sizes, bufs, digests)) {
+			printf("FAIL Trspi_HashBatch of %u buffers\n", count);
+			errors++;
+			continue;
+		}
+		check_digests("Trspi_HashBatch", count, sizes, bufs, digests);
+
+		/* the narrower kernels too, which Trspi_HashBatch skips if it can use a wider one */
+		for (lanes = hash_batch_lanes(); lanes >= 4; lanes /= 2) {
+			memset(digests, 0, NUM_BUFS * TPM_SHA1_160_HASH_LEN);
+			hash_batch_sha1(lanes, count, sizes, bufs, digests);
+			check_digests(lanes == 8 ? "8 lanes" : "4 lanes", count, sizes, bufs,
+				      digests);
+		}
+	}
+
+	test_events();
+
+	for (i = 0; i < NUM_BUFS; i++)
+		free(bufs[i]);
+	free(digests);
+
+	printf("%s\n", errors ? "FAILED" : "PASSED");
+
+	return errors ? 1 : 0;
+}
@@ -100,6 +100,10 @@ __tspi_obj_context_free(void *data)
 {
 	struct tr_context_obj *context = (struct tr_context_obj *)data;
 
+#ifdef TSS_BUILD_TRANSPORT
+	Trspi_SymKey_Free(&context->transCipher);
+	free(context->transBuf);
+#endif
 	free(context->machineName);
 	free(context);
 }
@@ -727,6 +731,8 @@ obj_context_transport_establish(TSS_HCONTEXT tspContext, struct tr_context_obj *
 
 	context->transPub.tag = TPM_TAG_TRANSPORT_PUBLIC;
 	context->transSecret.tag = TPM_TAG_TRANSPORT_AUTH;
+	/* a cipher left over from an earlier session is keyed with the old secret */
+	Trspi_SymKey_Free(&context->transCipher);
 
 	if ((result = get_local_random(tspContext, FALSE, TPM_SHA1_160_HASH_LEN,
 				       (BYTE **)context->transSecret.authData.authdata)))
@@ -897,163 +903,80 @@ obj_context_transport_establish(TSS_HCONTEXT tspContext, struct tr_context_obj *
 	return TSS_SUCCESS;
 }
 
-TSS_RESULT
-do_transport_decryption(TPM_TRANSPORT_PUBLIC *transPub,
-			TPM_AUTH *pTransAuth,
-			BYTE *secret,
-			UINT32 inLen,
-			BYTE *in,
-			UINT32 *outLen,
-			BYTE **out)
+/* Grow the session's ciphertext buffer to at least @size bytes. Called with the context list
+ * locked, which obj_context_transport_execute() holds for as long as it uses the buffer. */
+static TSS_RESULT
+transport_buffer_reserve(struct tr_context_obj *context, UINT32 size)
 {
-	TSS_RESULT result;
-	UINT32 i, decLen;
-	UINT32 seedLen, ivLen;
-	BYTE *dec;
-	BYTE seed[(2 * sizeof(TPM_NONCE)) + strlen("out") + TPM_SHA1_160_HASH_LEN];
-
-	/* allocate the most data anyone below might need */
-	decLen = inLen;//((inLen / TSS_MAX_SYM_BLOCK_SIZE) + 1) * TSS_MAX_SYM_BLOCK_SIZE;
-	if ((dec = malloc(decLen)) == NULL) {
-		LogError("malloc of %u bytes failed", decLen);
-		return TSPERR(TSS_E_OUTOFMEMORY);
-	}
-
-	/* set the common 3 initial values of 'seed', which is used to generate either the IV or
-	 * mask */
-	memcpy(seed, pTransAuth->NonceEven.nonce, sizeof(TPM_NONCE));
-	memcpy(&seed[sizeof(TPM_NONCE)], pTransAuth->NonceOdd.nonce, sizeof(TPM_NONCE));
-	memcpy(&seed[2 * sizeof(TPM_NONCE)], "out", strlen("out"));
-
-	switch (transPub->algId) {
-	case TPM_ALG_MGF1:
-	{
-		decLen = inLen;
-		seedLen = sizeof(seed);
-
-		/* add the secret data to the seed for MGF1 */
-		memcpy(&seed[2 * sizeof(TPM_NONCE) + strlen("out")], secret, TPM_SHA1_160_HASH_LEN);
-
-		if ((result = Trspi_MGF1(TSS_HASH_SHA1, seedLen, seed, decLen, dec))) {
-			free(dec);
-			return result;
-		}
-
-		for (i = 0; i < inLen; i++)
-			dec[i] ^= in[i];
-		break;
-	}
-	case TPM_ALG_AES128:
-	{
-		BYTE iv[TSS_MAX_SYM_BLOCK_SIZE];
-
-		ivLen = TSS_MAX_SYM_BLOCK_SIZE;
-		seedLen = (2 * sizeof(TPM_NONCE)) + strlen("out");
-
-		if ((result = Trspi_MGF1(TSS_HASH_SHA1, seedLen, seed, ivLen, iv))) {
-			free(dec);
-			return result;
-		}
+	BYTE *buf;
 
-		/* use the secret data as the key for AES */
-		if ((result = Trspi_SymEncrypt(transPub->algId, transPub->encScheme, secret, iv, in,
-					       inLen, dec, &decLen))) {
-			free(dec);
-			return result;
-		}
+	if (size <= context->transBufSize)
+		return TSS_SUCCESS;
 
-		break;
-	}
-	default:
-		LogDebug("Unknown algorithm for encrypted transport session: 0x%x",
-			 transPub->algId);
-		free(dec);
-		return TSPERR(TSS_E_INTERNAL_ERROR);
+	if ((buf = realloc(context->transBuf, size)) == NULL) {
+		LogError("malloc of %u bytes failed.", size);
+		return TSPERR(TSS_E_OUTOFMEMORY);
 	}
 
-	*out = dec;
-	*outLen = decLen;
+	context->transBuf = buf;
+	context->transBufSize = size;
 
-	return result;
+	return TSS_SUCCESS;
 }
 
-TSS_RESULT
-do_transport_encryption(TPM_TRANSPORT_PUBLIC *transPub,
-			TPM_AUTH *pTransAuth,
-			BYTE *secret,
-			UINT32 inLen,
-			BYTE *in,
-			UINT32 *outLen,
-			BYTE **out)
+/*
+ * Encrypt (@label "in") or decrypt (@label "out") @len bytes of @in into @out, which may be the
+ * same buffer. MGF1 sessions XOR the mask into the data as it's generated. AES sessions keep a
+ * cipher context keyed with the session secret for as long as the session lasts, and only derive
+ * a new IV for each command.
+ */
+static TSS_RESULT
+do_transport_crypt(struct tr_context_obj *context, char *label, UINT32 len, BYTE *in, BYTE *out)
 {
 	TSS_RESULT result;
-	UINT32 i, encLen;
-	UINT32 seedLen, ivLen;
-	BYTE *enc;
-	BYTE seed[(2 * sizeof(TPM_NONCE)) + strlen("in") + TPM_SHA1_160_HASH_LEN];
-
-	/* allocate the most data anyone below might need */
-	encLen = ((inLen / TSS_MAX_SYM_BLOCK_SIZE) + 1) * TSS_MAX_SYM_BLOCK_SIZE;
-	if ((enc = malloc(encLen)) == NULL) {
-		LogError("malloc of %u bytes failed", encLen);
-		return TSPERR(TSS_E_OUTOFMEMORY);
-	}
+	TPM_AUTH *pTransAuth = &context->transAuth;
+	BYTE *secret = context->transSecret.authData.authdata;
+	UINT32 labelLen = strlen(label);
+	BYTE seed[(2 * sizeof(TPM_NONCE)) + strlen("out") + TPM_SHA1_160_HASH_LEN];
 
 	/* set the common 3 initial values of 'seed', which is used to generate either the IV or
 	 * mask */
 	memcpy(seed, pTransAuth->NonceEven.nonce, sizeof(TPM_NONCE));
 	memcpy(&seed[sizeof(TPM_NONCE)], pTransAuth->NonceOdd.nonce, sizeof(TPM_NONCE));
-	memcpy(&seed[2 * sizeof(TPM_NONCE)], "in", strlen("in"));
+	memcpy(&seed[2 * sizeof(TPM_NONCE)], label, labelLen);
 
-	switch (transPub->algId) {
+	switch (context->transPub.algId) {
 	case TPM_ALG_MGF1:
-	{
-		encLen = inLen;
-		seedLen = sizeof(seed);
-
 		/* add the secret data to the seed for MGF1 */
-		memcpy(&seed[2 * sizeof(TPM_NONCE) + strlen("in")], secret, TPM_SHA1_160_HASH_LEN);
-
-		if ((result = Trspi_MGF1(TSS_HASH_SHA1, seedLen, seed, encLen, enc))) {
-			free(enc);
-			return result;
-		}
+		memcpy(&seed[2 * sizeof(TPM_NONCE) + labelLen], secret, TPM_SHA1_160_HASH_LEN);
 
-		for (i = 0; i < inLen; i++)
-			enc[i] ^= in[i];
+		result = Trspi_MGF1_Xor(TSS_HASH_SHA1, (2 * sizeof(TPM_NONCE)) + labelLen +
+					TPM_SHA1_160_HASH_LEN, seed, len, in, out);
 		break;
-	}
 	case TPM_ALG_AES128:
 	{
 		BYTE iv[TSS_MAX_SYM_BLOCK_SIZE];
 
-		ivLen = TSS_MAX_SYM_BLOCK_SIZE;
-		seedLen = (2 * sizeof(TPM_NONCE)) + strlen("in");
-
-		if ((result = Trspi_MGF1(TSS_HASH_SHA1, seedLen, seed, ivLen, iv))) {
-			free(enc);
+		/* use the secret data as the key for AES */
+		if (context->transCipher.ctx == NULL &&
+		    (result = Trspi_SymKey_Init(&context->transCipher, context->transPub.algId,
+						context->transPub.encScheme, secret)))
 			return result;
-		}
 
-		/* use the secret data as the key for AES */
-		if ((result = Trspi_SymEncrypt(transPub->algId, transPub->encScheme, secret, iv, in,
-					       inLen, enc, &encLen))) {
-			free(enc);
+		if ((result = Trspi_MGF1(TSS_HASH_SHA1, (2 * sizeof(TPM_NONCE)) + labelLen, seed,
+					 sizeof(iv), iv)))
 			return result;
-		}
 
+		result = Trspi_SymKey_Crypt(&context->transCipher, iv, len, in, out);
 		break;
 	}
 	default:
 		LogDebug("Unknown algorithm for encrypted transport session: 0x%x",
-			 transPub->algId);
-		free(enc);
-		return TSPERR(TSS_E_INTERNAL_ERROR);
+			 context->transPub.algId);
+		result = TSPERR(TSS_E_INTERNAL_ERROR);
+		break;
 	}
 
-	*out = enc;
-	*outLen = encLen;
-
 	return result;
 }
 
@@ -1079,8 +1002,9 @@ obj_context_transport_execute(TSS_HCONTEXT     tspContext,
 	Trspi_HashCtx hashCtx;
 	TPM_DIGEST etDigest, wDigest;
 	TPM_AUTH *pTransAuth;
-	UINT64 currentTicks;
-	TSS_BOOL free_enc = FALSE;
+	UINT64 currentTicks, offset;
+	UINT32 entityValueLen;
+	BYTE logBlob[sizeof(TPM_DIGEST) + sizeof(UINT16) + (2 * sizeof(TPM_DIGEST))];
 
 	if ((obj = obj_list_get_obj(&context_list, tspContext)) == NULL)
 		return TSPERR(TSS_E_INVALID_HANDLE);
@@ -1115,11 +1039,15 @@ obj_context_transport_execute(TSS_HCONTEXT     tspContext,
 		else
 			memset(context->transLogIn.pubKeyHash.digest, 0, sizeof(TPM_DIGEST));
 
-		/* TPM Commands spec rev106 step 10.f */
-		result = Trspi_HashInit(&hashCtx, TSS_HASH_SHA1);
-		result |= Trspi_Hash_DIGEST(&hashCtx, context->transLogDigest.digest);
-		result |= Trspi_Hash_TRANSPORT_LOG_IN(&hashCtx, &context->transLogIn);
-		if ((result |= Trspi_HashFinal(&hashCtx, context->transLogDigest.digest)))
+		/* TPM Commands spec rev106 step 10.f. The chain input has a fixed size, so marshal
+		 * it once and hash it in one go */
+		offset = 0;
+		Trspi_LoadBlob_DIGEST(&offset, logBlob, &context->transLogDigest);
+		Trspi_LoadBlob_UINT16(&offset, context->transLogIn.tag, logBlob);
+		Trspi_LoadBlob_DIGEST(&offset, logBlob, &context->transLogIn.parameters);
+		Trspi_LoadBlob_DIGEST(&offset, logBlob, &context->transLogIn.pubKeyHash);
+		if ((result = Trspi_Hash(TSS_HASH_SHA1, offset, logBlob,
+					 context->transLogDigest.digest)))
 			goto done;
 	}
 
@@ -1142,50 +1070,40 @@ obj_context_transport_execute(TSS_HCONTEXT     tspContext,
 			encLen = ulDataLen;
 			pEnc = rgbData;
 			break;
-		case TPM_ORD_DSAP:
-		{
-			UINT64 offset;
-			UINT32 tmpLen, entityValueLen;
-			BYTE *tmpEnc, *entityValuePtr;
+		default:
+			/* rgbData belongs to the caller, so the ciphertext goes into the session
+			 * buffer */
+			if ((result = transport_buffer_reserve(context, ulDataLen)))
+				goto done;
+			pEnc = context->transBuf;
 
-			/* DSAP is a special case where only entityValue is encrypted. So, we'll
-			 * parse through rgbData until we get to entityValue, encrypt it, alloc
-			 * new space for rgbData (since it could be up to a block length larger
-			 * than it came in) and copy the unencrypted data and the encrypted
-			 * entityValue to the new block, setting pEnc and encLen to new values. */
+			if (ordinal != TPM_ORD_DSAP) {
+				encLen = ulDataLen;
+				if ((result = do_transport_crypt(context, "in", ulDataLen, rgbData,
+								 pEnc)))
+					goto done;
+				break;
+			}
 
+			/* DSAP is a special case where only entityValue is encrypted. So, we'll
+			 * parse through rgbData until we get to entityValue, copy the unencrypted
+			 * data in front of it and encrypt entityValue behind that. */
 			offset = (2 * sizeof(UINT32)) + sizeof(TPM_NONCE);
-			Trspi_UnloadBlob_UINT32(&offset, &entityValueLen, rgbData);
-
-			entityValuePtr = &rgbData[offset];
-			if ((result = do_transport_encryption(&context->transPub, pTransAuth,
-							context->transSecret.authData.authdata,
-							entityValueLen, entityValuePtr, &tmpLen,
-							&tmpEnc)))
+			if (ulDataLen < offset + sizeof(UINT32)) {
+				result = TSPERR(TSS_E_BAD_PARAMETER);
 				goto done;
-
-			/* offset is the amount of data before the block we encrypted and tmpLen is
-			 * the size of the encrypted data */
-			encLen = offset + tmpLen;
-			if ((pEnc = malloc(encLen)) == NULL) {
-				LogError("malloc of %u bytes failed.", encLen);
-				result = TSPERR(TSS_E_OUTOFMEMORY);
+			}
+			Trspi_UnloadBlob_UINT32(&offset, &entityValueLen, rgbData);
+			if (entityValueLen > ulDataLen - offset) {
+				result = TSPERR(TSS_E_BAD_PARAMETER);
 				goto done;
 			}
-			memcpy(pEnc, rgbData, offset);
-			memcpy(&pEnc[offset], tmpEnc, tmpLen);
-			free(tmpEnc);
 
-			free_enc = TRUE;
-			break;
-		}
-		default:
-			if ((result = do_transport_encryption(&context->transPub, pTransAuth,
-							context->transSecret.authData.authdata,
-							ulDataLen, rgbData, &encLen, &pEnc)))
+			encLen = offset + entityValueLen;
+			memcpy(pEnc, rgbData, offset);
+			if ((result = do_transport_crypt(context, "in", entityValueLen,
+							 &rgbData[offset], &pEnc[offset])))
 				goto done;
-
-			free_enc = TRUE;
 			break;
 		}
 	} else {
@@ -1221,13 +1139,15 @@ obj_context_transport_execute(TSS_HCONTEXT     tspContext,
 			*out = rgbWrappedData;
 			break;
 		default:
-			if ((result = do_transport_decryption(&context->transPub, pTransAuth,
-							context->transSecret.authData.authdata,
-							ulWrappedDataLen, rgbWrappedData, outLen,
-							out)))
-					goto done;
+			/* the wrapped response is ours, so decrypt it where it is */
+			if ((result = do_transport_crypt(context, "out", ulWrappedDataLen,
+							 rgbWrappedData, rgbWrappedData))) {
+				free(rgbWrappedData);
+				goto done;
+			}
 
-			free(rgbWrappedData);
+			*outLen = ulWrappedDataLen;
+			*out = rgbWrappedData;
 		}
 	} else {
 		if (outLen) {
@@ -1299,8 +1219,9 @@ obj_context_transport_execute(TSS_HCONTEXT     tspContext,
 	}
 
 done:
-	if (free_enc)
-		free(pEnc);
+	/* DSAP leaves part of the command in the clear in the session buffer */
+	if (pEnc != NULL && pEnc == context->transBuf)
+		memset(pEnc, 0, ulDataLen);
 	obj_list_put(&context_list);
 
 	return result;
@@ -1420,6 +1341,7 @@ obj_context_transport_close(TSS_HCONTEXT   tspContext,
 	signInfo->dataLen = sizeof(TPM_DIGEST);
 
 	/* destroy all transport session info, except the key handle */
+	Trspi_SymKey_Free(&context->transCipher);
 	memset(&context->transPub, 0, sizeof(TPM_TRANSPORT_PUBLIC));
 	memset(&context->transMod, 0, sizeof(TPM_MODIFIER_INDICATOR));
 	memset(&context->transSecret, 0, sizeof(TPM_TRANSPORT_AUTH));
@@ -596,7 +596,7 @@ obj_pcrs_create_info(TSS_HPCRS hPcrs, UINT32 *size, BYTE **info)
 	struct tr_pcrs_obj *pcrs;
 	TSS_RESULT result = TSS_SUCCESS;
 	TPM_PCR_INFO info11;
-	UINT64 offset;
+	struct blob_cursor c;
 	UINT32 ret_size;
 	BYTE *ret;
 
@@ -625,9 +625,7 @@ obj_pcrs_create_info(TSS_HPCRS hPcrs, UINT32 *size, BYTE **info)
 			goto done;
 	}
 
-	offset = 0;
-	Trspi_LoadBlob_PCR_INFO(&offset, NULL, &info11);
-	ret_size = offset;
+	ret_size = BLOB_SIZEOF_PCR_INFO(&info11);
 
 	if ((ret = calloc(1, ret_size)) == NULL) {
 		result = TSPERR(TSS_E_OUTOFMEMORY);
@@ -635,8 +633,8 @@ obj_pcrs_create_info(TSS_HPCRS hPcrs, UINT32 *size, BYTE **info)
 		goto done;
 	}
 
-	offset = 0;
-	Trspi_LoadBlob_PCR_INFO(&offset, ret, &info11);
+	blob_cursor_init(&c, ret, ret_size, 0);
+	Trspi_PutBlob_PCR_INFO(&c, &info11);
 
 	*info = ret;
 	*size = ret_size;
@@ -656,7 +654,7 @@ obj_pcrs_create_info_long(TSS_HPCRS hPcrs, UINT32 *size, BYTE **info)
 	TPM_PCR_INFO_LONG infolong;
 	BYTE dummyBits[3] = { 0, 0, 0 };
 	TPM_PCR_SELECTION dummySelection = { 3, dummyBits };
-	UINT64 offset;
+	struct blob_cursor c;
 	UINT32 ret_size;
 	BYTE *ret;
 
@@ -695,9 +693,7 @@ obj_pcrs_create_info_long(TSS_HPCRS hPcrs, UINT32 *size, BYTE **info)
 			goto done;
 	}
 
-	offset = 0;
-	Trspi_LoadBlob_PCR_INFO_LONG(&offset, NULL, &infolong);
-	ret_size = offset;
+	ret_size = BLOB_SIZEOF_PCR_INFO_LONG(&infolong);
 
 	if ((ret = calloc(1, ret_size)) == NULL) {
 		result = TSPERR(TSS_E_OUTOFMEMORY);
@@ -705,8 +701,8 @@ obj_pcrs_create_info_long(TSS_HPCRS hPcrs, UINT32 *size, BYTE **info)
 		goto done;
 	}
 
-	offset = 0;
-	Trspi_LoadBlob_PCR_INFO_LONG(&offset, ret, &infolong);
+	blob_cursor_init(&c, ret, ret_size, 0);
+	Trspi_PutBlob_PCR_INFO_LONG(&c, &infolong);
 
 	*info = ret;
 	*size = ret_size;
@@ -725,7 +721,7 @@ obj_pcrs_create_info_short(TSS_HPCRS hPcrs, UINT32 *size, BYTE **info)
 	TSS_RESULT result = TSS_SUCCESS;
 	TPM_PCR_INFO_SHORT infoshort;
 	BYTE select[] = { 0, 0, 0 };
-	UINT64 offset;
+	struct blob_cursor c;
 	UINT32 ret_size;
 	BYTE *ret;
 
@@ -762,9 +758,7 @@ obj_pcrs_create_info_short(TSS_HPCRS hPcrs, UINT32 *size, BYTE **info)
 		infoshort.localityAtRelease = TSS_LOCALITY_ALL;
 	}
 
-	offset = 0;
-	Trspi_LoadBlob_PCR_INFO_SHORT(&offset, NULL, &infoshort);
-	ret_size = offset;
+	ret_size = BLOB_SIZEOF_PCR_INFO_SHORT(&infoshort);
 
 	if ((ret = calloc(1, ret_size)) == NULL) {
 		result = TSPERR(TSS_E_OUTOFMEMORY);
@@ -772,8 +766,8 @@ obj_pcrs_create_info_short(TSS_HPCRS hPcrs, UINT32 *size, BYTE **info)
 		goto done;
 	}
 
-	offset = 0;
-	Trspi_LoadBlob_PCR_INFO_SHORT(&offset, ret, &infoshort);
+	blob_cursor_init(&c, ret, ret_size, 0);
+	Trspi_PutBlob_PCR_INFO_SHORT(&c, &infoshort);
 
 	*info = ret;
 	*size = ret_size;
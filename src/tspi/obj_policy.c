@@ -69,6 +69,7 @@ __tspi_policy_free(void *data)
 #ifdef TSS_BUILD_DELEGATION
 	free(policy->delegationBlob);
 #endif
+	Trspi_HMAC_KeyFree(&policy->SecretHmacKey);
 	free(policy);
 }
 
@@ -182,25 +183,20 @@ obj_policy_do_hmac(TSS_HPOLICY hPolicy, TSS_HOBJECT hAuthorizedObject,
 	return result;
 }
 
-TSS_RESULT
-obj_policy_get_secret(TSS_HPOLICY hPolicy, TSS_BOOL ctx, TCPA_SECRET *secret)
+/* caller needs to hold the policy list lock */
+static TSS_RESULT
+policy_get_secret(struct tr_policy_obj *policy, TSS_BOOL ctx, TCPA_SECRET *secret)
 {
-	struct tsp_object *obj;
-	struct tr_policy_obj *policy;
 	TSS_RESULT result = TSS_SUCCESS;
 	TCPA_SECRET null_secret;
 
-	if ((obj = obj_list_get_obj(&policy_list, hPolicy)) == NULL)
-		return TSPERR(TSS_E_INVALID_HANDLE);
-
-	policy = (struct tr_policy_obj *)obj->data;
-
 	memset(&null_secret, 0, sizeof(TCPA_SECRET));
 
 	switch (policy->SecretMode) {
 		case TSS_SECRET_MODE_POPUP:
 			/* if the secret is still NULL, grab it using the GUI */
 			if (policy->SecretSet == FALSE) {
+				Trspi_HMAC_KeyFree(&policy->SecretHmacKey);
 				if ((result = popup_GetSecret(ctx,
 							      policy->hashMode,
 							      policy->popupString,
@@ -231,6 +227,70 @@ obj_policy_get_secret(TSS_HPOLICY hPolicy, TSS_BOOL ctx, TCPA_SECRET *secret)
 		LogDebugData(20, (BYTE *)secret);
 	}
 #endif
+	return result;
+}
+
+TSS_RESULT
+obj_policy_get_secret(TSS_HPOLICY hPolicy, TSS_BOOL ctx, TCPA_SECRET *secret)
+{
+	struct tsp_object *obj;
+	struct tr_policy_obj *policy;
+	TSS_RESULT result;
+
+	if ((obj = obj_list_get_obj(&policy_list, hPolicy)) == NULL)
+		return TSPERR(TSS_E_INVALID_HANDLE);
+
+	policy = (struct tr_policy_obj *)obj->data;
+
+	result = policy_get_secret(policy, ctx, secret);
+
+	obj_list_put(&policy_list);
+
+	return result;
+}
+
+/* Return the HMAC key schedule for @policy's secret, deriving it if this is the first use
+ * of the secret since it was set. Caller needs to hold the policy list lock for as long as
+ * the key is in use */
+TSS_RESULT
+obj_policy_get_hmac_key(struct tr_policy_obj *policy, TSS_BOOL ctx, Trspi_HmacKey **key)
+{
+	TCPA_SECRET secret;
+	TSS_RESULT result;
+
+	if (policy->SecretHmacKey.key == NULL) {
+		if ((result = policy_get_secret(policy, ctx, &secret)))
+			return result;
+
+		result = Trspi_HMAC_KeyInit(&policy->SecretHmacKey, TSS_HASH_SHA1,
+					    sizeof(TCPA_SECRET), secret.authdata);
+		memset(&secret, 0, sizeof(TCPA_SECRET));
+		if (result)
+			return result;
+	}
+
+	*key = &policy->SecretHmacKey;
+
+	return TSS_SUCCESS;
+}
+
+/* Compute the HMAC for an OIAP authorized command using @hPolicy's secret */
+TSS_RESULT
+obj_policy_hmac_auth(TSS_HPOLICY hPolicy, TSS_BOOL ctx, BYTE *digest, TPM_AUTH *auth)
+{
+	struct tsp_object *obj;
+	struct tr_policy_obj *policy;
+	Trspi_HmacKey *key;
+	TSS_RESULT result;
+
+	if ((obj = obj_list_get_obj(&policy_list, hPolicy)) == NULL)
+		return TSPERR(TSS_E_INVALID_HANDLE);
+
+	policy = (struct tr_policy_obj *)obj->data;
+
+	if ((result = obj_policy_get_hmac_key(policy, ctx, &key)) == TSS_SUCCESS)
+		result = HMAC_Auth_Keyed(key, digest, auth);
+
 	obj_list_put(&policy_list);
 
 	return result;
@@ -249,6 +309,7 @@ obj_policy_flush_secret(TSS_HPOLICY hPolicy)
 
 	memset(&policy->Secret, 0, policy->SecretSize);
 	policy->SecretSet = FALSE;
+	Trspi_HMAC_KeyFree(&policy->SecretHmacKey);
 
 	obj_list_put(&policy_list);
 
@@ -292,6 +353,7 @@ obj_policy_set_secret_object(TSS_HPOLICY hPolicy, TSS_FLAG mode, UINT32 size,
 	}
 
 	memcpy(policy->Secret, digest, size);
+	Trspi_HMAC_KeyFree(&policy->SecretHmacKey);
 	policy->SecretMode = mode;
 	policy->SecretSize = size;
 	policy->SecretSet = set;
@@ -979,6 +1041,7 @@ obj_policy_get_xsap_params(TSS_HPOLICY hPolicy,
 
 	if ((policy->SecretMode == TSS_SECRET_MODE_POPUP) &&
 	    (policy->SecretSet == FALSE)) {
+		Trspi_HMAC_KeyFree(&policy->SecretHmacKey);
 		if ((result = popup_GetSecret(new_secret,
 					      policy->hashMode,
 					      policy->popupString,
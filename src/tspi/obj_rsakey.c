@@ -1064,26 +1064,23 @@ obj_rsakey_get_blob(TSS_HKEY hKey, UINT32 *size, BYTE **data)
 	struct tsp_object *obj;
 	struct tr_rsakey_obj *rsakey;
 	TSS_RESULT result = TSS_SUCCESS;
-	UINT64 offset;
+	struct blob_cursor c;
 
 	if ((obj = obj_list_get_obj(&rsakey_list, hKey)) == NULL)
 		return TSPERR(TSS_E_INVALID_HANDLE);
 
 	rsakey = (struct tr_rsakey_obj *)obj->data;
 
-	offset = 0;
-	LoadBlob_TSS_KEY(&offset, NULL, &rsakey->key);
-
-	*data = calloc_tspi(obj->tspContext, offset);
+	*size = BLOB_SIZEOF_KEY(&rsakey->key);
+	*data = calloc_tspi(obj->tspContext, *size);
 	if (*data == NULL) {
-		LogError("malloc of %" PRIu64 " bytes failed.", offset);
+		LogError("malloc of %u bytes failed.", *size);
 		result = TSPERR(TSS_E_OUTOFMEMORY);
 		goto done;
 	}
 
-	offset = 0;
-	LoadBlob_TSS_KEY(&offset, *data, &rsakey->key);
-	*size = offset;
+	blob_cursor_init(&c, *data, *size, 0);
+	PutBlob_TSS_KEY(&c, &rsakey->key);
 
 done:
 	obj_list_put(&rsakey_list);
@@ -1200,7 +1197,7 @@ obj_rsakey_get_pub_blob(TSS_HKEY hKey, UINT32 *size, BYTE **data)
 	struct tsp_object *obj;
 	struct tr_rsakey_obj *rsakey;
 	TSS_RESULT result = TSS_SUCCESS;
-	UINT64 offset;
+	struct blob_cursor c;
 
 	if ((obj = obj_list_get_obj(&rsakey_list, hKey)) == NULL)
 		return TSPERR(TSS_E_INVALID_HANDLE);
@@ -1220,21 +1217,18 @@ obj_rsakey_get_pub_blob(TSS_HKEY hKey, UINT32 *size, BYTE **data)
 		}
 	}
 
-	offset = 0;
-	Trspi_LoadBlob_KEY_PARMS(&offset, NULL, &rsakey->key.algorithmParms);
-	Trspi_LoadBlob_STORE_PUBKEY(&offset, NULL, &rsakey->key.pubKey);
-
-	*data = calloc_tspi(obj->tspContext, offset);
+	*size = BLOB_SIZEOF_KEY_PARMS(&rsakey->key.algorithmParms) +
+		BLOB_SIZEOF_STORE_PUBKEY(&rsakey->key.pubKey);
+	*data = calloc_tspi(obj->tspContext, *size);
 	if (*data == NULL) {
-		LogError("malloc of %" PRIu64 " bytes failed.", offset);
+		LogError("malloc of %u bytes failed.", *size);
 		result = TSPERR(TSS_E_OUTOFMEMORY);
 		goto done;
 	}
 
-	offset = 0;
-	Trspi_LoadBlob_KEY_PARMS(&offset, *data, &rsakey->key.algorithmParms);
-	Trspi_LoadBlob_STORE_PUBKEY(&offset, *data, &rsakey->key.pubKey);
-	*size = offset;
+	blob_cursor_init(&c, *data, *size, 0);
+	Trspi_PutBlob_KEY_PARMS(&c, &rsakey->key.algorithmParms);
+	Trspi_PutBlob_STORE_PUBKEY(&c, &rsakey->key.pubKey);
 
 done:
 	obj_list_put(&rsakey_list);
@@ -1248,7 +1242,7 @@ obj_rsakey_get_version(TSS_HKEY hKey, UINT32 *size, BYTE **data)
 	struct tsp_object *obj;
 	struct tr_rsakey_obj *rsakey;
 	TSS_RESULT result = TSS_SUCCESS;
-	UINT64 offset;
+	struct blob_cursor c;
 	TPM_STRUCT_VER ver = {1, 2, 0, 0}, *pVer;
 
 	if ((obj = obj_list_get_obj(&rsakey_list, hKey)) == NULL)
@@ -1261,19 +1255,16 @@ obj_rsakey_get_version(TSS_HKEY hKey, UINT32 *size, BYTE **data)
 	else
 		pVer = &rsakey->key.hdr.key11.ver;
 
-	offset = 0;
-	Trspi_LoadBlob_TCPA_VERSION(&offset, NULL, *pVer);
-
-	*data = calloc_tspi(obj->tspContext, offset);
+	*size = BLOB_SIZEOF_VERSION;
+	*data = calloc_tspi(obj->tspContext, *size);
 	if (*data == NULL) {
-		LogError("malloc of %" PRIu64 " bytes failed.", offset);
+		LogError("malloc of %u bytes failed.", *size);
 		result = TSPERR(TSS_E_OUTOFMEMORY);
 		goto done;
 	}
 
-	offset = 0;
-	Trspi_LoadBlob_TCPA_VERSION(&offset, *data, *pVer);
-	*size = offset;
+	blob_cursor_init(&c, *data, *size, 0);
+	Trspi_PutBlob_TCPA_VERSION(&c, pVer);
 
 done:
 	obj_list_put(&rsakey_list);
@@ -1370,26 +1361,23 @@ obj_rsakey_get_uuid(TSS_HKEY hKey, UINT32 *size, BYTE **data)
 	struct tsp_object *obj;
 	struct tr_rsakey_obj *rsakey;
 	TSS_RESULT result = TSS_SUCCESS;
-	UINT64 offset;
+	struct blob_cursor c;
 
 	if ((obj = obj_list_get_obj(&rsakey_list, hKey)) == NULL)
 		return TSPERR(TSS_E_INVALID_HANDLE);
 
 	rsakey = (struct tr_rsakey_obj *)obj->data;
 
-	offset = 0;
-	Trspi_LoadBlob_UUID(&offset, NULL, rsakey->uuid);
-
-	*data = calloc_tspi(obj->tspContext, offset);
+	*size = BLOB_SIZEOF_UUID;
+	*data = calloc_tspi(obj->tspContext, *size);
 	if (*data == NULL) {
-		LogError("malloc of %" PRIu64 " bytes failed.", offset);
+		LogError("malloc of %u bytes failed.", *size);
 		result = TSPERR(TSS_E_OUTOFMEMORY);
 		goto done;
 	}
 
-	offset = 0;
-	Trspi_LoadBlob_UUID(&offset, *data, rsakey->uuid);
-	*size = offset;
+	blob_cursor_init(&c, *data, *size, 0);
+	Trspi_PutBlob_UUID(&c, &rsakey->uuid);
 
 done:
 	obj_list_put(&rsakey_list);
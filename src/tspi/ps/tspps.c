@@ -50,6 +50,35 @@ static MUTEX_DECLARE_INIT(user_ps_path);
 #endif
 static struct flock fl;
 
+/* size of the fixed part of a key record, everything up to the public key data */
+#define USER_PS_KEY_HEADER_SIZE	((2 * sizeof(TSS_UUID)) + (3 * sizeof(UINT16)) + sizeof(UINT32))
+
+/*
+ * In-process index of the user PS file. A user PS holds a handful of keys, so the whole file is
+ * read in with one pass and its records are indexed by UUID; lookups after that don't touch the
+ * disk at all. The index is trusted for as long as the file's identity, size and timestamps
+ * haven't changed, which catches writes made by other processes. Writes made through this
+ * process keep it up to date themselves. Only used with user_ps_lock held.
+ */
+struct user_ps_index {
+	TSS_BOOL valid;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct timespec ctime;
+	BYTE *image;				/* file contents */
+	UINT32 num_keys;
+	UINT32 max_keys;
+	struct key_disk_cache *entries;
+	UINT32 num_buckets;
+	UINT32 *buckets;			/* index into entries + 1, 0 is an empty slot */
+};
+
+static struct user_ps_index user_ps_idx;
+/* set when the file has been written since the last put_file() */
+static TSS_BOOL user_ps_dirty = FALSE;
+
 
 /*
  * Determine the default path to the persistent storage file and create it if it doesn't exist.
@@ -219,7 +248,11 @@ put_file(int fd)
 {
 	int rc = 0;
 
-	fsync(fd);
+	/* read-only queries have nothing to flush */
+	if (user_ps_dirty) {
+		fsync(fd);
+		user_ps_dirty = FALSE;
+	}
 
 	/* release the file lock */
 	fl.l_type = F_UNLCK;
@@ -232,14 +265,322 @@ put_file(int fd)
 	return rc;
 }
 
+static void
+psfile_index_free()
+{
+	free(user_ps_idx.image);
+	free(user_ps_idx.entries);
+	free(user_ps_idx.buckets);
+	memset(&user_ps_idx, 0, sizeof(struct user_ps_index));
+}
+
 void
 psfile_close(int fd)
 {
+	if (user_ps_dirty) {
+		fsync(fd);
+		user_ps_dirty = FALSE;
+	}
 	close(fd);
 	user_ps_fd = -1;
+	psfile_index_free();
 	MUTEX_UNLOCK(user_ps_lock);
 }
 
+static UINT32
+psfile_index_hash(TSS_UUID *uuid)
+{
+	BYTE *p = (BYTE *)uuid;
+	UINT32 i, h = 2166136261U;
+
+	/* FNV-1a, UUIDs handed out by applications are often sequential in a single field */
+	for (i = 0; i < sizeof(TSS_UUID); i++) {
+		h ^= p[i];
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+/* Returns the first record in the file with the given UUID, or NULL */
+static struct key_disk_cache *
+psfile_index_find(TSS_UUID *uuid)
+{
+	UINT32 b, slot;
+
+	if (user_ps_idx.num_buckets == 0)
+		return NULL;
+
+	b = psfile_index_hash(uuid) & (user_ps_idx.num_buckets - 1);
+	while ((slot = user_ps_idx.buckets[b])) {
+		if (!memcmp(&user_ps_idx.entries[slot - 1].uuid, uuid, sizeof(TSS_UUID)))
+			return &user_ps_idx.entries[slot - 1];
+		b = (b + 1) & (user_ps_idx.num_buckets - 1);
+	}
+
+	return NULL;
+}
+
+static void
+psfile_index_insert(UINT32 i)
+{
+	UINT32 b;
+
+	/* a duplicate UUID stays hidden behind the record that comes first in the file, the
+	 * same one a scan of the file would have found */
+	if (psfile_index_find(&user_ps_idx.entries[i].uuid))
+		return;
+
+	b = psfile_index_hash(&user_ps_idx.entries[i].uuid) & (user_ps_idx.num_buckets - 1);
+	while (user_ps_idx.buckets[b])
+		b = (b + 1) & (user_ps_idx.num_buckets - 1);
+
+	user_ps_idx.buckets[b] = i + 1;
+}
+
+/* Size the hash table for at least @num_keys keys at half load and put every entry in it */
+static TSS_RESULT
+psfile_index_rehash(UINT32 num_keys)
+{
+	UINT32 i, num_buckets = 16;
+
+	while (num_buckets < 2 * num_keys)
+		num_buckets *= 2;
+
+	if (num_buckets != user_ps_idx.num_buckets) {
+		free(user_ps_idx.buckets);
+		user_ps_idx.num_buckets = 0;
+		if ((user_ps_idx.buckets = calloc(num_buckets, sizeof(UINT32))) == NULL) {
+			LogDebug("malloc of %zu bytes failed.", num_buckets * sizeof(UINT32));
+			return TSPERR(TSS_E_OUTOFMEMORY);
+		}
+		user_ps_idx.num_buckets = num_buckets;
+	} else
+		memset(user_ps_idx.buckets, 0, num_buckets * sizeof(UINT32));
+
+	for (i = 0; i < user_ps_idx.num_keys; i++)
+		psfile_index_insert(i);
+
+	return TSS_SUCCESS;
+}
+
+static void
+psfile_index_stamp(struct stat *st)
+{
+	user_ps_idx.dev = st->st_dev;
+	user_ps_idx.ino = st->st_ino;
+	user_ps_idx.size = st->st_size;
+	user_ps_idx.mtime = st->st_mtim;
+	user_ps_idx.ctime = st->st_ctim;
+}
+
+static TSS_BOOL
+psfile_index_is_current(struct stat *st)
+{
+	return user_ps_idx.valid &&
+	       user_ps_idx.dev == st->st_dev &&
+	       user_ps_idx.ino == st->st_ino &&
+	       user_ps_idx.size == st->st_size &&
+	       user_ps_idx.mtime.tv_sec == st->st_mtim.tv_sec &&
+	       user_ps_idx.mtime.tv_nsec == st->st_mtim.tv_nsec &&
+	       user_ps_idx.ctime.tv_sec == st->st_ctim.tv_sec &&
+	       user_ps_idx.ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+/* Walk the key records in the file image, filling in the index entries */
+static TSS_RESULT
+psfile_index_parse()
+{
+	BYTE *image = user_ps_idx.image;
+	UINT64 offset = TSSPS_KEYS_OFFSET, size = user_ps_idx.size;
+	struct key_disk_cache *c, *entries;
+	UINT32 i, num_keys, max_keys;
+
+	user_ps_idx.num_keys = 0;
+	if (size < TSSPS_KEYS_OFFSET)
+		return psfile_index_rehash(0);
+
+	memcpy(&num_keys, &image[TSSPS_NUM_KEYS_OFFSET], sizeof(UINT32));
+	num_keys = LE_32(num_keys);
+
+	/* every record has at least its fixed part, don't trust a bogus count */
+	if (num_keys > (size - TSSPS_KEYS_OFFSET) / USER_PS_KEY_HEADER_SIZE) {
+		LogDebug("USER PS: file claims %u keys in %llu bytes", num_keys,
+			 (unsigned long long)size);
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	if (num_keys > user_ps_idx.max_keys) {
+		/* leave room for keys registered later on */
+		max_keys = num_keys + 16;
+		if ((entries = realloc(user_ps_idx.entries,
+				       max_keys * sizeof(struct key_disk_cache))) == NULL) {
+			LogDebug("malloc of %zu bytes failed.",
+				 max_keys * sizeof(struct key_disk_cache));
+			return TSPERR(TSS_E_OUTOFMEMORY);
+		}
+		user_ps_idx.entries = entries;
+		user_ps_idx.max_keys = max_keys;
+	}
+
+	for (i = 0; i < num_keys; i++) {
+		c = &user_ps_idx.entries[i];
+
+		if (offset + USER_PS_KEY_HEADER_SIZE > size)
+			goto truncated;
+
+		memset(c, 0, sizeof(struct key_disk_cache));
+		c->offset = offset;
+		memcpy(&c->uuid, &image[TSSPS_UUID_OFFSET(c)], sizeof(TSS_UUID));
+		memcpy(&c->parent_uuid, &image[TSSPS_PARENT_UUID_OFFSET(c)], sizeof(TSS_UUID));
+		memcpy(&c->pub_data_size, &image[TSSPS_PUB_DATA_SIZE_OFFSET(c)], sizeof(UINT16));
+		c->pub_data_size = LE_16(c->pub_data_size);
+		memcpy(&c->blob_size, &image[TSSPS_BLOB_SIZE_OFFSET(c)], sizeof(UINT16));
+		c->blob_size = LE_16(c->blob_size);
+		memcpy(&c->vendor_data_size, &image[TSSPS_VENDOR_SIZE_OFFSET(c)], sizeof(UINT32));
+		c->vendor_data_size = LE_32(c->vendor_data_size);
+		memcpy(&c->flags, &image[TSSPS_CACHE_FLAGS_OFFSET(c)], sizeof(UINT16));
+		c->flags = LE_16(c->flags);
+
+		DBG_ASSERT(c->pub_data_size <= 2048 && c->pub_data_size > 0);
+		DBG_ASSERT(c->blob_size <= 4096 && c->blob_size > 0);
+
+		offset = (UINT64)TSSPS_VENDOR_DATA_OFFSET(c) + c->vendor_data_size;
+		if (offset > size)
+			goto truncated;
+
+		user_ps_idx.num_keys++;
+	}
+
+	return psfile_index_rehash(num_keys);
+
+truncated:
+	LogDebug("USER PS: key record %u runs past the end of the file", i);
+	return TSPERR(TSS_E_INTERNAL_ERROR);
+}
+
+/*
+ * Make sure the index reflects what's on disk right now, re-reading the file only if it has
+ * changed since the index was built. Must be called with the file locked by get_file().
+ */
+static TSS_RESULT
+psfile_index_load(int fd)
+{
+	TSS_RESULT result;
+	struct stat st;
+	BYTE *image;
+	ssize_t rc;
+	off_t done;
+
+	if (fstat(fd, &st) == -1) {
+		LogDebug("USER PS: fstat: %s", strerror(errno));
+		user_ps_idx.valid = FALSE;
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	if (psfile_index_is_current(&st))
+		return TSS_SUCCESS;
+
+	user_ps_idx.valid = FALSE;
+
+	if ((image = realloc(user_ps_idx.image, st.st_size ? st.st_size : 1)) == NULL) {
+		LogDebug("malloc of %lld bytes failed.", (long long)st.st_size);
+		return TSPERR(TSS_E_OUTOFMEMORY);
+	}
+	user_ps_idx.image = image;
+
+	for (done = 0; done < st.st_size; done += rc) {
+		rc = pread(fd, image + done, st.st_size - done, done);
+		if (rc == -1 && errno == EINTR) {
+			rc = 0;
+			continue;
+		} else if (rc <= 0) {
+			LogDebug("USER PS: read of %lld bytes: %s", (long long)st.st_size,
+				 rc ? strerror(errno) : "short read");
+			return TSPERR(TSS_E_INTERNAL_ERROR);
+		}
+	}
+
+	user_ps_idx.size = st.st_size;
+	if ((result = psfile_index_parse()))
+		return result;
+
+	psfile_index_stamp(&st);
+	user_ps_idx.valid = TRUE;
+
+	return TSS_SUCCESS;
+}
+
+/* Add the record just appended at the end of the file to the index. If anything goes wrong
+ * the index is simply dropped and rebuilt from the file on the next lookup. */
+static void
+psfile_index_append(int fd, BYTE *rec, UINT32 rec_size)
+{
+	struct stat st;
+	BYTE *image;
+	UINT32 num_keys;
+
+	if (!user_ps_idx.valid || user_ps_idx.size < (off_t)TSSPS_KEYS_OFFSET)
+		goto invalidate;
+
+	if (fstat(fd, &st) == -1 || st.st_size != user_ps_idx.size + (off_t)rec_size)
+		goto invalidate;
+
+	if ((image = realloc(user_ps_idx.image, st.st_size)) == NULL)
+		goto invalidate;
+	user_ps_idx.image = image;
+	memcpy(image + user_ps_idx.size, rec, rec_size);
+
+	/* psfile_change_num_keys() has already updated the count on disk */
+	num_keys = LE_32(user_ps_idx.num_keys + 1);
+	memcpy(&image[TSSPS_NUM_KEYS_OFFSET], &num_keys, sizeof(UINT32));
+
+	user_ps_idx.size = st.st_size;
+	if (psfile_index_parse())
+		goto invalidate;
+
+	psfile_index_stamp(&st);
+	return;
+
+invalidate:
+	user_ps_idx.valid = FALSE;
+}
+
+/* Drop the record at [@head, @tail) that was just cut out of the file from the index */
+static void
+psfile_index_cut(int fd, UINT32 head, UINT32 tail)
+{
+	struct stat st;
+	UINT32 num_keys;
+
+	if (!user_ps_idx.valid)
+		return;
+
+	if (fstat(fd, &st) == -1 || st.st_size != user_ps_idx.size - (off_t)(tail - head))
+		goto invalidate;
+
+	memmove(&user_ps_idx.image[head], &user_ps_idx.image[tail], user_ps_idx.size - tail);
+
+	num_keys = LE_32(user_ps_idx.num_keys - 1);
+	memcpy(&user_ps_idx.image[TSSPS_NUM_KEYS_OFFSET], &num_keys, sizeof(UINT32));
+
+	user_ps_idx.size = st.st_size;
+	if (psfile_index_parse())
+		goto invalidate;
+
+	psfile_index_stamp(&st);
+	return;
+
+invalidate:
+	user_ps_idx.valid = FALSE;
+}
+
+static inline BYTE *
+psfile_index_blob(struct key_disk_cache *c)
+{
+	return &user_ps_idx.image[TSSPS_BLOB_DATA_OFFSET(c)];
+}
+
 TSS_RESULT
 psfile_is_key_registered(int fd, TSS_UUID *uuid, TSS_BOOL *answer)
 {
@@ -293,35 +634,20 @@ psfile_get_parent_ps_type(int fd, TSS_UUID *uuid, UINT32 *type)
 TSS_RESULT
 psfile_get_key_by_uuid(int fd, TSS_UUID *uuid, BYTE *key)
 {
-        int rc;
 	TSS_RESULT result;
-        off_t file_offset;
         struct key_disk_cache tmp;
-	BYTE buf[4096];
 
 	if ((result = psfile_get_cache_entry_by_uuid(fd, uuid, &tmp)))
 		return result;
 
-	/* jump to the location of the key blob */
-	file_offset = TSSPS_BLOB_DATA_OFFSET(&tmp);
-
-	rc = lseek(fd, file_offset, SEEK_SET);
-	if (rc == ((off_t)-1)) {
-		LogDebugFn("lseek: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
-	}
-
 	if (tmp.blob_size > 4096) {
 		LogError("Blob size greater than 4096! Size:  %d",
 			  tmp.blob_size);
 		return TSPERR(TSS_E_INTERNAL_ERROR);
 	}
-	if ((rc = read_data(fd, buf, tmp.blob_size))) {
-		LogDebugFn("Blob read from disk failed.");
-		return rc;
-	}
 
-	memcpy(key, buf, tmp.blob_size);
+	/* the blob is already in memory with the rest of the file */
+	memcpy(key, psfile_index_blob(&tmp), tmp.blob_size);
 	return TSS_SUCCESS;
 }
 
@@ -331,36 +657,19 @@ psfile_get_key_by_uuid(int fd, TSS_UUID *uuid, BYTE *key)
 TSS_RESULT
 psfile_get_key_by_pub(int fd, TSS_UUID *uuid, UINT32 pub_size, BYTE *pub, BYTE *key)
 {
-        int rc;
 	TSS_RESULT result;
-        off_t file_offset;
         struct key_disk_cache tmp;
-	BYTE buf[4096];
 
 	if ((result = psfile_get_cache_entry_by_pub(fd, pub_size, pub, &tmp)))
 		return result;
 
-	/* jump to the location of the key blob */
-	file_offset = TSSPS_BLOB_DATA_OFFSET(&tmp);
-
-	rc = lseek(fd, file_offset, SEEK_SET);
-	if (rc == ((off_t)-1)) {
-		LogDebugFn("lseek: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
-	}
-
 	if (tmp.blob_size > 4096) {
 		LogError("Blob size greater than 4096! Size:  %d",
 			  tmp.blob_size);
 		return TSPERR(TSS_E_INTERNAL_ERROR);
 	}
 
-	if ((result = read_data(fd, buf, tmp.blob_size))) {
-		LogDebugFn("Blob read from disk failed.");
-		return result;
-	}
-
-	memcpy(key, buf, tmp.blob_size);
+	memcpy(key, psfile_index_blob(&tmp), tmp.blob_size);
 	memcpy(uuid, &tmp.uuid, sizeof(TSS_UUID));
 
 	return TSS_SUCCESS;
@@ -484,16 +793,23 @@ psfile_write_key(int fd,
 {
 	TSS_RESULT result;
 	TSS_KEY key;
-	UINT32 zero = 0;
+	UINT32 zero = 0, rec_size;
 	UINT64 offset;
-	UINT16 pub_key_size, cache_flags = 0;
+	UINT16 pub_key_size, cache_flags = 0, tmp16;
+	struct key_disk_cache c;
 	struct stat stat_buf;
+	BYTE *rec = NULL;
 	int rc, file_offset;
 
 	/* leaving the cache flag for parent ps type as 0 implies TSS_PS_TYPE_USER */
 	if (parent_ps == TSS_PS_TYPE_SYSTEM)
 		cache_flags |= CACHE_FLAG_PARENT_PS_SYSTEM;
 
+	/* bring the index up to date while the file is locked, so the new record can be added
+	 * to it instead of the whole file being read back in on the next lookup */
+	psfile_index_load(fd);
+	user_ps_dirty = TRUE;
+
 	if ((rc = fstat(fd, &stat_buf)) == -1) {
 		LogDebugFn("stat failed: %s", strerror(errno));
 		return TSPERR(TSS_E_INTERNAL_ERROR);
@@ -520,56 +836,45 @@ psfile_write_key(int fd,
 
 	pub_key_size = key.pubKey.keyLength;
 
-	/* [TSS_UUID uuid0           ] yes */
-        if ((result = write_data(fd, (void *)uuid, sizeof(TSS_UUID)))) {
-		LogDebug("%s", __FUNCTION__);
+	/* lay the record out in memory and write it in one go */
+	rec_size = USER_PS_KEY_HEADER_SIZE + pub_key_size + key_blob_size;
+	if ((rec = malloc(rec_size)) == NULL) {
+		LogDebug("malloc of %u bytes failed.", rec_size);
+		result = TSPERR(TSS_E_OUTOFMEMORY);
 		goto done;
 	}
 
+	memset(&c, 0, sizeof(struct key_disk_cache));
+	c.pub_data_size = pub_key_size;
+
+	/* [TSS_UUID uuid0           ] yes */
+	memcpy(&rec[TSSPS_UUID_OFFSET(&c)], uuid, sizeof(TSS_UUID));
+
 	/* [TSS_UUID uuid_parent0    ] yes */
-        if ((result = write_data(fd, (void *)parent_uuid, sizeof(TSS_UUID)))) {
-		LogDebug("%s", __FUNCTION__);
-		goto done;
-	}
+	memcpy(&rec[TSSPS_PARENT_UUID_OFFSET(&c)], parent_uuid, sizeof(TSS_UUID));
 
 	/* [UINT16   pub_data_size0  ] yes */
-	pub_key_size = LE_16(pub_key_size);
-        if ((result = write_data(fd, &pub_key_size, sizeof(UINT16)))) {
-		LogDebug("%s", __FUNCTION__);
-		goto done;
-	}
-	pub_key_size = LE_16(pub_key_size);
+	tmp16 = LE_16(pub_key_size);
+	memcpy(&rec[TSSPS_PUB_DATA_SIZE_OFFSET(&c)], &tmp16, sizeof(UINT16));
 
 	/* [UINT16   blob_size0      ] yes */
-	key_blob_size = LE_16(key_blob_size);
-        if ((result = write_data(fd, &key_blob_size, sizeof(UINT16)))) {
-		LogDebug("%s", __FUNCTION__);
-		goto done;
-	}
-	key_blob_size = LE_16(key_blob_size);
+	tmp16 = LE_16(key_blob_size);
+	memcpy(&rec[TSSPS_BLOB_SIZE_OFFSET(&c)], &tmp16, sizeof(UINT16));
 
 	/* [UINT32   vendor_data_size0 ] yes */
-        if ((result = write_data(fd, &zero, sizeof(UINT32)))) {
-		LogDebug("%s", __FUNCTION__);
-		goto done;
-	}
+	memcpy(&rec[TSSPS_VENDOR_SIZE_OFFSET(&c)], &zero, sizeof(UINT32));
 
 	/* [UINT16   cache_flags0    ] yes */
-	cache_flags = LE_16(cache_flags);
-        if ((result = write_data(fd, &cache_flags, sizeof(UINT16)))) {
-		LogDebug("%s", __FUNCTION__);
-		goto done;
-	}
-	cache_flags = LE_16(cache_flags);
+	tmp16 = LE_16(cache_flags);
+	memcpy(&rec[TSSPS_CACHE_FLAGS_OFFSET(&c)], &tmp16, sizeof(UINT16));
 
 	/* [BYTE[]   pub_data0       ] no */
-        if ((result = write_data(fd, (void *)key.pubKey.key, pub_key_size))) {
-		LogDebug("%s", __FUNCTION__);
-		goto done;
-	}
+	memcpy(&rec[TSSPS_PUB_DATA_OFFSET(&c)], key.pubKey.key, pub_key_size);
 
 	/* [BYTE[]   blob0           ] no */
-        if ((result = write_data(fd, (void *)key_blob, key_blob_size))) {
+	memcpy(&rec[TSSPS_BLOB_DATA_OFFSET(&c)], key_blob, key_blob_size);
+
+        if ((result = write_data(fd, (void *)rec, rec_size))) {
 		LogDebug("%s", __FUNCTION__);
 		goto done;
 	}
@@ -579,7 +884,11 @@ psfile_write_key(int fd,
 		goto done;
 	}
 
+	psfile_index_append(fd, rec, rec_size);
 done:
+	if (result)
+		user_ps_idx.valid = FALSE;
+	free(rec);
 	free_key_refs(&key);
         return result;
 }
@@ -588,225 +897,94 @@ TSS_RESULT
 psfile_remove_key(int fd, TSS_UUID *uuid)
 {
         TSS_RESULT result;
-        UINT32 head_offset = 0, tail_offset;
-	int rc, size = 0;
+        UINT32 head_offset = 0, tail_offset, tail_size;
+	int rc;
 	struct key_disk_cache c;
-	BYTE buf[4096];
 
+	/* this also brings the in-memory copy of the file up to date */
 	if ((result = psfile_get_cache_entry_by_uuid(fd, uuid, &c)))
 		return result;
 
+	user_ps_dirty = TRUE;
+
 	/* head_offset is the offset the beginning of the key */
 	head_offset = TSSPS_UUID_OFFSET(&c);
 
 	/* tail_offset is the offset the beginning of the next key */
 	tail_offset = TSSPS_VENDOR_DATA_OFFSET(&c) + c.vendor_data_size;
+	tail_size = user_ps_idx.size - tail_offset;
 
-	rc = lseek(fd, tail_offset, SEEK_SET);
-	if (rc == ((off_t)-1)) {
-		LogDebug("lseek: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
-	}
-
-	/* read in from tail, write out to head to fill the gap */
-	while ((rc = read(fd, buf, sizeof(buf))) > 0) {
-		size = rc;
-		tail_offset += size;
-
-		/* set the file pointer to where we want to write */
-		rc = lseek(fd, head_offset, SEEK_SET);
-		if (rc == ((off_t)-1)) {
-			LogDebug("lseek: %s", strerror(errno));
-			return TSPERR(TSS_E_INTERNAL_ERROR);
-		}
-
-		/* write the data */
-		if ((result = write_data(fd, (void *)buf, size))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-		head_offset += size;
-
-		/* set the file pointer to where we want to read in the next
-		 * loop */
-		rc = lseek(fd, tail_offset, SEEK_SET);
-		if (rc == ((off_t)-1)) {
-			LogDebug("lseek: %s", strerror(errno));
-			return TSPERR(TSS_E_INTERNAL_ERROR);
-		}
-	}
-
-	if (rc < 0) {
-		LogDebug("read: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
-	}
-
-	/* set the file pointer to where we want to write */
 	rc = lseek(fd, head_offset, SEEK_SET);
 	if (rc == ((off_t)-1)) {
 		LogDebug("lseek: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
+		result = TSPERR(TSS_E_INTERNAL_ERROR);
+		goto done;
 	}
 
-	/* head_offset now contains a pointer to where we want to truncate the
-	 * file. Zero out the old tail end of the file and truncate it. */
-
-	memset(buf, 0, sizeof(buf));
-
-	/* Zero out the old tail end of the file */
-	if ((result = write_data(fd, (void *)buf, tail_offset - head_offset))) {
+	/* the rest of the file is already in memory, write it out over the key to fill the gap */
+	if (tail_size &&
+	    (result = write_data(fd, &user_ps_idx.image[tail_offset], tail_size))) {
 		LogDebug("%s", __FUNCTION__);
-		return result;
+		goto done;
 	}
 
-	if ((rc = ftruncate(fd, head_offset)) < 0) {
+	if ((rc = ftruncate(fd, head_offset + tail_size)) < 0) {
 		LogDebug("ftruncate: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
+		result = TSPERR(TSS_E_INTERNAL_ERROR);
+		goto done;
 	}
 
 	/* we succeeded in removing a key from the disk. Decrement the number
 	 * of keys in the file */
 	if ((result = psfile_change_num_keys(fd, TSS_PSFILE_DECREMENT_NUM_KEYS)))
-		return result;
+		goto done;
 
-	return TSS_SUCCESS;
+	psfile_index_cut(fd, head_offset, tail_offset);
+done:
+	if (result)
+		user_ps_idx.valid = FALSE;
+	return result;
 }
 
 TSS_RESULT
 psfile_get_all_cache_entries(int fd, UINT32 *size, struct key_disk_cache **c)
 {
-	UINT32 i, num_keys = psfile_get_num_keys(fd);
-	int offset;
 	TSS_RESULT result;
 	struct key_disk_cache *tmp = NULL;
 
-	if (num_keys == 0) {
+	if ((result = psfile_index_load(fd)))
+		return result;
+
+	if (user_ps_idx.num_keys == 0) {
 		*size = 0;
 		*c = NULL;
 		return TSS_SUCCESS;
 	}
 
-	/* make sure the file pointer is where we expect, just after the number
-	 * of keys on disk at the head of the file
-	 */
-	offset = lseek(fd, TSSPS_KEYS_OFFSET, SEEK_SET);
-	if (offset == ((off_t)-1)) {
-		LogDebug("lseek: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
-	}
-
-	if ((tmp = malloc(num_keys * sizeof(struct key_disk_cache))) == NULL) {
-		LogDebug("malloc of %zu bytes failed.", num_keys * sizeof(struct key_disk_cache));
+	if ((tmp = malloc(user_ps_idx.num_keys * sizeof(struct key_disk_cache))) == NULL) {
+		LogDebug("malloc of %zu bytes failed.",
+			 user_ps_idx.num_keys * sizeof(struct key_disk_cache));
 		return TSPERR(TSS_E_OUTOFMEMORY);
 	}
 
-	for (i = 0; i < num_keys; i++) {
-		offset = lseek(fd, 0, SEEK_CUR);
-		if (offset == ((off_t)-1)) {
-			LogDebug("lseek: %s", strerror(errno));
-			result = TSPERR(TSS_E_INTERNAL_ERROR);
-			goto err_exit;
-		}
-		tmp[i].offset = offset;
-
-		/* read UUID */
-		if ((result = read_data(fd, &tmp[i].uuid, sizeof(TSS_UUID)))) {
-			LogDebug("%s", __FUNCTION__);
-			goto err_exit;
-		}
-
-		/* read parent UUID */
-		if ((result = read_data(fd, &tmp[i].parent_uuid, sizeof(TSS_UUID)))) {
-			LogDebug("%s", __FUNCTION__);
-			goto err_exit;
-		}
-
-		/* pub data size */
-		if ((result = read_data(fd, &tmp[i].pub_data_size, sizeof(UINT16)))) {
-			LogDebug("%s", __FUNCTION__);
-			goto err_exit;
-		}
-		tmp[i].pub_data_size = LE_16(tmp[i].pub_data_size);
-
-		DBG_ASSERT(tmp[i].pub_data_size <= 2048);
-
-		/* blob size */
-		if ((result = read_data(fd, &tmp[i].blob_size, sizeof(UINT16)))) {
-			LogDebug("%s", __FUNCTION__);
-			goto err_exit;
-		}
-		tmp[i].blob_size = LE_16(tmp[i].blob_size);
-
-		DBG_ASSERT(tmp[i].blob_size <= 4096);
-
-		/* vendor data size */
-		if ((result = read_data(fd, &tmp[i].vendor_data_size, sizeof(UINT32)))) {
-			LogDebug("%s", __FUNCTION__);
-			goto err_exit;
-		}
-		tmp[i].vendor_data_size = LE_32(tmp[i].vendor_data_size);
-
-		/* cache flags */
-		if ((result = read_data(fd, &tmp[i].flags, sizeof(UINT16)))) {
-			LogDebug("%s", __FUNCTION__);
-			goto err_exit;
-		}
-		tmp[i].flags = LE_16(tmp[i].flags);
-
-		/* fast forward over the pub key */
-		offset = lseek(fd, tmp[i].pub_data_size, SEEK_CUR);
-		if (offset == ((off_t)-1)) {
-			LogDebug("lseek: %s", strerror(errno));
-			result = TSPERR(TSS_E_INTERNAL_ERROR);
-			goto err_exit;
-		}
-
-		/* fast forward over the blob */
-		offset = lseek(fd, tmp[i].blob_size, SEEK_CUR);
-		if (offset == ((off_t)-1)) {
-			LogDebug("lseek: %s", strerror(errno));
-			result = TSPERR(TSS_E_INTERNAL_ERROR);
-			goto err_exit;
-		}
-
-		/* ignore vendor data for user ps */
-	}
+	memcpy(tmp, user_ps_idx.entries, user_ps_idx.num_keys * sizeof(struct key_disk_cache));
 
-	*size = num_keys;
+	*size = user_ps_idx.num_keys;
 	*c = tmp;
 
 	return TSS_SUCCESS;
-
-err_exit:
-	free(tmp);
-	return result;
 }
 
 TSS_RESULT
 copy_key_info(int fd, TSS_KM_KEYINFO *ki, struct key_disk_cache *c)
 {
 	TSS_KEY key;
-	BYTE blob[4096];
 	UINT64 offset;
 	TSS_RESULT result;
-	off_t off;
-
-	/* Set the file pointer to the offset that the key blob is at */
-	off = lseek(fd, TSSPS_BLOB_DATA_OFFSET(c), SEEK_SET);
-	if (off == ((off_t)-1)) {
-		LogDebug("lseek: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
-	}
-
-	/* Read in the key blob */
-	if ((result = read_data(fd, (void *)blob, c->blob_size))) {
-		LogDebug("%s", __FUNCTION__);
-		return result;
-	}
 
 	/* Expand the blob into a useable form */
 	offset = 0;
-	if ((result = UnloadBlob_TSS_KEY(&offset, blob, &key)))
+	if ((result = UnloadBlob_TSS_KEY(&offset, psfile_index_blob(c), &key)))
 		return result;
 
 	if (key.hdr.key12.tag == TPM_TAG_KEY12) {
@@ -829,27 +1007,12 @@ TSS_RESULT
 copy_key_info2(int fd, TSS_KM_KEYINFO2 *ki, struct key_disk_cache *c)
 {
 	TSS_KEY key;
-	BYTE blob[4096];
 	UINT64 offset;
 	TSS_RESULT result;
-	off_t off;
-
-	/* Set the file pointer to the offset that the key blob is at */
-	off = lseek(fd, TSSPS_BLOB_DATA_OFFSET(c), SEEK_SET);
-	if (off == ((off_t)-1)) {
-		LogDebug("lseek: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
-	}
-
-	/* Read in the key blob */
-	if ((result = read_data(fd, (void *)blob, c->blob_size))) {
-		LogDebug("%s", __FUNCTION__);
-		return result;
-	}
 
 	/* Expand the blob into a useable form */
 	offset = 0;
-	if ((result = UnloadBlob_TSS_KEY(&offset, blob, &key)))
+	if ((result = UnloadBlob_TSS_KEY(&offset, psfile_index_blob(c), &key)))
 		return result;
 
 	if (key.hdr.key12.tag == TPM_TAG_KEY12) {
@@ -883,15 +1046,15 @@ psfile_get_registered_keys(int fd,
 			   TSS_KM_KEYINFO **keys)
 {
 	TSS_RESULT result;
-	struct key_disk_cache *cache_entries;
-	UINT32 cache_size, i, j;
+	struct key_disk_cache *c;
+	UINT32 i, j;
 	TSS_KM_KEYINFO *keyinfos = NULL;
 	TSS_UUID *find_uuid;
 
-        if ((result = psfile_get_all_cache_entries(fd, &cache_size, &cache_entries)))
-                return result;
+	if ((result = psfile_index_load(fd)))
+		return result;
 
-	if (cache_size == 0) {
+	if (user_ps_idx.num_keys == 0) {
 		if (uuid)
 			return TSPERR(TSS_E_PS_KEY_NOTFOUND);
 		else {
@@ -905,29 +1068,22 @@ psfile_get_registered_keys(int fd,
 		find_uuid = uuid;
 		j = 0;
 
-restart_search:
-		/* Search for the requested UUID.  When found, allocate new space for it, copy
-		 * it in, then change the uuid to be searched for it its parent and start over. */
-		for (i = 0; i < cache_size; i++) {
-			if (!memcmp(&cache_entries[i].uuid, find_uuid, sizeof(TSS_UUID))) {
-				if (!(keyinfos = realloc(keyinfos,
-							 (j+1) * sizeof(TSS_KM_KEYINFO)))) {
-					free(cache_entries);
-					free(keyinfos);
-					return TSPERR(TSS_E_OUTOFMEMORY);
-				}
-				memset(&keyinfos[j], 0, sizeof(TSS_KM_KEYINFO));
-
-				if ((result = copy_key_info(fd, &keyinfos[j], &cache_entries[i]))) {
-					free(cache_entries);
-					free(keyinfos);
-					return result;
-				}
-
-				find_uuid = &keyinfos[j].parentKeyUUID;
-				j++;
-				goto restart_search;
+		/* Look up the requested UUID, copy it in, then move on to its parent. A chain can't
+		 * be longer than the number of keys in the file unless it loops back on itself. */
+		while ((c = psfile_index_find(find_uuid)) && j < user_ps_idx.num_keys) {
+			if (!(keyinfos = realloc(keyinfos, (j+1) * sizeof(TSS_KM_KEYINFO)))) {
+				free(keyinfos);
+				return TSPERR(TSS_E_OUTOFMEMORY);
+			}
+			memset(&keyinfos[j], 0, sizeof(TSS_KM_KEYINFO));
+
+			if ((result = copy_key_info(fd, &keyinfos[j], c))) {
+				free(keyinfos);
+				return result;
 			}
+
+			find_uuid = &keyinfos[j].parentKeyUUID;
+			j++;
 		}
 
 		/* Searching for keys in the user PS will always lead us up to some key in the
@@ -937,26 +1093,22 @@ restart_search:
 
 		*size = j;
         } else {
-		if ((keyinfos = calloc(cache_size, sizeof(TSS_KM_KEYINFO))) == NULL) {
+		if ((keyinfos = calloc(user_ps_idx.num_keys, sizeof(TSS_KM_KEYINFO))) == NULL) {
 			LogDebug("malloc of %zu bytes failed.",
-				 cache_size * sizeof(TSS_KM_KEYINFO));
-			free(cache_entries);
+				 user_ps_idx.num_keys * sizeof(TSS_KM_KEYINFO));
 			return TSPERR(TSS_E_OUTOFMEMORY);
 		}
 
-                for (i = 0; i < cache_size; i++) {
-			if ((result = copy_key_info(fd, &keyinfos[i], &cache_entries[i]))) {
-				free(cache_entries);
+                for (i = 0; i < user_ps_idx.num_keys; i++) {
+			if ((result = copy_key_info(fd, &keyinfos[i], &user_ps_idx.entries[i]))) {
 				free(keyinfos);
 				return result;
 			}
                 }
 
-		*size = cache_size;
+		*size = user_ps_idx.num_keys;
         }
 
-	free(cache_entries);
-
 	*keys = keyinfos;
 
 	return TSS_SUCCESS;
@@ -970,15 +1122,15 @@ psfile_get_registered_keys2(int fd,
 			   TSS_KM_KEYINFO2 **keys)
 {
 	TSS_RESULT result;
-	struct key_disk_cache *cache_entries;
-	UINT32 cache_size, i, j;
+	struct key_disk_cache *c;
+	UINT32 i, j;
 	TSS_KM_KEYINFO2 *keyinfos = NULL;
 	TSS_UUID *find_uuid;
 
-        if ((result = psfile_get_all_cache_entries(fd, &cache_size, &cache_entries)))
-                return result;
+	if ((result = psfile_index_load(fd)))
+		return result;
 
-	if (cache_size == 0) {
+	if (user_ps_idx.num_keys == 0) {
 		if (uuid)
 			return TSPERR(TSS_E_PS_KEY_NOTFOUND);
 		else {
@@ -992,33 +1144,23 @@ psfile_get_registered_keys2(int fd,
 		find_uuid = uuid;
 		j = 0;
 
-		restart_search:
-			/* Search for the requested UUID.  When found, allocate new space for it, copy
-			 * it in, then change the uuid to be searched for it its parent and start over. */
-			for (i = 0; i < cache_size; i++) {
-				/*Return 0 if normal finish*/
-				if (!memcmp(&cache_entries[i].uuid, find_uuid, sizeof(TSS_UUID))) {
-					if (!(keyinfos = realloc(keyinfos,
-							(j+1) * sizeof(TSS_KM_KEYINFO2)))) {
-						free(cache_entries);
-						free(keyinfos);
-						return TSPERR(TSS_E_OUTOFMEMORY);
-					}
-					/* Here the key UUID is found and needs to be copied for the array*/
-					/* Initializes the keyinfos with 0's*/
-					memset(&keyinfos[j], 0, sizeof(TSS_KM_KEYINFO2));
-
-					if ((result = copy_key_info2(fd, &keyinfos[j], &cache_entries[i]))) {
-						free(cache_entries);
-						free(keyinfos);
-						return result;
-					}
-
-					find_uuid = &keyinfos[j].parentKeyUUID;
-					j++;
-					goto restart_search;
-				}
+		/* Look up the requested UUID, copy it in, then move on to its parent */
+		while ((c = psfile_index_find(find_uuid)) && j < user_ps_idx.num_keys) {
+			if (!(keyinfos = realloc(keyinfos, (j+1) * sizeof(TSS_KM_KEYINFO2)))) {
+				free(keyinfos);
+				return TSPERR(TSS_E_OUTOFMEMORY);
 			}
+			/* Initializes the keyinfos with 0's*/
+			memset(&keyinfos[j], 0, sizeof(TSS_KM_KEYINFO2));
+
+			if ((result = copy_key_info2(fd, &keyinfos[j], c))) {
+				free(keyinfos);
+				return result;
+			}
+
+			find_uuid = &keyinfos[j].parentKeyUUID;
+			j++;
+		}
 
 		/* Searching for keys in the user PS will always lead us up to some key in the
 		 * system PS. Return that key's uuid so that the upper layers can call down to TCS
@@ -1027,26 +1169,22 @@ psfile_get_registered_keys2(int fd,
 
 		*size = j;
 	} else {
-		if ((keyinfos = calloc(cache_size, sizeof(TSS_KM_KEYINFO2))) == NULL) {
+		if ((keyinfos = calloc(user_ps_idx.num_keys, sizeof(TSS_KM_KEYINFO2))) == NULL) {
 			LogDebug("malloc of %zu bytes failed.",
-					cache_size * sizeof(TSS_KM_KEYINFO2));
-			free(cache_entries);
+					user_ps_idx.num_keys * sizeof(TSS_KM_KEYINFO2));
 			return TSPERR(TSS_E_OUTOFMEMORY);
 		}
 
-		for (i = 0; i < cache_size; i++) {
-			if ((result = copy_key_info2(fd, &keyinfos[i], &cache_entries[i]))) {
-				free(cache_entries);
+		for (i = 0; i < user_ps_idx.num_keys; i++) {
+			if ((result = copy_key_info2(fd, &keyinfos[i], &user_ps_idx.entries[i]))) {
 				free(keyinfos);
 				return result;
 			}
 		}
 
-		*size = cache_size;
+		*size = user_ps_idx.num_keys;
 	}
 
-	free(cache_entries);
-
 	*keys = keyinfos;
 
 	return TSS_SUCCESS;
@@ -1103,196 +1241,39 @@ psfile_get_num_keys(int fd)
 TSS_RESULT
 psfile_get_cache_entry_by_uuid(int fd, TSS_UUID *uuid, struct key_disk_cache *c)
 {
-	UINT32 i, num_keys = psfile_get_num_keys(fd);
-	int offset;
 	TSS_RESULT result;
-	BYTE found = 0;
-
-	if (num_keys == 0)
-		return TSPERR(TSS_E_PS_KEY_NOTFOUND);
-
-	/* make sure the file pointer is where we expect, just after the number
-	 * of keys on disk at the head of the file
-	 */
-	offset = lseek(fd, TSSPS_KEYS_OFFSET, SEEK_SET);
-	if (offset == ((off_t)-1)) {
-		LogDebug("lseek: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
-	}
-
-	for (i = 0; i < num_keys && !found; i++) {
-		offset = lseek(fd, 0, SEEK_CUR);
-		if (offset == ((off_t)-1)) {
-			LogDebug("lseek: %s", strerror(errno));
-			return TSPERR(TSS_E_INTERNAL_ERROR);
-		}
-		c->offset = offset;
+	struct key_disk_cache *tmp;
 
-		/* read UUID */
-		if ((result = read_data(fd, (void *)&c->uuid, sizeof(TSS_UUID)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-
-		if (!memcmp(&c->uuid, uuid, sizeof(TSS_UUID))) {
-			found = 1;
-
-			/* read parent UUID */
-			if ((result = read_data(fd, (void *)&c->parent_uuid, sizeof(TSS_UUID)))) {
-				LogDebug("%s", __FUNCTION__);
-				return result;
-			}
-		} else {
-			/* fast forward over the parent UUID */
-			offset = lseek(fd, sizeof(TSS_UUID), SEEK_CUR);
-			if (offset == ((off_t)-1)) {
-				LogDebug("lseek: %s", strerror(errno));
-				return TSPERR(TSS_E_INTERNAL_ERROR);
-			}
-		}
-
-		/* pub data size */
-		if ((result = read_data(fd, &c->pub_data_size, sizeof(UINT16)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-		c->pub_data_size = LE_16(c->pub_data_size);
-		DBG_ASSERT(c->pub_data_size <= 2048 && c->pub_data_size > 0);
-
-		/* blob size */
-		if ((result = read_data(fd, &c->blob_size, sizeof(UINT16)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-		c->blob_size = LE_16(c->blob_size); 
-		DBG_ASSERT(c->blob_size <= 4096 && c->blob_size > 0);
-
-		/* vendor data size */
-		if ((result = read_data(fd, &c->vendor_data_size, sizeof(UINT32)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-		c->vendor_data_size = LE_32(c->vendor_data_size); 
-
-		/* cache flags */
-		if ((result = read_data(fd, &c->flags, sizeof(UINT16)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-		c->flags = LE_16(c->flags); 
-
-		/* fast forward over the pub key */
-		offset = lseek(fd, c->pub_data_size, SEEK_CUR);
-		if (offset == ((off_t)-1)) {
-			LogDebug("lseek: %s", strerror(errno));
-			return TSPERR(TSS_E_INTERNAL_ERROR);
-		}
+	if ((result = psfile_index_load(fd)))
+		return result;
 
-		/* fast forward over the blob */
-		offset = lseek(fd, c->blob_size, SEEK_CUR);
-		if (offset == ((off_t)-1)) {
-			LogDebug("lseek: %s", strerror(errno));
-			return TSPERR(TSS_E_INTERNAL_ERROR);
-		}
+	if ((tmp = psfile_index_find(uuid)) == NULL)
+		return TSPERR(TSS_E_PS_KEY_NOTFOUND);
 
-		/* ignore vendor data in user ps */
-	}
+	memcpy(c, tmp, sizeof(struct key_disk_cache));
 
-	return found ? TSS_SUCCESS : TSPERR(TSS_E_PS_KEY_NOTFOUND);
+	return TSS_SUCCESS;
 }
 
 TSS_RESULT
 psfile_get_cache_entry_by_pub(int fd, UINT32 pub_size, BYTE *pub, struct key_disk_cache *c)
 {
-	BYTE blob[2048];
-	UINT32 i, num_keys = psfile_get_num_keys(fd);
-	int offset;
 	TSS_RESULT result;
+	struct key_disk_cache *tmp;
+	UINT32 i;
 
-	if (num_keys == 0)
-		return TSPERR(TSS_E_PS_KEY_NOTFOUND);
-
-	/* make sure the file pointer is where we expect, just after the number
-	 * of keys on disk at the head of the file
-	 */
-	offset = lseek(fd, TSSPS_KEYS_OFFSET, SEEK_SET);
-	if (offset == ((off_t)-1)) {
-		LogDebug("lseek: %s", strerror(errno));
-		return TSPERR(TSS_E_INTERNAL_ERROR);
-	}
-
-	for (i = 0; i < num_keys; i++) {
-		offset = lseek(fd, 0, SEEK_CUR);
-		if (offset == ((off_t)-1)) {
-			LogDebug("lseek: %s", strerror(errno));
-			return TSPERR(TSS_E_INTERNAL_ERROR);
-		}
-		c->offset = offset;
-
-		/* read UUID */
-		if ((result = read_data(fd, (void *)&c->uuid, sizeof(TSS_UUID)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-
-		/* read parent UUID */
-		if ((result = read_data(fd, (void *)&c->parent_uuid, sizeof(TSS_UUID)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-
-		/* pub data size */
-		if ((result = read_data(fd, &c->pub_data_size, sizeof(UINT16)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-
-		c->pub_data_size = LE_16(c->pub_data_size);
-		DBG_ASSERT(c->pub_data_size <= 2048 && c->pub_data_size > 0);
-
-		/* blob size */
-		if ((result = read_data(fd, &c->blob_size, sizeof(UINT16)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-
-		c->blob_size = LE_16(c->blob_size);
-		DBG_ASSERT(c->blob_size <= 4096 && c->blob_size > 0);
-
-		/* vendor data size */
-		if ((result = read_data(fd, &c->vendor_data_size, sizeof(UINT32)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-		c->vendor_data_size = LE_32(c->vendor_data_size);
-
-		/* cache flags */
-		if ((result = read_data(fd, &c->flags, sizeof(UINT16)))) {
-			LogDebug("%s", __FUNCTION__);
-			return result;
-		}
-		c->flags = LE_16(c->flags);
-
-		if (c->pub_data_size == pub_size) {
-			/* read in the pub key */
-			if ((result = read_data(fd, blob, c->pub_data_size))) {
-				LogDebug("%s", __FUNCTION__);
-				return result;
-			}
+	if ((result = psfile_index_load(fd)))
+		return result;
 
-			if (!memcmp(blob, pub, pub_size))
-				break;
-		}
+	for (i = 0; i < user_ps_idx.num_keys; i++) {
+		tmp = &user_ps_idx.entries[i];
 
-		/* fast forward over the blob */
-		offset = lseek(fd, c->blob_size, SEEK_CUR);
-		if (offset == ((off_t)-1)) {
-			LogDebug("lseek: %s", strerror(errno));
-			return TSPERR(TSS_E_INTERNAL_ERROR);
+		if (tmp->pub_data_size == pub_size &&
+		    !memcmp(&user_ps_idx.image[TSSPS_PUB_DATA_OFFSET(tmp)], pub, pub_size)) {
+			memcpy(c, tmp, sizeof(struct key_disk_cache));
+			return TSS_SUCCESS;
 		}
-
-		/* ignore vendor data */
 	}
 
-	return TSS_SUCCESS;
+	return TSPERR(TSS_E_PS_KEY_NOTFOUND);
 }
@@ -14,6 +14,7 @@
 #include <string.h>
 
 #include "trousers/tss.h"
+#include "trousers/trousers.h"
 #include "trousers_types.h"
 #include "tsplog.h"
 #include "hosttable.h"
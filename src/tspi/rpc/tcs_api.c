@@ -233,6 +233,60 @@ TSS_RESULT RPC_GetPcrEventLog(TSS_HCONTEXT tspContext,	/* in */
 	return result;
 }
 
+TSS_RESULT RPC_GetPcrEventLogPage(TSS_HCONTEXT tspContext,	/* in */
+				  UINT32 * pPcrIndex,		/* in, out */
+				  UINT32 * pSequence,		/* in, out */
+				  UINT32 ulMaxSize,		/* in */
+				  UINT32 * pEventCount,		/* out */
+				  TSS_PCR_EVENT ** ppEvents)	/* out */
+{
+	TSS_RESULT result = (TSS_E_INTERNAL_ERROR | TSS_LAYER_TSP);
+	struct host_table_entry *entry = get_table_entry(tspContext);
+
+	if (entry == NULL)
+		return TSPERR(TSS_E_NO_CONNECTION);
+
+	switch (entry->type) {
+		case CONNECTION_TYPE_TCP_PERSISTANT:
+			result = RPC_GetPcrEventLogPage_TP(entry, pPcrIndex, pSequence, ulMaxSize,
+							   pEventCount, ppEvents);
+			break;
+		default:
+			break;
+	}
+
+	put_table_entry(entry);
+
+	return result;
+}
+
+TSS_RESULT RPC_GetPcrEventsSince(TSS_HCONTEXT tspContext,	/* in */
+				 UINT32 PcrIndex,		/* in */
+				 UINT32 Since,			/* in */
+				 UINT32 * pEventCount,		/* out */
+				 TSS_PCR_EVENT ** ppEvents,	/* out */
+				 TCPA_DIGEST * pAggregate)	/* out */
+{
+	TSS_RESULT result = (TSS_E_INTERNAL_ERROR | TSS_LAYER_TSP);
+	struct host_table_entry *entry = get_table_entry(tspContext);
+
+	if (entry == NULL)
+		return TSPERR(TSS_E_NO_CONNECTION);
+
+	switch (entry->type) {
+		case CONNECTION_TYPE_TCP_PERSISTANT:
+			result = RPC_GetPcrEventsSince_TP(entry, PcrIndex, Since, pEventCount,
+							  ppEvents, pAggregate);
+			break;
+		default:
+			break;
+	}
+
+	put_table_entry(entry);
+
+	return result;
+}
+
 TSS_RESULT RPC_RegisterKey(TSS_HCONTEXT tspContext,	/* in */
 			   TSS_UUID WrappingKeyUUID,	/* in */
 			   TSS_UUID KeyUUID,	/* in */
@@ -283,6 +337,61 @@ TSS_RESULT RPC_UnregisterKey(TSS_HCONTEXT tspContext,	/* in */
 	return result;
 }
 
+TSS_RESULT RPC_RegisterKeys(TSS_HCONTEXT tspContext,	/* in */
+			    UINT32 ulKeyCount,		/* in */
+			    TSS_UUID *WrappingKeyUUIDs,	/* in */
+			    TSS_UUID *KeyUUIDs,		/* in */
+			    UINT32 *cKeySizes,		/* in */
+			    BYTE ** rgbKeys,		/* in */
+			    UINT32 cVendorData,		/* in */
+			    BYTE * gbVendorData,	/* in */
+			    UINT32 * pulSent)		/* out */
+{
+	TSS_RESULT result = (TSS_E_INTERNAL_ERROR | TSS_LAYER_TSP);
+	struct host_table_entry *entry = get_table_entry(tspContext);
+
+	if (entry == NULL)
+		return TSPERR(TSS_E_NO_CONNECTION);
+
+	switch (entry->type) {
+		case CONNECTION_TYPE_TCP_PERSISTANT:
+			result = RPC_RegisterKeys_TP(entry, ulKeyCount, WrappingKeyUUIDs, KeyUUIDs,
+						     cKeySizes, rgbKeys, cVendorData,
+						     gbVendorData, pulSent);
+			break;
+		default:
+			break;
+	}
+
+	put_table_entry(entry);
+
+	return result;
+}
+
+TSS_RESULT RPC_UnregisterKeys(TSS_HCONTEXT tspContext,	/* in */
+			      UINT32 ulKeyCount,	/* in */
+			      TSS_UUID *KeyUUIDs,	/* in */
+			      UINT32 * pulSent)		/* out */
+{
+	TSS_RESULT result = (TSS_E_INTERNAL_ERROR | TSS_LAYER_TSP);
+	struct host_table_entry *entry = get_table_entry(tspContext);
+
+	if (entry == NULL)
+		return TSPERR(TSS_E_NO_CONNECTION);
+
+	switch (entry->type) {
+		case CONNECTION_TYPE_TCP_PERSISTANT:
+			result = RPC_UnregisterKeys_TP(entry, ulKeyCount, KeyUUIDs, pulSent);
+			break;
+		default:
+			break;
+	}
+
+	put_table_entry(entry);
+
+	return result;
+}
+
 TSS_RESULT RPC_EnumRegisteredKeys(TSS_HCONTEXT tspContext,	/* in */
 				  TSS_UUID * pKeyUUID,	/* in */
 				  UINT32 * pcKeyHierarchySize,	/* out */
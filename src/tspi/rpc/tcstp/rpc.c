@@ -49,56 +49,56 @@ initData(struct tcsd_comm_data *comm, int parm_count)
 	memset(comm->buf, 0, comm->buf_size);
 }
 
-int
-loadData(UINT64 *offset, TCSD_PACKET_TYPE data_type, void *data, int data_size, BYTE *blob)
+static TSS_RESULT
+loadData(struct blob_cursor *c, TCSD_PACKET_TYPE data_type, void *data, int data_size)
 {
 	switch (data_type) {
 		case TCSD_PACKET_TYPE_BYTE:
-			Trspi_LoadBlob_BYTE(offset, *((BYTE *) (data)), blob);
+			PutBlob_BYTE(c, *((BYTE *) (data)));
 			break;
 		case TCSD_PACKET_TYPE_BOOL:
-			Trspi_LoadBlob_BOOL(offset, *((TSS_BOOL *) (data)), blob);
+			PutBlob_BOOL(c, *((TSS_BOOL *) (data)));
 			break;
 		case TCSD_PACKET_TYPE_UINT16:
-			Trspi_LoadBlob_UINT16(offset, *((UINT16 *) (data)), blob);
+			PutBlob_UINT16(c, *((UINT16 *) (data)));
 			break;
 		case TCSD_PACKET_TYPE_UINT32:
-			Trspi_LoadBlob_UINT32(offset, *((UINT32 *) (data)), blob);
+			PutBlob_UINT32(c, *((UINT32 *) (data)));
 			break;
 		case TCSD_PACKET_TYPE_PBYTE:
-			Trspi_LoadBlob(offset, data_size, blob, (BYTE *)data);
+			PutBlob(c, data_size, (BYTE *)data);
 			break;
 		case TCSD_PACKET_TYPE_NONCE:
-			Trspi_LoadBlob(offset, 20, blob, ((TCPA_NONCE *)data)->nonce);
+			PutBlob(c, 20, ((TCPA_NONCE *)data)->nonce);
 			break;
 		case TCSD_PACKET_TYPE_DIGEST:
-			Trspi_LoadBlob(offset, 20, blob, ((TCPA_DIGEST *)data)->digest);
+			PutBlob(c, 20, ((TCPA_DIGEST *)data)->digest);
 			break;
 		case TCSD_PACKET_TYPE_AUTH:
-			LoadBlob_AUTH(offset, blob, ((TPM_AUTH *)data));
+			PutBlob_AUTH(c, ((TPM_AUTH *)data));
 			break;
 		case TCSD_PACKET_TYPE_UUID:
-			Trspi_LoadBlob_UUID(offset, blob, *((TSS_UUID *)data));
+			Trspi_PutBlob_UUID(c, ((TSS_UUID *)data));
 			break;
 		case TCSD_PACKET_TYPE_ENCAUTH:
-			Trspi_LoadBlob(offset, 20, blob, ((TCPA_ENCAUTH *)data)->authdata);
+			PutBlob(c, 20, ((TCPA_ENCAUTH *)data)->authdata);
 			break;
 		case TCSD_PACKET_TYPE_VERSION:
-			Trspi_LoadBlob_TCPA_VERSION(offset, blob, *((TCPA_VERSION *)data));
+			Trspi_PutBlob_TCPA_VERSION(c, ((TCPA_VERSION *)data));
 			break;
 #ifdef TSS_BUILD_PS
 		case TCSD_PACKET_TYPE_LOADKEY_INFO:
-			LoadBlob_LOADKEY_INFO(offset, blob, ((TCS_LOADKEY_INFO *)data));
+			PutBlob_LOADKEY_INFO(c, ((TCS_LOADKEY_INFO *)data));
 			break;
 #endif
 		case TCSD_PACKET_TYPE_PCR_EVENT:
-			Trspi_LoadBlob_PCR_EVENT(offset, blob, ((TSS_PCR_EVENT *)data));
+			Trspi_PutBlob_PCR_EVENT(c, ((TSS_PCR_EVENT *)data));
 			break;
 		case TCSD_PACKET_TYPE_COUNTER_VALUE:
-			Trspi_LoadBlob_COUNTER_VALUE(offset, blob, ((TPM_COUNTER_VALUE *)data));
+			Trspi_PutBlob_COUNTER_VALUE(c, ((TPM_COUNTER_VALUE *)data));
 			break;
 		case TCSD_PACKET_TYPE_SECRET:
-			Trspi_LoadBlob(offset, 20, blob, ((TCPA_SECRET *)data)->authdata);
+			PutBlob(c, 20, ((TCPA_SECRET *)data)->authdata);
 			break;
 		default:
 			LogError("TCSD packet type unknown! (0x%x)", data_type & 0xff);
@@ -115,45 +115,56 @@ setData(TCSD_PACKET_TYPE dataType,
 	int theDataSize,
 	struct tcsd_comm_data *comm)
 {
-        UINT64 old_offset, offset;
-        TSS_RESULT result;
-        TCSD_PACKET_TYPE *type;
-
-        /* Calculate the size of the area needed (use NULL for blob address) */
-        offset = 0;
-        if ((result = loadData(&offset, dataType, theData, theDataSize, NULL)))
-                return result;
-        if ((comm->hdr.packet_size + offset) > TSS_TPM_TXBLOB_SIZE) {
-                LogError("Too much data to be transmitted!");
-                return TSPERR(TSS_E_INTERNAL_ERROR);
-        }
-        if ((comm->hdr.packet_size + offset) > comm->buf_size) {
-                /* reallocate the buffer */
-                BYTE *buffer;
-                int buffer_size = comm->hdr.packet_size + offset;
-
-                LogDebug("Increasing communication buffer to %d bytes.", buffer_size);
-                buffer = realloc(comm->buf, buffer_size);
-                if (buffer == NULL) {
-                        LogError("realloc of %d bytes failed.", buffer_size);
-                        return TSPERR(TSS_E_INTERNAL_ERROR);
-                }
-                comm->buf_size = buffer_size;
-                comm->buf = buffer;
-        }
-
-        offset = old_offset = comm->hdr.parm_offset + comm->hdr.parm_size;
-        if ((result = loadData(&offset, dataType, theData, theDataSize, comm->buf)))
-                return result;
-        type = (TCSD_PACKET_TYPE *)(comm->buf + comm->hdr.type_offset) + index;
-        *type = dataType;
-        comm->hdr.type_size += sizeof(TCSD_PACKET_TYPE);
-        comm->hdr.parm_size += (offset - old_offset);
-
-        comm->hdr.packet_size = offset;
-        comm->hdr.num_parms++;
-
-        return TSS_SUCCESS;
+	UINT64 old_offset;
+	TSS_RESULT result;
+	TCSD_PACKET_TYPE *type;
+	struct blob_cursor c;
+
+	/* Encode straight into the packet buffer. Only if the parameter doesn't fit is it sized
+	 * and the buffer grown, after which the encoding is done again */
+	old_offset = comm->hdr.parm_offset + comm->hdr.parm_size;
+	blob_cursor_init(&c, comm->buf, MIN((UINT64)comm->buf_size, TSS_TPM_TXBLOB_SIZE),
+			 old_offset);
+	if ((result = loadData(&c, dataType, theData, theDataSize)))
+		return result;
+
+	if (!blob_cursor_ok(&c)) {
+		BYTE *buffer;
+		int buffer_size;
+
+		blob_cursor_init_sizer(&c, old_offset);
+		if ((result = loadData(&c, dataType, theData, theDataSize)))
+			return result;
+		if (c.pos > TSS_TPM_TXBLOB_SIZE) {
+			LogError("Too much data to be transmitted!");
+			return TSPERR(TSS_E_INTERNAL_ERROR);
+		}
+
+		/* reallocate the buffer */
+		buffer_size = c.pos;
+		LogDebug("Increasing communication buffer to %d bytes.", buffer_size);
+		buffer = realloc(comm->buf, buffer_size);
+		if (buffer == NULL) {
+			LogError("realloc of %d bytes failed.", buffer_size);
+			return TSPERR(TSS_E_INTERNAL_ERROR);
+		}
+		comm->buf_size = buffer_size;
+		comm->buf = buffer;
+
+		blob_cursor_init(&c, comm->buf, comm->buf_size, old_offset);
+		if ((result = loadData(&c, dataType, theData, theDataSize)))
+			return result;
+	}
+
+	type = (TCSD_PACKET_TYPE *)(comm->buf + comm->hdr.type_offset) + index;
+	*type = dataType;
+	comm->hdr.type_size += sizeof(TCSD_PACKET_TYPE);
+	comm->hdr.parm_size += (c.pos - old_offset);
+
+	comm->hdr.packet_size = c.pos;
+	comm->hdr.num_parms++;
+
+	return TSS_SUCCESS;
 }
 
 UINT32
@@ -512,3 +523,20 @@ get_port(void)
 	return (short)port;
 }
 
+/* The TPM new contexts are bound to, as an index into the tcsd's tpm_device list. The first one
+ * is the default */
+UINT32
+get_tcsd_device(void)
+{
+	char *env_device;
+	int device;
+
+	if ((env_device = getenv("TSS_TCSD_DEVICE")) == NULL)
+		return 0;
+
+	if ((device = atoi(env_device)) < 0 || device >= TCSD_MAX_TPM_DEVICES)
+		return 0;
+
+	return (UINT32)device;
+}
+
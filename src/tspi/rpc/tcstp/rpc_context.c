@@ -29,9 +29,14 @@ RPC_OpenContext_TP(struct host_table_entry* hte,
 		       TCS_CONTEXT_HANDLE*      tcsContext)
 {
 	TSS_RESULT result;
+	UINT32 device = get_tcsd_device(), bound;
 
-	initData(&hte->comm, 0);
+	/* the default TPM is asked for the way TCSDs that serve only one understand */
+	initData(&hte->comm, device ? 1 : 0);
 	hte->comm.hdr.u.ordinal = TCSD_ORD_OPENCONTEXT;
+	if (device && setData(TCSD_PACKET_TYPE_UINT32, 0, &device, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
 	result = sendTCSDPacket(hte);
 
 	if (result == TSS_SUCCESS)
@@ -45,6 +50,15 @@ RPC_OpenContext_TP(struct host_table_entry* hte,
 
 		if (getData(TCSD_PACKET_TYPE_UINT32, 1, tpm_version, 0, &hte->comm))
 			return TSPERR(TSS_E_INTERNAL_ERROR);
+
+		/* a TCSD that doesn't confirm the TPM opened the context on its only one */
+		if (device && (getData(TCSD_PACKET_TYPE_UINT32, 2, &bound, 0, &hte->comm) ||
+			       bound != device)) {
+			LogError("The TCSD can't bind contexts to TPM device %u", device);
+			hte->tcsContext = *tcsContext;
+			(void)RPC_CloseContext_TP(hte);
+			return TSPERR(TSS_E_CONNECTION_FAILED);
+		}
 	}
 
 	return result;
@@ -229,3 +229,135 @@ RPC_GetPcrEventLog_TP(struct host_table_entry *hte,
 done:
 	return result;
 }
+
+TSS_RESULT
+RPC_GetPcrEventLogPage_TP(struct host_table_entry *hte,
+			  UINT32 * pPcrIndex,	/* in, out */
+			  UINT32 * pSequence,	/* in, out */
+			  UINT32 ulMaxSize,	/* in */
+			  UINT32 * pEventCount,	/* out */
+			  TSS_PCR_EVENT ** ppEvents	/* out */
+    ) {
+	TSS_RESULT result;
+	UINT32 i, j;
+
+	initData(&hte->comm, 4);
+	hte->comm.hdr.u.ordinal = TCSD_ORD_GETPCREVENTLOGPAGE;
+	LogDebugFn("TCS Context: 0x%x", hte->tcsContext);
+
+	if (setData(TCSD_PACKET_TYPE_UINT32, 0, &hte->tcsContext, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	if (setData(TCSD_PACKET_TYPE_UINT32, 1, pPcrIndex, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	if (setData(TCSD_PACKET_TYPE_UINT32, 2, pSequence, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	if (setData(TCSD_PACKET_TYPE_UINT32, 3, &ulMaxSize, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	result = sendTCSDPacket(hte);
+
+	if (result == TSS_SUCCESS)
+		result = hte->comm.hdr.u.result;
+
+	if (result == TSS_SUCCESS) {
+		if (getData(TCSD_PACKET_TYPE_UINT32, 0, pPcrIndex, 0, &hte->comm) ||
+		    getData(TCSD_PACKET_TYPE_UINT32, 1, pSequence, 0, &hte->comm) ||
+		    getData(TCSD_PACKET_TYPE_UINT32, 2, pEventCount, 0, &hte->comm)) {
+			result = TSPERR(TSS_E_INTERNAL_ERROR);
+			goto done;
+		}
+
+		if (*pEventCount > 0) {
+			*ppEvents = calloc_tspi(hte->tspContext,
+						sizeof(TSS_PCR_EVENT) * (*pEventCount));
+			if (*ppEvents == NULL) {
+				LogError("malloc of %zd bytes failed.",
+					 sizeof(TSS_PCR_EVENT) * (*pEventCount));
+				result = TSPERR(TSS_E_OUTOFMEMORY);
+				goto done;
+			}
+
+			i = 3;
+			for (j = 0; j < (*pEventCount); j++) {
+				if (getData(TCSD_PACKET_TYPE_PCR_EVENT, i++, &((*ppEvents)[j]), 0, &hte->comm)) {
+					free_tspi(hte->tspContext, *ppEvents);
+					*ppEvents = NULL;
+					result = TSPERR(TSS_E_INTERNAL_ERROR);
+					goto done;
+				}
+			}
+		} else {
+			*ppEvents = NULL;
+		}
+	}
+
+done:
+	return result;
+}
+
+TSS_RESULT
+RPC_GetPcrEventsSince_TP(struct host_table_entry *hte,
+			 UINT32 PcrIndex,	/* in */
+			 UINT32 Since,		/* in */
+			 UINT32 * pEventCount,	/* out */
+			 TSS_PCR_EVENT ** ppEvents,	/* out */
+			 TCPA_DIGEST * pAggregate	/* out */
+    ) {
+	TSS_RESULT result;
+	UINT32 i, j;
+
+	initData(&hte->comm, 3);
+	hte->comm.hdr.u.ordinal = TCSD_ORD_GETPCREVENTSSINCE;
+	LogDebugFn("TCS Context: 0x%x", hte->tcsContext);
+
+	if (setData(TCSD_PACKET_TYPE_UINT32, 0, &hte->tcsContext, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	if (setData(TCSD_PACKET_TYPE_UINT32, 1, &PcrIndex, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	if (setData(TCSD_PACKET_TYPE_UINT32, 2, &Since, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	result = sendTCSDPacket(hte);
+
+	if (result == TSS_SUCCESS)
+		result = hte->comm.hdr.u.result;
+
+	if (result == TSS_SUCCESS) {
+		if (getData(TCSD_PACKET_TYPE_UINT32, 0, pEventCount, 0, &hte->comm) ||
+		    getData(TCSD_PACKET_TYPE_DIGEST, 1, pAggregate, 0, &hte->comm)) {
+			result = TSPERR(TSS_E_INTERNAL_ERROR);
+			goto done;
+		}
+
+		if (*pEventCount > 0) {
+			*ppEvents = calloc_tspi(hte->tspContext,
+						sizeof(TSS_PCR_EVENT) * (*pEventCount));
+			if (*ppEvents == NULL) {
+				LogError("malloc of %zd bytes failed.",
+					 sizeof(TSS_PCR_EVENT) * (*pEventCount));
+				result = TSPERR(TSS_E_OUTOFMEMORY);
+				goto done;
+			}
+
+			i = 2;
+			for (j = 0; j < (*pEventCount); j++) {
+				if (getData(TCSD_PACKET_TYPE_PCR_EVENT, i++, &((*ppEvents)[j]), 0, &hte->comm)) {
+					free_tspi(hte->tspContext, *ppEvents);
+					*ppEvents = NULL;
+					result = TSPERR(TSS_E_INTERNAL_ERROR);
+					goto done;
+				}
+			}
+		} else {
+			*ppEvents = NULL;
+		}
+	}
+
+done:
+	return result;
+}
@@ -136,6 +136,114 @@ RPC_UnregisterKey_TP(struct host_table_entry *hte,
 	return result;
 }
 
+/*
+ * Send as many of the ulKeyCount keys as fit in one packet, at least one, in a single
+ * TCSD_ORD_REGISTERKEYS request. *pulSent is set to the number of keys that were sent.
+ */
+TSS_RESULT
+RPC_RegisterKeys_TP(struct host_table_entry *hte,
+		    UINT32 ulKeyCount,		/* in */
+		    TSS_UUID *WrappingKeyUUIDs,	/* in */
+		    TSS_UUID *KeyUUIDs,		/* in */
+		    UINT32 *cKeySizes,		/* in */
+		    BYTE ** rgbKeys,		/* in */
+		    UINT32 cVendorData,		/* in */
+		    BYTE * gbVendorData,	/* in */
+		    UINT32 * pulSent)		/* out */
+{
+	TSS_RESULT result;
+	UINT64 size;
+	UINT32 count, i;
+
+	size = sizeof(struct tcsd_packet_hdr) + (4 * sizeof(TCSD_PACKET_TYPE)) +
+	       (3 * sizeof(UINT32)) + cVendorData;
+	for (count = 0; count < ulKeyCount; count++) {
+		size += (4 * sizeof(TCSD_PACKET_TYPE)) + (2 * sizeof(TSS_UUID)) + sizeof(UINT32) +
+			cKeySizes[count];
+		if (count > 0 && size > TSS_TPM_TXBLOB_SIZE)
+			break;
+	}
+
+	initData(&hte->comm, 4 + (4 * count));
+	hte->comm.hdr.u.ordinal = TCSD_ORD_REGISTERKEYS;
+	LogDebugFn("TCS Context: 0x%x, %u of %u keys", hte->tcsContext, count, ulKeyCount);
+
+	if (setData(TCSD_PACKET_TYPE_UINT32, 0, &hte->tcsContext, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	if (setData(TCSD_PACKET_TYPE_UINT32, 1, &count, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	if (setData(TCSD_PACKET_TYPE_UINT32, 2, &cVendorData, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	if (setData(TCSD_PACKET_TYPE_PBYTE, 3, gbVendorData, cVendorData, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	for (i = 0; i < count; i++) {
+		if (setData(TCSD_PACKET_TYPE_UUID, 4 + (4 * i), &WrappingKeyUUIDs[i], 0,
+			    &hte->comm))
+			return TSPERR(TSS_E_INTERNAL_ERROR);
+		if (setData(TCSD_PACKET_TYPE_UUID, 5 + (4 * i), &KeyUUIDs[i], 0, &hte->comm))
+			return TSPERR(TSS_E_INTERNAL_ERROR);
+		if (setData(TCSD_PACKET_TYPE_UINT32, 6 + (4 * i), &cKeySizes[i], 0, &hte->comm))
+			return TSPERR(TSS_E_INTERNAL_ERROR);
+		if (setData(TCSD_PACKET_TYPE_PBYTE, 7 + (4 * i), rgbKeys[i], cKeySizes[i],
+			    &hte->comm))
+			return TSPERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	result = sendTCSDPacket(hte);
+
+	if (result == TSS_SUCCESS)
+		result = hte->comm.hdr.u.result;
+
+	if (result == TSS_SUCCESS)
+		*pulSent = count;
+
+	return result;
+}
+
+/*
+ * Send as many of the ulKeyCount UUIDs as fit in one packet in a single
+ * TCSD_ORD_UNREGISTERKEYS request. *pulSent is set to the number of keys that were sent.
+ */
+TSS_RESULT
+RPC_UnregisterKeys_TP(struct host_table_entry *hte,
+		      UINT32 ulKeyCount,	/* in */
+		      TSS_UUID *KeyUUIDs,	/* in */
+		      UINT32 * pulSent)		/* out */
+{
+	TSS_RESULT result;
+	UINT32 count, i, max;
+
+	max = (TSS_TPM_TXBLOB_SIZE - sizeof(struct tcsd_packet_hdr) -
+	       (2 * (sizeof(TCSD_PACKET_TYPE) + sizeof(UINT32)))) /
+	      (sizeof(TCSD_PACKET_TYPE) + sizeof(TSS_UUID));
+	count = MIN(ulKeyCount, max);
+
+	initData(&hte->comm, 2 + count);
+	hte->comm.hdr.u.ordinal = TCSD_ORD_UNREGISTERKEYS;
+	LogDebugFn("TCS Context: 0x%x, %u of %u keys", hte->tcsContext, count, ulKeyCount);
+
+	if (setData(TCSD_PACKET_TYPE_UINT32, 0, &hte->tcsContext, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	if (setData(TCSD_PACKET_TYPE_UINT32, 1, &count, 0, &hte->comm))
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+
+	for (i = 0; i < count; i++) {
+		if (setData(TCSD_PACKET_TYPE_UUID, 2 + i, &KeyUUIDs[i], 0, &hte->comm))
+			return TSPERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	result = sendTCSDPacket(hte);
+
+	if (result == TSS_SUCCESS)
+		result = hte->comm.hdr.u.result;
+
+	if (result == TSS_SUCCESS)
+		*pulSent = count;
+
+	return result;
+}
+
 TSS_RESULT
 RPC_EnumRegisteredKeys_TP(struct host_table_entry *hte,
 				      TSS_UUID * pKeyUUID,	/* in */
@@ -345,6 +453,19 @@ RPC_LoadKeyByUUID_TP(struct host_table_entry *hte,
 	return result;
 }
 
+void
+PutBlob_LOADKEY_INFO(struct blob_cursor *c, TCS_LOADKEY_INFO *info)
+{
+	Trspi_PutBlob_UUID(c, &info->keyUUID);
+	Trspi_PutBlob_UUID(c, &info->parentKeyUUID);
+	PutBlob(c, TCPA_DIGEST_SIZE, info->paramDigest.digest);
+	PutBlob_UINT32(c, info->authData.AuthHandle);
+	PutBlob(c, TCPA_NONCE_SIZE, (BYTE *)&info->authData.NonceOdd.nonce);
+	PutBlob(c, TCPA_NONCE_SIZE, (BYTE *)&info->authData.NonceEven.nonce);
+	PutBlob_BOOL(c, info->authData.fContinueAuthSession);
+	PutBlob(c, TCPA_DIGEST_SIZE, (BYTE *)&info->authData.HMAC);
+}
+
 void
 LoadBlob_LOADKEY_INFO(UINT64 *offset, BYTE *blob, TCS_LOADKEY_INFO *info)
 {
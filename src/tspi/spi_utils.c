@@ -404,6 +404,25 @@ get_pcr_event_size(TSS_PCR_EVENT *e)
 	return (sizeof(TSS_PCR_EVENT) + e->ulEventLength + e->ulPcrValueLength);
 }
 
+/* A TCS that predates an ordinal rejects it with exactly TSS_E_FAIL from the TCS layer. The
+ * tcsd's handlers for the newer ordinals never return that, and it refuses operations that
+ * aren't allowed with TSS_E_INVALID_OBJ_ACCESS, so any other result is a real failure that has
+ * to be reported rather than worked around with older ordinals */
+TSS_BOOL
+tcs_lacks_ordinal(TSS_RESULT result)
+{
+	return (result == (TSS_LAYER_TCS | TSS_E_FAIL));
+}
+
+void
+PutBlob_AUTH(struct blob_cursor *c, TPM_AUTH *auth)
+{
+	PutBlob_UINT32(c, auth->AuthHandle);
+	PutBlob(c, 20, auth->NonceOdd.nonce);
+	PutBlob_BOOL(c, auth->fContinueAuthSession);
+	PutBlob(c, 20, (BYTE *)&auth->HMAC);
+}
+
 void
 LoadBlob_AUTH(UINT64 *offset, BYTE *blob, TPM_AUTH *auth)
 {
@@ -105,9 +105,11 @@ Transport_MakeIdentity2(TSS_HCONTEXT tspContext,
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_MakeIdentity, dataLen,
 						    data, NULL, &handlesLen, NULL, pSrkAuth,
 						    pOwnerAuth, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
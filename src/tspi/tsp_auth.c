@@ -38,7 +38,6 @@ secret_PerformAuth_OIAP(TSS_HOBJECT hAuthorizedObject,
 	TSS_RESULT result;
 	TSS_BOOL bExpired;
 	UINT32 mode;
-	TCPA_SECRET secret;
 	TSS_HCONTEXT tspContext;
 	TSS_RESULT (*OIAP)(TSS_HCONTEXT, TCS_AUTHHANDLE *, TPM_NONCE *); // XXX hack
 	TSS_RESULT (*TerminateHandle)(TSS_HCONTEXT, TCS_HANDLE); // XXX hack
@@ -101,11 +100,8 @@ secret_PerformAuth_OIAP(TSS_HOBJECT hAuthorizedObject,
 		case TSS_SECRET_MODE_SHA1:
 		case TSS_SECRET_MODE_PLAIN:
 		case TSS_SECRET_MODE_POPUP:
-			if ((result = obj_policy_get_secret(hPolicy, TR_SECRET_CTX_NOT_NEW,
-							    &secret)))
-				break;
-
-			HMAC_Auth(secret.authdata, hashDigest->digest, auth);
+			result = obj_policy_hmac_auth(hPolicy, TR_SECRET_CTX_NOT_NEW,
+						      hashDigest->digest, auth);
 			break;
 		case TSS_SECRET_MODE_NONE:
 			/* fall through */
@@ -362,21 +358,54 @@ validateReturnAuth(BYTE *secret, BYTE *hash, TPM_AUTH *auth)
 	return ((TSS_BOOL) memcmp(digest, &auth->HMAC, 20) != 0);
 }
 
-void
-HMAC_Auth(BYTE * secret, BYTE * Digest, TPM_AUTH * auth)
+TSS_BOOL
+validateReturnAuth_Keyed(Trspi_HmacKey *key, BYTE *hash, TPM_AUTH *auth)
 {
-	UINT64 offset;
-	BYTE Blob[61];
+	BYTE digest[20];
+	/* auth is expected to have both nonces and the digest from the TPM */
+	memcpy(digest, &auth->HMAC, 20);
+	if (HMAC_Auth_Keyed(key, hash, auth))
+		return TRUE;
+
+	return ((TSS_BOOL) memcmp(digest, &auth->HMAC, 20) != 0);
+}
+
+static UINT64
+HMAC_Auth_LoadBlob(BYTE *Digest, TPM_AUTH *auth, BYTE *Blob)
+{
+	UINT64 offset = 0;
 
-	offset = 0;
 	Trspi_LoadBlob(&offset, 20, Blob, Digest);
 	Trspi_LoadBlob(&offset, 20, Blob, auth->NonceEven.nonce);
 	Trspi_LoadBlob(&offset, 20, Blob, auth->NonceOdd.nonce);
 	Blob[offset++] = auth->fContinueAuthSession;
 
+	return offset;
+}
+
+void
+HMAC_Auth(BYTE * secret, BYTE * Digest, TPM_AUTH * auth)
+{
+	UINT64 offset;
+	BYTE Blob[61];
+
+	offset = HMAC_Auth_LoadBlob(Digest, auth, Blob);
+
 	Trspi_HMAC(TSS_HASH_SHA1, 20, secret, offset, Blob, (BYTE *)&auth->HMAC);
 }
 
+/* Same as HMAC_Auth, using a precomputed key schedule for the secret */
+TSS_RESULT
+HMAC_Auth_Keyed(Trspi_HmacKey *key, BYTE *Digest, TPM_AUTH *auth)
+{
+	UINT64 offset;
+	BYTE Blob[61];
+
+	offset = HMAC_Auth_LoadBlob(Digest, auth, Blob);
+
+	return Trspi_HMAC_Keyed(key, offset, Blob, (BYTE *)&auth->HMAC);
+}
+
 TSS_RESULT
 OSAP_Calc(TSS_HCONTEXT tspContext, UINT16 EntityType, UINT32 EntityValue,
 	  BYTE * authSecret, BYTE * usageSecret, BYTE * migSecret,
@@ -452,6 +481,7 @@ obj_policy_validate_auth_oiap(TSS_HPOLICY hPolicy, TCPA_DIGEST *hashDigest, TPM_
 	TSS_RESULT result = TSS_SUCCESS;
 	struct tsp_object *obj;
 	struct tr_policy_obj *policy;
+	Trspi_HmacKey *key;
 	BYTE wellKnown[TCPA_SHA1_160_HASH_LEN] = TSS_WELL_KNOWN_SECRET;
 
 	if ((obj = obj_list_get_obj(&policy_list, hPolicy)) == NULL)
@@ -477,7 +507,10 @@ obj_policy_validate_auth_oiap(TSS_HPOLICY hPolicy, TCPA_DIGEST *hashDigest, TPM_
 		case TSS_SECRET_MODE_SHA1:
 		case TSS_SECRET_MODE_PLAIN:
 		case TSS_SECRET_MODE_POPUP:
-			if (validateReturnAuth(policy->Secret, hashDigest->digest, auth))
+			if ((result = obj_policy_get_hmac_key(policy, TR_SECRET_CTX_NOT_NEW, &key)))
+				break;
+
+			if (validateReturnAuth_Keyed(key, hashDigest->digest, auth))
 				result = TSPERR(TSS_E_TSP_AUTHFAIL);
 			break;
 		case TSS_SECRET_MODE_NONE:
@@ -746,14 +779,20 @@ authsess_callback_hmac(PVOID lpAppData,
 	Trspi_LoadBlob(&offset, ulSizeNonces, Blob, rgbNonceOdd);
 	Blob[offset++] = ContinueUse;
 
+	if (sess->sharedSecretKey.key == NULL) {
+		if ((result = Trspi_HMAC_KeyInit(&sess->sharedSecretKey, TSS_HASH_SHA1,
+						 ulSizeDigestHmac, sess->sharedSecret.digest)))
+			return result;
+	}
+
 	if (ReturnOrVerify) {
-		Trspi_HMAC(TSS_HASH_SHA1, ulSizeDigestHmac, sess->sharedSecret.digest, offset, Blob,
-			   rgbHmacData);
+		result = Trspi_HMAC_Keyed(&sess->sharedSecretKey, offset, Blob, rgbHmacData);
 	} else {
 		TPM_HMAC hmacVerify;
 
-		Trspi_HMAC(TSS_HASH_SHA1, ulSizeDigestHmac, sess->sharedSecret.digest, offset, Blob,
-			   hmacVerify.digest);
+		if ((result = Trspi_HMAC_Keyed(&sess->sharedSecretKey, offset, Blob,
+					       hmacVerify.digest)))
+			return result;
 		result = memcmp(rgbHmacData, hmacVerify.digest, ulSizeDigestHmac);
 		if (result)
 			result = TPM_E_AUTHFAIL;
@@ -1130,6 +1169,7 @@ authsess_free(struct authsess *xsap)
 		if (xsap->auth.AuthHandle && xsap->auth.fContinueAuthSession)
 			(void)__tspi_free_resource(xsap->tspContext, xsap->auth.AuthHandle, TPM_RT_AUTH);
 
+		Trspi_HMAC_KeyFree(&xsap->sharedSecretKey);
 		free(xsap->entityValue);
 		free(xsap);
 		xsap = NULL;
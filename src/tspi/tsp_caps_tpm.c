@@ -104,9 +104,11 @@ Transport_GetTPMCapability(TSS_HCONTEXT        tspContext,	/* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_GetCapability, dataLen,
 						    data, NULL, &handlesLen, NULL, NULL, NULL,
 						    &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
@@ -161,6 +163,8 @@ Transport_SetCapability(TSS_HCONTEXT tspContext,	/* in */
 	result = obj_context_transport_execute(tspContext, TPM_ORD_SetCapability, dataLen, data,
 					       NULL, &handlesLen, NULL, NULL, NULL, NULL, NULL);
 
+	memset(data, 0, dataLen);
+
 	free(data);
 	return result;
 }
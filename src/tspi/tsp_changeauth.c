@@ -420,9 +420,11 @@ Transport_ChangeAuth(TSS_HCONTEXT tspContext,	/* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_ChangeAuth, dataLen, data,
 						    &pubKeyHash, &handlesLen, &handles,
 						    ownerAuth, entityAuth, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
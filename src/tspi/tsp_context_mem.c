@@ -1,4 +1,3 @@
-
 /*
  * Licensed Materials - Property of IBM
  *
@@ -21,6 +20,22 @@
 #include "tsplog.h"
 #include "obj.h"
 
+#define MEM_ALIGN_UP(x)		(((x) + (MEM_ARENA_ALIGN - 1)) & ~(MEM_ARENA_ALIGN - 1))
+#define MEM_CHUNK_HDR_SIZE	MEM_ALIGN_UP(sizeof(struct memChunk))
+#define MEM_ARENA_CLASS(x)	(((x) / MEM_ARENA_ALIGN) - 1)
+
+static inline UINT32
+__tspi_ptrHash(void *pointer, UINT32 num_buckets)
+{
+	unsigned long p = (unsigned long)pointer;
+
+	/* the low bits are always zero due to alignment, so mix the high ones in */
+	p ^= p >> 4;
+	p ^= p >> 12;
+
+	return (UINT32)(p & (num_buckets - 1));
+}
+
 static struct memTable *
 __tspi_createTable()
 {
@@ -34,6 +49,16 @@ __tspi_createTable()
 		LogError("malloc of %zd bytes failed.", sizeof(struct memTable));
 		return NULL;
 	}
+
+	table->entries = calloc(MEM_ENTRY_HASH_INIT, sizeof(struct memEntry *));
+	if (table->entries == NULL) {
+		LogError("malloc of %zd bytes failed.",
+			 MEM_ENTRY_HASH_INIT * sizeof(struct memEntry *));
+		free(table);
+		return NULL;
+	}
+	table->num_buckets = MEM_ENTRY_HASH_INIT;
+
 	return (table);
 }
 
@@ -43,7 +68,7 @@ getTable(TSS_HCONTEXT tspContext)
 {
 	struct memTable *tmp;
 
-	for (tmp = SpiMemoryTable; tmp; tmp = tmp->nextTable)
+	for (tmp = SpiMemoryTable[tspContext % MEM_TABLE_HASH_SIZE]; tmp; tmp = tmp->nextTable)
 		if (tmp->tspContext == tspContext)
 			return tmp;
 
@@ -54,80 +79,187 @@ getTable(TSS_HCONTEXT tspContext)
 static void
 __tspi_addTable(struct memTable *new)
 {
-	struct memTable *tmp = SpiMemoryTable;
+	UINT32 bucket = new->tspContext % MEM_TABLE_HASH_SIZE;
 
-	/* base case, this is the first table */
-	if (SpiMemoryTable == NULL) {
-		SpiMemoryTable = new;
-		return;
+	new->nextTable = SpiMemoryTable[bucket];
+	SpiMemoryTable[bucket] = new;
+}
+
+/* caller needs to lock memtable lock */
+static struct memTable *
+__tspi_getOrCreateTable(TSS_HCONTEXT tspContext)
+{
+	struct memTable *table = getTable(tspContext);
+
+	if (table == NULL) {
+		if ((table = __tspi_createTable()) == NULL)
+			return NULL;
+		table->tspContext = tspContext;
+		__tspi_addTable(table);
 	}
 
-	/* else add @new onto the end */
-	for (; tmp; tmp = tmp->nextTable)
-		if (tmp->nextTable == NULL) {
-			tmp->nextTable = new;
-			break;
-		}
+	return table;
 }
 
-/* caller needs to lock memtable lock and be sure the context mem slot for
- * @tspContext exists before calling.
- */
-void
-__tspi_addEntry(TSS_HCONTEXT tspContext, struct memEntry *new)
+/* Carve @size zeroed bytes out of @table's arena, reusing a freed block of the same size class
+ * if there is one. Caller needs to lock memtable lock. */
+static void *
+__tspi_arenaAlloc(struct memTable *table, UINT32 size)
 {
-	struct memTable *tmp = getTable(tspContext);
-	struct memEntry *tmp_entry;
-
-	if (tmp == NULL) {
-		if ((tmp = __tspi_createTable()) == NULL)
-			return;
-		tmp->tspContext = tspContext;
-		__tspi_addTable(tmp);
+	struct memChunk *chunk = table->chunks;
+	void *mem, **free_list;
+
+	size = MEM_ALIGN_UP(size);
+
+	free_list = &table->free_blocks[MEM_ARENA_CLASS(size)];
+	if ((mem = *free_list) != NULL) {
+		*free_list = *(void **)mem;
+		memset(mem, 0, size);
+		return mem;
 	}
 
-	tmp_entry = tmp->entries;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		chunk = malloc(MEM_CHUNK_HDR_SIZE + MEM_ARENA_CHUNK_SIZE);
+		if (chunk == NULL) {
+			LogError("malloc of %zd bytes failed.",
+				 MEM_CHUNK_HDR_SIZE + MEM_ARENA_CHUNK_SIZE);
+			return NULL;
+		}
+		chunk->used = 0;
+		chunk->size = MEM_ARENA_CHUNK_SIZE;
+		chunk->next = table->chunks;
+		table->chunks = chunk;
+	}
+
+	mem = (BYTE *)chunk + MEM_CHUNK_HDR_SIZE + chunk->used;
+	chunk->used += size;
+	memset(mem, 0, size);
+
+	return mem;
+}
 
-	if (tmp->entries == NULL) {
-		tmp->entries = new;
+/* Put the @size byte arena block at @mem on its size class's free list. Caller needs to lock
+ * memtable lock. */
+static void
+__tspi_arenaFree(struct memTable *table, void *mem, UINT32 size)
+{
+	void **free_list = &table->free_blocks[MEM_ARENA_CLASS(size)];
+
+	*(void **)mem = *free_list;
+	*free_list = mem;
+}
+
+/* Once the user has given back every pointer in the context, the arena can be rewound. All
+ * but the newest chunk are released, so a burst of small allocations doesn't pin its chunks
+ * for the rest of the context's life. Caller needs to lock memtable lock. */
+static void
+__tspi_arenaReset(struct memTable *table)
+{
+	struct memChunk *chunk, *next;
+
+	if (table->chunks == NULL)
 		return;
+
+	for (chunk = table->chunks->next; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	table->chunks->next = NULL;
+	table->chunks->used = 0;
+	table->free_entries = NULL;
+	memset(table->free_blocks, 0, sizeof(table->free_blocks));
+}
+
+/* caller needs to lock memtable lock */
+static struct memEntry *
+__tspi_newEntry(struct memTable *table)
+{
+	struct memEntry *entry;
+
+	if ((entry = table->free_entries) != NULL) {
+		table->free_entries = entry->nextEntry;
+		memset(entry, 0, sizeof(struct memEntry));
+		return entry;
 	}
 
-	/* else tack @new onto the end */
-	for (; tmp_entry; tmp_entry = tmp_entry->nextEntry) {
-		if (tmp_entry->nextEntry == NULL) {
-			tmp_entry->nextEntry = new;
-			break;
+	return __tspi_arenaAlloc(table, sizeof(struct memEntry));
+}
+
+/* Double the number of hash buckets, rehashing all entries. If the allocation fails, the
+ * table just keeps working with longer chains. Caller needs to lock memtable lock. */
+static void
+__tspi_growTable(struct memTable *table)
+{
+	struct memEntry **new_entries, *entry, *next;
+	UINT32 i, bucket, new_size = table->num_buckets * 2;
+
+	if ((new_entries = calloc(new_size, sizeof(struct memEntry *))) == NULL)
+		return;
+
+	for (i = 0; i < table->num_buckets; i++) {
+		for (entry = table->entries[i]; entry; entry = next) {
+			next = entry->nextEntry;
+			bucket = __tspi_ptrHash(entry->memPointer, new_size);
+			entry->nextEntry = new_entries[bucket];
+			new_entries[bucket] = entry;
 		}
 	}
+
+	free(table->entries);
+	table->entries = new_entries;
+	table->num_buckets = new_size;
+}
+
+/* caller needs to lock memtable lock */
+void
+__tspi_addEntry(struct memTable *table, struct memEntry *new)
+{
+	UINT32 bucket;
+
+	if (table->num_entries >= table->num_buckets)
+		__tspi_growTable(table);
+
+	bucket = __tspi_ptrHash(new->memPointer, table->num_buckets);
+	new->nextEntry = table->entries[bucket];
+	table->entries[bucket] = new;
+	table->num_entries++;
 }
 
 /* caller needs to lock memtable lock */
 TSS_RESULT
 __tspi_freeTable(TSS_HCONTEXT tspContext)
 {
-	struct memTable *prev = NULL, *index = NULL, *next = NULL;
-	struct memEntry *entry = NULL, *entry_next = NULL;
-
-	for(index = SpiMemoryTable; index; index = index->nextTable) {
-		next = index->nextTable;
-		if (index->tspContext == tspContext) {
-			for (entry = index->entries; entry; entry = entry_next) {
-				/* this needs to be set before we do free(entry) */
-				entry_next = entry->nextEntry;
-				free(entry->memPointer);
-				free(entry);
+	struct memTable *prev = NULL, *index = NULL;
+	struct memEntry *entry = NULL;
+	struct memChunk *chunk = NULL, *chunk_next = NULL;
+	UINT32 i, bucket = tspContext % MEM_TABLE_HASH_SIZE;
+
+	for (index = SpiMemoryTable[bucket]; index; prev = index, index = index->nextTable) {
+		if (index->tspContext != tspContext)
+			continue;
+
+		if (prev != NULL)
+			prev->nextTable = index->nextTable;
+		else
+			SpiMemoryTable[bucket] = index->nextTable;
+
+		/* arena memory goes away with its chunks, only the rest is freed one by one */
+		for (i = 0; i < index->num_buckets; i++) {
+			for (entry = index->entries[i]; entry; entry = entry->nextEntry) {
+				if (!(entry->flags & MEM_ENTRY_FLAG_ARENA))
+					free(entry->memPointer);
 			}
+		}
 
-			if (prev != NULL)
-				prev->nextTable = next;
-			else
-				SpiMemoryTable = NULL;
-
-			free(index);
-			break;
+		for (chunk = index->chunks; chunk; chunk = chunk_next) {
+			chunk_next = chunk->next;
+			free(chunk);
 		}
-		prev = index;
+
+		free(index->entries);
+		free(index);
+		break;
 	}
 
 	return TSS_SUCCESS;
@@ -138,20 +270,31 @@ __tspi_freeEntry(struct memTable *table, void *pointer)
 {
 	struct memEntry *index = NULL;
 	struct memEntry *prev = NULL;
-	struct memEntry *toKill = NULL;
+	UINT32 bucket = __tspi_ptrHash(pointer, table->num_buckets);
+
+	for (index = table->entries[bucket]; index; prev = index, index = index->nextEntry) {
+		if (index->memPointer != pointer)
+			continue;
 
-	for (index = table->entries; index; prev = index, index = index->nextEntry) {
-		if (index->memPointer == pointer) {
-			toKill = index;
-			if (prev == NULL)
-				table->entries = toKill->nextEntry;
-			else
-				prev->nextEntry = toKill->nextEntry;
+		if (prev == NULL)
+			table->entries[bucket] = index->nextEntry;
+		else
+			prev->nextEntry = index->nextEntry;
+		table->num_entries--;
 
+		if (index->flags & MEM_ENTRY_FLAG_ARENA)
+			__tspi_arenaFree(table, pointer, index->size);
+		else
 			free(pointer);
-			free(toKill);
-			return TSS_SUCCESS;
+
+		if (table->num_entries == 0) {
+			__tspi_arenaReset(table);
+		} else {
+			index->nextEntry = table->free_entries;
+			table->free_entries = index;
 		}
+
+		return TSS_SUCCESS;
 	}
 
 	return TSPERR(TSS_E_INVALID_RESOURCE);
@@ -160,17 +303,20 @@ __tspi_freeEntry(struct memTable *table, void *pointer)
 TSS_RESULT
 __tspi_add_mem_entry(TSS_HCONTEXT tspContext, void *allocd_mem)
 {
-	struct memEntry *newEntry = calloc(1, sizeof(struct memEntry));
-	if (newEntry == NULL) {
-		LogError("malloc of %zd bytes failed.", sizeof(struct memEntry));
+	struct memTable *table;
+	struct memEntry *newEntry;
+
+	MUTEX_LOCK(memtable_lock);
+
+	if ((table = __tspi_getOrCreateTable(tspContext)) == NULL ||
+	    (newEntry = __tspi_newEntry(table)) == NULL) {
+		MUTEX_UNLOCK(memtable_lock);
 		return TSPERR(TSS_E_OUTOFMEMORY);
 	}
 
 	newEntry->memPointer = allocd_mem;
 
-	MUTEX_LOCK(memtable_lock);
-
-	__tspi_addEntry(tspContext, newEntry);
+	__tspi_addEntry(table, newEntry);
 
 	MUTEX_UNLOCK(memtable_lock);
 
@@ -189,27 +335,31 @@ calloc_tspi(TSS_HCONTEXT tspContext, UINT32 howMuch)
 
 	MUTEX_LOCK(memtable_lock);
 
-	table = getTable(tspContext);
-	if (table == NULL) {
-		if ((table = __tspi_createTable()) == NULL) {
-			MUTEX_UNLOCK(memtable_lock);
-			return NULL;
-		}
-		table->tspContext = tspContext;
-		__tspi_addTable(table);
+	if ((table = __tspi_getOrCreateTable(tspContext)) == NULL) {
+		MUTEX_UNLOCK(memtable_lock);
+		return NULL;
 	}
 
-	newEntry = calloc(1, sizeof(struct memEntry));
-	if (newEntry == NULL) {
-		LogError("malloc of %zd bytes failed.", sizeof(struct memEntry));
+	if ((newEntry = __tspi_newEntry(table)) == NULL) {
 		MUTEX_UNLOCK(memtable_lock);
 		return NULL;
 	}
 
-	newEntry->memPointer = calloc(1, howMuch);
+	/* small buffers such as digests, nonces and PCR values come out of the arena */
+	if (howMuch != 0 && howMuch <= MEM_ARENA_SMALL_MAX) {
+		newEntry->memPointer = __tspi_arenaAlloc(table, howMuch);
+		newEntry->flags = MEM_ENTRY_FLAG_ARENA;
+		newEntry->size = MEM_ALIGN_UP(howMuch);
+	} else {
+		newEntry->memPointer = calloc(1, howMuch);
+		if (newEntry->memPointer == NULL) {
+			LogError("malloc of %d bytes failed.", howMuch);
+		}
+	}
+
 	if (newEntry->memPointer == NULL) {
-		LogError("malloc of %d bytes failed.", howMuch);
-		free(newEntry);
+		newEntry->nextEntry = table->free_entries;
+		table->free_entries = newEntry;
 		MUTEX_UNLOCK(memtable_lock);
 		return NULL;
 	}
@@ -217,7 +367,7 @@ calloc_tspi(TSS_HCONTEXT tspContext, UINT32 howMuch)
 	/* this call must happen inside the lock or else another thread could
 	 * remove the context mem slot, causing a segfault
 	 */
-	__tspi_addEntry(tspContext, newEntry);
+	__tspi_addEntry(table, newEntry);
 
 	MUTEX_UNLOCK(memtable_lock);
 
@@ -465,9 +465,11 @@ Transport_Delegate_Manage(TSS_HCONTEXT tspContext,              /* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_Delegate_Manage, dataLen,
 						    data, NULL, &handlesLen, NULL, ownerAuth,
 						    NULL, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
@@ -535,9 +537,11 @@ Transport_Delegate_CreateKeyDelegation(TSS_HCONTEXT tspContext,         /* in */
 						    TPM_ORD_Delegate_CreateKeyDelegation, dataLen,
 						    data, &pubKeyHash, &handlesLen, &handles,
 						    keyAuth, NULL, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
@@ -591,9 +595,11 @@ Transport_Delegate_CreateOwnerDelegation(TSS_HCONTEXT tspContext,       /* in */
 						    TPM_ORD_Delegate_CreateOwnerDelegation, dataLen,
 						    data, NULL, &handlesLen, NULL, ownerAuth,
 						    NULL, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
@@ -644,9 +650,11 @@ Transport_Delegate_LoadOwnerDelegation(TSS_HCONTEXT tspContext, /* in */
 						    TPM_ORD_Delegate_LoadOwnerDelegation, dataLen,
 						    data, NULL, &handlesLen, NULL, ownerAuth,
 						    NULL, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 	free(dec);
 
@@ -736,9 +744,11 @@ Transport_Delegate_UpdateVerificationCount(TSS_HCONTEXT tspContext,     /* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_Delegate_UpdateVerification,
 						    dataLen, data, NULL, &handlesLen, NULL,
 						    ownerAuth, NULL, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
@@ -786,6 +796,7 @@ Transport_Delegate_VerifyDelegation(TSS_HCONTEXT tspContext,    /* in */
 	result = obj_context_transport_execute(tspContext, TPM_ORD_Delegate_VerifyDelegation,
 					       dataLen, data, NULL, &handlesLen, NULL, NULL, NULL,
 					       &decLen, &dec);
+	memset(data, 0, dataLen);
 	free(data);
 	free(dec);
 
@@ -847,9 +858,11 @@ Transport_DSAP(TSS_HCONTEXT tspContext,		/* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_DSAP, dataLen, data,
 						    &pubKeyHash, &handlesLen, &handles, NULL, NULL,
 						    &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
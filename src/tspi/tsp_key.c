@@ -41,6 +41,15 @@ free_key_refs(TSS_KEY *key)
 	key->PCRInfoSize = 0;
 }
 
+void
+PutBlob_TSS_KEY(struct blob_cursor *c, TSS_KEY *key)
+{
+	if (key->hdr.key12.tag == TPM_TAG_KEY12)
+		Trspi_PutBlob_KEY12(c, (TPM_KEY12 *)key);
+	else
+		Trspi_PutBlob_KEY(c, (TCPA_KEY *)key);
+}
+
 void
 LoadBlob_TSS_KEY(UINT64 *offset, BYTE *blob, TSS_KEY *key)
 {
@@ -236,6 +245,7 @@ Transport_CreateWrapKey(TSS_HCONTEXT tspContext,	/* in */
 	*keyDataSize = decLen;
 	*keyData = dec;
 done:
+	memset(data, 0, 2 * sizeof(TPM_ENCAUTH) + keyInfoSize);
 	free(data);
 
 	return result;
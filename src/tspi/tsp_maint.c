@@ -154,9 +154,11 @@ Transport_LoadManuMaintPub(TSS_HCONTEXT tspContext,	/* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_LoadManuMaintPub,
 						    dataLen, data, NULL, &handlesLen, NULL, NULL,
 						    NULL, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
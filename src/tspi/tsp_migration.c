@@ -82,9 +82,11 @@ Transport_CreateMigrationBlob(TSS_HCONTEXT tspContext,	/* in */
 						    dataLen, data, &pubKeyHash, &handlesLen,
 						    &handles, parentAuth, entityAuth, &decLen,
 						    &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
@@ -167,9 +169,11 @@ Transport_ConvertMigrationBlob(TSS_HCONTEXT tspContext,	/* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_ConvertMigrationBlob,
 						    dataLen, data, &pubKeyHash, &handlesLen,
 						    &handles, parentAuth, NULL, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
@@ -248,9 +252,11 @@ Transport_AuthorizeMigrationKey(TSS_HCONTEXT tspContext,	/* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_AuthorizeMigrationKey,
 						    dataLen, data, NULL, &handlesLen, NULL,
 						    ownerAuth, NULL, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	*MigrationKeyAuthSize = decLen;
@@ -53,6 +53,7 @@ Transport_NV_DefineOrReleaseSpace(TSS_HCONTEXT tspContext,	/* in */
 
 	result = obj_context_transport_execute(tspContext, TPM_ORD_NV_DefineSpace, dataLen, data,
 					       NULL, &handlesLen, NULL, pAuth, NULL, NULL, NULL);
+	memset(data, 0, dataLen);
 	free(data);
 
 	return result;
@@ -91,6 +92,7 @@ Transport_NV_WriteValue(TSS_HCONTEXT tspContext,	/* in */
 
 	result = obj_context_transport_execute(tspContext, TPM_ORD_NV_WriteValue, dataLen, data,
 					       NULL, &handlesLen, NULL, privAuth, NULL, NULL, NULL);
+	memset(data, 0, dataLen);
 	free(data);
 
 	return result;
@@ -129,6 +131,7 @@ Transport_NV_WriteValueAuth(TSS_HCONTEXT tspContext,	/* in */
 
 	result = obj_context_transport_execute(tspContext, TPM_ORD_NV_WriteValueAuth, dataLen, data,
 					       NULL, &handlesLen, NULL, NVAuth, NULL, NULL, NULL);
+	memset(data, 0, dataLen);
 	free(data);
 
 	return result;
@@ -168,9 +171,11 @@ Transport_NV_ReadValue(TSS_HCONTEXT tspContext,	/* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_NV_ReadValue, dataLen, data,
 						    NULL, &handlesLen, NULL, privAuth, NULL,
 						    &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset64 = 0;
@@ -222,9 +227,11 @@ Transport_NV_ReadValueAuth(TSS_HCONTEXT tspContext,	/* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_NV_ReadValueAuth, dataLen,
 						    data, NULL, &handlesLen, NULL, NVAuth, NULL,
 						    &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset64 = 0;
@@ -145,6 +145,64 @@ ps_remove_key(TSS_UUID *uuid)
 	return result;
 }
 
+/* Remove @count keys, or none of them: if one can't be removed, the ones that were are written
+ * back */
+TSS_RESULT
+ps_remove_keys(UINT32 count, TSS_UUID *uuids)
+{
+	struct key_disk_cache *removed;
+	BYTE **blobs;
+	UINT32 i, j;
+	int fd;
+	TSS_RESULT result;
+
+	removed = calloc(count, sizeof(struct key_disk_cache));
+	blobs = calloc(count, sizeof(BYTE *));
+	if (removed == NULL || blobs == NULL) {
+		LogError("malloc of %zd bytes failed.",
+			 count * (sizeof(struct key_disk_cache) + sizeof(BYTE *)));
+		free(removed);
+		free(blobs);
+		return TSPERR(TSS_E_OUTOFMEMORY);
+	}
+
+	if ((result = get_file(&fd)))
+		goto done;
+
+	for (i = 0; i < count; i++) {
+		/* keep a copy of the key to write back if a later one fails */
+		if ((result = psfile_get_cache_entry_by_uuid(fd, &uuids[i], &removed[i])))
+			break;
+
+		if ((blobs[i] = malloc(removed[i].blob_size)) == NULL) {
+			LogError("malloc of %u bytes failed.", removed[i].blob_size);
+			result = TSPERR(TSS_E_OUTOFMEMORY);
+			break;
+		}
+
+		if ((result = psfile_get_key_by_uuid(fd, &uuids[i], blobs[i])) ||
+		    (result = psfile_remove_key(fd, &uuids[i])))
+			break;
+	}
+
+	if (result) {
+		for (j = 0; j < i; j++)
+			(void)psfile_write_key(fd, &uuids[j], &removed[j].parent_uuid,
+					       (removed[j].flags & CACHE_FLAG_PARENT_PS_SYSTEM) ?
+					       TSS_PS_TYPE_SYSTEM : TSS_PS_TYPE_USER,
+					       blobs[j], removed[j].blob_size);
+	}
+
+	put_file(fd);
+done:
+	for (i = 0; i < count; i++)
+		free(blobs[i]);
+	free(blobs);
+	free(removed);
+
+	return result;
+}
+
 TSS_RESULT
 ps_get_key_by_pub(TSS_HCONTEXT tspContext, UINT32 pub_size, BYTE *pub, TSS_HKEY *hKey)
 {
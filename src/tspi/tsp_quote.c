@@ -75,9 +75,11 @@ Transport_Quote(TSS_HCONTEXT tspContext,	/* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_Quote, dataLen, data,
 						    &pubKeyHash, &handlesLen, &handles,
 						    privAuth, NULL, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
@@ -79,9 +79,11 @@ Transport_Quote2(TSS_HCONTEXT tspContext, /* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_Quote2, dataLen, data,
 						    &pubKeyHash, &handlesLen, &handles,
 						    privAuth, NULL, &decLen, &dec))) {
+		memset(data, 0, dataLen);
 		free(data);
 		return result;
 	}
+	memset(data, 0, dataLen);
 	free(data);
 
 	offset = 0;
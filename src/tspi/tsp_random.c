@@ -81,6 +81,7 @@ Transport_StirRandom(TSS_HCONTEXT tspContext,	/* in */
 
 	result = obj_context_transport_execute(tspContext, TPM_ORD_StirRandom, dataLen, data, NULL,
 					       &handlesLen, NULL, NULL, NULL, NULL, NULL);
+	memset(data, 0, dataLen);
 	free(data);
 
 	return result;
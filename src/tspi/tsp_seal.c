@@ -126,10 +126,13 @@ Transport_Seal(TSS_HCONTEXT tspContext,    /* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_Seal, dataLen, data,
 						    &pubKeyHash, &handlesLen, &handles, pubAuth,
 						    NULL, &decLen, &dec)))
-		return result;
+		goto done;
 
 	*SealedDataSize = decLen;
 	*SealedData = dec;
+done:
+	memset(data, 0, dataLen);
+	free(data);
 
 	return result;
 }
@@ -188,10 +191,13 @@ Transport_Sealx(TSS_HCONTEXT tspContext,   /* in */
 	if ((result = obj_context_transport_execute(tspContext, TPM_ORD_Sealx, dataLen, data,
 						    &pubKeyHash, &handlesLen, &handles, pubAuth,
 						    NULL, &decLen, &dec)))
-		return result;
+		goto done;
 
 	*SealedDataSize = decLen;
 	*SealedData = dec;
+done:
+	memset(data, 0, dataLen);
+	free(data);
 
 	return result;
 }
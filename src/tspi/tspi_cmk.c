@@ -221,6 +221,7 @@ Tspi_Key_CMKCreateBlob(TSS_HKEY     hKeyToMigrate,	/* in */
 	TPM_DIGEST digest;
 	TPM_AUTH parentAuth, *pAuth;
 	UINT64 offset;
+	struct blob_cursor c;
 	TSS_RESULT result;
 
 	memset(&tssKey, 0, sizeof(tssKey));
@@ -333,17 +334,14 @@ Tspi_Key_CMKCreateBlob(TSS_HKEY     hKeyToMigrate,	/* in */
 	/* Set outData to null since it will now be freed during key ref freeing */
 	outData = NULL;
 
-	offset = 0;
-	LoadBlob_TSS_KEY(&offset, NULL, &tssKey);
-
-	newBlobSize = offset;
+	newBlobSize = BLOB_SIZEOF_KEY(&tssKey);
 	if ((newBlob = malloc(newBlobSize)) == NULL) {
 		LogError("malloc of %u bytes failed.", newBlobSize);
 		result = TSPERR(TSS_E_OUTOFMEMORY);
 		goto done;
 	}
-	offset = 0;
-	LoadBlob_TSS_KEY(&offset, newBlob, &tssKey);
+	blob_cursor_init(&c, newBlob, newBlobSize, 0);
+	PutBlob_TSS_KEY(&c, &tssKey);
 
 	if ((result = obj_migdata_set_blob(hMigrationData, newBlobSize, newBlob)))
 		goto done;
@@ -156,6 +156,7 @@ Tspi_Key_CreateMigrationBlob(TSS_HKEY hKeyToMigrate,		/* in */
 	TPM_AUTH *pParentAuth;
 	TCPA_RESULT result;
 	UINT64 offset;
+	struct blob_cursor c;
 	TCPA_DIGEST digest;
 	UINT32 keyToMigrateSize;
 	BYTE *keyToMigrateBlob = NULL;
@@ -272,18 +273,15 @@ Tspi_Key_CreateMigrationBlob(TSS_HKEY hKeyToMigrate,		/* in */
 	/* Set blob to null since it will now be freed during key ref freeing */
 	blob = NULL;
 
-	offset = 0;
-	LoadBlob_TSS_KEY(&offset, NULL, &tssKey);
-	
-	*pulMigrationBlobLength = offset;
+	*pulMigrationBlobLength = BLOB_SIZEOF_KEY(&tssKey);
 	*prgbMigrationBlob = calloc_tspi(tspContext, *pulMigrationBlobLength);
 	if (*prgbMigrationBlob == NULL) {
 		LogError("malloc of %u bytes failed.", *pulMigrationBlobLength);
 		result = TSPERR(TSS_E_OUTOFMEMORY);
 		goto done;
 	}
-	offset = 0;
-	LoadBlob_TSS_KEY(&offset, *prgbMigrationBlob, &tssKey);
+	blob_cursor_init(&c, *prgbMigrationBlob, *pulMigrationBlobLength, 0);
+	PutBlob_TSS_KEY(&c, &tssKey);
 
 	if (randomSize) {
 		if ((result = __tspi_add_mem_entry(tspContext, random)))
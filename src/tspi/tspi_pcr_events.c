@@ -80,6 +80,62 @@ Tspi_TPM_GetEvents(TSS_HTPM hTPM,			/* in */
 	return TSS_SUCCESS;
 }
 
+/* Read the whole event log a page at a time, so that no single response from the TCS has to
+ * hold all of it. A TCS that predates paging rejects the ordinal, in which case the log is
+ * fetched in one piece. */
+static TSS_RESULT
+get_event_log_paged(TSS_HCONTEXT tspContext, UINT32 *pulEventNumber,
+		    TSS_PCR_EVENT **prgbPcrEvents)
+{
+	TSS_PCR_EVENT *log = NULL, *page, *tmp;
+	UINT32 pcr = 0, seq = 0, num = 0, size = 0, count;
+	UINT16 numPcrs = get_num_pcrs(tspContext);
+	TSS_RESULT result;
+
+	if (numPcrs == 0) {
+		LogDebugFn("Error querying the TPM for its number of PCRs");
+		return TSPERR(TSS_E_INTERNAL_ERROR);
+	}
+
+	while (pcr < numPcrs) {
+		if ((result = RPC_GetPcrEventLogPage(tspContext, &pcr, &seq, 0, &count, &page))) {
+			free(log);
+			if (pcr == 0 && seq == 0 && tcs_lacks_ordinal(result))
+				return RPC_GetPcrEventLog(tspContext, pulEventNumber,
+							  prgbPcrEvents);
+			return result;
+		}
+
+		if (count == 0)
+			continue;
+
+		if (num + count > size) {
+			size = (size * 2 > num + count) ? size * 2 : num + count;
+			if ((tmp = realloc(log, size * sizeof(TSS_PCR_EVENT))) == NULL) {
+				LogError("malloc of %zd bytes failed.", size * sizeof(TSS_PCR_EVENT));
+				free_tspi(tspContext, page);
+				free(log);
+				return TSPERR(TSS_E_OUTOFMEMORY);
+			}
+			log = tmp;
+		}
+
+		memcpy(&log[num], page, count * sizeof(TSS_PCR_EVENT));
+		num += count;
+		free_tspi(tspContext, page);
+	}
+
+	if (log && (result = __tspi_add_mem_entry(tspContext, log))) {
+		free(log);
+		return result;
+	}
+
+	*pulEventNumber = num;
+	*prgbPcrEvents = log;
+
+	return TSS_SUCCESS;
+}
+
 TSS_RESULT
 Tspi_TPM_GetEventLog(TSS_HTPM hTPM,			/* in */
 		     UINT32 * pulEventNumber,		/* out */
@@ -113,8 +169,50 @@ Tspi_TPM_GetEventLog(TSS_HTPM hTPM,			/* in */
 			*pulEventNumber += numEvents;
 		}
 	} else
-		return RPC_GetPcrEventLog(tspContext, pulEventNumber, prgbPcrEvents);
+		return get_event_log_paged(tspContext, pulEventNumber, prgbPcrEvents);
 
 	return TSS_SUCCESS;
 }
 
+TSS_RESULT
+Tspi_TPM_GetEventLogPage(TSS_HTPM hTPM,			/* in */
+			 UINT32 * pulPcrIndex,		/* in, out */
+			 UINT32 * pulSequence,		/* in, out */
+			 UINT32 ulMaxSize,		/* in */
+			 UINT32 * pulEventNumber,	/* out */
+			 TSS_PCR_EVENT ** prgbPcrEvents)	/* out */
+{
+	TSS_HCONTEXT tspContext;
+	TSS_RESULT result;
+
+	if (pulPcrIndex == NULL || pulSequence == NULL || pulEventNumber == NULL ||
+	    prgbPcrEvents == NULL)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	if ((result = obj_tpm_get_tsp_context(hTPM, &tspContext)))
+		return result;
+
+	return RPC_GetPcrEventLogPage(tspContext, pulPcrIndex, pulSequence, ulMaxSize,
+				      pulEventNumber, prgbPcrEvents);
+}
+
+TSS_RESULT
+Tspi_TPM_GetEventsSince(TSS_HTPM hTPM,			/* in */
+			UINT32 ulPcrIndex,		/* in */
+			UINT32 ulSequence,		/* in */
+			UINT32 * pulEventNumber,	/* out */
+			TSS_PCR_EVENT ** prgbPcrEvents,	/* out */
+			TPM_DIGEST * pAggregate)	/* out */
+{
+	TSS_HCONTEXT tspContext;
+	TSS_RESULT result;
+
+	if (pulEventNumber == NULL || prgbPcrEvents == NULL || pAggregate == NULL)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	if ((result = obj_tpm_get_tsp_context(hTPM, &tspContext)))
+		return result;
+
+	return RPC_GetPcrEventsSince(tspContext, ulPcrIndex, ulSequence, pulEventNumber,
+				     prgbPcrEvents, pAggregate);
+}
@@ -262,6 +262,194 @@ Tspi_Context_UnregisterKey(TSS_HCONTEXT tspContext,		/* in */
 	return TSS_SUCCESS;
 }
 
+static TSS_RESULT
+unregister_system_keys(TSS_HCONTEXT tspContext, UINT32 ulKeyCount, TSS_UUID *rgUuidKeys)
+{
+	TSS_RESULT result;
+	UINT32 done, sent, i;
+
+	for (done = 0; done < ulKeyCount; done += sent) {
+		if ((result = RPC_UnregisterKeys(tspContext, ulKeyCount - done, &rgUuidKeys[done],
+						 &sent)) == TSS_SUCCESS)
+			continue;
+
+		if (done > 0 || !tcs_lacks_ordinal(result))
+			return result;
+
+		for (i = 0; i < ulKeyCount; i++) {
+			if ((result = RPC_UnregisterKey(tspContext, rgUuidKeys[i])))
+				return result;
+		}
+		break;
+	}
+
+	return TSS_SUCCESS;
+}
+
+static TSS_RESULT
+register_system_keys(TSS_HCONTEXT tspContext, UINT32 ulKeyCount, UINT32 *sizes, BYTE **blobs,
+		     TSS_UUID *rgUuidKeys, TSS_UUID *rgUuidParentKeys)
+{
+	TSS_RESULT result;
+	UINT32 done, sent, i;
+
+	for (done = 0; done < ulKeyCount; done += sent) {
+		if ((result = RPC_RegisterKeys(tspContext, ulKeyCount - done,
+					       &rgUuidParentKeys[done], &rgUuidKeys[done],
+					       &sizes[done], &blobs[done],
+					       strlen(PACKAGE_STRING) + 1,
+					       (BYTE *)PACKAGE_STRING, &sent)) == TSS_SUCCESS)
+			continue;
+
+		/* the batch didn't fit in one request, undo the ones that went in */
+		if (done > 0) {
+			(void)unregister_system_keys(tspContext, done, rgUuidKeys);
+			return result;
+		}
+
+		if (!tcs_lacks_ordinal(result))
+			return result;
+
+		for (i = 0; i < ulKeyCount; i++) {
+			if ((result = RPC_RegisterKey(tspContext, rgUuidParentKeys[i],
+						      rgUuidKeys[i], sizes[i], blobs[i],
+						      strlen(PACKAGE_STRING) + 1,
+						      (BYTE *)PACKAGE_STRING))) {
+				while (i--)
+					(void)RPC_UnregisterKey(tspContext, rgUuidKeys[i]);
+				return result;
+			}
+		}
+		break;
+	}
+
+	return TSS_SUCCESS;
+}
+
+static TSS_RESULT
+register_user_keys(UINT32 ulKeyCount, UINT32 *sizes, BYTE **blobs, TSS_UUID *rgUuidKeys,
+		   TSS_FLAG persistentStorageTypeParent, TSS_UUID *rgUuidParentKeys)
+{
+	TSS_RESULT result;
+	TSS_BOOL answer;
+	UINT32 i;
+
+	for (i = 0; i < ulKeyCount; i++) {
+		if ((result = ps_is_key_registered(&rgUuidKeys[i], &answer)))
+			goto undo;
+
+		if (answer == TRUE) {
+			result = TSPERR(TSS_E_KEY_ALREADY_REGISTERED);
+			goto undo;
+		}
+
+		if ((result = ps_write_key(&rgUuidKeys[i], &rgUuidParentKeys[i],
+					   persistentStorageTypeParent, sizes[i], blobs[i])))
+			goto undo;
+	}
+
+	return TSS_SUCCESS;
+undo:
+	while (i--)
+		(void)ps_remove_key(&rgUuidKeys[i]);
+
+	return result;
+}
+
+TSS_RESULT
+Tspi_Context_RegisterKeys(TSS_HCONTEXT tspContext,		/* in */
+			  UINT32 ulKeyCount,			/* in */
+			  TSS_HKEY * rghKeys,			/* in */
+			  TSS_FLAG persistentStorageType,	/* in */
+			  TSS_UUID * rgUuidKeys,		/* in */
+			  TSS_FLAG persistentStorageTypeParent,	/* in */
+			  TSS_UUID * rgUuidParentKeys)		/* in */
+{
+	UINT32 *sizes = NULL, i;
+	BYTE **blobs = NULL;
+	TSS_RESULT result;
+
+	if (ulKeyCount == 0 || rghKeys == NULL || rgUuidKeys == NULL ||
+	    rgUuidParentKeys == NULL)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	if (!obj_is_context(tspContext))
+		return TSPERR(TSS_E_INVALID_HANDLE);
+
+	for (i = 0; i < ulKeyCount; i++) {
+		if (!obj_is_rsakey(rghKeys[i]))
+			return TSPERR(TSS_E_INVALID_HANDLE);
+	}
+
+	if (persistentStorageType == TSS_PS_TYPE_SYSTEM) {
+		if (persistentStorageTypeParent == TSS_PS_TYPE_USER)
+			return TSPERR(TSS_E_NOTIMPL);
+		else if (persistentStorageTypeParent != TSS_PS_TYPE_SYSTEM)
+			return TSPERR(TSS_E_BAD_PARAMETER);
+	} else if (persistentStorageType != TSS_PS_TYPE_USER)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	sizes = calloc(ulKeyCount, sizeof(UINT32));
+	blobs = calloc(ulKeyCount, sizeof(BYTE *));
+	if (sizes == NULL || blobs == NULL) {
+		LogError("malloc of %zd bytes failed.",
+			 ulKeyCount * (sizeof(UINT32) + sizeof(BYTE *)));
+		result = TSPERR(TSS_E_OUTOFMEMORY);
+		goto done;
+	}
+
+	for (i = 0; i < ulKeyCount; i++) {
+		if ((result = obj_rsakey_get_blob(rghKeys[i], &sizes[i], &blobs[i])))
+			goto done;
+	}
+
+	if (persistentStorageType == TSS_PS_TYPE_SYSTEM)
+		result = register_system_keys(tspContext, ulKeyCount, sizes, blobs, rgUuidKeys,
+					      rgUuidParentKeys);
+	else
+		result = register_user_keys(ulKeyCount, sizes, blobs, rgUuidKeys,
+					    persistentStorageTypeParent, rgUuidParentKeys);
+	if (result)
+		goto done;
+
+	for (i = 0; i < ulKeyCount; i++) {
+		if ((result = obj_rsakey_set_uuid(rghKeys[i], persistentStorageType,
+						  &rgUuidKeys[i])))
+			goto done;
+	}
+done:
+	if (blobs) {
+		for (i = 0; i < ulKeyCount; i++) {
+			if (blobs[i])
+				free_tspi(tspContext, blobs[i]);
+		}
+	}
+	free(blobs);
+	free(sizes);
+
+	return result;
+}
+
+TSS_RESULT
+Tspi_Context_UnregisterKeys(TSS_HCONTEXT tspContext,		/* in */
+			    TSS_FLAG persistentStorageType,	/* in */
+			    UINT32 ulKeyCount,			/* in */
+			    TSS_UUID * rgUuidKeys)		/* in */
+{
+	if (ulKeyCount == 0 || rgUuidKeys == NULL)
+		return TSPERR(TSS_E_BAD_PARAMETER);
+
+	if (!obj_is_context(tspContext))
+		return TSPERR(TSS_E_INVALID_HANDLE);
+
+	if (persistentStorageType == TSS_PS_TYPE_SYSTEM)
+		return unregister_system_keys(tspContext, ulKeyCount, rgUuidKeys);
+	else if (persistentStorageType == TSS_PS_TYPE_USER)
+		return ps_remove_keys(ulKeyCount, rgUuidKeys);
+
+	return TSPERR(TSS_E_BAD_PARAMETER);
+}
+
 TSS_RESULT
 Tspi_Context_GetKeyByUUID(TSS_HCONTEXT tspContext,		/* in */
 			  TSS_FLAG persistentStorageType,	/* in */
@@ -22,7 +22,7 @@
  *
  *   Convert a persistent storage file from one version to another.
  *
- *   There are 2 different types of persistent storage files:
+ *   There are 3 different types of persistent storage files:
  *
  * A)
  *
@@ -51,6 +51,36 @@
  * [BYTE[]   vendor_data0           ]
  * [...]
  *
+ * C) system PS only
+ *
+ * [BYTE     TrouSerS PS version='2'   ]
+ * [BYTE[7]  magic="TSS-PS"            ]
+ * [UINT32   num_keys_on_disk          ]
+ * [UINT32   num_buckets               ]
+ * [UINT32   generation                ]
+ * [UINT32   free_list_head            ]
+ * [UINT32   end_of_records            ]
+ * [UINT32   reserved                  ]
+ * [UINT32[] uuid_index[num_buckets]   ]
+ * [UINT32[] pub_index[num_buckets]    ]
+ * [TSS_UUID uuid0                     ]
+ * [TSS_UUID uuid_parent0              ]
+ * [BYTE[20] SHA1(pub_data0)           ]
+ * [UINT32   record_size0              ]
+ * [UINT32   vendor_data_size0         ]
+ * [UINT16   pub_data_size0            ]
+ * [UINT16   blob_size0                ]
+ * [UINT16   cache_flags0              ]
+ * [UINT16   reserved                  ]
+ * [UINT32   next_in_uuid_chain0       ]
+ * [UINT32   next_in_pub_chain0        ]
+ * [UINT32   reserved                  ]
+ * [BYTE[]   pub_data0                 ]
+ * [BYTE[]   blob0                     ]
+ * [BYTE[]   vendor_data0              ]
+ * [...]
+ *
+ *   See src/include/tcsps.h for the details of version 2.
  */
 
 
@@ -58,8 +88,10 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <trousers/tss.h>
+#include <trousers/trousers.h>
 
 #define PRINTERR(...)	fprintf(stderr, ##__VA_ARGS__)
 #define PRINT(...)	printf("PS " __VA_ARGS__)
@@ -72,15 +104,41 @@
 		} \
 	} while (0)
 
-/* one global buffer we read into from the PS file */
-unsigned char buf[1024];
+#define IN(stream, buf, size) \
+	do { \
+		if (fread(buf, size, 1, stream) != 1) { \
+			PRINTERR("fread error: %s\n", feof(stream) ? "unexpected EOF" : \
+				 strerror(errno)); \
+			return -1; \
+		} \
+	} while (0)
+
+#define PS_VERSION_LATEST	2
+#define PS2_MAGIC		"TSS-PS"
+#define PS2_HDR_SIZE		32
+#define PS2_REC_HDR_SIZE	80
+#define PS2_MIN_BUCKETS		128
+#define CACHE_FLAG_VALID	0x0001
+
+/* one key, as read from a PS file of any version */
+struct ps_key {
+	TSS_UUID uuid;
+	TSS_UUID parent_uuid;
+	UINT16 pub_data_size;
+	UINT16 blob_size;
+	UINT32 vendor_data_size;
+	UINT16 cache_flags;
+	BYTE *data;	/* pub data, blob and vendor data */
+};
 
 void
 usage(char *argv0)
 {
-	PRINTERR("usage: %s filename\n"
-		 "\nBrings a persistent storage file up to date with the latest "
-		 "version of trousers.\nOutput will be to \"filename.new\".\n", argv0);
+	PRINTERR("usage: %s [-v version] filename\n"
+		 "\nConverts a persistent storage file to the given version, or brings it up "
+		 "to date\nwith the latest version of trousers (%d) if no version is given.\n"
+		 "Version 2 is for the system PS file only.\n"
+		 "Output will be to \"filename.new\".\n", argv0, PS_VERSION_LATEST);
 	exit(-1);
 }
 
@@ -98,139 +156,335 @@ print_hex(BYTE *buf, UINT32 len)
 	}
 }
 
+void
+free_keys(struct ps_key *keys, UINT32 num_keys)
+{
+	UINT32 i;
+
+	for (i = 0; i < num_keys; i++)
+		free(keys[i].data);
+	free(keys);
+}
 
+/* read the pub data, blob and vendor data that follow a key's header */
 int
-convertkey_0(FILE *in, FILE *out)
+read_key_data(FILE *in, struct ps_key *key)
 {
-	UINT16 pub_data_size, blob_size, cache_flags;
-	UINT32 vendor_data_size = 0;
-	int members;
-
-	/* output the key's UUID and parent UUID */
-	OUT(out, buf, sizeof(TSS_UUID));
-	OUT(out, &buf[sizeof(TSS_UUID)], sizeof(TSS_UUID));
-
-	pub_data_size = *(UINT16 *)&buf[(2 * sizeof(TSS_UUID))];
-	blob_size = *(UINT16 *)&buf[(2 * sizeof(TSS_UUID)) + sizeof(UINT16)];
-	cache_flags = *(UINT16 *)&buf[2*sizeof(TSS_UUID) + 2*sizeof(UINT16)];
-
-	OUT(out, &pub_data_size, sizeof(UINT16));
-	OUT(out, &blob_size, sizeof(UINT16));
-	OUT(out, &vendor_data_size, sizeof(UINT32));
-	OUT(out, &cache_flags, sizeof(UINT16));
-
-	/* trash buf, we've got what we needed from it */
-	if ((members = fread(buf, pub_data_size + blob_size,
-			1, in)) != 1) {
-		PRINTERR("fread: %s: %d members read\n", strerror(errno), members);
+	UINT32 size = key->pub_data_size + key->blob_size + key->vendor_data_size;
+
+	if ((key->data = malloc(size ? size : 1)) == NULL) {
+		PRINTERR("malloc of %u bytes failed\n", size);
 		return -1;
 	}
 
-	OUT(out, buf, pub_data_size);
-	OUT(out, &buf[pub_data_size], blob_size);
+	if (size)
+		IN(in, key->data, size);
 
 	return 0;
 }
 
+/* Read the keys of a version 0 or 1 file, positioned just past the number of keys */
 int
-version_0_convert(FILE *in, FILE *out)
+read_keys_01(FILE *in, int version, UINT32 num_keys, struct ps_key **ret)
 {
-	int rc, members = 0;
+	struct ps_key *keys;
 	UINT32 i;
-	UINT32 *u32 = (UINT32 *) &buf;
+
+	if ((keys = calloc(num_keys ? num_keys : 1, sizeof(struct ps_key))) == NULL) {
+		PRINTERR("malloc of %zd bytes failed\n", num_keys * sizeof(struct ps_key));
+		return -1;
+	}
+	*ret = keys;
+
+	for (i = 0; i < num_keys; i++) {
+		IN(in, &keys[i].uuid, sizeof(TSS_UUID));
+		IN(in, &keys[i].parent_uuid, sizeof(TSS_UUID));
+		IN(in, &keys[i].pub_data_size, sizeof(UINT16));
+		IN(in, &keys[i].blob_size, sizeof(UINT16));
+		if (version == 1)
+			IN(in, &keys[i].vendor_data_size, sizeof(UINT32));
+		IN(in, &keys[i].cache_flags, sizeof(UINT16));
+
+		if (read_key_data(in, &keys[i]))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Read the valid keys of a version 2 file, in file order */
+int
+read_keys_2(FILE *in, UINT32 *num_keys, struct ps_key **ret)
+{
+	BYTE hdr[PS2_HDR_SIZE], rec[PS2_REC_HDR_SIZE];
+	struct ps_key *keys;
+	UINT32 num_buckets, end, offset, rec_size, n = 0, max;
+
+	rewind(in);
+	IN(in, hdr, sizeof(hdr));
+
+	memcpy(&max, &hdr[8], sizeof(UINT32));
+	memcpy(&num_buckets, &hdr[12], sizeof(UINT32));
+	memcpy(&end, &hdr[24], sizeof(UINT32));
+
+	if ((keys = calloc(max ? max : 1, sizeof(struct ps_key))) == NULL) {
+		PRINTERR("malloc of %zd bytes failed\n", max * sizeof(struct ps_key));
+		return -1;
+	}
+	*ret = keys;
+	*num_keys = 0;
+
+	for (offset = PS2_HDR_SIZE + 2 * num_buckets * sizeof(UINT32); offset < end;
+	     offset += rec_size) {
+		if (fseek(in, offset, SEEK_SET)) {
+			PRINTERR("fseek: %s\n", strerror(errno));
+			return -1;
+		}
+
+		IN(in, rec, sizeof(rec));
+		memcpy(&rec_size, &rec[52], sizeof(UINT32));
+		if (rec_size < PS2_REC_HDR_SIZE) {
+			PRINTERR("Corrupt record at offset %u\n", offset);
+			return -1;
+		}
+
+		memcpy(&keys[n].cache_flags, &rec[64], sizeof(UINT16));
+		if (!(keys[n].cache_flags & CACHE_FLAG_VALID))
+			continue;
+
+		if (n == max) {
+			PRINTERR("More valid keys than the header says\n");
+			return -1;
+		}
+
+		memcpy(&keys[n].uuid, &rec[0], sizeof(TSS_UUID));
+		memcpy(&keys[n].parent_uuid, &rec[16], sizeof(TSS_UUID));
+		memcpy(&keys[n].vendor_data_size, &rec[56], sizeof(UINT32));
+		memcpy(&keys[n].pub_data_size, &rec[60], sizeof(UINT16));
+		memcpy(&keys[n].blob_size, &rec[62], sizeof(UINT16));
+
+		if (read_key_data(in, &keys[n]))
+			return -1;
+
+		*num_keys = ++n;
+	}
+
+	return 0;
+}
+
+int
+write_keys_1(FILE *out, struct ps_key *keys, UINT32 num_keys)
+{
+	UINT32 i, size;
+	TSS_UUID SRK_UUID = TSS_UUID_SRK;
+	struct ps_key tmp;
+
+	/* version 1 readers expect the SRK to be the first key in the file */
+	for (i = 1; i < num_keys; i++) {
+		if (!memcmp(&keys[i].uuid, &SRK_UUID, sizeof(TSS_UUID))) {
+			tmp = keys[0];
+			keys[0] = keys[i];
+			keys[i] = tmp;
+			break;
+		}
+	}
 
 	/* output the PS version */
 	OUT(out, "\1", 1);
 
 	/* number of keys */
-	OUT(out, u32, sizeof(UINT32));
+	OUT(out, &num_keys, sizeof(UINT32));
+
+	for (i = 0; i < num_keys; i++) {
+		OUT(out, &keys[i].uuid, sizeof(TSS_UUID));
+		OUT(out, &keys[i].parent_uuid, sizeof(TSS_UUID));
+		OUT(out, &keys[i].pub_data_size, sizeof(UINT16));
+		OUT(out, &keys[i].blob_size, sizeof(UINT16));
+		OUT(out, &keys[i].vendor_data_size, sizeof(UINT32));
+		OUT(out, &keys[i].cache_flags, sizeof(UINT16));
+
+		size = keys[i].pub_data_size + keys[i].blob_size + keys[i].vendor_data_size;
+		if (size)
+			OUT(out, keys[i].data, size);
+	}
 
-	/* The +- 1's below account for the byte we read in to determine
-	 * if the PS file had a version byte at the beginning */
+	return 0;
+}
 
-	/* align the beginning of the buffer with the beginning of the key */
-	memcpy(buf, &buf[4], sizeof(TSS_UUID) + 1);
+/* must match psfile_uuid_bucket() in the tcsd */
+UINT32
+uuid_bucket(TSS_UUID *uuid, UINT32 num_buckets)
+{
+	BYTE *p = (BYTE *)uuid;
+	UINT32 i, h = 2166136261U;
 
-	/* read in the rest of the first key's header */
-	if ((members = fread(&buf[sizeof(TSS_UUID) + 1],
-			sizeof(TSS_UUID) + (3 * sizeof(UINT16)) - 1,
-			1, in)) != 1) {
-		PRINTERR("fread: %s\n", strerror(errno));
+	for (i = 0; i < sizeof(TSS_UUID); i++) {
+		h ^= p[i];
+		h *= 16777619;
+	}
+
+	return h & (num_buckets - 1);
+}
+
+int
+write_keys_2(FILE *out, struct ps_key *keys, UINT32 num_keys)
+{
+	BYTE hdr[PS2_HDR_SIZE], rec[PS2_REC_HDR_SIZE], digest[20];
+	UINT32 *index, num_buckets = PS2_MIN_BUCKETS, offset, size, b, i, u32;
+	TSS_RESULT result;
+
+	while (num_buckets < 2 * num_keys)
+		num_buckets *= 2;
+
+	if ((index = calloc(2 * num_buckets, sizeof(UINT32))) == NULL) {
+		PRINTERR("malloc of %zd bytes failed\n", 2 * num_buckets * sizeof(UINT32));
 		return -1;
 	}
 
-	if (convertkey_0(in, out)) {
-		PRINTERR("printkey_0 failed.\n");
+	/* leave room for the header and index, they're written once the chains are known */
+	offset = PS2_HDR_SIZE + 2 * num_buckets * sizeof(UINT32);
+	if (fseek(out, offset, SEEK_SET)) {
+		PRINTERR("fseek: %s\n", strerror(errno));
+		free(index);
 		return -1;
 	}
 
-	for (i = 1; i < *u32; i++) {
-		/* read in subsequent key's headers */
-		if ((members = fread(buf, 2*sizeof(TSS_UUID) + 3*sizeof(UINT16),
-					1, in)) != 1) {
-			PRINTERR("fread: %s\n", strerror(errno));
+	for (i = 0; i < num_keys; i++) {
+		size = keys[i].pub_data_size + keys[i].blob_size + keys[i].vendor_data_size;
+
+		if ((result = Trspi_Hash(TSS_HASH_SHA1, keys[i].pub_data_size, keys[i].data,
+					 digest))) {
+			PRINTERR("Trspi_Hash failed: %s\n", Trspi_Error_String(result));
+			free(index);
+			return -1;
+		}
+
+		memset(rec, 0, sizeof(rec));
+		memcpy(&rec[0], &keys[i].uuid, sizeof(TSS_UUID));
+		memcpy(&rec[16], &keys[i].parent_uuid, sizeof(TSS_UUID));
+		memcpy(&rec[32], digest, sizeof(digest));
+		u32 = PS2_REC_HDR_SIZE + size;
+		memcpy(&rec[52], &u32, sizeof(UINT32));
+		memcpy(&rec[56], &keys[i].vendor_data_size, sizeof(UINT32));
+		memcpy(&rec[60], &keys[i].pub_data_size, sizeof(UINT16));
+		memcpy(&rec[62], &keys[i].blob_size, sizeof(UINT16));
+		memcpy(&rec[64], &keys[i].cache_flags, sizeof(UINT16));
+
+		b = uuid_bucket(&keys[i].uuid, num_buckets);
+		memcpy(&rec[68], &index[b], sizeof(UINT32));
+		index[b] = offset;
+
+		b = num_buckets + ((digest[0] | (digest[1] << 8) | (digest[2] << 16) |
+				   ((UINT32)digest[3] << 24)) & (num_buckets - 1));
+		memcpy(&rec[72], &index[b], sizeof(UINT32));
+		index[b] = offset;
+
+		if (fwrite(rec, sizeof(rec), 1, out) != 1 ||
+		    (size && fwrite(keys[i].data, size, 1, out) != 1)) {
+			PRINTERR("fwrite error: %s\n", strerror(errno));
+			free(index);
 			return -1;
 		}
 
-		if ((rc = convertkey_0(in, out)))
-			return rc;
+		offset += PS2_REC_HDR_SIZE + size;
 	}
 
+	memset(hdr, 0, sizeof(hdr));
+	hdr[0] = 2;
+	memcpy(&hdr[1], PS2_MAGIC, sizeof(PS2_MAGIC));
+	memcpy(&hdr[8], &num_keys, sizeof(UINT32));
+	memcpy(&hdr[12], &num_buckets, sizeof(UINT32));
+	memcpy(&hdr[24], &offset, sizeof(UINT32));
+
+	rewind(out);
+	if (fwrite(hdr, sizeof(hdr), 1, out) != 1 ||
+	    fwrite(index, 2 * num_buckets * sizeof(UINT32), 1, out) != 1) {
+		PRINTERR("fwrite error: %s\n", strerror(errno));
+		free(index);
+		return -1;
+	}
+
+	free(index);
 	return 0;
 }
 
 int
-inspect(char *filename, FILE *in)
+inspect(char *filename, FILE *in, int to_version)
 {
-	int members = 0, rc, namelen;
+	unsigned char buf[sizeof(TSS_UUID) + sizeof(UINT32) + 8];
+	int rc, namelen, version;
 	FILE *out = NULL;
 	char outfile[256];
-	UINT32 *num_keys;
+	UINT32 num_keys;
+	struct ps_key *keys = NULL;
 	TSS_UUID SRK_UUID = TSS_UUID_SRK;
 
 	/* do the initial read, which should include sizeof(TSS_UUID)
 	 * + sizeof(UINT32) + 1 bytes */
-	if ((members = fread(buf,
-			sizeof(TSS_UUID) + sizeof(UINT32) + 1,
-			1, in)) != 1) {
+	if (fread(buf, sizeof(TSS_UUID) + sizeof(UINT32) + 1, 1, in) != 1) {
 		PRINTERR("fread: %s\n", strerror(errno));
 		return -1;
 	}
 
-	if (buf[0] == '\1') {
-		num_keys = (UINT32 *)&buf[1];
-		if (*num_keys == 0)
-			goto version0;
-
-		if (memcmp(&buf[5], &SRK_UUID, sizeof(TSS_UUID)))
-			goto version0;
-
-		printf("%s is already up to date.\n", filename);
+	if (buf[0] == '\2' && !memcmp(&buf[1], PS2_MAGIC, sizeof(PS2_MAGIC))) {
+		version = 2;
+	} else if (buf[0] == '\1' && !memcmp(&buf[5], &SRK_UUID, sizeof(TSS_UUID))) {
+		memcpy(&num_keys, &buf[1], sizeof(UINT32));
+		version = num_keys ? 1 : 0;
+	} else
+		version = 0;
 
+	if (version == 0 && memcmp(&buf[4], &SRK_UUID, sizeof(TSS_UUID))) {
+		printf("This file does not appear to be a valid PS file.\n");
 		return -2;
 	}
 
-version0:
-	if (memcmp(&buf[4], &SRK_UUID, sizeof(TSS_UUID))) {
-		printf("This file does not appear to be a valid PS file.\n");
+	if (version == to_version) {
+		printf("%s is already a version %d PS file.\n", filename, version);
 		return -2;
 	}
 
-	printf("%s appears to be a version 0 PS file. Updating to version 1... ",
-			filename);
+	printf("%s appears to be a version %d PS file. Converting to version %d... ",
+			filename, version, to_version);
+
+	if (version == 2) {
+		rc = read_keys_2(in, &num_keys, &keys);
+	} else {
+		/* the keys start just after the number of keys */
+		if (fseek(in, version == 1 ? 1 + sizeof(UINT32) : sizeof(UINT32), SEEK_SET)) {
+			PRINTERR("fseek: %s\n", strerror(errno));
+			return -1;
+		}
+		memcpy(&num_keys, &buf[version == 1 ? 1 : 0], sizeof(UINT32));
+		rc = read_keys_01(in, version, num_keys, &keys);
+	}
+	if (rc)
+		goto done;
 
 	namelen = strlen(filename);
+	if (namelen + 5 > (int)sizeof(outfile)) {
+		PRINTERR("%s: file name too long\n", filename);
+		rc = -1;
+		goto done;
+	}
 	memcpy(outfile, filename, namelen);
 	memcpy(&outfile[namelen], ".new", 5);
 
 	if ((out = fopen(outfile, "w+")) == NULL) {
 		PRINTERR("fopen(%s, \"w+\"): %s\n", outfile, strerror(errno));
-		return -1;
+		rc = -1;
+		goto done;
 	}
 
-	rc = version_0_convert(in, out);
+	if (to_version == 2)
+		rc = write_keys_2(out, keys, num_keys);
+	else
+		rc = write_keys_1(out, keys, num_keys);
 
 	fclose(out);
+done:
+	if (keys)
+		free_keys(keys, num_keys);
 
 	return rc;
 }
@@ -239,17 +493,29 @@ int
 main(int argc, char ** argv)
 {
 	FILE *in = NULL;
-	int rc;
+	int rc, c, to_version = PS_VERSION_LATEST;
+
+	while ((c = getopt(argc, argv, "v:")) != -1) {
+		switch (c) {
+			case 'v':
+				to_version = atoi(optarg);
+				if (to_version < 1 || to_version > PS_VERSION_LATEST)
+					usage(argv[0]);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
 
-	if (argc != 2)
+	if (optind != argc - 1)
 		usage(argv[0]);
 
-	if ((in = fopen(argv[1], "r")) == NULL) {
-		PRINTERR("fopen(%s, \"r\"): %s\n", argv[1], strerror(errno));
+	if ((in = fopen(argv[optind], "r")) == NULL) {
+		PRINTERR("fopen(%s, \"r\"): %s\n", argv[optind], strerror(errno));
 		return -1;
 	}
 
-	if ((rc = inspect(argv[1], in)) == 0) {
+	if ((rc = inspect(argv[optind], in, to_version)) == 0) {
 		printf("Success.\n");
 	} else if (rc != -2) {
 		printf("Failure.\n");
@@ -52,6 +52,24 @@
  * [BYTE[]   vendor_data0           ]
  * [...]
  *
+ * C) system PS only, see src/include/tcsps.h
+ *
+ * [BYTE     TrouSerS PS version='2'   ]
+ * [BYTE[7]  magic="TSS-PS"            ]
+ * [UINT32   num_keys_on_disk          ]
+ * [UINT32   num_buckets               ]
+ * [UINT32   generation                ]
+ * [UINT32   free_list_head            ]
+ * [UINT32   end_of_records            ]
+ * [UINT32   reserved                  ]
+ * [UINT32[] uuid_index[num_buckets]   ]
+ * [UINT32[] pub_index[num_buckets]    ]
+ * [80 byte record header0             ]
+ * [BYTE[]   pub_data0                 ]
+ * [BYTE[]   blob0                     ]
+ * [BYTE[]   vendor_data0              ]
+ * [...]
+ *
  */
 
 
@@ -265,6 +283,98 @@ version_1_print(FILE *f)
 	return 0;
 }
 
+int
+version_2_print(FILE *f)
+{
+	UINT32 num_keys, num_buckets, generation, free_head, end, offset, rec_size;
+	UINT32 vendor_data_size, next_uuid, next_pub, i = 0;
+	UINT16 pub_data_size, blob_size, cache_flags;
+
+	/* re-read the whole header */
+	if (fseek(f, 0, SEEK_SET) || fread(buf, 32, 1, f) != 1) {
+		PRINTERR("fread: %s\n", strerror(errno));
+		return -1;
+	}
+
+	num_keys = *(UINT32 *)&buf[8];
+	num_buckets = *(UINT32 *)&buf[12];
+	generation = *(UINT32 *)&buf[16];
+	free_head = *(UINT32 *)&buf[20];
+	end = *(UINT32 *)&buf[24];
+
+	PRINT("version:        2\n");
+	PRINT("number of keys: %u\n", num_keys);
+	PRINT("index buckets:  %u\n", num_buckets);
+	PRINT("generation:     %u\n", generation);
+	PRINT("free list head: %u\n", free_head);
+	PRINT("end of records: %u\n", end);
+
+	for (offset = 32 + 2 * num_buckets * sizeof(UINT32); offset < end; offset += rec_size) {
+		if (fseek(f, offset, SEEK_SET) || fread(buf, 80, 1, f) != 1) {
+			PRINTERR("fread: %s\n", strerror(errno));
+			return -1;
+		}
+
+		rec_size = *(UINT32 *)&buf[52];
+		vendor_data_size = *(UINT32 *)&buf[56];
+		pub_data_size = *(UINT16 *)&buf[60];
+		blob_size = *(UINT16 *)&buf[62];
+		cache_flags = *(UINT16 *)&buf[64];
+		next_uuid = *(UINT32 *)&buf[68];
+		next_pub = *(UINT32 *)&buf[72];
+
+		if (rec_size < 80) {
+			PRINTERR("bad record size %u at offset %u\n", rec_size, offset);
+			return -1;
+		}
+
+		PRINT("record at offset %u (%u bytes)%s\n", offset, rec_size,
+		      (cache_flags & 0x1) ? "" : ", free");
+		if (!(cache_flags & 0x1))
+			continue;
+
+		PRINT("uuid%u: ", i);
+		print_hex(buf, sizeof(TSS_UUID));
+
+		PRINT("parent uuid%u: ", i);
+		print_hex(&buf[sizeof(TSS_UUID)], sizeof(TSS_UUID));
+
+		PRINT("pub_data digest%u: ", i);
+		print_hex(&buf[2 * sizeof(TSS_UUID)], 20);
+
+		PRINT("pub_data_size%u: %hu\n", i, pub_data_size);
+		PRINT("blob_size%u: %hu\n", i, blob_size);
+		PRINT("vendor_data_size%u: %u\n", i, vendor_data_size);
+		PRINT("cache_flags%u: %02hx\n", i, cache_flags);
+		PRINT("next in uuid chain%u: %u\n", i, next_uuid);
+		PRINT("next in pub chain%u: %u\n", i, next_pub);
+
+		if ((UINT32)pub_data_size + blob_size + vendor_data_size > sizeof(buf)) {
+			PRINTERR("key data too large to print\n");
+			return -1;
+		}
+
+		if (fread(buf, pub_data_size + blob_size + vendor_data_size, 1, f) != 1) {
+			PRINTERR("fread: %s\n", strerror(errno));
+			return -1;
+		}
+
+		PRINT("pub_data%u:\n", i);
+		print_hex(buf, pub_data_size);
+
+		PRINT("blob%u:\n", i);
+		print_hex(&buf[pub_data_size], blob_size);
+
+		PRINT("vendor_data%u:\n", i);
+		if (vendor_data_size > 0)
+			print_hex(&buf[pub_data_size + blob_size], vendor_data_size);
+
+		i++;
+	}
+
+	return 0;
+}
+
 /* the smallest key on disk should be around 360 bytes total
  * and the largest should be about 560 bytes, so if the number
  * of keys is not in this ballpark, this is probably not a PS
@@ -297,6 +407,9 @@ inspect(FILE *f, off_t file_size)
 		return -1;
 	}
 
+	if (buf[0] == '\2' && !memcmp(&buf[1], "TSS-PS", 7))
+		return version_2_print(f);
+
 	if (buf[0] == '\1') {
 		num_keys = (UINT32 *)&buf[1];
 		if (*num_keys == 0 || bad_file_size(*num_keys, file_size))